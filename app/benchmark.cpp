@@ -0,0 +1,377 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "benchmark.hpp"
+
+#include <unistd.h>
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include <pdal/PointTable.hpp>
+#include <pdal/PointView.hpp>
+#include <pdal/io/BufferReader.hpp>
+#include <pdal/io/LasWriter.hpp>
+
+#include <entwine/builder/builder.hpp>
+#include <entwine/builder/chunk-cache.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/util/config.hpp>
+#include <entwine/util/fs.hpp>
+#include <entwine/util/info.hpp>
+#include <entwine/util/metrics.hpp>
+#include <entwine/util/pdal-mutex.hpp>
+#include <entwine/util/synthetic.hpp>
+#include <entwine/util/time.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+namespace
+{
+
+const Bounds bounds(0, 0, 0, 100000, 100000, 1000);
+
+uint64_t getPoints(const json& j)
+{
+    return j.value<uint64_t>("points", 10000000);
+}
+uint64_t getFiles(const json& j) { return j.value<uint64_t>("files", 8); }
+uint64_t getSeed(const json& j) { return j.value<uint64_t>("seed", 0); }
+std::string getDistribution(const json& j)
+{
+    return j.value("distribution", "uniform");
+}
+
+double seconds(const TimePoint start)
+{
+    return since<std::chrono::milliseconds>(start) / 1000.0;
+}
+
+} // unnamed namespace
+
+void Benchmark::addArgs()
+{
+    m_ap.setUsage("entwine benchmark (<options>)");
+
+    m_ap.add(
+            "--points",
+            "-n",
+            "Total number of synthetic points to generate (default: "
+            "10000000).\n"
+            "Example: --points 100000000",
+            [this](json j) { m_json["benchmark"]["points"] = extract(j); });
+
+    m_ap.add(
+            "--distribution",
+            "Distribution of the synthetic points.  Valid values are "
+            "\"uniform\", \"clustered\", \"terrain\", or \"strips\".  "
+            "Default: \"uniform\".\n"
+            "Example: --distribution terrain",
+            [this](json j) { m_json["benchmark"]["distribution"] = j; });
+
+    m_ap.add(
+            "--files",
+            "Number of input files, each covering a tile of the bounds, "
+            "among which the points are divided (default: 8).\n"
+            "Example: --files 64",
+            [this](json j) { m_json["benchmark"]["files"] = extract(j); });
+
+    m_ap.add(
+            "--seed",
+            "Seed for point generation, so runs are repeatable (default: 0).\n"
+            "Example: --seed 42",
+            [this](json j) { m_json["benchmark"]["seed"] = extract(j); });
+
+    addOutput(
+            "Output directory for the build.  If omitted, the build is "
+            "written beneath the temporary directory and removed afterward.\n"
+            "Example: --output ~/entwine/benchmark");
+
+    m_ap.add(
+            "--report",
+            "If provided, the results are also written to this path as "
+            "JSON.\n"
+            "Example: --report results.json",
+            [this](json j) { m_json["benchmark"]["report"] = j; });
+
+    addConfig();
+    addTmp();
+
+    m_ap.add(
+            "--threads",
+            "-t",
+            "The number of threads, which may be split between work and "
+            "clip threads as for `entwine build`.\n"
+            "Example: --threads 12, --threads [8, 4]",
+            [this](json j)
+            {
+                m_json["threads"] = json::parse(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--dataType",
+            "Data type for serialized point cloud data.  Valid values are "
+            "\"laszip\", \"zstandard\", \"binary\", or \"columnar\".  "
+            "Default: \"laszip\".\n"
+            "Example: --dataType binary",
+            [this](json j) { m_json["dataType"] = j; });
+
+    m_ap.add(
+            "--span",
+            "Number of voxels in each spatial dimension for data nodes.  "
+            "Default: 256.\n"
+            "Example: --span 128",
+            [this](json j) { m_json["span"] = extract(j); });
+
+    m_ap.add(
+            "--latency",
+            "Write the build through simulated remote storage which adds "
+            "this many milliseconds to every request.  See `simulate` in the "
+            "configuration documentation.\n"
+            "Example: --latency 40",
+            [this](json j)
+            {
+                m_json["simulate"]["latency"] = std::stod(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--bandwidth",
+            "Write the build through simulated remote storage whose "
+            "transfers share this many megabytes per second.\n"
+            "Example: --bandwidth 100",
+            [this](json j)
+            {
+                m_json["simulate"]["bandwidth"] =
+                    std::stod(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--failureRate",
+            "Write the build through simulated remote storage whose requests "
+            "fail with this probability.\n"
+            "Example: --failureRate 0.01",
+            [this](json j)
+            {
+                m_json["simulate"]["failureRate"] =
+                    std::stod(j.get<std::string>());
+            });
+
+    addArbiter();
+}
+
+StringList Benchmark::generate(const std::string& dir) const
+{
+    const json b(m_json.value("benchmark", json::object()));
+    const uint64_t points(getPoints(b));
+    const uint64_t files(std::max<uint64_t>(getFiles(b), 1));
+    const synthetic::Distribution distribution(
+        synthetic::toDistribution(getDistribution(b)));
+
+    // Files are laid out as the tiles of a grid covering our bounds.
+    const uint64_t cols(std::ceil(std::sqrt(files)));
+    const uint64_t rows((files + cols - 1) / cols);
+    const Point& min(bounds.min());
+    const Point tile(
+        (bounds.max().x - min.x) / cols,
+        (bounds.max().y - min.y) / rows,
+        bounds.max().z - min.z);
+
+    StringList paths;
+    for (uint64_t i(0); i < files; ++i)
+    {
+        const Point tileMin(
+            min.x + (i % cols) * tile.x,
+            min.y + (i / cols) * tile.y,
+            min.z);
+        const uint64_t count(points / files + (i < points % files ? 1 : 0));
+
+        const std::vector<Point> generated(
+            synthetic::generate(
+                distribution,
+                count,
+                Bounds(tileMin, tileMin + tile),
+                getSeed(b) + i));
+
+        pdal::PointTable table;
+        pdal::PointLayoutPtr layout(table.layout());
+        layout->registerDim(DimId::X);
+        layout->registerDim(DimId::Y);
+        layout->registerDim(DimId::Z);
+        layout->registerDim(DimId::Intensity);
+        layout->registerDim(DimId::Classification);
+        layout->registerDim(DimId::GpsTime);
+
+        auto view(std::make_shared<pdal::PointView>(table));
+        for (uint64_t id(0); id < generated.size(); ++id)
+        {
+            const Point& p(generated[id]);
+            view->setField(DimId::X, id, p.x);
+            view->setField(DimId::Y, id, p.y);
+            view->setField(DimId::Z, id, p.z);
+            view->setField(DimId::Intensity, id, (id * 7919) % 4096);
+            view->setField(DimId::Classification, id, p.z < 300 ? 2 : 1);
+            view->setField(DimId::GpsTime, id, id * 0.0001);
+        }
+
+        pdal::BufferReader reader;
+        reader.addView(view);
+
+        const std::string path(
+            arbiter::join(dir, std::to_string(i) + ".las"));
+
+        pdal::Options options;
+        options.add("filename", path);
+        options.add("minor_version", 2);
+        options.add("dataformat_id", 1);
+        options.add("scale_x", 0.01);
+        options.add("scale_y", 0.01);
+        options.add("scale_z", 0.01);
+        options.add("offset_x", bounds.mid().x);
+        options.add("offset_y", bounds.mid().y);
+        options.add("offset_z", bounds.mid().z);
+
+        pdal::LasWriter writer;
+        writer.setOptions(options);
+        writer.setInput(reader);
+
+        {
+            std::lock_guard<std::mutex> lock(PdalMutex::get());
+            writer.prepare(table);
+        }
+        writer.execute(table);
+
+        paths.push_back(path);
+    }
+
+    return paths;
+}
+
+void Benchmark::run()
+{
+    const json b(m_json.value("benchmark", json::object()));
+    json config(m_json);
+    config.erase("benchmark");
+
+    const std::string tmp(config::getTmp(config));
+    const std::string root(
+        arbiter::join(tmp, "entwine-benchmark-" + std::to_string(::getpid())));
+    const std::string inputDir(arbiter::join(root, "input"));
+    arbiter::mkdirp(inputDir);
+
+    // Without an output, a simulation applies to the one we choose.
+    const bool keep(config.count("output"));
+    const std::string scheme(config.count("simulate") ? "sim://" : "");
+    if (!keep) config["output"] = scheme + arbiter::join(root, "output");
+    config["force"] = true;
+
+    std::cout << "Generating " << commify(getPoints(b)) << " " <<
+        getDistribution(b) << " points in " << getFiles(b) <<
+        " files" << std::endl;
+
+    auto start(now());
+    config["input"] = generate(inputDir);
+    const double generateTime(seconds(start));
+
+    const Endpoints endpoints = config::getEndpoints(config);
+
+    std::cout << "Analyzing" << std::endl;
+    start = now();
+    Manifest manifest;
+    const SourceList sources = analyze(
+        config::getInput(config),
+        config::getPipeline(config),
+        config::getDeep(config),
+        tmp,
+        *endpoints.arbiter,
+        config::getThreads(config),
+        "",
+        config::getIoThreads(config));
+    for (const auto& source : sources)
+    {
+        if (source.info.points) manifest.emplace_back(source);
+    }
+    config = merge(
+        manifest::reduce(sources, config::getThreads(config)),
+        config);
+    const double analyzeTime(seconds(start));
+
+    const Metadata metadata = config::getMetadata(config);
+    Builder builder(endpoints, metadata, std::move(manifest));
+
+    std::cout << "Building" << std::endl;
+    ChunkCache::latchInfo();
+    start = now();
+    const Threads threads(config::getCompoundThreads(config));
+    const uint64_t inserted = builder.run(
+        threads,
+        0,
+        config::getProgressInterval(config));
+    const double buildTime(seconds(start));
+    const ChunkCache::Info info(ChunkCache::latchInfo());
+
+    uint64_t bytes(0);
+    const std::string output(config::getOutput(config));
+    for (const std::string& f : endpoints.arbiter->resolve(output + "/**"))
+    {
+        if (const auto size = endpoints.arbiter->tryGetSize(f)) bytes += *size;
+    }
+
+    const json results {
+        { "points", inserted },
+        { "distribution", getDistribution(b) },
+        { "files", getFiles(b) },
+        { "seed", getSeed(b) },
+        { "threads", {
+            { "work", threads.work },
+            { "clip", threads.clip }
+        } },
+        { "dataType", metadata.dataType },
+        { "span", metadata.span },
+        { "simulate", config.value("simulate", json()) },
+        { "phases", {
+            { "generate", generateTime },
+            { "analyze", analyzeTime },
+            { "build", buildTime }
+        } },
+        { "pointsPerSecond", buildTime > 0 ? inserted / buildTime : 0 },
+        { "peakRss", metrics::peakRss() },
+        { "bytesWritten", bytes },
+        { "chunksWritten", info.written },
+        { "chunkReads", info.read },
+        { "chunkBytesWritten", info.bytesWritten },
+        { "chunkBytesRead", info.bytesRead },
+        { "chunkEvictions", info.evictions },
+        { "chunkReclaims", info.reclaims },
+        { "metrics", metrics::get() }
+    };
+
+    std::cout << std::endl << "Results:\n" << results.dump(2) << std::endl;
+
+    if (b.count("report"))
+    {
+        endpoints.arbiter->put(
+            b.at("report").get<std::string>(),
+            results.dump(2));
+    }
+
+    removeTree(inputDir, *endpoints.arbiter);
+    // A simulated output is removed directly, since it is local.
+    if (!keep) removeTree(arbiter::stripProtocol(output), *endpoints.arbiter);
+    arbiter::remove(root);
+}
+
+} // namespace app
+} // namespace entwine
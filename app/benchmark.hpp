@@ -0,0 +1,32 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include "entwine.hpp"
+
+namespace entwine
+{
+namespace app
+{
+
+class Benchmark : public App
+{
+private:
+    virtual void addArgs() override;
+    virtual void run() override;
+
+    // Write synthetic input files to this directory, returning their paths.
+    StringList generate(const std::string& dir) const;
+};
+
+} // namespace app
+} // namespace entwine
+
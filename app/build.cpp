@@ -10,14 +10,33 @@
 
 #include "build.hpp"
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <thread>
+
 #include <entwine/builder/builder.hpp>
+#include <entwine/builder/checkpoint.hpp>
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/builder/hierarchy.hpp>
+#include <entwine/builder/lease.hpp>
+#include <entwine/builder/profile.hpp>
+#include <entwine/builder/scheduler.hpp>
+#include <entwine/io/io.hpp>
 #include <entwine/types/exceptions.hpp>
 #include <entwine/types/metadata.hpp>
+#include <entwine/util/access-trace.hpp>
 #include <entwine/util/config.hpp>
 #include <entwine/util/fs.hpp>
 #include <entwine/util/info.hpp>
+#include <entwine/util/io.hpp>
+#include <entwine/util/metrics.hpp>
+#include <entwine/util/perf.hpp>
+#include <entwine/util/sweep.hpp>
 #include <entwine/util/time.hpp>
+#include <entwine/util/trace.hpp>
 
 namespace entwine
 {
@@ -59,10 +78,18 @@ void Build::addArgs()
             "exist at this output location.",
             [this](json j) { checkEmpty(j); m_json["force"] = true; });
 
+    m_ap.add(
+            "--clean",
+            "With --force, remove the files of a previous build at this output "
+            "location which the new build does not overwrite, once it is "
+            "saved.",
+            [this](json j) { checkEmpty(j); m_json["clean"] = true; });
+
     m_ap.add(
             "--dataType",
             "Data type for serialized point cloud data.  Valid values are "
-            "\"laszip\", \"zstandard\", or \"binary\".  Default: \"laszip\".\n"
+            "\"laszip\", \"zstandard\", \"binary\", or \"columnar\".  "
+            "Default: \"laszip\".\n"
             "Example: --dataType binary",
             [this](json j) { m_json["dataType"] = j; });
 
@@ -84,6 +111,17 @@ void Build::addArgs()
                 m_json["allowOriginId"] = false;
             });
 
+    m_ap.add(
+            "--noPointId",
+            "If present, a PointId dimension tracking points to their "
+            "position within their original source files will *not* be "
+            "inserted.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["allowPointId"] = false;
+            });
+
     m_ap.add(
             "--bounds",
             "-b",
@@ -107,6 +145,9 @@ void Build::addArgs()
             });
 
     addDeep();
+    addScanCache();
+    addIoThreads();
+    addListingCache();
     addAbsolute();
 
     m_ap.add(
@@ -142,6 +183,13 @@ void Build::addArgs()
                 m_json["subset"]["of"] = of;
             });
 
+    m_ap.add(
+            "--subsetDataType",
+            "Data type of the nodes shared by every subset, which the merge "
+            "rewrites in the final data type.  Defaults to binary.\n"
+            "Example: --subsetDataType zstandard",
+            [this](json j) { m_json["subsetDataType"] = j; });
+
     m_ap.add(
             "--maxNodeSize",
             "Maximum number of points in a node before an overflow is "
@@ -166,6 +214,20 @@ void Build::addArgs()
             "entwine will determine it heuristically.",
             [this](json j) { m_json["hierarchyStep"] = extract(j); });
 
+    m_ap.add(
+            "--hierarchyPageSize",
+            "If set, split hierarchy files wherever a subtree exceeds this "
+            "many nodes, rather than at fixed depths.",
+            [this](json j) { m_json["hierarchyPageSize"] = extract(j); });
+
+    m_ap.add(
+            "--hierarchyMemory",
+            "Memory budget in bytes for hierarchy nodes during the build, "
+            "beyond which deeper nodes are spilled to the temporary "
+            "directory (default: 0).\n"
+            "Example: --hierarchyMemory 4000000000",
+            [this](json j) { m_json["hierarchyMemory"] = extract(j); });
+
     m_ap.add(
             "--sleepCount",
             "Count (per-thread) after which idle nodes are serialized.",
@@ -177,56 +239,790 @@ void Build::addArgs()
             "logging (default: 10).",
             [this](json j) { m_json["progressInterval"] = extract(j); });
 
+    m_ap.add(
+            "--insertThreads",
+            "Number of dedicated insertion threads per work thread.  If "
+            "non-zero, work threads only read and decode their input files "
+            "while these threads perform tree insertion (default: 0).\n"
+            "Example: --insertThreads 2",
+            [this](json j) { m_json["insertThreads"] = extract(j); });
+
+    m_ap.add(
+            "--splitPoints",
+            "If non-zero, LAS/LAZ files containing more than this many points "
+            "are split into ranges of this size which are inserted in "
+            "parallel by separate work threads (default: 0).\n"
+            "Example: --splitPoints 10000000",
+            [this](json j) { m_json["splitPoints"] = extract(j); });
+
+    m_ap.add(
+            "--sample",
+            "Read and insert only about this fraction of the points of each "
+            "input file, for a quick preview of a build.\n"
+            "Example: --sample 0.01",
+            [this](json j)
+            {
+                m_json["sample"] = std::stod(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--order",
+            "Order in which input files are scheduled: \"manifest\", "
+            "\"spatial\" to insert neighboring files together, or "
+            "\"largest\" to insert the largest files first "
+            "(default: manifest).\n"
+            "Example: --order spatial",
+            [this](json j) { m_json["order"] = extract(j); });
+
+    m_ap.add(
+            "--memory",
+            "Memory budget in bytes for resident point data.  When reached, "
+            "idle nodes are serialized more aggressively (default: 0, "
+            "meaning no budget).\n"
+            "Example: --memory 8000000000",
+            [this](json j) { m_json["memory"] = extract(j); });
+
+    m_ap.add(
+            "--spill",
+            "While over the memory budget, spill large overflows to the "
+            "temporary directory rather than holding them in memory.",
+            [this](json j) { checkEmpty(j); m_json["spill"] = true; });
+
+    m_ap.add(
+            "--prefetch",
+            "Number of remote input files to download in the background "
+            "ahead of the work threads (default: 0).\n"
+            "Example: --prefetch 4",
+            [this](json j) { m_json["prefetch"] = extract(j); });
+
+    m_ap.add(
+            "--rangeReads",
+            "Fetch remote uncompressed LAS files in ranges of points using "
+            "ranged reads, rather than downloading them entirely.",
+            [this](json j) { checkEmpty(j); m_json["rangeReads"] = true; });
+
+    m_ap.add(
+            "--compact",
+            "Hold point coordinates in memory as scaled 32-bit integers "
+            "rather than doubles, if the output is scaled.",
+            [this](json j) { checkEmpty(j); m_json["compact"] = true; });
+
+    m_ap.add(
+            "--hugePages",
+            "Allocate point data from memory backed by transparent huge "
+            "pages, where supported.",
+            [this](json j) { checkEmpty(j); m_json["hugePages"] = true; });
+
+    m_ap.add(
+            "--zstdLevel",
+            "Compression level for the zstandard data type, trading CPU "
+            "time for output size (default: 3).\n"
+            "Example: --zstdLevel 19",
+            [this](json j)
+            {
+                m_json["zstdLevel"] =
+                    json::parse(j.get<std::string>()).get<int>();
+            });
+
+    m_ap.add(
+            "--dataTiers",
+            "Data types and zstandard levels of the nodes shallower than "
+            "given depths, as a JSON array.\n"
+            "Example: --dataTiers '[{ \"below\": 6, "
+            "\"dataType\": \"zstandard\", \"zstdLevel\": 19 }]'",
+            [this](json j)
+            {
+                m_json["dataTiers"] = json::parse(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--zstdThreads",
+            "Number of threads with which to compress large nodes for the "
+            "zstandard data type (default: 0).\n"
+            "Example: --zstdThreads 4",
+            [this](json j) { m_json["zstdThreads"] = extract(j); });
+
+    m_ap.add(
+            "--zstdDictionary",
+            "Maximum size in bytes of a dictionary trained from the first "
+            "small nodes of a zstandard build, with which later small nodes "
+            "are compressed (default: 0).\n"
+            "Example: --zstdDictionary 112640",
+            [this](json j) { m_json["zstdDictionary"] = extract(j); });
+
+    m_ap.add(
+            "--coordinate",
+            "Build the given number of subsets cooperatively with any other "
+            "workers coordinating on this output, claiming subsets via lease "
+            "files until all are built, and then merging them.\n"
+            "Example: --coordinate 16",
+            [this](json j) { m_json["coordinate"] = extract(j); });
+
+    m_ap.add(
+            "--jobs",
+            "Configuration files of builds to run together in this process, "
+            "whose inserts share a single pool of the given threads, and "
+            "whose chunks share a single memory budget, each build being "
+            "given an equal share of the threads as others finish.  Options "
+            "given here apply to every build, and are overridden by its "
+            "file.\n"
+            "Example: --jobs '[\"a.json\", \"b.json\"]' --threads 64",
+            [this](json j)
+            {
+                const std::string s(j.get<std::string>());
+                m_json["jobs"] = s.size() && s[0] == '[' ? json::parse(s) : j;
+            });
+
+    m_ap.add(
+            "--pointOrder",
+            "Order of the points within each node: \"morton\" for spatial "
+            "locality, \"progressive\" so that any prefix of a node is a "
+            "uniform subsample of it, or \"gpstime\" for time order, which "
+            "may improve compression.  By default points are not reordered, "
+            "except by GpsTime for laszip data.\n"
+            "Example: --pointOrder morton",
+            [this](json j) { m_json["pointOrder"] = extract(j); });
+
+    m_ap.add(
+            "--voxelPolicy",
+            "Which of two points contending for a voxel keeps it: \"closest\" "
+            "to its center (the default), \"first\" to arrive, which is "
+            "cheapest, \"maxz\", \"minz\", or \"random\".\n"
+            "Example: --voxelPolicy first",
+            [this](json j) { m_json["voxelPolicy"] = extract(j); });
+
+    m_ap.add(
+            "--maxDepth",
+            "If set, create nodes only at depths shallower than this, and "
+            "discard the points which lose their voxels at the deepest.\n"
+            "Example: --maxDepth 12",
+            [this](json j) { m_json["maxDepth"] = extract(j); });
+
+    m_ap.add(
+            "--minVoxelSize",
+            "If set, and maxDepth is not, limit the depth of the tree to that "
+            "whose voxels are at least this size, in the units of the "
+            "output.\n"
+            "Example: --minVoxelSize 0.01",
+            [this](json j)
+            {
+                m_json["minVoxelSize"] = std::stod(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--dedup",
+            "Drop points whose coordinates duplicate those of another point, "
+            "such as those of overlapping deliveries of the same data.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["dedup"] = true;
+            });
+
+    m_ap.add(
+            "--overflowThreads",
+            "If set, overflows which become nodes are pushed down by this "
+            "many background threads rather than by the inserting thread.\n"
+            "Example: --overflowThreads 2",
+            [this](json j) { m_json["overflowThreads"] = extract(j); });
+
+    m_ap.add(
+            "--uploadThreads",
+            "If set, serialized nodes are written by this many dedicated "
+            "threads, so serialization does not wait on storage latency.\n"
+            "Example: --uploadThreads 16",
+            [this](json j) { m_json["uploadThreads"] = extract(j); });
+
+    m_ap.add(
+            "--ioUring",
+            "Queue the node writes of local output to an io_uring, so that "
+            "they are submitted in batches rather than written by blocking "
+            "calls.  Linux only - elsewhere, nodes are written as usual.",
+            [this](json j) { checkEmpty(j); m_json["ioUring"] = true; });
+
+    m_ap.add(
+            "--nodeCache",
+            "Memory budget in bytes for serialized nodes which are held in "
+            "compressed form after eviction, so that nodes woken up again "
+            "need not be fetched, and are only written once (default: 0).\n"
+            "Example: --nodeCache 4000000000",
+            [this](json j) { m_json["nodeCache"] = extract(j); });
+
+    m_ap.add(
+            "--nodePrefetch",
+            "Memory budget in bytes for existing nodes of remote output which "
+            "are fetched ahead of the threads which will wake them, for "
+            "continued builds and merges (default: 0).\n"
+            "Example: --nodePrefetch 1000000000",
+            [this](json j) { m_json["nodePrefetch"] = extract(j); });
+
+    m_ap.add(
+            "--contentEncoding",
+            "Write ept.json, the hierarchy, and the manifest overview "
+            "compactly, and precompress them with this content encoding for "
+            "remote output, so that web readers fetch less.  Supported: "
+            "gzip.\n"
+            "Example: --contentEncoding gzip",
+            [this](json j) { m_json["contentEncoding"] = extract(j); });
+
+    m_ap.add(
+            "--journal",
+            "For remote output, stage nodes in the temporary directory and "
+            "upload them together whenever the build is saved, so that a "
+            "node rewritten several times is uploaded only once.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["journal"] = true;
+            });
+
+    m_ap.add(
+            "--pinnedDepth",
+            "Nodes shallower than this depth are kept in memory for the "
+            "entire build, bypassing the chunk cache (default: 0, maximum: "
+            "6).\n"
+            "Example: --pinnedDepth 4",
+            [this](json j) { m_json["pinnedDepth"] = extract(j); });
+
+    m_ap.add(
+            "--stagingDepth",
+            "Each thread resolves its points shallower than this depth "
+            "privately, merging them into the shared tree periodically "
+            "(default: 0).\n"
+            "Example: --stagingDepth 4",
+            [this](json j) { m_json["stagingDepth"] = extract(j); });
+
+    m_ap.add(
+            "--metricsPath",
+            "A local path to which a JSON line of build metrics is appended "
+            "at each progress interval.\n"
+            "Example: --metricsPath metrics.jsonl",
+            [this](json j) { m_json["metricsPath"] = j; });
+
+    m_ap.add(
+            "--trace",
+            "A local path to which spans of the build's work are written in "
+            "the Chrome trace-event format, for viewing in Perfetto.\n"
+            "Example: --trace trace.json",
+            [this](json j) { m_json["trace"] = j; });
+
+    m_ap.add(
+            "--accessTrace",
+            "A local path to which the chunk cache events of the build are "
+            "written, to be replayed through other cache policies by "
+            "`entwine replay`.\n"
+            "Example: --accessTrace access.bin",
+            [this](json j) { m_json["accessTrace"] = j; });
+
+    m_ap.add(
+            "--trackMemory",
+            "Attribute the memory allocated by the build to its subsystems, "
+            "which is reported in its metrics and at its end.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["trackMemory"] = true;
+            });
+
+    m_ap.add(
+            "--perfCounters",
+            "Count cycles, instructions, cache misses, and branch misses of "
+            "each phase of the build with hardware performance counters, "
+            "which are reported in its metrics and at its end.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["perfCounters"] = true;
+            });
+
+    m_ap.add(
+            "--metricsPort",
+            "If provided, build metrics are served over HTTP on this port "
+            "at /metrics, in the Prometheus text format.\n"
+            "Example: --metricsPort 9100",
+            [this](json j) { m_json["metricsPort"] = extract(j); });
+
+    m_ap.add(
+            "--adaptiveThreads",
+            "Shift threads between work and clipping during the build, "
+            "according to which is holding up the other.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["adaptiveThreads"] = true;
+            });
+
+    m_ap.add(
+            "--checkpointMinutes",
+            "If provided, the build's progress is checkpointed after this "
+            "many minutes, so an interrupted build may be resumed from its "
+            "latest checkpoint.\n"
+            "Example: --checkpointMinutes 30",
+            [this](json j) { m_json["checkpointMinutes"] = extract(j); });
+
+    m_ap.add(
+            "--checkpointFiles",
+            "If provided, the build's progress is checkpointed after this "
+            "many files are inserted.\n"
+            "Example: --checkpointFiles 100",
+            [this](json j) { m_json["checkpointFiles"] = extract(j); });
+
+    m_ap.add(
+            "--maxTime",
+            "If provided, the build is saved after about this many seconds, "
+            "without starting files which are not expected to finish in "
+            "time.  Running the same command again continues the build.\n"
+            "Example: --maxTime 28800",
+            [this](json j) { m_json["maxTime"] = extract(j); });
+
+    m_ap.add(
+            "--previewMinutes",
+            "If provided, a preview of the shallowest depths of the build is "
+            "published to ept-preview this often while it runs.\n"
+            "Example: --previewMinutes 15",
+            [this](json j) { m_json["previewMinutes"] = extract(j); });
+
+    m_ap.add(
+            "--previewDepth",
+            "The number of depths included in each preview.\n"
+            "Example: --previewDepth 6",
+            [this](json j) { m_json["previewDepth"] = extract(j); });
+
+    m_ap.add(
+            "--estimate",
+            "Rather than building, build a sample of the input into the "
+            "temporary directory, and estimate the node count, hierarchy "
+            "size, memory, output size and time of the full build from it.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["estimate"] = true;
+            });
+
+    m_ap.add(
+            "--append",
+            "When continuing a build, load and rewrite the metadata of only "
+            "the files which have yet to be inserted, which is much faster "
+            "for builds of many files.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["append"] = true;
+            });
+
+    m_ap.add(
+            "--numa",
+            "Pin threads to the NUMA nodes of this machine, and give each "
+            "node its own share of the input files, so that chunk memory is "
+            "allocated near the threads which insert into it.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["numa"] = true;
+            });
+
+    m_ap.add(
+            "--subsets",
+            "Further subset IDs, of the same total as --subset, to build in "
+            "this process along with it.  Each input file is read once for "
+            "all of them.\n"
+            "Example: --subset 1 16 --subsets 2 3 4",
+            [this](json j)
+            {
+                if (!j.is_array()) j = json::array({ j });
+                for (const json& id : j)
+                {
+                    m_json["subsets"].push_back(
+                        std::stoul(id.get<std::string>()));
+                }
+            });
+
+    m_ap.add(
+            "--pack",
+            "Pack the nodes of each hierarchy file into a single object, so "
+            "that far fewer objects are written.  Packed datasets may only be "
+            "read by Entwine, and may not be continued.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["pack"] = true;
+            });
+
+    m_ap.add(
+            "--manifestShardSize",
+            "Save the metadata of the input files in shards of this many "
+            "files each, rather than in one file per input.\n"
+            "Example: --manifestShardSize 10000",
+            [this](json j) { m_json["manifestShardSize"] = extract(j); });
+
+    m_ap.add(
+            "--compactManifest",
+            "Hold only an overview of each input file in memory, loading the "
+            "rest of its metadata from ept-sources while it is inserted or "
+            "saved.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["compactManifest"] = true;
+            });
+
+    m_ap.add(
+            "--nodeStats",
+            "Save the minimum and maximum of each dimension, and the "
+            "Classification counts, of every node in ept-node-stats, so that "
+            "nodes may be pruned by attribute without being fetched.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["nodeStats"] = true;
+            });
+
+    m_ap.add(
+            "--nodeSizes",
+            "Save the encoded size in bytes of every node in ept-node-sizes, "
+            "so that readers may plan their fetches without requesting the "
+            "size of each node.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["nodeSizes"] = true;
+            });
+
+    m_ap.add(
+            "--provenance",
+            "Save the nodes holding the points of each source, by their "
+            "PointId ranges, in ept-provenance, so that a point of a source "
+            "may be found without scanning the dataset.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["provenance"] = true;
+            });
+
+    m_ap.add(
+            "--presortDepth",
+            "Build in two passes: first bucket the points of every input "
+            "into local scratch files by their node at this depth, and then "
+            "insert each bucket in turn, so that scattered inputs do not "
+            "thrash the chunk cache (default: 0, meaning a single pass).\n"
+            "Example: --presortDepth 4",
+            [this](json j) { m_json["presortDepth"] = extract(j); });
+
+    m_ap.add(
+            "--presortSplit",
+            "In a presorted build, insert the nodes above the presort depth "
+            "first, and then build each subtree beneath it independently, so "
+            "that no locks are shared between them.  Applies only to new "
+            "builds.",
+            [this](json j) { checkEmpty(j); m_json["presortSplit"] = true; });
+
+    m_ap.add(
+            "--bottomUp",
+            "In a presorted build, build each subtree beneath the presort "
+            "depth first, and then derive the nodes above it by sampling the "
+            "points of their children, so that no point passes through them.  "
+            "Applies only to new builds.",
+            [this](json j) { checkEmpty(j); m_json["bottomUp"] = true; });
+
+    m_ap.add(
+            "--relativeXyz",
+            "Store the XYZ of binary and zstandard nodes as offsets from the "
+            "minimum corner of each node, in the narrowest integer type which "
+            "covers the node at the dataset scale.  Requires a scaled schema.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["relativeXyz"] = true;
+            });
+
+    m_ap.add(
+            "--lossyDepth",
+            "Round the XYZ of binary and zstandard nodes shallower than this "
+            "depth to a coarser step, relative to their voxel size.  Requires "
+            "a scaled schema.\n"
+            "Example: --lossyDepth 6",
+            [this](json j) { m_json["lossyDepth"] = extract(j); });
+
+    m_ap.add(
+            "--autoTune",
+            "Choose the span and node sizes of a new build, unless given, "
+            "from the point density of its sources.  The choice is explained "
+            "in ept-build.json.",
+            [this](json j) { checkEmpty(j); m_json["autoTune"] = true; });
+
+    m_ap.add(
+            "--tuningProfile",
+            "A JSON file of tuning profiles by storage backend.  Parameters "
+            "not given are taken from the profile for our output, which is "
+            "then updated with those learned from this build.\n"
+            "Example: --tuningProfile ~/.entwine-profile.json",
+            [this](json j) { m_json["tuningProfile"] = j; });
+
+    addReadCache();
     addArbiter();
 }
 
 void Build::run()
+{
+    if (m_json.count("jobs")) schedule();
+    else if (const uint64_t of = config::getCoordinate(m_json)) coordinate(of);
+    else build(m_json);
+}
+
+void Build::schedule()
+{
+    json base(m_json);
+    const json jobs(base.at("jobs"));
+    base.erase("jobs");
+
+    const arbiter::Arbiter a(base.value("arbiter", json()).dump());
+    std::vector<json> configs;
+    for (const json& job : jobs.is_array() ? jobs : json::array({ jobs }))
+    {
+        const json config(
+            merge(base, json::parse(a.get(job.get<std::string>()))));
+
+        // These act upon the state of our whole process, which our builds
+        // share.
+        if (
+            config::getCoordinate(config) ||
+            config::getEstimate(config) ||
+            config::getClean(config) ||
+            config::getTrace(config).size() ||
+            config::getAccessTrace(config).size() ||
+            config::getMetricsPort(config))
+        {
+            throw std::runtime_error(
+                "Cannot coordinate, estimate, clean, trace, or serve metrics "
+                "for a scheduled build: " + job.get<std::string>());
+        }
+        configs.push_back(config);
+    }
+
+    Scheduler scheduler(config::getThreads(base), config::getMemory(base));
+    for (const json& config : configs)
+    {
+        scheduler.add([this, config](
+            const Threads threads,
+            const std::shared_ptr<Allotment>& allotment)
+        {
+            // Analysis and saving run with our share of threads, and our
+            // inserts with our allotment.
+            json scheduled(config);
+            scheduled["threads"] = getTotal(threads);
+            return build(scheduled, allotment);
+        });
+    }
+
+    const std::vector<uint64_t> inserted = scheduler.run();
+    for (std::size_t i(0); i < inserted.size(); ++i)
+    {
+        std::cout << "Job " << i << " (" << jobs.at(i).get<std::string>() <<
+            "): wrote " << commify(inserted[i]) << " points." << std::endl;
+    }
+}
+
+void Build::coordinate(const uint64_t of)
 {
     const Endpoints endpoints = config::getEndpoints(m_json);
     const unsigned threads = config::getThreads(m_json);
 
+    // A subset which stopped early would be mistaken for a complete one.
+    if (config::getMaxTime(m_json))
+    {
+        throw std::runtime_error("Cannot use maxTime while coordinating");
+    }
+    if (config::getSubsets(m_json).size())
+    {
+        throw std::runtime_error("Cannot use subsets while coordinating");
+    }
+
+    Leases leases(endpoints.output, of, heuristics::leaseSeconds);
+    std::cout << "Coordinating " << of << " subsets as " << leases.owner() <<
+        std::endl;
+
+    while (!leases.finished())
+    {
+        if (leases.exhausted())
+        {
+            throw std::runtime_error(
+                "A subset has failed too many times - aborting");
+        }
+
+        const optional<uint64_t> id = leases.claim();
+        if (!id)
+        {
+            // Every remaining subset is held by another worker, whose lease
+            // may yet expire.
+            std::this_thread::sleep_for(
+                std::chrono::seconds(heuristics::leasePollSeconds));
+            continue;
+        }
+
+        std::cout << "Claimed subset " << *id << "/" << of << std::endl;
+
+        json config(m_json);
+        config.erase("coordinate");
+        config["subset"] = { { "id", *id }, { "of", of } };
+
+        try
+        {
+            Heartbeat heartbeat(leases, *id, heuristics::leaseSeconds / 3);
+            build(config);
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "Subset " << *id << " failed: " << e.what() <<
+                std::endl;
+            leases.fail(*id);
+            continue;
+        }
+
+        if (!leases.complete(*id))
+        {
+            std::cout << "Subset " << *id << " was taken over by another " <<
+                "worker" << std::endl;
+        }
+    }
+
+    // Whoever claims the merge may yet fail or disappear, so we wait until it
+    // is done, ready to take it over.
+    while (!leases.claimMerge())
+    {
+        if (leases.merged())
+        {
+            std::cout << "Merged by another worker" << std::endl;
+            return;
+        }
+        if (leases.exhausted())
+        {
+            throw std::runtime_error(
+                "The merge has failed too many times - aborting");
+        }
+
+        std::this_thread::sleep_for(
+            std::chrono::seconds(heuristics::leasePollSeconds));
+    }
+
+    try
+    {
+        Heartbeat heartbeat(
+            leases,
+            Leases::mergeId,
+            heuristics::leaseSeconds / 3);
+
+        std::cout << "Merging" << std::endl;
+        builder::merge(endpoints, threads);
+    }
+    catch (...)
+    {
+        leases.fail(Leases::mergeId);
+        throw;
+    }
+
+    if (!leases.complete(Leases::mergeId))
+    {
+        std::cout << "Merge was taken over by another worker" << std::endl;
+        return;
+    }
+    std::cout << "Done" << std::endl;
+}
+
+uint64_t Build::build(
+    json config,
+    const std::shared_ptr<Allotment> allotment)
+{
+    // Tracking is enabled first, so that everything we allocate is attributed.
+    if (config::getTrackMemory(config)) metrics::trackMemory(true);
+    if (config::getPerfCounters(config) && !perf::enable())
+    {
+        std::cout << "Hardware performance counters are unavailable" <<
+            std::endl;
+    }
+
+    const Endpoints endpoints = config::getEndpoints(config);
+    const unsigned threads = config::getThreads(config);
+
+    // The output of a subset is shared with its other subsets, so only a
+    // complete build may remove what it does not write.  Previous files are
+    // listed while we prepare, and written files are noted from now on.
+    std::shared_ptr<Sweep> sweep;
+    if (config::getForce(config) && config::getClean(config))
+    {
+        if (config.count("subset"))
+        {
+            throw std::runtime_error("Cannot clean the output of a subset");
+        }
+        sweep = std::make_shared<Sweep>(
+            *endpoints.arbiter,
+            endpoints.output,
+            threads);
+        setSweep(sweep);
+    }
+
     Manifest manifest;
     Hierarchy hierarchy;
+    bool awakened(false);
 
     // TODO: Handle subset postfixing during existence check - currently
     // continuations of subset builds will not work properly.
-    // const optional<Subset> subset = config::getSubset(m_json);
-    if (!config::getForce(m_json) && endpoints.output.tryGetSize("ept.json"))
+    // const optional<Subset> subset = config::getSubset(config);
+    if (!config::getForce(config) && endpoints.output.tryGetSize("ept.json"))
     {
         std::cout << "Awakening existing build." << std::endl;
+        awakened = true;
 
         // Merge in our metadata JSON, overriding any config settings.
         const json existingConfig = merge(
             json::parse(endpoints.output.get("ept-build.json")),
             json::parse(endpoints.output.get("ept.json"))
         );
-        m_json = merge(m_json, existingConfig);
+        config = merge(config, existingConfig);
+
+        if (existingConfig.value("checkpointing", false))
+        {
+            throw std::runtime_error(
+                "This build was interrupted while saving a checkpoint, and "
+                "cannot be resumed - use --force to restart it");
+        }
+        if (config::getPack(existingConfig))
+        {
+            throw std::runtime_error("Cannot continue a packed build");
+        }
+
+        // Return any nodes written since our latest checkpoint to their
+        // state as of that checkpoint, which our manifest and hierarchy
+        // describe.
+        Checkpoint::restore(endpoints, config.value("checkpoint", 0));
 
         // Awaken our existing manifest and hierarchy.
-        manifest = manifest::load(endpoints.sources, threads);
+        manifest = manifest::load(
+            endpoints.sources,
+            threads,
+            "",
+            !config::getAppend(config));
         hierarchy = hierarchy::load(endpoints.hierarchy, threads);
     }
 
-    // Now, analyze the incoming `input` if needed.
-    StringList inputs = resolve(config::getInput(m_json), *endpoints.arbiter);
-    const auto exists = [&manifest](std::string path)
+    // Now, analyze the incoming `input` if needed.  Its files are analyzed as
+    // their listings arrive, skipping any we already have in our manifest.
+    std::set<std::string> existing;
+    for (const BuildItem& b : manifest) existing.insert(b.source.path);
+    const auto exists = [&existing](const std::string& path)
     {
-        return std::any_of(
-            manifest.begin(),
-            manifest.end(),
-            [path](const BuildItem& b) { return b.source.path == path; });
+        return existing.count(path) > 0;
     };
-    // Remove any inputs we already have in our manifest prior to analysis.
-    inputs.erase(
-        std::remove_if(inputs.begin(), inputs.end(), exists),
-        inputs.end());
     const SourceList sources = analyze(
-        inputs,
-        config::getPipeline(m_json),
-        config::getDeep(m_json),
-        config::getTmp(m_json),
+        config::getInput(config),
+        config::getPipeline(config),
+        config::getDeep(config),
+        config::getTmp(config),
         *endpoints.arbiter,
-        threads);
+        threads,
+        config::getScanCache(config),
+        config::getIoThreads(config),
+        config::getListingCache(config),
+        exists);
     for (const auto& source : sources)
     {
         if (source.info.points) manifest.emplace_back(source);
@@ -236,13 +1032,150 @@ void Build::run()
     // It's possible we've just analyzed some files, in which case we have
     // potentially new information like bounds, schema, and SRS.  Prioritize
     // values from the config, which may explicitly override these.
-    const SourceInfo analysis = manifest::reduce(sources);
-    m_json = merge(analysis, m_json);
-    const Metadata metadata = config::getMetadata(m_json);
+    const SourceInfo analysis = manifest::reduce(sources, threads);
+    config = merge(analysis, config);
+
+    // The span of an existing build is fixed.
+    if (!awakened && config::getAutoTune(config))
+    {
+        const json tuning = config::tune(config, manifest);
+        if (!tuning.is_null())
+        {
+            const StringList keys = { "span", "minNodeSize", "maxNodeSize" };
+            for (const std::string& key : keys)
+            {
+                if (!config.count(key)) config[key] = tuning.at(key);
+            }
+            config["tuning"] = tuning;
+            std::cout << "Tuned by density: " << tuning.dump() << std::endl;
+        }
+    }
+
+    // Our profile is kept by the type of our output, since the parameters
+    // which suit a local build rarely suit a remote one.
+    const std::string profilePath = config::getTuningProfile(config);
+    const std::string backend = endpoints.output.type();
+    json profiles = json::object();
+    if (profilePath.size())
+    {
+        if (const auto data = endpoints.arbiter->tryGet(profilePath))
+        {
+            profiles = json::parse(*data);
+        }
+        if (profiles.count(backend))
+        {
+            const json applied = profile::apply(config, profiles.at(backend));
+            std::cout << "Tuned by profile: " << applied.dump() << std::endl;
+        }
+    }
+
+    // A new build may drop the dimensions tracking each point to its source,
+    // which otherwise occupy every point held in memory and written to every
+    // node.  The schema of an existing build is fixed.
+    if (!awakened && config.count("schema"))
+    {
+        Schema schema = config.at("schema").get<Schema>();
+        if (!config::getAllowOriginId(config))
+        {
+            schema = omit(schema, "OriginId");
+        }
+        if (!config::getAllowPointId(config)) schema = omit(schema, "PointId");
+        config["schema"] = schema;
+    }
+
+    // Balance new subsets by the point density of our manifest.  Awakened
+    // subsets have already been planned.
+    if (const optional<Subset> subset = config::getSubset(config))
+    {
+        if (!isBalanced(*subset))
+        {
+            config["subset"] =
+                balance(*subset, config::getBounds(config), manifest);
+        }
+
+        // The shared nodes of a new subset are rewritten by the merge, so
+        // they are written cheaply meanwhile.  Awakened subsets keep the type
+        // with which they were started.
+        if (!awakened && !config.count("subsetDataType"))
+        {
+            config["subsetDataType"] = "binary";
+        }
+    }
+    const Metadata metadata = config::getMetadata(config);
+
+    // Nodes are only packed once the build is complete.
+    if (
+        metadata.internal.pack &&
+        (config::getLimit(config) ||
+            config::getMaxTime(config) ||
+            config::getCheckpointMinutes(config) ||
+            config::getCheckpointFiles(config)))
+    {
+        throw std::runtime_error(
+            "Cannot checkpoint or limit the extent of a packed build");
+    }
+
+    // Until its second pass, the points of a presorted build are only in its
+    // scratch files.
+    if (
+        metadata.internal.presortDepth &&
+        (config::getCheckpointMinutes(config) ||
+            config::getCheckpointFiles(config)))
+    {
+        throw std::runtime_error("Cannot checkpoint a presorted build");
+    }
+
+    Builder builder(
+        endpoints,
+        metadata,
+        std::move(manifest),
+        std::move(hierarchy));
 
-    Builder builder(endpoints, metadata, manifest, hierarchy);
+    // Further subsets built along with this one share its plan, its manifest,
+    // and the reading of its sources.
+    std::vector<Builder> peers;
+    const std::vector<uint64_t> ids = config::getSubsets(config);
+    if (ids.size())
+    {
+        if (!metadata.subset)
+        {
+            throw std::runtime_error("Cannot use subsets without a subset");
+        }
+        if (
+            config::getCheckpointMinutes(config) ||
+            config::getCheckpointFiles(config) ||
+            config::getMaxTime(config))
+        {
+            throw std::runtime_error(
+                "Cannot checkpoint or limit the time of multiple subsets");
+        }
+        if (getInsertedPoints(builder.manifest))
+        {
+            throw std::runtime_error(
+                "Cannot continue a build of multiple subsets");
+        }
+
+        peers.reserve(ids.size());
+        for (const uint64_t id : ids)
+        {
+            if (
+                id == metadata.subset->id ||
+                std::count(ids.begin(), ids.end(), id) > 1)
+            {
+                throw std::runtime_error("Duplicate subset ID");
+            }
 
-    const uint64_t points = getTotalPoints(manifest);
+            json peer(config);
+            peer["subset"]["id"] = id;
+            peers.emplace_back(
+                endpoints,
+                config::getMetadata(peer),
+                builder.manifest);
+        }
+        for (Builder& peer : peers) builder.peers.push_back(&peer);
+    }
+
+    const uint64_t points = getTotalPoints(builder.manifest);
     printInfo(
         metadata.schema,
         metadata.boundsConforming,
@@ -252,19 +1185,241 @@ void Build::run()
         analysis.errors);
     if (metadata.subset)
     {
-        std::cout << "Subset: " <<
-            metadata.subset->id << "/" <<
-            metadata.subset->of << std::endl;
+        std::cout << "Subset: " << metadata.subset->id;
+        for (const Builder& peer : peers)
+        {
+            std::cout << ", " << peer.metadata.subset->id;
+        }
+        std::cout << "/" << metadata.subset->of << std::endl;
+    }
+
+    const json& resources(metadata.internal.resources);
+    const json& used(resources.at("threads"));
+    std::cout << "Threads: " << used.at(0).get<uint64_t>() << " work, " <<
+        used.at(1).get<uint64_t>() << " clip" << std::endl;
+    if (const uint64_t memory = resources.at("memory").get<uint64_t>())
+    {
+        std::cout << "Memory budget: " << commify(memory) << " bytes" <<
+            std::endl;
+    }
+    if (resources.count("container"))
+    {
+        std::cout << "Container limits: " << resources.at("container").dump() <<
+            std::endl;
     }
 
     std::cout << std::endl;
 
+    if (config::getEstimate(config))
+    {
+        setSweep({ });
+        estimate(config, builder);
+        return 0;
+    }
+
+    const std::string tracePath = config::getTrace(config);
+    if (tracePath.size()) trace::start(tracePath);
+
+    const std::string accessTracePath = config::getAccessTrace(config);
+    if (accessTracePath.size()) accessTrace::start(accessTracePath);
+
+    builder.allotment = allotment;
     const uint64_t actual = builder.run(
-        config::getCompoundThreads(m_json),
-        config::getLimit(m_json),
-        config::getProgressInterval(m_json));
+        config::getCompoundThreads(config),
+        config::getLimit(config),
+        config::getProgressInterval(config));
+
+    trace::stop();
+    accessTrace::stop();
+
+    if (sweep)
+    {
+        setSweep({ });
+
+        // Whatever wrote them, the files of the nodes of our hierarchy, as
+        // named for our data type at their depths, are ours.
+        const std::string root(endpoints.data.prefixedRoot());
+        const auto keep = [&builder, &root](const std::string& path)
+        {
+            if (path.compare(0, root.size(), root)) return false;
+            const std::string name(path.substr(root.size()));
+            const std::size_t dot(name.rfind('.'));
+            if (dot == std::string::npos) return false;
+
+            try
+            {
+                const Dxyz key(name.substr(0, dot));
+                return
+                    name.substr(dot) ==
+                        io::getNodeExtension(builder.metadata, key.d) &&
+                    builder.hierarchy.has(key);
+            }
+            catch (...) { return false; }
+        };
+
+        std::cout << "Removing files of the previous build..." << std::endl;
+        std::cout << "Removed " << commify(sweep->run(keep)) << " files." <<
+            std::endl;
+    }
+
+    if (profilePath.size() && !builder.observed.is_null())
+    {
+        profiles[backend] = profile::learn(builder.observed);
+        endpoints.arbiter->put(profilePath, profiles.dump(2));
+        std::cout << "Updated profile for " << backend << ": " <<
+            profiles.at(backend).dump() << std::endl;
+    }
 
     std::cout << "Wrote " << commify(actual) << " points." << std::endl;
+
+    const uint64_t tooDeep =
+        metrics::get().at("counts").at("tooDeep").get<uint64_t>();
+    if (tooDeep)
+    {
+        std::cout << "Discarded " << commify(tooDeep) <<
+            " points at the maximum depth." << std::endl;
+    }
+
+    if (metrics::trackingMemory())
+    {
+        std::cout << "Peak memory by subsystem:" << std::endl;
+        for (const auto& p : metrics::get().at("memory").items())
+        {
+            std::cout << "\t" << p.key() << ": " <<
+                commify(p.value().at("peak").get<uint64_t>()) << " bytes" <<
+                std::endl;
+        }
+    }
+
+    if (perf::enabled())
+    {
+        std::cout << "Hardware events by phase:" << std::endl;
+        for (const auto& p : metrics::get().at("hardware").items())
+        {
+            const json& events(p.value());
+            const double instructions(events.at("instructions").get<double>());
+            if (!instructions) continue;
+
+            const auto perKilo = [&](const std::string& event)
+            {
+                return events.at(event).get<double>() * 1000 / instructions;
+            };
+            std::cout << "\t" << p.key() << ": " <<
+                instructions / events.at("cycles").get<double>() << " IPC, " <<
+                perKilo("cacheMisses") << " cache misses and " <<
+                perKilo("branchMisses") << " branch misses per 1000 " <<
+                "instructions" << std::endl;
+        }
+    }
+
+    return actual;
+}
+
+void Build::estimate(const json& config, const Builder& builder)
+{
+    const Threads threads = config::getCompoundThreads(config);
+
+    // Sample evenly throughout the remaining sources, with enough of them to
+    // occupy every work thread.
+    Manifest remaining;
+    for (const BuildItem& item : builder.manifest)
+    {
+        if (!isSettled(item)) remaining.push_back(item);
+    }
+    if (remaining.empty())
+    {
+        std::cout << "Nothing left to build" << std::endl;
+        return;
+    }
+
+    const uint64_t count = std::min<uint64_t>(
+        remaining.size(),
+        std::max<uint64_t>(heuristics::estimateSources, threads.work));
+
+    Manifest sample;
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        sample.push_back(remaining[i * remaining.size() / count]);
+    }
+
+    const uint64_t totalPoints = getTotalPoints(remaining);
+    const uint64_t samplePoints = getTotalPoints(sample);
+    const double scale = double(totalPoints) / samplePoints;
+
+    // Our sample is built with the same settings, but none of the side
+    // effects of a real build.
+    Metadata metadata = builder.metadata;
+    metadata.internal.metricsPath.clear();
+    metadata.internal.metricsPort = 0;
+    metadata.internal.checkpointMinutes = 0;
+    metadata.internal.checkpointFiles = 0;
+    metadata.internal.maxTime = 0;
+    metadata.internal.previewMinutes = 0;
+
+    const std::string tmp = config::getTmp(config);
+    const std::string dir = arbiter::join(
+        tmp,
+        "entwine-estimate-" + std::to_string(::getpid()));
+    const Endpoints endpoints(builder.endpoints.arbiter, dir, tmp);
+
+    std::cout << "Building a sample of " << count << " of " <<
+        remaining.size() << " files (" << commify(samplePoints) <<
+        " points)" << std::endl;
+
+    Builder sampled(endpoints, metadata, std::move(sample));
+    const auto start = now();
+    sampled.run(threads, 0, 0);
+    const double seconds = since<std::chrono::milliseconds>(start) / 1000.0;
+
+    uint64_t nodes = 0;
+    sampled.hierarchy.forEach([&nodes](const Dxyz&, int64_t np)
+    {
+        if (np) ++nodes;
+    });
+
+    const auto sizeOf = [&](const std::string& glob)
+    {
+        uint64_t bytes = 0;
+        for (const std::string& f : endpoints.arbiter->resolve(glob))
+        {
+            if (const auto size = endpoints.arbiter->tryGetSize(f))
+            {
+                bytes += *size;
+            }
+        }
+        return bytes;
+    };
+    const uint64_t dataBytes = sizeOf(arbiter::join(dir, "ept-data", "*"));
+    const uint64_t hierarchyBytes =
+        sizeOf(arbiter::join(dir, "ept-hierarchy", "*.json"));
+
+    removeTree(dir, *endpoints.arbiter);
+
+    // Node counts grow with the number of points, apart from the shallow
+    // depths, so this overestimates slightly.  Memory is bounded by our cache
+    // rather than the size of the build, apart from the hierarchy.
+    const double totalNodes = nodes * scale;
+    const json results {
+        { "sample", {
+            { "files", count },
+            { "points", samplePoints },
+            { "nodes", nodes },
+            { "seconds", seconds }
+        } },
+        { "files", remaining.size() },
+        { "points", totalPoints },
+        { "nodes", uint64_t(totalNodes) },
+        { "hierarchyBytes", uint64_t(hierarchyBytes * scale) },
+        { "dataBytes", uint64_t(dataBytes * scale) },
+        { "peakMemory", uint64_t(
+            metrics::peakRss() +
+            (totalNodes - nodes) * heuristics::estimateNodeBytes) },
+        { "seconds", uint64_t(seconds * scale) }
+    };
+
+    std::cout << std::endl << "Estimate:\n" << results.dump(2) << std::endl;
+    std::cout << "Estimated time: " <<
+        formatTime(seconds * scale) << std::endl;
 }
 
 } // namespace app
@@ -12,6 +12,11 @@
 
 #include "entwine.hpp"
 
+#include <memory>
+
+#include <entwine/builder/allotment.hpp>
+#include <entwine/builder/builder.hpp>
+
 namespace entwine
 {
 
@@ -23,6 +28,21 @@ class Build : public App
 private:
     virtual void addArgs() override;
     virtual void run() override;
+
+    void coordinate(uint64_t of);
+
+    // Run the builds of our jobs together, through a single Scheduler.
+    void schedule();
+
+    // Returns the number of points inserted.  If an allotment is given, our
+    // inserts run through it in the pool of its scheduler.
+    uint64_t build(
+        json config,
+        std::shared_ptr<Allotment> allotment = std::shared_ptr<Allotment>());
+
+    // Build a sample of the remaining sources into a temporary location, and
+    // extrapolate the cost of the whole build from it.
+    void estimate(const json& config, const Builder& builder);
 };
 
 } // namespace app
@@ -0,0 +1,111 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "convert.hpp"
+
+#include <iostream>
+#include <string>
+
+#include <entwine/reader/reader.hpp>
+#include <entwine/reader/tileset.hpp>
+#include <entwine/types/endpoints.hpp>
+#include <entwine/util/config.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+void Convert::addArgs()
+{
+    m_ap.setUsage("entwine convert <path> --output <path> (<options>)");
+
+    m_ap.addDefault(
+            "--input",
+            "-i",
+            "Path of the EPT dataset to convert",
+            [this](json j) { m_json["input"] = j; });
+    addOutput("Output directory for the Cesium 3D Tiles tileset");
+    addConfig();
+    addTmp();
+    addSimpleThreads();
+
+    m_ap.add(
+            "--colorType",
+            "Color of the tiles: none, rgb, intensity, or tile, which colors "
+            "each tile randomly.  By default RGB is used if it exists, or "
+            "otherwise Intensity if it exists.\n"
+            "Example: --colorType intensity",
+            [this](json j) { m_json["colorType"] = j; });
+
+    m_ap.add(
+            "--truncate",
+            "If set, two-byte color values are scaled down to one byte "
+            "rather than clamped.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["truncate"] = true;
+            });
+
+    m_ap.add(
+            "--geometricErrorDivisor",
+            "The root geometric error is the width of the dataset's cube "
+            "divided by this value.  Default: 32.\n"
+            "Example: --geometricErrorDivisor 16",
+            [this](json j)
+            {
+                m_json["geometricErrorDivisor"] =
+                    std::stod(j.get<std::string>());
+            });
+
+    addReadCache();
+    addArbiter();
+}
+
+void Convert::run()
+{
+    if (!m_json.count("input"))
+    {
+        throw std::runtime_error("Missing dataset to convert");
+    }
+    if (!m_json.count("output"))
+    {
+        throw std::runtime_error("Missing conversion output");
+    }
+
+    // Our dataset is read as the output of its build.
+    json config(m_json);
+    config["output"] = m_json.at("input");
+    const std::string output = m_json.at("output");
+
+    const Endpoints endpoints = config::getEndpoints(config);
+    const unsigned threads = config::getThreads(config);
+
+    if (!endpoints.output.tryGetSize("ept.json"))
+    {
+        throw std::runtime_error("No completed dataset exists here");
+    }
+
+    tileset::Options options;
+    options.colorType = m_json.value("colorType", "");
+    options.truncate = m_json.value("truncate", false);
+    options.geometricErrorDivisor =
+        m_json.value("geometricErrorDivisor", options.geometricErrorDivisor);
+
+    Reader reader(endpoints, threads);
+
+    std::cout << "Converting to " << output << std::endl;
+    const uint64_t tiles = tileset::write(reader, output, options);
+    std::cout << "Wrote " << commify(tiles) << " tiles" << std::endl;
+}
+
+} // namespace app
+} // namespace entwine
@@ -8,10 +8,18 @@
 *
 ******************************************************************************/
 
+#include "benchmark.hpp"
 #include "build.hpp"
 #include "entwine.hpp"
+#include "convert.hpp"
+#include "export.hpp"
 #include "info.hpp"
 #include "merge.hpp"
+#include "recover.hpp"
+#include "remove.hpp"
+#include "replay.hpp"
+#include "serve.hpp"
+#include "verify.hpp"
 
 #include <csignal>
 #include <cstdio>
@@ -44,7 +52,23 @@ namespace
             t(2) + "merge\n" +
             t(3) + "Merge colocated entwine subsets\n" +
             t(2) + "info\n" +
-            t(3) + "Gather metadata information about point cloud files\n";
+            t(3) + "Gather metadata information about point cloud files\n" +
+            t(2) + "benchmark\n" +
+            t(3) + "Build a synthetic dataset to measure performance\n" +
+            t(2) + "remove\n" +
+            t(3) + "Remove points from an EPT dataset in place\n" +
+            t(2) + "serve\n" +
+            t(3) + "Serve an EPT dataset and queries of it over HTTP\n" +
+            t(2) + "export\n" +
+            t(3) + "Export an EPT dataset at a target resolution\n" +
+            t(2) + "convert\n" +
+            t(3) + "Convert an EPT dataset to Cesium 3D Tiles\n" +
+            t(2) + "verify\n" +
+            t(3) + "Check that the nodes of an EPT dataset exist and decode\n" +
+            t(2) + "recover\n" +
+            t(3) + "Rebuild the hierarchy of an EPT dataset from its nodes\n" +
+            t(2) + "replay\n" +
+            t(3) + "Replay a chunk access trace through cache policies\n";
     }
 
     std::mutex mutex;
@@ -186,6 +210,55 @@ void App::addNoTrustHeaders()
             });
 }
 
+void App::addScanCache()
+{
+    m_ap.add(
+            "--scanCache",
+            "A directory in which to cache file analysis results, so that "
+            "unchanged files are not analyzed again by later runs.\n"
+            "Example: --scanCache s3://my-bucket/entwine-cache",
+            [this](json j) { m_json["scanCache"] = j; });
+}
+
+void App::addIoThreads()
+{
+    m_ap.add(
+            "--ioThreads",
+            "Number of threads with which input files, or their headers, are "
+            "fetched during analysis, separately from the threads which parse "
+            "them (default: 64).\n"
+            "Example: --ioThreads 256",
+            [this](json j) { m_json["ioThreads"] = extract(j); });
+}
+
+void App::addListingCache()
+{
+    m_ap.add(
+            "--listingCache",
+            "A directory in which to save the listing of each input "
+            "directory, which later runs reuse rather than listing that "
+            "directory again.  Remove a listing to refresh it.\n"
+            "Example: --listingCache s3://my-bucket/entwine-listings",
+            [this](json j) { m_json["listingCache"] = j; });
+}
+
+void App::addReadCache()
+{
+    m_ap.add(
+            "--readCache",
+            "A local directory in which to cache remote objects as they are "
+            "read, such as nodes and hierarchy files, so that later runs "
+            "need not fetch them again.\n"
+            "Example: --readCache /mnt/ssd/entwine-cache",
+            [this](json j) { m_json["readCache"] = j; });
+
+    m_ap.add(
+            "--readCacheSize",
+            "The maximum size of the --readCache directory, in bytes.  "
+            "Default: 16 GiB.",
+            [this](json j) { m_json["readCacheSize"] = extract(j); });
+}
+
 void App::addDeep()
 {
     m_ap.add(
@@ -248,6 +321,39 @@ void App::addArbiter()
                 m_json["arbiter"]["s3"]["allowInstanceProfile"] = true;
             });
 
+    m_ap.add(
+            "--requestRate",
+            "Limit requests to each storage location to this many per "
+            "second.  See `rateLimit` in the configuration docs.\n"
+            "Example: --requestRate 3000",
+            [this](json j)
+            {
+                m_json["rateLimit"]["requests"] =
+                    std::stod(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--bandwidthLimit",
+            "Limit transfers to each storage location to this many MB per "
+            "second.\n"
+            "Example: --bandwidthLimit 500",
+            [this](json j)
+            {
+                m_json["rateLimit"]["bandwidth"] =
+                    std::stod(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--ioPriority",
+            "Weight of this process, relative to others sharing its storage, "
+            "by which it regains its request rate after being throttled\n"
+            "Example: --ioPriority 2",
+            [this](json j)
+            {
+                m_json["rateLimit"]["priority"] =
+                    std::stod(j.get<std::string>());
+            });
+
     m_ap.add(
             "--verbose",
             "-v",
@@ -412,6 +518,38 @@ int main(int argc, char** argv)
         {
             entwine::app::Info().go(args);
         }
+        else if (app == "benchmark")
+        {
+            entwine::app::Benchmark().go(args);
+        }
+        else if (app == "remove")
+        {
+            entwine::app::Remove().go(args);
+        }
+        else if (app == "serve")
+        {
+            entwine::app::Serve().go(args);
+        }
+        else if (app == "export")
+        {
+            entwine::app::Export().go(args);
+        }
+        else if (app == "convert")
+        {
+            entwine::app::Convert().go(args);
+        }
+        else if (app == "verify")
+        {
+            entwine::app::Verify().go(args);
+        }
+        else if (app == "recover")
+        {
+            entwine::app::Recover().go(args);
+        }
+        else if (app == "replay")
+        {
+            entwine::app::Replay().go(args);
+        }
         else
         {
             if (app != "help" && app != "-h" && app != "--help")
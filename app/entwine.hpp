@@ -56,6 +56,10 @@ protected:
     void addReprojection();
     void addNoTrustHeaders();
     void addDeep();
+    void addScanCache();
+    void addIoThreads();
+    void addListingCache();
+    void addReadCache();
     void addAbsolute();
     void addArbiter();
 
@@ -0,0 +1,149 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "export.hpp"
+
+#include <iostream>
+#include <string>
+
+#include <entwine/reader/export.hpp>
+#include <entwine/reader/reader.hpp>
+#include <entwine/types/endpoints.hpp>
+#include <entwine/util/config.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+void Export::addArgs()
+{
+    m_ap.setUsage("entwine export <path> --destination <path> (<options>)");
+
+    addOutput("Path of the EPT dataset to export", true);
+    addConfig();
+    addTmp();
+    addSimpleThreads();
+
+    m_ap.add(
+            "--destination",
+            "Path of the export: a file for binary exports, or a directory "
+            "of files for LAS and LAZ exports",
+            [this](json j) { m_json["destination"] = j; });
+
+    m_ap.add(
+            "--resolution",
+            "-r",
+            "Export points down to the depth whose spacing is at least "
+            "this fine.\n"
+            "Example: --resolution 1",
+            [this](json j)
+            {
+                m_json["resolution"] = std::stod(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--format",
+            "-f",
+            "Export format: laz (default), las, copc, or binary, which is "
+            "packed records of the exported dimensions.\n"
+            "Example: --format binary",
+            [this](json j) { m_json["format"] = j; });
+
+    m_ap.add(
+            "--bounds",
+            "-b",
+            "Only points within these bounds are exported.\n"
+            "Example: --bounds 0 0 0 100 100 100, -b \"[0,0,0,100,100,100]\"",
+            [this](json j)
+            {
+                if (j.is_string())
+                {
+                    m_json["bounds"] = json::parse(j.get<std::string>());
+                }
+                else if (j.is_array())
+                {
+                    for (json& coord : j)
+                    {
+                        coord = std::stod(coord.get<std::string>());
+                    }
+                    m_json["bounds"] = j;
+                }
+            });
+
+    m_ap.add(
+            "--dims",
+            "Dimensions to export, in order.  All of them by default.\n"
+            "Example: --dims X Y Z Intensity",
+            [this](json j)
+            {
+                if (j.is_string()) j = json::array({ j });
+                m_json["dims"] = j;
+            });
+
+    m_ap.add(
+            "--time",
+            "Only points whose GpsTime lies within this inclusive range are "
+            "exported.\n"
+            "Example: --time 266000 267000",
+            [this](json j)
+            {
+                if (!j.is_array() || j.size() != 2)
+                {
+                    throw std::runtime_error("Invalid time: " + j.dump());
+                }
+                for (json& t : j) t = std::stod(t.get<std::string>());
+                m_json["time"] = j;
+            });
+
+    addReadCache();
+    addArbiter();
+}
+
+void Export::run()
+{
+    const Endpoints endpoints = config::getEndpoints(m_json);
+    const unsigned threads = config::getThreads(m_json);
+
+    if (!endpoints.output.tryGetSize("ept.json"))
+    {
+        throw std::runtime_error("No completed dataset exists here");
+    }
+    if (!m_json.count("destination"))
+    {
+        throw std::runtime_error("Missing export destination");
+    }
+
+    Query query;
+    if (m_json.count("bounds")) query.bounds = config::getBounds(m_json);
+    query.resolution = m_json.value("resolution", 0.0);
+    query.dimensions = m_json.value("dims", StringList());
+    if (m_json.count("time"))
+    {
+        const json& time(m_json.at("time"));
+        query.time = std::make_pair(
+            time.at(0).get<double>(),
+            time.at(1).get<double>());
+    }
+
+    const std::string destination = m_json.at("destination");
+    const exporter::Format format =
+        exporter::toFormat(m_json.value("format", "laz"));
+
+    Reader reader(endpoints, threads);
+
+    std::cout << "Exporting to " << destination << std::endl;
+    const uint64_t points =
+        exporter::write(reader, query, destination, format);
+    std::cout << "Exported " << commify(points) << " points" << std::endl;
+}
+
+} // namespace app
+} // namespace entwine
@@ -10,10 +10,10 @@
 
 #include "info.hpp"
 
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/types/metadata.hpp>
 #include <entwine/types/srs.hpp>
 #include <entwine/util/config.hpp>
-#include <entwine/util/fs.hpp>
 #include <entwine/util/info.hpp>
 #include <entwine/util/time.hpp>
 
@@ -39,6 +39,9 @@ void Info::addArgs()
 
     addTmp();
     addDeep();
+    addScanCache();
+    addIoThreads();
+    addListingCache();
     addReprojection();
     addSimpleThreads();
     addConfig();
@@ -48,28 +51,21 @@ void Info::addArgs()
 void Info::run()
 {
     const arbiter::Arbiter a = config::getArbiter(m_json);
-    StringList inputs = config::getInput(m_json);
+    const StringList inputs = config::getInput(m_json);
     if (inputs.empty())
     {
         std::cout << "No inputs supplied - exiting" << std::endl;
         return;
     }
-    if (std::any_of(inputs.begin(), inputs.end(), isDirectory))
-    {
-        std::cout << "Resolving inputs..." << std::endl;
-        inputs = resolve(inputs, a);
-        std::cout << "\tResolved." << std::endl;
-    }
 
     const std::string output = config::getOutput(m_json);
     const std::string tmp = config::getTmp(m_json);
     const bool deep = config::getDeep(m_json);
     const unsigned threads = config::getThreads(m_json);
+    const unsigned ioThreads = config::getIoThreads(m_json);
     const json pipeline = config::getPipeline(m_json);
     const auto reprojection = config::getReprojection(m_json);
 
-    if (inputs.empty()) throw std::runtime_error("No files found!");
-
     std::cout << "Analyzing:\n" <<
         "\tInput: " <<
             (inputs.size() > 1
@@ -79,6 +75,8 @@ void Info::run()
         "\tReprojection: " << getReprojectionString(reprojection) << "\n" <<
         "\tType: " << (deep ? "deep" : "shallow") << "\n" <<
         "\tThreads: " << threads << "\n" <<
+        "\tI/O threads: " <<
+            (ioThreads ? ioThreads : heuristics::analysisIoThreads) << "\n" <<
         std::endl;
 
     const SourceList sources = analyze(
@@ -87,8 +85,13 @@ void Info::run()
         deep,
         tmp,
         a,
-        threads);
-    const SourceInfo summary = manifest::reduce(sources);
+        threads,
+        config::getScanCache(m_json),
+        ioThreads,
+        config::getListingCache(m_json));
+    if (sources.empty()) throw std::runtime_error("No files found!");
+
+    const SourceInfo summary = manifest::reduce(sources, threads);
 
     std::cout << "\tDone.\n" << std::endl;
 
@@ -13,12 +13,13 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
-#include <mutex>
 #include <string>
 
 #include <entwine/builder/builder.hpp>
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/types/endpoints.hpp>
 #include <entwine/util/config.hpp>
+#include <entwine/util/trace.hpp>
 
 namespace entwine
 {
@@ -33,13 +34,43 @@ void Merge::addArgs()
     addConfig();
     addTmp();
     addSimpleThreads();
+    addReadCache();
     addArbiter();
+    m_ap.add(
+            "--subsetOutputs",
+            "The output paths of the subset builds, in order of their IDs, "
+            "if they were not written to the merged output.  Their nodes are "
+            "copied into the merged output.\n"
+            "Example: --subsetOutputs s3://a/ept s3://b/ept",
+            [this](json j)
+            {
+                if (j.is_array())
+                {
+                    for (const json& entry : j)
+                    {
+                        m_json["subsetOutputs"].push_back(entry);
+                    }
+                }
+                else m_json["subsetOutputs"].push_back(j);
+            });
     m_ap.add(
             "--force",
             "-f",
             "Force merge overwrite - if a completed EPT dataset exists at this "
             "output location, overwrite it with the result of the merge.",
             [this](json j) { checkEmpty(j); m_json["force"] = true; });
+    m_ap.add(
+            "--incremental",
+            "Merge subsets as each of them is completed, rather than waiting "
+            "for all of them, saving the merged dataset after each.  An "
+            "interrupted incremental merge resumes where it left off.",
+            [this](json j) { checkEmpty(j); m_json["incremental"] = true; });
+    m_ap.add(
+            "--trace",
+            "A local path to which spans of the merge's work are written in "
+            "the Chrome trace-event format, for viewing in Perfetto.\n"
+            "Example: --trace trace.json",
+            [this](json j) { m_json["trace"] = j; });
 }
 
 void Merge::run()
@@ -47,62 +78,36 @@ void Merge::run()
     const Endpoints endpoints = config::getEndpoints(m_json);
     const unsigned threads = config::getThreads(m_json);
     const bool force = config::getForce(m_json);
+    const StringList subsetOutputs = config::getSubsetOutputs(m_json);
+    const bool incremental = config::getIncremental(m_json);
 
-    if (!force && endpoints.output.tryGetSize("ept.json"))
+    // The output of an incremental merge in progress is resumed, unless we
+    // are forced to start over.
+    const bool resuming =
+        incremental && endpoints.output.tryGetSize("ept-merge.json");
+
+    if (!force && !resuming && endpoints.output.tryGetSize("ept.json"))
     {
         throw std::runtime_error(
             "Completed dataset already exists here: "
             "re-run with '--force' to overwrite it");
     }
 
-    if (!endpoints.output.tryGetSize("ept-1.json"))
-    {
-        throw std::runtime_error("Failed to find first subset");
-    }
-
-    std::cout << "Initializing" << std::endl;
-    const Builder base = builder::load(endpoints, threads, 1);
-
-    // Grab the total number of subsets, then clear the subsetting from our
-    // metadata aggregator which will represent our merged output.
-    Metadata metadata = base.metadata;
-    const unsigned of = metadata.subset.value().of;
-    metadata.subset = { };
-
-    Manifest manifest = base.manifest;
-
-    Builder builder(endpoints, metadata, manifest);
-    ChunkCache cache(endpoints, builder.metadata, builder.hierarchy, threads);
+    const std::string tracePath = config::getTrace(m_json);
+    if (tracePath.size()) trace::start(tracePath);
 
     std::cout << "Merging" << std::endl;
-
-    Pool pool(threads);
-    std::mutex mutex;
-
-    for (unsigned id = 1; id <= of; ++id)
+    if (incremental)
     {
-        std::cout << "\t" << id << "/" << of << ": ";
-        if (endpoints.output.tryGetSize("ept-" + std::to_string(id) + ".json"))
-        {
-            std::cout << "merging" << std::endl;
-            pool.add([&endpoints, threads, id, &builder, &cache, &mutex]()
-            {
-                Builder current = builder::load(endpoints, threads, id);
-                builder::merge(builder, current, cache);
-
-                std::lock_guard<std::mutex> lock(mutex);
-                builder.manifest = manifest::merge(
-                    builder.manifest,
-                    current.manifest);
-            });
-        }
-        else std::cout << "skipping" << std::endl;
+        builder::mergeIncrementally(
+            endpoints,
+            threads,
+            subsetOutputs,
+            heuristics::mergePollSeconds,
+            !force);
     }
-
-    pool.join();
-    cache.join();
-
-    builder.save(threads);
+    else builder::merge(endpoints, threads, subsetOutputs);
+    trace::stop();
     std::cout << "Done" << std::endl;
 }
 
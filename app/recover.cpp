@@ -0,0 +1,57 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "recover.hpp"
+
+#include <iostream>
+#include <stdexcept>
+
+#include <entwine/builder/recover.hpp>
+#include <entwine/types/endpoints.hpp>
+#include <entwine/util/config.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/time.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+void Recover::addArgs()
+{
+    m_ap.setUsage("entwine recover <path> (<options>)");
+
+    addOutput("Path of the EPT build whose hierarchy is recovered", true);
+    addConfig();
+    addTmp();
+    addSimpleThreads();
+    addReadCache();
+    addArbiter();
+}
+
+void Recover::run()
+{
+    const Endpoints endpoints = config::getEndpoints(m_json);
+    const unsigned threads = config::getThreads(m_json);
+
+    if (!endpoints.output.tryGetSize("ept.json"))
+    {
+        throw std::runtime_error("No completed dataset exists here");
+    }
+
+    std::cout << "Recovering hierarchy from node files" << std::endl;
+    const auto start = now();
+    const uint64_t points = builder::recover(endpoints, threads);
+    std::cout << "Recovered " << commify(points) << " points in " <<
+        formatTime(since(start)) << std::endl;
+}
+
+} // namespace app
+} // namespace entwine
@@ -0,0 +1,123 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "remove.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <string>
+
+#include <entwine/builder/builder.hpp>
+#include <entwine/types/endpoints.hpp>
+#include <entwine/util/config.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+void Remove::addArgs()
+{
+    m_ap.setUsage("entwine remove <path> (<options>)");
+
+    addOutput("Path of the EPT build from which points are removed", true);
+    addConfig();
+    addTmp();
+    addSimpleThreads();
+
+    m_ap.add(
+            "--bounds",
+            "-b",
+            "Points within these bounds are removed.\n"
+            "Example: --bounds 0 0 0 100 100 100, -b \"[0,0,0,100,100,100]\"",
+            [this](json j)
+            {
+                if (j.is_string())
+                {
+                    m_json["bounds"] = json::parse(j.get<std::string>());
+                }
+                else if (j.is_array())
+                {
+                    for (json& coord : j)
+                    {
+                        coord = std::stod(coord.get<std::string>());
+                    }
+                    m_json["bounds"] = j;
+                }
+            });
+
+    m_ap.add(
+            "--origins",
+            "Points of these input files are removed, given as their origin "
+            "IDs or their paths as they appear in the manifest.\n"
+            "Example: --origins 3 17, --origins tiles/bad.laz",
+            [this](json j)
+            {
+                if (j.is_string()) j = json::array({ j });
+                m_json["origins"] = j;
+            });
+
+    addReadCache();
+    addArbiter();
+}
+
+void Remove::run()
+{
+    const Endpoints endpoints = config::getEndpoints(m_json);
+    const unsigned threads = config::getThreads(m_json);
+
+    if (!endpoints.output.tryGetSize("ept.json"))
+    {
+        throw std::runtime_error("No completed dataset exists here");
+    }
+
+    Builder builder = builder::load(endpoints, threads, 0);
+
+    builder::Removal removal;
+    if (m_json.count("bounds")) removal.bounds = config::getBounds(m_json);
+
+    for (const json& j : m_json.value("origins", json::array()))
+    {
+        const std::string s = j.is_string()
+            ? j.get<std::string>()
+            : std::to_string(j.get<uint64_t>());
+        const auto match = std::find_if(
+            builder.manifest.begin(),
+            builder.manifest.end(),
+            [&s](const BuildItem& item)
+            {
+                return item.source.path == s ||
+                    item.source.path == arbiter::expandTilde(s);
+            });
+
+        if (match != builder.manifest.end())
+        {
+            removal.origins.insert(match - builder.manifest.begin());
+        }
+        else if (s.size() && std::all_of(s.begin(), s.end(), ::isdigit))
+        {
+            const Origin origin = std::stoull(s);
+            if (origin >= builder.manifest.size())
+            {
+                throw std::runtime_error("Invalid origin: " + s);
+            }
+            removal.origins.insert(origin);
+        }
+        else throw std::runtime_error("No input file matches: " + s);
+    }
+
+    std::cout << "Removing points" << std::endl;
+    const uint64_t removed = builder::remove(builder, removal, threads);
+    std::cout << "Removed " << commify(removed) << " points" << std::endl;
+}
+
+} // namespace app
+} // namespace entwine
@@ -0,0 +1,129 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "replay.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/builder/replay.hpp>
+#include <entwine/util/access-trace.hpp>
+#include <entwine/util/config.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+namespace
+{
+
+// Each of these options may be a single value or a list of them to sweep.
+json asList(const json& j)
+{
+    return j.is_array() ? j : json::array({ j });
+}
+
+} // unnamed namespace
+
+void Replay::addArgs()
+{
+    m_ap.setUsage("entwine replay <path> (<options>)");
+
+    m_ap.addDefault(
+            "--input",
+            "-i",
+            "Path of an access trace recorded by `entwine build "
+            "--accessTrace`",
+            [this](json j) { m_json["input"] = j; });
+
+    m_ap.add(
+            "--cacheSize",
+            "The number of released chunks held by the cache, or a list of "
+            "them to compare (default: 64).\n"
+            "Example: --cacheSize 64, --cacheSize [16, 64, 256]",
+            [this](json j)
+            {
+                m_json["cacheSize"] = json::parse(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--policy",
+            "The order in which released chunks are evicted: \"lru\", "
+            "\"deepest\", or \"shallowest\", or a list of them to compare "
+            "(default: \"lru\").\n"
+            "Example: --policy deepest, --policy [\"lru\", \"deepest\"]",
+            [this](json j)
+            {
+                const std::string s(j.get<std::string>());
+                m_json["policy"] = s.size() && s[0] == '[' ? json::parse(s) : j;
+            });
+
+    m_ap.add(
+            "--report",
+            "If provided, the results are also written to this path as "
+            "JSON.\n"
+            "Example: --report results.json",
+            [this](json j) { m_json["report"] = j; });
+
+    addConfig();
+    addArbiter();
+}
+
+void Replay::run()
+{
+    if (!m_json.count("input"))
+    {
+        throw std::runtime_error("Missing access trace to replay");
+    }
+
+    const std::string path(m_json.at("input").get<std::string>());
+    std::cout << "Reading " << path << std::endl;
+    const std::vector<accessTrace::Record> records(accessTrace::read(path));
+
+    const json sizes(m_json.value("cacheSize", json(heuristics::cacheSize)));
+    const json policies(m_json.value("policy", json("lru")));
+
+    json results = json::array();
+    for (const json& size : asList(sizes))
+    {
+        for (const json& name : asList(policies))
+        {
+            const replay::Policy policy(
+                replay::toPolicy(name.get<std::string>()));
+            const uint64_t cacheSize(size.get<uint64_t>());
+
+            json result(
+                replay::toJson(replay::run(records, cacheSize, policy)));
+            result["cacheSize"] = cacheSize;
+            result["policy"] = replay::toString(policy);
+            results.push_back(result);
+        }
+    }
+
+    const json report {
+        { "trace", replay::summarize(records) },
+        { "results", results }
+    };
+
+    std::cout << report.dump(2) << std::endl;
+
+    if (m_json.count("report"))
+    {
+        config::getArbiter(m_json).put(
+            m_json.at("report").get<std::string>(),
+            report.dump(2));
+    }
+}
+
+} // namespace app
+} // namespace entwine
@@ -0,0 +1,73 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "serve.hpp"
+
+#include <iostream>
+#include <string>
+
+#include <entwine/reader/reader.hpp>
+#include <entwine/reader/server.hpp>
+#include <entwine/types/endpoints.hpp>
+#include <entwine/util/config.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+void Serve::addArgs()
+{
+    m_ap.setUsage("entwine serve <path> (<options>)");
+
+    addOutput("Path of the EPT dataset to serve", true);
+    addConfig();
+    addTmp();
+    addSimpleThreads();
+
+    m_ap.add(
+            "--port",
+            "Port on which to serve.  Default: 8080.\n"
+            "Example: --port 8080",
+            [this](json j) { m_json["port"] = extract(j); });
+
+    m_ap.add(
+            "--cache",
+            "Maximum bytes of responses to hold in memory.  "
+            "Default: 1000000000.\n"
+            "Example: --cache 4000000000",
+            [this](json j) { m_json["cache"] = extract(j); });
+
+    addReadCache();
+    addArbiter();
+}
+
+void Serve::run()
+{
+    const Endpoints endpoints = config::getEndpoints(m_json);
+    const unsigned threads = config::getThreads(m_json);
+    const uint64_t port = m_json.value("port", 8080);
+    const uint64_t cache = m_json.value("cache", 1000000000ull);
+
+    if (!endpoints.output.tryGetSize("ept.json"))
+    {
+        throw std::runtime_error("No completed dataset exists here");
+    }
+
+    Reader reader(endpoints, threads);
+    Server server(reader, port, threads, cache);
+
+    std::cout << "Serving " << endpoints.output.prefixedRoot() <<
+        " on port " << port << std::endl;
+    server.run();
+}
+
+} // namespace app
+} // namespace entwine
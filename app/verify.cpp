@@ -0,0 +1,113 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include "verify.hpp"
+
+#include <iostream>
+#include <string>
+
+#include <entwine/reader/reader.hpp>
+#include <entwine/reader/verify.hpp>
+#include <entwine/types/endpoints.hpp>
+#include <entwine/util/config.hpp>
+
+namespace entwine
+{
+namespace app
+{
+
+namespace
+{
+
+std::string perSecond(const double n, const double seconds)
+{
+    return commify(seconds > 0 ? uint64_t(n / seconds) : uint64_t(n));
+}
+
+} // unnamed namespace
+
+void Verify::addArgs()
+{
+    m_ap.setUsage("entwine verify <path> (<options>)");
+
+    addOutput("Path of the EPT dataset to verify", true);
+    addConfig();
+    addTmp();
+    addSimpleThreads();
+
+    m_ap.add(
+            "--sample",
+            "The fraction of nodes, from 0 to 1, which are decoded to check "
+            "their point counts and bounds against the hierarchy.  By "
+            "default, only the existence of each node is checked.\n"
+            "Example: --sample 0.01",
+            [this](json j)
+            {
+                m_json["sample"] = std::stod(j.get<std::string>());
+            });
+
+    m_ap.add(
+            "--full",
+            "Decode every node, as if --sample 1 were given.",
+            [this](json j)
+            {
+                checkEmpty(j);
+                m_json["full"] = true;
+            });
+
+    addReadCache();
+    addArbiter();
+}
+
+void Verify::run()
+{
+    const Endpoints endpoints = config::getEndpoints(m_json);
+    const unsigned threads = config::getThreads(m_json);
+
+    if (!endpoints.output.tryGetSize("ept.json"))
+    {
+        throw std::runtime_error("No completed dataset exists here");
+    }
+
+    const double sample =
+        m_json.value("full", false) ? 1.0 : m_json.value("sample", 0.0);
+
+    Reader reader(endpoints, threads);
+
+    std::cout << "Verifying " << endpoints.output.prefixedRoot() << std::endl;
+    const verifier::Report report =
+        verifier::verify(reader, sample);
+
+    std::cout << "Checked " << commify(report.objects) << " objects of " <<
+        commify(report.nodes) << " nodes in " << report.checkSeconds <<
+        " seconds (" << perSecond(report.objects, report.checkSeconds) <<
+        " objects/s)" << std::endl;
+
+    if (report.decoded)
+    {
+        std::cout << "Decoded " << commify(report.decoded) << " nodes of " <<
+            commify(report.points) << " points in " << report.decodeSeconds <<
+            " seconds (" << perSecond(report.points, report.decodeSeconds) <<
+            " points/s)" << std::endl;
+    }
+
+    for (const std::string& e : report.errors) std::cout << "\t" << e << "\n";
+
+    if (report.errorCount)
+    {
+        throw std::runtime_error(
+            "Verification failed with " + commify(report.errorCount) +
+            " errors");
+    }
+    std::cout << "Verified" << std::endl;
+}
+
+} // namespace app
+} // namespace entwine
@@ -0,0 +1,613 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+// Micro-benchmarks of the hot paths of a build, over synthetic points.  Each
+// benchmark is run several times per distribution, and its timings are
+// reported as JSON so that the results of different commits may be compared.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "arg-parser.hpp"
+
+#include <entwine/builder/chunk.hpp>
+#include <entwine/builder/chunk-cache.hpp>
+#include <entwine/builder/clipper.hpp>
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/builder/resident.hpp>
+#include <entwine/io/binary.hpp>
+#include <entwine/io/zstandard.hpp>
+#include <entwine/types/dimension.hpp>
+#include <entwine/types/endpoints.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/types/version.hpp>
+#include <entwine/types/voxel.hpp>
+#include <entwine/util/config.hpp>
+#include <entwine/util/synthetic.hpp>
+#include <entwine/util/time.hpp>
+
+using namespace entwine;
+
+namespace
+{
+
+struct Options
+{
+    uint64_t points = 1000000;
+    uint64_t iterations = 5;
+    uint64_t seed = 0;
+    uint64_t span = 128;
+    uint64_t threads = 4;
+    StringList distributions = synthetic::distributions();
+    std::string filter;
+    std::string output;
+    std::string tmp = arbiter::getTempPath();
+};
+
+uint64_t toNumber(const json& j)
+{
+    return json::parse(j.get<std::string>()).get<uint64_t>();
+}
+
+// Keeps results observable so the optimizer cannot discard our work.
+volatile uint64_t sink(0);
+
+json summarize(std::vector<double> seconds, const uint64_t items)
+{
+    std::sort(seconds.begin(), seconds.end());
+    const double median(seconds[seconds.size() / 2]);
+    return {
+        { "items", items },
+        { "iterations", seconds.size() },
+        { "min", seconds.front() },
+        { "median", median },
+        { "max", seconds.back() },
+        { "itemsPerSecond", median > 0 ? items / median : 0 }
+    };
+}
+
+// A scratch directory for our output, removed along with its contents.
+class Scratch
+{
+public:
+    Scratch(const std::string& tmp, const std::string& name)
+        : m_root(
+            arbiter::join(tmp, "entwine-bench-" + std::to_string(::getpid())))
+        , m_path(arbiter::join(m_root, name))
+    {
+        arbiter::mkdirp(m_path);
+    }
+
+    ~Scratch()
+    {
+        const arbiter::Arbiter a;
+        for (const std::string& f : a.resolve(arbiter::join(m_path, "**")))
+        {
+            arbiter::remove(f);
+        }
+        for (const char* sub : { "ept-data", "ept-hierarchy", "ept-sources" })
+        {
+            arbiter::remove(arbiter::join(m_path, sub));
+        }
+        arbiter::remove(m_path);
+        arbiter::remove(m_root);
+    }
+
+    const std::string& path() const { return m_path; }
+
+private:
+    const std::string m_root;
+    const std::string m_path;
+};
+
+// The points of one distribution, along with a small schema resembling that
+// of typical LAS data.
+class Dataset
+{
+public:
+    Dataset(
+            const Options& options,
+            const synthetic::Distribution distribution)
+        : m_bounds(0, 0, 0, 10000, 10000, 1000)
+        , m_metadata(config::getMetadata(json {
+                { "bounds", m_bounds },
+                { "schema", Schema {
+                    { "X", Type::Double },
+                    { "Y", Type::Double },
+                    { "Z", Type::Double },
+                    { "Intensity", Type::Unsigned16 },
+                    { "Classification", Type::Unsigned8 },
+                    { "GpsTime", Type::Double }
+                } },
+                { "span", options.span },
+                { "dataType", io::Type::Binary }
+            }))
+        , m_layout(toLayout(m_metadata.absoluteSchema))
+        , m_points(
+            synthetic::generate(
+                distribution,
+                options.points,
+                m_bounds,
+                options.seed))
+        , m_block(m_layout.pointSize(), 4096)
+    {
+        const uint64_t x(m_layout.dimOffset(DimId::X));
+        const uint64_t y(m_layout.dimOffset(DimId::Y));
+        const uint64_t z(m_layout.dimOffset(DimId::Z));
+        const uint64_t in(m_layout.dimOffset(DimId::Intensity));
+        const uint64_t cl(m_layout.dimOffset(DimId::Classification));
+        const uint64_t gt(m_layout.dimOffset(DimId::GpsTime));
+
+        for (uint64_t i(0); i < m_points.size(); ++i)
+        {
+            const Point& p(m_points[i]);
+            const uint16_t intensity(i * 7919 % 4096);
+            const uint8_t classification(p.z < 300 ? 2 : 1);
+            const double time(i * 0.0001);
+
+            char* pos(m_block.next());
+            std::memcpy(pos + x, &p.x, sizeof(double));
+            std::memcpy(pos + y, &p.y, sizeof(double));
+            std::memcpy(pos + z, &p.z, sizeof(double));
+            std::memcpy(pos + in, &intensity, sizeof(intensity));
+            std::memcpy(pos + cl, &classification, sizeof(classification));
+            std::memcpy(pos + gt, &time, sizeof(double));
+        }
+    }
+
+    const Metadata& metadata() const { return m_metadata; }
+    FixedPointLayout& layout() { return m_layout; }
+    const std::vector<Point>& points() const { return m_points; }
+    const MemBlock& block() const { return m_block; }
+
+    // A copy of our points in the resident layout, clipped to our scale, since
+    // insertion modifies the point data it is given.
+    MemBlock resident(std::vector<Voxel>& voxels) const
+    {
+        const Resident resident(m_metadata);
+        const auto so(getScaleOffset(m_metadata.schema));
+
+        MemBlock block(resident.pointSize(), 4096);
+        voxels.clear();
+        voxels.reserve(m_points.size());
+
+        uint64_t i(0);
+        for (const PointSpan& span : m_block.spans())
+        {
+            const char* pos(span.data);
+            for (uint64_t j(0); j < span.size; ++j, ++i)
+            {
+                char* dst(block.next());
+                if (resident.compact()) resident.fromAbsolute(pos, dst);
+                else std::memcpy(dst, pos, m_layout.pointSize());
+                pos += m_layout.pointSize();
+
+                Voxel voxel;
+                voxel.initShallow(m_points[i], dst);
+                if (so) voxel.clip(*so);
+                voxels.push_back(voxel);
+            }
+        }
+
+        return block;
+    }
+
+private:
+    const Bounds m_bounds;
+    const Metadata m_metadata;
+    FixedPointLayout m_layout;
+    const std::vector<Point> m_points;
+    MemBlock m_block;
+};
+
+// Runs a single iteration of a benchmark, returning its duration in seconds.
+// Any setup which should not be measured happens outside of the timer.
+using Iteration = std::function<double()>;
+
+template <typename F>
+double measure(F f)
+{
+    const TimePoint start(now());
+    f();
+    return since<std::chrono::nanoseconds>(start) / 1e9;
+}
+
+class Runner
+{
+public:
+    Runner(const Options& options) : m_options(options) { }
+
+    void run(
+        const std::string& name,
+        const std::string& distribution,
+        uint64_t items,
+        Iteration iteration)
+    {
+        if (name.find(m_options.filter) == std::string::npos) return;
+
+        std::cerr << "\t" << name << "..." << std::endl;
+
+        std::vector<double> seconds;
+        for (uint64_t i(0); i < m_options.iterations; ++i)
+        {
+            seconds.push_back(iteration());
+        }
+
+        json result(summarize(seconds, items));
+        result["name"] = name;
+        result["distribution"] = distribution;
+        m_results.push_back(result);
+    }
+
+    const json& results() const { return m_results; }
+
+private:
+    const Options& m_options;
+    json m_results = json::array();
+};
+
+void benchKeys(Runner& runner, const std::string& name, Dataset& dataset)
+{
+    const Metadata& m(dataset.metadata());
+    const auto& points(dataset.points());
+    const uint64_t depth(10);
+
+    runner.run("key-init", name, points.size(), [&]()
+    {
+        Key key(m.bounds, getStartDepth(m));
+        return measure([&]()
+        {
+            for (const Point& p : points)
+            {
+                key.init(p, depth);
+                sink += key.position().x;
+            }
+        });
+    });
+
+    runner.run("key-init-chunk", name, points.size(), [&]()
+    {
+        ChunkKey ck(m.bounds, getStartDepth(m));
+        Key key(m.bounds, getStartDepth(m));
+        return measure([&]()
+        {
+            for (const Point& p : points)
+            {
+                ck.init(p, depth);
+                key.init(p, ck);
+                sink += key.position().x;
+            }
+        });
+    });
+}
+
+void benchInsert(
+    Runner& runner,
+    const Options& options,
+    const std::string& name,
+    Dataset& dataset)
+{
+    const Metadata& m(dataset.metadata());
+    const uint64_t np(dataset.points().size());
+    auto a(std::make_shared<arbiter::Arbiter>());
+
+    // Insertion into a single chunk, whose losers are held as overflow until
+    // they are split into the cache.
+    runner.run("chunk-insert", name, np, [&]()
+    {
+        Scratch scratch(options.tmp, "chunk-insert");
+        const Endpoints endpoints(a, scratch.path(), scratch.path());
+        Hierarchy hierarchy;
+        ChunkCache cache(endpoints, m, hierarchy, options.threads);
+
+        std::vector<Voxel> voxels;
+        MemBlock block(dataset.resident(voxels));
+
+        const ChunkKey ck(m.bounds, getStartDepth(m));
+        double seconds(0);
+        {
+            Clipper clipper(cache);
+            Chunk chunk(m, ck, hierarchy);
+            Key key(m.bounds, getStartDepth(m));
+
+            seconds = measure([&]()
+            {
+                for (Voxel& voxel : voxels)
+                {
+                    key.init(voxel.point());
+                    sink += chunk.insert(cache, clipper, voxel, key);
+                }
+            });
+        }
+        cache.join();
+        return seconds;
+    });
+
+    // Insertion into the whole tree, in groups, as performed by a build.
+    runner.run("cache-insert", name, np, [&]()
+    {
+        Scratch scratch(options.tmp, "cache-insert");
+        const Endpoints endpoints(a, scratch.path(), scratch.path());
+        Hierarchy hierarchy;
+        ChunkCache cache(endpoints, m, hierarchy, options.threads);
+
+        std::vector<Voxel> voxels;
+        MemBlock block(dataset.resident(voxels));
+
+        const ChunkKey ck(m.bounds, getStartDepth(m));
+        const uint64_t batch(4096);
+        double seconds(0);
+        {
+            Clipper clipper(cache);
+            Key key(m.bounds, getStartDepth(m));
+            Insertions group;
+
+            seconds = measure([&]()
+            {
+                for (uint64_t i(0); i < voxels.size(); i += batch)
+                {
+                    const uint64_t end(std::min<uint64_t>(i + batch, np));
+                    for (uint64_t j(i); j < end; ++j)
+                    {
+                        key.init(voxels[j].point());
+                        group.emplace_back(voxels[j], key);
+                    }
+                    cache.insert(group, ck, clipper);
+                    group.clear();
+                }
+            });
+        }
+        cache.join();
+        return seconds;
+    });
+
+    // Insertion of single points in scanline order, whose chunk lookups
+    // alternate between neighbors at each depth.
+    runner.run("cache-insert-scanline", name, np, [&]()
+    {
+        Scratch scratch(options.tmp, "cache-insert-scanline");
+        const Endpoints endpoints(a, scratch.path(), scratch.path());
+        Hierarchy hierarchy;
+        ChunkCache cache(endpoints, m, hierarchy, options.threads);
+
+        std::vector<Voxel> voxels;
+        MemBlock block(dataset.resident(voxels));
+        std::sort(
+            voxels.begin(),
+            voxels.end(),
+            [](const Voxel& a, const Voxel& b)
+            {
+                const Point& pa(a.point());
+                const Point& pb(b.point());
+                return pa.y < pb.y || (pa.y == pb.y && pa.x < pb.x);
+            });
+
+        const ChunkKey ck(m.bounds, getStartDepth(m));
+        double seconds(0);
+        {
+            Clipper clipper(cache);
+            Key key(m.bounds, getStartDepth(m));
+
+            seconds = measure([&]()
+            {
+                for (Voxel& voxel : voxels)
+                {
+                    key.init(voxel.point());
+                    cache.insert(voxel, key, ck, clipper);
+                }
+            });
+        }
+        cache.join();
+        return seconds;
+    });
+}
+
+void benchSerialization(Runner& runner, const std::string& name, Dataset& d)
+{
+    const Metadata& m(d.metadata());
+    const uint64_t np(d.points().size());
+
+    BlockPointTable table(d.layout());
+    table.insert(d.block());
+
+    const std::vector<char> packed(io::binary::pack(m, table));
+    const std::vector<char> compressed(io::zstandard::compress(m, packed));
+
+    runner.run("binary-pack", name, np, [&]()
+    {
+        return measure([&]() { sink += io::binary::pack(m, table).size(); });
+    });
+
+    runner.run("binary-unpack", name, np, [&]()
+    {
+        std::vector<char> copy(packed);
+        VectorPointTable dst(d.layout(), np);
+        return measure([&]()
+        {
+            io::binary::unpack(m, dst, std::move(copy));
+        });
+    });
+
+    runner.run("zstd-compress", name, np, [&]()
+    {
+        return measure([&]()
+        {
+            sink += io::zstandard::compress(m, packed).size();
+        });
+    });
+
+    runner.run("zstd-decompress", name, np, [&]()
+    {
+        return measure([&]()
+        {
+            sink += io::zstandard::decompress(compressed).size();
+        });
+    });
+}
+
+void benchHierarchy(
+    Runner& runner,
+    const Options& options,
+    const std::string& name,
+    Dataset& dataset)
+{
+    const Metadata& m(dataset.metadata());
+    const uint64_t maxDepth(8);
+
+    // Count each point at every depth, as if each node held all of its
+    // points, for a hierarchy shaped like that of a real build.
+    Hierarchy hierarchy;
+    for (const Point& p : dataset.points())
+    {
+        ChunkKey ck(m.bounds, getStartDepth(m));
+        while (ck.depth() < maxDepth)
+        {
+            const Dxyz dxyz(ck.dxyz());
+            hierarchy::set(
+                hierarchy,
+                dxyz,
+                hierarchy::get(hierarchy, dxyz) + 1);
+            ck.step(p);
+        }
+    }
+
+    const uint64_t nodes(hierarchy.size());
+    const unsigned threads(options.threads);
+    const unsigned step(hierarchy::determineStep(hierarchy));
+
+    Scratch scratch(options.tmp, "hierarchy");
+    const arbiter::Arbiter a;
+    const arbiter::Endpoint ep(a.getEndpoint(scratch.path()));
+
+    runner.run("hierarchy-save", name, nodes, [&]()
+    {
+        return measure([&]()
+        {
+            hierarchy::save(hierarchy, ep, step, threads);
+        });
+    });
+
+    runner.run("hierarchy-load", name, nodes, [&]()
+    {
+        return measure([&]()
+        {
+            sink += hierarchy::load(ep, threads).size();
+        });
+    });
+}
+
+} // unnamed namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    ArgParser ap;
+    ap.setUsage("entwine-bench (<options>)");
+    ap.add(
+            "--points",
+            "Number of points per distribution (default: 1000000)",
+            [&](json j) { options.points = toNumber(j); });
+    ap.add(
+            "--iterations",
+            "Number of runs of each benchmark, whose median is reported "
+            "(default: 5)",
+            [&](json j) { options.iterations = toNumber(j); });
+    ap.add(
+            "--seed",
+            "Seed for point generation (default: 0)",
+            [&](json j) { options.seed = toNumber(j); });
+    ap.add(
+            "--span",
+            "Number of voxels in each spatial dimension of a node "
+            "(default: 128)",
+            [&](json j) { options.span = toNumber(j); });
+    ap.add(
+            "--threads",
+            "Threads for serialization and hierarchy I/O (default: 4)",
+            [&](json j) { options.threads = toNumber(j); });
+    ap.add(
+            "--distributions",
+            "Point distributions to generate, of: uniform, clustered, "
+            "terrain, strips (default: all)",
+            [&](json j)
+            {
+                options.distributions.clear();
+                const json list(j.is_array() ? j : json::array({ j }));
+                for (const json& d : list)
+                {
+                    options.distributions.push_back(d.get<std::string>());
+                }
+            });
+    ap.add(
+            "--filter",
+            "Only run benchmarks whose names contain this string",
+            [&](json j) { options.filter = j.get<std::string>(); });
+    ap.add(
+            "--output",
+            "Write results to this file rather than to stdout",
+            [&](json j) { options.output = j.get<std::string>(); });
+    ap.add(
+            "--tmp",
+            "Directory for scratch output, which is removed afterward",
+            [&](json j) { options.tmp = j.get<std::string>(); });
+
+    try
+    {
+        if (!ap.handle(StringList(argv + 1, argv + argc))) return 1;
+        if (!options.points) throw std::runtime_error("No points requested");
+        if (!options.iterations) options.iterations = 1;
+
+        Runner runner(options);
+        for (const std::string& name : options.distributions)
+        {
+            std::cerr << "Generating " << name << "..." << std::endl;
+            Dataset dataset(options, synthetic::toDistribution(name));
+
+            benchKeys(runner, name, dataset);
+            benchInsert(runner, options, name, dataset);
+            benchSerialization(runner, name, dataset);
+            benchHierarchy(runner, options, name, dataset);
+        }
+
+        const json out {
+            { "version", currentEntwineVersion().toString() },
+            { "options", {
+                { "points", options.points },
+                { "iterations", options.iterations },
+                { "seed", options.seed },
+                { "span", options.span },
+                { "threads", options.threads }
+            } },
+            { "results", runner.results() }
+        };
+
+        if (options.output.empty()) std::cout << out.dump(2) << std::endl;
+        else std::ofstream(options.output) << out.dump(2) << std::endl;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
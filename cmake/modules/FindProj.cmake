@@ -0,0 +1,11 @@
+find_path(PROJ_INCLUDE_DIR NAMES proj.h)
+find_library(PROJ_LIBRARY NAMES proj)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Proj
+    REQUIRED_VARS PROJ_INCLUDE_DIR PROJ_LIBRARY)
+
+if (PROJ_FOUND)
+    set(PROJ_LIBRARIES ${PROJ_LIBRARY})
+    set(PROJ_INCLUDE_DIRS ${PROJ_INCLUDE_DIR})
+endif()
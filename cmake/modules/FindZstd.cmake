@@ -1,7 +1,9 @@
 find_path(ZSTD_INCLUDE_DIR NAMES zstd.h)
 find_library(ZSTD_LIBRARY NAMES zstd)
 
-find_package_handle_standard_args(ZSTD ZSTD_INCLUDE_DIR ZSTD_LIBRARY)
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Zstd
+    REQUIRED_VARS ZSTD_INCLUDE_DIR ZSTD_LIBRARY)
 
 if (ZSTD_FOUND)
     set(ZSTD_LIBRARIES ${ZSTD_LIBRARY})
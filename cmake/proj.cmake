@@ -0,0 +1,4 @@
+find_package(Proj)
+if (PROJ_FOUND)
+    set(PROJ_DEFS ENTWINE_HAVE_PROJ)
+endif()
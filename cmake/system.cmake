@@ -19,14 +19,19 @@ function(compiler_options target)
             ${CURL_DEFS}
             ${OPENSSL_DEFS}
 			${BACKTRACE_DEFS}
+            ${PROJ_DEFS}
+            ${ZLIB_DEFS}
     )
     target_include_directories(${target}
         PRIVATE
 			${ROOT_DIR}
             ${PROJECT_BINARY_DIR}/include
             ${PDAL_INCLUDE_DIRS}
+            ${PROJ_INCLUDE_DIRS}
             ${CURL_INCLUDE_DIR}
             ${OPENSSL_INCLUDE_DIR}
+            ${ZLIB_INCLUDE_DIRS}
+            ${ZSTD_INCLUDE_DIRS}
             ${LASZIP_DIRECTORIES}
 			${JSONCPP_INCLUDE_DIR}
     )
@@ -0,0 +1,8 @@
+find_package(ZLIB)
+if (ZLIB_FOUND)
+    set(ARBITER_ZLIB TRUE)
+    set(ENTWINE_ZLIB TRUE)
+    set(ZLIB_DEFS ARBITER_ZLIB ENTWINE_ZLIB)
+else()
+    message("zlib NOT found - gzip content encoding will not be available")
+endif()
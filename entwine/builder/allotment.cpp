@@ -0,0 +1,111 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/allotment.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+namespace entwine
+{
+
+namespace
+{
+
+// Runs a task of an allotment, freeing its place once the task completes,
+// even if it throws.
+class Admitted
+{
+public:
+    Admitted(Task task, std::function<void()> done)
+        : m_task(std::move(task))
+        , m_done(std::move(done))
+    { }
+
+    void operator()()
+    {
+        struct Release
+        {
+            ~Release() { done(); }
+            std::function<void()>& done;
+        } release { m_done };
+
+        m_task();
+    }
+
+private:
+    Task m_task;
+    std::function<void()> m_done;
+};
+
+} // unnamed namespace
+
+Allotment::Allotment(
+    Pool& pool,
+    std::atomic_uint64_t& resident,
+    const uint64_t memory,
+    const uint64_t threads)
+    : m_pool(pool)
+    , m_resident(resident)
+    , m_memory(memory)
+    , m_threads(std::max<uint64_t>(threads, 1))
+{ }
+
+uint64_t Allotment::threads() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_threads;
+}
+
+void Allotment::threads(const uint64_t n)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_threads = std::max<uint64_t>(n, 1);
+    }
+    m_cv.notify_all();
+}
+
+void Allotment::add(Task task)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return m_running < m_threads; });
+        ++m_running;
+    }
+
+    try
+    {
+        m_pool.add(Admitted(std::move(task), [this]() { done(); }));
+    }
+    catch (...)
+    {
+        done();
+        throw;
+    }
+}
+
+void Allotment::await()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return !m_running; });
+}
+
+void Allotment::done()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_running;
+    }
+    m_cv.notify_all();
+}
+
+} // namespace entwine
@@ -0,0 +1,72 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+// A single build's share of the pool and memory budget of a Scheduler, which
+// runs many builds at once.  The inserts of the build are added to the shared
+// pool through its allotment, which admits only as many of them at a time as
+// its share of threads, so that no build crowds out the others.  The points
+// held in memory by every build count against the single budget, if one is
+// set, so the memory freed by a finished build goes to those still running.
+class Allotment
+{
+public:
+    Allotment(
+        Pool& pool,
+        std::atomic_uint64_t& resident,
+        uint64_t memory,
+        uint64_t threads);
+
+    uint64_t threads() const;
+
+    // Rebalanced by our scheduler as builds start and finish.  A narrowed
+    // allotment lets its running tasks finish, and admits no more until it
+    // is back within its share.
+    void threads(uint64_t n);
+
+    // Add a task to the shared pool, blocking until fewer than our share of
+    // threads are running our earlier tasks.
+    void add(Task task);
+
+    // Wait for every task we have added to complete.
+    void await();
+
+    void addResident(uint64_t bytes) { m_resident += bytes; }
+    void removeResident(uint64_t bytes) { m_resident -= bytes; }
+    bool overBudget() const { return m_memory && m_resident >= m_memory; }
+
+private:
+    void done();
+
+    Pool& m_pool;
+    std::atomic_uint64_t& m_resident;
+    const uint64_t m_memory;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    uint64_t m_threads;
+    uint64_t m_running = 0;
+
+    Allotment(const Allotment&) = delete;
+    Allotment& operator=(const Allotment&) = delete;
+};
+
+} // namespace entwine
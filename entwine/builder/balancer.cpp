@@ -0,0 +1,99 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/balancer.hpp>
+
+#include <chrono>
+#include <iostream>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/util/metrics.hpp>
+
+namespace entwine
+{
+
+Balancer::Balancer(Throttle& work, Throttle& clip, const uint64_t maxWork)
+    : m_work(work)
+    , m_clip(clip)
+    , m_maxWork(maxWork)
+    , m_total(work.limit() + clip.limit())
+    , m_lastWait(metrics::timers()[
+        static_cast<std::size_t>(metrics::Timer::ClipWait)].load())
+    , m_thread([this]() { run(); })
+{ }
+
+Balancer::~Balancer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+void Balancer::run()
+{
+    const std::chrono::milliseconds interval(heuristics::balanceIntervalMs);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_cv.wait_for(lock, interval, [this]() { return m_done; }))
+    {
+        step(interval.count() / 1000.0);
+    }
+}
+
+void Balancer::step(const double seconds)
+{
+    const uint64_t wait(
+        metrics::timers()[
+            static_cast<std::size_t>(metrics::Timer::ClipWait)].load());
+    const double waited((wait - m_lastWait) / 1000000000.0);
+    m_lastWait = wait;
+
+    const uint64_t work(m_work.limit());
+    const uint64_t clip(m_clip.limit());
+
+    // The fraction of the work threads' time spent blocked while queueing
+    // chunks for serialization.
+    const double stalled(waited / (seconds * work));
+
+    uint64_t next(work);
+    if (stalled > heuristics::balanceStallHigh && work > 1) --next;
+    else if (
+        stalled < heuristics::balanceStallLow &&
+        clip > 1 &&
+        work < m_maxWork &&
+        metrics::gauges()[
+            static_cast<std::size_t>(metrics::Gauge::SerializeQueue)] <= 0)
+    {
+        ++next;
+    }
+
+    if (next == work) return;
+
+    // Widen one side only after narrowing the other, so that the limits never
+    // sum to more than our total.
+    if (next < work)
+    {
+        m_work.limit(next);
+        m_clip.limit(m_total - next);
+    }
+    else
+    {
+        m_clip.limit(m_total - next);
+        m_work.limit(next);
+    }
+
+    std::cout << "\tBalanced threads - work: " << next << ", clip: " <<
+        m_total - next << std::endl;
+}
+
+} // namespace entwine
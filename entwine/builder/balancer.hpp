@@ -0,0 +1,56 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include <entwine/util/throttle.hpp>
+
+namespace entwine
+{
+
+// Shifts threads between the work threads, which read and insert points, and
+// the clip threads, which serialize chunks, while a build runs.  Both pools
+// are sized for more threads than they begin with, and throttled to their
+// current shares of the total.
+//
+// A thread moves toward clipping while the work threads spend much of their
+// time blocked on a backlog of chunks to be serialized, and back toward work
+// while they spend almost none.
+class Balancer
+{
+public:
+    Balancer(Throttle& work, Throttle& clip, uint64_t maxWork);
+    ~Balancer();
+
+private:
+    void run();
+    void step(double seconds);
+
+    Throttle& m_work;
+    Throttle& m_clip;
+    const uint64_t m_maxWork;
+    const uint64_t m_total;
+
+    uint64_t m_lastWait = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_done = false;
+    std::thread m_thread;
+
+    Balancer(const Balancer& other) = delete;
+};
+
+} // namespace entwine
@@ -0,0 +1,127 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/bucket.hpp>
+
+#include <array>
+#include <stdexcept>
+
+namespace entwine
+{
+namespace bucket
+{
+
+namespace
+{
+
+// Spread the low 21 bits of v so that each is followed by two zeros.
+uint64_t spread(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x1f00000000ffffull;
+    v = (v | (v << 16)) & 0x1f0000ff0000ffull;
+    v = (v | (v << 8)) & 0x100f00f00f00f00full;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+    v = (v | (v << 2)) & 0x1249249249249249ull;
+    return v;
+}
+
+uint64_t compact(uint64_t v)
+{
+    v &= 0x1249249249249249ull;
+    v = (v ^ (v >> 2)) & 0x10c30c30c30c30c3ull;
+    v = (v ^ (v >> 4)) & 0x100f00f00f00f00full;
+    v = (v ^ (v >> 8)) & 0x1f0000ff0000ffull;
+    v = (v ^ (v >> 16)) & 0x1f00000000ffffull;
+    v = (v ^ (v >> 32)) & 0x1fffff;
+    return v;
+}
+
+const uint64_t digitBits(8);
+const uint64_t digits(1 << digitBits);
+
+} // unnamed namespace
+
+uint64_t toMorton(const Xyz& p)
+{
+    return spread(p.x) | (spread(p.y) << 1) | (spread(p.z) << 2);
+}
+
+void group(
+    const Insertions& list,
+    const Metadata& metadata,
+    const uint64_t depth,
+    Groups& groups)
+{
+    // Positions are relative to our cube, beneath any start depth.
+    const uint64_t levels(getStartDepth(metadata) + depth);
+    if (levels > maxLevels)
+    {
+        throw std::runtime_error("Cannot group points this deep");
+    }
+
+    groups.keys.clear();
+    groups.offsets.clear();
+    groups.order.clear();
+    if (list.empty()) return;
+
+    ChunkKey ck(metadata.bounds, getStartDepth(metadata));
+    std::vector<uint64_t> codes(list.size());
+    for (std::size_t i(0); i < list.size(); ++i)
+    {
+        ck.init(list[i].voxel.point(), depth);
+        codes[i] = toMorton(ck.position());
+    }
+
+    // A least significant digit radix sort is stable, so the points of each
+    // group keep their order.
+    std::vector<uint32_t>& order(groups.order);
+    std::vector<uint32_t> swap(list.size());
+    order.resize(list.size());
+    for (std::size_t i(0); i < order.size(); ++i) order[i] = i;
+
+    for (uint64_t shift(0); shift < 3 * levels; shift += digitBits)
+    {
+        std::array<uint64_t, digits> counts;
+        counts.fill(0);
+        for (const uint32_t i : order) ++counts[(codes[i] >> shift) % digits];
+
+        uint64_t total(0);
+        for (uint64_t& count : counts)
+        {
+            const uint64_t n(count);
+            count = total;
+            total += n;
+        }
+
+        for (const uint32_t i : order)
+        {
+            swap[counts[(codes[i] >> shift) % digits]++] = i;
+        }
+        order.swap(swap);
+    }
+
+    for (std::size_t i(0); i < order.size(); ++i)
+    {
+        const uint64_t code(codes[order[i]]);
+        if (i && code == codes[order[i - 1]]) continue;
+
+        groups.offsets.push_back(i);
+        groups.keys.emplace_back(
+            depth,
+            compact(code),
+            compact(code >> 1),
+            compact(code >> 2));
+    }
+    groups.offsets.push_back(order.size());
+}
+
+} // namespace bucket
+} // namespace entwine
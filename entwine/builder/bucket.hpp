@@ -0,0 +1,55 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <entwine/builder/overflow.hpp>
+#include <entwine/types/key.hpp>
+
+namespace entwine
+{
+namespace bucket
+{
+
+// The deepest level beneath the cube at which cells may be grouped, since
+// each axis is given 21 bits of a 64-bit code.
+const uint64_t maxLevels(21);
+
+// The Morton code of a cell, interleaving the bits of its position as z, y, x
+// from the most significant.  Only the low 21 bits of each axis are kept.
+uint64_t toMorton(const Xyz& p);
+
+// A grouping of points by the cell containing each of them at some depth.
+// Group i holds the points order[offsets[i]] through order[offsets[i + 1]],
+// in their original order, within the cell keys[i].  Groups are ordered by
+// the Morton codes of their cells.
+struct Groups
+{
+    std::vector<Dxyz> keys;
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> order;
+};
+
+// Group these insertions by the cell at this depth which contains each of
+// them.  Their cells are computed directly from their coordinates and then
+// counting-sorted by their codes, so the cost is linear in the points and
+// each group may then be handled without any per-point lookup.  The start
+// depth of the metadata plus this depth may be at most maxLevels.
+void group(
+    const Insertions& list,
+    const Metadata& metadata,
+    uint64_t depth,
+    Groups& groups);
+
+} // namespace bucket
+} // namespace entwine
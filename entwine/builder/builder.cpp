@@ -12,45 +12,505 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <type_traits>
 
 #include <pdal/PipelineManager.hpp>
 
+#include <entwine/builder/allotment.hpp>
+#include <entwine/builder/balancer.hpp>
 #include <entwine/builder/clipper.hpp>
+#include <entwine/builder/derive.hpp>
 #include <entwine/builder/heuristics.hpp>
+#include <entwine/builder/inserter.hpp>
+#include <entwine/builder/node-sizes.hpp>
+#include <entwine/builder/node-stats.hpp>
+#include <entwine/builder/prefetcher.hpp>
+#include <entwine/builder/presort.hpp>
+#include <entwine/builder/profile.hpp>
+#include <entwine/builder/provenance.hpp>
+#include <entwine/builder/resident.hpp>
+#include <entwine/io/io.hpp>
 #include <entwine/types/dimension.hpp>
+#include <entwine/types/point-order.hpp>
 #include <entwine/types/point-counts.hpp>
+#include <entwine/types/stats-accumulator.hpp>
+#include <entwine/util/block-pool.hpp>
 #include <entwine/util/config.hpp>
+#include <entwine/util/ept.hpp>
 #include <entwine/util/fs.hpp>
 #include <entwine/util/io.hpp>
+#include <entwine/util/journal.hpp>
+#include <entwine/util/las.hpp>
+#include <entwine/util/metrics-server.hpp>
+#include <entwine/util/metrics.hpp>
+#include <entwine/util/numa.hpp>
+#include <entwine/util/pack.hpp>
 #include <entwine/util/pdal-mutex.hpp>
 #include <entwine/util/pipeline.hpp>
+#include <entwine/util/queue.hpp>
+#include <entwine/util/reduce.hpp>
+#include <entwine/util/reprojector.hpp>
+#include <entwine/util/spin-lock.hpp>
 #include <entwine/util/time.hpp>
+#include <entwine/util/trace.hpp>
+#include <entwine/util/unique.hpp>
 
 namespace entwine
 {
 
+namespace
+{
+
+bool isNonZero(uint64_t v) { return v != 0; }
+
+// Get the Morton code of the midpoint of these bounds within the cube, so that
+// sorting by this code visits sources in spatially coherent order.
+uint64_t getMortonCode(const Bounds& cube, const Bounds& bounds)
+{
+    return getMortonCode(cube, bounds.mid());
+}
+
+// Fetch a local copy of this file, outside of our prefetcher.
+std::shared_ptr<arbiter::LocalHandle> fetchLocal(
+    const arbiter::Arbiter& a,
+    const std::string& path)
+{
+    auto local(ensureGetLocalHandle(a, path));
+    return std::make_shared<arbiter::LocalHandle>(
+        local.release(),
+        a.isRemote(path));
+}
+
+// The bounds within which points may be inserted by this build or its peers.
+Bounds getActiveBounds(const Builder& builder)
+{
+    Bounds active = getActiveBounds(builder.metadata);
+    for (const Builder* peer : builder.peers)
+    {
+        active.grow(getActiveBounds(peer->metadata));
+    }
+    return active;
+}
+
+// Whether this source is a COPC file.  These are read in place by
+// readers.copc, which fetches and decodes only the chunks it needs, in
+// parallel, rather than being copied locally in their entirety.
+bool isCopc(const BuildItem& item)
+{
+    const json& pipeline(item.source.info.pipeline);
+    const std::string type = pipeline.is_array() && pipeline.size()
+        ? pipeline.at(0).value("type", "")
+        : "";
+    if (!type.empty()) return type == "readers.copc";
+
+    std::string path(item.source.path);
+    std::transform(
+        path.begin(),
+        path.end(),
+        path.begin(),
+        [](unsigned char c) { return std::tolower(c); });
+
+    const std::string copc(".copc.laz");
+    return path.size() >= copc.size() &&
+        path.compare(path.size() - copc.size(), copc.size(), copc) == 0;
+}
+
+// Whether this source is an existing EPT dataset, which is read in place by
+// our own decoding of its nodes.
+bool isEpt(const BuildItem& item)
+{
+    return ept::isNativeCandidate(item.source.info.pipeline);
+}
+
+// Whether this source is read in place rather than from a local copy.
+bool isInPlace(const BuildItem& item)
+{
+    return isCopc(item) || isEpt(item);
+}
+
+// Whether the reader of this source may be given a bounds option, outside of
+// which it skips decoding.
+bool isSpatialReader(const BuildItem& item)
+{
+    const json& pipeline(item.source.info.pipeline);
+    return isCopc(item) || (
+        pipeline.is_array() && pipeline.size() &&
+        pipeline.at(0).value("type", "") == "readers.ept");
+}
+
+// Insert a bucket of a presorted build into the subtree of this chunk key.
+void insertBucket(
+    ChunkCache& cache,
+    const Presort& presort,
+    const Presort::Bucket& bucket,
+    const ChunkKey& ck)
+{
+    trace::Span span("bucket", bucket.dxyz.toString());
+
+    const uint64_t sleepCount(cache.metadata().internal.sleepCount);
+    Clipper clipper(cache);
+    uint64_t sinceClip(0);
+    presort.forEach(bucket, ck, [&](Insertions& list)
+    {
+        const auto start(metrics::Clock::now());
+        cache.insert(list, ck, clipper);
+        metrics::add(metrics::Timer::Insert, metrics::nanosSince(start));
+
+        sinceClip += list.size();
+        if (sinceClip > sleepCount)
+        {
+            sinceClip = 0;
+            clipper.clip();
+        }
+    });
+
+    clipper.clip();
+    arbiter::remove(bucket.path);
+}
+
+// Insert the buckets of the first pass of a presorted build, each of which is
+// inserted entirely by a single thread and then released, so that only the
+// subtrees of the buckets in progress are resident.
+void insertBuckets(
+    ChunkCache& cache,
+    const Presort& presort,
+    const uint64_t threads)
+{
+    const Metadata& m(cache.metadata());
+    const ChunkKey ck(m.bounds, getStartDepth(m));
+    const std::vector<Presort::Bucket> buckets(presort.buckets());
+
+    std::cout << "Inserting " << buckets.size() << " buckets" << std::endl;
+
+    Pool pool(threads);
+    for (const Presort::Bucket& bucket : buckets)
+    {
+        pool.add([&cache, &presort, &ck, bucket]()
+        {
+            insertBucket(cache, presort, bucket, ck);
+        });
+    }
+    pool.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+}
+
+// Our uploader and node cache are joined by us alone, so nodes written outside
+// of our cache are written directly.
+Endpoints getDirectEndpoints(const ChunkCache& cache)
+{
+    Endpoints endpoints(cache.endpoints());
+    endpoints.uploader.reset();
+    endpoints.nodeCache.reset();
+    return endpoints;
+}
+
+// Build each of these buckets, whose keys are at the presort depth, as an
+// independent subtree by a cache and hierarchy of its own, sharing no locks
+// with the others, and merge its hierarchy into ours.
+void buildSubtrees(
+    ChunkCache& cache,
+    Hierarchy& hierarchy,
+    const Presort& split,
+    const uint64_t threads)
+{
+    const Metadata& m(cache.metadata());
+
+    // Each subtree has a share of our memory budget, and writes its nodes
+    // directly.  Its shallow depths are never reached.
+    Metadata sub(m);
+    sub.internal.memory = m.internal.memory / std::max<uint64_t>(threads, 1);
+    sub.internal.overflowThreads = 0;
+    sub.internal.uploadThreads = 0;
+    sub.internal.nodeCache = 0;
+    sub.internal.nodePrefetch = 0;
+    sub.internal.pinnedDepth = 0;
+    sub.internal.stagingDepth = 0;
+
+    const std::vector<Presort::Bucket> buckets(split.buckets());
+    std::cout << "Building " << buckets.size() << " subtrees" << std::endl;
+
+    const uint64_t depth(m.internal.presortDepth);
+    const Endpoints endpoints(getDirectEndpoints(cache));
+
+    Pool pool(threads);
+    for (const Presort::Bucket& bucket : buckets)
+    {
+        pool.add([&, bucket]()
+        {
+            ChunkKey ck(sub.bounds, getStartDepth(sub));
+            ck.init(bucket.dxyz);
+
+            Hierarchy fragment;
+            {
+                ChunkCache subtree(endpoints, sub, fragment, 1);
+                insertBucket(subtree, split, bucket, ck);
+                subtree.join();
+            }
+
+            Hierarchy::Entries entries;
+            fragment.forEach([&](const Dxyz& key, const int64_t n)
+            {
+                if (key.d >= depth && n) entries.emplace_back(key, n);
+            });
+            hierarchy.set(entries);
+        });
+    }
+    pool.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+}
+
+// Insert the buckets of a presorted build in two phases.  First, the nodes
+// above the presort depth are built by a shared cache, which diverts the
+// points reaching that depth into a bucket for each subtree beneath it.  Then
+// each subtree is built from its bucket independently.
+void insertSplit(
+    ChunkCache& cache,
+    Hierarchy& hierarchy,
+    const Presort& presort,
+    const uint64_t threads)
+{
+    const Metadata& m(cache.metadata());
+    Presort split(m, presort.dir() + "-split", presort.pointSize());
+
+    cache.setSplit(&split);
+    insertBuckets(cache, presort, threads);
+    cache.setSplit(nullptr);
+
+    buildSubtrees(cache, hierarchy, split, threads);
+}
+
+// Build a presorted build from the bottom up.  Each bucket is built as an
+// independent subtree, without passing through the nodes above the presort
+// depth, which are then derived from the subtrees beneath them.
+void insertBottomUp(
+    ChunkCache& cache,
+    Hierarchy& hierarchy,
+    const Presort& presort,
+    const uint64_t threads)
+{
+    const Metadata& m(cache.metadata());
+    buildSubtrees(cache, hierarchy, presort, threads);
+    deriveParents(
+        m,
+        getDirectEndpoints(cache),
+        hierarchy,
+        m.internal.presortDepth,
+        threads);
+}
+
+} // unnamed namespace
+
 Builder::Builder(
     Endpoints endpoints,
     Metadata metadata,
     Manifest manifest,
     Hierarchy hierarchy)
-    : endpoints(endpoints)
-    , metadata(metadata)
-    , manifest(manifest)
-    , hierarchy(hierarchy)
-{ }
+    : endpoints(std::move(endpoints))
+    , metadata(std::move(metadata))
+    , manifest(std::move(manifest))
+    , hierarchy(std::move(hierarchy))
+{
+    // Our arguments have been moved from, so use our members.
+    if (this->metadata.internal.append)
+    {
+        for (const BuildItem& item : this->manifest)
+        {
+            settled.push_back(isSettled(item));
+        }
+        settledSchema = this->metadata.schema;
+    }
+}
+
+void Builder::prepare()
+{
+    BlockPool::get().hugePages(metadata.internal.hugePages);
+
+    if (metadata.internal.nodeStats && !metadata.subset)
+    {
+        endpoints.nodeStats =
+            std::make_shared<NodeStats>(metadata.absoluteSchema);
+    }
+    if (metadata.internal.nodeSizes && !metadata.subset)
+    {
+        endpoints.nodeSizes = std::make_shared<NodeSizes>();
+    }
+    if (
+        metadata.internal.provenance &&
+        !metadata.subset &&
+        contains(metadata.absoluteSchema, "OriginId") &&
+        contains(metadata.absoluteSchema, "PointId"))
+    {
+        endpoints.provenance = std::make_shared<Provenance>();
+    }
+
+    // A dictionary trained by an earlier run of this build is kept for good,
+    // since its nodes depend on it.
+    const int level = metadata.internal.zstdLevel;
+    if (
+        metadata.dataType == io::Type::Zstandard &&
+        metadata.internal.zstdDictionary &&
+        !metadata.subset &&
+        !endpoints.zstdDictionary)
+    {
+        endpoints.zstdDictionary =
+            ZstdDictionary::load(endpoints.output, level);
+        if (!endpoints.zstdDictionary)
+        {
+            endpoints.zstdDictionary = std::make_shared<ZstdDictionary>(
+                metadata.internal.zstdDictionary,
+                level);
+        }
+    }
+
+    // The nodes of a packed build to remote output are staged locally, and
+    // only their packs are written out.
+    if (
+        metadata.internal.pack &&
+        !metadata.subset &&
+        !endpoints.output.isLocal())
+    {
+        const std::string dir = arbiter::join(
+            endpoints.tmp.prefixedRoot(),
+            "ept-pack-" + std::to_string(
+                std::hash<std::string>()(endpoints.output.prefixedRoot())));
+        if (!arbiter::mkdirp(dir))
+        {
+            throw std::runtime_error("Failed to create directory: " + dir);
+        }
+        endpoints.data = endpoints.arbiter->getEndpoint(dir);
+    }
+
+    // Otherwise, the nodes of a journaled build to remote output are staged
+    // locally, and uploaded together whenever we are saved.
+    if (
+        metadata.internal.journal &&
+        !metadata.internal.pack &&
+        !endpoints.output.isLocal() &&
+        !endpoints.journal)
+    {
+        const std::string dir = arbiter::join(
+            endpoints.tmp.prefixedRoot(),
+            "ept-journal-" + std::to_string(
+                std::hash<std::string>()(
+                    endpoints.output.prefixedRoot() + getPostfix(metadata))));
+        if (!arbiter::mkdirp(dir))
+        {
+            throw std::runtime_error("Failed to create directory: " + dir);
+        }
+        endpoints.journal =
+            std::make_shared<Journal>(endpoints.arbiter->getEndpoint(dir));
+    }
+
+    if (metadata.internal.spill)
+    {
+        const std::string dir = arbiter::join(
+            endpoints.tmp.prefixedRoot(),
+            "ept-spill-" + std::to_string(
+                std::hash<std::string>()(
+                    endpoints.output.prefixedRoot() + getPostfix(metadata))));
+        if (!arbiter::mkdirp(dir))
+        {
+            throw std::runtime_error("Failed to create directory: " + dir);
+        }
+        endpoints.spill = dir;
+    }
+
+    if (const uint64_t bytes = metadata.internal.hierarchyMemory)
+    {
+        const std::string dir = arbiter::join(
+            endpoints.tmp.prefixedRoot(),
+            "ept-hierarchy-" + std::to_string(
+                std::hash<std::string>()(
+                    endpoints.output.prefixedRoot() + getPostfix(metadata))));
+        if (!arbiter::mkdirp(dir))
+        {
+            throw std::runtime_error("Failed to create directory: " + dir);
+        }
+        hierarchy.spill(dir, bytes / heuristics::hierarchyNodeBytes);
+    }
+}
 
 uint64_t Builder::run(
     const Threads threads,
     const uint64_t limit,
     const uint64_t progressInterval)
 {
-    Pool pool(2);
+    prepare();
+
+    if (metadata.internal.compactManifest && !metadata.subset && !sourceLog)
+    {
+        compactSources(getTotal(threads));
+    }
+
+    // Unless our manifest is compact, or we are a subset whose manifest is
+    // saved whole for its merge, the detail of each source is written in the
+    // background as it finishes, so that our saves need only write the rest.
+    if (!sourceLog && !metadata.subset)
+    {
+        assignSourcePaths();
+        sourcesWritten.assign(manifest.size(), false);
+        sourceWriter = std::make_shared<Pool>(
+            heuristics::sourceWriterThreads,
+            heuristics::sourceWriterQueue);
+    }
 
     std::atomic_uint64_t counter(0);
     std::atomic_bool done(false);
-    pool.add([&]() { monitor(progressInterval, counter, done); });
-    pool.add([&]() { runInserts(threads, limit, counter); done = true; });
+
+    std::unique_ptr<MetricsServer> server;
+    if (const uint64_t port = metadata.internal.metricsPort)
+    {
+        const uint64_t already = getInsertedPoints(manifest);
+        const uint64_t total = getTotalPoints(manifest);
+        const auto start = now();
+
+        server = makeUnique<MetricsServer>(port, [&, already, total, start]()
+        {
+            const uint64_t inserted = already + counter;
+            const double seconds = since<std::chrono::milliseconds>(start);
+            std::ostringstream os;
+            os <<
+                "# TYPE entwine_points_inserted_total counter\n" <<
+                "entwine_points_inserted_total " << inserted << "\n" <<
+                "# TYPE entwine_points gauge\n" <<
+                "entwine_points " << total << "\n" <<
+                "# TYPE entwine_points_per_second gauge\n" <<
+                "entwine_points_per_second " <<
+                    (seconds ? counter * 1000.0 / seconds : 0) << "\n" <<
+                "# TYPE entwine_memory_budget_bytes gauge\n" <<
+                "entwine_memory_budget_bytes " <<
+                    metadata.internal.memory << "\n" <<
+                metrics::toPrometheus();
+            return os.str();
+        });
+        std::cout << "Serving metrics on port " << port << std::endl;
+    }
+
+    Progress progress(getInsertedPoints(manifest), getTotalPoints(manifest));
+
+    Pool pool(2);
+    pool.add([&]() { monitor(progressInterval, counter, progress, done); });
+    pool.add([&]()
+    {
+        runInserts(threads, limit, counter, progress);
+        done = true;
+    });
 
     pool.join();
 
@@ -60,394 +520,2506 @@ uint64_t Builder::run(
 void Builder::runInserts(
     Threads threads,
     uint64_t limit,
-    std::atomic_uint64_t& counter)
+    std::atomic_uint64_t& counter,
+    Progress& progress)
 {
-    const Bounds active = metadata.subset
-        ? intersection(
-            getBounds(metadata.bounds, *metadata.subset),
-            metadata.boundsConforming
-        )
-        : metadata.boundsConforming;
+    const auto start = now();
+
+    const Bounds active = getActiveBounds(*this);
+
+    // Gather our tasks up front, since large files may be split into multiple
+    // ranges which are inserted independently.
+    struct Tracker
+    {
+        uint64_t remaining = 0;
+        bool failed = false;
+        Schema stats;
+        PointCounts counts;
+        TimePoint started;
+    };
+    std::vector<Tracker> trackers(manifest.size());
+    std::vector<PointRange> ranges;
+
+    SourceIndex sources(manifest);
+    for (const Origin origin : getSchedule(sources, active, limit))
+    {
+        const std::vector<PointRange> current = getRanges(origin);
+        trackers[origin].remaining = current.size();
+        ranges.insert(ranges.end(), current.begin(), current.end());
+    }
 
     const uint64_t actualWorkThreads =
-        std::min<uint64_t>(threads.work, manifest.size());
+        std::min<uint64_t>(threads.work, ranges.size());
     const uint64_t stolenThreads = threads.work - actualWorkThreads;
     const uint64_t actualClipThreads = threads.clip + stolenThreads;
 
-    ChunkCache cache(endpoints, metadata, hierarchy, actualClipThreads);
-    Pool pool(std::min<uint64_t>(actualWorkThreads, manifest.size()));
+    // With NUMA placement, each node takes a contiguous share of the files,
+    // balanced by point count, which is inserted by its own pool of work
+    // threads pinned to the node.  Files of the shares are interleaved in our
+    // dispatch order, so that no node waits long on the queue of another.
+    // The threads of a shared pool are not ours to pin.
+    const std::vector<numa::Node> nodes = metadata.internal.numa && !allotment
+        ? numa::nodes()
+        : std::vector<numa::Node>();
+    const uint64_t shares = nodes.size() > 1
+        ? std::min<uint64_t>(nodes.size(), actualWorkThreads)
+        : 1;
+    std::vector<uint64_t> shareOf(ranges.size(), 0);
+
+    if (shares > 1)
+    {
+        uint64_t total = 0;
+        for (uint64_t i = 0; i < ranges.size(); ++i)
+        {
+            if (i && ranges[i - 1].origin == ranges[i].origin) continue;
+            total += manifest.at(ranges[i].origin).source.info.points;
+        }
+
+        // The ranges of each share, grouped by file.
+        std::vector<std::vector<std::vector<PointRange>>> split(shares);
+        uint64_t before = 0;
+        for (uint64_t i = 0; i < ranges.size(); ++i)
+        {
+            const PointRange& range = ranges[i];
+            if (!i || ranges[i - 1].origin != range.origin)
+            {
+                const uint64_t share = std::min<uint64_t>(
+                    total ? before * shares / total : 0,
+                    shares - 1);
+                before += manifest.at(range.origin).source.info.points;
+                split[share].emplace_back();
+                split[share].back().push_back(range);
+            }
+            else
+            {
+                for (auto& files : split)
+                {
+                    if (files.size() && files.back().back().origin ==
+                            range.origin)
+                    {
+                        files.back().push_back(range);
+                    }
+                }
+            }
+        }
+
+        std::vector<PointRange> interleaved;
+        interleaved.reserve(ranges.size());
+        shareOf.clear();
+        for (uint64_t file = 0; interleaved.size() < ranges.size(); ++file)
+        {
+            for (uint64_t share = 0; share < shares; ++share)
+            {
+                if (file >= split[share].size()) continue;
+                for (const PointRange& range : split[share][file])
+                {
+                    interleaved.push_back(range);
+                    shareOf.push_back(share);
+                }
+            }
+        }
+        ranges = std::move(interleaved);
+    }
+
+    std::vector<Prefetcher::Planned> plan;
+    for (const PointRange& range : ranges)
+    {
+        const Origin origin = range.origin;
+        if (range.extract || isInPlace(manifest.at(origin))) continue;
+        if (plan.empty() || plan.back().origin != origin)
+        {
+            plan.emplace_back(
+                origin,
+                manifest.at(origin).source.path,
+                trackers[origin].remaining);
+        }
+    }
+    Prefetcher prefetcher(*endpoints.arbiter, plan, metadata.internal.prefetch);
+
+    // When balancing adaptively, each side has enough threads to take over
+    // nearly the whole budget, but runs only as many as its throttle allows.
+    const bool adaptive =
+        metadata.internal.adaptiveThreads && peers.empty() && !allotment;
+    const uint64_t totalThreads = actualWorkThreads + actualClipThreads;
+    const uint64_t maxWorkThreads = adaptive
+        ? std::min<uint64_t>(totalThreads - 1, ranges.size())
+        : actualWorkThreads;
+
+    // Each of our peers has a cache of its own, and the clip threads are
+    // divided among them.
+    const uint64_t clipThreadsEach = std::max<uint64_t>(
+        actualClipThreads / (peers.size() + 1),
+        1);
+    std::vector<std::unique_ptr<ChunkCache>> owned;
+    owned.push_back(
+        makeUnique<ChunkCache>(
+            endpoints,
+            metadata,
+            hierarchy,
+            clipThreadsEach,
+            adaptive ? totalThreads - 1 : 0));
+    for (Builder* peer : peers)
+    {
+        owned.push_back(
+            makeUnique<ChunkCache>(
+                peer->endpoints,
+                peer->metadata,
+                peer->hierarchy,
+                clipThreadsEach,
+                0));
+    }
+    std::vector<ChunkCache*> caches;
+    for (auto& c : owned) caches.push_back(c.get());
+    ChunkCache& cache(*caches.front());
+    if (allotment)
+    {
+        for (ChunkCache* c : caches) c->setAllotment(allotment.get());
+    }
+
+    // A presorted build first buckets the points of each cache into scratch
+    // files of its own.
+    std::vector<std::unique_ptr<Presort>> presorts;
+    if (metadata.internal.presortDepth)
+    {
+        for (ChunkCache* c : caches)
+        {
+            const Metadata& m(c->metadata());
+            const std::string dir = arbiter::join(
+                endpoints.tmp.prefixedRoot(),
+                "ept-presort-" + std::to_string(
+                    std::hash<std::string>()(
+                        endpoints.output.prefixedRoot() + getPostfix(m))));
+            presorts.push_back(
+                makeUnique<Presort>(m, dir, Resident(m).pointSize()));
+            c->setPresort(presorts.back().get());
+        }
+    }
 
-    uint64_t filesInserted = 0;
+    // Our caches prefer to serialize the chunks which no file yet to be
+    // inserted will touch.
+    for (const PointRange& range : ranges)
+    {
+        sources.setPending(range.origin, true);
+    }
+    for (ChunkCache* c : caches) c->setSources(&sources);
+
+    // Within a shared pool, our allotment limits our inserts instead, since
+    // its share may grow as other builds finish.
+    Throttle throttle(
+        allotment
+            ? std::numeric_limits<uint64_t>::max()
+            : actualWorkThreads);
+    std::mutex mutex;
+
+    std::vector<std::unique_ptr<Pool>> pools;
+    for (uint64_t share = 0; share < shares && !allotment; ++share)
+    {
+        const uint64_t size =
+            maxWorkThreads * (share + 1) / shares -
+            maxWorkThreads * share / shares;
+        Pool::Start start;
+        if (shares > 1)
+        {
+            const numa::Node node = nodes[share];
+            start = [node](std::size_t) { numa::pin(node); };
+        }
+        pools.push_back(makeUnique<Pool>(size, 1, true, start));
+    }
 
-    for (
-        uint64_t origin = 0;
-        origin < manifest.size() && (!limit || filesInserted < limit);
-        ++origin)
+    std::unique_ptr<Balancer> balancer;
+    if (adaptive && totalThreads > 2)
     {
-        const auto& item = manifest.at(origin);
-        const auto& info = item.source.info;
-        if (!item.inserted && info.points && active.overlaps(info.bounds))
+        balancer = makeUnique<Balancer>(
+            throttle,
+            cache.throttle(),
+            maxWorkThreads);
+    }
+
+    const uint64_t checkpointMinutes = metadata.internal.checkpointMinutes;
+    const uint64_t checkpointFiles = metadata.internal.checkpointFiles;
+    auto lastCheckpoint = now();
+    uint64_t completed = 0;
+
+    // The origins which failed, by whether they may simply be retried.
+    std::vector<Origin> retryable;
+    std::vector<Origin> partial;
+
+    // The durations of the files inserted so far, from which we judge whether
+    // another file can be finished before our deadline.
+    const uint64_t maxTime = metadata.internal.maxTime;
+    uint64_t finished = 0;
+    double busy = 0;
+
+    // Previews are written from the complete output, and so are unavailable
+    // for subsets.
+    const uint64_t previewMinutes =
+        metadata.subset ? 0 : metadata.internal.previewMinutes;
+    auto lastPreview = now();
+
+    // The existing nodes overlapping the files about to be inserted are
+    // fetched ahead of them, for up to a file per work thread beyond the one
+    // being added, if node prefetching is enabled.
+    uint64_t prefetched = 0;
+
+    for (uint64_t i = 0; i < ranges.size(); ++i)
+    {
+        const PointRange& range = ranges[i];
+        const Origin origin = range.origin;
+
+        // Checkpoint and preview only between files, once those in flight
+        // have finished, so that no file is partially inserted as of either.
+        if (i && ranges[i - 1].origin != origin)
         {
-            std::cout << "Adding " << origin << " - " << item.source.path <<
-                std::endl;
+            uint64_t files = 0;
+            double expected = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                files = completed;
+                if (finished) expected = busy / finished;
+            }
 
-            pool.add([this, &cache, origin, &counter]()
+            // Past our deadline, the remaining files are left for a later
+            // run while those in flight finish.
+            const double elapsed =
+                since<std::chrono::milliseconds>(start) / 1000.0;
+            if (maxTime && elapsed + expected >= maxTime)
             {
-                tryInsert(cache, origin, counter);
-                std::cout << "\tDone " << origin << std::endl;
-            });
+                std::set<Origin> remaining;
+                for (uint64_t j = i; j < ranges.size(); ++j)
+                {
+                    remaining.insert(ranges[j].origin);
+                }
+                std::cout << "Approaching time limit - leaving " <<
+                    remaining.size() << " files for a later run" <<
+                    std::endl;
+                break;
+            }
+
+            const bool checkpointDue =
+                (checkpointFiles && files >= checkpointFiles) ||
+                (checkpointMinutes &&
+                    since<std::chrono::minutes>(lastCheckpoint) >=
+                        int64_t(checkpointMinutes));
+            const bool previewDue =
+                previewMinutes &&
+                since<std::chrono::minutes>(lastPreview) >=
+                    int64_t(previewMinutes);
+
+            if (checkpointDue || previewDue)
+            {
+                if (allotment) allotment->await();
+                for (auto& pool : pools) pool->await();
+                for (ChunkCache* c : caches) c->flush();
+            }
+
+            if (checkpointDue)
+            {
+                checkpoint(cache, getTotal(threads));
+
+                lastCheckpoint = now();
+                std::lock_guard<std::mutex> lock(mutex);
+                completed = 0;
+            }
+
+            if (previewDue)
+            {
+                preview(getTotal(threads));
+                lastPreview = now();
+            }
+        }
+
+        std::cout << "Adding " << origin;
+        if (range.count)
+        {
+            std::cout << " [" << range.start << ", " <<
+                range.start + range.count << ")";
+        }
+        std::cout << " - " << manifest.at(origin).source.path << std::endl;
+
+        // The detail of a compact manifest is loaded for a batch of upcoming
+        // sources at a time, which are not yet referenced by any worker.
+        if (sourceLog && !manifest.at(origin).detailed)
+        {
+            const uint64_t batchSize(heuristics::sourceDetailBatch);
+            OriginList batch;
+            for (
+                uint64_t j = i;
+                j < ranges.size() && batch.size() < batchSize;
+                ++j)
+            {
+                const Origin o = ranges[j].origin;
+                if (manifest.at(o).detailed) continue;
+                if (batch.empty() || batch.back() != o) batch.push_back(o);
+            }
+            manifest::loadDetails(
+                endpoints.sources,
+                manifest,
+                batch,
+                heuristics::sourceDetailThreads);
+        }
+
+        if (!i || ranges[i - 1].origin != origin)
+        {
+            trackers[origin].started = now();
+            const Source& source(manifest.at(origin).source);
+            progress.start(origin, source.path, source.info.points);
+        }
+
+        for ( ; prefetched < ranges.size(); ++prefetched)
+        {
+            if (prefetched > i + maxWorkThreads) break;
+
+            const Origin next = ranges[prefetched].origin;
+            if (prefetched && ranges[prefetched - 1].origin == next) continue;
+
+            const Bounds& bounds = manifest.at(next).source.info.bounds;
+            for (ChunkCache* c : caches) c->prefetch(bounds);
+        }
+
+        auto task = [&, range]()
+        {
+            Schema stats;
+            PointCounts counts;
+            std::string error;
+
+            // A failure before any point of this range was inserted, such as
+            // a failed fetch, may be transient, so it is retried with backoff.
+            // Retries fetch their own copy, since each planned use of our
+            // prefetcher is acquired only once.
+            for (uint64_t attempt(0); ; ++attempt)
+            {
+                error.clear();
+                try
+                {
+                    Throttle::Guard guard(throttle);
+                    const BuildItem& item = manifest.at(range.origin);
+                    const Prefetcher::Handle handle = isInPlace(item)
+                        ? Prefetcher::Handle()
+                        : range.extract
+                            ? fetchRange(range)
+                            : attempt
+                                ? fetchLocal(
+                                    *endpoints.arbiter,
+                                    item.source.path)
+                                : prefetcher.acquire(range.origin);
+                    stats = insert(
+                        caches,
+                        range,
+                        handle ? handle->localPath() : item.source.path,
+                        counter,
+                        counts,
+                        throttle);
+                }
+                catch (const std::exception& e)
+                {
+                    error = e.what();
+                }
+                catch (...)
+                {
+                    error = "Unknown error during build";
+                }
+
+                if (error.empty() || !counts.empty()) break;
+                if (attempt >= heuristics::sourceRetries) break;
+
+                const uint64_t delay(heuristics::sourceRetryMs << attempt);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    std::cout << "\tRetrying " << range.origin << " in " <<
+                        delay / 1000.0 << "s: " << error << std::endl;
+                }
+                metrics::add(metrics::Counter::SourceRetries);
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto& item = manifest.at(range.origin);
+            auto& tracker = trackers[range.origin];
+            tracker.counts += counts;
+
+            if (error.size())
+            {
+                if (!counts.empty())
+                {
+                    error = "Failed after " + commify(counts.inserts) +
+                        " points were inserted: " + error;
+                }
+                item.source.info.errors.push_back(error);
+                tracker.failed = true;
+                metrics::add(metrics::Counter::SourceErrors);
+            }
+            else if (stats.size())
+            {
+                tracker.stats = tracker.stats.empty()
+                    ? stats
+                    : combine(tracker.stats, stats, true);
+            }
+
+            if (!--tracker.remaining)
+            {
+                // Only keep statistics which cover the entire file.
+                if (!tracker.failed && tracker.stats.size())
+                {
+                    item.source.info.schema = tracker.stats;
+                }
+
+                // A source which failed without inserting any points is left
+                // to be retried by a later run.  One which failed partway is
+                // done, since its points may not be inserted twice, and may
+                // only be removed by origin and inserted anew.
+                item.source.info.counts = tracker.counts;
+                item.inserted = !tracker.failed || !tracker.counts.empty();
+
+                // Until our next save, the detail of a compact manifest is
+                // only held by our log.
+                if (sourceLog)
+                {
+                    sourceLog->put(range.origin, item.source);
+                    manifest::compact(item);
+                }
+
+                // Sources to be retried are saved along with our manifest,
+                // as are those held in shards of many sources.
+                if (
+                    sourceWriter &&
+                    item.inserted &&
+                    !manifest::isShardPath(item.metadataPath))
+                {
+                    const arbiter::Endpoint out(endpoints.sources);
+                    const std::string path(item.metadataPath);
+                    const Source source(item.source);
+                    const bool pretty(manifest.size() <= 1000);
+                    sourceWriter->add([out, path, source, pretty]()
+                    {
+                        ensurePut(
+                            out,
+                            path,
+                            json(source).dump(getIndent(pretty)));
+                    });
+                    sourcesWritten[range.origin] = true;
+                }
+                if (tracker.failed)
+                {
+                    (item.inserted ? partial : retryable).push_back(
+                        range.origin);
+                }
+                sources.setPending(range.origin, false);
+                for (ChunkCache* c : caches) c->finished();
+                ++completed;
+                ++finished;
+                busy += since<std::chrono::milliseconds>(tracker.started) /
+                    1000.0;
+                metrics::add(metrics::Counter::SourcesInserted);
+                const PointCounts& c(tracker.counts);
+                const uint64_t pace(progress.finish(range.origin, c.inserts));
+                std::cout << "\tDone " << range.origin;
+                if (c.outOfBounds || c.outOfSubset)
+                {
+                    std::cout << " - " << commify(c.inserts) <<
+                        " inserted, " << commify(c.outOfBounds) <<
+                        " out of bounds";
+                    if (metadata.subset)
+                    {
+                        std::cout << ", " << commify(c.outOfSubset) <<
+                            " out of subset";
+                    }
+                }
+                std::cout << " - " << commify(pace) << " points/s" <<
+                    std::endl;
+            }
+        };
+
+        if (allotment) allotment->add(std::move(task));
+        else pools[shareOf[i]]->add(std::move(task));
+    }
+
+    std::cout << "Joining" << std::endl;
+
+    if (allotment) allotment->await();
+    for (auto& pool : pools) pool->join();
+    balancer.reset();
+
+    const auto list = [](const std::vector<Origin>& origins)
+    {
+        std::ostringstream ss;
+        for (const Origin origin : origins) ss << " " << origin;
+        return ss.str();
+    };
+    if (retryable.size())
+    {
+        std::cout << "Failed without inserting, to be retried by a later " <<
+            "run:" << list(retryable) << std::endl;
+    }
+    if (partial.size())
+    {
+        std::cout << "Failed after inserting some points, which may be " <<
+            "removed by origin:" << list(partial) << std::endl;
+    }
+
+    // Subtrees may be built independently only if there are no nodes from
+    // earlier builds beneath the presort depth.
+    for (std::size_t i = 0; i < presorts.size(); ++i)
+    {
+        Hierarchy& h = i ? peers[i - 1]->hierarchy : hierarchy;
+        caches[i]->setPresort(nullptr);
+
+        // Bucketed points may reach any chunk regardless of which files
+        // remain, so no chunk is held to be finished by its sources.
+        caches[i]->setSources(nullptr);
+        if (metadata.internal.bottomUp && h.size() <= 1)
+        {
+            insertBottomUp(*caches[i], h, *presorts[i], maxWorkThreads);
+        }
+        else if (metadata.internal.presortSplit && h.size() <= 1)
+        {
+            insertSplit(*caches[i], h, *presorts[i], maxWorkThreads);
+        }
+        else insertBuckets(*caches[i], *presorts[i], maxWorkThreads);
+    }
+
+    // Our final state supersedes any checkpoint, so it is saved as a new
+    // generation of its own.
+    const unsigned total = getTotal(threads);
+    const bool generation = checkpointMinutes || checkpointFiles;
+    if (generation) markCheckpoint();
+
+    // Our peers share our manifest, since their sources were read by us, and
+    // are saved along with us.
+    std::vector<Builder*> builders(1, this);
+    for (Builder* peer : peers)
+    {
+        peer->manifest = manifest;
+        builders.push_back(peer);
+    }
+
+    // Our sources do not depend on our nodes, so they are saved while our
+    // chunks are flushed.  The caches of our peers are flushed together with
+    // our own, rather than one after another.
+    std::cout << "Saving" << std::endl;
+    Pool saving(1);
+    saving.add([&builders, total]()
+    {
+        for (Builder* b : builders) b->saveSources(total);
+    });
+
+    {
+        Pool flush(caches.size());
+        for (ChunkCache* c : caches) flush.add([c]() { c->join(); });
+        flush.join();
+
+        if (flush.errors().size())
+        {
+            throw std::runtime_error(flush.errors().front());
+        }
+    }
+
+    // Our observations are saved with our build parameters, from which later
+    // builds may learn.
+    observed = profile::observe(
+        metadata,
+        threads,
+        counter,
+        since<std::chrono::milliseconds>(start) / 1000.0);
+
+    // With every chunk count in place, our hierarchy may be paged.  Our
+    // metadata marks our output as complete, so it is saved last.
+    for (Builder* b : builders) b->saveNodes(total);
+
+    saving.join();
+    if (saving.errors().size())
+    {
+        throw std::runtime_error(saving.errors().front());
+    }
+
+    for (Builder* b : builders) b->saveMetadata(total);
+    if (generation) cache.checkpoint().commit(metadata.internal.checkpoint);
+}
+
+void Builder::monitor(
+    const uint64_t progressInterval,
+    std::atomic_uint64_t& atomicCurrent,
+    Progress& progress,
+    std::atomic_bool& done)
+{
+    if (!progressInterval) return;
+
+    using ms = std::chrono::milliseconds;
+    const double mph = 3600.0 / 1000000.0;
+
+    const double already = getInsertedPoints(manifest);
+    const double total = getTotalPoints(manifest);
+    const auto start = now();
+
+    int64_t lastTick = 0;
+    double lastInserted = 0;
+
+    // Each snapshot of our metrics is appended as a line of JSON.
+    std::ofstream metricsFile;
+    if (metadata.internal.metricsPath.size())
+    {
+        const std::string path(
+            arbiter::expandTilde(metadata.internal.metricsPath));
+        metricsFile.open(path, std::ios::app);
+        if (!metricsFile) std::cout << "Could not open " << path << std::endl;
+    }
+
+    const auto writeMetrics = [&](int64_t elapsed, const json& snapshot)
+    {
+        if (!metricsFile.is_open()) return;
+        json line(metrics::get());
+        line["elapsed"] = elapsed;
+        line["inserted"] = snapshot.at("inserted");
+        line["progress"] = snapshot;
+        metricsFile << line.dump() << std::endl;
+    };
+
+    while (!done)
+    {
+        std::this_thread::sleep_for(ms(1000 - (since<ms>(start) % 1000)));
+        const int64_t tick = since<std::chrono::seconds>(start);
+
+        if (tick == lastTick || tick % progressInterval) continue;
+
+        lastTick = tick;
+
+        const double current = atomicCurrent;
+        const double inserted = already + current;
+        const double fraction = inserted / total;
+
+        const uint64_t pace = inserted / tick * mph;
+        const uint64_t intervalPace =
+            (inserted - lastInserted) / progressInterval * mph;
+
+        lastInserted = inserted;
+
+        const json snapshot(progress.update(tick, current));
+
+        std::cout << formatTime(tick) << " - " <<
+            std::round(fraction * 100) << "% - " <<
+            commify(inserted) << " - " <<
+            commify(pace) << " " <<
+            "(" << commify(intervalPace) << ") M/h";
+        const int64_t eta(progress.eta());
+        if (eta >= 0) std::cout << " - ETA " << formatTime(eta);
+        std::cout << std::endl;
+
+        // Report which locks, if any, were contended during this interval.
+        const lockstats::Counts contention(lockstats::latch());
+        if (std::any_of(contention.begin(), contention.end(), isNonZero))
+        {
+            std::cout << "\tContention -";
+            for (std::size_t i(0); i < contention.size(); ++i)
+            {
+                if (!contention[i]) continue;
+                std::cout << " " <<
+                    lockstats::toString(static_cast<LockType>(i)) << ": " <<
+                    commify(contention[i]);
+            }
+            std::cout << std::endl;
+        }
+
+        writeMetrics(tick, snapshot);
+    }
+
+    const int64_t elapsed(since<std::chrono::seconds>(start));
+    writeMetrics(elapsed, progress.update(elapsed, atomicCurrent));
+}
+
+std::vector<Origin> Builder::getSchedule(
+    const SourceIndex& sources,
+    const Bounds& active,
+    const uint64_t limit) const
+{
+    std::vector<Origin> origins;
+    for (const Origin origin : sources.query(active))
+    {
+        const auto& item = manifest.at(origin);
+        if (!item.inserted && item.source.info.points)
+        {
+            origins.push_back(origin);
+        }
+    }
+
+    const std::string& order = metadata.internal.order;
+    if (order == "spatial" || order == "largest")
+    {
+        std::vector<uint64_t> codes(manifest.size(), 0);
+        for (const Origin origin : origins)
+        {
+            codes[origin] = getMortonCode(
+                metadata.bounds,
+                manifest.at(origin).source.info.bounds);
+        }
+
+        const bool largest = order == "largest";
+        std::stable_sort(
+            origins.begin(),
+            origins.end(),
+            [&](Origin a, Origin b)
+            {
+                if (largest)
+                {
+                    const uint64_t pa = manifest.at(a).source.info.points;
+                    const uint64_t pb = manifest.at(b).source.info.points;
+                    if (pa != pb) return pa > pb;
+                }
+                return codes[a] < codes[b];
+            });
+    }
+
+    if (limit && origins.size() > limit) origins.resize(limit);
+    return origins;
+}
+
+std::vector<PointRange> Builder::getRanges(const Origin origin) const
+{
+    const auto& item = manifest.at(origin);
+    const auto& info = item.source.info;
+
+    // Only readers.las supports reading from an arbitrary starting point.
+    const std::string type = info.pipeline.is_array() && info.pipeline.size()
+        ? info.pipeline.at(0).value("type", "")
+        : "";
+    std::string extension = arbiter::getExtension(item.source.path);
+    std::transform(
+        extension.begin(),
+        extension.end(),
+        extension.begin(),
+        [](unsigned char c) { return std::tolower(c); });
+
+    const bool isLas = extension == "las" || extension == "laz";
+    if (isCopc(item)) return { origin };
+    if (!(type == "readers.las" || (type.empty() && isLas))) return { origin };
+
+    // Remote uncompressed files may be fetched one range at a time, rather
+    // than downloading them in their entirety.
+    const bool extract =
+        metadata.internal.rangeReads &&
+        extension == "las" &&
+        endpoints.arbiter->isRemote(item.source.path);
+
+    // A sampled source is read as evenly spaced blocks of points, which for
+    // LAZ are whole chunks, so that the points between them are skipped
+    // rather than decoded.  Sources too small to hold a sampled block are
+    // decimated as they are read instead, in insert().
+    const double sample = metadata.internal.sample;
+    if (sample)
+    {
+        const uint64_t block = heuristics::sampleBlockPoints;
+        if (info.points * sample < block) return { origin };
+
+        std::vector<PointRange> ranges;
+        for (uint64_t i(0); i * block < info.points; ++i)
+        {
+            if (uint64_t((i + 1) * sample) == uint64_t(i * sample)) continue;
+
+            const uint64_t start = i * block;
+            const uint64_t count = std::min(block, info.points - start);
+            ranges.emplace_back(origin, start, count, extract);
+        }
+        return ranges;
+    }
+
+    uint64_t splitPoints = metadata.internal.splitPoints;
+    if (extract && !splitPoints) splitPoints = heuristics::rangeReadPoints;
+
+    if (!splitPoints) return { origin };
+    if (!extract && info.points <= splitPoints) return { origin };
+
+    std::vector<PointRange> ranges;
+    for (uint64_t start(0); start < info.points; start += splitPoints)
+    {
+        // The final range reads through the end of the file, in case the
+        // header point count is inaccurate.
+        const uint64_t count = start + splitPoints < info.points
+            ? splitPoints
+            : 0;
+        ranges.emplace_back(origin, start, count, extract);
+    }
+    return ranges;
+}
+
+std::shared_ptr<arbiter::LocalHandle> Builder::fetchRange(
+    const PointRange& range) const
+{
+    const std::string& path = manifest.at(range.origin).source.path;
+    auto handle = getLasRangeFile(
+        path,
+        endpoints.tmp.prefixedRoot(),
+        *endpoints.arbiter,
+        range.start,
+        range.count);
+    return std::make_shared<arbiter::LocalHandle>(handle.release(), true);
+}
+
+Schema Builder::insert(
+    const std::vector<ChunkCache*>& caches,
+    const PointRange& range,
+    const std::string& localPath,
+    std::atomic_uint64_t& counter,
+    PointCounts& counts,
+    Throttle& throttle)
+{
+    const Origin originId = range.origin;
+    const auto& item = manifest.at(originId);
+    const auto& info(item.source.info);
+
+    trace::Span span("insert", item.source.path);
+
+    // Each inserting thread tallies its own counts, which are merged once it
+    // has finished, so that no counter is shared while inserting.
+    const bool subset(!!metadata.subset);
+    std::mutex countsMutex;
+
+    // Point IDs always refer to the position of the point within its file,
+    // regardless of the range being inserted.
+    uint64_t pointId(range.start);
+
+    auto layout = toMemoryLayout(metadata.absoluteSchema);
+    VectorPointTable table(layout);
+    const IdWriter ids(layout);
+
+    // Statistics are gathered on the reader thread as each batch is read.
+    // TODO: Allow this to be disabled via config.
+    optional<StatsAccumulator> stats;
+    if (!hasStats(info.schema)) stats = StatsAccumulator(info.schema);
+
+    // In the pipelined case, the reader thread (this one) only decodes points
+    // and stamps their origin information, and then hands the batch off to
+    // our inserter threads.
+    const uint64_t insertThreads = metadata.internal.insertThreads;
+    const std::size_t pointSize = layout.pointSize();
+
+    BoundedQueue<PointBatch> batches(
+        insertThreads * heuristics::batchesPerInsertThread);
+    BoundedQueue<std::vector<char>> recycled(
+        insertThreads * (heuristics::batchesPerInsertThread + 1) + 1);
+    std::unique_ptr<Pool> inserters;
+    std::vector<std::unique_ptr<Inserter>> targets;
+    std::unique_ptr<Reprojector> reprojector;
+
+    // Time spent in our processing of each batch on this thread is excluded
+    // from the time attributed to reading.
+    uint64_t processing(0);
+
+    const auto drain = [&]()
+    {
+        batches.close();
+        if (inserters) inserters->join();
+    };
+
+    if (insertThreads)
+    {
+        inserters = makeUnique<Pool>(insertThreads);
+        for (uint64_t i(0); i < insertThreads; ++i)
+        {
+            inserters->add([&]()
+            {
+                try
+                {
+                    // An inserter for each cache, each of which filters our
+                    // batches by its own bounds.
+                    std::vector<std::unique_ptr<Inserter>> own;
+                    for (ChunkCache* c : caches)
+                    {
+                        own.push_back(
+                            makeUnique<Inserter>(c->metadata(), *c, layout));
+                    }
+
+                    PointCounts local;
+                    PointBatch batch;
+                    while (batches.pop(batch))
+                    {
+                        const auto start(metrics::Clock::now());
+                        uint64_t inserts(0);
+                        for (auto& inserter : own)
+                        {
+                            inserts += inserter->insert(batch);
+                        }
+                        counter += inserts;
+                        tally(local, batch.size, inserts, subset, [&]()
+                        {
+                            return own.front()->outOfBounds(batch);
+                        });
+                        metrics::add(
+                            metrics::Timer::Insert,
+                            metrics::nanosSince(start));
+                        recycled.push(std::move(batch.data));
+                    }
+                    for (auto& inserter : own) inserter->finish();
+
+                    std::lock_guard<std::mutex> lock(countsMutex);
+                    counts += local;
+                }
+                catch (...)
+                {
+                    // Unblock the reader, which will notice the closure on its
+                    // next push.
+                    batches.close();
+                    throw;
+                }
+            });
+        }
+
+        table.setProcess([&]()
+        {
+            throttle.check();
+
+            const auto start(metrics::Clock::now());
+            if (reprojector) reprojector->transform(table.batch());
+            if (stats) stats->add(table);
+
+            PointBatch batch;
+            if (!recycled.tryPop(batch.data))
+            {
+                batch.data.resize(table.capacity() * pointSize);
+            }
+
+            char* pos(batch.data.data());
+            for (auto it = table.begin(); it != table.end(); ++it)
+            {
+                ids.write(it.data(), originId, pointId);
+                ++pointId;
+
+                std::copy(it.data(), it.data() + pointSize, pos);
+                pos += pointSize;
+                ++batch.size;
+            }
+
+            if (!batches.push(std::move(batch)))
+            {
+                throw std::runtime_error("Point insertion aborted");
+            }
+            processing += metrics::nanosSince(start);
+        });
+    }
+    else
+    {
+        for (ChunkCache* c : caches)
+        {
+            targets.push_back(makeUnique<Inserter>(c->metadata(), *c, layout));
+        }
+
+        std::vector<Extents::Overlap> overlaps(targets.size());
+        std::vector<Point> coords;
+        table.setProcess([&]()
+        {
+            throttle.check();
+
+            const auto start(metrics::Clock::now());
+            const auto points(table.batch());
+            if (reprojector) reprojector->transform(points);
+            if (stats) stats->add(table);
+
+            Voxel voxel;
+            uint64_t inserts(0);
+
+            // Our targets share a schema, so the coordinates of the batch are
+            // clipped once for all of them.
+            coords.resize(points.size());
+            for (pdal::PointId i(0); i < points.size(); ++i)
+            {
+                coords[i] = points.point(i);
+            }
+            targets.front()->clip(coords);
+
+            Extents extents;
+            for (pdal::PointId i(0); i < points.size(); ++i)
+            {
+                if (!points.skip(i)) extents.grow(coords[i]);
+            }
+
+            uint64_t visited(0);
+            bool any(false);
+            for (std::size_t t(0); t < targets.size(); ++t)
+            {
+                targets[t]->maybeClip(table.numPoints());
+                overlaps[t] = targets[t]->overlap(extents);
+                any = any || overlaps[t] != Extents::Overlap::None;
+            }
+
+            for (pdal::PointId i(0); i < points.size(); ++i)
+            {
+                if (points.skip(i)) continue;
+
+                // Point IDs are assigned even to points which are not
+                // inserted.
+                const uint64_t id(pointId++);
+                ++visited;
+                if (!any) continue;
+
+                ids.write(points.data(i), originId, id);
+
+                // Our targets are disjoint, so a point belongs to at most one.
+                for (std::size_t t(0); t < targets.size(); ++t)
+                {
+                    const Extents::Overlap o(overlaps[t]);
+                    if (o == Extents::Overlap::None) continue;
+
+                    voxel.initShallow(coords[i], points.data(i));
+                    if (targets[t]->addClipped(
+                            voxel,
+                            o == Extents::Overlap::Full))
+                    {
+                        ++inserts;
+                        break;
+                    }
+                }
+            }
+
+            for (auto& inserter : targets) inserter->flush();
+            counter += inserts;
+            tally(counts, visited, inserts, subset, [&]()
+            {
+                uint64_t n(0);
+                for (pdal::PointId i(0); i < points.size(); ++i)
+                {
+                    if (points.skip(i)) continue;
+                    if (!metadata.boundsConforming.contains(points.point(i)))
+                    {
+                        ++n;
+                    }
+                }
+                return n;
+            });
+
+            const uint64_t ns(metrics::nanosSince(start));
+            metrics::add(metrics::Timer::Insert, ns);
+            processing += ns;
+        });
+    }
+
+    json pipeline = info.pipeline.is_null()
+        ? json::array({ json::object() })
+        : info.pipeline;
+    pipeline.at(0)["filename"] = localPath;
+
+    // An extracted range is a standalone file, so it is read in its entirety.
+    if (range.extract) pipeline.at(0)["type"] = "readers.las";
+    else if (range.count || range.start)
+    {
+        pipeline.at(0)["type"] = "readers.las";
+        pipeline.at(0)["start"] = range.start;
+        if (range.count) pipeline.at(0)["count"] = range.count;
+    }
+    else if (isCopc(item))
+    {
+        json& reader(pipeline.at(0));
+        reader["type"] = "readers.copc";
+        if (!reader.count("threads"))
+        {
+            reader["threads"] = heuristics::copcThreads;
+        }
+    }
+
+    // Sampled sources which are not read in blocks of points are decimated
+    // straight after they are read.
+    const double sample = metadata.internal.sample;
+    if (sample && !range.count)
+    {
+        const uint64_t step = std::max<uint64_t>(1, std::llround(1 / sample));
+        pipeline.insert(
+            pipeline.begin() + 1,
+            json { { "type", "filters.decimation" }, { "step", step } });
+    }
+
+    // A trailing reprojection is performed by our own transformation on whole
+    // batches, rather than point by point within the pipeline.
+    const optional<Reprojection> reprojection(Reprojector::extract(pipeline));
+
+    // Once reading is done, flush the remaining batches through our
+    // inserters.  If any of them failed, this source failed.
+    const auto finish = [&](const metrics::Clock::time_point reading)
+        -> Schema
+    {
+        metrics::add(
+            metrics::Timer::Read,
+            metrics::nanosSince(reading) - processing);
+
+        drain();
+        if (inserters && inserters->errors().size())
+        {
+            throw std::runtime_error(inserters->errors().front());
+        }
+        for (auto& inserter : targets) inserter->finish();
+
+        metrics::add(metrics::Counter::OutOfBounds, counts.outOfBounds);
+        metrics::add(metrics::Counter::OutOfSubset, counts.outOfSubset);
+        return stats ? stats->schema() : Schema();
+    };
+
+    // A lone LAS reader is replaced by our own decoding of its records, which
+    // skips the setup of a pipeline and PDAL's per-point field conversion.
+    // A range extracted to a standalone file is read in its entirety.
+    std::unique_ptr<las::Decoder> decoder;
+    if (las::isNativeCandidate(pipeline))
+    {
+        decoder = range.extract
+            ? las::Decoder::create(localPath, layout)
+            : las::Decoder::create(
+                localPath,
+                layout,
+                range.start,
+                range.count);
+    }
+
+    // Likewise, a lone EPT reader is replaced by our own reading of its nodes,
+    // limited to the bounds we insert.
+    std::unique_ptr<ept::Decoder> eptDecoder;
+    if (ept::isNativeCandidate(pipeline))
+    {
+        const Bounds active = getActiveBounds(*this);
+        const double margin(getClipMargin(metadata));
+        eptDecoder = makeUnique<ept::Decoder>(
+            endpoints.arbiter,
+            item.source.path,
+            endpoints.tmp.prefixedRoot(),
+            layout,
+            heuristics::eptThreads,
+            active.contains(info.bounds)
+                ? optional<Bounds>()
+                : Bounds(active.min() - margin, active.max() + margin));
+    }
+
+    if (eptDecoder)
+    {
+        const auto reading(metrics::Clock::now());
+        try
+        {
+            if (reprojection)
+            {
+                const std::string in(reprojection->in().size()
+                    ? reprojection->in()
+                    : info.srs.wkt());
+                if (in.empty())
+                {
+                    throw std::runtime_error(
+                        "No SRS to reproject from: " + item.source.path);
+                }
+                reprojector = makeUnique<Reprojector>(in, reprojection->out());
+            }
+
+            while (const uint64_t np = eptDecoder->read(table))
+            {
+                table.clear(np);
+            }
+        }
+        catch (...)
+        {
+            drain();
+            throw;
+        }
+
+        return finish(reading);
+    }
+
+    if (decoder)
+    {
+        const auto reading(metrics::Clock::now());
+        try
+        {
+            if (reprojection)
+            {
+                // Without reader options, the SRS of our source is that of
+                // its file.
+                const std::string in(reprojection->in().size()
+                    ? reprojection->in()
+                    : info.srs.wkt());
+                if (in.empty())
+                {
+                    throw std::runtime_error(
+                        "No SRS to reproject from: " + item.source.path);
+                }
+                reprojector = makeUnique<Reprojector>(in, reprojection->out());
+            }
+
+            while (const uint64_t np = decoder->read(table)) table.clear(np);
+        }
+        catch (...)
+        {
+            drain();
+            throw;
+        }
+
+        return finish(reading);
+    }
+
+    // Readers which can skip the data outside of given bounds are limited to
+    // those we insert, such as those of our subset, so that other points are
+    // never decoded.  This holds only while the pipeline leaves coordinates as
+    // read.
+    const Bounds active = getActiveBounds(*this);
+    json& reader(pipeline.at(0));
+    if (
+        pipeline.size() == 1 &&
+        !reprojection &&
+        !reader.count("bounds") &&
+        isSpatialReader(item) &&
+        !active.contains(info.bounds))
+    {
+        const double margin(getClipMargin(metadata));
+        const Point min(active.min() - margin);
+        const Point max(active.max() + margin);
+
+        std::ostringstream ss;
+        ss << std::setprecision(std::numeric_limits<double>::max_digits10) <<
+            "([" << min.x << ", " << max.x << "], " <<
+            "[" << min.y << ", " << max.y << "], " <<
+            "[" << min.z << ", " << max.z << "])";
+        reader["bounds"] = ss.str();
+    }
+
+    pdal::PipelineManager pm;
+    std::istringstream iss(pipeline.dump());
+
+    pm.readPipeline(iss);
+    pm.validateStageOptions();
+    pdal::Stage& last = getStage(pm);
+
+    const auto reading(metrics::Clock::now());
+    {
+        trace::Span span("prepare", item.source.path);
+        std::lock_guard<std::mutex> lock(PdalMutex::get());
+        last.prepare(table);
+    }
+
+    if (reprojection)
+    {
+        // The reader's SRS accounts for any default or overridden input SRS.
+        const std::string in(reprojection->in().size()
+            ? reprojection->in()
+            : getReader(last).getSpatialReference().getWKT());
+        if (in.empty())
+        {
+            drain();
+            throw std::runtime_error(
+                "No SRS to reproject from: " + item.source.path);
+        }
+        reprojector = makeUnique<Reprojector>(in, reprojection->out());
+    }
+
+    try
+    {
+        last.execute(table);
+    }
+    catch (...)
+    {
+        drain();
+        throw;
+    }
+
+    return finish(reading);
+}
+
+void Builder::save(const unsigned threads)
+{
+    std::cout << "Saving" << std::endl;
+    saveNodes(threads);
+    saveSources(threads);
+    saveMetadata(threads);
+}
+
+void Builder::saveNodes(const unsigned threads)
+{
+    if (endpoints.journal) saveJournal(threads);
+    saveHierarchy(threads);
+    if (metadata.internal.pack && !metadata.subset) savePacks(threads);
+    if (endpoints.nodeStats) saveNodeStats(threads);
+    if (endpoints.nodeSizes) saveNodeSizes(threads);
+    if (endpoints.provenance) saveProvenance(threads);
+}
+
+void Builder::checkpoint(ChunkCache& cache, const unsigned threads)
+{
+    trace::Span span("checkpoint");
+    std::cout << "Checkpointing" << std::endl;
+
+    markCheckpoint();
+    save(threads);
+    cache.checkpoint().commit(metadata.internal.checkpoint);
+}
+
+void Builder::markCheckpoint()
+{
+    // An interruption while we save would leave a mix of generations, from
+    // which we cannot resume, so mark our build as such until we are done.
+    const std::string postfix = getPostfix(metadata);
+    json buildJson = metadata.internal;
+    buildJson["checkpointing"] = true;
+    ensurePut(
+        endpoints.output,
+        "ept-build" + postfix + ".json",
+        buildJson.dump(2));
+
+    ++metadata.internal.checkpoint;
+}
+
+void Builder::preview(const unsigned threads)
+{
+    trace::Span span("preview");
+
+    const uint64_t depth = metadata.internal.previewDepth;
+    std::cout << "Publishing preview to depth " << depth << std::endl;
+
+    const Endpoints out(
+        endpoints.arbiter,
+        arbiter::join(endpoints.output.prefixedRoot(), "ept-preview"),
+        endpoints.tmp.prefixedRoot());
+
+    Hierarchy shallow;
+    std::vector<Dxyz> keys;
+    uint64_t points = 0;
+    hierarchy.forEach([&](const Dxyz& key, int64_t np)
+    {
+        if (key.d >= depth || !np) return;
+        shallow.set(key, np);
+        keys.push_back(key);
+        points += np;
+    });
+
+    // Each node is written before the hierarchy which refers to it, and the
+    // metadata last of all.
+    Pool pool(threads);
+    for (const Dxyz& key : keys)
+    {
+        pool.add([&, key]()
+        {
+            const std::string path =
+                key.toString() + io::getNodeExtension(metadata, key.d);
+            const auto staged = endpoints.journal
+                ? endpoints.journal->get(path)
+                : optional<std::vector<char>>();
+            ensurePut(
+                out.data,
+                path,
+                staged ? *staged : ensureGetBinary(endpoints.data, path));
+        });
+    }
+    pool.join();
+
+    if (endpoints.zstdDictionary && endpoints.zstdDictionary->ddict())
+    {
+        const std::string path = ZstdDictionary::filename();
+        ensurePut(out.output, path, ensureGetBinary(endpoints.output, path));
+    }
+
+    const std::string& encoding = metadata.internal.contentEncoding;
+    hierarchy::save(shallow, out.hierarchy, 0, threads, "", false, encoding);
+
+    json metaJson = metadata;
+    metaJson["points"] = points;
+    ensurePutJson(
+        out.output,
+        "ept.json",
+        metaJson.dump(encoding.size() ? -1 : 2),
+        encoding);
+}
+
+void Builder::saveJournal(const unsigned threads)
+{
+    trace::Span span("journalSave");
+
+    // Our nodes are written before the hierarchy which refers to them.
+    std::cout << "Uploading " << endpoints.journal->size() << " nodes" <<
+        std::endl;
+    endpoints.journal->upload(
+        endpoints.data,
+        std::max<unsigned>(threads, heuristics::journalThreads));
+}
+
+void Builder::saveHierarchy(const unsigned threads)
+{
+    metrics::ScopedTimer timer(metrics::Timer::HierarchySave);
+    trace::Span span("hierarchySave");
+
+    // If we are a) saving a subset or b) saving a partial build, then defer
+    // choosing a hierarchy step and instead just write one monolothic file.
+    const bool stepped =
+        !metadata.subset &&
+        std::all_of(manifest.begin(), manifest.end(), isSettled);
+
+    // Keep the step of any existing hierarchy files stable, so that only the
+    // files containing changed nodes need to be rewritten.  The chosen step
+    // is persisted with our build parameters.
+    const uint64_t previous = metadata.internal.hierarchyStep;
+    const unsigned step = !stepped
+        ? 0
+        : previous ? previous : hierarchy::determineStep(hierarchy);
+
+    // Files paged by node count may move as the hierarchy grows, so they are
+    // rewritten incrementally only while their roots are unchanged since our
+    // last save.  The step still groups our packs and node statistics.
+    const uint64_t pageSize = metadata.internal.hierarchyPageSize;
+    if (stepped && pageSize)
+    {
+        hierarchy::Roots roots(hierarchy::determineRoots(hierarchy, pageSize));
+        hierarchy::save(
+            hierarchy,
+            endpoints.hierarchy,
+            roots,
+            threads,
+            getPostfix(metadata),
+            roots == hierarchyRoots,
+            metadata.internal.contentEncoding);
+        hierarchyRoots = std::move(roots);
+    }
+    else
+    {
+        hierarchy::save(
+            hierarchy,
+            endpoints.hierarchy,
+            step,
+            threads,
+            getPostfix(metadata),
+            step == previous,
+            metadata.internal.contentEncoding);
+    }
+
+    hierarchy.clean();
+    metadata.internal.hierarchyStep = step;
+}
+
+void Builder::savePacks(const unsigned threads)
+{
+    trace::Span span("packSave");
+
+    // Packs follow the hierarchy files, whose step has now been chosen.
+    const uint64_t step = metadata.internal.hierarchyStep;
+    std::map<Dxyz, std::vector<Dxyz>> packs;
+    hierarchy.forEach([&](const Dxyz& key, int64_t np)
+    {
+        if (np) packs[pack::getRoot(key, step)].push_back(key);
+    });
+
+    const arbiter::Endpoint out = endpoints.output.getSubEndpoint("ept-data");
+    const auto extension = [this](const uint64_t depth)
+    {
+        return io::getNodeExtension(metadata, depth);
+    };
+    const bool local = endpoints.data.isLocal();
+
+    Pool pool(threads);
+    for (const auto& p : packs)
+    {
+        pool.add([&]()
+        {
+            pack::write(
+                endpoints.data,
+                out,
+                p.first,
+                p.second,
+                extension,
+                local);
+        });
+    }
+    pool.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+
+    // Our staging directory is empty once its nodes have been packed.
+    if (endpoints.data.prefixedRoot() != out.prefixedRoot())
+    {
+        arbiter::remove(endpoints.data.prefixedRoot());
+    }
+}
+
+void Builder::saveNodeStats(const unsigned threads)
+{
+    trace::Span span("nodeStatsSave");
+
+    const arbiter::Endpoint out =
+        endpoints.output.getSubEndpoint("ept-node-stats");
+    if (out.isLocal()) arbiter::mkdirp(out.prefixedRoot());
+
+    endpoints.nodeStats->save(out, metadata.internal.hierarchyStep, threads);
+}
+
+void Builder::saveNodeSizes(const unsigned threads)
+{
+    trace::Span span("nodeSizesSave");
+
+    const arbiter::Endpoint out =
+        endpoints.output.getSubEndpoint("ept-node-sizes");
+    if (out.isLocal()) arbiter::mkdirp(out.prefixedRoot());
+
+    endpoints.nodeSizes->save(out, metadata.internal.hierarchyStep, threads);
+}
+
+void Builder::saveProvenance(const unsigned threads)
+{
+    trace::Span span("provenanceSave");
+
+    const arbiter::Endpoint out =
+        endpoints.output.getSubEndpoint("ept-provenance");
+    if (out.isLocal()) arbiter::mkdirp(out.prefixedRoot());
+
+    endpoints.provenance->save(out, threads);
+}
+
+void Builder::compactSources(const unsigned threads)
+{
+    saveSources(threads);
+    for (BuildItem& item : manifest) manifest::compact(item);
+
+    const std::string path = arbiter::join(
+        endpoints.tmp.prefixedRoot(),
+        "ept-sources-" + std::to_string(
+            std::hash<std::string>()(
+                endpoints.output.prefixedRoot() + getPostfix(metadata))) +
+        ".json");
+    sourceLog = std::make_shared<SourceLog>(path);
+}
+
+void Builder::saveSources(const unsigned threads)
+{
+    const std::string postfix = getPostfix(metadata);
+    const std::string manifestFilename = "manifest" + postfix + ".json";
+    const bool pretty = manifest.size() <= 1000;
+
+    // Our overview is fetched by readers, unlike our per-file metadata.
+    const std::string& encoding = metadata.internal.contentEncoding;
+    const int overviewIndent = getIndent(pretty && encoding.empty());
+
+    if (sourceLog)
+    {
+        // The detail of a compact manifest was saved before any source was
+        // inserted, so only the sources logged since are saved again, a
+        // batch at a time.  Their metadata paths were assigned back then.
+        const OriginList logged = sourceLog->origins();
+        const uint64_t batchSize(heuristics::sourceDetailBatch);
+        for (uint64_t begin = 0; begin < logged.size(); begin += batchSize)
+        {
+            const uint64_t end = std::min<uint64_t>(
+                begin + batchSize,
+                logged.size());
+
+            Manifest changed;
+            OriginList sharded;
+            for (uint64_t i = begin; i < end; ++i)
+            {
+                const Origin o = logged[i];
+                BuildItem& item = manifest[o];
+                sourceLog->restore(o, item);
+
+                if (manifest::isShardPath(item.metadataPath))
+                {
+                    sharded.push_back(o);
+                }
+                else changed.push_back(item);
+            }
+            saveEach(changed, endpoints.sources, threads, pretty);
+            manifest::saveShards(
+                manifest,
+                sharded,
+                endpoints.sources,
+                threads,
+                pretty);
+
+            for (uint64_t i = begin; i < end; ++i)
+            {
+                manifest::compact(manifest[logged[i]]);
+            }
+        }
+        sourceLog->clear();
+
+        ensurePutJson(
+            endpoints.sources,
+            manifestFilename,
+            toOverview(manifest).dump(overviewIndent),
+            encoding);
+    }
+    else if (metadata.subset)
+    {
+        // If we are a subset, write the whole detailed metadata as one giant
+        // blob, since we know we're going to need to wake up the whole thing to
+        // do the merge.
+        ensurePut(
+            endpoints.sources,
+            manifestFilename,
+            json(manifest).dump(getIndent(pretty)));
+    }
+    else
+    {
+        // Only the entries new to this build are saved, except for those
+        // whose detail was written as they finished.
+        if (sourceWriter)
+        {
+            sourceWriter->cycle();
+            if (sourceWriter->errors().size())
+            {
+                throw std::runtime_error(
+                    "Failed to save sources: " +
+                    sourceWriter->errors().front());
+            }
+        }
+        assignSourcePaths();
+
+        Manifest changed;
+        OriginList sharded;
+        for (uint64_t i = 0; i < manifest.size(); ++i)
+        {
+            const BuildItem& item = manifest[i];
+            if (i < settled.size() && settled[i]) continue;
+            if (i < sourcesWritten.size() && sourcesWritten[i]) continue;
+
+            if (manifest::isShardPath(item.metadataPath)) sharded.push_back(i);
+            else changed.push_back(item);
+        }
+        saveEach(changed, endpoints.sources, threads, pretty);
+        manifest::saveShards(
+            manifest,
+            sharded,
+            endpoints.sources,
+            threads,
+            pretty);
+
+        // Our manifest itself is saved as an overview, which excludes the
+        // detailed metadata of each source.
+        ensurePutJson(
+            endpoints.sources,
+            manifestFilename,
+            toOverview(manifest).dump(overviewIndent),
+            encoding);
+    }
+}
+
+void Builder::assignSourcePaths()
+{
+    const uint64_t shardSize = metadata.internal.manifestShardSize;
+
+    if (settled.empty() && !shardSize)
+    {
+        manifest = assignMetadataPaths(manifest);
+        return;
+    }
+
+    // Existing entries keep their paths, which new entries must not collide
+    // with.
+    std::set<std::string> paths;
+    for (uint64_t i = 0; i < settled.size(); ++i)
+    {
+        if (settled[i]) paths.insert(manifest[i].metadataPath);
+    }
+
+    for (uint64_t i = 0; i < manifest.size(); ++i)
+    {
+        BuildItem& item = manifest[i];
+        if (!item.metadataPath.empty()) continue;
+
+        if (shardSize)
+        {
+            item.metadataPath = manifest::getShardPath(i, shardSize);
+        }
+        else
+        {
+            item.metadataPath = getStem(item.source.path) + ".json";
+            if (!paths.insert(item.metadataPath).second)
+            {
+                item.metadataPath = std::to_string(i) + ".json";
+            }
+        }
+    }
+}
+
+void Builder::saveMetadata(const unsigned threads)
+{
+    // If we've gained dimension stats during our build, accumulate them and
+    // add them to our main metadata.  When appending, the stats of the
+    // entries settled beforehand are already accumulated.
+    const auto isNew = [this](uint64_t i)
+    {
+        return i >= settled.size() || !settled[i];
+    };
+    bool complete = settled.empty() || hasStats(settledSchema);
+    const Schema base = settled.empty()
+        ? clearStats(metadata.schema)
+        : settledSchema;
+    const auto so = getScaleOffset(metadata.schema);
+    const auto add = [&](Schema& schema, std::size_t i)
+    {
+        if (!isNew(i)) return;
+        const Schema& itemSchema = manifest[i].source.info.schema;
+        schema = combine(
+            std::move(schema),
+            so ? setScaleOffset(itemSchema, *so) : itemSchema,
+            true);
+    };
+
+    if (sourceLog)
+    {
+        // The detail of a compact manifest, which has just been saved, is
+        // streamed back from our saved metadata a batch at a time.
+        OriginList origins;
+        for (uint64_t i = 0; i < manifest.size(); ++i)
+        {
+            if (isNew(i)) origins.push_back(i);
+        }
+
+        Schema added = clearStats(base);
+        const uint64_t batchSize(heuristics::sourceDetailBatch);
+        for (
+            uint64_t begin = 0;
+            complete && begin < origins.size();
+            begin += batchSize)
+        {
+            const OriginList batch(
+                origins.begin() + begin,
+                origins.begin() + std::min<uint64_t>(
+                    begin + batchSize,
+                    origins.size()));
+            manifest::loadDetails(
+                endpoints.sources,
+                manifest,
+                batch,
+                heuristics::sourceDetailThreads);
+
+            for (const Origin o : batch)
+            {
+                if (!hasStats(manifest[o])) complete = false;
+                else add(added, o);
+                manifest::compact(manifest[o]);
+            }
+        }
+
+        if (complete) metadata.schema = combine(base, added, true);
+    }
+    else
+    {
+        for (uint64_t i = 0; i < manifest.size(); ++i)
+        {
+            if (isNew(i) && !hasStats(manifest[i])) complete = false;
+        }
+
+        if (!metadata.subset && complete)
+        {
+            // The new entries are accumulated in shares, each starting from
+            // our base schema without its stats so that those are counted
+            // once.
+            const Schema added = parallelReduce(
+                manifest.size(),
+                clearStats(base),
+                threads,
+                add,
+                [](Schema& schema, Schema&& other)
+                {
+                    schema = combine(std::move(schema), other, true);
+                });
+
+            metadata.schema = combine(base, added, true);
+        }
+    }
+
+    const std::string postfix = getPostfix(metadata);
+
+    const std::string metaFilename = "ept" + postfix + ".json";
+    const std::string& encoding = metadata.internal.contentEncoding;
+    json metaJson = metadata;
+    metaJson["points"] = getInsertedPoints(manifest);
+    ensurePutJson(
+        endpoints.output,
+        metaFilename,
+        metaJson.dump(encoding.size() ? -1 : 2),
+        encoding);
+
+    const std::string buildFilename = "ept-build" + postfix + ".json";
+    json buildJson = metadata.internal;
+    buildJson["metrics"] = metrics::get();
+    if (!observed.is_null()) buildJson["observed"] = observed;
+    ensurePut(endpoints.output, buildFilename, buildJson.dump(2));
+}
+
+namespace builder
+{
+
+Builder load(
+    Endpoints endpoints,
+    const unsigned threads,
+    const unsigned subsetId)
+{
+    const std::string postfix = subsetId ? "-" + std::to_string(subsetId) : "";
+    const json metadataJson = entwine::merge(
+        json::parse(endpoints.output.get("ept-build" + postfix + ".json")),
+        json::parse(endpoints.output.get("ept" + postfix + ".json")));
 
-            ++filesInserted;
-        }
+    Metadata metadata = config::getMetadata(metadataJson);
+    if (
+        metadata.dataType == io::Type::Zstandard &&
+        metadata.internal.zstdDictionary)
+    {
+        endpoints.zstdDictionary = ZstdDictionary::load(
+            endpoints.output,
+            metadata.internal.zstdLevel);
     }
+    Manifest manifest = manifest::load(endpoints.sources, threads, postfix);
+    Hierarchy hierarchy =
+        hierarchy::load(endpoints.hierarchy, threads, postfix);
 
-    std::cout << "Joining" << std::endl;
-
-    pool.join();
-    cache.join();
-
-    save(getTotal(threads));
+    return Builder(
+        std::move(endpoints),
+        std::move(metadata),
+        std::move(manifest),
+        std::move(hierarchy));
 }
 
-void Builder::monitor(
-    const uint64_t progressInterval,
-    std::atomic_uint64_t& atomicCurrent,
-    std::atomic_bool& done)
+namespace
 {
-    if (!progressInterval) return;
-
-    using ms = std::chrono::milliseconds;
-    const double mph = 3600.0 / 1000000.0;
-
-    const double already = getInsertedPoints(manifest);
-    const double total = getTotalPoints(manifest);
-    const auto start = now();
 
-    int64_t lastTick = 0;
-    double lastInserted = 0;
+// Insert the points of one subset's shared-depth node into our cache.
+void mergeNode(
+    const Builder& dst,
+    ChunkCache& cache,
+    Clipper& clipper,
+    const Dxyz& key,
+    const uint64_t count,
+    const std::string& postfix,
+    const io::Type type)
+{
+    const auto& metadata = dst.metadata;
 
-    while (!done)
+    pdal::PointLayout& layout(metadata.layouts->absolute());
+    VectorPointTable table(layout, count);
+    table.setProcess([&]()
     {
-        std::this_thread::sleep_for(ms(1000 - (since<ms>(start) % 1000)));
-        const int64_t tick = since<std::chrono::seconds>(start);
-
-        if (tick == lastTick || tick % progressInterval) continue;
+        Voxel voxel;
+        Key pk(metadata.bounds, getStartDepth(metadata));
+        ChunkKey ck(metadata.bounds, getStartDepth(metadata));
+        ck.init(key);
 
-        lastTick = tick;
+        const Resident resident(metadata);
+        std::vector<char> converted(resident.pointSize());
 
-        const double current = atomicCurrent;
-        const double inserted = already + current;
-        const double progress = inserted / total;
+        const auto points(table.batch());
+        for (pdal::PointId i(0); i < points.size(); ++i)
+        {
+            if (points.skip(i)) continue;
 
-        const uint64_t pace = inserted / tick * mph;
-        const uint64_t intervalPace =
-            (inserted - lastInserted) / progressInterval * mph;
+            voxel.initShallow(points.point(i), points.data(i));
+            if (resident.compact())
+            {
+                resident.fromAbsolute(points.data(i), converted.data());
+                voxel.setData(converted.data());
+            }
+            pk.init(voxel.point(), ck);
+            cache.insert(voxel, pk, ck, clipper);
+        }
+    });
 
-        lastInserted = inserted;
+    // Read through our cache's endpoints, so as to take any node which it has
+    // prefetched.
+    const auto stem = key.toString() + postfix;
+    io::read(
+        type,
+        metadata,
+        cache.endpoints(),
+        stem,
+        table,
+        getNodeBounds(metadata, key));
+}
 
-        std::cout << formatTime(tick) << " - " <<
-            std::round(progress * 100) << "% - " <<
-            commify(inserted) << " - " <<
-            commify(pace) << " " <<
-            "(" << commify(intervalPace) << ") M/h" <<
-            std::endl;
-    }
+// The endpoints from which this subset is read: its own output, if subset
+// outputs are given, or our own.
+Endpoints getSubsetEndpoints(
+    const Endpoints& endpoints,
+    const StringList& subsetOutputs,
+    const unsigned id)
+{
+    if (subsetOutputs.empty()) return endpoints;
+    return Endpoints(
+        endpoints.arbiter,
+        subsetOutputs.at(id - 1),
+        endpoints.tmp.prefixedRoot());
 }
 
-void Builder::tryInsert(
-    ChunkCache& cache,
-    const Origin originId,
-    std::atomic_uint64_t& counter)
+} // unnamed namespace
+
+void merge(
+    Builder& dst,
+    const unsigned of,
+    const unsigned threads,
+    const StringList& subsetOutputs)
 {
-    auto& item = manifest.at(originId);
+    std::vector<unsigned> ids(of);
+    std::iota(ids.begin(), ids.end(), 1u);
+    merge(dst, ids, of, threads, subsetOutputs);
+}
 
-    try
-    {
-        insert(cache, originId, counter);
-    }
-    catch (const std::exception& e)
+void merge(
+    Builder& dst,
+    const std::vector<unsigned>& ids,
+    const unsigned of,
+    const unsigned threads,
+    const StringList& subsetOutputs)
+{
+    if (subsetOutputs.size() && subsetOutputs.size() != of)
     {
-        item.source.info.errors.push_back(e.what());
+        throw std::runtime_error(
+            "Expected " + std::to_string(of) + " subset outputs, got " +
+            std::to_string(subsetOutputs.size()));
     }
-    catch (...)
+
+    // First, gather the subsets' manifests and hierarchies.  Nodes beneath
+    // the shared depth belong to exactly one subset and are adopted as they
+    // are, so only the few shared-depth nodes are recorded for re-insertion.
+    struct Shared
     {
-        item.source.info.errors.push_back("Unknown error during build");
-    }
+        unsigned id;
+        uint64_t count;
+        io::Type type;
+    };
+    std::map<Dxyz, std::vector<Shared>> shared;
+    std::vector<Manifest> manifests(of);
+    std::mutex mutex;
+
+    // Subsets written elsewhere must have their node files, from every depth,
+    // copied into our data.  These are gathered as source and destination
+    // paths.
+    using Copy = std::pair<std::string, std::string>;
+    std::vector<Copy> copies;
 
-    item.inserted = true;
-}
+    {
+        Pool pool(threads);
+        for (const unsigned id : ids)
+        {
+            const auto endpoints = std::make_shared<Endpoints>(
+                getSubsetEndpoints(dst.endpoints, subsetOutputs, id));
 
-void Builder::insert(
-    ChunkCache& cache,
-    const Origin originId,
-    std::atomic_uint64_t& counter)
-{
-    auto& item = manifest.at(originId);
-    auto& info(item.source.info);
-    const auto handle =
-        ensureGetLocalHandle(*endpoints.arbiter, item.source.path);
+            const std::string postfix = "-" + std::to_string(id);
+            if (!endpoints->output.tryGetSize("ept" + postfix + ".json"))
+            {
+                std::cout << "\t" << id << "/" << of << ": skipping" <<
+                    std::endl;
+                continue;
+            }
 
-    const std::string localPath = handle.localPath();
+            const bool relocate =
+                endpoints->output.prefixedRoot() !=
+                dst.endpoints.output.prefixedRoot();
 
-    ChunkKey ck(metadata.bounds, getStartDepth(metadata));
-    Clipper clipper(cache);
+            pool.add([
+                &dst, &shared, &manifests, &copies, &mutex,
+                endpoints, relocate, id, of, threads]()
+            {
+                trace::Span span("mergeLoad", std::to_string(id));
+                Builder src = builder::load(*endpoints, threads, id);
+                const uint64_t sharedDepth = getSharedDepth(src.metadata);
 
-    optional<ScaleOffset> so = getScaleOffset(metadata.schema);
-    const optional<Bounds> boundsSubset = metadata.subset
-        ? getBounds(metadata.bounds, *metadata.subset)
-        : optional<Bounds>();
+                std::vector<Copy> relocations;
+                if (relocate)
+                {
+                    src.hierarchy.forEach([&](const Dxyz& key, int64_t count)
+                    {
+                        if (!count) return;
+                        const std::string filename =
+                            key.toString() +
+                            getPostfix(src.metadata, key.d) +
+                            io::toExtension(
+                                io::getNodeType(src.metadata, key.d));
+                        relocations.emplace_back(
+                            src.endpoints.data.prefixedFullPath(filename),
+                            dst.endpoints.data.prefixedFullPath(filename));
+                    });
+                }
 
-    uint64_t inserted(0);
-    uint64_t pointId(0);
+                std::vector<std::pair<Dxyz, uint64_t>> local;
+                src.hierarchy.forEach([&](const Dxyz& key, int64_t count)
+                {
+                    if (!count) return;
+                    if (key.d < sharedDepth) local.emplace_back(key, count);
+                    else
+                    {
+                        assert(!hierarchy::get(dst.hierarchy, key));
+                        hierarchy::set(dst.hierarchy, key, count);
+                    }
+                });
+
+                manifests[id - 1] = std::move(src.manifest);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                for (const auto& p : local)
+                {
+                    shared[p.first].push_back({
+                        id,
+                        p.second,
+                        io::getNodeType(src.metadata, p.first.d) });
+                }
+                copies.insert(
+                    copies.end(),
+                    relocations.begin(),
+                    relocations.end());
+                std::cout << "\t" << id << "/" << of << ": loaded" <<
+                    std::endl;
+            });
+        }
+        pool.join();
+    }
 
-    auto layout = toLayout(metadata.absoluteSchema);
-    VectorPointTable table(layout);
-    table.setProcess([&]()
+    // Relocated nodes are copied by their drivers, so for a copy within a
+    // single remote service no point data passes through us.  The shared-depth
+    // nodes are copied as well, so they are merged below as if they had been
+    // written here.
+    if (copies.size())
     {
-        inserted += table.numPoints();
-        if (inserted > heuristics::sleepCount)
+        trace::Span span("mergeCopy", std::to_string(copies.size()));
+        std::cout << "\tCopying " << copies.size() << " nodes" << std::endl;
+
+        const arbiter::Arbiter& a(*dst.endpoints.arbiter);
+        Pool pool(threads);
+        for (const Copy& copy : copies)
         {
-            inserted = 0;
-            clipper.clip();
+            pool.add([&a, &copy]()
+            {
+                a.copyFile(copy.first, copy.second);
+                noteWrite(copy.second);
+            });
         }
+        pool.join();
 
-        Voxel voxel;
-        PointCounts counts;
-
-        Key key(metadata.bounds, getStartDepth(metadata));
+        if (pool.errors().size())
+        {
+            throw std::runtime_error(
+                "Failed to copy subset nodes: " + pool.errors().front());
+        }
+    }
 
-        for (auto it = table.begin(); it != table.end(); ++it)
+    for (const Manifest& m : manifests)
+    {
+        if (!m.empty())
         {
-            auto& pr = it.pointRef();
-            pr.setField(DimId::OriginId, originId);
-            pr.setField(DimId::PointId, pointId);
-            ++pointId;
+            dst.manifest = manifest::merge(std::move(dst.manifest), m);
+        }
+    }
 
-            voxel.initShallow(it.pointRef(), it.data());
-            if (so) voxel.clip(*so);
-            const Point& point(voxel.point());
+    // Then each shared-depth node is merged by a single task which streams
+    // that node from every subset in turn, so at most one node per thread is
+    // being read at any time.
+    ChunkCache cache(dst.endpoints, dst.metadata, dst.hierarchy, threads);
 
-            ck.reset();
+    {
+        Pool pool(threads);
+        for (const auto& node : shared)
+        {
+            const Dxyz& key = node.first;
+            const std::vector<Shared>& sources = node.second;
 
-            if (metadata.boundsConforming.contains(point))
+            pool.add([&dst, &cache, &key, &sources]()
             {
-                if (!boundsSubset || boundsSubset->contains(point))
+                trace::Span span("merge", key.toString());
+
+                // While each subset's node is inserted, the nodes of the
+                // subsets after it are fetched in the background.
+                for (const Shared& s : sources)
                 {
-                    key.init(point);
-                    cache.insert(voxel, key, ck, clipper);
-                    ++counts.inserts;
+                    const std::string postfix = "-" + std::to_string(s.id);
+                    if (!cache.prefetch(key, postfix, s.count, s.type)) break;
                 }
-            }
-        }
-        counter += counts.inserts;
-    });
-
-    json pipeline = info.pipeline.is_null()
-        ? json::array({ json::object() })
-        : info.pipeline;
-    pipeline.at(0)["filename"] = localPath;
 
-    // TODO: Allow this to be disabled via config.
-    const bool needsStats = !hasStats(info.schema);
-    if (needsStats)
-    {
-        json& statsFilter = findOrAppendStage(pipeline, "filters.stats");
-        if (!statsFilter.count("enumerate"))
-        {
-            statsFilter.update({ { "enumerate", "Classification" } });
+                Clipper clipper(cache);
+                for (const Shared& s : sources)
+                {
+                    const std::string postfix = "-" + std::to_string(s.id);
+                    mergeNode(
+                        dst,
+                        cache,
+                        clipper,
+                        key,
+                        s.count,
+                        postfix,
+                        s.type);
+                }
+            });
         }
+        pool.join();
     }
 
-    pdal::PipelineManager pm;
-    std::istringstream iss(pipeline.dump());
+    cache.join();
+}
 
-    std::unique_lock<std::mutex> lock(PdalMutex::get());
+namespace
+{
 
-    pm.readPipeline(iss);
-    pm.validateStageOptions();
-    pdal::Stage& last = getStage(pm);
-    last.prepare(table);
+const std::string mergeFilename("ept-merge.json");
+
+// Create the builder of our merged output from the subset with this ID, and
+// grab the total number of subsets.
+Builder createMerged(
+    const Endpoints& endpoints,
+    const unsigned threads,
+    const StringList& subsetOutputs,
+    const unsigned id,
+    unsigned& of)
+{
+    Builder base = builder::load(
+        getSubsetEndpoints(endpoints, subsetOutputs, id),
+        threads,
+        id);
+
+    // Clear the subsetting from our metadata aggregator which will represent
+    // our merged output.  Nothing else of this subset is needed, so its state
+    // is moved rather than copied.
+    Metadata metadata = std::move(base.metadata);
+    of = metadata.subset.value().of;
+    metadata.subset = { };
+    metadata.internal.subsetDataType.clear();
 
-    lock.unlock();
+    return Builder(endpoints, std::move(metadata), std::move(base.manifest));
+}
 
-    last.execute(table);
+// The IDs of the subsets which have been completed so far.  Subsets at our own
+// output are found by listing it, since their total may not yet be known.
+std::vector<unsigned> findSubsets(
+    const Endpoints& endpoints,
+    const StringList& subsetOutputs)
+{
+    std::vector<unsigned> ids;
+    if (subsetOutputs.size())
+    {
+        for (unsigned id = 1; id <= subsetOutputs.size(); ++id)
+        {
+            const arbiter::Endpoint out(
+                endpoints.arbiter->getEndpoint(subsetOutputs[id - 1]));
+            const std::string filename = "ept-" + std::to_string(id) + ".json";
+            if (out.tryGetSize(filename)) ids.push_back(id);
+        }
+        return ids;
+    }
 
-    // TODO:
-    // - update point count information for this file's metadata.
-    if (pdal::Stage* stage = findStage(last, "filters.stats"))
+    const std::string prefix("ept-"), postfix(".json");
+    for (const std::string& path : endpoints.arbiter->resolve(
+            endpoints.output.prefixedFullPath(prefix + "*")))
     {
-        const pdal::StatsFilter& statsFilter(
-            dynamic_cast<const pdal::StatsFilter&>(last));
+        const std::string name = arbiter::getBasename(path);
+        if (name.size() <= prefix.size() + postfix.size()) continue;
+        if (name.compare(name.size() - postfix.size(), postfix.size(), postfix))
+        {
+            continue;
+        }
 
-        for (Dimension& d : info.schema)
+        const std::string id = name.substr(
+            prefix.size(),
+            name.size() - prefix.size() - postfix.size());
+        if (std::all_of(id.begin(), id.end(), ::isdigit))
         {
-            const DimId id = layout.findDim(d.name);
-            d.stats = DimensionStats(statsFilter.getStats(id));
+            ids.push_back(std::stoul(id));
         }
     }
+    std::sort(ids.begin(), ids.end());
+    return ids;
 }
 
-void Builder::save(const unsigned threads)
-{
-    std::cout << "Saving" << std::endl;
-    saveHierarchy(threads);
-    saveSources(threads);
-    saveMetadata();
-}
+} // unnamed namespace
 
-void Builder::saveHierarchy(const unsigned threads)
+void merge(
+    const Endpoints& endpoints,
+    const unsigned threads,
+    const StringList& subsetOutputs)
 {
-    // If we are a) saving a subset or b) saving a partial build, then defer
-    // choosing a hierarchy step and instead just write one monolothic file.
-    const bool stepped =
-        !metadata.subset &&
-        std::all_of(manifest.begin(), manifest.end(), isSettled);
-
-    const unsigned step = stepped ? hierarchy::determineStep(hierarchy) : 0;
+    const Endpoints first = getSubsetEndpoints(endpoints, subsetOutputs, 1);
+    if (!first.output.tryGetSize("ept-1.json"))
+    {
+        throw std::runtime_error("Failed to find first subset");
+    }
 
-    hierarchy::save(
-        hierarchy,
-        endpoints.hierarchy,
-        step,
-        threads,
-        getPostfix(metadata));
+    unsigned of = 0;
+    Builder builder = createMerged(endpoints, threads, subsetOutputs, 1, of);
+    merge(builder, of, threads, subsetOutputs);
+    builder.save(threads);
 }
 
-void Builder::saveSources(const unsigned threads)
+void mergeIncrementally(
+    const Endpoints& endpoints,
+    const unsigned threads,
+    const StringList& subsetOutputs,
+    const uint64_t pollSeconds,
+    const bool resume)
 {
-    const std::string postfix = getPostfix(metadata);
-    const std::string manifestFilename = "manifest" + postfix + ".json";
-    const bool pretty = manifest.size() <= 1000;
+    std::unique_ptr<Builder> builder;
+    std::set<unsigned> merged;
+    unsigned of = 0;
 
-    if (metadata.subset)
-    {
-        // If we are a subset, write the whole detailed metadata as one giant
-        // blob, since we know we're going to need to wake up the whole thing to
-        // do the merge.
-        ensurePut(
-            endpoints.sources,
-            manifestFilename,
-            json(manifest).dump(getIndent(pretty)));
-    }
-    else
+    const auto progress =
+        resume ? endpoints.output.tryGet(mergeFilename) : nullptr;
+    if (progress)
     {
-        // Save individual per-file metadata.
-        manifest = assignMetadataPaths(manifest);
-        saveEach(manifest, endpoints.sources, threads, pretty);
+        const json j = json::parse(*progress);
+        if (j.value("saving", false))
+        {
+            throw std::runtime_error(
+                "This merge was interrupted while saving, and cannot be "
+                "resumed - re-run with '--force' to restart it");
+        }
 
-        // And in this case, we'll only write an overview for the manifest
-        // itself, which excludes things like detailed metadata.
-        ensurePut(
-            endpoints.sources,
-            manifestFilename,
-            toOverview(manifest).dump(getIndent(pretty)));
+        of = j.at("of").get<unsigned>();
+        merged = j.at("merged").get<std::set<unsigned>>();
+        builder = makeUnique<Builder>(builder::load(endpoints, threads, 0));
+        std::cout << "Resuming after " << merged.size() << "/" << of <<
+            " subsets" << std::endl;
     }
-}
 
-void Builder::saveMetadata()
-{
-    // If we've gained dimension stats during our build, accumulate them and
-    // add them to our main metadata.
-    const auto pred = [](const BuildItem& b) { return hasStats(b); };
-    if (!metadata.subset && std::all_of(manifest.begin(), manifest.end(), pred))
+    // An interruption while we save would leave the output partially ahead
+    // of our record of the merged subsets, so mark that we are saving until
+    // we are done.
+    const auto record = [&](const bool saving)
     {
-        Schema schema = clearStats(metadata.schema);
+        json progress = { { "of", of }, { "merged", merged } };
+        if (saving) progress["saving"] = true;
+        ensurePut(endpoints.output, mergeFilename, progress.dump(2));
+    };
 
-        for (const BuildItem& item : manifest)
+    while (!builder || merged.size() < of)
+    {
+        std::vector<unsigned> ready;
+        for (const unsigned id : findSubsets(endpoints, subsetOutputs))
         {
-            auto itemSchema = item.source.info.schema;
-            if (auto so = getScaleOffset(metadata.schema))
-            {
-                itemSchema = setScaleOffset(itemSchema, *so);
-            }
-            schema = combine(schema, itemSchema, true);
+            if (!merged.count(id)) ready.push_back(id);
         }
 
-        metadata.schema = schema;
-    }
+        if (ready.empty())
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(pollSeconds));
+            continue;
+        }
 
-    const std::string postfix = getPostfix(metadata);
+        if (!builder)
+        {
+            builder = makeUnique<Builder>(createMerged(
+                endpoints,
+                threads,
+                subsetOutputs,
+                ready.front(),
+                of));
+        }
 
-    const std::string metaFilename = "ept" + postfix + ".json";
-    json metaJson = metadata;
-    metaJson["points"] = getInsertedPoints(manifest);
-    ensurePut(endpoints.output, metaFilename, metaJson.dump(2));
+        // Subsets which have completed since our last poll are merged
+        // together, since their shared nodes are then rewritten only once.
+        std::cout << "Merging " << ready.size() << " subsets" << std::endl;
+        merge(*builder, ready, of, threads, subsetOutputs);
 
-    const std::string buildFilename = "ept-build" + postfix + ".json";
-    ensurePut(endpoints.output, buildFilename, json(metadata.internal).dump(2));
+        record(true);
+        merged.insert(ready.begin(), ready.end());
+        builder->save(threads);
+        record(false);
+
+        std::cout << "Merged " << merged.size() << "/" << of << " subsets" <<
+            std::endl;
+    }
 }
 
-namespace builder
+namespace
 {
 
-Builder load(
-    const Endpoints endpoints,
-    const unsigned threads,
-    const unsigned subsetId)
+// Read the points of one node which survive a removal, tallying those which
+// do not by their origin.
+PointBatch gatherNode(
+    const Builder& b,
+    const Removal& removal,
+    const Dxyz& key,
+    const uint64_t count,
+    std::map<Origin, uint64_t>& removed)
 {
-    const std::string postfix = subsetId ? "-" + std::to_string(subsetId) : "";
-    const json metadataJson = entwine::merge(
-        json::parse(endpoints.output.get("ept-build" + postfix + ".json")),
-        json::parse(endpoints.output.get("ept" + postfix + ".json")));
+    const Metadata& metadata = b.metadata;
+    pdal::PointLayout& layout(metadata.layouts->absolute());
+    const std::size_t pointSize = layout.pointSize();
 
-    const Metadata metadata = config::getMetadata(metadataJson);
+    PointBatch batch;
+    batch.data.resize(count * pointSize);
 
-    const Manifest manifest =
-        manifest::load(endpoints.sources, threads, postfix);
+    VectorPointTable table(layout, count);
+    table.setProcess([&]()
+    {
+        for (auto it(table.begin()); it != table.end(); ++it)
+        {
+            const pdal::PointRef& pr(it.pointRef());
+            const Point point(
+                pr.getFieldAs<double>(DimId::X),
+                pr.getFieldAs<double>(DimId::Y),
+                pr.getFieldAs<double>(DimId::Z));
+            const Origin origin(pr.getFieldAs<uint64_t>(DimId::OriginId));
+
+            if (
+                (!removal.bounds || removal.bounds->contains(point)) &&
+                (removal.origins.empty() || removal.origins.count(origin)))
+            {
+                ++removed[origin];
+                continue;
+            }
 
-    const Hierarchy hierarchy =
-        hierarchy::load(endpoints.hierarchy, threads, postfix);
+            std::memcpy(
+                batch.data.data() + batch.size * pointSize,
+                it.data(),
+                pointSize);
+            ++batch.size;
+        }
+    });
 
-    return Builder(endpoints, metadata, manifest, hierarchy);
+    const auto stem = key.toString() + getPostfix(metadata, key.d);
+    io::read(
+        io::getNodeType(metadata, key.d),
+        metadata,
+        b.endpoints,
+        stem,
+        table,
+        getNodeBounds(metadata, key));
+
+    batch.data.resize(batch.size * pointSize);
+    return batch;
 }
 
-void merge(Builder& dst, const Builder& src, ChunkCache& cache)
+} // unnamed namespace
+
+uint64_t remove(Builder& b, const Removal& removal, const unsigned threads)
 {
-    // TODO: Should make sure that the src/dst metadata match.  For now we're
-    // relying on the user not to have done anything weird.
-    const auto& endpoints = dst.endpoints;
-    const auto& metadata = dst.metadata;
+    const Metadata& metadata = b.metadata;
+    Hierarchy& hierarchy = b.hierarchy;
 
-    Clipper clipper(cache);
-    const auto sharedDepth = getSharedDepth(src.metadata);
-    for (const auto& node : src.hierarchy.map)
+    if (metadata.subset)
+    {
+        throw std::runtime_error("Cannot remove points from a subset");
+    }
+    if (metadata.internal.pack)
+    {
+        throw std::runtime_error("Cannot remove points from a packed build");
+    }
+    if (!contains(metadata.absoluteSchema, "OriginId"))
+    {
+        throw std::runtime_error("Removing points requires an OriginId");
+    }
+    if (!removal.bounds && removal.origins.empty())
     {
-        const Dxyz& key = node.first;
-        const uint64_t count = node.second;
-        if (!count) continue;
+        throw std::runtime_error("No points specified for removal");
+    }
 
-        if (key.d >= sharedDepth)
+    // Only nodes overlapping this region may hold points to be removed.
+    optional<Bounds> region = removal.bounds;
+    if (removal.origins.size())
+    {
+        Bounds origins = Bounds::expander();
+        for (const Origin origin : removal.origins)
         {
-            assert(!hierarchy::get(dst.hierarchy, key));
-            hierarchy::set(dst.hierarchy, key, count);
+            origins.grow(b.manifest.at(origin).source.info.bounds);
         }
-        else
+        region = region ? intersection(*region, origins) : origins;
+    }
+    else
+    {
+        // Only the sources overlapping our bounds may have points within them.
+        Bounds sources = Bounds::expander();
+        for (const Origin origin : SourceIndex(b.manifest).query(*region))
+        {
+            sources.grow(b.manifest.at(origin).source.info.bounds);
+        }
+        region = intersection(*region, sources);
+    }
+
+    std::vector<Dxyz> next;
+    const std::function<void(const ChunkKey&)> find = [&](const ChunkKey& ck)
+    {
+        if (!hierarchy::get(hierarchy, ck.dxyz())) return;
+        if (!ck.bounds().overlaps(*region)) return;
+        next.push_back(ck.dxyz());
+        for (uint64_t i = 0; i < 8; ++i) find(ck.getStep(toDir(i)));
+    };
+    find(ChunkKey(metadata.bounds, getStartDepth(metadata)));
+
+    std::map<Origin, uint64_t> removed;
+    std::set<Dxyz> cleared;
+    std::mutex mutex;
+
+    // Affected nodes are read and cleared, and their remaining points are
+    // reinserted from the root.  A cleared node may end up without points
+    // while its children remain, in which case those children are rebuilt in
+    // turn, so that their points rise to refill it.
+    while (next.size())
+    {
+        std::cout << "Rebuilding " << next.size() << " nodes" << std::endl;
+
+        std::vector<PointBatch> batches(next.size());
         {
-            auto layout = toLayout(metadata.absoluteSchema);
-            VectorPointTable table(layout, count);
-            table.setProcess([&]()
+            Pool pool(threads);
+            for (uint64_t i = 0; i < next.size(); ++i)
             {
-                Voxel voxel;
-                Key pk(metadata.bounds, getStartDepth(metadata));
-                ChunkKey ck(metadata.bounds, getStartDepth(metadata));
+                pool.add([&, i]()
+                {
+                    std::map<Origin, uint64_t> local;
+                    batches[i] = gatherNode(
+                        b,
+                        removal,
+                        next[i],
+                        hierarchy::get(hierarchy, next[i]),
+                        local);
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    for (const auto& p : local) removed[p.first] += p.second;
+                });
+            }
+            pool.join();
+        }
+
+        for (const Dxyz& key : next)
+        {
+            hierarchy.erase(key);
+            cleared.insert(key);
+        }
+
+        {
+            ChunkCache cache(b.endpoints, metadata, hierarchy, threads);
+            pdal::PointLayout& layout(metadata.layouts->absolute());
 
-                for (auto it(table.begin()); it != table.end(); ++it)
+            Pool pool(threads);
+            for (PointBatch& batch : batches)
+            {
+                if (!batch.size) continue;
+                pool.add([&]()
                 {
-                    voxel.initShallow(it.pointRef(), it.data());
-                    const Point point(voxel.point());
-                    pk.init(point, key.d);
-                    ck.init(point, key.d);
+                    Inserter inserter(metadata, cache, layout);
+                    inserter.insert(batch);
+                });
+            }
+            pool.join();
+            cache.join();
+        }
 
-                    assert(ck.dxyz() == key);
+        next.clear();
+        for (const Dxyz& key : cleared)
+        {
+            if (hierarchy.has(key)) continue;
 
-                    cache.insert(voxel, pk, ck, clipper);
+            ChunkKey ck(metadata.bounds, getStartDepth(metadata));
+            ck.init(key);
+            for (uint64_t i = 0; i < 8; ++i)
+            {
+                const Dxyz child = ck.getStep(toDir(i)).dxyz();
+                if (hierarchy.has(child) && !cleared.count(child))
+                {
+                    next.push_back(child);
                 }
-            });
+            }
+        }
+    }
 
-            const auto stem = key.toString() + getPostfix(src.metadata);
-            io::read(metadata.dataType, metadata, endpoints, stem, table);
+    // The data of nodes which no longer exist is removed where we can.
+    if (b.endpoints.output.isLocal())
+    {
+        for (const Dxyz& key : cleared)
+        {
+            if (hierarchy.has(key)) continue;
+            arbiter::remove(
+                arbiter::join(
+                    b.endpoints.data.prefixedRoot(),
+                    key.toString() + io::getNodeExtension(metadata, key.d)));
         }
     }
+
+    uint64_t total = 0;
+    for (const auto& p : removed)
+    {
+        auto& info = b.manifest.at(p.first).source.info;
+        info.points -= std::min<uint64_t>(info.points, p.second);
+        total += p.second;
+    }
+
+    b.save(threads);
+    return total;
 }
 
 } // namespace builder
@@ -11,18 +11,53 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
 #include <entwine/builder/chunk-cache.hpp>
 #include <entwine/builder/hierarchy.hpp>
+#include <entwine/builder/progress.hpp>
+#include <entwine/builder/source-index.hpp>
+#include <entwine/builder/source-log.hpp>
 #include <entwine/types/endpoints.hpp>
 #include <entwine/types/metadata.hpp>
+#include <entwine/types/point-counts.hpp>
 #include <entwine/types/source.hpp>
 #include <entwine/types/threads.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/throttle.hpp>
 
 namespace entwine
 {
 
+class Allotment;
+class Pool;
+
+// A contiguous range of points from a single source file.  A count of zero
+// means that the range extends through the end of the file.  If extract is
+// set, this range is fetched on its own via ranged reads rather than being
+// read from a local copy of the entire file.
+struct PointRange
+{
+    PointRange(
+        Origin origin,
+        uint64_t start = 0,
+        uint64_t count = 0,
+        bool extract = false)
+        : origin(origin)
+        , start(start)
+        , count(count)
+        , extract(extract)
+    { }
+
+    Origin origin;
+    uint64_t start;
+    uint64_t count;
+    bool extract;
+};
+
 struct Builder
 {
     Builder(
@@ -31,6 +66,10 @@ struct Builder
         Manifest manifest,
         Hierarchy hierarchy = Hierarchy());
 
+    // Set up our endpoints and memory for a build, which run() does, and
+    // which must otherwise be done before inserting points.
+    void prepare();
+
     uint64_t run(
         Threads threads,
         uint64_t limit = 0,
@@ -39,37 +78,177 @@ struct Builder
     void monitor(
         uint64_t progressIntervalSeconds,
         std::atomic_uint64_t& counter,
+        Progress& progress,
         std::atomic_bool& done);
 
     void runInserts(
         Threads threads,
         uint64_t limit,
-        std::atomic_uint64_t& counter);
-    void tryInsert(
-        ChunkCache& cache,
-        uint64_t origin,
-        std::atomic_uint64_t& counter);
-    void insert(
-        ChunkCache& cache,
-        uint64_t origin,
-        std::atomic_uint64_t& counter);
+        std::atomic_uint64_t& counter,
+        Progress& progress);
+    // Get the origins to be inserted, in the order in which they should be
+    // scheduled.
+    std::vector<Origin> getSchedule(
+        const SourceIndex& sources,
+        const Bounds& active,
+        uint64_t limit) const;
+    std::vector<PointRange> getRanges(Origin origin) const;
+    std::shared_ptr<arbiter::LocalHandle> fetchRange(
+        const PointRange& range) const;
+    // Insert a range of points from a local copy of its source file into each
+    // of these caches, which keep only the points within the bounds of their
+    // own builds.  Returns the schema of this file with statistics populated,
+    // if they were gathered while inserting this range.  The fates of the
+    // points read are added to counts.  The caller holds a slot of the
+    // throttle, which is checked between batches.
+    Schema insert(
+        const std::vector<ChunkCache*>& caches,
+        const PointRange& range,
+        const std::string& localPath,
+        std::atomic_uint64_t& counter,
+        PointCounts& counts,
+        Throttle& throttle);
     void save(unsigned threads);
 
+    // Save the parts of our state which describe our written nodes: our
+    // journal, hierarchy, packs, and node summaries, but not our sources or
+    // metadata.
+    void saveNodes(unsigned threads);
+
+    // Save the state of a build whose insertions are quiescent as a new
+    // checkpoint generation, after which the build continues.
+    void checkpoint(ChunkCache& cache, unsigned threads);
+
+    // Mark our build as saving a new checkpoint generation, until our
+    // metadata is saved.
+    void markCheckpoint();
+
+    // Publish the shallowest depths of a quiescent build, which has been
+    // written out, as a standalone EPT dataset in ept-preview.
+    void preview(unsigned threads);
+
+    void saveJournal(unsigned threads);
     void saveHierarchy(unsigned threads);
+
+    // Pack the data of the nodes of each hierarchy file into one object.
+    void savePacks(unsigned threads);
+
+    // Save the summaries of the nodes written since our last save.
+    void saveNodeStats(unsigned threads);
+    void saveNodeSizes(unsigned threads);
+    void saveProvenance(unsigned threads);
     void saveSources(unsigned threads);
-    void saveMetadata();
+
+    // Assign metadata paths to the entries of our manifest which lack them.
+    void assignSourcePaths();
+
+    // Save the detail of our manifest and then release it from memory, after
+    // which it is only loaded while each source is inserted or saved.
+    void compactSources(unsigned threads);
+    void saveMetadata(unsigned threads);
 
     Endpoints endpoints;
     Metadata metadata;
     Manifest manifest;
     Hierarchy hierarchy;
+
+    // The roots of the hierarchy files of our last save, if they were paged
+    // by node count.
+    hierarchy::Roots hierarchyRoots;
+
+    // When appending, whether each entry of our manifest was settled before
+    // this build.  The metadata of these entries is unchanged, and need not
+    // have been loaded in detail, so it is not rewritten.  Their statistics
+    // are taken from our schema as of this build's start.
+    std::vector<bool> settled;
+    Schema settledSchema;
+
+    // If our manifest is compact, the detail of the sources inserted since
+    // our last save, which is held here rather than in memory.
+    std::shared_ptr<SourceLog> sourceLog;
+
+    // The writer of the detail of each source as it finishes, and whether
+    // each entry of our manifest has been written by it, in which case our
+    // saves skip it.
+    std::shared_ptr<Pool> sourceWriter;
+    std::vector<bool> sourcesWritten;
+
+    // Other subsets of this build, with identical manifests, into which the
+    // points read by this build are also routed so that each source is read
+    // only once for all of them.  They are saved along with this build.
+    std::vector<Builder*> peers;
+
+    // A summary of our last run, as gathered by profile::observe.
+    json observed;
+
+    // If set by a Scheduler, our inserts run in its pool, which is shared with
+    // other builds, as our allotment admits them, and our chunks count against
+    // its memory budget rather than our own.
+    std::shared_ptr<Allotment> allotment;
 };
 
 namespace builder
 {
 
 Builder load(Endpoints endpoints, unsigned threads, unsigned subsetId);
-void merge(Builder& dst, const Builder& src, ChunkCache& cache);
+
+// Merge the subset builds at dst's output into dst, which should have been
+// created from their unsubsetted metadata.  Subset hierarchies are merged up
+// front, and then each shared-depth node is merged as a single task across
+// all subsets.
+//
+// If subset outputs are given, one per subset in order, each subset is read
+// from its own output instead, and its nodes are copied into dst's data with
+// server-side copies where the drivers allow.
+void merge(
+    Builder& dst,
+    unsigned of,
+    unsigned threads,
+    const StringList& subsetOutputs = { });
+
+// Merge only the subsets with these IDs, out of this many, into dst.  Shared
+// nodes which dst has already written, from earlier merges, are woken and
+// extended rather than replaced.
+void merge(
+    Builder& dst,
+    const std::vector<unsigned>& ids,
+    unsigned of,
+    unsigned threads,
+    const StringList& subsetOutputs = { });
+
+// Merge the complete set of subset builds at this output, or at these subset
+// outputs, into its final unsubsetted dataset, and save it.
+void merge(
+    const Endpoints& endpoints,
+    unsigned threads,
+    const StringList& subsetOutputs = { });
+
+// Merge the subset builds at this output, or at these subset outputs, as each
+// is completed, polling for them at this interval.  Each batch of completed
+// subsets is folded into the merged dataset, which is saved along with a
+// record of the subsets merged so far, from which the merge is resumed unless
+// resume is false.  The last subset to complete is then the only one left to
+// merge.
+void mergeIncrementally(
+    const Endpoints& endpoints,
+    unsigned threads,
+    const StringList& subsetOutputs,
+    uint64_t pollSeconds,
+    bool resume = true);
+
+// The points to be removed from a build: those of any of these origins which
+// lie within these bounds.  Either may be omitted, but not both.
+struct Removal
+{
+    optional<Bounds> bounds;
+    std::set<Origin> origins;
+};
+
+// Remove the matching points from a build in place, which is then saved.  Only
+// the nodes which may hold them are rebuilt, by reinserting their remaining
+// points, along with those descendants needed to refill the nodes which have
+// been emptied.  Returns the number of points removed.
+uint64_t remove(Builder& builder, const Removal& removal, unsigned threads);
 
 } // namespace builder
 
@@ -0,0 +1,126 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/checkpoint.hpp>
+
+#include <iostream>
+
+#include <entwine/io/io.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/util/io.hpp>
+
+namespace entwine
+{
+
+Checkpoint::Checkpoint(
+    const Endpoints& endpoints,
+    const Metadata& metadata,
+    const Hierarchy& hierarchy)
+    : m_endpoints(endpoints)
+    , m_metadata(metadata)
+    , m_hierarchy(hierarchy)
+    , m_enabled(
+        metadata.internal.checkpointMinutes ||
+        metadata.internal.checkpointFiles)
+    , m_postfix(getPostfix(metadata))
+    , m_generation(metadata.internal.checkpoint)
+{ }
+
+std::string Checkpoint::getDir(
+    const uint64_t generation,
+    const std::string& postfix)
+{
+    return "ept-checkpoint/" + std::to_string(generation) + postfix;
+}
+
+void Checkpoint::preserve(const ChunkKey& ck)
+{
+    if (!m_enabled) return;
+
+    uint64_t generation(0);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_written.insert(ck.dxyz()).second) return;
+        generation = m_generation;
+    }
+
+    // Nodes created since the checkpoint are absent from its hierarchy, and
+    // will be started afresh by a restored build.
+    if (!hierarchy::get(m_hierarchy, ck.dxyz())) return;
+
+    const std::string path(
+        ck.toString() +
+        getPostfix(m_metadata, ck.depth()) +
+        io::toExtension(io::getNodeType(m_metadata, ck.depth())));
+
+    const std::string dir(getDir(generation, m_postfix));
+    if (m_endpoints.output.isLocal())
+    {
+        arbiter::mkdirp(arbiter::join(m_endpoints.output.prefixedRoot(), dir));
+    }
+
+    ensurePut(
+        m_endpoints.output.getSubEndpoint(dir),
+        path,
+        ensureGetBinary(m_endpoints.data, path));
+}
+
+void Checkpoint::commit(const uint64_t generation)
+{
+    if (!m_enabled) return;
+
+    uint64_t previous(0);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        previous = m_generation;
+        m_generation = generation;
+        m_written.clear();
+    }
+
+    // Our arbiter cannot remove remote files, so obsolete generations are
+    // only cleaned up for local output.
+    if (previous == generation || !m_endpoints.output.isLocal()) return;
+
+    const arbiter::Endpoint ep(
+        m_endpoints.output.getSubEndpoint(getDir(previous, m_postfix)));
+    for (const std::string& f : m_endpoints.arbiter->resolve(
+            arbiter::join(ep.prefixedRoot(), "*")))
+    {
+        arbiter::remove(f);
+    }
+    arbiter::remove(ep.prefixedRoot());
+}
+
+void Checkpoint::restore(
+    const Endpoints& endpoints,
+    const uint64_t generation,
+    const std::string postfix)
+{
+    const arbiter::Endpoint ep(
+        endpoints.output.getSubEndpoint(getDir(generation, postfix)));
+    const std::string root(ep.prefixedRoot());
+
+    uint64_t restored(0);
+    for (const std::string& f : endpoints.arbiter->resolve(
+            arbiter::join(root, "*")))
+    {
+        const std::string path(f.substr(root.size()));
+        ensurePut(endpoints.data, path, ensureGetBinary(ep, path));
+        ++restored;
+    }
+
+    if (restored)
+    {
+        std::cout << "Restored " << restored << " nodes from checkpoint " <<
+            generation << std::endl;
+    }
+}
+
+} // namespace entwine
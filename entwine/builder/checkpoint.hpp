@@ -0,0 +1,68 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/types/endpoints.hpp>
+#include <entwine/types/key.hpp>
+
+namespace entwine
+{
+
+struct Metadata;
+
+// The saved hierarchy and manifest of a build describe its data as of its
+// latest checkpoint, but nodes continue to be rewritten in place afterward.
+// So that an interrupted build may be restored to exactly its checkpointed
+// state, the first rewrite of each checkpointed node first copies its data
+// aside, into a directory for the checkpoint's generation.
+class Checkpoint
+{
+public:
+    Checkpoint(
+        const Endpoints& endpoints,
+        const Metadata& metadata,
+        const Hierarchy& hierarchy);
+
+    // Called before each write of this node.
+    void preserve(const ChunkKey& ck);
+
+    // Called once the state of a new generation has been saved, after which
+    // the nodes preserved for the previous one are obsolete.
+    void commit(uint64_t generation);
+
+    // Restore the nodes of an interrupted build to their state as of this
+    // generation.
+    static void restore(
+        const Endpoints& endpoints,
+        uint64_t generation,
+        std::string postfix = "");
+
+private:
+    static std::string getDir(uint64_t generation, const std::string& postfix);
+
+    const Endpoints& m_endpoints;
+    const Metadata& m_metadata;
+    const Hierarchy& m_hierarchy;
+    const bool m_enabled;
+    const std::string m_postfix;
+
+    std::mutex m_mutex;
+    uint64_t m_generation;
+    std::set<Dxyz> m_written;
+};
+
+} // namespace entwine
@@ -10,23 +10,70 @@
 
 #include <entwine/builder/chunk-cache.hpp>
 
+#include <deque>
+#include <limits>
+
 #include <entwine/builder/clipper.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/util/access-trace.hpp>
+#include <entwine/util/node-cache.hpp>
+#include <entwine/util/node-prefetcher.hpp>
+#include <entwine/util/numa.hpp>
+#include <entwine/util/ring.hpp>
+#include <entwine/util/uploader.hpp>
 
 namespace entwine
 {
 
 namespace
 {
-    SpinLock infoSpin;
-    ChunkCache::Info info;
+    // These are updated by every thread, so each has its own cache line.
+    struct alignas(64) Tally
+    {
+        void add(uint64_t n = 1) { v.fetch_add(n, std::memory_order_relaxed); }
+        void sub() { v.fetch_sub(1, std::memory_order_relaxed); }
+
+        std::atomic_uint64_t v{ 0 };
+    };
+
+    struct Tallies
+    {
+        Tally written;
+        Tally read;
+        Tally alive;
+        Tally bytesWritten;
+        Tally bytesRead;
+        Tally evictions;
+        Tally reclaims;
+    };
+
+    Tallies tallies;
+
+    // With NUMA placement, clip threads are spread round-robin across nodes.
+    Pool::Start getStart(const Metadata& metadata)
+    {
+        if (!metadata.internal.numa) return Pool::Start();
+
+        const std::vector<numa::Node> nodes = numa::nodes();
+        if (nodes.size() < 2) return Pool::Start();
+
+        return [nodes](std::size_t index)
+        {
+            numa::pin(nodes[index % nodes.size()]);
+        };
+    }
 }
 
 ChunkCache::Info ChunkCache::latchInfo()
 {
-    SpinGuard lock(infoSpin);
-    Info latched = info;
-    info.written = 0;
-    info.read = 0;
+    Info latched;
+    latched.written = tallies.written.v.exchange(0);
+    latched.read = tallies.read.v.exchange(0);
+    latched.alive = tallies.alive.v.load();
+    latched.bytesWritten = tallies.bytesWritten.v.exchange(0);
+    latched.bytesRead = tallies.bytesRead.v.exchange(0);
+    latched.evictions = tallies.evictions.v.exchange(0);
+    latched.reclaims = tallies.reclaims.v.exchange(0);
     return latched;
 }
 
@@ -34,31 +81,161 @@ ChunkCache::ChunkCache(
     const Endpoints& endpoints,
     const Metadata& metadata,
     Hierarchy& hierarchy,
-    const uint64_t threads)
+    const uint64_t threads,
+    const uint64_t maxThreads)
     : m_endpoints(endpoints)
     , m_metadata(metadata)
     , m_hierarchy(hierarchy)
-    , m_pool(threads)
-{ }
+    , m_checkpoint(m_endpoints, metadata, hierarchy)
+    , m_throttle(threads)
+    , m_pool(std::max(threads, maxThreads), 1, true, getStart(metadata))
+    , m_cacheSize(metadata.internal.cacheSize)
+    , m_memory(metadata.internal.memory)
+    , m_resident(0)
+    , m_pinnedDepth(
+        std::min<uint64_t>(
+            metadata.internal.pinnedDepth,
+            heuristics::maxPinnedDepth))
+{
+    for (uint64_t depth(0); depth < m_pinnedDepth; ++depth)
+    {
+        m_pinned.emplace_back(1ull << (depth * 3));
+    }
+
+    // Background overflows are never refused, since the thread handing one
+    // off may hold a chunk which is still being built, for which a blocked
+    // overflow thread could be waiting.  Their memory remains accounted as
+    // resident until they have been pushed down.
+    if (const uint64_t threads = metadata.internal.overflowThreads)
+    {
+        m_overflowPool = makeUnique<Pool>(
+            threads,
+            std::numeric_limits<std::size_t>::max(),
+            true,
+            getStart(metadata));
+    }
+
+    // Local writes may be queued to a ring rather than to upload threads,
+    // unless the ring is unavailable here.
+    std::unique_ptr<Ring> ring;
+    if (metadata.internal.ioUring && m_endpoints.data.isLocal())
+    {
+        ring = Ring::create(heuristics::ringEntries);
+    }
+
+    const uint64_t uploadThreads = metadata.internal.uploadThreads;
+    if (uploadThreads || ring)
+    {
+        m_endpoints.uploader = std::make_shared<Uploader>(
+            std::max<uint64_t>(uploadThreads, 1),
+            heuristics::uploadBytes,
+            std::move(ring));
+    }
+
+    // Nodes evicted from the node cache are written directly, or via our
+    // uploader if we have one.
+    if (const uint64_t bytes = metadata.internal.nodeCache)
+    {
+        const Endpoints direct(m_endpoints);
+        m_endpoints.nodeCache = std::make_shared<NodeCache>(
+            bytes,
+            [direct](const std::string& path, std::vector<char> data)
+            {
+                putData(direct, path, std::move(data));
+            });
+    }
+
+    // Local nodes are mapped rather than fetched, so gain nothing from this.
+    const uint64_t prefetch(metadata.internal.nodePrefetch);
+    if (prefetch && !m_endpoints.data.isLocal())
+    {
+        m_endpoints.nodePrefetcher = std::make_shared<NodePrefetcher>(
+            m_endpoints.data,
+            heuristics::nodePrefetchThreads,
+            prefetch);
+    }
+}
 
 ChunkCache::~ChunkCache()
 {
     join();
+
+    // Anything still counted as ours no longer holds the shared budget.
+    if (m_allotment) m_allotment->removeResident(m_resident);
 }
 
 void ChunkCache::join()
 {
+    awaitOverflows();
+    if (m_overflowPool) m_overflowPool->join();
     maybePurge(0);
+    savePinned();
     m_pool.join();
+    if (m_endpoints.nodeCache) m_endpoints.nodeCache->flush();
+    if (m_endpoints.uploader) m_endpoints.uploader->join();
+
+#ifndef NDEBUG
+    for (const auto& shards : m_slices)
+    {
+        for (const Slice& slice : shards) assert(slice.map.empty());
+    }
+#endif
+}
+
+void ChunkCache::flush()
+{
+    awaitOverflows();
+    maybePurge(0);
+    savePinned();
+    m_pool.await();
+    if (m_endpoints.nodeCache) m_endpoints.nodeCache->flush();
+    if (m_endpoints.uploader) m_endpoints.uploader->await();
+}
+
+void ChunkCache::persist()
+{
+    awaitOverflows();
+
+    std::vector<Dxyz> owned;
+    {
+        SpinGuard ownedLock(m_ownedSpin);
+        owned.reserve(m_owned.size());
+        for (const auto& p : m_owned) owned.push_back(p.first);
+    }
+
+    // Our owned chunks hold only our own references, so nothing may evict or
+    // insert into them while they are written.
+    for (const Dxyz& dxyz : owned)
+    {
+        m_pool.add([this, dxyz]()
+        {
+            Throttle::Guard guard(m_throttle);
+
+            Slice& slice(getSlice(dxyz.depth(), dxyz.position()));
+            UniqueSpin sliceLock(slice.spin);
+            Chunk& chunk(slice.map.at(dxyz.position()).chunk());
+            sliceLock.unlock();
 
-    assert(
-        std::all_of(
-            m_slices.begin(),
-            m_slices.end(),
-            [](const std::map<Xyz, ReffedChunk>& slice)
+            save(chunk);
+        });
+    }
+
+    for (auto& depth : m_pinned)
+    {
+        for (Pinned& pinned : depth)
+        {
+            if (!pinned.chunk.load()) continue;
+            m_pool.add([this, &pinned]()
             {
-                return slice.empty();
-            }));
+                Throttle::Guard guard(m_throttle);
+                save(*pinned.owned);
+            });
+        }
+    }
+
+    m_pool.await();
+    if (m_endpoints.nodeCache) m_endpoints.nodeCache->flush();
+    if (m_endpoints.uploader) m_endpoints.uploader->await();
 }
 
 void ChunkCache::insert(
@@ -69,8 +246,23 @@ void ChunkCache::insert(
 {
     assert(ck.depth() < maxDepth);
 
-    // Get from single-threaded cache if we can.
-    Chunk* chunk = clipper.get(ck);
+    if (isTooDeep(ck))
+    {
+        metrics::add(metrics::Counter::TooDeep);
+        return;
+    }
+
+    if (isSplit(ck))
+    {
+        clipper.split()->write(voxel);
+        return;
+    }
+
+    // Pinned chunks need no per-thread bookkeeping.
+    Chunk* chunk = isPinned(ck) ? &getPinned(ck, clipper) : nullptr;
+
+    // Otherwise get from single-threaded cache if we can.
+    if (!chunk) chunk = clipper.get(ck);
 
     // Otherwise, make sure it's initialized and increment its ref count.
     if (!chunk) chunk = &addRef(ck, clipper);
@@ -80,19 +272,207 @@ void ChunkCache::insert(
 
     // Failed to insert - need to traverse to the next depth.
     key.step(voxel.point());
-    const Dir dir(getDirection(ck.bounds().mid(), voxel.point()));
+    const Dir dir(getDirection(ck.mid(), voxel.point()));
     insert(voxel, key, chunk->childAt(dir), clipper);
 }
 
+void ChunkCache::insert(
+        Insertions& group,
+        const ChunkKey& ck,
+        Clipper& clipper)
+{
+    assert(ck.depth() < maxDepth);
+
+    if (isTooDeep(ck))
+    {
+        metrics::add(metrics::Counter::TooDeep, group.size());
+        return;
+    }
+
+    if (isSplit(ck))
+    {
+        clipper.split()->write(group);
+        return;
+    }
+
+    Chunk* chunk = isPinned(ck) ? &getPinned(ck, clipper) : nullptr;
+    if (!chunk) chunk = clipper.get(ck);
+    if (!chunk) chunk = &addRef(ck, clipper);
+
+    // Whatever doesn't fit here is grouped by the child to which it belongs.
+    std::array<Insertions, 8> children;
+    const Point mid(ck.mid());
+
+    if (Stage* stage = clipper.stage(ck))
+    {
+        // Losers which the shared chunk would hold as overflow are deferred
+        // until the merge.  Once a chunk has no overflow in some direction it
+        // never will again, so the rest may safely continue downward.
+        std::array<bool, 8> overflows;
+        for (uint64_t i(0); i < overflows.size(); ++i)
+        {
+            overflows[i] = chunk->overflows(toDir(i));
+        }
+
+        Stage::Node& node(stage->node(ck));
+        for (Insertion& insertion : group)
+        {
+            Voxel& voxel(insertion.voxel);
+            Key& key(insertion.key);
+
+            if (stage->insert(node, voxel, key)) continue;
+
+            const Dir dir(getDirection(mid, voxel.point()));
+            if (overflows[toIntegral(dir)])
+            {
+                stage->defer(node, voxel, key);
+                continue;
+            }
+
+            key.step(voxel.point());
+            children[toIntegral(dir)].push_back(insertion);
+        }
+    }
+    else
+    {
+        for (Insertion& insertion : group)
+        {
+            Voxel& voxel(insertion.voxel);
+            Key& key(insertion.key);
+
+            if (chunk->insert(*this, clipper, voxel, key)) continue;
+
+            key.step(voxel.point());
+            const Dir dir(getDirection(mid, voxel.point()));
+            children[toIntegral(dir)].push_back(insertion);
+        }
+    }
+
+    for (uint64_t i(0); i < children.size(); ++i)
+    {
+        if (children[i].empty()) continue;
+        insert(children[i], chunk->childAt(toDir(i)), clipper);
+    }
+}
+
+void ChunkCache::pushDown(
+        std::unique_ptr<Overflow> overflow,
+        Clipper& clipper)
+{
+    if (!m_overflowPool) return pushDown(*overflow, clipper);
+
+    // Each background overflow references its chunks through its own clipper,
+    // which releases them once it is done.
+    const std::shared_ptr<Overflow> shared(std::move(overflow));
+    m_overflowPool->add([this, shared]()
+    {
+        Clipper clipper(*this);
+        pushDown(*shared, clipper);
+    });
+}
+
+void ChunkCache::pushDown(Overflow& overflow, Clipper& clipper)
+{
+    const ChunkKey ck(overflow.chunkKey);
+
+    // Spilled entries come first, so insertion order is preserved.
+    overflow.forEachSpilled(heuristics::spillBatchPoints, [&](Insertions& list)
+    {
+        insert(list, ck, clipper);
+    });
+
+    Insertions list(overflow.insertions());
+    insert(list, ck, clipper);
+
+    removeResident(overflow.block.bytes());
+}
+
+void ChunkCache::awaitOverflows()
+{
+    if (!m_overflowPool) return;
+
+    m_overflowPool->await();
+    if (m_overflowPool->errors().size())
+    {
+        throw std::runtime_error(
+            "Overflow failed: " + m_overflowPool->errors().front());
+    }
+}
+
+Chunk& ChunkCache::getPinned(const ChunkKey& ck, Clipper& clipper)
+{
+    const uint64_t d(ck.depth());
+    const Xyz& p(ck.position());
+    Pinned& pinned(m_pinned[d][(p.x << (2 * d)) | (p.y << d) | p.z]);
+
+    if (Chunk* chunk = pinned.chunk.load(std::memory_order_acquire))
+    {
+        return *chunk;
+    }
+
+    UniqueSpin lock(pinned.spin);
+    if (Chunk* chunk = pinned.chunk.load(std::memory_order_relaxed))
+    {
+        return *chunk;
+    }
+
+    pinned.owned = makeUnique<Chunk>(m_metadata, ck, m_hierarchy);
+    Chunk& chunk(*pinned.owned);
+    pinned.chunk.store(&chunk, std::memory_order_release);
+    lock.unlock();
+
+    tallies.alive.add();
+    metrics::add(metrics::Gauge::ChunksAlive, 1);
+    metrics::add(metrics::Counter::ChunkMisses);
+
+    // As for other chunks, other threads may insert here while we load the
+    // data of a continued build.  Our load may itself insert here, so we must
+    // not hold our lock.
+    if (const uint64_t np = hierarchy::get(m_hierarchy, ck.dxyz()))
+    {
+        load(chunk, clipper, np);
+    }
+
+    return chunk;
+}
+
+void ChunkCache::savePinned()
+{
+    for (auto& depth : m_pinned)
+    {
+        for (Pinned& pinned : depth)
+        {
+            if (!pinned.chunk.load()) continue;
+
+            metrics::add(metrics::Gauge::SerializeQueue, 1);
+            m_pool.add([this, &pinned]()
+            {
+                Throttle::Guard guard(m_throttle);
+                metrics::add(metrics::Gauge::SerializeQueue, -1);
+                Chunk& chunk(*pinned.owned);
+                save(chunk);
+                removeResident(chunk.residentBytes());
+
+                pinned.chunk.store(nullptr);
+                pinned.owned.reset();
+
+                metrics::add(metrics::Gauge::ChunksAlive, -1);
+                tallies.evictions.add();
+                tallies.alive.sub();
+            });
+        }
+    }
+}
+
 Chunk& ChunkCache::addRef(const ChunkKey& ck, Clipper& clipper)
 {
     // This is the first access of this chunk for a particular thread.
-    UniqueSpin sliceLock(m_spins[ck.depth()]);
+    Slice& slice(getSlice(ck.depth(), ck.position()));
+    UniqueSpin sliceLock(slice.spin);
 
-    auto& slice(m_slices[ck.depth()]);
-    auto it(slice.find(ck.position()));
+    auto it(slice.map.find(ck.position()));
 
-    if (it != slice.end())
+    if (it != slice.map.end())
     {
         // We've found a reffed chunk here.  The chunk itself may not exist,
         // since the serialization and deletion steps occur asynchronously.
@@ -102,34 +482,46 @@ Chunk& ChunkCache::addRef(const ChunkKey& ck, Clipper& clipper)
 
         sliceLock.unlock();
 
-        if (!ref.exists())
+        // This chunk is being built, or written out.  Since we've added our
+        // reference, it will be resident once either is complete.
+        if (ref.state() != ReffedChunk::State::Ready)
         {
-            assert(ref.count() == 1);
+            ref.await(chunkLock);
+            assert(ref.exists());
+        }
 
+        if (!ref.exists())
+        {
             // This chunk has already been serialized, but we've caught hold of
-            // its lock before it was actually erased from our map.  In this
-            // case, we'll need to reinitialize the resident chunk from its
-            // remote source.  Our newly added reference will keep it from
-            // being erased.
+            // its lock before it was actually erased from our map, or the
+            // thread which was building it has failed.  In either case, we'll
+            // need to initialize the resident chunk ourselves, from its remote
+            // source if it has one.  Our newly added reference will keep it
+            // from being erased.
             ref.assign(m_metadata, ck, m_hierarchy);
             assert(ref.exists());
 
-            {
-                SpinGuard lock(infoSpin);
-                ++info.read;
-            }
+            metrics::add(metrics::Counter::ChunkMisses);
 
             const uint64_t np = hierarchy::get(m_hierarchy, ck.dxyz());
-            assert(np);
+            accessTrace::record(
+                np ? accessTrace::Event::Rewake : accessTrace::Event::Create,
+                ck.dxyz());
 
             // Need to insert this ref prior to loading the chunk or we'll end
-            // up deadlocked.
+            // up deadlocked.  As for a new chunk, other threads may insert
+            // here while we load, so they needn't wait on our remote read.
             clipper.set(ck, &ref.chunk());
-            ref.chunk().load(*this, clipper, m_endpoints, np);
+            chunkLock.unlock();
+            if (np) load(ref.chunk(), clipper, np);
+        }
+        else
+        {
+            clipper.set(ck, &ref.chunk());
+            chunkLock.unlock();
+            metrics::add(metrics::Counter::ChunkHits);
+            accessTrace::record(accessTrace::Event::Hit, ck.dxyz());
         }
-        else clipper.set(ck, &ref.chunk());
-
-        chunkLock.unlock();
 
         // If we've reclaimed this chunk while it sits in our ownership list,
         // remove it from that list - it is now communally owned.
@@ -141,38 +533,73 @@ Chunk& ChunkCache::addRef(const ChunkKey& ck, Clipper& clipper)
             assert(ref.count() > 1);
             ref.del();
             m_owned.erase(it);
+            metrics::add(metrics::Counter::ChunkReclaims);
+            tallies.reclaims.add();
+            accessTrace::record(accessTrace::Event::Reclaim, ck.dxyz());
         }
 
         return ref.chunk();
     }
 
-    // Couldn't find this chunk, create it.
-    auto insertion = slice.emplace(
+    // Couldn't find this chunk, so insert a placeholder for it.  Building the
+    // chunk allocates its tubes and consults the hierarchy, so that happens
+    // after our slice lock is released to avoid stalling this whole shard.
+    auto insertion = slice.map.emplace(
             std::piecewise_construct,
             std::forward_as_tuple(ck.position()),
-            std::forward_as_tuple(m_metadata, ck, m_hierarchy));
+            std::forward_as_tuple());
 
-    {
-        SpinGuard lock(infoSpin);
-        ++info.alive;
-    }
+    tallies.alive.add();
+    metrics::add(metrics::Gauge::ChunksAlive, 1);
+    metrics::add(metrics::Counter::ChunkMisses);
 
     it = insertion.first;
     assert(insertion.second);
 
     ReffedChunk& ref = it->second;
-    SpinGuard chunkLock(ref.spin());
+    UniqueSpin chunkLock(ref.spin());
 
-    // We shouldn't have any existing refs yet, but the chunk should exist.
+    // We shouldn't have any existing refs yet, nor a chunk.
     assert(!ref.count());
-    assert(ref.exists());
+    assert(!ref.exists());
 
     // Since we're still holding the slice lock, no one else can access this
-    // chunk yet.  Add our ref and then we can release the slice lock.
+    // chunk yet.  Add our ref and then we can release the slice lock.  Our
+    // ref keeps the placeholder from being erased while we build the chunk.
     ref.add();
-    clipper.set(ck, &ref.chunk());
 
     sliceLock.unlock();
+    chunkLock.unlock();
+
+    std::unique_ptr<Chunk> chunk;
+    try
+    {
+        chunk = makeUnique<Chunk>(m_metadata, ck, m_hierarchy);
+    }
+    catch (...)
+    {
+        // Wake anyone awaiting our placeholder, who will find it empty and
+        // build the chunk themselves.  If no one is, the placeholder goes.
+        sliceLock.lock();
+        chunkLock.lock();
+        ref.setState(ReffedChunk::State::Ready);
+        const bool unreffed(!ref.del());
+        chunkLock.unlock();
+
+        if (unreffed)
+        {
+            slice.map.erase(ck.position());
+            tallies.alive.sub();
+            metrics::add(metrics::Gauge::ChunksAlive, -1);
+        }
+        throw;
+    }
+
+    chunkLock.lock();
+    ref.assign(std::move(chunk));
+    ref.setState(ReffedChunk::State::Ready);
+    clipper.set(ck, &ref.chunk());
+    chunkLock.unlock();
 
     // Initialize with remote data if we're reawakening this chunk.  It's ok
     // if other threads are inserting here concurrently, and we have already
@@ -181,32 +608,112 @@ Chunk& ChunkCache::addRef(const ChunkKey& ck, Clipper& clipper)
     // Note that this in the case of a continued build, this chunk may have
     // been serialized prior to the current build process, so we still need to
     // check this.
-    if (const uint64_t np = hierarchy::get(m_hierarchy, ck.dxyz()))
+    const uint64_t np = hierarchy::get(m_hierarchy, ck.dxyz());
+    accessTrace::record(
+        np ? accessTrace::Event::Rewake : accessTrace::Event::Create,
+        ck.dxyz());
+    if (np) load(ref.chunk(), clipper, np);
+
+    return ref.chunk();
+}
+
+void ChunkCache::save(Chunk& chunk)
+{
+    // A chunk which is unchanged since it was loaded is simply dropped, since
+    // its saved data is already current.
+    if (!chunk.dirty())
+    {
+        metrics::add(metrics::Counter::ChunkSkips);
+        return;
+    }
+
+    m_checkpoint.preserve(chunk.chunkKey());
+
+    uint64_t np(0);
+    {
+        metrics::ScopedLatency latency(metrics::Histogram::ChunkSave);
+        np = chunk.save(m_endpoints);
+    }
+    hierarchy::set(m_hierarchy, chunk.chunkKey().get(), np);
+    assert(np);
+
+    // Nothing may insert here while we serialize, so once our write is
+    // complete we are clean even if we are reclaimed after it.
+    chunk.clean();
+
+    tallies.written.add();
+    tallies.bytesWritten.add(np * getPointSize(m_metadata.absoluteSchema));
+    metrics::add(metrics::Counter::ChunkWrites);
+}
+
+void ChunkCache::load(Chunk& chunk, Clipper& clipper, const uint64_t np)
+{
+    tallies.read.add();
+    tallies.bytesRead.add(np * getPointSize(m_metadata.absoluteSchema));
+    metrics::add(metrics::Counter::ChunkRewakes);
+
+    metrics::ScopedLatency latency(metrics::Histogram::ChunkLoad);
+    chunk.load(*this, clipper, m_endpoints, np);
+}
+
+void ChunkCache::prefetch(const Bounds& bounds)
+{
+    if (!m_endpoints.nodePrefetcher) return;
+
+    // Shallower nodes are woken first, so they are fetched first.  Nodes
+    // without points hold no children.
+    std::deque<ChunkKey> queue;
+    queue.emplace_back(m_metadata.bounds, getStartDepth(m_metadata));
+    while (!queue.empty())
     {
+        const ChunkKey ck(queue.front());
+        queue.pop_front();
+
+        const uint64_t np = hierarchy::get(m_hierarchy, ck.dxyz());
+        if (!np || !ck.bounds().overlaps(bounds)) continue;
+
+        const std::string postfix(getPostfix(m_metadata, ck.depth()));
+        const io::Type type(io::getNodeType(m_metadata, ck.depth()));
+        if (!prefetch(ck.dxyz(), postfix, np, type)) return;
+
+        const auto counts(m_hierarchy.getChildren(ck.dxyz()));
+        for (std::size_t i(0); i < counts.size(); ++i)
         {
-            SpinGuard lock(infoSpin);
-            ++info.read;
+            if (counts[i]) queue.push_back(ck.getStep(toDir(i)));
         }
-
-        ref.chunk().load(*this, clipper, m_endpoints, np);
     }
+}
 
-    return ref.chunk();
+bool ChunkCache::prefetch(
+    const Dxyz& key,
+    const std::string& postfix,
+    const uint64_t np,
+    const io::Type type)
+{
+    NodePrefetcher* prefetcher(m_endpoints.nodePrefetcher.get());
+    if (!prefetcher) return false;
+
+    // Our budget is reserved by the size of the node's absolute point data,
+    // which bounds its encoded size in practice.
+    return prefetcher->fetch(
+        key.toString() + postfix + io::toExtension(type),
+        np * getPointSize(m_metadata.absoluteSchema));
 }
 
-void ChunkCache::clip(uint64_t depth, const std::map<Xyz, Chunk*>& stale)
+void ChunkCache::clip(uint64_t depth, const std::vector<Xyz>& stale)
 {
     if (stale.empty()) return;
 
-    auto& slice(m_slices[depth]);
-    UniqueSpin sliceLock(m_spins[depth]);
-
-    for (const auto& p : stale)
+    for (const Xyz& key : stale)
     {
-        const auto& key(p.first);
-        assert(slice.count(key));
+        accessTrace::record(accessTrace::Event::Clip, depth, key);
+
+        Slice& slice(getSlice(depth, key));
+        UniqueSpin sliceLock(slice.spin);
 
-        ReffedChunk& ref(slice.at(key));
+        assert(slice.map.count(key));
+
+        ReffedChunk& ref(slice.map.at(key));
         UniqueSpin chunkLock(ref.spin());
 
         assert(ref.count());
@@ -215,67 +722,154 @@ void ChunkCache::clip(uint64_t depth, const std::map<Xyz, Chunk*>& stale)
             // Defer erasing here, instead adding taking ownership.
             ref.add();
 
+            Owned owned;
+            owned.bytes = ref.chunk().residentBytes();
+
             chunkLock.unlock();
             sliceLock.unlock();
 
-            {
-                SpinGuard ownedLock(m_ownedSpin);
-                const Dxyz dxyz(depth, key);
-                assert(!m_owned.count(dxyz));
-                m_owned.insert(dxyz);
-            }
-
-            sliceLock.lock();
+            SpinGuard ownedLock(m_ownedSpin);
+            const Dxyz dxyz(depth, key);
+            assert(!m_owned.count(dxyz));
+            owned.stamp = ++m_stamp;
+            m_owned[dxyz] = owned;
         }
     }
 }
 
 void ChunkCache::maybePurge(const uint64_t maxCacheSize)
 {
-    uint64_t disowned(0);
     UniqueSpin ownedLock(m_ownedSpin);
+
+    // Our priorities are computed once and consumed from the back, skipping
+    // any chunks which have been reclaimed in the meantime.
+    std::vector<Dxyz> victims;
     while (m_owned.size() > maxCacheSize)
     {
-        ++disowned;
-
-        const Dxyz dxyz(*m_owned.rbegin());
-        auto& slice(m_slices[dxyz.depth()]);
-        UniqueSpin sliceLock(m_spins[dxyz.depth()]);
-
-        ReffedChunk& ref(slice.at(dxyz.position()));
-        UniqueSpin chunkLock(ref.spin());
+        if (victims.empty()) victims = prioritize();
 
-        m_owned.erase(std::prev(m_owned.end()));
+        const Dxyz dxyz(victims.back());
+        victims.pop_back();
+        if (!m_owned.count(dxyz)) continue;
 
         // If we're destructing and thus purging everything, we should be the
         // only ref-holder.
-        assert(maxCacheSize || ref.count() == 1);
+        disown(dxyz, ownedLock, !maxCacheSize);
+    }
+}
 
-        if (!ref.del())
-        {
-            // Once we've unreffed this chunk, all bets are off as to its
-            // validity.  It may be recaptured before deletion by an insertion
-            // thread, or may be deleted instantly.
-            chunkLock.unlock();
-            sliceLock.unlock();
-            ownedLock.unlock();
+void ChunkCache::evictFinished()
+{
+    if (!m_sources) return;
 
-            // Don't hold any locks while we do this, since it may block.  We
-            // only want to block the calling thread in this case, not the
-            // whole system.
-            m_pool.add([this, dxyz]() { maybeSerialize(dxyz); });
+    UniqueSpin ownedLock(m_ownedSpin);
 
-            ownedLock.lock();
+    // No file which may still insert points overlaps these chunks, so there
+    // is no reason to wait for them to age out.
+    std::vector<Dxyz> finished;
+    ChunkKey ck(m_metadata.bounds, getStartDepth(m_metadata));
+    for (const auto& p : m_owned)
+    {
+        ck.init(p.first);
+        if (!m_sources->overlapsPending(ck.bounds()))
+        {
+            finished.push_back(p.first);
         }
     }
+
+    for (const Dxyz& dxyz : finished)
+    {
+        if (m_owned.count(dxyz)) disown(dxyz, ownedLock, false);
+    }
+}
+
+void ChunkCache::disown(
+    const Dxyz& dxyz,
+    UniqueSpin& ownedLock,
+    const bool sole)
+{
+    Slice& slice(getSlice(dxyz.depth(), dxyz.position()));
+    UniqueSpin sliceLock(slice.spin);
+
+    ReffedChunk& ref(slice.map.at(dxyz.position()));
+    UniqueSpin chunkLock(ref.spin());
+
+    m_owned.erase(dxyz);
+
+    assert(!sole || ref.count() == 1);
+    (void)sole;
+
+    if (!ref.del())
+    {
+        // Once we've unreffed this chunk, all bets are off as to its
+        // validity.  It may be recaptured before deletion by an insertion
+        // thread, or may be deleted instantly.
+        chunkLock.unlock();
+        sliceLock.unlock();
+        ownedLock.unlock();
+
+        // Don't hold any locks while we do this, since it may block.  We
+        // only want to block the calling thread in this case, not the
+        // whole system.
+        metrics::add(metrics::Gauge::SerializeQueue, 1);
+        const auto start(metrics::Clock::now());
+        m_pool.add([this, dxyz]()
+        {
+            Throttle::Guard guard(m_throttle);
+            metrics::add(metrics::Gauge::SerializeQueue, -1);
+            maybeSerialize(dxyz);
+        });
+        metrics::add(metrics::Timer::ClipWait, metrics::nanosSince(start));
+
+        ownedLock.lock();
+    }
+}
+
+std::vector<Dxyz> ChunkCache::prioritize() const
+{
+    struct Candidate
+    {
+        Dxyz dxyz;
+        bool cold;
+        double cost;
+    };
+
+    std::vector<Candidate> candidates;
+    candidates.reserve(m_owned.size());
+
+    ChunkKey ck(m_metadata.bounds, getStartDepth(m_metadata));
+    for (const auto& p : m_owned)
+    {
+        const Owned& owned(p.second);
+        ck.init(p.first);
+        candidates.push_back({
+            p.first,
+            !m_sources || !m_sources->overlapsPending(ck.bounds()),
+            (owned.bytes + 1.0) * (m_stamp - owned.stamp + 1.0)
+        });
+    }
+
+    std::sort(
+        candidates.begin(),
+        candidates.end(),
+        [](const Candidate& a, const Candidate& b)
+        {
+            if (a.cold != b.cold) return b.cold;
+            return a.cost < b.cost;
+        });
+
+    std::vector<Dxyz> result;
+    result.reserve(candidates.size());
+    for (const Candidate& c : candidates) result.push_back(c.dxyz);
+    return result;
 }
 
 void ChunkCache::maybeSerialize(const Dxyz& dxyz)
 {
     // Acquire both locks in order and see what we need to do.
-    UniqueSpin sliceLock(m_spins[dxyz.depth()]);
-    auto& slice(m_slices[dxyz.depth()]);
-    auto it(slice.find(dxyz.position()));
+    Slice& slice(getSlice(dxyz.depth(), dxyz.position()));
+    UniqueSpin sliceLock(slice.spin);
+    auto it(slice.map.find(dxyz.position()));
 
     // This case represents a chunk that has been queued for serialization,
     // then reclaimed, and then queued for serialization again.  If the first
@@ -285,7 +879,7 @@ void ChunkCache::maybeSerialize(const Dxyz& dxyz)
     //
     // This check keeps us from having to search our serialization queue for
     // cleanup every time a chunk is reclaimed prior to its async serialization.
-    if (it == slice.end()) return;
+    if (it == slice.map.end()) return;
 
     ReffedChunk& ref = it->second;
     UniqueSpin chunkLock(ref.spin());
@@ -303,31 +897,48 @@ void ChunkCache::maybeSerialize(const Dxyz& dxyz)
     // erase the chunk immediately after we release the lock here.
     if (!ref.exists()) return;
 
+    // Likewise, a previous request for this chunk may still be writing it, in
+    // which case that request will handle its eviction.
+    if (ref.state() == ReffedChunk::State::Serializing) return;
+
     // At this point, we have both locks, and we know our chunk exists but has
     // no refs, so serialize it.
     //
-    // The actual IO is expensive, so retain only the chunk lock.  Note: As
-    // soon as we let go of the slice lock, another thread could arrive and be
-    // waiting for this chunk lock, so we can't delete the ref from our map
-    // outright after this point without reclaiming the locks.
+    // The actual IO is expensive, so we hold neither lock while we write.
+    // Threads arriving for this chunk in the meantime will see that it is
+    // serializing and wait for us.  Note: As soon as we let go of the slice
+    // lock, another thread could arrive and reference this chunk, so we can't
+    // delete the ref from our map outright after this point without
+    // reclaiming the locks.
+    ref.setState(ReffedChunk::State::Serializing);
+    chunkLock.unlock();
     sliceLock.unlock();
 
-    assert(ref.exists());
+    save(ref.chunk());
 
+    chunkLock.lock();
+
+    // If this chunk was reclaimed while we wrote it, its eviction is
+    // cancelled and its waiters may insert into it without reloading it.
+    if (ref.count())
     {
-        SpinGuard lock(infoSpin);
-        ++info.written;
+        ref.setState(ReffedChunk::State::Ready);
+        metrics::add(metrics::Counter::ChunkReclaims);
+        tallies.reclaims.add();
+        accessTrace::record(accessTrace::Event::Reclaim, dxyz);
+        return;
     }
 
-    const uint64_t np = ref.chunk().save(m_endpoints);
-    hierarchy::set(m_hierarchy, ref.chunk().chunkKey().get(), np);
-    assert(np);
+    removeResident(ref.chunk().residentBytes());
+    tallies.evictions.add();
+    accessTrace::record(accessTrace::Event::Evict, dxyz);
 
     // Cannot erase this chunk here, since we haven't been holding the
     // sliceLock, someone may be waiting for this chunkLock.  Instead we'll
     // just reset the pointer.  We'll have to reacquire both locks to attempt
     // to erase it.
     ref.reset();
+    ref.setState(ReffedChunk::State::Ready);
     chunkLock.unlock();
 
     maybeErase(dxyz);
@@ -335,12 +946,12 @@ void ChunkCache::maybeSerialize(const Dxyz& dxyz)
 
 void ChunkCache::maybeErase(const Dxyz& dxyz)
 {
-    UniqueSpin sliceLock(m_spins[dxyz.depth()]);
-    auto& slice(m_slices[dxyz.depth()]);
-    auto it(slice.find(dxyz.position()));
+    Slice& slice(getSlice(dxyz.depth(), dxyz.position()));
+    UniqueSpin sliceLock(slice.spin);
+    auto it(slice.map.find(dxyz.position()));
 
     // If the chunk has already been erased, no-op.
-    if (it == slice.end()) return;
+    if (it == slice.map.end()) return;
 
     ReffedChunk& ref = it->second;
     UniqueSpin chunkLock(ref.spin());
@@ -353,12 +964,10 @@ void ChunkCache::maybeErase(const Dxyz& dxyz)
     // Release the chunkLock so the unique_lock doesn't try to unlock a deleted
     // SpinLock when it destructs.
     chunkLock.release();
-    slice.erase(it);
+    slice.map.erase(it);
 
-    {
-        SpinGuard lock(infoSpin);
-        --info.alive;
-    }
+    tallies.alive.sub();
+    metrics::add(metrics::Gauge::ChunksAlive, -1);
 }
 
 } // namespace entwine
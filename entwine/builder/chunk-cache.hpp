@@ -11,24 +11,42 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
+#include <entwine/builder/allotment.hpp>
+#include <entwine/builder/checkpoint.hpp>
 #include <entwine/builder/chunk.hpp>
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/builder/hierarchy.hpp>
+#include <entwine/builder/source-index.hpp>
 #include <entwine/types/defs.hpp>
+#include <entwine/util/metrics.hpp>
 #include <entwine/util/pool.hpp>
 #include <entwine/util/spin-lock.hpp>
+#include <entwine/util/throttle.hpp>
 
 namespace entwine
 {
 
 class Clipper;
+class Presort;
 
 class ReffedChunk
 {
 public:
-    ReffedChunk(const Metadata& m, const ChunkKey& ck, const Hierarchy& h)
-        : m_chunk(makeUnique<Chunk>(m, ck, h))
-    { }
+    // While a chunk is being serialized its data is read without our lock, so
+    // it may not be inserted into.  Threads which reclaim it meanwhile are
+    // parked until it is ready again, rather than spinning on our lock.
+    // Likewise, a new chunk is built without any lock after its placeholder
+    // is inserted, and is awaited by other threads which arrive for it.
+    enum class State { Ready, Building, Serializing };
+
+    // Construct a placeholder, which is building until its chunk is assigned.
+    ReffedChunk() : m_state(State::Building) { }
 
     SpinLock& spin() { return m_spin; }
 
@@ -53,10 +71,30 @@ public:
         assert(!exists());
         m_chunk = makeUnique<Chunk>(m, ck, h);
     }
+    void assign(std::unique_ptr<Chunk> chunk)
+    {
+        assert(!exists());
+        m_chunk = std::move(chunk);
+    }
+
+    // These must be called while holding our lock, which is released while
+    // awaiting readiness and reacquired before returning.
+    State state() const { return m_state; }
+    void setState(State state)
+    {
+        m_state = state;
+        if (m_state == State::Ready) m_cv.notify_all();
+    }
+    void await(UniqueSpin& lock)
+    {
+        m_cv.wait(lock, [this]() { return m_state == State::Ready; });
+    }
 
 private:
-    SpinLock m_spin;
+    SpinLock m_spin{ LockType::Chunk };
     uint64_t m_refs = 0;
+    State m_state = State::Ready;
+    std::condition_variable_any m_cv;
     std::unique_ptr<Chunk> m_chunk;
 };
 
@@ -67,41 +105,246 @@ public:
         const Endpoints& endpoints,
         const Metadata& Metadata,
         Hierarchy& hierarchy,
-        uint64_t threads);
+        uint64_t threads,
+        uint64_t maxThreads = 0);
 
     ~ChunkCache();
 
     void insert(Voxel& voxel, Key& key, const ChunkKey& ck, Clipper& clipper);
-    void clip(uint64_t depth, const std::map<Xyz, Chunk*>& stale);
-    void clipped() { maybePurge(m_cacheSize); }
+
+    // Insert a group of points which all belong at the depth of this chunk
+    // key.  Points are pushed down the tree together, so the chunk lookup for
+    // each node is performed once per group rather than once per point.
+    void insert(Insertions& group, const ChunkKey& ck, Clipper& clipper);
+
+    // Insert the entries of an overflow, which has been detached from its
+    // chunk, into the child chunk for which it was held.  If overflow threads
+    // are configured, this is done in the background rather than by the
+    // calling thread.
+    void pushDown(std::unique_ptr<Overflow> overflow, Clipper& clipper);
+
+    void clip(uint64_t depth, const std::vector<Xyz>& stale);
+    void clipped()
+    {
+        if (m_finished.exchange(false)) evictFinished();
+        maybePurge(overBudget() ? 0 : m_cacheSize);
+    }
     void join();
 
+    // Write out every chunk, as join() does, while leaving us usable.  No
+    // insertions may be in progress.
+    void flush();
+
+    // Write every chunk which has changed since it was last saved, leaving
+    // all of them resident so that later insertions need not reload them.
+    // No insertions may be in progress, and no chunk may be referenced other
+    // than by us.
+    void persist();
+
+    Checkpoint& checkpoint() { return m_checkpoint; }
+
+    const Metadata& metadata() const { return m_metadata; }
+
+    // Our pool may have up to maxThreads threads, of which only this many
+    // serialize at once.
+    Throttle& throttle() { return m_throttle; }
+
+    // Each thread stages its insertions shallower than this depth privately,
+    // merging them into the shared chunks when its Clipper clips.
+    uint64_t stagingDepth() const { return m_metadata.internal.stagingDepth; }
+
+    // Accounting of the point data held in memory by resident chunks, which
+    // is compared against our memory budget, if one is set.
+    void addResident(uint64_t bytes)
+    {
+        m_resident += bytes;
+        if (m_allotment) m_allotment->addResident(bytes);
+        metrics::add(metrics::Gauge::ResidentBytes, bytes);
+    }
+    void removeResident(uint64_t bytes)
+    {
+        m_resident -= bytes;
+        if (m_allotment) m_allotment->removeResident(bytes);
+        metrics::add(metrics::Gauge::ResidentBytes, -int64_t(bytes));
+    }
+    uint64_t resident() const { return m_resident; }
+    bool overBudget() const
+    {
+        if (m_allotment) return m_allotment->overBudget();
+        return m_memory && m_resident >= m_memory;
+    }
+
+    // If our build shares the memory budget of a Scheduler, our resident
+    // chunks count against it rather than against our own, until we are
+    // destroyed.  It must be set before any insertion, and outlive us.
+    void setAllotment(Allotment* allotment) { m_allotment = allotment; }
+
+    const Endpoints& endpoints() const { return m_endpoints; }
+
+    // If node prefetching is enabled, fetch the existing data of the nodes
+    // overlapping these bounds ahead of its use, shallowest first, while our
+    // prefetch budget allows.
+    void prefetch(const Bounds& bounds);
+
+    // Fetch the data of this node, with this postfix, point count, and data
+    // type, ahead of its use.  Returns false if our prefetch budget is spent,
+    // or if prefetching is disabled.
+    bool prefetch(
+        const Dxyz& key,
+        const std::string& postfix,
+        uint64_t np,
+        io::Type type);
+
+    // The index of input files, whose pending files are those yet to be
+    // inserted, by which our unreferenced chunks are prioritized for
+    // serialization.  It must outlive our use of it.
+    void setSources(const SourceIndex* sources) { m_sources = sources; }
+
+    // Note that some file is no longer pending in our source index, after
+    // which the next clip serializes every unreferenced chunk that no pending
+    // file overlaps rather than leaving it to age out of our cache.  Such a
+    // chunk may still be rewoken, by the overflow of an ancestor that a
+    // pending file does overlap, so it is merely released early.
+    void finished() { m_finished = true; }
+
+    // During the first pass of a presorted build, points bound for us are
+    // bucketed here by their inserters rather than inserted.
+    void setPresort(Presort* presort) { m_presort = presort; }
+    Presort* presort() const { return m_presort; }
+
+    // While the nodes above the presort depth are built, points reaching
+    // that depth are diverted here, by the clipper of their thread, to be
+    // built later as independent subtrees.
+    void setSplit(Presort* split) { m_split = split; }
+    Presort* split() const { return m_split; }
+
+    // Chunk activity across all caches since the previous latch, except for
+    // the number of chunks alive.  Bytes are those of the point data of the
+    // chunks written or read, in our absolute schema.  Evictions include
+    // unchanged chunks dropped without being written, and reclaims are
+    // chunks referenced again after being released but before eviction.
     struct Info
     {
         uint64_t written = 0;
         uint64_t read = 0;
         uint64_t alive = 0;
+        uint64_t bytesWritten = 0;
+        uint64_t bytesRead = 0;
+        uint64_t evictions = 0;
+        uint64_t reclaims = 0;
     };
 
     static Info latchInfo();
 
 private:
+    // Each depth is split into independently locked shards, so threads working
+    // on different chunks at the same depth rarely contend for a lock.
+    struct Slice
+    {
+        SpinLock spin{ LockType::Slice };
+        std::unordered_map<Xyz, ReffedChunk> map;
+    };
+
+    Slice& getSlice(uint64_t depth, const Xyz& p)
+    {
+        const std::size_t shard(std::hash<Xyz>()(p) % m_slices[depth].size());
+        return m_slices[depth][shard];
+    }
+
+    // Chunks shallower than our pinned depth are created once, directly
+    // indexed by position, and kept resident until join().  They bypass
+    // reference counting and clipping entirely.
+    struct Pinned
+    {
+        SpinLock spin{ LockType::Chunk };
+        std::atomic<Chunk*> chunk{ nullptr };
+        std::unique_ptr<Chunk> owned;
+    };
+
+    // Points reaching a depth beyond our maximum are discarded.
+    bool isTooDeep(const ChunkKey& ck) const
+    {
+        const uint64_t limit(m_metadata.internal.maxDepth);
+        return limit && ck.depth() >= limit;
+    }
+
+    bool isSplit(const ChunkKey& ck) const
+    {
+        return m_split && ck.depth() == m_metadata.internal.presortDepth;
+    }
+
+    bool isPinned(const ChunkKey& ck) const
+    {
+        return ck.depth() < m_pinnedDepth;
+    }
+    Chunk& getPinned(const ChunkKey& ck, Clipper& clipper);
+    void savePinned();
+
     Chunk& addRef(const ChunkKey& ck, Clipper& clipper);
+
+    // Write this chunk, which may not be modified meanwhile, and record its
+    // new point count in our hierarchy.
+    void save(Chunk& chunk);
+
+    // Reinitialize this chunk from its previously saved data.
+    void load(Chunk& chunk, Clipper& clipper, uint64_t np);
+
+    void pushDown(Overflow& overflow, Clipper& clipper);
+
+    // Wait for our background overflows, including any which they cause in
+    // turn, throwing if any have failed.
+    void awaitOverflows();
+
     void maybeSerialize(const Dxyz& dxyz);
     void maybeErase(const Dxyz& dxyz);
     void maybePurge(uint64_t maxCacheSize);
+    void evictFinished();
+
+    // Release our ownership of this chunk, which must be owned, queueing it
+    // for serialization if ours was its last reference.  Our owned lock is
+    // released while queueing, and is held again when we return.
+    void disown(const Dxyz& dxyz, UniqueSpin& ownedLock, bool sole);
 
-    const Endpoints& m_endpoints;
+    // Our owned chunks in order of priority for serialization, lowest first.
+    // Cold chunks, which no pending file overlaps, precede all others, and
+    // are otherwise ordered by their size and the time since their release.
+    std::vector<Dxyz> prioritize() const;
+
+    Endpoints m_endpoints;
     const Metadata& m_metadata;
     Hierarchy& m_hierarchy;
+    Checkpoint m_checkpoint;
+    Throttle m_throttle;
     Pool m_pool;
-    const uint64_t m_cacheSize = 64;
+    std::unique_ptr<Pool> m_overflowPool;
+    const uint64_t m_cacheSize;
+    const uint64_t m_memory;
+    std::atomic_uint64_t m_resident;
+    Allotment* m_allotment = nullptr;
+
+    const uint64_t m_pinnedDepth;
+    std::vector<std::vector<Pinned>> m_pinned;
 
-    std::array<SpinLock, maxDepth> m_spins;
-    std::array<std::map<Xyz, ReffedChunk>, maxDepth> m_slices;
+    std::array<
+        std::array<Slice, heuristics::chunkCacheShards>,
+        maxDepth> m_slices;
+
+    const SourceIndex* m_sources = nullptr;
+    std::atomic_bool m_finished{ false };
+    Presort* m_presort = nullptr;
+    Presort* m_split = nullptr;
+
+    // Unreferenced chunks kept alive by us, with their resident size and the
+    // order in which they were released, by which they are evicted.
+    struct Owned
+    {
+        uint64_t bytes = 0;
+        uint64_t stamp = 0;
+    };
 
-    SpinLock m_ownedSpin;
-    std::set<Dxyz> m_owned;
+    SpinLock m_ownedSpin{ LockType::Slice };
+    std::map<Dxyz, Owned> m_owned;
+    uint64_t m_stamp = 0;
 };
 
 } // namespace entwine
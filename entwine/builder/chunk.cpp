@@ -11,18 +11,42 @@
 #include <entwine/builder/chunk.hpp>
 
 #include <entwine/builder/chunk-cache.hpp>
+#include <entwine/builder/node-stats.hpp>
+#include <entwine/builder/provenance.hpp>
 #include <entwine/io/io.hpp>
 #include <entwine/types/metadata.hpp>
+#include <entwine/types/point-order.hpp>
 #include <entwine/types/voxel.hpp>
+#include <entwine/util/metrics.hpp>
+#include <entwine/util/node-cache.hpp>
+#include <entwine/util/scratch.hpp>
+#include <entwine/util/trace.hpp>
 #include <entwine/util/unique.hpp>
 
 namespace entwine
 {
 
+namespace
+{
+
+uint64_t getTileSpan(const uint64_t span)
+{
+    return span % heuristics::gridTileSpan ? span : heuristics::gridTileSpan;
+}
+
+// The chunk whose own saved points are being restored by this thread, which
+// are not changes to that chunk.
+thread_local const Chunk* restoring(nullptr);
+
+} // unnamed namespace
+
 Chunk::Chunk(const Metadata& m, const ChunkKey& ck, const Hierarchy& hierarchy)
     : m_metadata(m)
     , m_span(m_metadata.span)
-    , m_pointSize(getPointSize(m_metadata.absoluteSchema))
+    , m_resident(m_metadata)
+    , m_pointSize(m_resident.pointSize())
+    , m_policy(toVoxelPolicy(m_metadata.internal.voxelPolicy))
+    , m_dedup(m_metadata.internal.dedup)
     , m_chunkKey(ck)
     , m_childKeys { {
         ck.getStep(toDir(0)),
@@ -34,80 +58,234 @@ Chunk::Chunk(const Metadata& m, const ChunkKey& ck, const Hierarchy& hierarchy)
         ck.getStep(toDir(6)),
         ck.getStep(toDir(7))
     } }
-    , m_grid(m_span * m_span)
-    , m_gridBlock(m_pointSize, 4096)
+    , m_tileSpan(getTileSpan(m_span))
+    , m_tiles((m_span / m_tileSpan) * (m_span / m_tileSpan))
+    , m_gridBlock(m_pointSize, 4096, metrics::Memory::ChunkPoints)
 {
+    m_gridCharge.add(m_tiles.size() * sizeof(std::atomic<Tile*>));
+
+    const std::array<int64_t, 8> counts(hierarchy.getChildren(ck.dxyz()));
     for (uint64_t i(0); i < dirEnd(); ++i)
     {
-        const Dir dir(toDir(i));
-
         // If there are already points here, it gets no overflow.
-        if (!hierarchy::get(hierarchy, childAt(dir).dxyz()))
-        {
-            m_overflows[i] = makeUnique<Overflow>(ck.getStep(dir), m_pointSize);
-        }
+        if (!counts[i]) m_eligible |= 1 << i;
     }
 }
 
+void Chunk::touch()
+{
+    if (restoring != this && !m_dirty) m_dirty = true;
+}
+
+bool Chunk::insert(ChunkCache& cache, Clipper& clipper, Voxel& voxel, Key& key)
+{
+    switch (m_policy)
+    {
+        case VoxelPolicy::First:
+            return insert<VoxelPolicy::First>(cache, clipper, voxel, key);
+        case VoxelPolicy::MaxZ:
+            return insert<VoxelPolicy::MaxZ>(cache, clipper, voxel, key);
+        case VoxelPolicy::MinZ:
+            return insert<VoxelPolicy::MinZ>(cache, clipper, voxel, key);
+        case VoxelPolicy::Random:
+            return insert<VoxelPolicy::Random>(cache, clipper, voxel, key);
+        default:
+            return insert<VoxelPolicy::Closest>(cache, clipper, voxel, key);
+    }
+}
+
+template <VoxelPolicy P>
 bool Chunk::insert(ChunkCache& cache, Clipper& clipper, Voxel& voxel, Key& key)
 {
     const Xyz& pos(key.position());
-    const uint64_t i((pos.y % m_span) * m_span + (pos.x % m_span));
-    auto& tube(m_grid[i]);
+    VoxelTube& tube(getTube(pos));
 
-    UniqueSpin tubeLock(tube.spin);
-    Voxel& dst(tube.map[pos.z]);
+    UniqueSpin tubeLock(tube.spin());
+    Voxel& dst(tube.at(pos.z));
 
     if (dst.data())
     {
-        const Point& mid(key.bounds().mid());
-        if (voxel.point().sqDist3d(mid) < dst.point().sqDist3d(mid))
+        if (m_dedup && voxel.point() == dst.point())
+        {
+            metrics::add(metrics::Counter::Duplicates);
+            return true;
+        }
+        if (voxel::replaces<P>(voxel.point(), dst.point(), key))
         {
             voxel.swapDeep(dst, m_pointSize);
+            touch();
         }
     }
     else
     {
+        uint64_t allocated(0);
         {
             SpinGuard lock(m_spin);
+            const uint64_t before(m_gridBlock.bytes());
             dst.setData(m_gridBlock.next());
+            allocated = m_gridBlock.bytes() - before;
         }
         dst.initDeep(voxel.point(), voxel.data(), m_pointSize);
+        touch();
+
+        if (allocated) cache.addResident(allocated);
         return true;
     }
 
     tubeLock.unlock();
 
-    return insertOverflow(cache, clipper, voxel, key);
+    if (insertOverflow(cache, clipper, voxel)) return true;
+
+    // A restored point passed downward is no longer held here.
+    if (restoring == this) m_dirty = true;
+    return false;
+}
+
+void Chunk::restore(ChunkCache& cache, Clipper& clipper, Insertions& group)
+{
+    switch (m_policy)
+    {
+        case VoxelPolicy::First:
+            return restore<VoxelPolicy::First>(cache, clipper, group);
+        case VoxelPolicy::MaxZ:
+            return restore<VoxelPolicy::MaxZ>(cache, clipper, group);
+        case VoxelPolicy::MinZ:
+            return restore<VoxelPolicy::MinZ>(cache, clipper, group);
+        case VoxelPolicy::Random:
+            return restore<VoxelPolicy::Random>(cache, clipper, group);
+        default:
+            return restore<VoxelPolicy::Closest>(cache, clipper, group);
+    }
+}
+
+// Our saved points are in point order rather than grid order, so a point
+// whose cell is occupied must still compete with its occupant to determine
+// which of them is held as overflow.  Otherwise they bypass the chunk lookup,
+// staging, and per-point policy dispatch of a general insertion, and the
+// grouping of points for our children is needed only for those which no
+// longer belong here.
+template <VoxelPolicy P>
+void Chunk::restore(ChunkCache& cache, Clipper& clipper, Insertions& group)
+{
+    std::array<Scratch<Insertion>, 8> children;
+    const Point mid(m_chunkKey.mid());
+
+    for (Insertion& insertion : group)
+    {
+        Voxel& voxel(insertion.voxel);
+        Key& key(insertion.key);
+
+        if (insert<P>(cache, clipper, voxel, key)) continue;
+
+        key.step(voxel.point());
+        const Dir dir(getDirection(mid, voxel.point()));
+        children[toIntegral(dir)]->push_back(insertion);
+    }
+
+    for (uint64_t i(0); i < children.size(); ++i)
+    {
+        if (children[i]->empty()) continue;
+        cache.insert(children[i].get(), m_childKeys[i], clipper);
+    }
+}
+
+VoxelTube& Chunk::getTube(const Xyz& pos)
+{
+    const uint64_t x(pos.x % m_span);
+    const uint64_t y(pos.y % m_span);
+
+    std::atomic<Tile*>& slot(
+        m_tiles[(y / m_tileSpan) * (m_span / m_tileSpan) + x / m_tileSpan]);
+
+    Tile* tile(slot.load(std::memory_order_acquire));
+    if (!tile)
+    {
+        SpinGuard lock(m_spin);
+        tile = slot.load(std::memory_order_relaxed);
+        if (!tile)
+        {
+            m_owned.push_back(makeUnique<Tile>(m_tileSpan * m_tileSpan));
+            m_gridCharge.add(m_tileSpan * m_tileSpan * sizeof(VoxelTube));
+            tile = m_owned.back().get();
+            slot.store(tile, std::memory_order_release);
+        }
+    }
+
+    return (*tile)[(y % m_tileSpan) * m_tileSpan + x % m_tileSpan];
 }
 
 bool Chunk::insertOverflow(
         ChunkCache& cache,
         Clipper& clipper,
-        Voxel& voxel,
-        Key& key)
+        const Voxel& voxel)
 {
     if (m_chunkKey.depth() < getSharedDepth(m_metadata)) return false;
 
-    const Dir dir(getDirection(m_chunkKey.bounds().mid(), voxel.point()));
+    // Chunks at our deepest depth have no children for which to hold points.
+    const uint64_t limit(m_metadata.internal.maxDepth);
+    if (limit && m_chunkKey.depth() + 1 >= limit) return false;
+
+    const Dir dir(getDirection(m_chunkKey.mid(), voxel.point()));
     const uint64_t i(toIntegral(dir));
 
-    SpinGuard lock(m_overflowSpin);
+    UniqueSpin lock(m_overflowSpin);
 
-    if (!m_overflows[i]) return false;
+    if (!(m_eligible & (1 << i))) return false;
+    if (!m_overflows[i])
+    {
+        m_overflows[i] = makeUnique<Overflow>(m_childKeys[i], m_pointSize);
+    }
 
-    m_overflows[i]->insert(voxel, key);
+    if (const uint64_t allocated = m_overflows[i]->insert(voxel))
+    {
+        cache.addResident(allocated);
+    }
+    touch();
 
-    // Overflow inserted, update metric and perform overflow if needed.
+    // Overflow inserted, update metric and detach an overflow if needed.
+    std::unique_ptr<Overflow> detached;
     if (++m_overflowCount >= m_metadata.internal.minNodeSize)
     {
-        maybeOverflow(cache, clipper);
+        detached = maybeOverflow();
+    }
+
+    // If this overflow remains and memory is scarce, move its entries to disk
+    // rather than holding them until it is large enough to become a node.
+    const std::string& spill(cache.endpoints().spill);
+    Overflow* overflow(m_overflows[i].get());
+    if (
+        !spill.empty() &&
+        overflow &&
+        overflow->points.size() >= heuristics::spillPoints &&
+        cache.overBudget())
+    {
+        static std::atomic_uint64_t spills(0);
+        const std::string path(overflow->spillPath.size()
+            ? overflow->spillPath
+            : arbiter::join(
+                spill,
+                overflow->chunkKey.toString() + "-" +
+                    std::to_string(++spills) + ".bin"));
+        cache.removeResident(overflow->spill(path));
     }
 
+    // A detached overflow is pushed down without our lock, so that other
+    // threads may meanwhile insert into the overflows which remain.
+    lock.unlock();
+    if (detached) cache.pushDown(std::move(detached), clipper);
+
     return true;
 }
 
-void Chunk::maybeOverflow(ChunkCache& cache, Clipper& clipper)
+bool Chunk::overflows(const Dir dir)
+{
+    if (m_chunkKey.depth() < getSharedDepth(m_metadata)) return false;
+
+    SpinGuard lock(m_overflowSpin);
+    return m_eligible & (1 << toIntegral(dir));
+}
+
+std::unique_ptr<Overflow> Chunk::maybeOverflow()
 {
     // See if our resident size is big enough to overflow.
     uint64_t gridSize(0);
@@ -117,7 +295,7 @@ void Chunk::maybeOverflow(ChunkCache& cache, Clipper& clipper)
     }
 
     const uint64_t ourSize(gridSize + m_overflowCount);
-    if (ourSize < m_metadata.internal.maxNodeSize) return;
+    if (ourSize < m_metadata.internal.maxNodeSize) return { };
 
     // Find the overflow with the largest point count.
     uint64_t selectedSize = 0;
@@ -125,56 +303,95 @@ void Chunk::maybeOverflow(ChunkCache& cache, Clipper& clipper)
     for (uint64_t d(0); d < m_overflows.size(); ++d)
     {
         auto& current(m_overflows[d]);
-        if (current && current->block.size() > selectedSize)
+        if (current && current->size() > selectedSize)
         {
             selectedIndex = d;
-            selectedSize = current->block.size();
+            selectedSize = current->size();
         }
     }
 
     // Make sure our largest overflow is large enough to necessitate
     // overflowing into its own node.
-    if (selectedSize < m_metadata.internal.minNodeSize) return;
+    if (selectedSize < m_metadata.internal.minNodeSize) return { };
 
-    doOverflow(cache, clipper, selectedIndex);
+    return detachOverflow(selectedIndex);
 }
 
-void Chunk::doOverflow(ChunkCache& cache, Clipper& clipper, uint64_t dir)
+std::unique_ptr<Overflow> Chunk::detachOverflow(uint64_t dir)
 {
     assert(m_overflows[dir]);
 
     std::unique_ptr<Overflow> active;
     std::swap(m_overflows[dir], active);
-    m_overflowCount -= active->block.size();
+    m_eligible &= ~(1 << dir);
+    m_overflowCount -= active->size();
 
-    // TODO We could unlock our overflowSpin here - bookkeeping has been
-    // fully updated for the removal of this Overflow.
+    // Our overflowed points are no longer ours, even if we are restoring.
+    m_dirty = true;
 
-    const ChunkKey ck(m_childKeys[dir]);
+    assert(active->chunkKey.dxyz() == m_childKeys[dir].dxyz());
+    return active;
+}
 
-    for (auto& entry : active->list)
-    {
-        entry.key.step(entry.voxel.point());
-        cache.insert(entry.voxel, entry.key, ck, clipper);
-    }
+uint64_t Chunk::residentBytes() const
+{
+    uint64_t bytes(m_gridBlock.bytes());
+    for (const auto& o : m_overflows) if (o) bytes += o->block.bytes();
+    return bytes;
 }
 
 uint64_t Chunk::save(const Endpoints& endpoints) const
 {
-    uint64_t np(m_gridBlock.size());
-    for (const auto& o : m_overflows) if (o) np += o->block.size();
+    metrics::ScopedTimer timer(metrics::Timer::Serialize);
+    trace::Span span("save", m_chunkKey.toString());
 
-    auto layout = toLayout(m_metadata.absoluteSchema);
+    pdal::PointLayout& layout(m_metadata.layouts->absolute());
     BlockPointTable table(layout);
-    table.reserve(np);
-    table.insert(m_gridBlock);
-    for (auto& o : m_overflows) if (o) table.insert(o->block);
+
+    // Compact points must be expanded to the absolute layout for writing.
+    MemBlock expanded(m_resident.absolutePointSize(), 4096);
+    const auto add([&](const MemBlock& block)
+    {
+        if (!m_resident.compact()) return table.insert(block);
+        for (const PointSpan& span : block.spans())
+        {
+            const char* pos(span.data);
+            for (uint64_t i(0); i < span.size; ++i, pos += m_pointSize)
+            {
+                m_resident.toAbsolute(pos, expanded.next());
+            }
+        }
+    });
+
+    // Spilled overflow entries are read back in full, since the node is
+    // written as a whole.
+    MemBlock spilled(m_pointSize, 4096);
+
+    add(m_gridBlock);
+    for (auto& o : m_overflows)
+    {
+        if (!o) continue;
+        add(o->block);
+        o->readSpilled(spilled);
+    }
+    add(spilled);
+    if (m_resident.compact()) table.insert(expanded);
+
+    sortPoints(table, m_metadata.internal.pointOrder, m_chunkKey.bounds());
+
+    if (endpoints.nodeStats) endpoints.nodeStats->add(m_chunkKey.get(), table);
+    if (endpoints.provenance)
+    {
+        endpoints.provenance->add(m_chunkKey.get(), table);
+    }
+
+    const uint64_t np(table.size());
 
     const auto filename =
         m_chunkKey.toString() + getPostfix(m_metadata, m_chunkKey.depth());
 
     io::write(
-        m_metadata.dataType,
+        io::getNodeType(m_metadata, m_chunkKey.depth()),
         m_metadata,
         endpoints,
         filename,
@@ -190,25 +407,80 @@ void Chunk::load(
         const Endpoints& endpoints,
         const uint64_t np)
 {
-    auto layout = toLayout(m_metadata.absoluteSchema);
-    VectorPointTable table(layout, np);
+    trace::Span span("load", m_chunkKey.toString());
+
+    // Our points are read into, and restored from, buffers reused by this
+    // thread across loads.
+    Scratch<char> storage;
+    Scratch<Insertion> insertions;
+
+    pdal::PointLayout& layout(m_metadata.layouts->absolute());
+    VectorPointTable table(layout, np, std::move(storage.get()));
     table.setProcess([&]()
     {
         Voxel voxel;
         Key key(m_metadata.bounds, getStartDepth(m_metadata));
 
-        for (auto it = table.begin(); it != table.end(); ++it)
+        Insertions& group(insertions.get());
+        group.clear();
+        group.reserve(table.numPoints());
+
+        MemBlock converted(m_pointSize, 4096);
+
+        const auto points(table.batch());
+        for (pdal::PointId i(0); i < points.size(); ++i)
         {
-            voxel.initShallow(it.pointRef(), it.data());
-            key.init(voxel.point(), m_chunkKey.depth());
-            cache.insert(voxel, key, m_chunkKey, clipper);
+            if (points.skip(i)) continue;
+
+            voxel.initShallow(points.point(i), points.data(i));
+            if (m_resident.compact())
+            {
+                char* pos(converted.next());
+                m_resident.fromAbsolute(points.data(i), pos);
+                voxel.setData(pos);
+            }
+            key.init(voxel.point(), m_chunkKey);
+            group.emplace_back(voxel, key);
         }
+
+        restore(cache, clipper, group);
     });
 
     const auto filename =
         m_chunkKey.toString() + getPostfix(m_metadata, m_chunkKey.depth());
 
-    io::read(m_metadata.dataType, m_metadata, endpoints, filename, table);
+    // This node may have been serialized recently, and still be uploading.
+    awaitData(endpoints, filename);
+
+    // A node held by our node cache has never been written, and is taken
+    // from it rather than copied, so we hold its only copy and must save it
+    // even if it is unchanged.  If it is evicted in the meantime, it is
+    // merely saved twice.
+    const bool taken(
+        endpoints.nodeCache && endpoints.nodeCache->holds(filename));
+
+    // Points inserted here by other threads during our load still dirty us.
+    const Chunk* const previous(restoring);
+    restoring = this;
+    try
+    {
+        io::read(
+            io::getNodeType(m_metadata, m_chunkKey.depth()),
+            m_metadata,
+            endpoints,
+            filename,
+            table,
+            m_chunkKey.bounds());
+    }
+    catch (...)
+    {
+        restoring = previous;
+        throw;
+    }
+    restoring = previous;
+    if (taken) m_dirty = true;
+
+    storage.get() = table.acquire();
 }
 
 } // namespace entwine
@@ -10,12 +10,18 @@
 
 #pragma once
 
+#include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <utility>
+#include <vector>
 
 #include <entwine/builder/hierarchy.hpp>
 #include <entwine/builder/overflow.hpp>
+#include <entwine/builder/resident.hpp>
+#include <entwine/builder/voxel-policy.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
 #include <entwine/types/endpoints.hpp>
 #include <entwine/types/vector-point-table.hpp>
@@ -27,10 +33,33 @@ namespace entwine
 class ChunkCache;
 class Clipper;
 
-struct VoxelTube
+// A column of voxels sharing the same X and Y cell.  Tubes are sparsely
+// populated, so their cells are stored contiguously and searched linearly,
+// which avoids a node allocation per occupied cell.
+class VoxelTube
 {
-    SpinLock spin;
-    std::map<uint32_t, Voxel> map;
+public:
+    SpinLock& spin() { return m_spin; }
+
+    // Get the voxel for this Z cell, inserting an empty one if necessary.
+    Voxel& at(uint32_t z)
+    {
+        for (Cell& cell : m_cells) if (cell.z == z) return cell.voxel;
+        m_cells.emplace_back(z);
+        return m_cells.back().voxel;
+    }
+
+private:
+    struct Cell
+    {
+        explicit Cell(uint32_t z) : z(z) { }
+
+        uint32_t z;
+        Voxel voxel;
+    };
+
+    SpinLock m_spin{ LockType::Tube };
+    std::vector<Cell> m_cells;
 };
 
 class Chunk
@@ -54,29 +83,80 @@ public:
 
     SpinLock& spin() { return m_spin; }
 
+    // Returns true if points which do not fit in our grid, in this direction,
+    // would currently be held here as overflow rather than passed downward.
+    bool overflows(Dir dir);
+
+    // Bytes of point data currently held by this chunk, including overflow.
+    uint64_t residentBytes() const;
+
+    // A chunk is dirty once its contents differ from those last saved or
+    // loaded, so a clean chunk may be dropped without being rewritten.  One
+    // loaded from our node cache, which gives up its copy, starts dirty.
+    bool dirty() const { return m_dirty; }
+    void clean() { m_dirty = false; }
+
 private:
+    using Tile = std::vector<VoxelTube>;
+
+    template <VoxelPolicy P>
+    bool insert(ChunkCache& cache, Clipper& clipper, Voxel& voxel, Key& key);
+
+    // Place points previously saved by this chunk, keyed at our depth,
+    // directly into our grid and overflows.
+    void restore(ChunkCache& cache, Clipper& clipper, Insertions& group);
+
+    template <VoxelPolicy P>
+    void restore(ChunkCache& cache, Clipper& clipper, Insertions& group);
+
+    // Get the tube of this position, allocating its tile if necessary.
+    VoxelTube& getTube(const Xyz& pos);
+
     bool insertOverflow(
         ChunkCache& cache,
         Clipper& clipper,
-        Voxel& voxel,
-        Key& key);
+        const Voxel& voxel);
 
-    void maybeOverflow(ChunkCache& cache, Clipper& clipper);
-    void doOverflow(ChunkCache& cache, Clipper& clipper, uint64_t dir);
+    // With our overflow lock held, detach our largest overflow if we are
+    // full and it is large enough to become a node, or return null.
+    std::unique_ptr<Overflow> maybeOverflow();
+    std::unique_ptr<Overflow> detachOverflow(uint64_t dir);
 
     const Metadata& m_metadata;
     const uint64_t m_span;
+    const Resident m_resident;
     const uint64_t m_pointSize;
+    const VoxelPolicy m_policy;
+
+    // If set, a point whose clipped coordinates equal those of the occupant of
+    // its voxel is dropped.
+    const bool m_dedup;
     const ChunkKey m_chunkKey;
     const std::array<ChunkKey, 8> m_childKeys;
 
-    SpinLock m_spin;
-    std::vector<VoxelTube> m_grid;
+    // Our grid of tubes is divided into square tiles, each of which is only
+    // allocated once a point falls within it, so that sparse chunks cost
+    // little regardless of their span.  Tiles are owned by m_owned, which is
+    // guarded by our spin along with our grid block.
+    const uint64_t m_tileSpan;
+    std::vector<std::atomic<Tile*>> m_tiles;
+    std::vector<std::unique_ptr<Tile>> m_owned;
+
+    SpinLock m_spin{ LockType::Chunk };
     MemBlock m_gridBlock;
+    metrics::MemoryCharge m_gridCharge{ metrics::Memory::ChunkGrids };
 
-    SpinLock m_overflowSpin;
+    // Overflows are created on their first insertion, in the directions whose
+    // bits are set in our eligible mask - those of children which have not
+    // yet been created.
+    SpinLock m_overflowSpin{ LockType::Overflow };
+    uint8_t m_eligible = 0;
     std::array<std::unique_ptr<Overflow>, 8> m_overflows;
     uint64_t m_overflowCount = 0;
+
+    std::atomic_bool m_dirty{ false };
+
+    void touch();
 };
 
 } // namespace entwine
@@ -10,93 +10,186 @@
 
 #include <entwine/builder/clipper.hpp>
 
+#include <algorithm>
+#include <cassert>
+
 #include <entwine/builder/chunk.hpp>
 #include <entwine/builder/chunk-cache.hpp>
+#include <entwine/util/metrics.hpp>
 
 namespace entwine
 {
 
-Clipper::~Clipper()
+Clipper::Clipper(ChunkCache& cache)
+    : m_cache(cache)
 {
-    for (
-            uint64_t depth(0);
-            depth < m_slow.size() && m_slow[depth].size();
-            ++depth)
+    resetFast();
+
+    if (const uint64_t depth = cache.stagingDepth())
     {
-        // Purging everything, insert everything into our aged list so we
-        // expire everything.
-        UsedMap& used(m_slow[depth]);
-        UsedMap& aged(m_aged[depth]);
-        aged.insert(used.begin(), used.end());
+        m_stage = makeUnique<Stage>(cache, cache.metadata(), depth);
     }
 
-    clip();
+    if (Presort* split = cache.split())
+    {
+        m_split = makeUnique<Presort::Writer>(*split);
+    }
 }
 
-Chunk* Clipper::get(const ChunkKey& ck)
+Clipper::~Clipper()
 {
-    CachedChunk& fast(m_fast[ck.depth()]);
-    if (fast.xyz == ck.position()) return fast.chunk;
+    // Merging our staged points may reference more chunks, which must be
+    // released below along with the rest.
+    if (m_stage) m_stage->merge(*this);
+    if (m_split) m_split->flush();
+
+    // Purging everything, so expire everything.
+    resetFast();
+    release(m_epoch + 1);
+    m_cache.clipped();
+}
 
-    auto& slow(m_slow[ck.depth()]);
-    auto it = slow.find(ck.position());
+Chunk* Clipper::get(const ChunkKey& ck)
+{
+    Fast& fast(m_fast[ck.depth()]);
+    const Xyz& p(ck.position());
+    if (fast[0].xyz == p) return fast[0].chunk;
 
-    if (it == slow.end())
+    for (std::size_t i(1); i < fast.size(); ++i)
     {
-        auto& aged(m_aged[ck.depth()]);
-        auto agedIt = aged.find(ck.position());
-        if (agedIt == aged.end()) return nullptr;
-
-        it = slow.insert(std::make_pair(agedIt->first, agedIt->second)).first;
-        aged.erase(agedIt);
+        if (fast[i].xyz == p)
+        {
+            std::rotate(fast.begin(), fast.begin() + i, fast.begin() + i + 1);
+            return fast[0].chunk;
+        }
     }
 
-    fast.xyz = ck.position();
-    return fast.chunk = it->second;
+    // Entries of our fast cache are stale after a clip, so only lookups
+    // which reach the table need to stamp it.
+    Chunk* chunk(m_tables[ck.depth()].touch(p, m_epoch));
+    if (!chunk) return nullptr;
+
+    return promote(fast, p, chunk);
 }
 
 void Clipper::set(const ChunkKey& ck, Chunk* chunk)
 {
-    CachedChunk& fast(m_fast[ck.depth()]);
+    promote(m_fast[ck.depth()], ck.position(), chunk);
+    m_tables[ck.depth()].insert(ck.position(), chunk, m_epoch);
+}
+
+void Clipper::clip()
+{
+    metrics::ScopedTimer timer(metrics::Timer::Clip);
+
+    if (m_stage) m_stage->merge(*this);
+
+    resetFast();
 
-    fast.xyz = ck.position();
-    fast.chunk = chunk;
+    // Whatever was last touched before the current epoch hasn't been touched
+    // in two iterations, so deref those chunks.  What remains ages by one.
+    release(m_epoch);
+    ++m_epoch;
 
-    auto& slow(m_slow[ck.depth()]);
-    assert(!slow.count(ck.position()));
-    slow[ck.position()] = chunk;
+    m_cache.clipped();
 }
 
-void Clipper::clip()
+Chunk* Clipper::promote(Fast& fast, const Xyz& p, Chunk* chunk)
+{
+    std::rotate(fast.begin(), fast.end() - 1, fast.end());
+    fast[0].xyz = p;
+    return fast[0].chunk = chunk;
+}
+
+void Clipper::resetFast()
 {
-    m_fast.fill(CachedChunk());
-
-    for (
-            uint64_t depth(0);
-            depth < m_slow.size() && (
-                m_slow[depth].size() || m_aged[depth].size()
-            );
-            ++depth)
+    for (Fast& fast : m_fast) fast.fill(CachedChunk());
+}
+
+void Clipper::release(const uint64_t epoch)
+{
+    // Pinned depths are never held here, so there may be gaps above our
+    // deepest table.
+    for (uint64_t depth(0); depth < m_tables.size(); ++depth)
     {
-        if (m_slow[depth].empty() && m_aged[depth].empty()) continue;
+        if (!m_tables[depth].size()) continue;
+
+        m_stale.clear();
+        m_tables[depth].expire(epoch, m_stale);
+        m_cache.clip(depth, m_stale);
+    }
+}
+
+std::size_t Clipper::Table::find(const Xyz& p) const
+{
+    const std::size_t mask(m_entries.size() - 1);
+    std::size_t i(std::hash<Xyz>()(p) & mask);
+    while (m_entries[i].chunk && !(m_entries[i].xyz == p)) i = (i + 1) & mask;
+    return i;
+}
+
+Chunk* Clipper::Table::touch(const Xyz& p, const uint64_t epoch)
+{
+    if (!m_size) return nullptr;
+
+    Entry& entry(m_entries[find(p)]);
+    if (!entry.chunk) return nullptr;
+
+    entry.epoch = epoch;
+    return entry.chunk;
+}
+
+void Clipper::Table::place(const Entry& entry)
+{
+    Entry& slot(m_entries[find(entry.xyz)]);
+    assert(!slot.chunk);
+    slot = entry;
+    ++m_size;
+}
 
-        UsedMap& used(m_slow[depth]);
-        UsedMap& aged(m_aged[depth]);
+void Clipper::Table::insert(
+    const Xyz& p,
+    Chunk* const chunk,
+    const uint64_t epoch)
+{
+    assert(chunk);
 
-        // Whatever is in our aging list hasn't been touched in two iterations,
-        // so deref those chunks.
-        m_cache.clip(depth, aged);
+    // Keep our load factor at most one half, so probes stay short.
+    if ((m_size + 1) * 2 > m_entries.size())
+    {
+        m_kept.clear();
+        for (const Entry& entry : m_entries)
+        {
+            if (entry.chunk) m_kept.push_back(entry);
+        }
+
+        m_entries.assign(std::max<std::size_t>(16, m_entries.size() * 2), {});
+        m_size = 0;
+        for (const Entry& entry : m_kept) place(entry);
+    }
 
-        // Get rid of what we just clipped, and lower our recently touched
-        // list into our aging list.
-        aged.clear();
+    Entry entry;
+    entry.xyz = p;
+    entry.chunk = chunk;
+    entry.epoch = epoch;
+    place(entry);
+}
 
-        // Now clear our "used" list, moving it into "aged".
-        std::swap(used, aged);
+void Clipper::Table::expire(const uint64_t epoch, std::vector<Xyz>& stale)
+{
+    // Removal from a linearly probed table would have to repair the probe
+    // sequences of the entries after it, so we simply rebuild in place.
+    m_kept.clear();
+    for (Entry& entry : m_entries)
+    {
+        if (!entry.chunk) continue;
+        if (entry.epoch < epoch) stale.push_back(entry.xyz);
+        else m_kept.push_back(entry);
+        entry = Entry();
     }
 
-    m_cache.clipped();
+    m_size = 0;
+    for (const Entry& entry : m_kept) place(entry);
 }
 
 } // namespace entwine
-
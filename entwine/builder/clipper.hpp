@@ -11,8 +11,15 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
 #include <limits>
+#include <memory>
+#include <vector>
 
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/builder/presort.hpp>
+#include <entwine/builder/stage.hpp>
 #include <entwine/types/key.hpp>
 
 namespace entwine
@@ -44,27 +51,80 @@ inline bool operator<(const CachedChunk& a, const CachedChunk& b)
 class Clipper
 {
 public:
-    Clipper(ChunkCache& cache)
-        : m_cache(cache)
-    {
-        m_fast.fill(CachedChunk());
-    }
-
+    Clipper(ChunkCache& cache);
     ~Clipper();
 
     Chunk* get(const ChunkKey& ck);
     void set(const ChunkKey& ck, Chunk* chunk);
     void clip();
 
+    // Returns our private staging grid if insertions into this chunk key
+    // should be staged there, or null if they go to the shared chunk.
+    Stage* stage(const ChunkKey& ck)
+    {
+        return m_stage && m_stage->covers(ck) ? m_stage.get() : nullptr;
+    }
+
+    // Returns the writer for the points diverted from our cache to be built
+    // as independent subtrees, or null if there are none.
+    Presort::Writer* split() { return m_split.get(); }
+
 private:
+    // An open-addressed table of the chunks referenced at one depth, each
+    // stamped with the epoch in which it was last touched.  Aging is a matter
+    // of advancing the epoch, so entries never move between tables, and once
+    // our capacity has settled no bookkeeping allocates.
+    class Table
+    {
+    public:
+        std::size_t size() const { return m_size; }
+
+        // Returns null if this position is not held.  Otherwise its entry is
+        // stamped with this epoch.
+        Chunk* touch(const Xyz& p, uint64_t epoch);
+        void insert(const Xyz& p, Chunk* chunk, uint64_t epoch);
+
+        // Remove every entry last touched before this epoch, appending their
+        // positions to stale.
+        void expire(uint64_t epoch, std::vector<Xyz>& stale);
+
+    private:
+        struct Entry
+        {
+            Xyz xyz;
+            Chunk* chunk = nullptr;
+            uint64_t epoch = 0;
+        };
+
+        std::size_t find(const Xyz& p) const;
+        void place(const Entry& entry);
+
+        std::vector<Entry> m_entries;
+        std::vector<Entry> m_kept;
+        std::size_t m_size = 0;
+    };
+
+    // The most recently used chunks of one depth, most recent first.
+    using Fast = std::array<CachedChunk, heuristics::clipperFastEntries>;
+
+    // Make this chunk the most recently used of its depth.
+    static Chunk* promote(Fast& fast, const Xyz& p, Chunk* chunk);
+    void resetFast();
+
+    // Release, from every depth, the chunks last touched before this epoch.
+    void release(uint64_t epoch);
+
     ChunkCache& m_cache;
+    std::unique_ptr<Stage> m_stage;
+    std::unique_ptr<Presort::Writer> m_split;
 
-    using UsedMap = std::map<Xyz, Chunk*>;
-    using AgedSet = std::set<Xyz>;
+    std::array<Fast, maxDepth> m_fast;
+    std::array<Table, maxDepth> m_tables;
 
-    std::array<CachedChunk, maxDepth> m_fast;
-    std::array<std::map<Xyz, Chunk*>, maxDepth> m_slow;
-    std::array<std::map<Xyz, Chunk*>, maxDepth> m_aged;
+    // Chunks touched in the current epoch or the one before it are retained
+    // when we clip.
+    uint64_t m_epoch = 1;
+    std::vector<Xyz> m_stale;
 };
 
 } // namespace entwine
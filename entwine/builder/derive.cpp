@@ -0,0 +1,277 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/derive.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <entwine/builder/node-stats.hpp>
+#include <entwine/builder/provenance.hpp>
+#include <entwine/builder/voxel-policy.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/types/point-order.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/pool.hpp>
+#include <entwine/util/trace.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+// The saved points of a node, in our absolute layout, and which of them have
+// been taken by its parent.
+struct Node
+{
+    explicit Node(const ChunkKey& ck) : ck(ck) { }
+
+    ChunkKey ck;
+    std::vector<char> data;
+    std::vector<Point> points;
+    std::vector<bool> taken;
+    uint64_t takenCount = 0;
+};
+
+std::string getFilename(const Metadata& m, const ChunkKey& ck)
+{
+    return ck.toString() + getPostfix(m, ck.depth());
+}
+
+void read(
+    const Metadata& m,
+    const Endpoints& endpoints,
+    Node& node,
+    const uint64_t np)
+{
+    pdal::PointLayout& layout(m.layouts->absolute());
+    const uint64_t pointSize(layout.pointSize());
+
+    node.data.reserve(np * pointSize);
+    node.points.reserve(np);
+
+    VectorPointTable table(layout, np);
+    table.setProcess([&]()
+    {
+        const auto points(table.batch());
+        for (pdal::PointId i(0); i < points.size(); ++i)
+        {
+            if (points.skip(i)) continue;
+            const char* pos(points.data(i));
+            node.data.insert(node.data.end(), pos, pos + pointSize);
+            node.points.push_back(points.point(i));
+        }
+    });
+
+    io::read(
+        io::getNodeType(m, node.ck.depth()),
+        m,
+        endpoints,
+        getFilename(m, node.ck),
+        table,
+        node.ck.bounds());
+
+    node.taken.assign(node.points.size(), false);
+}
+
+// Write these points, in our absolute layout, as the node of this key.
+void write(
+    const Metadata& m,
+    const Endpoints& endpoints,
+    const ChunkKey& ck,
+    const std::vector<const char*>& points)
+{
+    pdal::PointLayout& layout(m.layouts->absolute());
+    const uint64_t pointSize(layout.pointSize());
+
+    MemBlock block(pointSize, 4096);
+    for (const char* pos : points)
+    {
+        std::copy(pos, pos + pointSize, block.next());
+    }
+
+    BlockPointTable table(layout);
+    table.insert(block);
+    sortPoints(table, m.internal.pointOrder, ck.bounds());
+
+    if (endpoints.nodeStats) endpoints.nodeStats->add(ck.get(), table);
+    if (endpoints.provenance) endpoints.provenance->add(ck.get(), table);
+
+    io::write(
+        io::getNodeType(m, ck.depth()),
+        m,
+        endpoints,
+        getFilename(m, ck),
+        table,
+        ck.bounds());
+}
+
+template <VoxelPolicy P>
+void derive(
+    const Metadata& m,
+    const Endpoints& endpoints,
+    Hierarchy& hierarchy,
+    const ChunkKey& ck)
+{
+    trace::Span span("derive", ck.toString());
+
+    std::vector<Node> children;
+    for (uint64_t i(0); i < dirEnd(); ++i)
+    {
+        const ChunkKey child(ck.getStep(toDir(i)));
+        const int64_t np(hierarchy.get(child.dxyz()));
+        if (np <= 0) continue;
+
+        children.emplace_back(child);
+        read(m, endpoints, children.back(), np);
+    }
+
+    // The winner of each of our voxels, by its child and its index there.
+    using Winner = std::pair<std::size_t, std::size_t>;
+    std::unordered_map<uint64_t, Winner> winners;
+
+    const uint64_t s(m.span);
+    Key key(m.bounds, getStartDepth(m));
+    for (std::size_t c(0); c < children.size(); ++c)
+    {
+        const std::vector<Point>& points(children[c].points);
+        for (std::size_t i(0); i < points.size(); ++i)
+        {
+            key.init(points[i], ck);
+            const Xyz& pos(key.position());
+            const uint64_t cell(
+                ((pos.z % s) * s + pos.y % s) * s + pos.x % s);
+
+            const auto it(winners.find(cell));
+            if (it == winners.end()) winners.emplace(cell, Winner(c, i));
+            else
+            {
+                Winner& w(it->second);
+                const Point& current(children[w.first].points[w.second]);
+                if (voxel::replaces<P>(points[i], current, key))
+                {
+                    w = Winner(c, i);
+                }
+            }
+        }
+    }
+
+    for (const auto& p : winners)
+    {
+        Node& child(children[p.second.first]);
+        child.taken[p.second.second] = true;
+        ++child.takenCount;
+    }
+
+    std::vector<const char*> ours;
+    for (Node& child : children)
+    {
+        if (!child.takenCount) continue;
+
+        // If all of this child's points won their voxels, its first stays.
+        if (child.takenCount == child.points.size())
+        {
+            child.taken[0] = false;
+            --child.takenCount;
+            if (!child.takenCount) continue;
+        }
+
+        const uint64_t pointSize(child.data.size() / child.points.size());
+        std::vector<const char*> kept;
+        for (std::size_t i(0); i < child.points.size(); ++i)
+        {
+            const char* pos(child.data.data() + i * pointSize);
+            if (child.taken[i]) ours.push_back(pos);
+            else kept.push_back(pos);
+        }
+
+        write(m, endpoints, child.ck, kept);
+        hierarchy.set(child.ck.dxyz(), kept.size());
+    }
+
+    // A parent whose children each have a single point is left empty, but
+    // remains in our hierarchy so that its subtree is reachable.
+    if (ours.size()) write(m, endpoints, ck, ours);
+    hierarchy.set(ck.dxyz(), ours.size());
+}
+
+void derive(
+    const Metadata& m,
+    const Endpoints& endpoints,
+    Hierarchy& hierarchy,
+    const ChunkKey& ck)
+{
+    switch (toVoxelPolicy(m.internal.voxelPolicy))
+    {
+        case VoxelPolicy::First:
+            return derive<VoxelPolicy::First>(m, endpoints, hierarchy, ck);
+        case VoxelPolicy::MaxZ:
+            return derive<VoxelPolicy::MaxZ>(m, endpoints, hierarchy, ck);
+        case VoxelPolicy::MinZ:
+            return derive<VoxelPolicy::MinZ>(m, endpoints, hierarchy, ck);
+        case VoxelPolicy::Random:
+            return derive<VoxelPolicy::Random>(m, endpoints, hierarchy, ck);
+        default:
+            return derive<VoxelPolicy::Closest>(m, endpoints, hierarchy, ck);
+    }
+}
+
+} // unnamed namespace
+
+void deriveParents(
+    const Metadata& m,
+    const Endpoints& endpoints,
+    Hierarchy& hierarchy,
+    const uint64_t depth,
+    const uint64_t threads)
+{
+    for (uint64_t d(depth); d > 0; --d)
+    {
+        // The parents of every node at this depth, including those left
+        // empty, so that the nodes beneath them are reached.
+        std::set<Dxyz> parents;
+        hierarchy.forEach([&](const Dxyz& k, int64_t)
+        {
+            if (k.d != d) return;
+            parents.insert(Dxyz(d - 1, k.x / 2, k.y / 2, k.z / 2));
+        });
+
+        std::cout << "Deriving " << parents.size() << " nodes at depth " <<
+            (d - 1) << std::endl;
+
+        // The children of distinct parents are disjoint, so each parent may
+        // be derived independently.
+        Pool pool(threads);
+        for (const Dxyz& key : parents)
+        {
+            pool.add([&m, &endpoints, &hierarchy, key]()
+            {
+                ChunkKey ck(m.bounds, getStartDepth(m));
+                ck.init(key);
+                derive(m, endpoints, hierarchy, ck);
+            });
+        }
+        pool.join();
+
+        if (pool.errors().size())
+        {
+            throw std::runtime_error(pool.errors().front());
+        }
+    }
+}
+
+} // namespace entwine
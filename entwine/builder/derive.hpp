@@ -0,0 +1,38 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/types/endpoints.hpp>
+#include <entwine/types/metadata.hpp>
+
+namespace entwine
+{
+
+// Build the nodes above this depth from those at it, which must already be
+// saved, a depth at a time toward the root.  Each parent is sampled from the
+// points of its children: the winner of each of its voxels, by our voxel
+// policy, moves up into it, and the others stay where they are, so that every
+// point is still held by exactly one node.  A child keeps at least one of its
+// points, so no node is emptied.
+//
+// Parents, and the children from which points were taken, are written
+// directly to our output, and their counts are set in this hierarchy.
+void deriveParents(
+    const Metadata& metadata,
+    const Endpoints& endpoints,
+    Hierarchy& hierarchy,
+    uint64_t depth,
+    uint64_t threads);
+
+} // namespace entwine
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 namespace entwine
@@ -22,18 +23,265 @@ namespace heuristics
 // windows, which will trigger their serialization.
 const uint64_t sleepCount(65536 * 32);
 
+// While over the memory budget, this many points (per thread) will trigger a
+// clip, even if sleepCount has not yet been reached.
+const uint64_t minSleepCount(65536);
+
+// The number of independently locked shards into which each depth of the
+// chunk cache is divided.
+const std::size_t chunkCacheShards(64);
+
 // How many unreferenced chunks to keep alive in our chunk cache.
 const uint64_t cacheSize(64);
 
+// The number of recently used chunks at each depth which a clipper checks
+// before its table, so that points alternating between neighboring chunks
+// rarely reach the table.
+const std::size_t clipperFastEntries(4);
+
+// The maximum number of children of each node of the index of input files by
+// bounds, by which, for example, the chunk cache judges which of its
+// unreferenced chunks are cold.
+const uint64_t sourceIndexFanout(16);
+
+// The total thread count when none is given and our container does not limit
+// our CPUs.
+const uint64_t defaultThreads(8);
+
+// When no memory budget is given but our container has a memory limit, this
+// fraction of the limit is budgeted for point data, leaving the rest for the
+// hierarchy, caches, and the overhead of reading our inputs.
+const double containerMemoryRatio(0.5);
+
 // When building, we are given a total thread count.  Because serialization is
 // more expensive than actually doing tree work, we'll allocate more threads to
 // the "clip" task than to the "work" task.  This parameter tunes the ratio of
 // work threads to clip threads.
 const float defaultWorkToClipRatio(0.33f);
 
+// When reading and insertion are pipelined, the number of decoded point
+// batches that may be queued for each insertion thread before the reader
+// blocks.
+const uint64_t batchesPerInsertThread(2);
+
+// When range-reading remote uncompressed LAS files without an explicit split
+// size, the number of points fetched in each range.
+const uint64_t rangeReadPoints(1 << 22);
+
+// Sampled LAS and LAZ sources are read as evenly spaced blocks of this many
+// points, which is the default chunk size of LAZ.
+const uint64_t sampleBlockPoints(50000);
+
+// The number of threads with which each COPC source, read in place, decodes
+// its chunks.
+const uint64_t copcThreads(4);
+
+// The number of threads with which each EPT source, read in place, fetches
+// and decodes its nodes, and the number of decoded nodes per thread which may
+// wait to be inserted.
+const uint64_t eptThreads(8);
+const uint64_t eptNodesPerThread(2);
+
+// Free memory blocks beyond this many bytes are returned to the allocator
+// rather than being pooled for reuse.
+const uint64_t blockPoolBytes(1 << 28);
+
+// The number of freed memory blocks cached by each thread before they are
+// returned to the shared pool.
+const std::size_t blockPoolThreadCache(8);
+
+// Scratch buffers, in which nodes are packed and compressed and into which
+// they are read, are kept by each thread for reuse if they hold at most this
+// many bytes, and at most this many are kept per thread for each type.
+const uint64_t scratchBytes(1 << 24);
+const std::size_t scratchThreadCache(16);
+
+// When huge pages are enabled, memory blocks are carved from slabs of this
+// many bytes.
+const uint64_t hugePageSlabBytes(1 << 26);
+
+// When multithreaded zstd compression is enabled, only nodes with at least
+// this many uncompressed bytes are compressed with multiple threads.
+const uint64_t zstdThreadedBytes(1 << 24);
+
+// When a zstd dictionary is enabled, nodes with fewer than this many
+// uncompressed bytes are compressed with it, and it is trained once the
+// nodes sampled total this many times its size.
+const uint64_t zstdDictionaryBytes(1 << 16);
+const uint64_t zstdDictionarySamples(100);
+
+// When uploads are asynchronous, serialized nodes totaling at most this many
+// bytes may be pending upload before the threads producing them block.
+const uint64_t uploadBytes(1 << 28);
+
+// The submission queue depth of the io_uring to which local node writes are
+// queued, a quarter of which is the number of files in flight.
+const uint64_t ringEntries(256);
+
+// A rate-limited location which throttles us is halved in rate, to no less
+// than this fraction of its ceiling, and then regains this fraction of its
+// ceiling per second, times our priority.
+const double minRateLimitScale(1.0 / 64);
+const double rateLimitRecovery(0.05);
+
+// The number of threads fetching nodes ahead of their use, if enabled.
+const uint64_t nodePrefetchThreads(8);
+
+// The default budget of a local read cache of remote objects, if enabled.
+const uint64_t readCacheBytes(16ull << 30);
+
+// The number of independently locked shards of the hierarchy.
+const std::size_t hierarchyShards(64);
+
+// When the hierarchy is spilled, nodes shallower than this depth, which are
+// the most frequently updated, are always held in memory.  Each shard merges
+// its runs once it has more than hierarchyRuns of them.
+const uint64_t hierarchyResidentDepth(8);
+const std::size_t hierarchyRuns(4);
+
+// The approximate memory of a hierarchy node held in memory, by which a budget
+// in bytes is converted to a number of nodes.
+const uint64_t hierarchyNodeBytes(96);
+
+// The voxel grid of each chunk is allocated lazily, in square tiles of this
+// many tubes per side.
+const uint64_t gridTileSpan(16);
+
+// When overflows may be spilled to disk, an overflow holding at least this
+// many points in memory is spilled while the build is over its memory budget,
+// and spilled points are read back in batches of this many.
+const uint64_t spillPoints(16384);
+const uint64_t spillBatchPoints(65536);
+
+// For presorted builds, the deepest bucketing depth, and the bytes of records
+// buffered by each inserting thread before they are appended to the buckets.
+const uint64_t maxPresortDepth(8);
+const uint64_t presortBufferBytes(1 << 26);
+
+// For coordinated builds, the duration of a subset lease in seconds, which is
+// renewed by heartbeat at a third of this interval.
+const uint64_t leaseSeconds(300);
+
+// For coordinated builds, the number of times a subset may be claimed before
+// it is considered to have failed permanently.
+const uint64_t leaseAttempts(3);
+
+// For coordinated builds, how long to wait after writing a lease before
+// confirming that our claim was not overwritten by a competing worker.  Claims
+// whose read and write take longer than half of this are abandoned.
+const uint64_t leaseSettleMs(2000);
+
+// For coordinated builds, how long to wait before polling for newly available
+// subsets when every remaining subset is claimed by another worker.
+const uint64_t leasePollSeconds(30);
+
+// For incremental merges, how long to wait before polling for newly completed
+// subsets.
+const uint64_t mergePollSeconds(30);
+
+// Balanced subsets are planned over a grid of at least this many XY cells per
+// subset, which is refined until no cell holds more than this fraction of the
+// points of a subset, so each subset is balanced to within a small share.
+const uint64_t subsetCells(16);
+
+// The maximum depth of the balanced subset grid.  Nodes above this depth are
+// shared between subsets, and must be merged afterward.
+const uint64_t maxSubsetDepth(7);
+
+// The deepest pinned depth, beyond which direct indexing of every possible
+// chunk would be too large.  Depth 5 alone has 32768 chunks.
+const uint64_t maxPinnedDepth(6);
+
 // Max number of nodes to store in a single hierarchy file.
 const uint64_t maxHierarchyNodesPerFile(32768);
 
+// When threads are balanced adaptively, the interval in milliseconds at which
+// the split is reconsidered.  A thread moves to clipping if the work threads
+// spent more than the high fraction of this interval blocked on the
+// serialization queue, and back to work if they spent less than the low one
+// while nothing was queued.
+const uint64_t balanceIntervalMs(2000);
+const double balanceStallHigh(0.2);
+const double balanceStallLow(0.02);
+
+// The default number of depths published in a preview of a build in progress,
+// which is enough for an overview of most datasets.
+const uint64_t previewDepth(6);
+
+// The minimum number of sources sampled by a build estimate, and the memory
+// held per node of the hierarchy, which is the part of a build's memory that
+// grows with its size.
+const uint64_t estimateSources(4);
+const uint64_t estimateNodeBytes(64);
+
+// The weight of the latest interval in the smoothed pace from which a build
+// projects its completion, and the number of its longest-running sources
+// reported with each progress snapshot.
+const double progressSmoothing(0.3);
+const uint64_t progressSources(5);
+
+// The number of times a range which failed before any of its points were
+// inserted is retried, and the delay before the first retry in milliseconds,
+// which doubles with each attempt.
+const uint64_t sourceRetries(3);
+const uint64_t sourceRetryMs(1000);
+
+// Deep analysis of a LAS or LAZ file with more points than this is split into
+// ranges of this many points, which are analyzed in parallel.
+const uint64_t deepRangePoints(20 * 1000 * 1000);
+
+// The sources of a compact manifest have their detailed metadata loaded in
+// batches of this many, by this many threads, ahead of their insertion and
+// while it is saved.
+const uint64_t sourceDetailBatch(1024);
+const uint64_t sourceDetailThreads(32);
+
+// The detail of each source is written as it finishes by this many threads,
+// with at most this many writes queued before finishing sources must wait.
+const uint64_t sourceWriterThreads(8);
+const uint64_t sourceWriterQueue(4096);
+
+// During analysis, remote files are fetched, or their headers read, by this
+// many threads unless specified, since shallow scans of remote inputs are
+// bound by request latency rather than by our cores.
+const uint64_t analysisIoThreads(64);
+
+// The fewest threads given to each of the builds run together in a single
+// process: one work thread and the minimum number of clip threads.
+const uint64_t minBuildThreads(4);
+
+// Nodes shallower than the lossy depth of a build store XYZ with a step of at
+// most this fraction of the width of their voxels.
+const uint64_t lossyVoxelSteps(1024);
+
+// Staged nodes are uploaded by at least this many threads, since uploads wait
+// on the network rather than on our cores.
+const uint64_t journalThreads(32);
+
+// When tuning a build by its density, the span is chosen so that a node over
+// a surface holds about this many points, and then so that the tree is no
+// deeper than this, but no smaller than this span.
+const uint64_t tuneNodePoints(128 * 128);
+const uint64_t tuneMaxDepth(20);
+const uint64_t tuneMinSpan(16);
+
+// When learning a tuning profile from a build, the cache grows while more than
+// this fraction of chunk writes were later rewoken, within these limits...
+const double learnedRewakeRatio(0.25);
+const uint64_t minLearnedCacheSize(16);
+const uint64_t maxLearnedCacheSize(4096);
+
+// ...the sleep count grows while chunks were reclaimed more often than they
+// were written, up to this limit...
+const double learnedReclaimRatio(1.0);
+const uint64_t maxLearnedSleepCount(1 << 26);
+
+// ...and clip threads are added while insertion spent more than the first of
+// these fractions of its time waiting on clips, and removed while it spent
+// less than the second.
+const double learnedClipWaitHigh(0.1);
+const double learnedClipWaitLow(0.01);
+
 } // namespace heuristics
 } // namespace entwine
 
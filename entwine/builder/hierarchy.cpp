@@ -11,34 +11,378 @@
 #include <entwine/builder/hierarchy.hpp>
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
 
 #include <entwine/builder/heuristics.hpp>
 #include <entwine/types/metadata.hpp>
 #include <entwine/util/io.hpp>
 #include <entwine/util/pool.hpp>
+#include <entwine/util/sax.hpp>
 
 namespace entwine
 {
 
+namespace
+{
+
+// Records are written through a buffer of about this many bytes.
+const std::size_t runBufferBytes(1 << 20);
+
+// Runs are named uniquely within their directory by this counter.
+std::atomic_uint64_t runs(0);
+
+} // unnamed namespace
+
+Hierarchy::Run::Run(std::vector<Record> records)
+    : m_records(std::move(records))
+    , m_begin(m_records.data())
+    , m_end(m_records.data() + m_records.size())
+{ }
+
+Hierarchy::Run::~Run()
+{
+    m_file.reset();
+    if (m_path.size()) arbiter::remove(m_path);
+}
+
+template <typename F>
+std::shared_ptr<const Hierarchy::Run> Hierarchy::Run::write(
+    const std::string& dir,
+    F f)
+{
+    std::shared_ptr<Run> run(new Run());
+    run->m_path = arbiter::join(dir, std::to_string(++runs) + ".bin");
+
+    std::ofstream file(
+        run->m_path,
+        std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!file) throw std::runtime_error("Failed to open: " + run->m_path);
+
+    std::vector<Record> buffer;
+    buffer.reserve(runBufferBytes / sizeof(Record));
+    uint64_t n(0);
+    const auto flush([&]()
+    {
+        file.write(
+            reinterpret_cast<const char*>(buffer.data()),
+            buffer.size() * sizeof(Record));
+        n += buffer.size();
+        buffer.clear();
+    });
+
+    f([&](const Record& r)
+    {
+        buffer.push_back(r);
+        if (buffer.size() == buffer.capacity()) flush();
+    });
+    flush();
+
+    file.close();
+    if (!file) throw std::runtime_error("Failed to write: " + run->m_path);
+
+    if (n) run->m_file = MappedFile::create(run->m_path);
+    if (run->m_file)
+    {
+        run->m_begin = reinterpret_cast<const Record*>(run->m_file->data());
+    }
+    else
+    {
+        // Without a mapping, our records are read back into memory.
+        run->m_records.assign(n, Record { NodeKey(Dxyz()), 0, 0 });
+        std::ifstream in(run->m_path, std::ios_base::binary);
+        in.read(
+            reinterpret_cast<char*>(run->m_records.data()),
+            n * sizeof(Record));
+        if (!in) throw std::runtime_error("Failed to read: " + run->m_path);
+        run->m_begin = run->m_records.data();
+    }
+    run->m_end = run->m_begin + n;
+
+    return run;
+}
+
+const Hierarchy::Record* Hierarchy::Run::find(const NodeKey& k) const
+{
+    const Record* it(std::lower_bound(
+        m_begin,
+        m_end,
+        k,
+        [](const Record& r, const NodeKey& k) { return r.key < k; }));
+    return it != m_end && it->key == k ? it : nullptr;
+}
+
+void Hierarchy::spill(const std::string dir, const uint64_t maxNodes)
+{
+    m_spillDir = dir;
+    m_spillNodes = std::max<uint64_t>(maxNodes / m_shards.size(), 1);
+
+    for (Shard& shard : m_shards)
+    {
+        UniqueSpin lock(shard.spin);
+        maybeSpill(shard, lock);
+    }
+}
+
+void Hierarchy::spill(Shard& shard, UniqueSpin& lock)
+{
+    // Our spilled nodes, with their dirtiness, remain visible in memory as a
+    // new run while it is written.
+    std::vector<Record> records;
+    records.reserve(shard.map.size() - shard.resident);
+    for (auto it(shard.map.begin()); it != shard.map.end(); )
+    {
+        if (isResident(it->first)) ++it;
+        else
+        {
+            const uint64_t dirty(shard.dirty.erase(it->first));
+            records.push_back(Record { it->first, it->second, dirty });
+            it = shard.map.erase(it);
+        }
+    }
+    std::sort(
+        records.begin(),
+        records.end(),
+        [](const Record& a, const Record& b) { return a.key < b.key; });
+
+    const RunPtr pending(std::make_shared<const Run>(std::move(records)));
+    shard.runs.push_back(pending);
+    shard.spilling = true;
+
+    const std::vector<RunPtr> runs(shard.runs);
+    const std::size_t cleanRuns(shard.cleanRuns);
+    const uint64_t cleaned(shard.cleaned);
+    const bool merging(runs.size() > heuristics::hierarchyRuns);
+    lock.unlock();
+
+    RunPtr written;
+    try
+    {
+        if (!merging)
+        {
+            written = Run::write(m_spillDir, [&pending](
+                const std::function<void(const Record&)>& add)
+            {
+                for (const Record& r : *pending) add(r);
+            });
+        }
+        else
+        {
+            // Merge every run into one, where the newest record for each key
+            // wins.  With nothing older beneath our result, tombstones need
+            // only be kept while dirty.
+            written = Run::write(m_spillDir, [&](
+                const std::function<void(const Record&)>& add)
+            {
+                std::vector<const Record*> heads;
+                for (const RunPtr& run : runs) heads.push_back(run->begin());
+
+                while (true)
+                {
+                    const NodeKey* next(nullptr);
+                    for (std::size_t i(0); i < runs.size(); ++i)
+                    {
+                        if (heads[i] == runs[i]->end()) continue;
+                        if (!next || heads[i]->key < *next)
+                        {
+                            next = &heads[i]->key;
+                        }
+                    }
+                    if (!next) break;
+
+                    const NodeKey key(*next);
+                    Record merged { key, 0, 0 };
+                    for (std::size_t i(0); i < runs.size(); ++i)
+                    {
+                        if (heads[i] == runs[i]->end()) continue;
+                        if (!(heads[i]->key == key)) continue;
+                        merged.count = heads[i]->count;
+                        if (i >= cleanRuns) merged.dirty |= heads[i]->dirty;
+                        ++heads[i];
+                    }
+
+                    if (merged.count != erased() || merged.dirty) add(merged);
+                }
+            });
+        }
+    }
+    catch (...)
+    {
+        // The pending run remains in memory, which keeps us consistent.
+        lock.lock();
+        shard.spilling = false;
+        throw;
+    }
+
+    lock.lock();
+    if (merging)
+    {
+        // If we were cleaned while merging, none of our records are dirty.
+        shard.runs.assign(1, written);
+        shard.cleanRuns = shard.cleaned == cleaned ? 0 : 1;
+    }
+    else
+    {
+        std::replace(shard.runs.begin(), shard.runs.end(), pending, written);
+    }
+    shard.spilling = false;
+}
+
+uint64_t Hierarchy::size() const
+{
+    uint64_t n(0);
+    for (const Shard& shard : m_shards)
+    {
+        SpinGuard lock(shard.spin);
+        n += shard.nodes;
+    }
+    return n;
+}
+
+void Hierarchy::set(const Entries& entries)
+{
+    std::array<std::vector<NodeKey>, heuristics::hierarchyShards> keys;
+    std::array<std::vector<int64_t>, heuristics::hierarchyShards> vals;
+    for (const auto& e : entries)
+    {
+        const NodeKey k(e.first);
+        const std::size_t i(getShardIndex(k));
+        keys[i].push_back(k);
+        vals[i].push_back(e.second);
+    }
+
+    for (std::size_t i(0); i < m_shards.size(); ++i)
+    {
+        Shard& shard(m_shards[i]);
+        UniqueSpin lock(shard.spin);
+        for (std::size_t j(0); j < keys[i].size(); ++j)
+        {
+            assign(shard, keys[i][j], vals[i][j]);
+        }
+        maybeSpill(shard, lock);
+    }
+}
+
+Hierarchy::Map Hierarchy::map() const
+{
+    Map result;
+    for (const Shard& shard : m_shards)
+    {
+        SpinGuard lock(shard.spin);
+        for (const auto& p : shard.map) result[p.first.dxyz()] = p.second;
+    }
+    return result;
+}
+
+namespace
+{
+
+// Each record is a node's depth and position as 64-bit integers, followed by
+// its 64-bit count, following a header of a magic string and the node count.
+// Files of our first version, whose depths and positions were of 32 bits, are
+// still read.
+const std::string binaryMagic("EHB2");
+const std::string binaryMagicV1("EHB1");
+const uint64_t recordSize(4 * sizeof(uint64_t) + sizeof(int64_t));
+const uint64_t recordSizeV1(4 * sizeof(uint32_t) + sizeof(int64_t));
+const uint64_t headerSize(4 + sizeof(uint64_t));
+
+template <typename T>
+void readRecords(const char* pos, const uint64_t n, Hierarchy& h)
+{
+    T key[4];
+    int64_t count(0);
+    for (uint64_t i(0); i < n; ++i)
+    {
+        std::memcpy(key, pos, sizeof(key));
+        pos += sizeof(key);
+        std::memcpy(&count, pos, sizeof(count));
+        pos += sizeof(count);
+        h.set(Dxyz(key[0], key[1], key[2], key[3]), count);
+    }
+}
+
+std::string getBinaryFilename(const std::string& postfix)
+{
+    return "hierarchy" + postfix + ".bin";
+}
+
+} // unnamed namespace
+
+// Records are written in no particular order, directly from our shards, since
+// an ordered copy of a large hierarchy would be much larger than its encoding.
+std::vector<char> Hierarchy::toBinary() const
+{
+    std::vector<char> data(headerSize);
+    data.reserve(headerSize + size() * recordSize);
+    std::copy(binaryMagic.begin(), binaryMagic.end(), data.data());
+
+    forEach([&data](const Dxyz& key, const int64_t count)
+    {
+        const uint64_t values[4] = { key.d, key.x, key.y, key.z };
+        const char* pos(reinterpret_cast<const char*>(values));
+        data.insert(data.end(), pos, pos + sizeof(values));
+        pos = reinterpret_cast<const char*>(&count);
+        data.insert(data.end(), pos, pos + sizeof(count));
+    });
+
+    const uint64_t n((data.size() - headerSize) / recordSize);
+    std::memcpy(data.data() + 4, &n, sizeof(n));
+    return data;
+}
+
+Hierarchy Hierarchy::fromBinary(const std::vector<char>& data)
+{
+    if (data.size() < headerSize)
+    {
+        throw std::runtime_error("Invalid binary hierarchy");
+    }
+
+    const auto is([&data](const std::string& magic)
+    {
+        return std::equal(magic.begin(), magic.end(), data.data());
+    });
+    const bool v1(is(binaryMagicV1));
+    if (!v1 && !is(binaryMagic))
+    {
+        throw std::runtime_error("Invalid binary hierarchy");
+    }
+
+    // The count is checked against our size by division, so that a corrupt
+    // count cannot overflow.
+    uint64_t n(0);
+    std::memcpy(&n, data.data() + 4, sizeof(n));
+    const uint64_t size(v1 ? recordSizeV1 : recordSize);
+    const uint64_t body(data.size() - headerSize);
+    if (body % size || body / size != n)
+    {
+        throw std::runtime_error("Invalid binary hierarchy");
+    }
+
+    Hierarchy h;
+    const char* pos(data.data() + headerSize);
+    if (v1) readRecords<uint32_t>(pos, n, h);
+    else readRecords<uint64_t>(pos, n, h);
+    return h;
+}
+
 void to_json(json& j, const Hierarchy& h)
 {
     j = json::object();
-    for (const auto& entry : h.map) j[entry.first.toString()] = entry.second;
+    for (const auto& entry : h.map()) j[entry.first.toString()] = entry.second;
 }
 
 void from_json(const json& j, Hierarchy& h)
 {
-    h.map = j.get<Hierarchy::Map>();
-    /*
-    for (const auto& p : j.items())
-    {
-        const Dxyz key(p.key());
-        const uint64_t value = p.value().get<uint64_t>();
-        h.map[key] = value;
-    }
-    */
+    for (const auto& p : j.get<Hierarchy::Map>()) h.set(p.first, p.second);
 }
 
 namespace hierarchy
@@ -49,31 +393,79 @@ namespace
 
 struct Analysis
 {
-    Analysis() = default;
-    Analysis(const Hierarchy::ChunkMap& chunks)
+    uint64_t maxNodesPerFile = 0;
+    double rsd = 0;
+};
+
+struct DxyzHash
+{
+    std::size_t operator()(const Dxyz& k) const
+    {
+        return std::hash<Xyz>()(k.p) ^ (k.d * 0x9e3779b97f4a7c15ull);
+    }
+};
+
+Dxyz getAncestor(const Dxyz& key, const uint64_t depth)
+{
+    const uint64_t shift = key.d - depth;
+    return Dxyz(depth, key.x >> shift, key.y >> shift, key.z >> shift);
+}
+
+// Visit the root of each file in which this node appears for a given step.
+// Each node belongs to the file rooted at its nearest ancestor, or itself,
+// whose depth is a multiple of the step.  The roots of files other than the
+// root file are also referenced from their parent files.
+template <typename F>
+void forEachFile(const Dxyz& key, const unsigned step, F f)
+{
+    if (!step) return f(Dxyz());
+
+    const uint64_t r = (key.d / step) * step;
+    f(getAncestor(key, r));
+    if (key.d && key.d == r) f(getAncestor(key, r - step));
+}
+
+// Accumulates the node count of each file which a given hierarchy step would
+// produce, without materializing the files themselves.
+class StepCounter
+{
+public:
+    explicit StepCounter(unsigned step) : m_step(step) { }
+
+    unsigned step() const { return m_step; }
+
+    void add(const Dxyz& key)
     {
-        const double totalFiles = chunks.size();
+        forEachFile(key, m_step, [this](const Dxyz& root)
+        {
+            ++m_counts[root];
+        });
+    }
+
+    Analysis analyze() const
+    {
+        Analysis a;
+
+        const double totalFiles = m_counts.size();
         double totalNodes = 0;
-        for (const auto& chunk : chunks)
+        for (const auto& p : m_counts)
         {
-            const uint64_t chunkSize = chunk.second.size();
-            totalNodes += chunkSize;
-            maxNodesPerFile = std::max(maxNodesPerFile, chunkSize);
+            totalNodes += p.second;
+            a.maxNodesPerFile = std::max(a.maxNodesPerFile, p.second);
         }
 
         double mean = totalNodes / totalFiles;
         double ss = 0;
-        for (const auto& chunk : chunks)
-        {
-            const double n = chunk.second.size();
-            ss += std::pow(n - mean, 2.0);
-        }
+        for (const auto& p : m_counts) ss += std::pow(p.second - mean, 2.0);
         double stddev = std::sqrt(ss / (totalNodes - 1.0));
-        rsd = stddev / mean;
+        a.rsd = stddev / mean;
+
+        return a;
     }
 
-    uint64_t maxNodesPerFile = 0;
-    double rsd = 0;
+private:
+    const unsigned m_step;
+    std::unordered_map<Dxyz, uint64_t, DxyzHash> m_counts;
 };
 
 Dxyz getChild(const Dxyz& key, const int dir)
@@ -89,11 +481,11 @@ void getChunks(
     Hierarchy::ChunkMap& result,
     const Dxyz& root,
     const Dxyz& curr,
-    const Hierarchy::Map& h,
+    const Hierarchy& h,
     const unsigned step)
 {
-    if (!h.count(curr)) return;
-    const int64_t n = h.at(curr);
+    if (!h.has(curr)) return;
+    const int64_t n = h.get(curr);
 
     if (step && curr.d > root.d && curr.d % step == 0)
     {
@@ -113,32 +505,43 @@ void getChunks(
 
 } // unnamed namespace
 
+Dxyz getRoot(const Dxyz& key, const unsigned step)
+{
+    if (!step) return Dxyz();
+    return getAncestor(key, (key.d / step) * step);
+}
+
 Hierarchy::ChunkMap getChunks(const Hierarchy& h, const unsigned step)
 {
     Hierarchy::ChunkMap result;
-    getChunks(result, Dxyz(), Dxyz(), h.map, step);
+    getChunks(result, Dxyz(), Dxyz(), h, step);
     return result;
 }
 
 unsigned determineStep(const Hierarchy& h)
 {
-    if (h.map.size() < heuristics::maxHierarchyNodesPerFile) return 0;
+    if (h.size() < heuristics::maxHierarchyNodesPerFile) return 0;
+
+    // Gather the file sizes for every candidate step in a single pass.
+    std::vector<StepCounter> counters;
+    for (const unsigned step : { 4, 5, 6, 8, 10 }) counters.emplace_back(step);
+
+    h.forEach([&counters](const Dxyz& key, int64_t)
+    {
+        for (StepCounter& c : counters) c.add(key);
+    });
 
     struct AnalysisEntry
     {
-        AnalysisEntry(const Hierarchy& h, unsigned step)
-            : analysis(getChunks(h, step))
-            , step(step)
+        AnalysisEntry(const StepCounter& c)
+            : analysis(c.analyze())
+            , step(c.step())
         { }
         Analysis analysis;
         unsigned step = 0;
     };
 
-    std::vector<AnalysisEntry> entries;
-    for (const uint64_t step : { 4, 5, 6, 8, 10 })
-    {
-        entries.emplace_back(h, step);
-    }
+    std::vector<AnalysisEntry> entries(counters.begin(), counters.end());
 
     const auto best = std::min_element(
         entries.begin(),
@@ -162,62 +565,251 @@ unsigned determineStep(const Hierarchy& h)
     return best->step;
 }
 
-void save(
+namespace
+{
+
+// Gather the nodes of the file rooted at root, in the layout of getChunks,
+// where starts(key) is true for the roots of other files.
+template <typename Starts>
+void getSubtree(
+    json& data,
+    const Hierarchy& h,
+    const Dxyz& root,
+    const Dxyz& curr,
+    Starts starts)
+{
+    if (!h.has(curr)) return;
+
+    if (curr != root && starts(curr))
+    {
+        data[curr.toString()] = -1;
+        return;
+    }
+
+    data[curr.toString()] = h.get(curr);
+    for (int dir = 0; dir < 8; ++dir)
+    {
+        getSubtree(data, h, root, getChild(curr, dir), starts);
+    }
+}
+
+// The root of the file holding this node, among these roots.
+Dxyz getRoot(const Dxyz& key, const Roots& roots)
+{
+    Dxyz root(key);
+    while (root.d && !roots.count(root)) root = getAncestor(root, root.d - 1);
+    return root;
+}
+
+// As forEachFile for a step, for files rooted at these roots.
+template <typename F>
+void forEachFile(const Dxyz& key, const Roots& roots, F f)
+{
+    const Dxyz root(getRoot(key, roots));
+    f(root);
+    if (key.d && root == key) f(getRoot(getAncestor(key, key.d - 1), roots));
+}
+
+using Sizes = std::unordered_map<Dxyz, uint64_t, DxyzHash>;
+
+// Record the number of nodes in the subtree of each node, including itself.
+uint64_t getSizes(const Hierarchy& h, const Dxyz& key, Sizes& sizes)
+{
+    uint64_t n(1);
+    for (int dir = 0; dir < 8; ++dir)
+    {
+        const Dxyz child(getChild(key, dir));
+        if (h.has(child)) n += getSizes(h, child, sizes);
+    }
+    return sizes[key] = n;
+}
+
+// Each file is gathered by its own task directly from the hierarchy, so only
+// the files currently being written are held in memory.
+template <typename Starts>
+void write(
     const Hierarchy& h,
     const arbiter::Endpoint& ep,
-    const unsigned step,
+    const std::vector<Dxyz>& roots,
     const unsigned threads,
-    const std::string postfix)
+    const std::string& postfix,
+    const std::string& encoding,
+    Starts starts)
 {
-    Pool pool(threads);
+    if (roots.empty()) return;
 
-    const auto chunks = getChunks(h, step);
-    for (const auto& chunk : chunks)
+    Pool pool(threads);
+    for (const Dxyz& root : roots)
     {
-        pool.add([&]()
+        pool.add([&h, &ep, &postfix, &encoding, root, starts]()
         {
-            const Dxyz& root = chunk.first;
-            const Hierarchy::Map& counts = chunk.second;
-
-            const std::string filename = root.toString() + postfix + ".json";
             json data = json::object();
-            for (const auto& node : counts)
-            {
-                data[node.first.toString()] = node.second;
-            }
+            getSubtree(data, h, root, root, starts);
 
-            const int indent = root.d ? -1 : 2;
-            ensurePut(ep, filename, data.dump(indent));
+            const int indent = root.d || encoding.size() ? -1 : 2;
+            const std::string filename = root.toString() + postfix + ".json";
+            ensurePutJson(ep, filename, data.dump(indent), encoding);
         });
     }
 
+    // Alongside the EPT hierarchy for readers, write a binary copy from which
+    // we can awaken much faster for continued builds and merges.
+    pool.add([&]()
+    {
+        ensurePut(ep, getBinaryFilename(postfix), h.toBinary());
+    });
+
     pool.join();
+
+    // Our caller marks the hierarchy clean once we return, after which a
+    // failed file would never be rewritten.
+    if (pool.errors().size())
+    {
+        throw std::runtime_error(pool.errors().front());
+    }
 }
 
-void load(
-    Hierarchy& h,
+} // unnamed namespace
+
+Roots determineRoots(const Hierarchy& h, const uint64_t maxNodes)
+{
+    const uint64_t max(std::max<uint64_t>(maxNodes, 1));
+
+    Sizes sizes;
+    getSizes(h, Dxyz(), sizes);
+
+    Roots roots { Dxyz() };
+    std::vector<Dxyz> pending { Dxyz() };
+    std::deque<Dxyz> queue;
+
+    const auto enqueue([&sizes, &queue](const Dxyz& key)
+    {
+        for (int dir = 0; dir < 8; ++dir)
+        {
+            const Dxyz child(getChild(key, dir));
+            if (sizes.count(child)) queue.push_back(child);
+        }
+    });
+
+    while (pending.size())
+    {
+        const Dxyz root(pending.back());
+        pending.pop_back();
+
+        // Nodes are taken breadth-first, so that each file holds the
+        // shallowest depths of its subtree.  Once the file is full, each
+        // remaining subtree is referenced as a file of its own.
+        uint64_t nodes(1);
+        enqueue(root);
+        while (queue.size())
+        {
+            const Dxyz key(queue.front());
+            queue.pop_front();
+
+            const uint64_t size(sizes.at(key));
+            if (nodes + size <= max) nodes += size;
+            else if (nodes < max)
+            {
+                ++nodes;
+                enqueue(key);
+            }
+            else
+            {
+                roots.insert(key);
+                pending.push_back(key);
+            }
+        }
+    }
+
+    return roots;
+}
+
+void save(
+    const Hierarchy& h,
     const arbiter::Endpoint& ep,
-    Pool& pool,
-    const std::string& postfix,
-    const Dxyz& root = Dxyz())
+    const unsigned step,
+    const unsigned threads,
+    const std::string postfix,
+    const bool incremental,
+    const std::string encoding)
 {
-    const json j = json::parse(
-        ensureGet(ep, root.toString() + postfix + ".json"));
+    std::vector<Dxyz> roots;
+    if (incremental)
+    {
+        std::set<Dxyz> dirty;
+        h.forEachDirty([&dirty, step](const Dxyz& key)
+        {
+            forEachFile(key, step, [&dirty](const Dxyz& root)
+            {
+                dirty.insert(root);
+            });
+        });
+        roots.assign(dirty.begin(), dirty.end());
+    }
+    else
+    {
+        h.forEach([&roots, step](const Dxyz& key, int64_t)
+        {
+            if (!key.d || (step && key.d % step == 0)) roots.push_back(key);
+        });
+    }
 
-    for (const auto& node : j.items())
+    write(h, ep, roots, threads, postfix, encoding, [step](const Dxyz& key)
     {
-        const Dxyz key(node.key());
-        const int64_t val(node.value().get<int64_t>());
+        return step && key.d % step == 0;
+    });
+}
 
-        if (val == -1)
+void save(
+    const Hierarchy& h,
+    const arbiter::Endpoint& ep,
+    const Roots& roots,
+    const unsigned threads,
+    const std::string postfix,
+    const bool incremental,
+    const std::string encoding)
+{
+    std::set<Dxyz> files;
+    if (incremental)
+    {
+        h.forEachDirty([&files, &roots](const Dxyz& key)
         {
-            pool.add([&h, &ep, &pool, &postfix, key]()
+            forEachFile(key, roots, [&files](const Dxyz& root)
             {
-                load(h, ep, pool, postfix, key);
+                files.insert(root);
             });
-        }
-        else set(h, key, val);
+        });
     }
+    else
+    {
+        for (const Dxyz& root : roots) if (h.has(root)) files.insert(root);
+    }
+
+    const std::vector<Dxyz> list(files.begin(), files.end());
+    write(h, ep, list, threads, postfix, encoding, [&roots](const Dxyz& key)
+    {
+        return roots.count(key) != 0;
+    });
+}
+
+// Parse one hierarchy file, whose nodes are appended to entries and whose
+// child files are appended to children.
+void load(
+    const arbiter::Endpoint& ep,
+    const std::string& postfix,
+    const Dxyz& root,
+    Hierarchy::Entries& entries,
+    std::vector<Dxyz>& children)
+{
+    const auto f([&](const std::string& k, const int64_t val)
+    {
+        if (val == -1) children.emplace_back(k);
+        else entries.emplace_back(Dxyz(k), val);
+    });
+
+    sax::forEachInteger(
+        ensureGet(ep, root.toString() + postfix + ".json"),
+        f);
 }
 
 Hierarchy load(
@@ -225,12 +817,56 @@ Hierarchy load(
     const unsigned threads,
     const std::string postfix)
 {
-    Hierarchy hierarchy;
-    Pool pool(threads);
+    // The binary copy is only an accelerator: if it was truncated or
+    // corrupted, say by an interrupted upload, the JSON files are still
+    // authoritative for readers, so we load from those instead.
+    if (const auto data = ep.tryGetBinary(getBinaryFilename(postfix)))
+    {
+        try
+        {
+            Hierarchy hierarchy(Hierarchy::fromBinary(*data));
+            hierarchy.clean();
+            return hierarchy;
+        }
+        catch (const std::exception&) { }
+    }
+
+    // Files are fetched and parsed a depth of files at a time, with at most
+    // one request in flight per thread.  Each file is parsed into its own
+    // entries, which are merged into our hierarchy in bulk.
+    std::vector<Hierarchy::Entries> entries;
+    std::vector<Dxyz> files { Dxyz() };
+    while (files.size())
+    {
+        const uint64_t begin(entries.size());
+        entries.resize(begin + files.size());
+        std::vector<std::vector<Dxyz>> children(files.size());
 
-    load(hierarchy, ep, pool, postfix);
+        Pool pool(threads, files.size());
+        for (uint64_t i(0); i < files.size(); ++i)
+        {
+            pool.add([&, i]()
+            {
+                load(ep, postfix, files[i], entries[begin + i], children[i]);
+            });
+        }
+        pool.join();
 
-    pool.await();
+        if (pool.errors().size())
+        {
+            throw std::runtime_error(pool.errors().front());
+        }
+
+        files.clear();
+        for (const std::vector<Dxyz>& c : children)
+        {
+            files.insert(files.end(), c.begin(), c.end());
+        }
+    }
+
+    Hierarchy hierarchy;
+    for (const Hierarchy::Entries& e : entries) hierarchy.set(e);
+    hierarchy.clean();
 
     return hierarchy;
 }
@@ -10,30 +10,456 @@
 
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <limits>
 #include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/types/defs.hpp>
 #include <entwine/types/key.hpp>
+#include <entwine/util/mapped-file.hpp>
+#include <entwine/util/metrics.hpp>
 #include <entwine/util/spin-lock.hpp>
 
 namespace entwine
 {
 
-struct Hierarchy
+// Hierarchy node counts, keyed compactly and divided into independently
+// locked shards so that concurrent updates rarely contend.  Siblings share a
+// shard, so that the children of a node may be read under a single lock.
+//
+// If spilling is enabled, the deeper nodes of each shard are moved, whenever
+// it holds too many nodes in memory, into an immutable run sorted by key and
+// mapped from a local file.  Memory is searched before the runs, and newer
+// runs before older ones, so spilled nodes may be updated or erased in memory
+// as usual.  Too many runs are merged into one.
+class Hierarchy
 {
+public:
     using Map = std::map<Dxyz, int64_t>;
     using ChunkMap = std::map<Dxyz, Hierarchy::Map>;
+    using Entries = std::vector<std::pair<Dxyz, int64_t>>;
 
-    Hierarchy() = default;
-    Hierarchy(const Hierarchy& other) : map(other.map) { }
+    Hierarchy() { set(Dxyz(), 0); }
+    Hierarchy(const Hierarchy& other) { *this = other; }
     Hierarchy& operator=(const Hierarchy& other)
     {
-        map = other.map;
+        if (this == &other) return *this;
+        for (std::size_t i(0); i < m_shards.size(); ++i)
+        {
+            SpinGuard lock(other.m_shards[i].spin);
+            m_shards[i].assign(other.m_shards[i]);
+        }
+        m_spillDir = other.m_spillDir;
+        m_spillNodes = other.m_spillNodes;
         return *this;
     }
 
-    mutable SpinLock spin;
-    Map map = { { Dxyz(), 0 } };
+    // Moving takes the maps of each shard rather than copying them, which is
+    // significant for hierarchies of many nodes.
+    Hierarchy(Hierarchy&& other) { *this = std::move(other); }
+    Hierarchy& operator=(Hierarchy&& other)
+    {
+        if (this == &other) return *this;
+        for (std::size_t i(0); i < m_shards.size(); ++i)
+        {
+            SpinGuard lock(other.m_shards[i].spin);
+            m_shards[i].take(other.m_shards[i]);
+        }
+        m_spillDir = std::move(other.m_spillDir);
+        m_spillNodes = other.m_spillNodes;
+        return *this;
+    }
+
+    // Spill our nodes at or beneath heuristics::hierarchyResidentDepth to runs
+    // within this local directory, whenever a shard holds more than its share
+    // of maxNodes in memory.  Shards already over that share spill now.
+    void spill(std::string dir, uint64_t maxNodes);
+
+    // Nodes whose values change are marked dirty until clean() is called.
+    void set(const Dxyz& key, int64_t val)
+    {
+        const NodeKey k(key);
+        Shard& shard(getShard(k));
+        UniqueSpin lock(shard.spin);
+        assign(shard, k, val);
+        maybeSpill(shard, lock);
+    }
+
+    // Set many nodes at once, taking the lock of each shard only once.
+    void set(const Entries& entries);
+
+    // Erased nodes are also marked dirty, so that files which held them are
+    // rewritten.
+    void erase(const Dxyz& key)
+    {
+        const NodeKey k(key);
+        Shard& shard(getShard(k));
+        UniqueSpin lock(shard.spin);
+        if (!find(shard, k)) return;
+
+        --shard.nodes;
+        shard.dirty.insert(k);
+
+        // A node which may have been spilled is superseded by a tombstone.
+        if (shard.runs.empty() || isResident(k))
+        {
+            shard.map.erase(k);
+            if (isResident(k)) --shard.resident;
+        }
+        else
+        {
+            shard.map[k] = erased();
+            maybeSpill(shard, lock);
+        }
+    }
+
+    void clean()
+    {
+        for (Shard& shard : m_shards)
+        {
+            SpinGuard lock(shard.spin);
+            shard.dirty.clear();
+            shard.cleanRuns = shard.runs.size();
+            ++shard.cleaned;
+        }
+    }
+
+    // Visit every dirty node, in no particular order, as f(const Dxyz&).
+    template <typename F>
+    void forEachDirty(F f) const
+    {
+        for (const Shard& shard : m_shards)
+        {
+            SpinGuard lock(shard.spin);
+            for (const NodeKey& k : shard.dirty) f(k.dxyz());
+
+            // Runs spilled since our last cleaning flag their dirty nodes.
+            for (std::size_t i(shard.cleanRuns); i < shard.runs.size(); ++i)
+            {
+                for (const Record& r : *shard.runs[i])
+                {
+                    if (
+                        r.dirty &&
+                        !shard.dirty.count(r.key) &&
+                        isLatest(shard, i, r.key))
+                    {
+                        f(r.key.dxyz());
+                    }
+                }
+            }
+        }
+    }
+
+    bool has(const Dxyz& key) const
+    {
+        const NodeKey k(key);
+        const Shard& shard(getShard(k));
+        SpinGuard lock(shard.spin);
+        return find(shard, k);
+    }
+
+    // Returns zero for nonexistent nodes.
+    int64_t get(const Dxyz& key) const
+    {
+        const NodeKey k(key);
+        const Shard& shard(getShard(k));
+        SpinGuard lock(shard.spin);
+        const int64_t* count(find(shard, k));
+        return count ? *count : 0;
+    }
+
+    // The counts of the children of this node, in the order of their Dir.
+    std::array<int64_t, 8> getChildren(const Dxyz& key) const
+    {
+        std::array<int64_t, 8> counts;
+        const NodeKey first(Dxyz(key.d + 1, key.x * 2, key.y * 2, key.z * 2));
+        const Shard& shard(getShard(first));
+        SpinGuard lock(shard.spin);
+        for (uint32_t i(0); i < counts.size(); ++i)
+        {
+            NodeKey k(first);
+            k.x += i & 0x1;
+            k.y += (i >> 1) & 0x1;
+            k.z += (i >> 2) & 0x1;
+            const int64_t* count(find(shard, k));
+            counts[i] = count ? *count : 0;
+        }
+        return counts;
+    }
+
+    uint64_t size() const;
+
+    // Visit every node, in no particular order, as f(const Dxyz&, int64_t).
+    // The hierarchy must not be modified from within f.
+    template <typename F>
+    void forEach(F f) const
+    {
+        for (const Shard& shard : m_shards)
+        {
+            SpinGuard lock(shard.spin);
+            for (const auto& p : shard.map)
+            {
+                if (p.second != erased()) f(p.first.dxyz(), p.second);
+            }
+            for (std::size_t i(0); i < shard.runs.size(); ++i)
+            {
+                for (const Record& r : *shard.runs[i])
+                {
+                    if (r.count != erased() && isLatest(shard, i, r.key))
+                    {
+                        f(r.key.dxyz(), r.count);
+                    }
+                }
+            }
+        }
+    }
+
+    // An ordered copy of every node.
+    Map map() const;
+
+    // A compact binary encoding of every node, as fixed-size records.
+    std::vector<char> toBinary() const;
+    static Hierarchy fromBinary(const std::vector<char>& data);
+
+private:
+    // A node key as held by our shards and written to our runs.  Coordinates
+    // are of 64 bits, which suffices for keys at our maximum depth, beyond
+    // which keys are rejected.
+    struct NodeKey
+    {
+        explicit NodeKey(const Dxyz& k)
+            : x(k.x)
+            , y(k.y)
+            , z(k.z)
+            , d(static_cast<uint32_t>(k.d))
+        {
+            if (k.d > maxDepth) throw std::runtime_error("Key is too deep");
+        }
+
+        Dxyz dxyz() const { return Dxyz(d, x, y, z); }
+
+        bool operator==(const NodeKey& o) const
+        {
+            return x == o.x && y == o.y && z == o.z && d == o.d;
+        }
+        bool operator<(const NodeKey& o) const
+        {
+            if (d != o.d) return d < o.d;
+            if (x != o.x) return x < o.x;
+            if (y != o.y) return y < o.y;
+            return z < o.z;
+        }
+
+        uint64_t x;
+        uint64_t y;
+        uint64_t z;
+        uint32_t d;
+    };
+
+    struct NodeKeyHash
+    {
+        std::size_t operator()(const NodeKey& k) const
+        {
+            uint64_t h(k.x * 0x9e3779b97f4a7c15ull);
+            h ^= k.y * 0xc2b2ae3d27d4eb4full + (h << 6) + (h >> 2);
+            h ^= k.z * 0x165667b19e3779f9ull + (h << 6) + (h >> 2);
+            h ^= k.d * 0x27d4eb2f165667c5ull + (h << 6) + (h >> 2);
+            return h ^ (h >> 32);
+        }
+    };
+
+    // The count of an erased node which may have been spilled.
+    static int64_t erased() { return std::numeric_limits<int64_t>::min(); }
+
+    static bool isResident(const NodeKey& k)
+    {
+        return k.d < heuristics::hierarchyResidentDepth;
+    }
+
+    // A spilled node, which is dirty if it was dirty when it was spilled and
+    // its run has not since been cleaned.
+    struct Record
+    {
+        NodeKey key;
+        int64_t count;
+        uint64_t dirty;
+    };
+
+    // An immutable run of records sorted by key, which is held in memory while
+    // it is written, and mapped from its file thereafter.
+    class Run
+    {
+    public:
+        explicit Run(std::vector<Record> records);
+        ~Run();
+
+        // Write these sorted records to a new file in this directory, and map
+        // it.  If it cannot be mapped, its records are held in memory.
+        template <typename F>
+        static std::shared_ptr<const Run> write(const std::string& dir, F f);
+
+        const Record* begin() const { return m_begin; }
+        const Record* end() const { return m_end; }
+        const Record* find(const NodeKey& k) const;
+
+    private:
+        Run() = default;
+
+        std::vector<Record> m_records;
+        std::unique_ptr<MappedFile> m_file;
+        std::string m_path;
+        const Record* m_begin = nullptr;
+        const Record* m_end = nullptr;
+    };
+
+    using RunPtr = std::shared_ptr<const Run>;
+
+    template <typename T>
+    using Allocator = metrics::Allocator<T, metrics::Memory::Hierarchy>;
+
+    struct Shard
+    {
+        mutable SpinLock spin{ LockType::Hierarchy };
+        std::unordered_map<
+            NodeKey,
+            int64_t,
+            NodeKeyHash,
+            std::equal_to<NodeKey>,
+            Allocator<std::pair<const NodeKey, int64_t>>> map;
+        std::unordered_set<
+            NodeKey,
+            NodeKeyHash,
+            std::equal_to<NodeKey>,
+            Allocator<NodeKey>> dirty;
+
+        // The number of nodes which exist, in memory or in our runs, and the
+        // number of entries of our map which are never spilled.
+        uint64_t nodes = 0;
+        uint64_t resident = 0;
+
+        // Our runs, oldest first, of which the first cleanRuns were spilled
+        // before our last cleaning.  Runs change only while spilling, and are
+        // written by a single spilling thread at a time, outside of our lock.
+        std::vector<RunPtr> runs;
+        std::size_t cleanRuns = 0;
+        uint64_t cleaned = 0;
+        bool spilling = false;
+
+        void assign(const Shard& o)
+        {
+            map = o.map;
+            dirty = o.dirty;
+            nodes = o.nodes;
+            resident = o.resident;
+            runs = o.runs;
+            cleanRuns = o.cleanRuns;
+        }
+
+        void take(Shard& o)
+        {
+            map = std::move(o.map);
+            dirty = std::move(o.dirty);
+            runs = std::move(o.runs);
+            nodes = o.nodes;
+            resident = o.resident;
+            cleanRuns = o.cleanRuns;
+            o.map.clear();
+            o.dirty.clear();
+            o.runs.clear();
+            o.nodes = o.resident = o.cleanRuns = 0;
+        }
+    };
+
+    // The count of this node, if it exists, with the lock of its shard held.
+    static const int64_t* find(const Shard& shard, const NodeKey& k)
+    {
+        const auto it(shard.map.find(k));
+        if (it != shard.map.end())
+        {
+            return it->second == erased() ? nullptr : &it->second;
+        }
+        for (auto run(shard.runs.rbegin()); run != shard.runs.rend(); ++run)
+        {
+            if (const Record* r = (*run)->find(k))
+            {
+                return r->count == erased() ? nullptr : &r->count;
+            }
+        }
+        return nullptr;
+    }
+
+    // Whether this key, from the run at this index, is not superseded.
+    static bool isLatest(const Shard& shard, std::size_t i, const NodeKey& k)
+    {
+        if (shard.map.count(k)) return false;
+        for (++i; i < shard.runs.size(); ++i)
+        {
+            if (shard.runs[i]->find(k)) return false;
+        }
+        return true;
+    }
+
+    static void assign(Shard& shard, const NodeKey& k, const int64_t val)
+    {
+        const int64_t* existing(find(shard, k));
+        if (existing && *existing == val) return;
+
+        if (!existing) ++shard.nodes;
+        const auto result(shard.map.emplace(k, val));
+        if (!result.second) result.first->second = val;
+        else if (isResident(k)) ++shard.resident;
+        shard.dirty.insert(k);
+    }
+
+    void maybeSpill(Shard& shard, UniqueSpin& lock)
+    {
+        if (
+            m_spillNodes &&
+            !shard.spilling &&
+            shard.map.size() - shard.resident > m_spillNodes)
+        {
+            spill(shard, lock);
+        }
+    }
+
+    // Move the spillable nodes of this shard into a new run, and write it, or
+    // if there are too many runs, write the merge of them all.  Our lock is
+    // released while writing.
+    void spill(Shard& shard, UniqueSpin& lock);
+
+    // Nodes are sharded by their parent keys.
+    static std::size_t getShardIndex(NodeKey k)
+    {
+        if (k.d)
+        {
+            k.x >>= 1;
+            k.y >>= 1;
+            k.z >>= 1;
+            --k.d;
+        }
+        return NodeKeyHash()(k) % heuristics::hierarchyShards;
+    }
+
+    Shard& getShard(const NodeKey& k) { return m_shards[getShardIndex(k)]; }
+    const Shard& getShard(const NodeKey& k) const
+    {
+        return m_shards[getShardIndex(k)];
+    }
+
+    std::array<Shard, heuristics::hierarchyShards> m_shards;
+
+    // If m_spillNodes is non-zero, the number of spillable nodes which each
+    // shard may hold in memory, and the directory of our runs.
+    std::string m_spillDir;
+    uint64_t m_spillNodes = 0;
 };
 
 void to_json(json& j, const Hierarchy& h);
@@ -44,26 +470,53 @@ namespace hierarchy
 
 inline void set(Hierarchy& h, const Dxyz& key, uint64_t val)
 {
-    SpinGuard lock(h.spin);
-    h.map[key] = val;
+    h.set(key, val);
 }
 
 inline uint64_t get(const Hierarchy& h, const Dxyz& key)
 {
-    SpinGuard lock(h.spin);
-    const auto it = h.map.find(key);
-    if (it == h.map.end()) return 0;
-    else return it->second;
+    return h.get(key);
 }
 
+// The root of the file holding this node, for this hierarchy step.
+Dxyz getRoot(const Dxyz& key, unsigned step);
+
 unsigned determineStep(const Hierarchy& h);
+
+// The roots of the files of a hierarchy paged adaptively, rather than at fixed
+// depths, including the root node.
+using Roots = std::set<Dxyz>;
+
+// Page this hierarchy by node count: each file takes the shallowest nodes of
+// its subtree, absorbing whole subtrees which fit, until it holds maxNodes
+// nodes, and the remaining subtrees start files of their own.
+Roots determineRoots(const Hierarchy& h, uint64_t maxNodes);
 Hierarchy::ChunkMap getChunks(const Hierarchy& h, unsigned step = 0);
+
+// If incremental, only the files containing dirty nodes are written, which
+// requires that the existing files were written with the same step.  With a
+// content encoding, every file is written compactly, and precompressed as for
+// ensurePutJson.
 void save(
     const Hierarchy& h,
     const arbiter::Endpoint& ep,
     unsigned step,
     unsigned threads,
-    std::string postfix = "");
+    std::string postfix = "",
+    bool incremental = false,
+    std::string encoding = "");
+
+// As above, for files rooted at these roots.  If incremental, the existing
+// files must have been written with the same roots.
+void save(
+    const Hierarchy& h,
+    const arbiter::Endpoint& ep,
+    const Roots& roots,
+    unsigned threads,
+    std::string postfix = "",
+    bool incremental = false,
+    std::string encoding = "");
+
 Hierarchy load(
     const arbiter::Endpoint& ep,
     unsigned threads,
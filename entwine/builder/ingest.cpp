@@ -0,0 +1,261 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/ingest.hpp>
+
+#include <stdexcept>
+
+#include <entwine/types/dimension.hpp>
+#include <entwine/util/metrics.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+Ingest::Ingest(Builder& builder, const unsigned threads)
+    : m_builder(builder)
+    , m_threads(std::max(threads, 1u))
+{
+    const Metadata& metadata(m_builder.metadata);
+    if (metadata.internal.presortDepth)
+    {
+        throw std::runtime_error("Cannot ingest points into a presorted build");
+    }
+    if (m_builder.peers.size())
+    {
+        throw std::runtime_error("Cannot ingest points into multiple subsets");
+    }
+
+    m_builder.prepare();
+    m_cache = makeUnique<ChunkCache>(
+        m_builder.endpoints,
+        metadata,
+        m_builder.hierarchy,
+        m_threads);
+}
+
+std::unique_ptr<Ingest::Stream> Ingest::add(
+    const std::string path,
+    const Bounds& bounds,
+    const Srs& srs)
+{
+    Source source(path);
+    source.info.bounds = bounds;
+    source.info.srs = srs;
+    source.info.schema = m_builder.metadata.schema;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return !m_publishing; });
+
+    const Origin origin(m_builder.manifest.size());
+    m_builder.manifest.emplace_back(source);
+
+    std::unique_ptr<Stream> stream(new Stream(*this, origin));
+    m_streams.insert(stream.get());
+    return stream;
+}
+
+void Ingest::enter()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return !m_publishing; });
+    ++m_busy;
+}
+
+void Ingest::leave()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    --m_busy;
+    m_cv.notify_all();
+}
+
+void Ingest::maybePublish()
+{
+    const uint64_t minutes = m_builder.metadata.internal.checkpointMinutes;
+    const uint64_t files = m_builder.metadata.internal.checkpointFiles;
+    if (!minutes && !files) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_publishing) return;
+
+        const auto elapsed = std::chrono::duration_cast<std::chrono::minutes>(
+            Clock::now() - m_published).count();
+        const bool due =
+            (files && m_finished >= files) ||
+            (minutes && elapsed >= int64_t(minutes));
+        if (!due) return;
+    }
+
+    publish();
+}
+
+void Ingest::publish()
+{
+    if (!m_cache) throw std::runtime_error("Ingestion was already saved");
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return !m_publishing; });
+        m_publishing = true;
+        m_cv.wait(lock, [this]() { return !m_busy; });
+    }
+
+    const auto done([this]()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_publishing = false;
+        m_published = Clock::now();
+        m_finished = 0;
+        m_cv.notify_all();
+    });
+
+    try
+    {
+        // Every stream is idle, and none may be added or finished until we
+        // are done, so their references may be released from here.
+        for (Stream* stream : m_streams) stream->release();
+        m_cache->persist();
+
+        const Metadata& metadata(m_builder.metadata);
+        if (metadata.internal.checkpointMinutes ||
+            metadata.internal.checkpointFiles)
+        {
+            m_builder.checkpoint(*m_cache, m_threads);
+        }
+        else m_builder.save(m_threads);
+    }
+    catch (...)
+    {
+        done();
+        throw;
+    }
+
+    done();
+}
+
+void Ingest::save()
+{
+    if (!m_cache) throw std::runtime_error("Ingestion was already saved");
+    if (m_streams.size())
+    {
+        throw std::runtime_error("Every stream must be finished before saving");
+    }
+
+    m_cache->join();
+
+    // As for a build, our final state supersedes any checkpoint.
+    const Metadata& metadata(m_builder.metadata);
+    if (metadata.internal.checkpointMinutes ||
+        metadata.internal.checkpointFiles)
+    {
+        m_builder.checkpoint(*m_cache, m_threads);
+    }
+    else m_builder.save(m_threads);
+
+    m_cache.reset();
+}
+
+Ingest::Stream::Stream(Ingest& ingest, const Origin origin)
+    : m_ingest(ingest)
+    , m_origin(origin)
+    , m_pointSize(getPointSize(ingest.m_builder.metadata.absoluteSchema))
+    , m_ids(toMemoryLayout(ingest.m_builder.metadata.absoluteSchema))
+    , m_inserter(makeInserter())
+{ }
+
+std::unique_ptr<Inserter> Ingest::Stream::makeInserter() const
+{
+    const Metadata& metadata(m_ingest.m_builder.metadata);
+    return makeUnique<Inserter>(
+        metadata,
+        *m_ingest.m_cache,
+        toMemoryLayout(metadata.absoluteSchema));
+}
+
+void Ingest::Stream::release()
+{
+    // Our clipper releases its references as it is destroyed.
+    m_inserter->finish();
+    m_inserter = makeInserter();
+}
+
+uint64_t Ingest::Stream::write(char* const data, const uint64_t points)
+{
+    if (!m_inserter) throw std::runtime_error("Stream is finished");
+
+    m_ingest.enter();
+    try
+    {
+        const uint64_t inserts(insert(data, points));
+        m_ingest.leave();
+        return inserts;
+    }
+    catch (...)
+    {
+        m_ingest.leave();
+        throw;
+    }
+}
+
+uint64_t Ingest::Stream::insert(char* const data, const uint64_t points)
+{
+
+    char* pos(data);
+    for (uint64_t i(0); i < points; ++i, pos += m_pointSize)
+    {
+        m_ids.write(pos, m_origin, m_pointId++);
+    }
+
+    const auto start(metrics::Clock::now());
+    const uint64_t inserts(m_inserter->insert(data, points));
+    metrics::add(metrics::Timer::Insert, metrics::nanosSince(start));
+
+    const bool subset(!!m_ingest.m_builder.metadata.subset);
+    tally(m_counts, points, inserts, subset, [&]()
+    {
+        return m_inserter->outOfBounds(data, points);
+    });
+    m_ingest.m_inserted += inserts;
+    return inserts;
+}
+
+void Ingest::Stream::finish()
+{
+    if (!m_inserter) return;
+
+    m_ingest.enter();
+    try
+    {
+        // Releasing our inserter releases its chunk references.
+        m_inserter->finish();
+        m_inserter.reset();
+
+        std::lock_guard<std::mutex> lock(m_ingest.m_mutex);
+        m_ingest.m_streams.erase(this);
+        ++m_ingest.m_finished;
+
+        BuildItem& item(m_ingest.m_builder.manifest.at(m_origin));
+        item.source.info.points = m_pointId;
+        item.source.info.counts = m_counts;
+        item.inserted = true;
+    }
+    catch (...)
+    {
+        m_ingest.leave();
+        throw;
+    }
+    m_ingest.leave();
+
+    metrics::add(metrics::Counter::SourcesInserted);
+    m_ingest.maybePublish();
+}
+
+} // namespace entwine
@@ -0,0 +1,130 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include <entwine/builder/builder.hpp>
+#include <entwine/builder/chunk-cache.hpp>
+#include <entwine/builder/inserter.hpp>
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/defs.hpp>
+#include <entwine/types/point-counts.hpp>
+#include <entwine/types/srs.hpp>
+
+namespace entwine
+{
+
+// Builds directly from points held in memory, rather than from files read by
+// PDAL pipelines.  Each stream of points is added to the manifest of our
+// builder as a source whose info is given rather than analyzed.  Its points
+// are packed in the absolute layout of our builder's metadata, whose bounds
+// must already cover them.
+//
+// Streams may be written concurrently, each by one thread at a time.  Once
+// every stream has been destroyed, save() writes out our nodes and saves the
+// build.
+//
+// For continuous ingestion, publish() snapshots the build as it stands while
+// keeping our chunks resident, so that a long-running process may accept new
+// streams indefinitely without reloading its nodes.  Publication also occurs
+// automatically as streams finish, every checkpointMinutes or
+// checkpointFiles streams, in which case each snapshot is a checkpoint from
+// which the build may be resumed.
+class Ingest
+{
+public:
+    Ingest(Builder& builder, unsigned threads);
+
+    class Stream
+    {
+    public:
+        ~Stream() { finish(); }
+
+        // Insert this many packed points, returning the number inserted.
+        // Their origin and point IDs are stamped in place, so the data is
+        // modified, and is referenced rather than copied as it is inserted.
+        uint64_t write(char* data, uint64_t points);
+
+        // Record the fates of our points with our source.  No more points
+        // may be written afterward.
+        void finish();
+
+    private:
+        friend class Ingest;
+        Stream(Ingest& ingest, Origin origin);
+
+        std::unique_ptr<Inserter> makeInserter() const;
+        uint64_t insert(char* data, uint64_t points);
+
+        // Release our chunk references, so that they may be written.
+        void release();
+
+        Ingest& m_ingest;
+        const Origin m_origin;
+        const uint64_t m_pointSize;
+        const IdWriter m_ids;
+        std::unique_ptr<Inserter> m_inserter;
+
+        uint64_t m_pointId = 0;
+        PointCounts m_counts;
+    };
+
+    // Add a source named by this path, whose points lie within these bounds
+    // and are in this SRS.
+    std::unique_ptr<Stream> add(
+        std::string path,
+        const Bounds& bounds,
+        const Srs& srs = Srs());
+
+    // The number of points inserted so far by all of our streams.
+    uint64_t inserted() const { return m_inserted; }
+
+    // Write out every changed node, and save our hierarchy, sources, and
+    // metadata, while leaving our streams usable.  Writes are blocked until
+    // this completes.
+    void publish();
+
+    void save();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Streams hold these while writing, so that a publication may wait for
+    // them to be idle.
+    void enter();
+    void leave();
+    void maybePublish();
+
+    Builder& m_builder;
+    const unsigned m_threads;
+    std::unique_ptr<ChunkCache> m_cache;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::set<Stream*> m_streams;
+    uint64_t m_busy = 0;
+    bool m_publishing = false;
+
+    Clock::time_point m_published = Clock::now();
+    uint64_t m_finished = 0;
+
+    std::atomic_uint64_t m_inserted{ 0 };
+};
+
+} // namespace entwine
@@ -0,0 +1,434 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <pdal/PointLayout.hpp>
+
+#include <entwine/builder/chunk-cache.hpp>
+#include <entwine/builder/clipper.hpp>
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/builder/presort.hpp>
+#include <entwine/builder/resident.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/types/point-counts.hpp>
+#include <entwine/types/scale-offset.hpp>
+#include <entwine/types/subset.hpp>
+#include <entwine/types/voxel.hpp>
+#include <entwine/util/optional.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+// The machinery by which points, once read, are stamped, filtered by bounds,
+// and inserted into the tree, shared by the insertion of files and of points
+// ingested from memory.
+
+// A batch of points packed in the absolute layout of a build.
+struct PointBatch
+{
+    std::vector<char> data;
+    uint64_t size = 0;
+};
+
+// Stamps the origin and point ID of a point directly at their offsets in our
+// absolute layout.  Their types are resolved once, rather than dispatched by
+// setField for every point read, and either may be absent from the schema.
+class IdWriter
+{
+public:
+    explicit IdWriter(const pdal::PointLayout& layout)
+        : m_origin(getField(layout, DimId::OriginId))
+        , m_point(getField(layout, DimId::PointId))
+    { }
+
+    void write(char* point, const uint64_t originId, const uint64_t pointId)
+        const
+    {
+        if (m_origin.store) m_origin.store(point + m_origin.offset, originId);
+        if (m_point.store) m_point.store(point + m_point.offset, pointId);
+    }
+
+private:
+    using Store = void (*)(char*, uint64_t);
+
+    struct Field
+    {
+        std::size_t offset = 0;
+        Store store = nullptr;
+    };
+
+    template <typename T>
+    static void store(char* pos, const uint64_t v)
+    {
+        const T t(static_cast<T>(v));
+        if (std::is_integral<T>::value && static_cast<uint64_t>(t) != v)
+        {
+            throw std::runtime_error(
+                "ID " + std::to_string(v) + " overflows its dimension");
+        }
+        std::memcpy(pos, &t, sizeof(T));
+    }
+
+    static Field getField(const pdal::PointLayout& layout, const DimId id)
+    {
+        Field field;
+        if (!layout.hasDim(id)) return field;
+
+        field.offset = layout.dimOffset(id);
+        switch (layout.dimType(id))
+        {
+            case DimType::Signed8:      field.store = &store<int8_t>;   break;
+            case DimType::Signed16:     field.store = &store<int16_t>;  break;
+            case DimType::Signed32:     field.store = &store<int32_t>;  break;
+            case DimType::Signed64:     field.store = &store<int64_t>;  break;
+            case DimType::Unsigned8:    field.store = &store<uint8_t>;  break;
+            case DimType::Unsigned16:   field.store = &store<uint16_t>; break;
+            case DimType::Unsigned32:   field.store = &store<uint32_t>; break;
+            case DimType::Unsigned64:   field.store = &store<uint64_t>; break;
+            case DimType::Float:        field.store = &store<float>;    break;
+            case DimType::Double:       field.store = &store<double>;   break;
+            default: throw std::runtime_error("Invalid ID dimension type");
+        }
+        return field;
+    }
+
+    const Field m_origin;
+    const Field m_point;
+};
+
+// Add the fate of some points to these counts, of which this many were
+// inserted.  Without subsets, every rejection is out of bounds, and otherwise
+// the points out of bounds are counted only if necessary.
+template <typename F>
+void tally(
+    PointCounts& counts,
+    const uint64_t points,
+    const uint64_t inserts,
+    const bool subset,
+    F outOfBounds)
+{
+    counts.inserts += inserts;
+
+    const uint64_t rejected(points - inserts);
+    if (!rejected) return;
+
+    const uint64_t oob(
+        subset ? std::min<uint64_t>(rejected, outOfBounds()) : rejected);
+    counts.outOfBounds += oob;
+    counts.outOfSubset += rejected - oob;
+}
+
+// The bounds within which points may be inserted by this build.
+inline Bounds getActiveBounds(const Metadata& metadata)
+{
+    return metadata.subset
+        ? intersection(
+            getBounds(metadata.bounds, *metadata.subset),
+            metadata.boundsConforming
+        )
+        : metadata.boundsConforming;
+}
+
+// The farthest that scale-offset clipping may move a point along any axis.
+inline double getClipMargin(const Metadata& metadata)
+{
+    const auto so = getScaleOffset(metadata.schema);
+    if (!so) return 0;
+    return std::max({ so->scale.x, so->scale.y, so->scale.z });
+}
+
+// The extents of a batch of points.
+class Extents
+{
+public:
+    void grow(const Point& p)
+    {
+        m_min = Point::min(m_min, p);
+        m_max = Point::max(m_max, p);
+
+        // Non-finite coordinates are ignored by our extents, but not by this
+        // sum.
+        m_sum += p.x + p.y + p.z;
+    }
+
+    enum class Overlap { None, Partial, Full };
+
+    // Compare these extents with these bounds, grown for None and shrunk for
+    // Full by this margin.
+    Overlap overlap(const Bounds& b, const double margin) const
+    {
+        if (!std::isfinite(m_sum)) return Overlap::Partial;
+
+        const bool z = b.is3d();
+        const Point lo(b.min() - margin);
+        const Point hi(b.max() + margin);
+        if (
+            m_max.x < lo.x || m_min.x >= hi.x ||
+            m_max.y < lo.y || m_min.y >= hi.y ||
+            (z && (m_max.z < lo.z || m_min.z >= hi.z)))
+        {
+            return Overlap::None;
+        }
+
+        if (
+            z &&
+            m_min >= b.min() + margin &&
+            m_max < b.max() - margin)
+        {
+            return Overlap::Full;
+        }
+        return Overlap::Partial;
+    }
+
+private:
+    Point m_min = Point(
+        std::numeric_limits<double>::max(),
+        std::numeric_limits<double>::max(),
+        std::numeric_limits<double>::max());
+    Point m_max = Point(
+        std::numeric_limits<double>::lowest(),
+        std::numeric_limits<double>::lowest(),
+        std::numeric_limits<double>::lowest());
+    double m_sum = 0;
+};
+
+// Performs bounds filtering and tree insertion on behalf of a single thread,
+// which owns the Clipper for its chunk references.
+class Inserter
+{
+public:
+    Inserter(
+        const Metadata& metadata,
+        ChunkCache& cache,
+        const pdal::PointLayout& layout)
+        : m_metadata(metadata)
+        , m_cache(cache)
+        , m_clipper(cache)
+        , m_key(metadata.bounds, getStartDepth(metadata))
+        , m_ck(metadata.bounds, getStartDepth(metadata))
+        , m_so(getScaleOffset(metadata.schema))
+        , m_boundsSubset(metadata.subset
+            ? getBounds(metadata.bounds, *metadata.subset)
+            : optional<Bounds>())
+        , m_balanced(metadata.subset && isBalanced(*metadata.subset))
+        , m_cube(metadata.bounds)
+        , m_active(getActiveBounds(metadata))
+        , m_margin(getClipMargin(metadata))
+        , m_pointSize(layout.pointSize())
+        , m_xOffset(layout.dimOffset(DimId::X))
+        , m_yOffset(layout.dimOffset(DimId::Y))
+        , m_zOffset(layout.dimOffset(DimId::Z))
+        , m_resident(metadata)
+        , m_converted(m_resident.pointSize(), 4096)
+        , m_writer(cache.presort()
+            ? makeUnique<Presort::Writer>(*cache.presort())
+            : nullptr)
+    { }
+
+    // Every so often, release the chunks we haven't touched recently so they
+    // may be serialized.
+    void maybeClip(const uint64_t np)
+    {
+        m_sinceClip += np;
+
+        // If we're over our memory budget, clip more aggressively so that
+        // untouched chunks may be serialized sooner.
+        if (
+            m_sinceClip > m_metadata.internal.sleepCount ||
+            (m_cache.overBudget() && m_sinceClip > heuristics::minSleepCount))
+        {
+            m_sinceClip = 0;
+            m_clipper.clip();
+        }
+    }
+
+    // Compare the extents of a batch with our bounds.  The points of a batch
+    // wholly within them may be added without their per-point bounds checks,
+    // and a batch wholly outside of them need not be visited at all.  Our
+    // margin accounts for points moved by scale-offset clipping.
+    Extents::Overlap overlap(const Extents& extents) const
+    {
+        return extents.overlap(m_active, m_margin);
+    }
+
+    // Queue a point for insertion if it falls within our bounds.  Queued
+    // points are inserted together by flush().  If contained, the point is
+    // already known to lie within our bounds, except perhaps for those of a
+    // balanced subset.
+    bool add(Voxel& voxel, const bool contained = false)
+    {
+        if (m_so) voxel.clip(*m_so);
+        return addClipped(voxel, contained);
+    }
+
+    // Clip a batch of coordinates to our scale and offset, if we have one, so
+    // that they may be added by addClipped().
+    void clip(std::vector<Point>& points) const
+    {
+        if (m_so) entwine::clip(points.data(), points.size(), *m_so);
+    }
+
+    // As add(), for a point whose coordinates have already been clipped.
+    bool addClipped(Voxel& voxel, const bool contained = false)
+    {
+        const Point& point(voxel.point());
+
+        if (!contained)
+        {
+            if (!m_metadata.boundsConforming.contains(point)) return false;
+            if (m_boundsSubset && !m_boundsSubset->contains(point))
+            {
+                return false;
+            }
+        }
+        if (m_balanced && !contains(*m_metadata.subset, m_cube, point))
+        {
+            return false;
+        }
+
+        if (m_resident.compact())
+        {
+            char* pos(m_converted.next());
+            m_resident.fromAbsolute(voxel.data(), pos);
+            voxel.setData(pos);
+        }
+
+        m_key.init(point);
+        m_pending.emplace_back(voxel, m_key);
+        return true;
+    }
+
+    void flush()
+    {
+        if (m_pending.empty()) return;
+        if (m_writer) m_writer->write(m_pending);
+        else m_cache.insert(m_pending, m_ck, m_clipper);
+        m_pending.clear();
+        m_converted.clear();
+    }
+
+    // Flush our remaining points, including any buffered for our buckets.
+    void finish()
+    {
+        flush();
+        if (m_writer) m_writer->flush();
+    }
+
+    // Insert a batch of packed points from our absolute layout, returning the
+    // number of points actually inserted.
+    uint64_t insert(PointBatch& batch)
+    {
+        return insert(batch.data.data(), batch.size);
+    }
+
+    // Insert this many packed points, which are referenced rather than copied
+    // unless our resident layout is compact.
+    uint64_t insert(char* const data, const uint64_t size)
+    {
+        maybeClip(size);
+
+        // Coordinates are gathered and clipped once for the whole batch.
+        m_points.resize(size);
+        char* pos(data);
+        for (uint64_t i(0); i < size; ++i, pos += m_pointSize)
+        {
+            Point& point(m_points[i]);
+            std::memcpy(&point.x, pos + m_xOffset, sizeof(double));
+            std::memcpy(&point.y, pos + m_yOffset, sizeof(double));
+            std::memcpy(&point.z, pos + m_zOffset, sizeof(double));
+        }
+        clip(m_points);
+
+        Extents extents;
+        for (const Point& point : m_points) extents.grow(point);
+
+        const Extents::Overlap o(overlap(extents));
+        if (o == Extents::Overlap::None) return 0;
+        const bool contained(o == Extents::Overlap::Full);
+
+        Voxel voxel;
+        uint64_t inserts(0);
+        pos = data;
+        for (uint64_t i(0); i < size; ++i, pos += m_pointSize)
+        {
+            voxel.initShallow(m_points[i], pos);
+            if (addClipped(voxel, contained)) ++inserts;
+        }
+
+        flush();
+        return inserts;
+    }
+
+    // Count the points of a batch outside of our conforming bounds.
+    uint64_t outOfBounds(const PointBatch& batch) const
+    {
+        return outOfBounds(batch.data.data(), batch.size);
+    }
+
+    uint64_t outOfBounds(const char* const data, const uint64_t size) const
+    {
+        uint64_t n(0);
+        Point point;
+        const char* pos(data);
+        for (uint64_t i(0); i < size; ++i, pos += m_pointSize)
+        {
+            std::memcpy(&point.x, pos + m_xOffset, sizeof(double));
+            std::memcpy(&point.y, pos + m_yOffset, sizeof(double));
+            std::memcpy(&point.z, pos + m_zOffset, sizeof(double));
+            if (!m_metadata.boundsConforming.contains(point)) ++n;
+        }
+        return n;
+    }
+
+private:
+    const Metadata& m_metadata;
+    ChunkCache& m_cache;
+    Clipper m_clipper;
+
+    Key m_key;
+    const ChunkKey m_ck;
+    const optional<ScaleOffset> m_so;
+    const optional<Bounds> m_boundsSubset;
+    const bool m_balanced;
+    const Bounds m_cube;
+    const Bounds m_active;
+    const double m_margin;
+
+    const uint64_t m_pointSize;
+    const uint64_t m_xOffset;
+    const uint64_t m_yOffset;
+    const uint64_t m_zOffset;
+
+    const Resident m_resident;
+    MemBlock m_converted;
+
+    uint64_t m_sinceClip = 0;
+    Insertions m_pending;
+    std::vector<Point> m_points;
+
+    std::unique_ptr<Presort::Writer> m_writer;
+};
+
+} // namespace entwine
+
@@ -0,0 +1,233 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/lease.hpp>
+
+#include <chrono>
+#include <random>
+#include <sstream>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/util/io.hpp>
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::string makeOwner()
+{
+    std::random_device rd;
+    std::ostringstream ss;
+    ss << std::hex << rd() << rd();
+    return ss.str();
+}
+
+} // unnamed namespace
+
+constexpr uint64_t Leases::mergeId;
+
+Leases::Leases(
+    const arbiter::Endpoint& ep,
+    const uint64_t of,
+    const uint64_t seconds)
+    : m_ep(ep)
+    , m_of(of)
+    , m_seconds(seconds)
+    , m_owner(makeOwner())
+{ }
+
+std::string Leases::filename(const uint64_t id) const
+{
+    return "ept-lease-" + (id == mergeId ? "merge" : std::to_string(id)) +
+        ".json";
+}
+
+Leases::Lease Leases::read(const uint64_t id) const
+{
+    Lease lease;
+    if (const auto data = m_ep.tryGet(filename(id)))
+    {
+        const json j = json::parse(*data);
+        lease.owner = j.value("owner", "");
+        lease.expires = j.value("expires", 0);
+        lease.attempts = j.value("attempts", 0);
+        lease.done = j.value("done", false);
+    }
+    return lease;
+}
+
+void Leases::write(const uint64_t id, const Lease& lease) const
+{
+    const json j {
+        { "owner", lease.owner },
+        { "expires", lease.expires },
+        { "attempts", lease.attempts },
+        { "done", lease.done }
+    };
+    ensurePut(m_ep, filename(id), j.dump(2));
+}
+
+bool Leases::held(const uint64_t id, const Lease& lease) const
+{
+    if (lease.owner.empty()) return false;
+
+    // Each renewal changes the expiry, which we use only to spot renewals
+    // since it was computed from the clock of its writer.
+    const std::string version(
+        lease.owner + "@" + std::to_string(lease.expires));
+    const auto current(std::chrono::steady_clock::now());
+
+    Seen& seen(m_seen[id]);
+    if (seen.version != version)
+    {
+        seen.version = version;
+        seen.since = current;
+    }
+    return current - seen.since < std::chrono::seconds(m_seconds);
+}
+
+bool Leases::tryClaim(const uint64_t id)
+{
+    const auto start(std::chrono::steady_clock::now());
+
+    Lease lease(read(id));
+    if (lease.done) return false;
+    if (held(id, lease)) return false;
+    if (lease.attempts >= heuristics::leaseAttempts) return false;
+
+    lease.owner = m_owner;
+    lease.expires = now() + m_seconds;
+    ++lease.attempts;
+    write(id, lease);
+
+    // A competitor whose write lands after our confirmation must have read
+    // the lease after our own write landed, and so have seen our claim,
+    // unless its read and write took more than half of the settling delay.
+    // Ours are held to the same bound, or our claim is released.
+    const std::chrono::milliseconds settle(heuristics::leaseSettleMs);
+    if (std::chrono::steady_clock::now() - start > settle / 2)
+    {
+        fail(id);
+        return false;
+    }
+
+    // Give any competing claimant time to overwrite us, then see who won.
+    std::this_thread::sleep_for(settle);
+    return read(id).owner == m_owner;
+}
+
+optional<uint64_t> Leases::claim()
+{
+    for (uint64_t id(1); id <= m_of; ++id)
+    {
+        if (tryClaim(id)) return id;
+    }
+    return { };
+}
+
+bool Leases::claimMerge()
+{
+    return finished() && tryClaim(mergeId);
+}
+
+void Leases::renew(const uint64_t id)
+{
+    Lease lease(read(id));
+    if (lease.owner != m_owner) return;
+    lease.expires = now() + m_seconds;
+    write(id, lease);
+}
+
+bool Leases::complete(const uint64_t id)
+{
+    Lease lease(read(id));
+    if (lease.owner != m_owner) return false;
+    lease.done = true;
+    write(id, lease);
+    return true;
+}
+
+void Leases::fail(const uint64_t id)
+{
+    // Release our claim so that it may be retried immediately.
+    Lease lease(read(id));
+    if (lease.owner != m_owner) return;
+    lease.owner.clear();
+    lease.expires = 0;
+    write(id, lease);
+}
+
+bool Leases::finished() const
+{
+    for (uint64_t id(1); id <= m_of; ++id)
+    {
+        if (!read(id).done) return false;
+    }
+    return true;
+}
+
+bool Leases::merged() const
+{
+    return read(mergeId).done;
+}
+
+bool Leases::exhausted() const
+{
+    for (uint64_t id(mergeId); id <= m_of; ++id)
+    {
+        const Lease lease(read(id));
+        if (
+            !lease.done &&
+            !held(id, lease) &&
+            lease.attempts >= heuristics::leaseAttempts)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Heartbeat::Heartbeat(Leases& leases, const uint64_t id, const uint64_t seconds)
+    : m_thread([this, &leases, id, seconds]()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_cv.wait_for(
+            lock,
+            std::chrono::seconds(seconds),
+            [this]() { return m_done; }))
+        {
+            lock.unlock();
+            try { leases.renew(id); }
+            catch (...) { }
+            lock.lock();
+        }
+    })
+{ }
+
+Heartbeat::~Heartbeat()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+} // namespace entwine
@@ -0,0 +1,126 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/optional.hpp>
+
+namespace entwine
+{
+
+// Coordinates many independent workers building the subsets of a single
+// output, via lease files stored alongside that output.  A worker claims a
+// subset by writing a lease naming itself, which it must renew by heartbeat
+// before the lease expires.  Subsets whose leases expire, or which fail, may
+// be claimed again by any worker up to a limited number of attempts.
+//
+// Storage backends generally lack atomic conditional writes, so claims are
+// confirmed by re-reading the lease after a short delay, and abandoned if our
+// own read and write took long enough for a competitor to overwrite us
+// unseen.  Duplicate claims are then possible only if storage stalls for
+// longer than this delay.  A duplicated subset is built by both workers at
+// once, writing the same files, and only the worker still holding the lease
+// may complete it - but a write of the other may still be in flight, so the
+// merge could read a file mid-replacement.
+//
+// Expiry times written by other machines are never compared against our own
+// clock.  Instead, a lease is held for as long as we have seen it renewed
+// within its duration, by our own steady clock, so clock skew between workers
+// cannot cause a live lease to be taken over.  As a result, a worker which has
+// just started waits out a full duration before taking over a lease.
+class Leases
+{
+public:
+    // The merge is leased like any subset, under this reserved ID.
+    static constexpr uint64_t mergeId = 0;
+
+    Leases(const arbiter::Endpoint& ep, uint64_t of, uint64_t seconds);
+
+    // Returns the ID of a newly claimed subset, if any are available.
+    optional<uint64_t> claim();
+
+    // Claim the final merge, which is available only once every subset is
+    // complete.  Returns true if we have claimed it.
+    bool claimMerge();
+
+    void renew(uint64_t id);
+
+    // Returns false, leaving the lease to its current owner, if it has been
+    // taken over since we claimed it.
+    bool complete(uint64_t id);
+    void fail(uint64_t id);
+
+    // True if every subset has been completed.
+    bool finished() const;
+
+    // True if the merge has been completed.
+    bool merged() const;
+
+    // True if any subset, or the merge, has failed too many times to be
+    // claimed again.
+    bool exhausted() const;
+
+    const std::string& owner() const { return m_owner; }
+
+private:
+    struct Lease
+    {
+        std::string owner;
+        uint64_t expires = 0;
+        uint64_t attempts = 0;
+        bool done = false;
+    };
+
+    // The lease of each ID as we last saw it, and when we first saw it so.
+    struct Seen
+    {
+        std::string version;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    std::string filename(uint64_t id) const;
+    Lease read(uint64_t id) const;
+    void write(uint64_t id, const Lease& lease) const;
+    bool held(uint64_t id, const Lease& lease) const;
+    bool tryClaim(uint64_t id);
+
+    const arbiter::Endpoint m_ep;
+    const uint64_t m_of;
+    const uint64_t m_seconds;
+    const std::string m_owner;
+
+    // Only the claiming thread observes leases - heartbeats merely renew.
+    mutable std::map<uint64_t, Seen> m_seen;
+};
+
+// Renews a lease periodically for the lifetime of this object.
+class Heartbeat
+{
+public:
+    Heartbeat(Leases& leases, uint64_t id, uint64_t seconds);
+    ~Heartbeat();
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_done = false;
+    std::thread m_thread;
+};
+
+} // namespace entwine
@@ -0,0 +1,73 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/node-sizes.hpp>
+
+#include <stdexcept>
+#include <vector>
+
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/util/io.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+void NodeSizes::add(const std::string& path, const uint64_t bytes)
+{
+    const Dxyz key(path.substr(0, path.find('.')));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_nodes[key] = bytes;
+}
+
+void NodeSizes::save(
+    const arbiter::Endpoint& ep,
+    const unsigned step,
+    const unsigned threads)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::map<Dxyz, std::vector<const std::pair<const Dxyz, uint64_t>*>> files;
+    for (const auto& p : m_nodes)
+    {
+        files[hierarchy::getRoot(p.first, step)].push_back(&p);
+    }
+
+    Pool pool(threads);
+    for (const auto& file : files)
+    {
+        pool.add([&ep, &file]()
+        {
+            const std::string filename(file.first.toString() + ".json");
+
+            json j = json::object();
+            if (const auto existing = ep.tryGet(filename))
+            {
+                j = json::parse(*existing);
+            }
+
+            for (const auto* p : file.second)
+            {
+                j[p->first.toString()] = p->second;
+            }
+
+            ensurePut(ep, filename, j.dump());
+        });
+    }
+    pool.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+
+    m_nodes.clear();
+}
+
+} // namespace entwine
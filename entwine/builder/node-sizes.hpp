@@ -0,0 +1,47 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/key.hpp>
+
+namespace entwine
+{
+
+// The encoded size in bytes of each node, recorded as nodes are written, so
+// that readers may plan and prioritize their fetches without a request per
+// node to find its size.  They are saved in a file per hierarchy file, in
+// ept-node-sizes, which mirrors the hierarchy format:
+//
+//  { "<key>": <bytes>, ... }
+class NodeSizes
+{
+public:
+    // Record the size of the node written to this path within our data
+    // endpoint, which is named for its key.  A rewritten node replaces its
+    // previous size.
+    void add(const std::string& path, uint64_t bytes);
+
+    // Merge the sizes recorded so far into the files for this hierarchy step,
+    // which are updated rather than replaced if they exist.
+    void save(const arbiter::Endpoint& ep, unsigned step, unsigned threads);
+
+private:
+    std::mutex m_mutex;
+    std::map<Dxyz, uint64_t> m_nodes;
+};
+
+} // namespace entwine
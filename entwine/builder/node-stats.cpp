@@ -0,0 +1,206 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/node-stats.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/util/io.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+// Each pass reads a single dimension of every point, so per-value type
+// dispatch is hoisted out of the loops.
+template <typename T>
+void extend(
+    const BlockPointTable& table,
+    const std::size_t offset,
+    double& minimum,
+    double& maximum)
+{
+    T v;
+    table.forEach([&](const char* point)
+    {
+        std::memcpy(&v, point + offset, sizeof(T));
+        const double d(v);
+        minimum = std::min(minimum, d);
+        maximum = std::max(maximum, d);
+    });
+}
+
+template <typename T>
+void count(
+    const BlockPointTable& table,
+    const std::size_t offset,
+    std::map<uint64_t, uint64_t>& counts)
+{
+    T v;
+    table.forEach([&](const char* point)
+    {
+        std::memcpy(&v, point + offset, sizeof(T));
+        ++counts[static_cast<uint64_t>(v)];
+    });
+}
+
+void extend(
+    const BlockPointTable& table,
+    const DimType type,
+    const std::size_t o,
+    double& lo,
+    double& hi)
+{
+    switch (type)
+    {
+        case DimType::Signed8:     extend<int8_t>(table, o, lo, hi); break;
+        case DimType::Signed16:    extend<int16_t>(table, o, lo, hi); break;
+        case DimType::Signed32:    extend<int32_t>(table, o, lo, hi); break;
+        case DimType::Signed64:    extend<int64_t>(table, o, lo, hi); break;
+        case DimType::Unsigned8:   extend<uint8_t>(table, o, lo, hi); break;
+        case DimType::Unsigned16:  extend<uint16_t>(table, o, lo, hi); break;
+        case DimType::Unsigned32:  extend<uint32_t>(table, o, lo, hi); break;
+        case DimType::Unsigned64:  extend<uint64_t>(table, o, lo, hi); break;
+        case DimType::Float:       extend<float>(table, o, lo, hi); break;
+        case DimType::Double:      extend<double>(table, o, lo, hi); break;
+        default: throw std::runtime_error("Invalid dimension type");
+    }
+}
+
+void count(
+    const BlockPointTable& table,
+    const DimType type,
+    const std::size_t offset,
+    std::map<uint64_t, uint64_t>& counts)
+{
+    switch (type)
+    {
+        case DimType::Signed8:    count<int8_t>(table, offset, counts);   break;
+        case DimType::Signed16:   count<int16_t>(table, offset, counts);  break;
+        case DimType::Signed32:   count<int32_t>(table, offset, counts);  break;
+        case DimType::Signed64:   count<int64_t>(table, offset, counts);  break;
+        case DimType::Unsigned8:  count<uint8_t>(table, offset, counts);  break;
+        case DimType::Unsigned16: count<uint16_t>(table, offset, counts); break;
+        case DimType::Unsigned32: count<uint32_t>(table, offset, counts); break;
+        case DimType::Unsigned64: count<uint64_t>(table, offset, counts); break;
+        case DimType::Float:      count<float>(table, offset, counts);    break;
+        case DimType::Double:     count<double>(table, offset, counts);   break;
+        default: throw std::runtime_error("Invalid dimension type");
+    }
+}
+
+} // unnamed namespace
+
+NodeStats::NodeStats(const Schema& absoluteSchema) : m_schema(absoluteSchema)
+{ }
+
+void NodeStats::add(const Dxyz& key, BlockPointTable& table)
+{
+    const pdal::PointLayout& layout(*table.layout());
+
+    Node node;
+    node.minimum.assign(m_schema.size(), std::numeric_limits<double>::max());
+    node.maximum.assign(m_schema.size(), std::numeric_limits<double>::lowest());
+
+    for (std::size_t d(0); d < m_schema.size(); ++d)
+    {
+        const DimId id(layout.findDim(m_schema[d].name));
+        extend(
+            table,
+            layout.dimType(id),
+            layout.dimOffset(id),
+            node.minimum[d],
+            node.maximum[d]);
+    }
+
+    const DimId classification(layout.findDim("Classification"));
+    if (classification != DimId::Unknown)
+    {
+        count(
+            table,
+            layout.dimType(classification),
+            layout.dimOffset(classification),
+            node.classification);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_nodes[key] = std::move(node);
+}
+
+void NodeStats::save(
+    const arbiter::Endpoint& ep,
+    const unsigned step,
+    const unsigned threads)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::map<Dxyz, std::vector<const std::pair<const Dxyz, Node>*>> files;
+    for (const auto& p : m_nodes)
+    {
+        files[hierarchy::getRoot(p.first, step)].push_back(&p);
+    }
+
+    json dimensions = json::array();
+    for (const Dimension& d : m_schema) dimensions.push_back(d.name);
+
+    Pool pool(threads);
+    for (const auto& file : files)
+    {
+        pool.add([&ep, &dimensions, &file]()
+        {
+            const std::string filename(file.first.toString() + ".json");
+
+            json j = {
+                { "dimensions", dimensions },
+                { "nodes", json::object() }
+            };
+            if (const auto existing = ep.tryGet(filename))
+            {
+                j["nodes"] = json::parse(*existing).at("nodes");
+            }
+
+            json& nodes(j.at("nodes"));
+            for (const auto* p : file.second)
+            {
+                const Node& node(p->second);
+                json entry = {
+                    { "minimum", node.minimum },
+                    { "maximum", node.maximum }
+                };
+                if (node.classification.size())
+                {
+                    json& counts(entry["classification"] = json::object());
+                    for (const auto& c : node.classification)
+                    {
+                        counts[std::to_string(c.first)] = c.second;
+                    }
+                }
+                nodes[p->first.toString()] = entry;
+            }
+
+            ensurePut(ep, filename, j.dump());
+        });
+    }
+    pool.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+
+    m_nodes.clear();
+}
+
+} // namespace entwine
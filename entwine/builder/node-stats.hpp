@@ -0,0 +1,68 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/dimension.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/types/vector-point-table.hpp>
+
+namespace entwine
+{
+
+// Summaries of the points of each node, gathered as nodes are saved, so that
+// nodes may be pruned by their attributes without being fetched.  They are
+// saved in a file per hierarchy file, in ept-node-stats, as:
+//
+//  {
+//      "dimensions": ["X", "Y", "Z", ...],
+//      "nodes": {
+//          "<key>": {
+//              "minimum": [...], "maximum": [...],
+//              "classification": { "<value>": <count>, ... }
+//          }
+//      }
+//  }
+//
+// where the minimum and maximum of each node follow the order of dimensions.
+class NodeStats
+{
+public:
+    explicit NodeStats(const Schema& absoluteSchema);
+
+    // Summarize this node, whose points are in our absolute layout.
+    void add(const Dxyz& key, BlockPointTable& table);
+
+    // Merge the nodes summarized so far into the files for this hierarchy
+    // step, which are updated rather than replaced if they exist.
+    void save(const arbiter::Endpoint& ep, unsigned step, unsigned threads);
+
+private:
+    struct Node
+    {
+        std::vector<double> minimum;
+        std::vector<double> maximum;
+        std::map<uint64_t, uint64_t> classification;
+    };
+
+    const Schema m_schema;
+
+    std::mutex m_mutex;
+    std::map<Dxyz, Node> m_nodes;
+};
+
+} // namespace entwine
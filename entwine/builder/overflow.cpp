@@ -0,0 +1,149 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/overflow.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+const uint64_t coordBytes(3 * sizeof(double));
+
+// Read records from this spill file, in batches of at most this many, calling
+// f with the data of each batch and its record count.
+void forEachBatch(
+    const std::string& path,
+    const uint64_t recordSize,
+    const uint64_t total,
+    const uint64_t batchPoints,
+    const std::function<void(const char*, uint64_t)>& f)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("Failed to open spill: " + path);
+
+    std::vector<char> buffer(std::min(total, batchPoints) * recordSize);
+    uint64_t remaining(total);
+    while (remaining)
+    {
+        const uint64_t n(std::min(remaining, batchPoints));
+        file.read(buffer.data(), n * recordSize);
+        if (!file) throw std::runtime_error("Short read of spill: " + path);
+        f(buffer.data(), n);
+        remaining -= n;
+    }
+}
+
+Point readPoint(const char* pos)
+{
+    double xyz[3];
+    std::memcpy(xyz, pos, coordBytes);
+    return Point(xyz[0], xyz[1], xyz[2]);
+}
+
+} // unnamed namespace
+
+Overflow::~Overflow()
+{
+    if (!spillPath.empty()) arbiter::remove(spillPath);
+}
+
+uint64_t Overflow::spill(const std::string& path)
+{
+    if (spillPath.empty()) spillPath = path;
+
+    std::ofstream file(
+        spillPath,
+        std::ios::binary | std::ios::out | std::ios::app);
+    if (!file) throw std::runtime_error("Failed to open spill: " + spillPath);
+
+    auto point(points.begin());
+    for (const PointSpan& span : block.spans())
+    {
+        const char* pos(span.data);
+        for (uint64_t i(0); i < span.size; ++i, ++point, pos += pointSize)
+        {
+            const double xyz[3] = { point->x, point->y, point->z };
+            file.write(pos, pointSize);
+            file.write(reinterpret_cast<const char*>(xyz), coordBytes);
+        }
+    }
+    file.close();
+    if (!file) throw std::runtime_error("Failed to write spill: " + spillPath);
+
+    const uint64_t released(block.bytes());
+    spilled += points.size();
+    block.clear();
+    std::vector<Point>().swap(points);
+    return released;
+}
+
+void Overflow::forEachSpilled(
+    const uint64_t batchPoints,
+    const std::function<void(Insertions&)>& f) const
+{
+    if (!spilled) return;
+
+    const uint64_t recordSize(pointSize + coordBytes);
+    Insertions list;
+    list.reserve(std::min(spilled, batchPoints));
+
+    forEachBatch(
+        spillPath,
+        recordSize,
+        spilled,
+        batchPoints,
+        [&](const char* data, const uint64_t n)
+        {
+            // Our buffer is reused by the next batch, so the voxels may
+            // reference it in place.
+            char* pos(const_cast<char*>(data));
+            Key key(chunkKey.key());
+
+            list.clear();
+            for (uint64_t i(0); i < n; ++i, pos += recordSize)
+            {
+                const Point point(readPoint(pos + pointSize));
+                key.init(point, chunkKey);
+                list.emplace_back(key);
+                list.back().voxel.initShallow(point, pos);
+            }
+            f(list);
+        });
+}
+
+void Overflow::readSpilled(MemBlock& dst) const
+{
+    if (!spilled) return;
+
+    const uint64_t recordSize(pointSize + coordBytes);
+    forEachBatch(
+        spillPath,
+        recordSize,
+        spilled,
+        heuristics::spillBatchPoints,
+        [&](const char* pos, const uint64_t n)
+        {
+            for (uint64_t i(0); i < n; ++i, pos += recordSize)
+            {
+                std::copy(pos, pos + pointSize, dst.next());
+            }
+        });
+}
+
+} // namespace entwine
@@ -10,6 +10,12 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
 #include <entwine/types/key.hpp>
 #include <entwine/types/vector-point-table.hpp>
 #include <entwine/types/voxel.hpp>
@@ -17,34 +23,95 @@
 namespace entwine
 {
 
-struct Overflow
+// A point along with its key at the depth to which it is being inserted.
+struct Insertion
 {
-    struct Entry
-    {
-        Entry(const Key& key) : key(key) { }
-        Voxel voxel;
-        Key key;
-    };
+    Insertion(const Key& key) : key(key) { }
+    Insertion(const Voxel& voxel, const Key& key) : voxel(voxel), key(key) { }
+
+    Voxel voxel;
+    Key key;
+};
 
+using Insertions = std::vector<Insertion>;
+
+// Points held by a chunk on behalf of one of its children.  Entries are stored
+// as parallel arrays: the point data in our block, in insertion order, and the
+// coordinates of each point.  Keys are not stored, since they are cheaply
+// recomputed from the coordinates when the entries are finally inserted.
+//
+// While memory is scarce, our entries may be spilled to a local file, to which
+// they are appended as records of their point data followed by their
+// coordinates.  Spilled entries precede those in memory.
+struct Overflow
+{
     Overflow(const ChunkKey& chunkKey, uint64_t pointSize)
         : chunkKey(chunkKey)
         , pointSize(pointSize)
-        , block(pointSize, 256)
+        , block(pointSize, 256, metrics::Memory::Overflows)
     { }
+    ~Overflow();
+
+    // Returns the number of bytes newly allocated for this insertion.
+    uint64_t insert(const Voxel& voxel)
+    {
+        const uint64_t before = block.bytes();
 
-    void insert(Voxel& voxel, Key& key)
+        char* pos(block.next());
+        std::copy(voxel.data(), voxel.data() + pointSize, pos);
+        points.push_back(voxel.point());
+
+        return block.bytes() - before;
+    }
+
+    uint64_t size() const { return spilled + points.size(); }
+
+    // Append our entries in memory to our spill file, which is created at
+    // this path if we have not yet spilled, and release them.  Returns the
+    // number of bytes released.
+    uint64_t spill(const std::string& path);
+
+    // Read back our spilled entries, in batches of at most this many points,
+    // as insertions keyed at the depth of our chunk key.  The voxels of each
+    // batch reference memory which is valid only during the call to f.
+    void forEachSpilled(
+        uint64_t batchPoints,
+        const std::function<void(Insertions&)>& f) const;
+
+    // Append the point data of our spilled entries to this block.
+    void readSpilled(MemBlock& dst) const;
+
+    // Expand our entries into insertions keyed at the depth of our chunk key.
+    // The voxels are shallow, so they reference our block.
+    Insertions insertions() const
     {
-        Entry entry(key);
-        entry.voxel.setData(block.next());
-        entry.voxel.initDeep(voxel.point(), voxel.data(), pointSize);
-        list.push_back(entry);
+        Insertions list;
+        list.reserve(points.size());
+
+        Key key(chunkKey.key());
+        auto point(points.begin());
+        for (const PointSpan& span : block.spans())
+        {
+            char* pos(span.data);
+            for (uint64_t i(0); i < span.size; ++i, ++point, pos += pointSize)
+            {
+                key.init(*point, chunkKey);
+                list.emplace_back(key);
+                list.back().voxel.initShallow(*point, pos);
+            }
+        }
+
+        return list;
     }
 
     const ChunkKey chunkKey;
     const uint64_t pointSize = 0;
 
     MemBlock block;
-    std::vector<Entry> list;
+    std::vector<Point> points;
+
+    std::string spillPath;
+    uint64_t spilled = 0;
 };
 
 } // namespace entwine
@@ -0,0 +1,149 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/prefetcher.hpp>
+
+#include <stdexcept>
+
+#include <entwine/util/io.hpp>
+
+namespace entwine
+{
+
+Prefetcher::Prefetcher(
+    const arbiter::Arbiter& a,
+    const std::vector<Planned>& plan,
+    const uint64_t window)
+    : m_arbiter(a)
+    , m_window(window)
+{
+    m_entries.reserve(plan.size());
+    for (const Planned& p : plan)
+    {
+        m_index[p.origin] = m_entries.size();
+        m_entries.emplace_back(p);
+    }
+
+    if (m_window) m_thread = std::thread([this]() { run(); });
+}
+
+Prefetcher::~Prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable()) m_thread.join();
+}
+
+Prefetcher::Handle Prefetcher::acquire(const Origin origin)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Entry& entry(m_entries.at(m_index.at(origin)));
+
+    if (entry.state == State::Pending)
+    {
+        // Not yet prefetched, so fetch it ourselves.
+        entry.state = State::Fetching;
+        lock.unlock();
+        fetch(entry);
+        lock.lock();
+    }
+    else
+    {
+        m_cv.wait(lock, [&entry]() { return entry.state == State::Ready; });
+    }
+
+    if (!entry.uses) throw std::runtime_error("Too many acquisitions");
+
+    Handle handle(entry.handle);
+    const std::string error(entry.error);
+
+    // Once every user has acquired this file, release our own reference so
+    // the local copy is removed as soon as the last user is done with it.
+    if (!--entry.uses)
+    {
+        entry.handle.reset();
+        if (entry.prefetched)
+        {
+            --m_held;
+            lock.unlock();
+            m_cv.notify_all();
+        }
+    }
+
+    if (!handle) throw std::runtime_error(error);
+    return handle;
+}
+
+void Prefetcher::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true)
+    {
+        m_cv.wait(lock, [this]()
+        {
+            return m_done || m_next >= m_entries.size() || m_held < m_window;
+        });
+
+        if (m_done || m_next >= m_entries.size()) return;
+
+        Entry& entry(m_entries[m_next++]);
+
+        // Local files, and those already claimed by a work thread, need no
+        // prefetching.
+        if (entry.state != State::Pending) continue;
+        if (!m_arbiter.isRemote(entry.path)) continue;
+
+        entry.state = State::Fetching;
+        entry.prefetched = true;
+        ++m_held;
+
+        lock.unlock();
+        fetch(entry);
+        lock.lock();
+    }
+}
+
+void Prefetcher::fetch(Entry& entry)
+{
+    Handle handle;
+    std::string error;
+
+    try
+    {
+        // Take ownership of the local copy from the temporary handle, so it
+        // is removed only when our shared handle is destroyed.
+        auto local(ensureGetLocalHandle(m_arbiter, entry.path));
+        const bool remote(m_arbiter.isRemote(entry.path));
+        handle =
+            std::make_shared<arbiter::LocalHandle>(local.release(), remote);
+    }
+    catch (const std::exception& e)
+    {
+        error = e.what();
+    }
+    catch (...)
+    {
+        error = "Failed to fetch " + entry.path;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        entry.handle = handle;
+        entry.error = error;
+        entry.state = State::Ready;
+    }
+    m_cv.notify_all();
+}
+
+} // namespace entwine
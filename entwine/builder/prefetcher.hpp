@@ -0,0 +1,95 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/defs.hpp>
+
+namespace entwine
+{
+
+// Fetches local copies of input files, downloading up to a window of remote
+// files in the background ahead of the work threads which will insert them.
+// Each file is downloaded only once, even if it is inserted in multiple
+// ranges, and its local copy is removed once every user has released it.
+class Prefetcher
+{
+public:
+    using Handle = std::shared_ptr<arbiter::LocalHandle>;
+
+    struct Planned
+    {
+        Planned(Origin origin, std::string path, uint64_t uses)
+            : origin(origin)
+            , path(path)
+            , uses(uses)
+        { }
+
+        Origin origin;
+        std::string path;
+        uint64_t uses;
+    };
+
+    // Files are prefetched in the order of the plan.  A window of zero
+    // disables prefetching, so files are fetched when they are acquired.
+    Prefetcher(
+        const arbiter::Arbiter& a,
+        const std::vector<Planned>& plan,
+        uint64_t window);
+
+    ~Prefetcher();
+
+    // Get the local copy of this file, blocking until it is available.  This
+    // must be called once for each planned use of this file.
+    Handle acquire(Origin origin);
+
+private:
+    enum class State { Pending, Fetching, Ready };
+
+    struct Entry
+    {
+        Entry(const Planned& p) : path(p.path), uses(p.uses) { }
+
+        std::string path;
+        uint64_t uses;
+        State state = State::Pending;
+        bool prefetched = false;
+        Handle handle;
+        std::string error;
+    };
+
+    void run();
+    void fetch(Entry& entry);
+
+    const arbiter::Arbiter& m_arbiter;
+    const uint64_t m_window;
+
+    std::vector<Entry> m_entries;
+    std::map<Origin, std::size_t> m_index;
+    std::size_t m_next = 0;
+    uint64_t m_held = 0;
+    bool m_done = false;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+};
+
+} // namespace entwine
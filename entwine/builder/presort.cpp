@@ -0,0 +1,191 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/presort.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+const uint64_t coordBytes(3 * sizeof(double));
+
+} // unnamed namespace
+
+Presort::Presort(
+        const Metadata& metadata,
+        std::string dir,
+        const uint64_t pointSize)
+    : m_metadata(metadata)
+    , m_dir(dir)
+    , m_pointSize(pointSize)
+    , m_recordSize(pointSize + coordBytes)
+{
+    if (!arbiter::mkdirp(m_dir))
+    {
+        throw std::runtime_error("Failed to create directory: " + m_dir);
+    }
+}
+
+Presort::Writer::Writer(Presort& presort)
+    : m_presort(presort)
+    , m_ck(presort.m_metadata.bounds, getStartDepth(presort.m_metadata))
+{ }
+
+void Presort::Writer::append(std::vector<char>& buffer, const Voxel& voxel)
+{
+    const Point& p(voxel.point());
+    const double xyz[3] = { p.x, p.y, p.z };
+    const char* coords(reinterpret_cast<const char*>(xyz));
+    const char* data(voxel.data());
+    buffer.insert(buffer.end(), data, data + m_presort.m_pointSize);
+    buffer.insert(buffer.end(), coords, coords + coordBytes);
+}
+
+void Presort::Writer::write(const Voxel& voxel)
+{
+    m_ck.init(voxel.point(), m_presort.m_metadata.internal.presortDepth);
+    append(m_buffers[m_ck.dxyz()], voxel);
+
+    m_bytes += m_presort.m_recordSize;
+    if (m_bytes >= heuristics::presortBufferBytes) flush();
+}
+
+void Presort::Writer::write(const Insertions& list)
+{
+    const Metadata& m(m_presort.m_metadata);
+    const uint64_t depth(m.internal.presortDepth);
+    if (getStartDepth(m) + depth > bucket::maxLevels)
+    {
+        for (const Insertion& insertion : list) write(insertion.voxel);
+        return;
+    }
+
+    // Each bucket is looked up once per batch rather than once per point.
+    bucket::group(list, m, depth, m_groups);
+    for (std::size_t g(0); g < m_groups.keys.size(); ++g)
+    {
+        const uint64_t begin(m_groups.offsets[g]);
+        const uint64_t end(m_groups.offsets[g + 1]);
+
+        std::vector<char>& buffer(m_buffers[m_groups.keys[g]]);
+        for (uint64_t i(begin); i < end; ++i)
+        {
+            append(buffer, list[m_groups.order[i]].voxel);
+        }
+        m_bytes += (end - begin) * m_presort.m_recordSize;
+    }
+
+    if (m_bytes >= heuristics::presortBufferBytes) flush();
+}
+
+void Presort::Writer::flush()
+{
+    for (auto& p : m_buffers)
+    {
+        if (p.second.empty()) continue;
+        m_presort.append(p.first, p.second);
+        p.second.clear();
+    }
+    m_bytes = 0;
+}
+
+void Presort::append(const Dxyz& dxyz, const std::vector<char>& data)
+{
+    File* file(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::unique_ptr<File>& f(m_files[dxyz]);
+        if (!f)
+        {
+            f = makeUnique<File>();
+            f->path = arbiter::join(m_dir, dxyz.toString() + ".bin");
+        }
+        file = f.get();
+    }
+
+    std::lock_guard<std::mutex> lock(file->mutex);
+    std::ofstream stream(
+        file->path,
+        std::ios::binary | std::ios::out | std::ios::app);
+    stream.write(data.data(), data.size());
+    stream.close();
+    if (!stream) throw std::runtime_error("Failed to write " + file->path);
+
+    file->points += data.size() / m_recordSize;
+}
+
+std::vector<Presort::Bucket> Presort::buckets() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<Bucket> result;
+    for (const auto& p : m_files)
+    {
+        Bucket bucket;
+        bucket.dxyz = p.first;
+        bucket.path = p.second->path;
+        bucket.points = p.second->points;
+        result.push_back(bucket);
+    }
+    return result;
+}
+
+void Presort::forEach(
+    const Bucket& bucket,
+    const ChunkKey& ck,
+    const std::function<void(Insertions&)>& f) const
+{
+    std::ifstream file(bucket.path, std::ios::binary);
+    if (!file) throw std::runtime_error("Failed to open " + bucket.path);
+
+    const uint64_t batchPoints(heuristics::spillBatchPoints);
+    std::vector<char> buffer(
+        std::min(bucket.points, batchPoints) * m_recordSize);
+
+    Key key(m_metadata.bounds, getStartDepth(m_metadata));
+    Insertions list;
+
+    uint64_t remaining(bucket.points);
+    while (remaining)
+    {
+        const uint64_t n(std::min(remaining, batchPoints));
+        file.read(buffer.data(), n * m_recordSize);
+        if (!file) throw std::runtime_error("Short read of " + bucket.path);
+
+        list.clear();
+        char* pos(buffer.data());
+        for (uint64_t i(0); i < n; ++i, pos += m_recordSize)
+        {
+            double xyz[3];
+            std::memcpy(xyz, pos + m_pointSize, coordBytes);
+            const Point point(xyz[0], xyz[1], xyz[2]);
+
+            key.init(point, ck);
+            list.emplace_back(key);
+            list.back().voxel.initShallow(point, pos);
+        }
+
+        f(list);
+        remaining -= n;
+    }
+}
+
+} // namespace entwine
@@ -0,0 +1,102 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/builder/bucket.hpp>
+#include <entwine/builder/overflow.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/types/metadata.hpp>
+
+namespace entwine
+{
+
+// The scratch files of the first pass of a presorted build, into which points
+// are bucketed by the node containing them at a coarse depth.  Each bucket is
+// then inserted in its entirety before the next, so that the working set of
+// the second pass is only the subtree of a single bucket.
+//
+// Records are the resident data of a point followed by its coordinates, as
+// clipped for insertion.
+class Presort
+{
+public:
+    Presort(const Metadata& metadata, std::string dir, uint64_t pointSize);
+
+    // Buffers the records of a single thread, so that each bucket is appended
+    // in large writes.
+    class Writer
+    {
+    public:
+        explicit Writer(Presort& presort);
+
+        void write(const Voxel& voxel);
+        void write(const Insertions& list);
+        void flush();
+
+    private:
+        void append(std::vector<char>& buffer, const Voxel& voxel);
+
+        Presort& m_presort;
+        ChunkKey m_ck;
+        bucket::Groups m_groups;
+        std::map<Dxyz, std::vector<char>> m_buffers;
+        uint64_t m_bytes = 0;
+    };
+
+    struct Bucket
+    {
+        Dxyz dxyz;
+        std::string path;
+        uint64_t points = 0;
+    };
+
+    const std::string& dir() const { return m_dir; }
+    uint64_t pointSize() const { return m_pointSize; }
+
+    // The buckets written so far, in order of their keys.
+    std::vector<Bucket> buckets() const;
+
+    // Read back the records of this bucket in batches, as insertions keyed
+    // at the depth of this chunk key, which must contain them.  The voxels of
+    // each batch reference memory which is valid only during the call to f.
+    void forEach(
+        const Bucket& bucket,
+        const ChunkKey& ck,
+        const std::function<void(Insertions&)>& f) const;
+
+private:
+    struct File
+    {
+        std::mutex mutex;
+        std::string path;
+        uint64_t points = 0;
+    };
+
+    void append(const Dxyz& dxyz, const std::vector<char>& data);
+
+    const Metadata& m_metadata;
+    const std::string m_dir;
+    const uint64_t m_pointSize;
+    const uint64_t m_recordSize;
+
+    mutable std::mutex m_mutex;
+    std::map<Dxyz, std::unique_ptr<File>> m_files;
+};
+
+} // namespace entwine
@@ -0,0 +1,127 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/profile.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/util/metrics.hpp>
+
+namespace entwine
+{
+namespace profile
+{
+
+json observe(
+    const Metadata& m,
+    const Threads& threads,
+    const uint64_t points,
+    const double seconds)
+{
+    const json metrics(metrics::get());
+    const json& counts(metrics.at("counts"));
+    const json& times(metrics.at("times"));
+
+    return {
+        { "points", points },
+        { "seconds", seconds },
+        { "pointsPerSecond", seconds > 0 ? points / seconds : 0 },
+        { "peakRss", metrics::peakRss() },
+        { "memory", m.internal.memory },
+        { "threads", { { "work", threads.work }, { "clip", threads.clip } } },
+        { "cacheSize", m.internal.cacheSize },
+        { "sleepCount", m.internal.sleepCount },
+        { "chunkWrites", counts.at("chunkWrites") },
+        { "chunkRewakes", counts.at("chunkRewakes") },
+        { "chunkReclaims", counts.at("chunkReclaims") },
+        { "bytesRead", counts.at("bytesRead") },
+        { "bytesWritten", counts.at("bytesWritten") },
+        { "insertSeconds", times.at("insert") },
+        { "clipWaitSeconds", times.at("clipWait") }
+    };
+}
+
+json learn(const json& o)
+{
+    const double writes(std::max(o.at("chunkWrites").get<double>(), 1.0));
+    const double rewakes(o.at("chunkRewakes").get<double>() / writes);
+    const double reclaims(o.at("chunkReclaims").get<double>() / writes);
+
+    const uint64_t memory(o.at("memory"));
+    const bool memoryBound(
+        memory && o.at("peakRss").get<uint64_t>() >= memory);
+
+    // A chunk which is rewoken costs a write and a read, so a cache which
+    // rewakes many of its chunks is too small - unless memory ran out.
+    uint64_t cacheSize(o.at("cacheSize"));
+    if (memoryBound)
+    {
+        cacheSize = std::max(cacheSize / 2, heuristics::minLearnedCacheSize);
+    }
+    else if (rewakes > heuristics::learnedRewakeRatio)
+    {
+        cacheSize = std::min(cacheSize * 2, heuristics::maxLearnedCacheSize);
+    }
+
+    // Chunks which are reclaimed after their release were clipped too soon.
+    uint64_t sleepCount(o.at("sleepCount"));
+    if (reclaims > heuristics::learnedReclaimRatio && !memoryBound)
+    {
+        sleepCount = std::min(sleepCount * 2, heuristics::maxLearnedSleepCount);
+    }
+
+    // Inserting threads which wait on serialization want more clip threads,
+    // and those which never wait want fewer.
+    const double work(o.at("threads").at("work"));
+    const double clip(o.at("threads").at("clip"));
+    const double insert(
+        std::max(o.at("insertSeconds").get<double>(), 1e-9));
+    const double waiting(o.at("clipWaitSeconds").get<double>() / insert);
+
+    double ratio(work / (work + clip));
+    if (waiting > heuristics::learnedClipWaitHigh) ratio -= 0.05;
+    else if (waiting < heuristics::learnedClipWaitLow) ratio += 0.05;
+    ratio = std::min(std::max(ratio, 0.1), 0.9);
+
+    return {
+        { "cacheSize", cacheSize },
+        { "sleepCount", sleepCount },
+        { "workToClipRatio", std::round(ratio * 100) / 100 },
+        { "observed", o }
+    };
+}
+
+json apply(json& config, const json& entry)
+{
+    json applied = json::object();
+    for (const std::string key : { "cacheSize", "sleepCount", "hierarchyStep" })
+    {
+        if (!entry.count(key) || config.count(key)) continue;
+        config[key] = entry.at(key);
+        applied[key] = entry.at(key);
+    }
+
+    // Only a total thread count is split by our ratio.
+    const json threads(config.value("threads", json()));
+    if (entry.count("workToClipRatio") && !threads.is_array())
+    {
+        const uint64_t total(threads.is_number() ? threads.get<uint64_t>() : 8);
+        const double ratio(entry.at("workToClipRatio"));
+        const uint64_t work(std::llround(total * ratio));
+        config["threads"] = { work, total - std::min(work, total) };
+        applied["threads"] = config["threads"];
+    }
+    return applied;
+}
+
+} // namespace profile
+} // namespace entwine
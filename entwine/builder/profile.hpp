@@ -0,0 +1,56 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <entwine/types/metadata.hpp>
+#include <entwine/types/threads.hpp>
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+namespace profile
+{
+
+// A tuning profile holds, for each storage backend, the parameters with which
+// the next build to that backend should start, along with the observations
+// of the build from which they were learned, if any:
+//
+//  {
+//      "<backend>": {
+//          "cacheSize": 128, "sleepCount": 2097152, "workToClipRatio": 0.4,
+//          "observed": { ... }
+//      }
+//  }
+//
+// where the backend is the type of the output endpoint, like "file" or "s3".
+// A hierarchyStep may also be given, but is not learned.
+
+// Summarize the throughput, memory, and chunk traffic of a build, as of its
+// end, from our metrics.
+json observe(
+    const Metadata& metadata,
+    const Threads& threads,
+    uint64_t points,
+    double seconds);
+
+// Learn a profile entry from these observations.  Each parameter is nudged
+// from the value with which the observed build ran.
+json learn(const json& observed);
+
+// Set the parameters of this profile entry in this build configuration, other
+// than those which it sets explicitly.  Returns the parameters set.
+json apply(json& config, const json& entry);
+
+} // namespace profile
+} // namespace entwine
@@ -0,0 +1,134 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/progress.hpp>
+
+#include <algorithm>
+#include <chrono>
+
+#include <entwine/builder/heuristics.hpp>
+
+namespace entwine
+{
+
+Progress::Progress(const uint64_t already, const uint64_t total)
+    : m_already(already)
+    , m_total(total)
+    , m_inserted(already)
+{ }
+
+void Progress::start(
+    const Origin origin,
+    const std::string& path,
+    const uint64_t points)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Source& source(m_active[origin]);
+    source.path = path;
+    source.points = points;
+    source.started = now();
+}
+
+double Progress::finish(const Origin origin, const uint64_t inserted)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_done;
+
+    const auto it(m_active.find(origin));
+    if (it == m_active.end()) return 0;
+
+    Finished finished;
+    finished.origin = origin;
+    finished.seconds =
+        since<std::chrono::milliseconds>(it->second.started) / 1000.0;
+    finished.points = inserted;
+    m_finished.push_back(finished);
+    m_active.erase(it);
+
+    return finished.seconds ? inserted / finished.seconds : 0;
+}
+
+json Progress::update(const double elapsed, const uint64_t current)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const uint64_t inserted(m_already + current);
+    if (elapsed > m_elapsed)
+    {
+        const double pace((inserted - m_inserted) / (elapsed - m_elapsed));
+        const double w(heuristics::progressSmoothing);
+        m_pace = m_pace ? w * pace + (1 - w) * m_pace : pace;
+        m_elapsed = elapsed;
+        m_inserted = inserted;
+    }
+
+    std::vector<std::pair<Origin, const Source*>> active;
+    for (const auto& p : m_active) active.emplace_back(p.first, &p.second);
+    const std::size_t n(
+        std::min<std::size_t>(active.size(), heuristics::progressSources));
+    std::partial_sort(
+        active.begin(),
+        active.begin() + n,
+        active.end(),
+        [](const std::pair<Origin, const Source*>& a,
+            const std::pair<Origin, const Source*>& b)
+        {
+            return a.second->started < b.second->started;
+        });
+
+    json slowest = json::array();
+    for (std::size_t i(0); i < n; ++i)
+    {
+        const Source& source(*active[i].second);
+        slowest.push_back({
+            { "origin", active[i].first },
+            { "path", source.path },
+            { "elapsed", since(source.started) },
+            { "points", source.points }
+        });
+    }
+
+    json finished = json::array();
+    for (const Finished& f : m_finished)
+    {
+        finished.push_back({
+            { "origin", f.origin },
+            { "seconds", f.seconds },
+            { "pointsPerSecond", f.seconds ? f.points / f.seconds : 0 }
+        });
+    }
+    m_finished.clear();
+
+    const int64_t remaining(m_total > inserted ? m_total - inserted : 0);
+    json j = {
+        { "inserted", inserted },
+        { "total", m_total },
+        { "pointsPerSecond", m_pace },
+        { "eta", nullptr },
+        { "sources", {
+            { "done", m_done },
+            { "active", m_active.size() },
+            { "slowest", slowest },
+            { "finished", finished }
+        } }
+    };
+    if (m_pace > 0) j["eta"] = int64_t(remaining / m_pace);
+    return j;
+}
+
+int64_t Progress::eta() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pace <= 0) return -1;
+    const uint64_t remaining(m_total > m_inserted ? m_total - m_inserted : 0);
+    return remaining / m_pace;
+}
+
+} // namespace entwine
@@ -0,0 +1,90 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/types/defs.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/time.hpp>
+
+namespace entwine
+{
+
+// The sources in progress and the pace of a build, from which its monitor
+// projects completion and reports its slowest sources.  Snapshots are JSON,
+// as:
+//
+//  {
+//      "inserted": <points>, "total": <points>,
+//      "pointsPerSecond": <smoothed pace>, "eta": <seconds, or null>,
+//      "sources": {
+//          "done": <count>, "active": <count>,
+//          "slowest": [{ "origin", "path", "elapsed", "points" }, ...],
+//          "finished": [{ "origin", "seconds", "pointsPerSecond" }, ...]
+//      }
+//  }
+//
+// where the slowest are those active for longest, and the finished are those
+// completed since the previous snapshot.
+class Progress
+{
+public:
+    Progress(uint64_t already, uint64_t total);
+
+    // The first range of this origin, of this many points, has started.
+    void start(Origin origin, const std::string& path, uint64_t points);
+
+    // Every range of this origin is done, with this many points inserted.
+    // Returns the pace of its insertion in points per second.
+    double finish(Origin origin, uint64_t inserted);
+
+    // Take a snapshot with this many seconds elapsed and this many points
+    // inserted by this build, which updates our smoothed pace.
+    json update(double elapsed, uint64_t current);
+
+    // The projected seconds remaining as of our latest snapshot, or -1 if
+    // there is no pace yet from which to project.
+    int64_t eta() const;
+
+private:
+    struct Source
+    {
+        std::string path;
+        uint64_t points = 0;
+        TimePoint started;
+    };
+
+    struct Finished
+    {
+        Origin origin = 0;
+        double seconds = 0;
+        uint64_t points = 0;
+    };
+
+    const uint64_t m_already;
+    const uint64_t m_total;
+
+    mutable std::mutex m_mutex;
+    std::map<Origin, Source> m_active;
+    std::vector<Finished> m_finished;
+    uint64_t m_done = 0;
+
+    double m_elapsed = 0;
+    uint64_t m_inserted = 0;
+    double m_pace = 0;
+};
+
+} // namespace entwine
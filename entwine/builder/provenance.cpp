@@ -0,0 +1,147 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/provenance.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <entwine/util/io.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+using Read = uint64_t (*)(const char*);
+
+template <typename T>
+uint64_t read(const char* pos)
+{
+    T v;
+    std::memcpy(&v, pos, sizeof(T));
+    return static_cast<uint64_t>(v);
+}
+
+// IDs are stamped as integers, but the type of their dimension is up to the
+// schema, so its reader is resolved once per node.
+Read getRead(const DimType type)
+{
+    switch (type)
+    {
+        case DimType::Signed8:      return &read<int8_t>;
+        case DimType::Signed16:     return &read<int16_t>;
+        case DimType::Signed32:     return &read<int32_t>;
+        case DimType::Signed64:     return &read<int64_t>;
+        case DimType::Unsigned8:    return &read<uint8_t>;
+        case DimType::Unsigned16:   return &read<uint16_t>;
+        case DimType::Unsigned32:   return &read<uint32_t>;
+        case DimType::Unsigned64:   return &read<uint64_t>;
+        case DimType::Float:        return &read<float>;
+        case DimType::Double:       return &read<double>;
+        default: throw std::runtime_error("Invalid ID dimension type");
+    }
+}
+
+} // unnamed namespace
+
+void Provenance::add(const Dxyz& key, BlockPointTable& table)
+{
+    const pdal::PointLayout& layout(*table.layout());
+    if (!layout.hasDim(DimId::OriginId) || !layout.hasDim(DimId::PointId))
+    {
+        return;
+    }
+
+    const std::size_t originOffset(layout.dimOffset(DimId::OriginId));
+    const std::size_t pointOffset(layout.dimOffset(DimId::PointId));
+    const Read readOrigin(getRead(layout.dimType(DimId::OriginId)));
+    const Read readPoint(getRead(layout.dimType(DimId::PointId)));
+
+    std::vector<std::pair<Origin, uint64_t>> ids;
+    ids.reserve(table.size());
+    table.forEach([&](const char* point)
+    {
+        ids.emplace_back(
+            readOrigin(point + originOffset),
+            readPoint(point + pointOffset));
+    });
+    std::sort(ids.begin(), ids.end());
+
+    // Collapse the sorted IDs into runs of consecutive point IDs per origin.
+    std::map<Origin, Ranges> node;
+    for (const auto& id : ids)
+    {
+        Ranges& ranges(node[id.first]);
+        if (ranges.size() && ranges.back().second + 1 >= id.second)
+        {
+            ranges.back().second = std::max(ranges.back().second, id.second);
+        }
+        else ranges.emplace_back(id.second, id.second);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::set<Origin>& origins(m_nodes[key]);
+    for (const Origin origin : origins)
+    {
+        if (!node.count(origin)) m_origins[origin].erase(key);
+    }
+    origins.clear();
+
+    for (auto& p : node)
+    {
+        origins.insert(p.first);
+        m_origins[p.first][key] = std::move(p.second);
+    }
+}
+
+void Provenance::save(const arbiter::Endpoint& ep, const unsigned threads)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Pool pool(threads);
+    for (const auto& p : m_origins)
+    {
+        pool.add([&ep, &p]()
+        {
+            const std::string filename(std::to_string(p.first) + ".json");
+
+            json j = json::object();
+            if (const auto existing = ep.tryGet(filename))
+            {
+                j = json::parse(*existing);
+            }
+
+            for (const auto& node : p.second)
+            {
+                json& ranges(j[node.first.toString()] = json::array());
+                for (const Range& r : node.second)
+                {
+                    ranges.push_back({ r.first, r.second });
+                }
+            }
+
+            ensurePut(ep, filename, j.dump());
+        });
+    }
+    pool.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+
+    m_origins.clear();
+    m_nodes.clear();
+}
+
+} // namespace entwine
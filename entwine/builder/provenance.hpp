@@ -0,0 +1,61 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/defs.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/types/vector-point-table.hpp>
+
+namespace entwine
+{
+
+// The nodes into which the points of each source were written, gathered as
+// nodes are saved from the OriginId and PointId of their points, so that the
+// node holding a given point of a source may be found without scanning the
+// dataset.  They are saved in a file per origin, in ept-provenance, as:
+//
+//  { "<key>": [[<first>, <last>], ...], ... }
+//
+// where each pair is an inclusive range of the point IDs of that source which
+// are held by that node.
+class Provenance
+{
+public:
+    using Range = std::pair<uint64_t, uint64_t>;
+    using Ranges = std::vector<Range>;
+
+    // Record the points of this node, whose points are in our absolute
+    // layout.  A rewritten node replaces its previous record.  Nodes without
+    // both an OriginId and a PointId are not recorded.
+    void add(const Dxyz& key, BlockPointTable& table);
+
+    // Merge the nodes recorded so far into the file of each origin, which is
+    // updated rather than replaced if it exists.
+    void save(const arbiter::Endpoint& ep, unsigned threads);
+
+private:
+    std::mutex m_mutex;
+    std::map<Origin, std::map<Dxyz, Ranges>> m_origins;
+
+    // The origins recorded for each node, so that a rewritten node may drop
+    // the origins which it no longer holds.
+    std::map<Dxyz, std::set<Origin>> m_nodes;
+};
+
+} // namespace entwine
@@ -0,0 +1,275 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/recover.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <zstd.h>
+
+#include <entwine/io/binary.hpp>
+#include <entwine/io/columnar.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/io/zstandard.hpp>
+#include <entwine/types/defs.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/util/config.hpp>
+#include <entwine/util/io.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+namespace builder
+{
+
+namespace
+{
+
+// The largest header of LAS 1.4, which holds its 64-bit point count.
+const uint64_t lasHeaderSize(375);
+
+// The largest header of a zstandard frame, which holds its content size.
+const uint64_t zstdHeaderSize(18);
+
+template <typename T>
+T readLe(const std::vector<char>& data, const std::size_t offset)
+{
+    if (data.size() < offset + sizeof(T))
+    {
+        throw std::runtime_error("Truncated node header");
+    }
+    T v;
+    std::memcpy(&v, data.data() + offset, sizeof(T));
+    return v;
+}
+
+// Fetch at most the first size bytes of this file.
+std::vector<char> getHead(
+    const arbiter::Endpoint& ep,
+    const std::string& path,
+    const uint64_t size)
+{
+    if (ep.isHttpDerived())
+    {
+        return ep.getBinary(path, getRangeHeader(0, size));
+    }
+    if (ep.isLocal())
+    {
+        std::ifstream file(ep.prefixedRoot() + path, std::ios::binary);
+        if (!file.good()) throw std::runtime_error("Could not open " + path);
+
+        std::vector<char> data(size);
+        file.read(data.data(), size);
+        data.resize(file.gcount());
+        return data;
+    }
+    return ensureGetBinary(ep, path);
+}
+
+uint64_t getPointCount(
+    const Metadata& metadata,
+    const Endpoints& endpoints,
+    const Dxyz& key)
+{
+    const io::Type type(io::getNodeType(metadata, key.d));
+    const std::string path(key.toString() + io::toExtension(type));
+    const arbiter::Endpoint& ep(endpoints.data);
+
+    const auto getPointSize([&]()
+    {
+        return entwine::getPointSize(
+            io::binary::getPackedSchema(
+                metadata,
+                getNodeBounds(metadata, key)));
+    });
+
+    switch (type)
+    {
+        case io::Type::Binary:
+        {
+            const auto size(ep.tryGetSize(path));
+            if (!size) throw std::runtime_error("Could not stat " + path);
+            return *size / getPointSize();
+        }
+        case io::Type::Laszip:
+        {
+            // The point count of LAS 1.4 is 64 bits, and it is otherwise in
+            // the legacy field.
+            const std::vector<char> head(getHead(ep, path, lasHeaderSize));
+            if (readLe<uint8_t>(head, 25) >= 4)
+            {
+                return readLe<uint64_t>(head, 247);
+            }
+            return readLe<uint32_t>(head, 107);
+        }
+        case io::Type::Columnar:
+        {
+            const std::vector<char> head(
+                getHead(ep, path, io::columnar::headerSize));
+            return readLe<uint64_t>(head, 8);
+        }
+        case io::Type::Zstandard:
+        {
+            const std::vector<char> head(
+                getHead(ep, path, zstdHeaderSize));
+            const unsigned long long size(
+                ZSTD_getFrameContentSize(head.data(), head.size()));
+            if (
+                size != ZSTD_CONTENTSIZE_UNKNOWN &&
+                size != ZSTD_CONTENTSIZE_ERROR)
+            {
+                return size / getPointSize();
+            }
+            // Our frames record their size, so this is only reached for
+            // nodes written by other tools.
+            return io::zstandard::decompress(ensureGetBinary(ep, path))
+                .size() / getPointSize();
+        }
+    }
+    throw std::runtime_error("Invalid data type");
+}
+
+} // unnamed namespace
+
+Hierarchy recoverHierarchy(
+    const Endpoints& endpoints,
+    const Metadata& metadata,
+    const unsigned threads)
+{
+    if (metadata.internal.pack)
+    {
+        throw std::runtime_error(
+            "Cannot recover the hierarchy of a packed dataset");
+    }
+
+    // Each depth is listed on its own, so that listings of remote prefixes,
+    // which are paginated, proceed in parallel.
+    const std::string root(endpoints.data.prefixedRoot());
+
+    std::mutex mutex;
+    std::vector<Dxyz> keys;
+    {
+        Pool pool(threads);
+        for (uint64_t d(0); d <= maxDepth; ++d)
+        {
+            pool.add([&, d]()
+            {
+                const std::string extension(io::getNodeExtension(metadata, d));
+                const std::vector<std::string> paths(
+                    endpoints.arbiter->resolve(
+                        root + std::to_string(d) + "-*"));
+
+                std::vector<Dxyz> found;
+                for (const std::string& path : paths)
+                {
+                    const std::string name(arbiter::getBasename(path));
+                    const std::size_t dot(name.rfind('.'));
+                    if (
+                        dot == std::string::npos ||
+                        name.substr(dot) != extension)
+                    {
+                        continue;
+                    }
+                    found.emplace_back(name.substr(0, dot));
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                keys.insert(keys.end(), found.begin(), found.end());
+            });
+        }
+        pool.join();
+        if (pool.errors().size())
+        {
+            throw std::runtime_error(pool.errors().front());
+        }
+    }
+    std::cout << "Found " << commify(keys.size()) << " nodes" << std::endl;
+
+    Hierarchy hierarchy;
+    {
+        Pool pool(threads);
+        for (const Dxyz& key : keys)
+        {
+            pool.add([&, key]()
+            {
+                const uint64_t np(getPointCount(metadata, endpoints, key));
+                if (np) hierarchy.set(key, np);
+            });
+        }
+        pool.join();
+        if (pool.errors().size())
+        {
+            throw std::runtime_error(pool.errors().front());
+        }
+    }
+
+    // Every ancestor of a node must be present for it to be reached, so any
+    // whose data is missing are listed as empty.
+    for (const Dxyz& key : keys)
+    {
+        Dxyz parent(key);
+        while (parent.d)
+        {
+            parent = Dxyz(
+                parent.d - 1,
+                parent.x / 2,
+                parent.y / 2,
+                parent.z / 2);
+            if (hierarchy.has(parent)) break;
+            hierarchy.set(parent, 0);
+        }
+    }
+
+    return hierarchy;
+}
+
+uint64_t recover(const Endpoints& endpoints, const unsigned threads)
+{
+    json build(json::parse(ensureGet(endpoints.output, "ept-build.json")));
+    json ept(json::parse(ensureGet(endpoints.output, "ept.json")));
+    Metadata metadata(config::getMetadata(merge(build, ept)));
+
+    if (metadata.subset)
+    {
+        throw std::runtime_error("Cannot recover the hierarchy of a subset");
+    }
+
+    const Endpoints& ep(endpoints);
+    const Hierarchy hierarchy(recoverHierarchy(ep, metadata, threads));
+
+    uint64_t points(0);
+    hierarchy.forEach([&points](const Dxyz&, int64_t np) { points += np; });
+
+    const unsigned step(hierarchy::determineStep(hierarchy));
+    std::cout << "Saving hierarchy of " << commify(points) << " points" <<
+        std::endl;
+    hierarchy::save(hierarchy, ep.hierarchy, step, threads);
+
+    // Readers find our hierarchy files by our step, so our metadata is only
+    // written once they are in place.
+    build["hierarchyStep"] = step;
+    if (!step) build.erase("hierarchyStep");
+    ensurePut(ep.output, "ept-build.json", build.dump(2));
+
+    ept["points"] = points;
+    ensurePut(ep.output, "ept.json", ept.dump(2));
+
+    return points;
+}
+
+} // namespace builder
+} // namespace entwine
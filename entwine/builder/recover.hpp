@@ -0,0 +1,41 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/types/endpoints.hpp>
+#include <entwine/types/metadata.hpp>
+
+namespace entwine
+{
+namespace builder
+{
+
+// Reconstruct the hierarchy of a dataset from its node files, for when its
+// hierarchy has been lost or was never completely saved.  The data prefix is
+// listed a depth at a time, in parallel, and the point count of each node is
+// read with as little I/O as its type allows: from the size of binary nodes,
+// from the headers of laszip, columnar, and zstandard nodes, and only by
+// decompressing zstandard nodes whose frames do not record their size.
+Hierarchy recoverHierarchy(
+    const Endpoints& endpoints,
+    const Metadata& metadata,
+    unsigned threads);
+
+// Recover the hierarchy of the completed dataset at these endpoints, and save
+// it with a newly chosen step, updating our metadata to match.  Returns the
+// number of points of the recovered hierarchy.
+uint64_t recover(const Endpoints& endpoints, unsigned threads);
+
+} // namespace builder
+} // namespace entwine
@@ -0,0 +1,176 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/replay.hpp>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <tuple>
+
+namespace entwine
+{
+namespace replay
+{
+
+namespace
+{
+
+using Event = accessTrace::Event;
+
+// Our released chunks are ordered by their rank and then by the time of
+// their release, so that the first of them is the next to be evicted.
+using Victim = std::tuple<int64_t, uint64_t, Dxyz>;
+
+int64_t getRank(const Policy policy, const Dxyz& key)
+{
+    const int64_t depth(key.depth());
+    switch (policy)
+    {
+        case Policy::Deepest: return -depth;
+        case Policy::Shallowest: return depth;
+        default: return 0;
+    }
+}
+
+bool isRef(const Event event)
+{
+    return event == Event::Hit ||
+        event == Event::Create ||
+        event == Event::Rewake;
+}
+
+} // unnamed namespace
+
+Policy toPolicy(const std::string& s)
+{
+    if (s == "lru") return Policy::Lru;
+    if (s == "deepest") return Policy::Deepest;
+    if (s == "shallowest") return Policy::Shallowest;
+    throw std::runtime_error("Invalid replay policy: " + s);
+}
+
+std::string toString(const Policy policy)
+{
+    switch (policy)
+    {
+        case Policy::Deepest: return "deepest";
+        case Policy::Shallowest: return "shallowest";
+        default: return "lru";
+    }
+}
+
+json toJson(const Results& r)
+{
+    return {
+        { "refs", r.refs },
+        { "hits", r.hits },
+        { "reclaims", r.reclaims },
+        { "creates", r.creates },
+        { "rewakes", r.rewakes },
+        { "evictions", r.evictions },
+        { "peakResident", r.peakResident }
+    };
+}
+
+json summarize(const std::vector<accessTrace::Record>& records)
+{
+    std::map<Event, uint64_t> counts;
+    std::set<uint16_t> threads;
+    for (const accessTrace::Record& r : records)
+    {
+        ++counts[r.event];
+        threads.insert(r.thread);
+    }
+
+    json j = { { "records", records.size() }, { "threads", threads.size() } };
+    for (const Event e : {
+            Event::Hit, Event::Create, Event::Rewake,
+            Event::Reclaim, Event::Clip, Event::Evict })
+    {
+        j[accessTrace::toString(e)] = counts[e];
+    }
+    return j;
+}
+
+Results run(
+    const std::vector<accessTrace::Record>& records,
+    const uint64_t cacheSize,
+    const Policy policy)
+{
+    Results results;
+
+    // The references held by threads, the release stamps of our cached
+    // chunks which no thread holds, and the chunks which have saved data.
+    std::map<Dxyz, uint64_t> refs;
+    std::map<Dxyz, uint64_t> released;
+    std::set<Victim> victims;
+    std::set<Dxyz> saved;
+    uint64_t stamp(0);
+
+    for (const accessTrace::Record& r : records)
+    {
+        const Dxyz key(r.dxyz());
+
+        if (isRef(r.event))
+        {
+            ++results.refs;
+
+            uint64_t& count(refs[key]);
+            if (count) ++results.hits;
+            else
+            {
+                const auto it(released.find(key));
+                if (it != released.end())
+                {
+                    ++results.reclaims;
+                    victims.erase(Victim(getRank(policy, key), it->second, key));
+                    released.erase(it);
+                }
+                else if (r.event == Event::Rewake || saved.count(key))
+                {
+                    ++results.rewakes;
+                }
+                else ++results.creates;
+            }
+            ++count;
+
+            results.peakResident = std::max<uint64_t>(
+                results.peakResident,
+                refs.size() + released.size());
+        }
+        else if (r.event == Event::Clip)
+        {
+            // A trace begun during a build may clip earlier references.
+            const auto it(refs.find(key));
+            if (it == refs.end()) continue;
+            if (--it->second) continue;
+            refs.erase(it);
+
+            released[key] = ++stamp;
+            victims.emplace(getRank(policy, key), stamp, key);
+
+            while (released.size() > cacheSize)
+            {
+                const Dxyz victim(std::get<2>(*victims.begin()));
+                victims.erase(victims.begin());
+                released.erase(victim);
+                saved.insert(victim);
+                ++results.evictions;
+            }
+        }
+    }
+
+    return results;
+}
+
+} // namespace replay
+} // namespace entwine
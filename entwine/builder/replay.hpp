@@ -0,0 +1,67 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <entwine/util/access-trace.hpp>
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+namespace replay
+{
+
+// The order in which released chunks are evicted once the cache is full.
+enum class Policy
+{
+    Lru,        // Least recently released first.
+    Deepest,    // Deepest first, and then least recently released.
+    Shallowest  // Shallowest first, and then least recently released.
+};
+
+Policy toPolicy(const std::string& s);
+std::string toString(Policy policy);
+
+// The outcomes of the references of a trace.  A reference of a chunk which
+// no thread holds is a reclaim if the chunk is still cached, and otherwise a
+// creation, or a rewake of a chunk which had been evicted or which existed
+// before the build.
+struct Results
+{
+    uint64_t refs = 0;
+    uint64_t hits = 0;
+    uint64_t reclaims = 0;
+    uint64_t creates = 0;
+    uint64_t rewakes = 0;
+    uint64_t evictions = 0;
+    uint64_t peakResident = 0;
+};
+
+json toJson(const Results& results);
+
+// The counts of each event of a trace, as recorded by the build.
+json summarize(const std::vector<accessTrace::Record>& records);
+
+// Replay the references and clips of a trace through a model of our chunk
+// cache, which holds this many released chunks.  The evictions and reclaims
+// of the trace are the outcomes of the policy of the traced build, so they
+// are ignored, and the times at which chunks were released are taken from
+// the trace as they were, since each thread's clipper decided them.
+Results run(
+    const std::vector<accessTrace::Record>& records,
+    uint64_t cacheSize,
+    Policy policy);
+
+} // namespace replay
+} // namespace entwine
@@ -0,0 +1,40 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/resident.hpp>
+
+#include <entwine/types/dimension.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+bool isScaled(const Schema& schema)
+{
+    for (const std::string name : { "X", "Y", "Z" })
+    {
+        const auto d(maybeFind(schema, name));
+        if (!d || d->type != DimType::Signed32) return false;
+    }
+    return !!getScaleOffset(schema);
+}
+
+} // unnamed namespace
+
+Resident::Resident(const Metadata& metadata)
+    : m_compact(metadata.internal.compact && isScaled(metadata.schema))
+    , m_plan(m_compact ? &metadata.layouts->plan() : nullptr)
+    , m_absolutePointSize(metadata.layouts->absolutePointSize())
+    , m_pointSize(m_compact ? m_plan->packedPointSize() : m_absolutePointSize)
+{ }
+
+} // namespace entwine
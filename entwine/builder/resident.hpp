@@ -0,0 +1,59 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <entwine/types/copy-plan.hpp>
+#include <entwine/types/metadata.hpp>
+
+namespace entwine
+{
+
+// Describes the layout in which points are held in memory during a build.  By
+// default this is the absolute schema, with XYZ stored as doubles.  If compact
+// residency is enabled and the output schema is scaled, XYZ are instead held
+// as their scaled 32-bit integers.  Voxels carry their own world coordinates,
+// so conversion is only needed when points enter or leave the tree.
+class Resident
+{
+public:
+    explicit Resident(const Metadata& metadata);
+
+    bool compact() const { return m_compact; }
+    uint64_t pointSize() const { return m_pointSize; }
+    uint64_t absolutePointSize() const { return m_absolutePointSize; }
+
+    // Convert a point from the absolute layout to the resident layout.
+    void fromAbsolute(const char* src, char* dst) const
+    {
+        if (m_compact) m_plan->pack(src, dst);
+        else std::memcpy(dst, src, m_pointSize);
+    }
+
+    // Convert a point from the resident layout to the absolute layout.
+    void toAbsolute(const char* src, char* dst) const
+    {
+        if (m_compact) m_plan->unpack(src, dst);
+        else std::memcpy(dst, src, m_pointSize);
+    }
+
+private:
+    const bool m_compact;
+
+    // Only planned if compact, since the plan is never needed otherwise.
+    const CopyPlan* const m_plan;
+    const uint64_t m_absolutePointSize;
+    const uint64_t m_pointSize;
+};
+
+} // namespace entwine
@@ -0,0 +1,135 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/scheduler.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <stdexcept>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+Scheduler::Scheduler(const uint64_t threads, const uint64_t memory)
+    : m_threads(std::max<uint64_t>(threads, heuristics::minBuildThreads))
+    , m_memory(memory)
+{ }
+
+void Scheduler::add(Builder& builder, const uint64_t progressInterval)
+{
+    add([&builder, progressInterval](
+        const Threads threads,
+        const std::shared_ptr<Allotment>& allotment)
+    {
+        builder.allotment = allotment;
+        try
+        {
+            const uint64_t inserted = builder.run(threads, 0, progressInterval);
+            builder.allotment.reset();
+            return inserted;
+        }
+        catch (...)
+        {
+            builder.allotment.reset();
+            throw;
+        }
+    });
+}
+
+std::vector<uint64_t> Scheduler::run()
+{
+    std::vector<uint64_t> inserted(m_jobs.size(), 0);
+    if (m_jobs.empty()) return inserted;
+
+    const uint64_t concurrency = std::min<uint64_t>(
+        m_threads / heuristics::minBuildThreads,
+        m_jobs.size());
+
+    const uint64_t work = std::max<uint64_t>(
+        std::llround(m_threads * heuristics::defaultWorkToClipRatio),
+        1);
+    const uint64_t clip = m_threads - work;
+
+    Pool shared(work);
+    std::atomic_uint64_t resident(0);
+
+    // The allotments of the builds now running, among which our work threads
+    // are divided evenly, and the number of builds which are unfinished.
+    std::mutex mutex;
+    std::vector<Allotment*> running;
+    uint64_t unfinished(m_jobs.size());
+
+    const auto rebalance = [&running, work]()
+    {
+        const uint64_t n(running.size());
+        for (uint64_t i(0); i < n; ++i)
+        {
+            running[i]->threads(work * (i + 1) / n - work * i / n);
+        }
+    };
+
+    Pool pool(concurrency, 1);
+    for (std::size_t i(0); i < m_jobs.size(); ++i)
+    {
+        pool.add([&, i]()
+        {
+            const auto allotment(
+                std::make_shared<Allotment>(shared, resident, m_memory, 1));
+
+            uint64_t sharers(0);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                sharers = std::min<uint64_t>(unfinished, concurrency);
+                running.push_back(allotment.get());
+                rebalance();
+            }
+
+            const auto finish = [&]()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running.erase(
+                    std::find(running.begin(), running.end(), allotment.get()));
+                --unfinished;
+                rebalance();
+            };
+
+            const Threads threads(
+                std::max<uint64_t>(work / sharers, 1),
+                std::max<uint64_t>(clip / sharers, 1));
+
+            try
+            {
+                inserted[i] = m_jobs[i](threads, allotment);
+            }
+            catch (...)
+            {
+                finish();
+                throw;
+            }
+            finish();
+        });
+    }
+    pool.join();
+    shared.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+    if (shared.errors().size())
+    {
+        throw std::runtime_error(shared.errors().front());
+    }
+    return inserted;
+}
+
+} // namespace entwine
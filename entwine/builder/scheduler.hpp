@@ -0,0 +1,62 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <entwine/builder/allotment.hpp>
+#include <entwine/builder/builder.hpp>
+#include <entwine/types/threads.hpp>
+
+namespace entwine
+{
+
+// Runs many builds within a single process, so that a large machine may be
+// shared among many small builds without being oversubscribed or left idle.
+//
+// At most as many builds run at once as our threads allow each to have its
+// minimum, and they are started in the order in which they were added.  The
+// inserts of every build run in a single pool, through an allotment for each
+// build which admits an equal share of its threads among the builds running,
+// and which is rebalanced as each build starts and finishes.  The points held
+// in memory by every build count against our single memory budget, if one is
+// set.  Clip threads, which inserts may wait upon, are not shared, so each
+// build is given its share of those as it starts.
+class Scheduler
+{
+public:
+    Scheduler(uint64_t threads, uint64_t memory = 0);
+
+    // Runs a single build with these threads, and whose inserts are added
+    // through this allotment, returning the number of points it inserted.
+    using Job = std::function<
+        uint64_t(Threads, const std::shared_ptr<Allotment>&)>;
+
+    void add(Job job) { m_jobs.push_back(job); }
+
+    // The builder must outlive our run().
+    void add(Builder& builder, uint64_t progressIntervalSeconds = 0);
+
+    // Run every build to completion, returning the number of points inserted
+    // by each, in the order in which they were added.  If any build fails,
+    // the others still run, after which the first error is thrown.
+    std::vector<uint64_t> run();
+
+private:
+    const uint64_t m_threads;
+    const uint64_t m_memory;
+    std::vector<Job> m_jobs;
+};
+
+} // namespace entwine
@@ -0,0 +1,209 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/source-index.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <entwine/builder/heuristics.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+const uint64_t npos(std::numeric_limits<uint64_t>::max());
+const uint64_t fanout(heuristics::sourceIndexFanout);
+
+// Order these items so that each consecutive run of our fanout is a tile:
+// they are sorted into vertical slices by the X of their centers, and then
+// within each slice by the Y of their centers.
+template <typename T>
+void tile(std::vector<T>& items)
+{
+    std::sort(
+        items.begin(),
+        items.end(),
+        [](const T& a, const T& b)
+        {
+            return a.bounds.mid().x < b.bounds.mid().x;
+        });
+
+    const uint64_t runs((items.size() + fanout - 1) / fanout);
+    const uint64_t slices(std::ceil(std::sqrt(static_cast<double>(runs))));
+    const uint64_t perSlice(slices * fanout);
+
+    for (uint64_t begin(0); begin < items.size(); begin += perSlice)
+    {
+        const uint64_t end(std::min<uint64_t>(begin + perSlice, items.size()));
+        std::sort(
+            items.begin() + begin,
+            items.begin() + end,
+            [](const T& a, const T& b)
+            {
+                return a.bounds.mid().y < b.bounds.mid().y;
+            });
+    }
+}
+
+} // unnamed namespace
+
+SourceIndex::SourceIndex(const Manifest& manifest)
+    : m_leaves(manifest.size(), npos)
+    , m_pending(manifest.size())
+{
+    for (Origin origin(0); origin < manifest.size(); ++origin)
+    {
+        const Bounds& bounds(manifest[origin].source.info.bounds);
+        if (bounds.exists()) m_entries.emplace_back(origin, bounds);
+    }
+    if (m_entries.empty()) return;
+
+    // Our leaves come first, followed by each level above them in turn, so
+    // that our root is last.
+    tile(m_entries);
+    for (uint64_t begin(0); begin < m_entries.size(); begin += fanout)
+    {
+        Node node;
+        node.leaf = true;
+        node.begin = begin;
+        node.end = std::min<uint64_t>(begin + fanout, m_entries.size());
+        node.bounds = Bounds::expander();
+        for (uint64_t i(node.begin); i < node.end; ++i)
+        {
+            node.bounds.grow(m_entries[i].bounds);
+        }
+        m_nodes.push_back(node);
+    }
+
+    uint64_t levelBegin(0);
+    uint64_t levelEnd(m_nodes.size());
+    while (levelEnd - levelBegin > 1)
+    {
+        // The nodes of this level are reordered before their parents are
+        // made, which leaves their own children in place.
+        std::vector<Node> level(
+            m_nodes.begin() + levelBegin,
+            m_nodes.begin() + levelEnd);
+        tile(level);
+        std::copy(level.begin(), level.end(), m_nodes.begin() + levelBegin);
+
+        for (uint64_t begin(levelBegin); begin < levelEnd; begin += fanout)
+        {
+            Node node;
+            node.begin = begin;
+            node.end = std::min<uint64_t>(begin + fanout, levelEnd);
+            node.bounds = Bounds::expander();
+            for (uint64_t i(node.begin); i < node.end; ++i)
+            {
+                node.bounds.grow(m_nodes[i].bounds);
+            }
+            m_nodes.push_back(node);
+        }
+
+        levelBegin = levelEnd;
+        levelEnd = m_nodes.size();
+    }
+
+    for (uint64_t i(0); i < m_nodes.size(); ++i)
+    {
+        const Node& node(m_nodes[i]);
+        for (uint64_t c(node.begin); c < node.end; ++c)
+        {
+            if (node.leaf)
+            {
+                m_leaves[m_entries[c].origin] = i;
+            }
+            else m_nodes[c].parent = i;
+        }
+    }
+    m_nodes.back().parent = npos;
+
+    m_counts = std::vector<std::atomic<uint64_t>>(m_nodes.size());
+}
+
+template <typename F>
+void SourceIndex::search(
+    const Bounds& bounds,
+    const bool force2d,
+    const bool pending,
+    F f) const
+{
+    if (m_nodes.empty()) return;
+
+    std::vector<uint64_t> stack(1, m_nodes.size() - 1);
+    while (stack.size())
+    {
+        const uint64_t index(stack.back());
+        stack.pop_back();
+
+        const Node& node(m_nodes[index]);
+        if (pending && !m_counts[index]) continue;
+        if (!node.bounds.overlaps(bounds, force2d)) continue;
+
+        for (uint64_t c(node.begin); c < node.end; ++c)
+        {
+            if (!node.leaf)
+            {
+                stack.push_back(c);
+                continue;
+            }
+
+            const Entry& entry(m_entries[c]);
+            if (pending && !m_pending[entry.origin]) continue;
+            if (!entry.bounds.overlaps(bounds, force2d)) continue;
+            if (!f(entry)) return;
+        }
+    }
+}
+
+std::vector<Origin> SourceIndex::query(
+    const Bounds& bounds,
+    const bool force2d) const
+{
+    std::vector<Origin> origins;
+    search(bounds, force2d, false, [&origins](const Entry& entry)
+    {
+        origins.push_back(entry.origin);
+        return true;
+    });
+    std::sort(origins.begin(), origins.end());
+    return origins;
+}
+
+void SourceIndex::setPending(const Origin origin, const bool pending)
+{
+    if (m_pending.at(origin).exchange(pending) == pending) return;
+
+    for (
+        uint64_t node(m_leaves[origin]);
+        node != npos;
+        node = m_nodes[node].parent)
+    {
+        if (pending) ++m_counts[node];
+        else --m_counts[node];
+    }
+}
+
+bool SourceIndex::overlapsPending(const Bounds& bounds) const
+{
+    bool found(false);
+    search(bounds, true, true, [&found](const Entry&)
+    {
+        found = true;
+        return false;
+    });
+    return found;
+}
+
+} // namespace entwine
@@ -0,0 +1,84 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/source.hpp>
+
+namespace entwine
+{
+
+// A static R-tree over the bounds of the sources of a manifest, packed by
+// sort-tile-recursion, so that the sources overlapping a region are found
+// without visiting every source.  Sources without bounds are not indexed.
+//
+// Each source may also be marked pending, while it has yet to be inserted.
+// Every node counts its pending sources, so that queries for pending sources
+// skip the subtrees which have none.  Marking is safe alongside queries.
+class SourceIndex
+{
+public:
+    explicit SourceIndex(const Manifest& manifest);
+
+    // The origins of the sources whose bounds overlap these, in order.
+    std::vector<Origin> query(const Bounds& bounds, bool force2d = false)
+        const;
+
+    void setPending(Origin origin, bool pending);
+
+    // Returns true if any pending source overlaps these bounds in XY.
+    bool overlapsPending(const Bounds& bounds) const;
+
+private:
+    struct Node
+    {
+        Bounds bounds;
+
+        // Our children, which are entries for a leaf and otherwise nodes.
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        bool leaf = false;
+
+        uint64_t parent = 0;
+    };
+
+    struct Entry
+    {
+        Entry(Origin origin, const Bounds& bounds)
+            : origin(origin)
+            , bounds(bounds)
+        { }
+
+        Origin origin = 0;
+        Bounds bounds;
+    };
+
+    // Visit the entries overlapping these bounds, in no particular order, as
+    // f(const Entry&), for which a false return value ends our search.  If
+    // pending, only subtrees with pending sources are visited.
+    template <typename F>
+    void search(const Bounds& bounds, bool force2d, bool pending, F f) const;
+
+    std::vector<Entry> m_entries;
+    std::vector<Node> m_nodes;
+
+    // The leaf which holds each origin, or npos if it is not indexed.
+    std::vector<uint64_t> m_leaves;
+
+    std::vector<std::atomic<bool>> m_pending;
+    std::vector<std::atomic<uint64_t>> m_counts;
+};
+
+} // namespace entwine
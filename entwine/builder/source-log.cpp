@@ -0,0 +1,90 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/source-log.hpp>
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+const auto mode =
+    std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc;
+
+} // unnamed namespace
+
+SourceLog::SourceLog(const std::string path)
+    : m_path(path)
+    , m_file(path, mode)
+{
+    if (!m_file) throw std::runtime_error("Failed to create " + path);
+}
+
+SourceLog::~SourceLog()
+{
+    m_file.close();
+    std::remove(m_path.c_str());
+}
+
+void SourceLog::put(const Origin origin, const Source& source)
+{
+    const std::string data(json(source).dump());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file.seekp(m_size);
+    m_file.write(data.data(), data.size());
+    if (!m_file) throw std::runtime_error("Failed to write " + m_path);
+
+    m_entries[origin] = std::make_pair(m_size, data.size());
+    m_size += data.size();
+}
+
+void SourceLog::restore(const Origin origin, BuildItem& item) const
+{
+    std::vector<char> data;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto& entry(m_entries.at(origin));
+        data.resize(entry.second);
+
+        m_file.flush();
+        m_file.seekg(entry.first);
+        m_file.read(data.data(), data.size());
+        if (!m_file) throw std::runtime_error("Failed to read " + m_path);
+    }
+    manifest::restore(item, SourceInfo(json::parse(data.begin(), data.end())));
+}
+
+OriginList SourceLog::origins() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    OriginList list;
+    for (const auto& p : m_entries) list.push_back(p.first);
+    return list;
+}
+
+void SourceLog::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_size = 0;
+    m_file.close();
+    m_file.open(m_path, mode);
+    if (!m_file) throw std::runtime_error("Failed to create " + m_path);
+}
+
+} // namespace entwine
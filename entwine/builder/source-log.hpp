@@ -0,0 +1,62 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <entwine/types/defs.hpp>
+#include <entwine/types/source.hpp>
+
+namespace entwine
+{
+
+// The detailed metadata of the sources of a compact manifest which have been
+// inserted since it was last saved, held in a local file rather than in memory
+// until then.  Each source is appended as JSON, and only its position in the
+// file is held.  The file is removed along with this object.
+class SourceLog
+{
+public:
+    explicit SourceLog(std::string path);
+    ~SourceLog();
+
+    // Record the detail of this source, replacing any earlier record of it.
+    void put(Origin origin, const Source& source);
+
+    // Restore the detail of this entry from its record.
+    void restore(Origin origin, BuildItem& item) const;
+
+    // Our recorded origins, in order.
+    OriginList origins() const;
+
+    // Forget every record, once they have been saved.
+    void clear();
+
+private:
+    const std::string m_path;
+
+    mutable std::mutex m_mutex;
+    mutable std::fstream m_file;
+    uint64_t m_size = 0;
+
+    // The offset and length of the latest record of each origin.
+    std::map<Origin, std::pair<uint64_t, uint64_t>> m_entries;
+
+    SourceLog(const SourceLog&) = delete;
+    SourceLog& operator=(const SourceLog&) = delete;
+};
+
+} // namespace entwine
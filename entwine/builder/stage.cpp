@@ -0,0 +1,141 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/builder/stage.hpp>
+
+#include <entwine/builder/chunk-cache.hpp>
+#include <entwine/builder/clipper.hpp>
+#include <entwine/builder/resident.hpp>
+#include <entwine/util/metrics.hpp>
+
+namespace entwine
+{
+
+Stage::Stage(ChunkCache& cache, const Metadata& metadata, const uint64_t depth)
+    : m_cache(cache)
+    , m_depth(depth)
+    , m_pointSize(Resident(metadata).pointSize())
+    , m_policy(toVoxelPolicy(metadata.internal.voxelPolicy))
+    , m_dedup(metadata.internal.dedup)
+    , m_block(m_pointSize, 4096)
+    , m_nodes(depth)
+{ }
+
+Stage::Node& Stage::node(const ChunkKey& ck)
+{
+    auto& nodes(m_nodes[ck.depth()]);
+    auto it(nodes.find(ck.position()));
+    if (it == nodes.end())
+    {
+        it = nodes.emplace(ck.position(), Node(ck)).first;
+    }
+    return it->second;
+}
+
+bool Stage::insert(Node& node, Voxel& voxel, const Key& key)
+{
+    auto it(node.voxels.find(key.position()));
+    if (it == node.voxels.end())
+    {
+        Insertion entry(key);
+        entry.voxel.setData(next());
+        entry.voxel.initDeep(voxel.point(), voxel.data(), m_pointSize);
+        node.voxels.emplace(key.position(), entry);
+        return true;
+    }
+
+    Voxel& dst(it->second.voxel);
+    if (m_dedup && voxel.point() == dst.point())
+    {
+        metrics::add(metrics::Counter::Duplicates);
+        return true;
+    }
+    if (replaces(voxel.point(), dst.point(), key))
+    {
+        voxel.swapDeep(dst, m_pointSize);
+    }
+    return false;
+}
+
+bool Stage::replaces(
+    const Point& incoming,
+    const Point& current,
+    const Key& key) const
+{
+    switch (m_policy)
+    {
+        case VoxelPolicy::First:
+            return voxel::replaces<VoxelPolicy::First>(incoming, current, key);
+        case VoxelPolicy::MaxZ:
+            return voxel::replaces<VoxelPolicy::MaxZ>(incoming, current, key);
+        case VoxelPolicy::MinZ:
+            return voxel::replaces<VoxelPolicy::MinZ>(incoming, current, key);
+        case VoxelPolicy::Random:
+            return voxel::replaces<VoxelPolicy::Random>(incoming, current, key);
+        default:
+            return voxel::replaces<VoxelPolicy::Closest>(
+                incoming,
+                current,
+                key);
+    }
+}
+
+void Stage::defer(Node& node, const Voxel& voxel, const Key& key)
+{
+    Insertion entry(key);
+    entry.voxel.setData(next());
+    entry.voxel.initDeep(voxel.point(), voxel.data(), m_pointSize);
+    node.deferred.push_back(entry);
+}
+
+void Stage::merge(Clipper& clipper)
+{
+    if (!m_block.size()) return;
+
+    // While merging, insertions into our depths go to the shared chunks.
+    m_merging = true;
+
+    // Our winners are inserted ahead of our deferred losers, so that they
+    // contend for the shared voxels in the same order they would have.
+    for (auto& nodes : m_nodes)
+    {
+        for (auto& p : nodes)
+        {
+            Node& node(p.second);
+
+            Insertions group;
+            group.reserve(node.voxels.size() + node.deferred.size());
+            for (auto& v : node.voxels) group.push_back(v.second);
+            for (auto& d : node.deferred) group.push_back(d);
+
+            m_cache.insert(group, node.ck, clipper);
+        }
+
+        nodes.clear();
+    }
+
+    m_merging = false;
+
+    m_cache.removeResident(m_block.bytes());
+    m_block.clear();
+}
+
+char* Stage::next()
+{
+    const uint64_t before(m_block.bytes());
+    char* pos(m_block.next());
+    if (const uint64_t allocated = m_block.bytes() - before)
+    {
+        m_cache.addResident(allocated);
+    }
+    return pos;
+}
+
+} // namespace entwine
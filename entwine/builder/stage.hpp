@@ -0,0 +1,89 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include <entwine/builder/overflow.hpp>
+#include <entwine/builder/voxel-policy.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/types/voxel.hpp>
+
+namespace entwine
+{
+
+class ChunkCache;
+class Clipper;
+
+// A private voxel grid for the shallowest depths of the tree, owned by the
+// Clipper of a single thread.  Points destined for these depths are resolved
+// against the other points of this thread, with the same rule as Chunk::insert
+// but without any locking, and are merged into the shared chunks in bulk when
+// our Clipper clips.
+class Stage
+{
+public:
+    struct Node
+    {
+        explicit Node(const ChunkKey& ck) : ck(ck) { }
+
+        ChunkKey ck;
+        std::unordered_map<Xyz, Insertion> voxels;
+
+        // Points which lost locally, but which the shared chunk would hold as
+        // overflow rather than passing downward.
+        Insertions deferred;
+    };
+
+    Stage(ChunkCache& cache, const Metadata& metadata, uint64_t depth);
+
+    // Returns true if insertions into this chunk key should be staged here.
+    bool covers(const ChunkKey& ck) const
+    {
+        return !m_merging && ck.depth() < m_depth;
+    }
+
+    Node& node(const ChunkKey& ck);
+
+    // Returns true if the point now occupies its voxel, or was dropped as a
+    // duplicate of its occupant.  Otherwise, voxel holds whichever point lost,
+    // which must be sent downward or deferred.
+    bool insert(Node& node, Voxel& voxel, const Key& key);
+    void defer(Node& node, const Voxel& voxel, const Key& key);
+
+    // Insert everything staged into the shared tree, shallowest first, and
+    // release our memory.
+    void merge(Clipper& clipper);
+
+private:
+    char* next();
+    bool replaces(
+        const Point& incoming,
+        const Point& current,
+        const Key& key) const;
+
+    ChunkCache& m_cache;
+    const uint64_t m_depth;
+    const uint64_t m_pointSize;
+    const VoxelPolicy m_policy;
+    const bool m_dedup;
+
+    MemBlock m_block;
+    std::vector<std::map<Xyz, Node>> m_nodes;
+    bool m_merging = false;
+};
+
+} // namespace entwine
@@ -0,0 +1,114 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <entwine/types/key.hpp>
+#include <entwine/types/point.hpp>
+
+namespace entwine
+{
+
+// The rule by which two points contending for the same voxel are resolved.
+// The winner keeps the voxel, and the loser moves on toward the leaves.
+enum class VoxelPolicy
+{
+    Closest,    // Nearest to the center of the voxel.
+    First,      // Whichever arrived first, so no comparison is made.
+    MaxZ,       // Highest.
+    MinZ,       // Lowest.
+    Random      // Smallest hash of its coordinates, independent of order.
+};
+
+// Names are validated by our configuration, so anything unknown is Closest.
+inline VoxelPolicy toVoxelPolicy(const std::string& s)
+{
+    if (s == "first") return VoxelPolicy::First;
+    if (s == "maxz") return VoxelPolicy::MaxZ;
+    if (s == "minz") return VoxelPolicy::MinZ;
+    if (s == "random") return VoxelPolicy::Random;
+    return VoxelPolicy::Closest;
+}
+
+namespace voxel
+{
+
+inline uint64_t hash(const Point& p)
+{
+    uint64_t h(0);
+    for (const double v : { p.x, p.y, p.z })
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        h ^= bits + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Returns true if the incoming point should take the voxel of the current
+// one, which occupies this key.
+template <VoxelPolicy P>
+bool replaces(const Point& incoming, const Point& current, const Key& key);
+
+template <>
+inline bool replaces<VoxelPolicy::Closest>(
+    const Point& incoming,
+    const Point& current,
+    const Key& key)
+{
+    const Point mid(key.mid());
+    return incoming.sqDist3d(mid) < current.sqDist3d(mid);
+}
+
+template <>
+inline bool replaces<VoxelPolicy::First>(
+    const Point&,
+    const Point&,
+    const Key&)
+{
+    return false;
+}
+
+template <>
+inline bool replaces<VoxelPolicy::MaxZ>(
+    const Point& incoming,
+    const Point& current,
+    const Key&)
+{
+    return incoming.z > current.z;
+}
+
+template <>
+inline bool replaces<VoxelPolicy::MinZ>(
+    const Point& incoming,
+    const Point& current,
+    const Key&)
+{
+    return incoming.z < current.z;
+}
+
+template <>
+inline bool replaces<VoxelPolicy::Random>(
+    const Point& incoming,
+    const Point& current,
+    const Key&)
+{
+    return hash(incoming) < hash(current);
+}
+
+} // namespace voxel
+} // namespace entwine
@@ -11,13 +11,17 @@
 #include <entwine/io/binary.hpp>
 
 #include <algorithm>
-
-#include <pdal/PointRef.hpp>
-
-#include <entwine/types/dimension.hpp>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/types/copy-plan.hpp>
 #include <entwine/types/metadata.hpp>
-#include <entwine/types/scale-offset.hpp>
 #include <entwine/util/io.hpp>
+#include <entwine/util/mapped-file.hpp>
 
 namespace entwine
 {
@@ -26,6 +30,78 @@ namespace io
 namespace binary
 {
 
+namespace
+{
+
+// The type, and scaling if any, of XYZ within a packed node, and the number
+// of units of that scale to which each value is rounded, if it is lossy.
+struct PackedXyz
+{
+    DimType type = DimType::Double;
+    optional<ScaleOffset> so;
+    optional<std::array<double, 3>> quantum;
+};
+
+PackedXyz getPackedXyz(const Metadata& m, const Bounds& bounds)
+{
+    PackedXyz xyz;
+    xyz.type = find(m.schema, "X").type;
+    xyz.so = getScaleOffset(m.schema);
+    if (!xyz.so) return xyz;
+
+    ScaleOffset& so(*xyz.so);
+
+    // Shallow nodes are rounded to a power of two multiple of our scale, to
+    // the largest step within a small fraction of their voxel size.  They are
+    // still packed at our scale, so any reader decodes them as usual, while
+    // their zeroed low bits compress well.
+    const double ratio(m.bounds.width() / bounds.width());
+    if (std::llround(std::log2(ratio)) < int64_t(m.internal.lossyDepth))
+    {
+        const double step(
+            bounds.width() / m.span / heuristics::lossyVoxelSteps);
+        std::array<double, 3> quantum = { { 1, 1, 1 } };
+        for (std::size_t i(0); i < 3; ++i)
+        {
+            while (so.scale[i] * quantum[i] * 2 <= step) quantum[i] *= 2;
+        }
+        xyz.quantum = quantum;
+    }
+
+    if (!m.internal.relativeXyz) return xyz;
+
+    // Points may be rounded onto the faces of their node, so a margin of one
+    // unit on each side covers every point which it may hold.
+    std::array<double, 3> mins;
+    uint64_t extent(0);
+    for (std::size_t i(0); i < 3; ++i)
+    {
+        const double s(so.scale[i]);
+        const double o(so.offset[i]);
+        const double lo(std::floor((bounds.min()[i] - o) / s) - 1);
+        const double hi(std::ceil((bounds.max()[i] - o) / s) + 1);
+        mins[i] = lo;
+        extent = std::max<uint64_t>(extent, hi - lo);
+    }
+
+    if (extent > std::numeric_limits<uint32_t>::max()) return xyz;
+
+    xyz.type = DimType::Unsigned32;
+    if (extent <= std::numeric_limits<uint8_t>::max())
+    {
+        xyz.type = DimType::Unsigned8;
+    }
+    else if (extent <= std::numeric_limits<uint16_t>::max())
+    {
+        xyz.type = DimType::Unsigned16;
+    }
+
+    for (std::size_t i(0); i < 3; ++i) so.offset[i] += mins[i] * so.scale[i];
+    return xyz;
+}
+
+} // unnamed namespace
+
 void write(
     const Metadata& metadata,
     const Endpoints& endpoints,
@@ -33,128 +109,143 @@ void write(
     BlockPointTable& table,
     const Bounds bounds)
 {
-    const auto packed = pack(metadata, table);
-    ensurePut(endpoints.data, filename + ".bin", packed);
+    putData(
+        endpoints,
+        filename + ".bin",
+        pack(getPackedPlan(metadata, bounds), table));
 }
 
 void read(
     const Metadata& metadata,
     const Endpoints& endpoints,
     const std::string filename,
-    VectorPointTable& table)
+    VectorPointTable& table,
+    const Bounds bounds)
 {
+    const CopyPlan plan(getPackedPlan(metadata, bounds));
+    if (auto cached = takeData(endpoints, filename + ".bin"))
+    {
+        unpack(plan, table, std::move(*cached));
+        return;
+    }
+
+    // Local nodes are unpacked straight from a mapping of the file.
+    if (auto mapped = MappedFile::create(endpoints.data, filename + ".bin"))
+    {
+        unpack(plan, table, mapped->data(), mapped->size());
+        return;
+    }
+
     auto packed = ensureGetBinary(endpoints.data, filename + ".bin");
-    unpack(metadata, table, std::move(packed));
+    unpack(plan, table, std::move(packed));
 }
 
-std::vector<char> pack(const Metadata& m, BlockPointTable& src)
+Schema getPackedSchema(const Metadata& m, const Bounds& bounds)
 {
-    const uint64_t np(src.size());
-
-    auto layout = toLayout(m.schema);
-    VectorPointTable dst(layout, np);
-
-    // Handle XYZ separately since we might need to scale/offset them.
-    const Schema others = omit(m.schema, { "X", "Y", "Z" });
-    struct DimReg { DimId id; DimType type; uint64_t offset; };
-    const auto registrations = std::accumulate(
-        others.begin(),
-        others.end(),
-        std::vector<DimReg>(),
-        [&layout](std::vector<DimReg> v, const Dimension& d)
-        {
-            const DimId id = layout.findDim(d.name);
-            v.push_back({ id, d.type, layout.dimOffset(id) });
-            return v;
-        });
-
-    pdal::PointRef srcPr(src, 0);
-    pdal::PointRef dstPr(dst, 0);
-
-    Point p;
-
-    const auto so = getScaleOffset(m.schema);
+    const PackedXyz xyz(getPackedXyz(m, bounds));
 
-    for (uint64_t i(0); i < np; ++i)
+    Schema schema(m.schema);
+    if (xyz.so) schema = setScaleOffset(schema, *xyz.so);
+    for (const std::string name : { "X", "Y", "Z" })
     {
-        srcPr.setPointId(i);
-        dstPr.setPointId(i);
-        char* pos(dst.getPoint(i));
-
-        // Handle XYZ, applying transformation if needed.
-        p.x = srcPr.getFieldAs<double>(DimId::X);
-        p.y = srcPr.getFieldAs<double>(DimId::Y);
-        p.z = srcPr.getFieldAs<double>(DimId::Z);
+        find(schema, name).type = xyz.type;
+    }
+    return schema;
+}
 
-        if (so) p = Point::scale(p, so->scale, so->offset).round();
+CopyPlan getPackedPlan(const Metadata& m, const Bounds& bounds)
+{
+    const PackedXyz xyz(getPackedXyz(m, bounds));
+    const CopyPlan plan(m.layouts->plan(xyz.type, xyz.so));
+    return xyz.quantum ? plan.quantized(*xyz.quantum) : plan;
+}
 
-        dstPr.setField(DimId::X, p.x);
-        dstPr.setField(DimId::Y, p.y);
-        dstPr.setField(DimId::Z, p.z);
+std::vector<char> pack(const CopyPlan& plan, BlockPointTable& src)
+{
+    std::vector<char> packed;
+    pack(plan, src, packed);
+    return packed;
+}
 
-        // Handle the rest of the dimensions.
-        for (const auto& dim : registrations)
-        {
-            srcPr.getField(pos + dim.offset, dim.id, dim.type);
-        }
-    }
+void pack(const CopyPlan& plan, BlockPointTable& src, std::vector<char>& dst)
+{
+    const uint64_t pointSize(plan.packedPointSize());
+    dst.resize(src.size() * pointSize);
+    char* pos(dst.data());
 
-    return dst.data();
+    src.forEach([&](const char* point)
+    {
+        plan.pack(point, pos);
+        pos += pointSize;
+    });
 }
 
 void unpack(
-    const Metadata& m,
+    const CopyPlan& plan,
     VectorPointTable& dst,
     std::vector<char>&& packed)
 {
-    auto scaledLayout = toLayout(m.schema);
-    VectorPointTable src(scaledLayout, std::move(packed));
+    unpack(plan, dst, packed.data(), packed.size());
+}
 
-    const uint64_t np(src.capacity());
-    assert(np == dst.capacity());
+void unpack(
+    const CopyPlan& plan,
+    VectorPointTable& dst,
+    const char* const data,
+    const uint64_t size)
+{
+    const uint64_t pointSize(plan.packedPointSize());
 
-    // For reading, our destination schema will always be normalized (i.e. XYZ
-    // as doubles).  So we can just copy the full dimension list and then
-    // transform XYZ in place, if necessary.
-    auto absoluteLayout = toLayout(m.absoluteSchema);
-    pdal::DimTypeList dimTypes(absoluteLayout.dimTypes());
+    if (!pointSize) throw std::runtime_error("Invalid schema of size 0");
+    if (size % pointSize != 0)
+    {
+        throw std::runtime_error("Invalid binary data");
+    }
 
-    pdal::PointRef srcPr(src, 0);
-    pdal::PointRef dstPr(dst, 0);
+    // For reading, our destination schema will always be normalized (i.e. XYZ
+    // as doubles), which is the absolute layout of our plan.
+    const uint64_t np(size / pointSize);
+    assert(np == dst.capacity());
 
-    Point p;
+    const char* pos(data);
+    for (uint64_t i(0); i < np; ++i, pos += pointSize)
+    {
+        plan.unpack(pos, dst.getPoint(i));
+    }
 
-    const auto so = getScaleOffset(m.schema);
+    dst.clear(np);
+}
 
-    for (uint64_t i(0); i < np; ++i)
-    {
-        srcPr.setPointId(i);
-        dstPr.setPointId(i);
-        char* pos(dst.getPoint(i));
+uint64_t getPackedSize(const CopyPlan& plan, VectorPointTable& table)
+{
+    return table.capacity() * plan.packedPointSize();
+}
 
-        for (const pdal::DimType& dim : dimTypes)
-        {
-            srcPr.getField(
-                    pos + absoluteLayout.dimOffset(dim.m_id),
-                    dim.m_id,
-                    dim.m_type);
-        }
+char* getPackedPosition(const CopyPlan& plan, VectorPointTable& table)
+{
+    // The packed points occupy the tail of the storage.  Since packed points
+    // are never larger than absolute ones, converting from front to back never
+    // overwrites a packed point before it has been read.
+    std::vector<char>& data(table.data());
+    return data.data() + data.size() - getPackedSize(plan, table);
+}
 
-        if (so)
-        {
-            p.x = dstPr.getFieldAs<double>(DimId::X);
-            p.y = dstPr.getFieldAs<double>(DimId::Y);
-            p.z = dstPr.getFieldAs<double>(DimId::Z);
+void unpackInPlace(const CopyPlan& plan, VectorPointTable& table)
+{
+    const uint64_t np(table.capacity());
+    assert(plan.absolutePointSize() == table.pointSize());
 
-            p = Point::unscale(p, so->scale, so->offset);
+    const char* pos(getPackedPosition(plan, table));
+    std::vector<char> point(plan.packedPointSize());
 
-            dstPr.setField(DimId::X, p.x);
-            dstPr.setField(DimId::Y, p.y);
-            dstPr.setField(DimId::Z, p.z);
-        }
+    for (uint64_t i(0); i < np; ++i, pos += plan.packedPointSize())
+    {
+        // The destination of a point may overlap its own source.
+        std::copy(pos, pos + point.size(), point.data());
+        plan.unpack(point.data(), table.getPoint(i));
     }
 
-    dst.clear(np);
+    table.clear(np);
 }
 
 } // namespace binary
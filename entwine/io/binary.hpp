@@ -14,6 +14,8 @@
 #include <vector>
 
 #include <entwine/types/bounds.hpp>
+#include <entwine/types/copy-plan.hpp>
+#include <entwine/types/dimension.hpp>
 #include <entwine/types/endpoints.hpp>
 #include <entwine/types/vector-point-table.hpp>
 
@@ -27,11 +29,38 @@ namespace io
 namespace binary
 {
 
-std::vector<char> pack(const Metadata& metadata, BlockPointTable& src);
+// The schema in which the points of the node with these bounds are packed.
+// If our build stores relative coordinates, this is our schema with XYZ as
+// unsigned offsets from the minimum corner of the node, at our scale, in the
+// narrowest type which covers the node.  Nodes above our lossy depth keep
+// this schema, but their XYZ are rounded to a coarser step of it.
+Schema getPackedSchema(const Metadata& m, const Bounds& bounds);
+
+// The plan between our absolute layout and the packed schema above, which is
+// derived from the shared layouts of our metadata rather than built anew, and
+// which performs any rounding of lossy nodes.
+CopyPlan getPackedPlan(const Metadata& m, const Bounds& bounds);
+
+std::vector<char> pack(const CopyPlan& plan, BlockPointTable& src);
+
+// Pack into this buffer, whose existing capacity is reused.
+void pack(const CopyPlan& plan, BlockPointTable& src, std::vector<char>& dst);
 void unpack(
-    const Metadata& m,
+    const CopyPlan& plan,
     VectorPointTable& dst,
     std::vector<char>&& buffer);
+void unpack(
+    const CopyPlan& plan,
+    VectorPointTable& dst,
+    const char* data,
+    uint64_t size);
+
+// To unpack without an intermediate buffer, the packed points for the entire
+// capacity of the table may be placed in its own storage at the position
+// given by getPackedPosition, and then converted by unpackInPlace.
+uint64_t getPackedSize(const CopyPlan& plan, VectorPointTable& table);
+char* getPackedPosition(const CopyPlan& plan, VectorPointTable& table);
+void unpackInPlace(const CopyPlan& plan, VectorPointTable& table);
 
 void write(
     const Metadata& Metadata,
@@ -44,7 +73,8 @@ void read(
     const Metadata& metadata,
     const Endpoints& endpoints,
     std::string filename,
-    VectorPointTable& table);
+    VectorPointTable& table,
+    const Bounds bounds);
 
 } // namespace binary
 } // namespace io
@@ -0,0 +1,567 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/io/columnar.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <entwine/io/binary.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/io/zstandard.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/util/io.hpp>
+#include <entwine/util/scratch.hpp>
+
+namespace entwine
+{
+namespace io
+{
+namespace columnar
+{
+
+namespace
+{
+
+const std::string magic("ECOL");
+const uint32_t version(1);
+
+// The size of our first ranged read, which typically covers the directory.
+const uint64_t directoryGuess(4096);
+
+using Data = std::vector<char>;
+
+template <typename T>
+void append(Data& data, const T v)
+{
+    const char* p(reinterpret_cast<const char*>(&v));
+    data.insert(data.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+T extract(const Data& data, const uint64_t pos)
+{
+    if (pos + sizeof(T) > data.size())
+    {
+        throw std::runtime_error("Invalid columnar data: unexpected end");
+    }
+    T v;
+    std::memcpy(&v, data.data() + pos, sizeof(T));
+    return v;
+}
+
+Encoding getEncoding(const Dimension& d)
+{
+    const bool integral(
+        d.type != entwine::Type::Float && d.type != entwine::Type::Double);
+    const bool spatial(d.name == "X" || d.name == "Y" || d.name == "Z");
+
+    if (spatial && integral) return Encoding::Delta;
+    if (d.name == "Classification") return Encoding::RunLength;
+    if (d.type == entwine::Type::Unsigned8 && (
+            d.name == "ReturnNumber" ||
+            d.name == "NumberOfReturns" ||
+            d.name == "ScanDirectionFlag" ||
+            d.name == "EdgeOfFlightLine" ||
+            d.name == "ScanChannel"))
+    {
+        return Encoding::BitPack;
+    }
+    return Encoding::Raw;
+}
+
+// Zigzag-encode the wrapping differences between successive values, which
+// are all of the unsigned type U so the arithmetic is well-defined.
+template <typename U>
+Data deltaEncode(const Data& values)
+{
+    const uint64_t n(values.size() / sizeof(U));
+    const unsigned shift(sizeof(U) * 8 - 1);
+
+    Data out(values.size());
+    U prev(0);
+    for (uint64_t i(0); i < n; ++i)
+    {
+        U v;
+        std::memcpy(&v, values.data() + i * sizeof(U), sizeof(U));
+        const U d(v - prev);
+        const U z((U)(d << 1) ^ (U)(0 - (U)(d >> shift)));
+        std::memcpy(out.data() + i * sizeof(U), &z, sizeof(U));
+        prev = v;
+    }
+    return out;
+}
+
+template <typename U>
+Data deltaDecode(const Data& encoded)
+{
+    const uint64_t n(encoded.size() / sizeof(U));
+
+    Data out(encoded.size());
+    U prev(0);
+    for (uint64_t i(0); i < n; ++i)
+    {
+        U z;
+        std::memcpy(&z, encoded.data() + i * sizeof(U), sizeof(U));
+        const U d((U)(z >> 1) ^ (U)(0 - (U)(z & 1)));
+        prev = (U)(prev + d);
+        std::memcpy(out.data() + i * sizeof(U), &prev, sizeof(U));
+    }
+    return out;
+}
+
+Data deltaEncode(const Data& values, const uint8_t size)
+{
+    switch (size)
+    {
+        case 1: return deltaEncode<uint8_t>(values);
+        case 2: return deltaEncode<uint16_t>(values);
+        case 4: return deltaEncode<uint32_t>(values);
+        case 8: return deltaEncode<uint64_t>(values);
+        default: throw std::runtime_error("Invalid delta value size");
+    }
+}
+
+Data deltaDecode(const Data& encoded, const uint8_t size)
+{
+    switch (size)
+    {
+        case 1: return deltaDecode<uint8_t>(encoded);
+        case 2: return deltaDecode<uint16_t>(encoded);
+        case 4: return deltaDecode<uint32_t>(encoded);
+        case 8: return deltaDecode<uint64_t>(encoded);
+        default: throw std::runtime_error("Invalid delta value size");
+    }
+}
+
+Data runLengthEncode(const Data& values, const uint8_t size)
+{
+    Data out;
+    const uint64_t n(values.size() / size);
+
+    uint64_t i(0);
+    while (i < n)
+    {
+        const char* value(values.data() + i * size);
+        uint32_t run(1);
+        while (
+            i + run < n &&
+            run < std::numeric_limits<uint32_t>::max() &&
+            !std::memcmp(value, values.data() + (i + run) * size, size))
+        {
+            ++run;
+        }
+
+        out.insert(out.end(), value, value + size);
+        append(out, run);
+        i += run;
+    }
+    return out;
+}
+
+Data runLengthDecode(
+    const Data& encoded,
+    const uint8_t size,
+    const uint64_t points)
+{
+    Data out;
+    out.reserve(points * size);
+
+    uint64_t pos(0);
+    while (pos < encoded.size())
+    {
+        const uint32_t run(extract<uint32_t>(encoded, pos + size));
+        if (out.size() / size + run > points)
+        {
+            throw std::runtime_error("Invalid run-length column");
+        }
+        for (uint32_t i(0); i < run; ++i)
+        {
+            out.insert(
+                out.end(),
+                encoded.begin() + pos,
+                encoded.begin() + pos + size);
+        }
+        pos += size + sizeof(uint32_t);
+    }
+    return out;
+}
+
+Data bitPack(const Data& values)
+{
+    uint8_t most(0);
+    for (const char c : values) most |= static_cast<uint8_t>(c);
+
+    uint8_t bits(0);
+    while (bits < 8 && (most >> bits)) ++bits;
+
+    Data out(1, static_cast<char>(bits));
+    out.reserve(1 + (values.size() * bits + 7) / 8);
+
+    uint64_t buffer(0);
+    unsigned buffered(0);
+    for (const char c : values)
+    {
+        buffer |= static_cast<uint64_t>(static_cast<uint8_t>(c)) << buffered;
+        buffered += bits;
+        while (buffered >= 8)
+        {
+            out.push_back(static_cast<char>(buffer & 0xff));
+            buffer >>= 8;
+            buffered -= 8;
+        }
+    }
+    if (buffered) out.push_back(static_cast<char>(buffer & 0xff));
+    return out;
+}
+
+Data bitUnpack(const Data& encoded, const uint64_t points)
+{
+    const uint8_t bits(extract<uint8_t>(encoded, 0));
+    if (bits > 8) throw std::runtime_error("Invalid bit-packed column");
+    if (1 + (points * bits + 7) / 8 > encoded.size())
+    {
+        throw std::runtime_error("Invalid bit-packed column");
+    }
+
+    Data out(points, 0);
+    if (!bits) return out;
+
+    const uint64_t mask((1u << bits) - 1);
+    uint64_t buffer(0);
+    unsigned buffered(0);
+    uint64_t pos(1);
+    for (uint64_t i(0); i < points; ++i)
+    {
+        while (buffered < bits)
+        {
+            buffer |= static_cast<uint64_t>(
+                static_cast<uint8_t>(encoded[pos++])) << buffered;
+            buffered += 8;
+        }
+        out[i] = static_cast<char>(buffer & mask);
+        buffer >>= bits;
+        buffered -= bits;
+    }
+    return out;
+}
+
+} // unnamed namespace
+
+std::vector<char> encode(
+    const std::vector<char>& values,
+    const Encoding encoding,
+    const uint8_t size)
+{
+    switch (encoding)
+    {
+        case Encoding::Raw: return values;
+        case Encoding::Delta: return deltaEncode(values, size);
+        case Encoding::RunLength: return runLengthEncode(values, size);
+        case Encoding::BitPack: return bitPack(values);
+        default: throw std::runtime_error("Invalid column encoding");
+    }
+}
+
+std::vector<char> decode(
+    const std::vector<char>& encoded,
+    const Encoding encoding,
+    const uint8_t size,
+    const uint64_t points)
+{
+    switch (encoding)
+    {
+        case Encoding::Raw: return encoded;
+        case Encoding::Delta: return deltaDecode(encoded, size);
+        case Encoding::RunLength:
+            return runLengthDecode(encoded, size, points);
+        case Encoding::BitPack: return bitUnpack(encoded, points);
+        default: throw std::runtime_error("Invalid column encoding");
+    }
+}
+
+uint64_t getDirectoryEnd(const std::vector<char>& data)
+{
+    if (data.size() < headerSize || std::string(data.data(), 4) != magic)
+    {
+        throw std::runtime_error("Invalid columnar data: bad header");
+    }
+    if (extract<uint32_t>(data, 4) != version)
+    {
+        throw std::runtime_error("Unsupported columnar data version");
+    }
+    return headerSize + extract<uint32_t>(data, 20);
+}
+
+Directory parseDirectory(const std::vector<char>& data)
+{
+    const uint64_t end(getDirectoryEnd(data));
+    if (data.size() < end)
+    {
+        throw std::runtime_error("Invalid columnar data: short directory");
+    }
+
+    Directory directory;
+    directory.points = extract<uint64_t>(data, 8);
+    const uint32_t count(extract<uint32_t>(data, 16));
+
+    uint64_t pos(headerSize);
+    for (uint32_t i(0); i < count; ++i)
+    {
+        Column column;
+        const uint16_t length(extract<uint16_t>(data, pos));
+        pos += sizeof(uint16_t);
+        if (pos + length > end)
+        {
+            throw std::runtime_error("Invalid columnar data: bad directory");
+        }
+        column.name.assign(data.data() + pos, length);
+        pos += length;
+
+        column.encoding = static_cast<Encoding>(extract<uint8_t>(data, pos));
+        column.size = extract<uint8_t>(data, pos + 1);
+        column.offset = extract<uint64_t>(data, pos + 2);
+        column.bytes = extract<uint64_t>(data, pos + 10);
+        pos += 18;
+
+        directory.columns.push_back(column);
+    }
+    return directory;
+}
+
+std::vector<char> decode(
+    const Column& column,
+    const char* data,
+    const uint64_t points)
+{
+    const Data values(
+        decode(
+            zstandard::decompress(Data(data, data + column.bytes)),
+            column.encoding,
+            column.size,
+            points));
+
+    if (values.size() != points * column.size)
+    {
+        throw std::runtime_error("Invalid column size for " + column.name);
+    }
+    return values;
+}
+
+std::vector<std::vector<char>> readColumns(
+    const Endpoints& endpoints,
+    const std::string filename,
+    const StringList& names)
+{
+    const std::string path(filename + ".col");
+    const arbiter::Endpoint& ep(endpoints.data);
+
+    // Without ranged reads, we can only fetch the whole node and decode the
+    // requested columns from it.
+    const bool ranged(ep.isHttpDerived());
+    Data head;
+
+    // Otherwise, fetch the header, then the directory if it did not fit in our
+    // first range, and then only the requested columns.
+    if (ranged)
+    {
+        head = ep.getBinary(path, getRangeHeader(0, directoryGuess));
+        const uint64_t end(getDirectoryEnd(head));
+        if (head.size() < end)
+        {
+            head = ep.getBinary(path, getRangeHeader(0, end));
+        }
+    }
+    else head = ensureGetBinary(ep, path);
+
+    const Directory directory(parseDirectory(head));
+
+    std::vector<std::vector<char>> columns;
+    for (const std::string& name : names)
+    {
+        const auto it(
+            std::find_if(
+                directory.columns.begin(),
+                directory.columns.end(),
+                [&name](const Column& c) { return c.name == name; }));
+        if (it == directory.columns.end())
+        {
+            throw std::runtime_error("No column " + name + " in " + path);
+        }
+
+        if (!ranged)
+        {
+            if (it->offset + it->bytes > head.size())
+            {
+                throw std::runtime_error("Invalid column data for " + name);
+            }
+            columns.push_back(
+                decode(*it, head.data() + it->offset, directory.points));
+            continue;
+        }
+
+        const Data data(
+            ep.getBinary(
+                path,
+                getRangeHeader(it->offset, it->offset + it->bytes)));
+        if (data.size() != it->bytes)
+        {
+            throw std::runtime_error("Invalid column data for " + name);
+        }
+        columns.push_back(decode(*it, data.data(), directory.points));
+    }
+    return columns;
+}
+
+void write(
+    const Metadata& metadata,
+    const Endpoints& endpoints,
+    const std::string filename,
+    BlockPointTable& table,
+    const Bounds bounds)
+{
+    Scratch<char> scratch;
+    binary::pack(metadata.layouts->plan(), table, scratch.get());
+    const Data& packed(scratch.get());
+    const pdal::PointLayout& layout(metadata.layouts->packed());
+    const uint64_t pointSize(layout.pointSize());
+    const uint64_t points(packed.size() / pointSize);
+    const uint64_t depth(getDepth(filename));
+
+    // Transpose each dimension into its own column, then encode and compress
+    // it independently.
+    std::vector<Column> columns;
+    std::vector<Data> payloads;
+    uint32_t directorySize(0);
+
+    Scratch<char> transposed;
+    Data& values(transposed.get());
+    for (const Dimension& d : metadata.schema)
+    {
+        const DimId id(layout.findDim(d.name));
+        const uint64_t offset(layout.dimOffset(id));
+
+        Column column;
+        column.name = d.name;
+        column.encoding = getEncoding(d);
+        column.size = layout.dimSize(id);
+
+        values.resize(points * column.size);
+        for (uint64_t i(0); i < points; ++i)
+        {
+            std::memcpy(
+                values.data() + i * column.size,
+                packed.data() + i * pointSize + offset,
+                column.size);
+        }
+
+        payloads.push_back(
+            zstandard::compress(
+                metadata,
+                depth,
+                encode(values, column.encoding, column.size)));
+        column.bytes = payloads.back().size();
+
+        columns.push_back(column);
+        directorySize += sizeof(uint16_t) + column.name.size() + 18;
+    }
+
+    Data data;
+    data.insert(data.end(), magic.begin(), magic.end());
+    append(data, version);
+    append(data, points);
+    append(data, static_cast<uint32_t>(columns.size()));
+    append(data, directorySize);
+
+    uint64_t offset(headerSize + directorySize);
+    for (Column& column : columns)
+    {
+        column.offset = offset;
+        offset += column.bytes;
+
+        append(data, static_cast<uint16_t>(column.name.size()));
+        data.insert(data.end(), column.name.begin(), column.name.end());
+        append(data, static_cast<uint8_t>(column.encoding));
+        append(data, column.size);
+        append(data, column.offset);
+        append(data, column.bytes);
+    }
+
+    for (const Data& payload : payloads)
+    {
+        data.insert(data.end(), payload.begin(), payload.end());
+    }
+
+    putData(endpoints, filename + ".col", std::move(data));
+}
+
+void read(
+    const Metadata& metadata,
+    const Endpoints& endpoints,
+    const std::string filename,
+    VectorPointTable& table,
+    const Bounds bounds)
+{
+    auto cached(takeData(endpoints, filename + ".col"));
+    const Data data(
+        cached ?
+            std::move(*cached) :
+            ensureGetBinary(endpoints.data, filename + ".col"));
+    const Directory directory(parseDirectory(data));
+
+    const pdal::PointLayout& layout(metadata.layouts->packed());
+    const CopyPlan& plan(metadata.layouts->plan());
+    const uint64_t pointSize(layout.pointSize());
+    const uint64_t points(directory.points);
+
+    if (points * pointSize != binary::getPackedSize(plan, table))
+    {
+        throw std::runtime_error("Invalid point count for " + filename);
+    }
+    if (directory.columns.size() != metadata.schema.size())
+    {
+        throw std::runtime_error("Invalid column count for " + filename);
+    }
+
+    // Scatter each column into the packed points at the tail of the table's
+    // own storage, and then expand them in place.
+    char* const pos(binary::getPackedPosition(plan, table));
+    for (const Column& column : directory.columns)
+    {
+        const DimId id(layout.findDim(column.name));
+        if (id == DimId::Unknown || layout.dimSize(id) != column.size)
+        {
+            throw std::runtime_error("Invalid column " + column.name);
+        }
+        if (column.offset + column.bytes > data.size())
+        {
+            throw std::runtime_error("Invalid column data for " + column.name);
+        }
+
+        const Data values(
+            decode(column, data.data() + column.offset, points));
+        const uint64_t offset(layout.dimOffset(id));
+        for (uint64_t i(0); i < points; ++i)
+        {
+            std::memcpy(
+                pos + i * pointSize + offset,
+                values.data() + i * column.size,
+                column.size);
+        }
+    }
+
+    binary::unpackInPlace(plan, table);
+}
+
+} // namespace columnar
+} // namespace io
+} // namespace entwine
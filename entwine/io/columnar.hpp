@@ -0,0 +1,128 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/defs.hpp>
+#include <entwine/types/endpoints.hpp>
+#include <entwine/types/vector-point-table.hpp>
+
+namespace entwine
+{
+
+struct Metadata;
+
+namespace io
+{
+namespace columnar
+{
+
+// Each dimension of a node is stored as its own column, encoded according to
+// its contents and then compressed with zstandard.  A node file consists of a
+// fixed-size header, then a directory of columns, then the column data, so
+// readers needing only some dimensions may fetch the header and directory and
+// then range-read only the columns they need.
+//
+// All values are little-endian.  The header consists of:
+//      char[4] magic ("ECOL"), uint32 version, uint64 point count,
+//      uint32 column count, uint32 directory size in bytes
+//
+// Each directory entry consists of:
+//      uint16 name length, char[] name, uint8 encoding, uint8 value size,
+//      uint64 absolute offset of the column data, uint64 size of that data
+enum class Encoding : uint8_t
+{
+    // Values as they are.
+    Raw = 0,
+
+    // Differences from the previous value, zigzag-encoded so small negative
+    // differences remain small, of the same size as the values.
+    Delta = 1,
+
+    // Pairs of a value and a uint32 count of its repetitions.
+    RunLength = 2,
+
+    // A uint8 bit width, followed by single-byte values packed at that width,
+    // least significant bits first.
+    BitPack = 3
+};
+
+struct Column
+{
+    std::string name;
+    Encoding encoding = Encoding::Raw;
+    uint8_t size = 0;
+    uint64_t offset = 0;
+    uint64_t bytes = 0;
+};
+
+struct Directory
+{
+    uint64_t points = 0;
+    std::vector<Column> columns;
+};
+
+const uint64_t headerSize(24);
+
+// Returns the combined size of the header and directory of a node file, given
+// at least its first headerSize bytes.
+uint64_t getDirectoryEnd(const std::vector<char>& data);
+
+// Parse the header and directory of a node file, given at least its first
+// getDirectoryEnd bytes.
+Directory parseDirectory(const std::vector<char>& data);
+
+// Encode the packed values of a single column, each of this size, prior to
+// compression, and the reverse.
+std::vector<char> encode(
+    const std::vector<char>& values,
+    Encoding encoding,
+    uint8_t size);
+std::vector<char> decode(
+    const std::vector<char>& encoded,
+    Encoding encoding,
+    uint8_t size,
+    uint64_t points);
+
+// Decompress and decode the data of a single column into its packed values.
+std::vector<char> decode(
+    const Column& column,
+    const char* data,
+    uint64_t points);
+
+// Fetch and decode only the named columns of a node with range reads, in the
+// order requested.
+std::vector<std::vector<char>> readColumns(
+    const Endpoints& endpoints,
+    std::string filename,
+    const StringList& names);
+
+void write(
+    const Metadata& Metadata,
+    const Endpoints& endpoints,
+    const std::string filename,
+    BlockPointTable& table,
+    const Bounds bounds);
+
+void read(
+    const Metadata& metadata,
+    const Endpoints& endpoints,
+    std::string filename,
+    VectorPointTable& table,
+    const Bounds bounds);
+
+} // namespace columnar
+} // namespace io
+} // namespace entwine
@@ -12,6 +12,8 @@
 
 #include <stdexcept>
 
+#include <entwine/types/metadata.hpp>
+
 namespace entwine
 {
 namespace io
@@ -22,6 +24,7 @@ Type toType(const std::string s)
     if (s == "binary") return Type::Binary;
     if (s == "laszip") return Type::Laszip;
     if (s == "zstandard") return Type::Zstandard;
+    if (s == "columnar") return Type::Columnar;
     throw std::runtime_error("Invalid data IO type: " + s);
 }
 
@@ -30,6 +33,40 @@ std::string toString(const Type t)
     if (t == Type::Binary) return "binary";
     if (t == Type::Laszip) return "laszip";
     if (t == Type::Zstandard) return "zstandard";
+    if (t == Type::Columnar) return "columnar";
+    throw std::runtime_error("Invalid data IO enumeration");
+}
+
+Type getNodeType(const Metadata& m, const uint64_t depth)
+{
+    const std::string& shared(m.internal.subsetDataType);
+    if (shared.size() && depth < getSharedDepth(m)) return toType(shared);
+
+    for (const DataTier& tier : m.internal.dataTiers)
+    {
+        if (depth < tier.below) return toType(tier.dataType);
+    }
+    return m.dataType;
+}
+
+int getZstdLevel(const Metadata& m, const uint64_t depth)
+{
+    for (const DataTier& tier : m.internal.dataTiers)
+    {
+        if (depth < tier.below)
+        {
+            return tier.zstdLevel ? tier.zstdLevel : m.internal.zstdLevel;
+        }
+    }
+    return m.internal.zstdLevel;
+}
+
+std::string toExtension(const Type t)
+{
+    if (t == Type::Binary) return ".bin";
+    if (t == Type::Laszip) return ".laz";
+    if (t == Type::Zstandard) return ".zst";
+    if (t == Type::Columnar) return ".col";
     throw std::runtime_error("Invalid data IO enumeration");
 }
 
@@ -17,8 +17,10 @@
 #include <entwine/types/endpoints.hpp>
 #include <entwine/types/vector-point-table.hpp>
 #include <entwine/util/json.hpp>
+#include <entwine/util/trace.hpp>
 
 #include <entwine/io/binary.hpp>
+#include <entwine/io/columnar.hpp>
 #include <entwine/io/laszip.hpp>
 #include <entwine/io/zstandard.hpp>
 
@@ -30,10 +32,34 @@ struct Metadata;
 namespace io
 {
 
-enum class Type { Binary, Laszip, Zstandard };
+enum class Type { Binary, Laszip, Zstandard, Columnar };
 
 Type toType(std::string s);
 std::string toString(Type t);
+
+// The extension of the node files written for this type.
+std::string toExtension(Type t);
+
+// The type in which the node at this depth is stored.  A subset build may
+// store its shared-depth nodes in an intermediate type, since the merge of
+// the subsets decodes them and writes them anew in our data type.  Otherwise,
+// the type of the first data tier which this depth is shallower than applies.
+Type getNodeType(const Metadata& m, uint64_t depth);
+
+// The extension of the node files at this depth.
+inline std::string getNodeExtension(const Metadata& m, uint64_t depth)
+{
+    return toExtension(getNodeType(m, depth));
+}
+
+// The zstandard level with which the node at this depth is compressed.
+int getZstdLevel(const Metadata& m, uint64_t depth);
+
+// The depth of the node written to this file, which is named for its key.
+inline uint64_t getDepth(const std::string& filename)
+{
+    return std::stoull(filename);
+}
 inline void to_json(json& j, Type t) { j = toString(t); }
 inline void from_json(const json& j, Type& t)
 {
@@ -43,11 +69,14 @@ inline void from_json(const json& j, Type& t)
 template <typename... Args>
 void write(Type type, Args&&... args)
 {
+    trace::Span span("write", toString(type));
+
     auto f = ([type]()
     {
         if (type == Type::Binary) return binary::write;
         if (type == Type::Laszip) return laszip::write;
         if (type == Type::Zstandard) return zstandard::write;
+        if (type == Type::Columnar) return columnar::write;
         throw std::runtime_error("Invalid data type");
     })();
 
@@ -62,6 +91,7 @@ void read(Type type, Args&&... args)
         if (type == Type::Binary) return binary::read;
         if (type == Type::Laszip) return laszip::read;
         if (type == Type::Zstandard) return zstandard::read;
+        if (type == Type::Columnar) return columnar::read;
         throw std::runtime_error("Invalid data type");
     })();
 
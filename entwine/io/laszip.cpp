@@ -10,13 +10,15 @@
 
 #include <entwine/io/laszip.hpp>
 
-#include <pdal/filters/SortFilter.hpp>
 #include <pdal/io/BufferReader.hpp>
 #include <pdal/io/LasReader.hpp>
 #include <pdal/io/LasWriter.hpp>
 
 #include <entwine/types/metadata.hpp>
+#include <entwine/types/point-order.hpp>
 #include <entwine/util/io.hpp>
+#include <entwine/util/mem-file.hpp>
+#include <entwine/util/metrics.hpp>
 #include <entwine/util/pdal-mutex.hpp>
 
 namespace entwine
@@ -37,10 +39,23 @@ void write(
     const arbiter::Endpoint& tmp(endpoints.tmp);
 
     const bool local(out.isLocal());
+
+    // For remote output, encode into an in-memory file if possible, rather
+    // than round-tripping through our temporary directory.
+    std::unique_ptr<MemFile> mem(local ? nullptr : MemFile::create(filename));
+
     const std::string localDir(local ? out.prefixedRoot() : tmp.prefixedRoot());
     const std::string localFile(
             (local ? filename : arbiter::crypto::encodeAsHex(filename)) +
             ".laz");
+    const std::string localPath(mem ? mem->path() : localDir + localFile);
+
+    // Points are sorted by time unless an explicit order has already been
+    // applied, which takes precedence.
+    if (metadata.internal.pointOrder.empty())
+    {
+        sortPoints(table, "gpstime", bounds);
+    }
 
     pdal::BufferReader reader;
     auto view(std::make_shared<pdal::PointView>(table));
@@ -52,7 +67,7 @@ void write(
     const uint64_t colorMask(contains(metadata.schema, "Red") ? 2 : 0);
 
     pdal::Options options;
-    options.add("filename", localDir + localFile);
+    options.add("filename", localPath);
     options.add("minor_version", 2);
     options.add("extra_dims", "all");
     options.add("software_id", "Entwine " + currentEntwineVersion().toString());
@@ -71,35 +86,28 @@ void write(
 
     if (metadata.srs) options.add("a_srs", metadata.srs->wkt());
 
-    std::unique_lock<std::mutex> lock(PdalMutex::get());
-
-    pdal::Stage* prev(&reader);
-
-    std::unique_ptr<pdal::SortFilter> sort;
-    if (contains(metadata.schema, "GpsTime"))
-    {
-        sort = makeUnique<pdal::SortFilter>();
-
-        pdal::Options so;
-        so.add("dimension", "GpsTime");
-        sort->setOptions(so);
-        sort->setInput(*prev);
-
-        prev = sort.get();
-    }
-
     pdal::LasWriter writer;
     writer.setOptions(options);
-    writer.setInput(*prev);
-    writer.prepare(table);
+    writer.setInput(reader);
 
-    lock.unlock();
+    {
+        std::lock_guard<std::mutex> lock(PdalMutex::get());
+        writer.prepare(table);
+    }
 
-    writer.execute(table);
+    {
+        metrics::ScopedTimer timer(metrics::Timer::Compress);
+        writer.execute(table);
+    }
 
-    if (!local)
+    if (local) noteWrite(out.prefixedFullPath(filename + ".laz"));
+    else if (mem)
     {
-        ensurePut(out, filename + ".laz", tmp.getBinary(localFile));
+        putData(endpoints, filename + ".laz", mem->read());
+    }
+    else if (!local)
+    {
+        putData(endpoints, filename + ".laz", tmp.getBinary(localFile));
         arbiter::remove(tmp.prefixedRoot() + localFile);
     }
 }
@@ -108,12 +116,42 @@ void read(
     const Metadata& metadata,
     const Endpoints& endpoints,
     const std::string filename,
-    VectorPointTable& table)
+    VectorPointTable& table,
+    const Bounds bounds)
 {
-    auto handle(endpoints.data.getLocalHandle(filename + ".laz"));
+    // Remote and cached nodes are read from an in-memory copy if possible.
+    std::unique_ptr<MemFile> mem;
+    std::unique_ptr<arbiter::LocalHandle> handle;
+
+    auto cached(takeData(endpoints, filename + ".laz"));
+    if (cached || !endpoints.data.isLocal()) mem = MemFile::create(filename);
+
+    if (mem)
+    {
+        mem->write(
+            cached ?
+                *cached :
+                ensureGetBinary(endpoints.data, filename + ".laz"));
+    }
+    else if (cached)
+    {
+        const std::string local(
+            arbiter::crypto::encodeAsHex(filename) + ".laz");
+        endpoints.tmp.put(local, *cached);
+        handle = makeUnique<arbiter::LocalHandle>(
+            endpoints.tmp.prefixedRoot() + local,
+            true);
+    }
+    else
+    {
+        auto local(endpoints.data.getLocalHandle(filename + ".laz"));
+        handle = makeUnique<arbiter::LocalHandle>(
+            local.release(),
+            !endpoints.data.isLocal());
+    }
 
     pdal::Options o;
-    o.add("filename", handle.localPath());
+    o.add("filename", mem ? mem->path() : handle->localPath());
     o.add("use_eb_vlr", true);
 
     pdal::LasReader reader;
@@ -38,7 +38,8 @@ void read(
     const Metadata& Metadata,
     const Endpoints& endpoints,
     std::string filename,
-    VectorPointTable& table);
+    VectorPointTable& table,
+    const Bounds bounds);
 
 } // namespace laszip
 } // namespace io
@@ -10,10 +10,20 @@
 
 #include <entwine/io/zstandard.hpp>
 
-#include <pdal/compression/ZstdCompression.hpp>
-#include <pdal/filters/SortFilter.hpp>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
 
+#include <zstd.h>
+#include <zdict.h>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/types/metadata.hpp>
 #include <entwine/util/io.hpp>
+#include <entwine/util/mapped-file.hpp>
+#include <entwine/util/metrics.hpp>
+#include <entwine/util/scratch.hpp>
 
 namespace entwine
 {
@@ -22,6 +32,290 @@ namespace io
 namespace zstandard
 {
 
+namespace
+{
+
+struct CCtxDeleter { void operator()(ZSTD_CCtx* c) { ZSTD_freeCCtx(c); } };
+struct DCtxDeleter { void operator()(ZSTD_DCtx* d) { ZSTD_freeDCtx(d); } };
+
+// Contexts are expensive to create, so each thread reuses its own.
+ZSTD_CCtx* getCompressionContext()
+{
+    static thread_local std::unique_ptr<ZSTD_CCtx, CCtxDeleter> ctx(
+        ZSTD_createCCtx());
+    if (!ctx) throw std::runtime_error("Failed to create zstd context");
+    return ctx.get();
+}
+
+ZSTD_DCtx* getDecompressionContext()
+{
+    static thread_local std::unique_ptr<ZSTD_DCtx, DCtxDeleter> ctx(
+        ZSTD_createDCtx());
+    if (!ctx) throw std::runtime_error("Failed to create zstd context");
+    return ctx.get();
+}
+
+std::size_t check(const std::size_t result)
+{
+    if (ZSTD_isError(result))
+    {
+        throw std::runtime_error(
+            std::string("Zstandard error: ") + ZSTD_getErrorName(result));
+    }
+    return result;
+}
+
+} // unnamed namespace
+
+} // namespace zstandard
+} // namespace io
+
+ZstdDictionary::ZstdDictionary(const uint64_t size, const int level)
+    : m_size(size)
+    , m_level(level)
+{ }
+
+ZstdDictionary::ZstdDictionary(const std::vector<char>& data, const int level)
+    : m_size(data.size())
+    , m_level(level)
+{
+    use(data);
+}
+
+ZstdDictionary::~ZstdDictionary()
+{
+    ZSTD_freeCDict(m_cdict);
+    ZSTD_freeDDict(m_ddict);
+}
+
+std::shared_ptr<ZstdDictionary> ZstdDictionary::load(
+    const arbiter::Endpoint& out,
+    const int level)
+{
+    const auto data(out.tryGetBinary(filename()));
+    if (!data) return nullptr;
+    return std::make_shared<ZstdDictionary>(*data, level);
+}
+
+bool ZstdDictionary::applies(const uint64_t bytes)
+{
+    return bytes < heuristics::zstdDictionaryBytes;
+}
+
+void ZstdDictionary::sample(
+    const std::vector<char>& node,
+    const arbiter::Endpoint& out)
+{
+    if (m_done || !applies(node.size())) return;
+
+    // Nodes written while we train are simply not sampled.
+    std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+    if (!lock || m_done) return;
+
+    m_samples.insert(m_samples.end(), node.begin(), node.end());
+    m_sampleSizes.push_back(node.size());
+
+    if (m_samples.size() >= m_size * heuristics::zstdDictionarySamples)
+    {
+        train(out);
+    }
+}
+
+void ZstdDictionary::train(const arbiter::Endpoint& out)
+{
+    m_done = true;
+
+    std::vector<char> data(m_size);
+    const std::size_t size(ZDICT_trainFromBuffer(
+        data.data(),
+        data.size(),
+        m_samples.data(),
+        m_sampleSizes.data(),
+        m_sampleSizes.size()));
+
+    m_samples = std::vector<char>();
+    m_sampleSizes = std::vector<std::size_t>();
+
+    // Samples which are too uniform to train from are compressed well enough
+    // without a dictionary.
+    if (ZDICT_isError(size))
+    {
+        std::cout << "Skipping zstd dictionary: " <<
+            ZDICT_getErrorName(size) << std::endl;
+        return;
+    }
+
+    data.resize(size);
+    ensurePut(out, filename(), data);
+    use(data);
+}
+
+void ZstdDictionary::use(const std::vector<char>& data)
+{
+    m_cdict = ZSTD_createCDict(data.data(), data.size(), m_level);
+    m_ddict = ZSTD_createDDict(data.data(), data.size());
+    if (!m_cdict || !m_ddict)
+    {
+        throw std::runtime_error("Failed to create zstd dictionary");
+    }
+
+    m_id = ZDICT_getDictID(data.data(), data.size());
+    m_done = true;
+    m_ready = true;
+}
+
+namespace io
+{
+namespace zstandard
+{
+
+std::vector<char> compress(
+    const Metadata& metadata,
+    const uint64_t depth,
+    const std::vector<char>& uncompressed,
+    const ZstdDictionary* dictionary)
+{
+    metrics::ScopedTimer timer(metrics::Timer::Compress);
+    ZSTD_CCtx* ctx(getCompressionContext());
+
+    // We compress into a reused buffer at the worst-case size, and return an
+    // exact copy, since the result is handed off to be uploaded.
+    Scratch<char> bound;
+
+    // Small nodes are compressed with our shared digested dictionary, which
+    // carries the compression level of our build regardless of depth.
+    if (
+        dictionary &&
+        dictionary->cdict() &&
+        ZstdDictionary::applies(uncompressed.size()))
+    {
+        check(ZSTD_CCtx_reset(ctx, ZSTD_reset_session_and_parameters));
+
+        bound->resize(ZSTD_compressBound(uncompressed.size()));
+        const std::size_t size(check(ZSTD_compress_usingCDict(
+            ctx,
+            bound->data(),
+            bound->size(),
+            uncompressed.data(),
+            uncompressed.size(),
+            dictionary->cdict())));
+        return std::vector<char>(bound->data(), bound->data() + size);
+    }
+    check(ZSTD_CCtx_reset(ctx, ZSTD_reset_session_and_parameters));
+    check(ZSTD_CCtx_setParameter(
+        ctx,
+        ZSTD_c_compressionLevel,
+        getZstdLevel(metadata, depth)));
+
+    // Multithreaded compression is only worthwhile for large inputs, and may
+    // be unsupported by the linked zstd library, in which case we proceed
+    // single-threaded.
+    const uint64_t threads(metadata.internal.zstdThreads);
+    if (threads > 1 && uncompressed.size() >= heuristics::zstdThreadedBytes)
+    {
+        ZSTD_CCtx_setParameter(ctx, ZSTD_c_nbWorkers, threads);
+    }
+
+    bound->resize(ZSTD_compressBound(uncompressed.size()));
+    const std::size_t size(check(ZSTD_compress2(
+        ctx,
+        bound->data(),
+        bound->size(),
+        uncompressed.data(),
+        uncompressed.size())));
+    return std::vector<char>(bound->data(), bound->data() + size);
+}
+
+std::vector<char> decompress(const std::vector<char>& compressed)
+{
+    ZSTD_DCtx* ctx(getDecompressionContext());
+    check(ZSTD_DCtx_reset(ctx, ZSTD_reset_session_only));
+
+    // Frames written by streaming compression do not record their size, so
+    // we may need to grow our output as we go.
+    const unsigned long long frameSize(
+        ZSTD_getFrameContentSize(compressed.data(), compressed.size()));
+    const bool known(
+        frameSize != ZSTD_CONTENTSIZE_UNKNOWN &&
+        frameSize != ZSTD_CONTENTSIZE_ERROR);
+
+    std::vector<char> uncompressed(
+        known ? frameSize : compressed.size() * 4 + ZSTD_DStreamOutSize());
+
+    ZSTD_inBuffer in { compressed.data(), compressed.size(), 0 };
+    ZSTD_outBuffer out { uncompressed.data(), uncompressed.size(), 0 };
+
+    while (in.pos < in.size)
+    {
+        if (out.pos == out.size)
+        {
+            uncompressed.resize(uncompressed.size() * 2);
+            out.dst = uncompressed.data();
+            out.size = uncompressed.size();
+        }
+        check(ZSTD_decompressStream(ctx, &out, &in));
+    }
+
+    uncompressed.resize(out.pos);
+    return uncompressed;
+}
+
+uint64_t decompress(
+    const std::vector<char>& compressed,
+    char* dst,
+    const uint64_t size,
+    const ZstdDictionary* dictionary)
+{
+    return decompress(
+        compressed.data(),
+        compressed.size(),
+        dst,
+        size,
+        dictionary);
+}
+
+uint64_t decompress(
+    const char* const compressed,
+    const uint64_t compressedSize,
+    char* dst,
+    const uint64_t size,
+    const ZstdDictionary* dictionary)
+{
+    ZSTD_DCtx* ctx(getDecompressionContext());
+
+    // A referenced dictionary persists across sessions, so it is cleared for
+    // frames which were compressed without one.
+    check(ZSTD_DCtx_reset(ctx, ZSTD_reset_session_and_parameters));
+    const unsigned id(ZSTD_getDictID_fromFrame(compressed, compressedSize));
+    if (id)
+    {
+        if (!dictionary || !dictionary->ddict() || dictionary->id() != id)
+        {
+            throw std::runtime_error("Missing zstd dictionary");
+        }
+        check(ZSTD_DCtx_refDDict(ctx, dictionary->ddict()));
+    }
+
+    ZSTD_inBuffer in { compressed, compressedSize, 0 };
+    ZSTD_outBuffer out { dst, size, 0 };
+
+    while (in.pos < in.size)
+    {
+        const std::size_t before(out.pos);
+        const std::size_t consumed(in.pos);
+        check(ZSTD_decompressStream(ctx, &out, &in));
+
+        // If the output is full and no progress is possible, there is more
+        // data here than was expected.
+        if (out.pos == out.size && out.pos == before && in.pos == consumed)
+        {
+            throw std::runtime_error("Decompressed data exceeds expected size");
+        }
+    }
+
+    return out.pos;
+}
+
 void write(
     const Metadata& metadata,
     const Endpoints& endpoints,
@@ -29,39 +323,64 @@ void write(
     BlockPointTable& table,
     const Bounds bounds)
 {
-    const std::vector<char> uncompressed = binary::pack(metadata, table);
-
-    std::vector<char> compressed;
-    pdal::ZstdCompressor compressor([&compressed](char* pos, std::size_t size)
-    {
-        compressed.insert(compressed.end(), pos, pos + size);
-    }, 3); // ZSTD_CLEVEL_DEFAULT = 3.
+    Scratch<char> packed;
+    binary::pack(binary::getPackedPlan(metadata, bounds), table, packed.get());
+    const std::vector<char>& uncompressed(packed.get());
 
-    compressor.compress(uncompressed.data(), uncompressed.size());
-    compressor.done();
+    ZstdDictionary* dictionary(endpoints.zstdDictionary.get());
+    if (dictionary) dictionary->sample(uncompressed, endpoints.output);
 
-    ensurePut(endpoints.data, filename + ".zst", compressed);
+    putData(
+        endpoints,
+        filename + ".zst",
+        compress(metadata, getDepth(filename), uncompressed, dictionary));
 }
 
 void read(
     const Metadata& metadata,
     const Endpoints& endpoints,
     const std::string filename,
-    VectorPointTable& table)
+    VectorPointTable& table,
+    const Bounds bounds)
 {
-    const std::vector<char> compressed = ensureGetBinary(
-        endpoints.data,
-        filename + ".zst");
+    // Our point count is known, so decompress straight into the tail of the
+    // table's own storage and expand the points in place.  Local nodes are
+    // decompressed straight from a mapping of the file.
+    const CopyPlan plan(binary::getPackedPlan(metadata, bounds));
+    const uint64_t expected(binary::getPackedSize(plan, table));
+    char* const pos(binary::getPackedPosition(plan, table));
+
+    const std::string path(filename + ".zst");
+    const ZstdDictionary* dictionary(endpoints.zstdDictionary.get());
 
-    std::vector<char> uncompressed;
-    pdal::ZstdDecompressor dec([&uncompressed](char* pos, std::size_t size)
+    uint64_t actual(0);
+    if (auto cached = takeData(endpoints, path))
     {
-        uncompressed.insert(uncompressed.end(), pos, pos + size);
-    });
+        actual = decompress(*cached, pos, expected, dictionary);
+    }
+    else if (auto mapped = MappedFile::create(endpoints.data, path))
+    {
+        actual = decompress(
+            mapped->data(),
+            mapped->size(),
+            pos,
+            expected,
+            dictionary);
+    }
+    else
+    {
+        const std::vector<char> compressed = ensureGetBinary(
+            endpoints.data,
+            path);
+        actual = decompress(compressed, pos, expected, dictionary);
+    }
 
-    dec.decompress(compressed.data(), compressed.size());
+    if (actual != expected)
+    {
+        throw std::runtime_error("Invalid point count for " + filename);
+    }
 
-    binary::unpack(metadata, table, std::move(uncompressed));
+    binary::unpackInPlace(plan, table);
 }
 
 } // namespace zstandard
@@ -8,15 +8,107 @@
 *
 ******************************************************************************/
 
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include <entwine/io/binary.hpp>
 
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
 namespace entwine
 {
+
+// A dictionary for the small nodes of a zstandard build, which compress poorly
+// on their own.  It is trained from a sample of the first small nodes written,
+// and saved alongside our metadata so that the nodes compressed with it may be
+// read.  Until it is trained, nodes are compressed without it.
+class ZstdDictionary
+{
+public:
+    // Train a dictionary of at most this many bytes.
+    ZstdDictionary(uint64_t size, int level);
+
+    // Use a previously trained dictionary.
+    ZstdDictionary(const std::vector<char>& data, int level);
+
+    ~ZstdDictionary();
+
+    static std::string filename() { return "ept-zstd-dictionary"; }
+
+    // Load the dictionary saved at this output, if there is one.
+    static std::shared_ptr<ZstdDictionary> load(
+        const arbiter::Endpoint& out,
+        int level);
+
+    // If we are still training, add this uncompressed node to our sample if it
+    // is small, and once our sample is complete, train and save ourselves to
+    // this endpoint.
+    void sample(const std::vector<char>& node, const arbiter::Endpoint& out);
+
+    // Whether nodes of this many uncompressed bytes use a dictionary.
+    static bool applies(uint64_t bytes);
+
+    // Our digested contexts, which are shared by all threads, or null if we
+    // are not yet trained.
+    const ZSTD_CDict_s* cdict() const { return m_ready ? m_cdict : nullptr; }
+    const ZSTD_DDict_s* ddict() const { return m_ready ? m_ddict : nullptr; }
+    unsigned id() const { return m_id; }
+
+private:
+    void train(const arbiter::Endpoint& out);
+    void use(const std::vector<char>& data);
+
+    const uint64_t m_size;
+    const int m_level;
+
+    std::mutex m_mutex;
+    std::atomic_bool m_ready{ false };
+    std::atomic_bool m_done{ false };
+    std::vector<char> m_samples;
+    std::vector<std::size_t> m_sampleSizes;
+
+    ZSTD_CDict_s* m_cdict = nullptr;
+    ZSTD_DDict_s* m_ddict = nullptr;
+    unsigned m_id = 0;
+};
+
 namespace io
 {
 namespace zstandard
 {
 
+// Compress with the level of a node at this depth and the threading of our
+// build parameters, and with our dictionary if this data is small enough, and
+// it has been trained.
+std::vector<char> compress(
+    const Metadata& metadata,
+    uint64_t depth,
+    const std::vector<char>& uncompressed,
+    const ZstdDictionary* dictionary = nullptr);
+std::vector<char> decompress(const std::vector<char>& compressed);
+
+// Decompress into a buffer of exactly this many bytes, returning the number of
+// bytes written.  Throws if the data would exceed this size.  Data compressed
+// with a dictionary requires that dictionary.
+uint64_t decompress(
+    const std::vector<char>& compressed,
+    char* dst,
+    uint64_t size,
+    const ZstdDictionary* dictionary = nullptr);
+uint64_t decompress(
+    const char* compressed,
+    uint64_t compressedSize,
+    char* dst,
+    uint64_t size,
+    const ZstdDictionary* dictionary = nullptr);
+
 void write(
     const Metadata& Metadata,
     const Endpoints& endpoints,
@@ -28,7 +120,8 @@ void read(
     const Metadata& metadata,
     const Endpoints& endpoints,
     std::string filename,
-    VectorPointTable& table);
+    VectorPointTable& table,
+    const Bounds bounds);
 
 } // namespace zstandard
 } // namespace io
@@ -0,0 +1,274 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/export.hpp>
+
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+#include <pdal/StageFactory.hpp>
+#include <pdal/io/BufferReader.hpp>
+#include <pdal/io/LasWriter.hpp>
+
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/io.hpp>
+#include <entwine/util/pdal-mutex.hpp>
+
+namespace entwine
+{
+namespace exporter
+{
+
+namespace
+{
+
+// Output files are written locally, and then copied to remote output.
+class Destination
+{
+public:
+    Destination(const Endpoints& endpoints, const std::string& dir)
+        : m_out(endpoints.arbiter->getEndpoint(dir))
+        , m_tmp(endpoints.tmp)
+    {
+        if (m_out.isLocal() && !arbiter::mkdirp(m_out.prefixedRoot()))
+        {
+            throw std::runtime_error("Failed to create directory: " + dir);
+        }
+    }
+
+    std::string local(const std::string& name) const
+    {
+        return m_out.isLocal()
+            ? m_out.prefixedRoot() + name
+            : m_tmp.prefixedRoot() + arbiter::crypto::encodeAsHex(
+                m_out.prefixedRoot() + name);
+    }
+
+    void finish(const std::string& name) const
+    {
+        if (m_out.isLocal()) return;
+        const std::string path(local(name));
+        ensurePut(m_out, name, m_tmp.getBinary(path.substr(
+                m_tmp.prefixedRoot().size())));
+        arbiter::remove(path);
+    }
+
+private:
+    const arbiter::Endpoint m_out;
+    const arbiter::Endpoint& m_tmp;
+};
+
+// The options shared by writers.las and writers.copc.
+pdal::Options getOptions(
+    const Metadata& metadata,
+    const std::string& filename)
+{
+    pdal::Options options;
+    options.add("filename", filename);
+    options.add("extra_dims", "all");
+
+    // Absolute datasets have no scale to preserve, so choose one.
+    if (const auto so = getScaleOffset(metadata.schema))
+    {
+        options.add("scale_x", so->scale.x);
+        options.add("scale_y", so->scale.y);
+        options.add("scale_z", so->scale.z);
+        options.add("offset_x", so->offset.x);
+        options.add("offset_y", so->offset.y);
+        options.add("offset_z", so->offset.z);
+    }
+    else
+    {
+        options.add("scale_x", 0.01);
+        options.add("scale_y", 0.01);
+        options.add("scale_z", 0.01);
+        options.add("offset_x", "auto");
+        options.add("offset_y", "auto");
+        options.add("offset_z", "auto");
+    }
+
+    if (metadata.srs) options.add("a_srs", metadata.srs->wkt());
+    return options;
+}
+
+void write(
+    pdal::Stage& writer,
+    const pdal::Options& options,
+    const Schema& schema,
+    std::vector<char> data)
+{
+    auto layout = toLayout(schema);
+    VectorPointTable table(layout, std::move(data));
+
+    pdal::BufferReader reader;
+    auto view(std::make_shared<pdal::PointView>(table));
+    for (std::size_t i(0); i < table.size(); ++i) view->getOrAddPoint(i);
+    reader.addView(view);
+
+    writer.setOptions(options);
+    writer.setInput(reader);
+
+    {
+        std::lock_guard<std::mutex> lock(PdalMutex::get());
+        writer.prepare(table);
+    }
+
+    writer.execute(table);
+}
+
+void writeLas(
+    const Metadata& metadata,
+    const Schema& schema,
+    std::vector<char> data,
+    const std::string& filename,
+    const bool compress)
+{
+    // See https://www.pdal.io/stages/writers.las.html
+    const uint64_t timeMask(contains(schema, "GpsTime") ? 1 : 0);
+    const uint64_t colorMask(contains(schema, "Red") ? 2 : 0);
+
+    pdal::Options options(getOptions(metadata, filename));
+    options.add("minor_version", 2);
+    options.add("software_id", "Entwine " + currentEntwineVersion().toString());
+    if (compress) options.add("compression", "laszip");
+    options.add("dataformat_id", timeMask | colorMask);
+
+    pdal::LasWriter writer;
+    write(writer, options, schema, std::move(data));
+}
+
+// Our PDAL may predate writers.copc, so it is created by name.
+void writeCopc(
+    const Metadata& metadata,
+    const Schema& schema,
+    std::vector<char> data,
+    const std::string& filename,
+    const uint64_t threads)
+{
+    pdal::Options options(getOptions(metadata, filename));
+    options.add("threads", threads);
+
+    pdal::StageFactory factory;
+    pdal::Stage* writer(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(PdalMutex::get());
+        writer = factory.createStage("writers.copc");
+    }
+    if (!writer)
+    {
+        throw std::runtime_error("COPC exports require PDAL's writers.copc");
+    }
+
+    write(*writer, options, schema, std::move(data));
+}
+
+} // unnamed namespace
+
+Format toFormat(const std::string s)
+{
+    if (s == "binary") return Format::Binary;
+    if (s == "las") return Format::Las;
+    if (s == "laz") return Format::Laz;
+    if (s == "copc") return Format::Copc;
+    throw std::runtime_error("Invalid export format: " + s);
+}
+
+uint64_t write(
+    Reader& reader,
+    const Query& query,
+    const std::string& path,
+    const Format format)
+{
+    const Endpoints& endpoints(reader.endpoints());
+    const Metadata& metadata(reader.metadata());
+    const Schema schema(reader.schema(query));
+    const uint64_t pointSize(getPointSize(schema));
+
+    std::atomic<uint64_t> points(0);
+
+    if (format == Format::Binary)
+    {
+        const std::string name(arbiter::getBasename(path));
+        const Destination destination(endpoints, arbiter::getDirname(path));
+
+        std::mutex mutex;
+        std::ofstream file(
+            destination.local(name),
+            std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file) throw std::runtime_error("Could not open output: " + path);
+
+        reader.read(query, [&](const Dxyz&, std::vector<char> data)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            file.write(data.data(), data.size());
+            points += data.size() / pointSize;
+        });
+
+        file.close();
+        if (!file) throw std::runtime_error("Could not write output: " + path);
+        destination.finish(name);
+        return points;
+    }
+
+    for (const std::string name : { "X", "Y", "Z" })
+    {
+        if (!contains(schema, name))
+        {
+            throw std::runtime_error("LAS exports require " + name);
+        }
+    }
+
+    // A COPC file holds its own octree, which is built by its writer from
+    // all of our points at once.
+    if (format == Format::Copc)
+    {
+        const std::string name(arbiter::getBasename(path));
+        const Destination destination(endpoints, arbiter::getDirname(path));
+
+        std::vector<char> data(reader.read(query));
+        points = data.size() / pointSize;
+
+        writeCopc(
+            metadata,
+            schema,
+            std::move(data),
+            destination.local(name),
+            reader.threads());
+        destination.finish(name);
+        return points;
+    }
+
+    const Destination destination(endpoints, path);
+    const std::string extension(format == Format::Laz ? ".laz" : ".las");
+
+    reader.read(query, [&](const Dxyz& key, std::vector<char> data)
+    {
+        if (data.empty()) return;
+
+        const std::string name(key.toString() + extension);
+        points += data.size() / pointSize;
+
+        writeLas(
+            metadata,
+            schema,
+            std::move(data),
+            destination.local(name),
+            format == Format::Laz);
+        destination.finish(name);
+    });
+
+    return points;
+}
+
+} // namespace exporter
+} // namespace entwine
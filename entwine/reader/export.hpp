@@ -0,0 +1,45 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <entwine/reader/reader.hpp>
+
+namespace entwine
+{
+namespace exporter
+{
+
+enum class Format { Binary, Las, Laz, Copc };
+
+Format toFormat(std::string s);
+
+// Write the points of this query, whose resolution thins the dataset by
+// reading only the depths of the hierarchy down to it.  Nodes are read and
+// written in parallel as they arrive, so memory use is bounded by our
+// threads rather than by the size of the export.
+//
+// Binary exports are a single file of packed records of the query's schema
+// at this path.  LAS and LAZ exports are a directory at this path, with a
+// file for each node that contributes points.  COPC exports are a single
+// file, for which all of the points are held in memory while it is written.
+//
+// Returns the number of points written.
+uint64_t write(
+    Reader& reader,
+    const Query& query,
+    const std::string& path,
+    Format format);
+
+} // namespace exporter
+} // namespace entwine
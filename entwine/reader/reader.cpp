@@ -0,0 +1,369 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/reader.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/config.hpp>
+#include <entwine/util/io.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/pack.hpp>
+#include <entwine/util/pool.hpp>
+#include <entwine/util/sax.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+Metadata loadMetadata(const Endpoints& endpoints)
+{
+    json j = json::parse(ensureGet(endpoints.output, "ept.json"));
+
+    // Datasets built by other tools carry no build parameters.
+    if (const auto build = endpoints.output.tryGet("ept-build.json"))
+    {
+        j = merge(json::parse(*build), j);
+    }
+
+    return config::getMetadata(j);
+}
+
+} // unnamed namespace
+
+Reader::Reader(const Endpoints endpoints, const uint64_t threads)
+    : m_endpoints(endpoints)
+    , m_threads(std::max<uint64_t>(threads, 1))
+    , m_metadata(loadMetadata(endpoints))
+{
+    if (m_metadata.internal.pack)
+    {
+        m_endpoints.packs = std::make_shared<Packs>(
+            m_endpoints.data,
+            m_metadata.internal.hierarchyStep);
+    }
+
+    // Datasets whose zstandard nodes were compressed with a dictionary have
+    // saved it alongside their metadata.
+    if (m_metadata.dataType == io::Type::Zstandard)
+    {
+        m_endpoints.zstdDictionary = ZstdDictionary::load(
+            m_endpoints.output,
+            m_metadata.internal.zstdLevel);
+    }
+
+    m_hierarchy[Dxyz()] = -1;
+    load({ Dxyz() });
+}
+
+void Reader::load(const std::vector<Dxyz>& pages)
+{
+    Pool pool(m_threads);
+    for (const Dxyz& root : pages)
+    {
+        pool.add([this, root]()
+        {
+            const std::string page(
+                ensureGet(m_endpoints.hierarchy, root.toString() + ".json"));
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            sax::forEachInteger(page, [this](std::string& k, int64_t count)
+            {
+                const Dxyz key(k);
+
+                // The root of a page is listed by its parent page as well as
+                // by its own, so don't lose its count to its placeholder.
+                auto it = m_hierarchy.find(key);
+                if (it == m_hierarchy.end()) m_hierarchy[key] = count;
+                else if (count != -1) it->second = count;
+            });
+        });
+    }
+    pool.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+}
+
+void Reader::loadTimes(const std::vector<Dxyz>& roots)
+{
+    const arbiter::Endpoint ep(
+        m_endpoints.output.getSubEndpoint("ept-node-stats"));
+
+    Pool pool(m_threads);
+    for (const Dxyz& root : roots)
+    {
+        pool.add([this, &ep, root]()
+        {
+            // Without statistics, every node is considered to overlap.
+            const auto data(ep.tryGet(root.toString() + ".json"));
+            if (!data) return;
+
+            const json j(json::parse(*data));
+            const StringList dims(j.at("dimensions").get<StringList>());
+            const auto it(std::find(dims.begin(), dims.end(), "GpsTime"));
+            if (it == dims.end()) return;
+            const std::size_t d(it - dims.begin());
+
+            const json& nodes(j.at("nodes"));
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto node(nodes.begin()); node != nodes.end(); ++node)
+            {
+                m_times[Dxyz(node.key())] = std::make_pair(
+                    node.value().at("minimum").at(d).get<double>(),
+                    node.value().at("maximum").at(d).get<double>());
+            }
+        });
+    }
+    pool.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+}
+
+bool Reader::inTime(
+    const Dxyz& key,
+    const std::pair<double, double>& time) const
+{
+    const auto it(m_times.find(key));
+    if (it == m_times.end()) return true;
+    return it->second.first <= time.second && it->second.second >= time.first;
+}
+
+uint64_t Reader::getDepthEnd(const Query& query) const
+{
+    uint64_t end(query.depthEnd ? query.depthEnd : 64);
+    if (query.resolution <= 0) return end;
+
+    // The points of a node at depth d are spaced by its width over our span.
+    const double width(m_metadata.bounds.width() / m_metadata.span);
+    uint64_t d(0);
+    while (d + 1 < end && width / (1ull << d) > query.resolution) ++d;
+    return d + 1;
+}
+
+Schema Reader::schema(const Query& query) const
+{
+    if (query.dimensions.empty()) return m_metadata.absoluteSchema;
+
+    Schema schema;
+    for (const std::string& name : query.dimensions)
+    {
+        const Dimension* dim(maybeFind(m_metadata.absoluteSchema, name));
+        if (!dim) throw std::runtime_error("Invalid dimension: " + name);
+        schema.emplace_back(dim->name, dim->type);
+    }
+    return schema;
+}
+
+std::vector<Reader::Node> Reader::nodes(const Query& query)
+{
+    const uint64_t depthEnd(getDepthEnd(query));
+    const auto overlaps([&query](const ChunkKey& ck)
+    {
+        return !query.bounds || query.bounds->overlaps(ck.bounds(), true);
+    });
+
+    // Walk a depth at a time, so that the hierarchy pages rooted at each
+    // depth may be fetched together.
+    std::vector<Node> nodes;
+    std::vector<ChunkKey> frontier;
+
+    const ChunkKey root(m_metadata.bounds, getStartDepth(m_metadata));
+    if (overlaps(root)) frontier.push_back(root);
+
+    while (frontier.size())
+    {
+        std::vector<Dxyz> pages;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (const ChunkKey& ck : frontier)
+            {
+                if (m_hierarchy.at(ck.dxyz()) == -1) pages.push_back(ck.dxyz());
+            }
+        }
+        if (pages.size()) load(pages);
+
+        // Node statistics are saved in a file per hierarchy step root.
+        if (query.time)
+        {
+            const uint64_t step(m_metadata.internal.hierarchyStep);
+            std::vector<Dxyz> roots;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (const ChunkKey& ck : frontier)
+                {
+                    const Dxyz root(hierarchy::getRoot(ck.dxyz(), step));
+                    if (m_timeRoots.insert(root).second) roots.push_back(root);
+                }
+            }
+            if (roots.size()) loadTimes(roots);
+        }
+
+        std::vector<ChunkKey> next;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const ChunkKey& ck : frontier)
+        {
+            const int64_t count(m_hierarchy.at(ck.dxyz()));
+            if (
+                count > 0 &&
+                ck.depth() >= query.depthBegin &&
+                (!query.time || inTime(ck.dxyz(), *query.time)))
+            {
+                nodes.push_back({ ck.dxyz(), static_cast<uint64_t>(count) });
+            }
+
+            if (ck.depth() + 1 >= depthEnd) continue;
+
+            for (uint64_t i(0); i < 8; ++i)
+            {
+                const ChunkKey child(ck.getStep(toDir(i)));
+                if (m_hierarchy.count(child.dxyz()) && overlaps(child))
+                {
+                    next.push_back(child);
+                }
+            }
+        }
+        frontier = std::move(next);
+    }
+
+    return nodes;
+}
+
+std::vector<Reader::Node> Reader::resolve(const std::vector<Dxyz>& keys)
+{
+    std::vector<Dxyz> pages;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const Dxyz& key : keys)
+        {
+            if (m_hierarchy.at(key) == -1) pages.push_back(key);
+        }
+    }
+    if (pages.size()) load(pages);
+
+    std::vector<Node> nodes;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const Dxyz& key : keys)
+    {
+        nodes.push_back({ key, static_cast<uint64_t>(m_hierarchy.at(key)) });
+    }
+    return nodes;
+}
+
+std::vector<Dxyz> Reader::children(const Dxyz& key)
+{
+    std::vector<Dxyz> children;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (uint64_t i(0); i < 8; ++i)
+    {
+        const Dxyz child(
+            key.d + 1,
+            key.x * 2 + (i & 1),
+            key.y * 2 + ((i >> 1) & 1),
+            key.z * 2 + ((i >> 2) & 1));
+        if (m_hierarchy.count(child)) children.push_back(child);
+    }
+    return children;
+}
+
+void Reader::read(const Query& query, const NodeCallback& f)
+{
+    const Schema out(schema(query));
+    const std::vector<Node> selected(nodes(query));
+
+    Pool pool(m_threads);
+    for (const Node& node : selected)
+    {
+        pool.add([this, &query, &out, &f, node]()
+        {
+            f(node.key, read(node.key, out, query.bounds, query.time));
+        });
+    }
+    pool.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+}
+
+std::vector<char> Reader::read(
+    const Dxyz& key,
+    const Schema& schema,
+    const optional<Bounds>& bounds,
+    const optional<std::pair<double, double>>& time) const
+{
+    pdal::PointLayout& layout(m_metadata.layouts->absolute());
+
+    std::vector<DimId> ids;
+    for (const Dimension& dim : schema) ids.push_back(layout.findDim(dim.name));
+
+    const DimId timeId(time ? layout.findDim("GpsTime") : DimId::Unknown);
+    if (time && timeId == DimId::Unknown)
+    {
+        throw std::runtime_error("Cannot query by time without GpsTime");
+    }
+
+    const uint64_t pointSize(getPointSize(schema));
+    std::vector<char> data;
+
+    VectorPointTable table(layout);
+    table.setProcess([&]()
+    {
+        const auto points(table.batch());
+        pdal::PointRef pr(table, 0);
+        for (pdal::PointId i(0); i < points.size(); ++i)
+        {
+            if (points.skip(i)) continue;
+            if (bounds && !bounds->contains(points.point(i))) continue;
+
+            pr.setPointId(i);
+            if (time)
+            {
+                const double t(pr.getFieldAs<double>(timeId));
+                if (t < time->first || t > time->second) continue;
+            }
+
+            std::size_t pos(data.size());
+            data.resize(pos + pointSize);
+            for (std::size_t i(0); i < ids.size(); ++i)
+            {
+                pr.getField(data.data() + pos, ids[i], schema[i].type);
+                pos += pdal::Dimension::size(schema[i].type);
+            }
+        }
+    });
+
+    io::read(
+        io::getNodeType(m_metadata, key.d),
+        m_metadata,
+        m_endpoints,
+        key.toString(),
+        table,
+        getNodeBounds(m_metadata, key));
+
+    return data;
+}
+
+std::vector<char> Reader::read(const Query& query)
+{
+    std::vector<char> result;
+    std::mutex mutex;
+    read(query, [&](const Dxyz&, std::vector<char> data)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        result.insert(result.end(), data.begin(), data.end());
+    });
+    return result;
+}
+
+} // namespace entwine
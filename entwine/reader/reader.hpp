@@ -0,0 +1,132 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/dimension.hpp>
+#include <entwine/types/endpoints.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/types/metadata.hpp>
+#include <entwine/util/optional.hpp>
+
+namespace entwine
+{
+
+struct Query
+{
+    // If set, only nodes overlapping these bounds are selected, and only the
+    // points within them are read.
+    optional<Bounds> bounds;
+
+    // Nodes are selected from the depths [depthBegin, depthEnd).  A depthEnd
+    // of zero leaves the depth unlimited.
+    uint64_t depthBegin = 0;
+    uint64_t depthEnd = 0;
+
+    // If nonzero, nodes are selected down to the first depth whose point
+    // spacing is at least this fine, if that is shallower than depthEnd.
+    double resolution = 0;
+
+    // If set, only the points whose GpsTime lies within this inclusive range
+    // are read.  If the dataset has node statistics, nodes whose points all
+    // lie outside of it are not selected, and so are never fetched.
+    optional<std::pair<double, double>> time;
+
+    // The dimensions to read, in order.  If empty, all of them are read.
+    StringList dimensions;
+};
+
+// Reads an EPT dataset by walking its hierarchy to select the nodes of a
+// query, fetching only the hierarchy pages that the walk reaches.
+class Reader
+{
+public:
+    struct Node
+    {
+        Dxyz key;
+        uint64_t points;
+    };
+
+    // Called with the points read from each node, packed as records of the
+    // query's schema.  Called concurrently from our worker threads.
+    using NodeCallback =
+        std::function<void(const Dxyz& key, std::vector<char> data)>;
+
+    explicit Reader(Endpoints endpoints, uint64_t threads = 8);
+
+    const Endpoints& endpoints() const { return m_endpoints; }
+    const Metadata& metadata() const { return m_metadata; }
+    uint64_t threads() const { return m_threads; }
+
+    // The dimensions of the records read for this query, with their types
+    // from our absolute schema.
+    Schema schema(const Query& query) const;
+
+    // The nodes selected by this query, with their point counts.
+    std::vector<Node> nodes(const Query& query);
+
+    // The point counts of these nodes, each of which must be in our
+    // hierarchy, loading the hierarchy pages rooted at any of them.
+    std::vector<Node> resolve(const std::vector<Dxyz>& keys);
+
+    // The children of this node which are in our hierarchy.  This node must
+    // have been resolved, but its children may not have been.
+    std::vector<Dxyz> children(const Dxyz& key);
+
+    void read(const Query& query, const NodeCallback& f);
+
+    // Read a single node as packed records of this schema, keeping only the
+    // points within these bounds and this GpsTime range if they are set.
+    std::vector<char> read(
+        const Dxyz& key,
+        const Schema& schema,
+        const optional<Bounds>& bounds = optional<Bounds>(),
+        const optional<std::pair<double, double>>& time =
+            optional<std::pair<double, double>>()) const;
+
+    // Read the points of this query into a single buffer of packed records.
+    std::vector<char> read(const Query& query);
+
+private:
+    void load(const std::vector<Dxyz>& pages);
+
+    // Load the GpsTime ranges of the nodes of the node statistics files for
+    // these hierarchy step roots, which may not exist.
+    void loadTimes(const std::vector<Dxyz>& roots);
+
+    // False if our node statistics show that no point of this node lies
+    // within this range.  Must be called with our mutex held.
+    bool inTime(const Dxyz& key, const std::pair<double, double>& time) const;
+    uint64_t getDepthEnd(const Query& query) const;
+
+    Endpoints m_endpoints;
+    const uint64_t m_threads;
+    const Metadata m_metadata;
+
+    // Counts are -1 for nodes whose hierarchy page has not yet been loaded.
+    std::mutex m_mutex;
+    std::map<Dxyz, int64_t> m_hierarchy;
+
+    // The GpsTime range of each node, from the node statistics files for the
+    // hierarchy step roots which time queries have reached.
+    std::set<Dxyz> m_timeRoots;
+    std::map<Dxyz, std::pair<double, double>> m_times;
+};
+
+} // namespace entwine
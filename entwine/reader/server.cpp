@@ -0,0 +1,617 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/server.hpp>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <entwine/io/io.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/util/json.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ENTWINE_SOCKETS
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+// Writes to a closed connection should fail rather than raise SIGPIPE.
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+namespace entwine
+{
+
+namespace
+{
+
+// How often our serving thread checks whether it should stop.
+const int pollMs(250);
+
+// Requests which are slower than this to arrive, or responses which are
+// slower than this to be accepted by the client, are dropped.
+const int timeoutSeconds(10);
+
+// The number of view traversals held for their incremental changes, beyond
+// which the least recently used are dropped.
+const std::size_t maxSessions(256);
+
+json toJson(const std::vector<Reader::Node>& nodes)
+{
+    json j = json::array();
+    for (const Reader::Node& node : nodes)
+    {
+        j.push_back({ node.key.toString(), node.points });
+    }
+    return j;
+}
+
+std::string decode(const std::string& s)
+{
+    std::string out;
+    for (std::size_t i(0); i < s.size(); ++i)
+    {
+        if (s[i] == '+') out.push_back(' ');
+        else if (
+            s[i] == '%' &&
+            i + 2 < s.size() &&
+            std::isxdigit(s[i + 1]) &&
+            std::isxdigit(s[i + 2]))
+        {
+            out.push_back(std::strtol(s.substr(i + 1, 2).c_str(), nullptr, 16));
+            i += 2;
+        }
+        else out.push_back(s[i]);
+    }
+    return out;
+}
+
+std::vector<std::string> split(const std::string& s, const char c)
+{
+    std::vector<std::string> out;
+    std::size_t begin(0);
+    while (begin <= s.size())
+    {
+        std::size_t end(s.find(c, begin));
+        if (end == std::string::npos) end = s.size();
+        if (end > begin) out.push_back(s.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return out;
+}
+
+std::map<std::string, std::string> parseParams(const std::string& query)
+{
+    std::map<std::string, std::string> params;
+    for (const std::string& pair : split(query, '&'))
+    {
+        const std::size_t eq(pair.find('='));
+        if (eq == std::string::npos) params[decode(pair)] = "";
+        else params[decode(pair.substr(0, eq))] = decode(pair.substr(eq + 1));
+    }
+    return params;
+}
+
+std::string header(
+    const std::string& status,
+    const std::string& type,
+    const uint64_t size,
+    const std::vector<std::string>& extra = std::vector<std::string>())
+{
+    std::string h =
+        "HTTP/1.1 " + status + "\r\n"
+        "Content-Type: " + type + "\r\n"
+        "Content-Length: " + std::to_string(size) + "\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n";
+    for (const std::string& line : extra) h += line + "\r\n";
+    return h + "\r\n";
+}
+
+bool sendAll(const int client, const char* data, const uint64_t size)
+{
+#ifdef ENTWINE_SOCKETS
+    uint64_t sent(0);
+    while (sent < size)
+    {
+        const ssize_t n(
+            ::send(client, data + sent, size - sent, MSG_NOSIGNAL));
+        if (n <= 0) return false;
+        sent += n;
+    }
+#endif
+    return true;
+}
+
+} // unnamed namespace
+
+Server::Data Server::Cache::get(
+    const std::string& key,
+    const std::function<Data()>& fetch)
+{
+    std::promise<Data> promise;
+    std::shared_future<Data> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it(m_entries.find(key));
+        if (it != m_entries.end())
+        {
+            // Either this is complete, or another thread is fetching it.
+            Entry& entry(it->second);
+            if (entry.lru != m_lru.end())
+            {
+                m_lru.splice(m_lru.begin(), m_lru, entry.lru);
+            }
+            pending = entry.data;
+        }
+        else
+        {
+            Entry& entry(m_entries[key]);
+            entry.data = promise.get_future().share();
+            entry.lru = m_lru.end();
+        }
+    }
+
+    if (pending.valid()) return pending.get();
+
+    Data data;
+    try
+    {
+        data = fetch();
+    }
+    catch (...)
+    {
+        promise.set_exception(std::current_exception());
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.erase(key);
+        throw;
+    }
+    promise.set_value(data);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it(m_entries.find(key));
+
+    // Misses, and responses too large to be worth holding, are not kept.
+    if (!data || data->size() > m_maxBytes)
+    {
+        m_entries.erase(it);
+        return data;
+    }
+
+    m_lru.push_front(key);
+    it->second.lru = m_lru.begin();
+    it->second.size = data->size();
+    m_bytes += data->size();
+
+    while (m_bytes > m_maxBytes)
+    {
+        auto victim(m_entries.find(m_lru.back()));
+        m_bytes -= victim->second.size;
+        m_entries.erase(victim);
+        m_lru.pop_back();
+    }
+
+    return data;
+}
+
+Server::Server(
+    Reader& reader,
+    const uint64_t port,
+    const uint64_t threads,
+    const uint64_t cacheBytes)
+    : m_reader(reader)
+    , m_cache(cacheBytes)
+    , m_pool(threads, threads)
+{
+#ifdef ENTWINE_SOCKETS
+    m_socket = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (m_socket < 0) throw std::runtime_error("Could not create socket");
+
+    const int yes(1);
+    ::setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    if (
+        ::bind(
+            m_socket,
+            reinterpret_cast<sockaddr*>(&address),
+            sizeof(address)) < 0 ||
+        ::listen(m_socket, 64) < 0)
+    {
+        ::close(m_socket);
+        throw std::runtime_error(
+            "Could not serve on port " + std::to_string(port) +
+            ": " + std::strerror(errno));
+    }
+#else
+    throw std::runtime_error("Serving is not supported on this system");
+#endif
+}
+
+Server::~Server()
+{
+    m_done = true;
+    m_pool.join();
+#ifdef ENTWINE_SOCKETS
+    ::close(m_socket);
+#endif
+}
+
+void Server::run()
+{
+#ifdef ENTWINE_SOCKETS
+    while (!m_done)
+    {
+        pollfd p;
+        p.fd = m_socket;
+        p.events = POLLIN;
+        if (::poll(&p, 1, pollMs) <= 0) continue;
+
+        const int client(::accept(m_socket, nullptr, nullptr));
+        if (client < 0) continue;
+
+        m_pool.add([this, client]()
+        {
+            try { respond(client); }
+            catch (std::exception& e)
+            {
+                std::cout << "Request failed: " << e.what() << std::endl;
+            }
+            ::close(client);
+        });
+    }
+#endif
+}
+
+void Server::respond(const int client)
+{
+#ifdef ENTWINE_SOCKETS
+    timeval timeout;
+    timeout.tv_sec = timeoutSeconds;
+    timeout.tv_usec = 0;
+    ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // We only need the request line, so read until we have it.
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n") == std::string::npos && request.size() < 8192)
+    {
+        const ssize_t n(::recv(client, buffer, sizeof(buffer), 0));
+        if (n <= 0) return;
+        request.append(buffer, n);
+    }
+
+    const std::vector<std::string> line(
+        split(request.substr(0, request.find("\r\n")), ' '));
+
+    Response response;
+    if (line.size() != 3 || line[0] != "GET")
+    {
+        response.status = "405 Method Not Allowed";
+    }
+    else
+    {
+        const std::string& target(line[1]);
+        const std::size_t q(target.find('?'));
+        const std::string path(decode(target.substr(0, q)));
+        const std::string query(
+            q == std::string::npos ? "" : target.substr(q + 1));
+
+        if (path.empty() || path[0] != '/' ||
+            path.find("..") != std::string::npos)
+        {
+            response.status = "400 Bad Request";
+        }
+        else if (query.empty() && sendFile(client, path)) return;
+        else
+        {
+            try { response = get(path, query); }
+            catch (std::exception& e)
+            {
+                const std::string message(std::string(e.what()) + "\n");
+                response = Response();
+                response.status = "400 Bad Request";
+                response.type = "text/plain";
+                response.body = std::make_shared<const std::vector<char>>(
+                    message.begin(), message.end());
+            }
+        }
+    }
+
+    if (!response.body)
+    {
+        if (response.status == "200 OK") response.status = "404 Not Found";
+        response.type = "text/plain";
+        const std::string message(response.status + "\n");
+        response.body = std::make_shared<const std::vector<char>>(
+            message.begin(), message.end());
+    }
+
+    const std::string h(
+        header(
+            response.status,
+            response.type,
+            response.body->size(),
+            response.headers));
+
+    if (sendAll(client, h.data(), h.size()))
+    {
+        sendAll(client, response.body->data(), response.body->size());
+    }
+#endif
+}
+
+bool Server::sendFile(const int client, const std::string& path)
+{
+#if defined(ENTWINE_SOCKETS) && defined(__linux__)
+    // Node data, which is never altered on its way out, is sent straight from
+    // its file by the kernel when our dataset is local.
+    const Endpoints& endpoints(m_reader.endpoints());
+    if (!endpoints.output.isLocal() || path.compare(0, 10, "/ept-data/"))
+    {
+        return false;
+    }
+
+    const std::string filename(
+        arbiter::join(endpoints.output.root(), path.substr(1)));
+    const int fd(::open(filename.c_str(), O_RDONLY));
+    if (fd < 0) return false;
+
+    struct stat s;
+    if (::fstat(fd, &s) < 0 || !S_ISREG(s.st_mode))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    const std::string h(
+        header("200 OK", "application/octet-stream", s.st_size));
+    if (sendAll(client, h.data(), h.size()))
+    {
+        off_t offset(0);
+        while (offset < s.st_size)
+        {
+            if (::sendfile(client, fd, &offset, s.st_size - offset) <= 0) break;
+        }
+    }
+
+    ::close(fd);
+    return true;
+#else
+    return false;
+#endif
+}
+
+Server::Response Server::get(const std::string& path, const std::string& query)
+{
+    const std::map<std::string, std::string> params(parseParams(query));
+    if (path == "/query") return getQuery(params);
+    if (path == "/view") return getView(params);
+
+    const std::string subpath(path.substr(1));
+
+    Response response;
+    if (params.count("dims"))
+    {
+        // Re-encode a node as packed records of a subset of its dimensions.
+        const std::string filename(subpath.substr(subpath.rfind('/') + 1));
+        if (subpath.compare(0, 9, "ept-data/"))
+        {
+            throw std::runtime_error("Only nodes may be re-encoded");
+        }
+
+        const Dxyz key(filename.substr(0, filename.find('.')));
+        Query q;
+        q.dimensions = split(params.at("dims"), ',');
+        const Schema schema(m_reader.schema(q));
+
+        response.body = m_cache.get(
+            "node:" + key.toString() + "?" + params.at("dims"),
+            [this, &key, &schema]()
+            {
+                return std::make_shared<const std::vector<char>>(
+                    m_reader.read(key, schema));
+            });
+        response.headers.push_back(
+            "X-Points: " + std::to_string(
+                response.body->size() / getPointSize(schema)));
+        return response;
+    }
+
+    response.body = getFile(subpath);
+    if (arbiter::getExtension(subpath) == "json")
+    {
+        response.type = "application/json";
+    }
+    return response;
+}
+
+Server::Data Server::getFile(const std::string& subpath)
+{
+    const Endpoints& endpoints(m_reader.endpoints());
+    return m_cache.get(
+        "file:" + subpath,
+        [&endpoints, &subpath]() -> Data
+        {
+            // The nodes of a packed dataset are read from their packs.
+            if (endpoints.packs && !subpath.compare(0, 9, "ept-data/"))
+            {
+                if (auto data = takeData(endpoints, subpath.substr(9)))
+                {
+                    return std::make_shared<const std::vector<char>>(
+                        std::move(*data));
+                }
+                return Data();
+            }
+            if (auto data = endpoints.output.tryGetBinary(subpath))
+            {
+                return std::make_shared<const std::vector<char>>(
+                    std::move(*data));
+            }
+            return Data();
+        });
+}
+
+Server::Response Server::getQuery(
+    const std::map<std::string, std::string>& params)
+{
+    Query q;
+    for (const auto& p : params)
+    {
+        if (p.first == "bounds") q.bounds = Bounds(json::parse(p.second));
+        else if (p.first == "depthBegin") q.depthBegin = std::stoull(p.second);
+        else if (p.first == "depthEnd") q.depthEnd = std::stoull(p.second);
+        else if (p.first == "resolution") q.resolution = std::stod(p.second);
+        else if (p.first == "dims") q.dimensions = split(p.second, ',');
+        else if (p.first == "time")
+        {
+            const StringList range(split(p.second, ','));
+            if (range.size() != 2)
+            {
+                throw std::runtime_error("Invalid time: " + p.second);
+            }
+            q.time = std::make_pair(std::stod(range[0]), std::stod(range[1]));
+        }
+        else throw std::runtime_error("Invalid query parameter: " + p.first);
+    }
+    const Schema schema(m_reader.schema(q));
+
+    // Parameters are ordered by our map, so equivalent queries share a key.
+    std::string key("query:");
+    for (const auto& p : params) key += p.first + "=" + p.second + "&";
+
+    Response response;
+    response.body = m_cache.get(key, [this, &q]()
+    {
+        return std::make_shared<const std::vector<char>>(m_reader.read(q));
+    });
+    response.headers.push_back(
+        "X-Points: " + std::to_string(
+            response.body->size() / getPointSize(schema)));
+    return response;
+}
+
+std::shared_ptr<Traversal> Server::getTraversal(const std::string& session)
+{
+    std::lock_guard<std::mutex> lock(m_sessionsMutex);
+    auto it(m_sessions.find(session));
+    if (it != m_sessions.end())
+    {
+        m_sessionLru.splice(m_sessionLru.begin(), m_sessionLru, it->second.lru);
+        return it->second.traversal;
+    }
+
+    m_sessionLru.push_front(session);
+    Session& s(m_sessions[session]);
+    s.traversal = std::make_shared<Traversal>(m_reader);
+    s.lru = m_sessionLru.begin();
+
+    if (m_sessions.size() > maxSessions)
+    {
+        m_sessions.erase(m_sessionLru.back());
+        m_sessionLru.pop_back();
+    }
+    return s.traversal;
+}
+
+Server::Response Server::getView(
+    const std::map<std::string, std::string>& params)
+{
+    View view;
+    std::string session;
+    bool hasMatrix(false);
+    for (const auto& p : params)
+    {
+        if (p.first == "matrix")
+        {
+            const json j(json::parse(p.second));
+            if (!j.is_array() || j.size() != 16)
+            {
+                throw std::runtime_error("Invalid matrix: " + p.second);
+            }
+            for (std::size_t i(0); i < 16; ++i) view.matrix[i] = j.at(i);
+            hasMatrix = true;
+        }
+        else if (p.first == "eye") view.eye = Point(json::parse(p.second));
+        else if (p.first == "fov") view.fov = std::stod(p.second);
+        else if (p.first == "height") view.height = std::stod(p.second);
+        else if (p.first == "error") view.maxError = std::stod(p.second);
+        else if (p.first == "budget") view.pointBudget = std::stoull(p.second);
+        else if (p.first == "prefetch") view.prefetch = std::stoull(p.second);
+        else if (p.first == "session") session = p.second;
+        else throw std::runtime_error("Invalid view parameter: " + p.first);
+    }
+    if (!hasMatrix) throw std::runtime_error("A view requires a matrix");
+
+    // Without a session, every node of the selection is new.
+    Traversal single(m_reader);
+    const Selection selection(
+        session.size() ? getTraversal(session)->update(view) :
+            single.update(view));
+
+    // Node data is fetched into our cache ahead of its request, unless it is
+    // sent from its files.
+    const Endpoints& endpoints(m_reader.endpoints());
+    if (!endpoints.output.isLocal() || endpoints.packs)
+    {
+        const Metadata& metadata(m_reader.metadata());
+        for (const Reader::Node& node : selection.prefetch)
+        {
+            const std::string subpath(
+                "ept-data/" + node.key.toString() +
+                io::getNodeExtension(metadata, node.key.d));
+            m_pool.add([this, subpath]()
+            {
+                try { getFile(subpath); }
+                catch (...) { }
+            });
+        }
+    }
+
+    json removed = json::array();
+    for (const Dxyz& key : selection.removed) removed.push_back(key.toString());
+
+    const json j {
+        { "nodes", toJson(selection.nodes) },
+        { "added", toJson(selection.added) },
+        { "removed", removed },
+        { "prefetch", toJson(selection.prefetch) }
+    };
+    const std::string body(j.dump());
+
+    Response response;
+    response.type = "application/json";
+    response.body = std::make_shared<const std::vector<char>>(
+        body.begin(), body.end());
+    return response;
+}
+
+} // namespace entwine
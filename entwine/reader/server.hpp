@@ -0,0 +1,127 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/reader/reader.hpp>
+#include <entwine/reader/traversal.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+// An HTTP server for an EPT dataset, answering GET requests for:
+//
+//  - the files of the dataset, by their paths within it.  For local datasets,
+//    node data is sent straight from its file.
+//  - a node file with ?dims=X,Y,Z, which is decoded and answered with packed
+//    records of those dimensions.
+//  - /query, with the parameters bounds, depthBegin, depthEnd, resolution,
+//    and dims of a Query, answered with packed records of its points.
+//  - /view, with the parameters matrix, eye, fov, height, error, budget, and
+//    prefetch of a View, answered with the JSON of its Selection.  Requests
+//    with the same session parameter share a Traversal, so that the changes
+//    from the previous view of a session are given.  The nodes to prefetch
+//    are fetched into our cache.
+//
+// Responses other than those sent from files are held in a cache of at most
+// cacheBytes, and concurrent requests for the same response are coalesced
+// into a single fetch.  Only supported on POSIX systems - elsewhere,
+// construction throws.
+class Server
+{
+public:
+    Server(
+        Reader& reader,
+        uint64_t port,
+        uint64_t threads,
+        uint64_t cacheBytes);
+    ~Server();
+
+    // Serve requests until stop() is called.
+    void run();
+    void stop() { m_done = true; }
+
+private:
+    using Data = std::shared_ptr<const std::vector<char>>;
+
+    struct Response
+    {
+        std::string status = "200 OK";
+        std::string type = "application/octet-stream";
+        Data body;
+        std::vector<std::string> headers;
+    };
+
+    class Cache
+    {
+    public:
+        explicit Cache(uint64_t maxBytes) : m_maxBytes(maxBytes) { }
+
+        // Get the data for this key, or fetch it, awaiting any fetch already
+        // in progress for it.
+        Data get(const std::string& key, const std::function<Data()>& fetch);
+
+    private:
+        struct Entry
+        {
+            std::shared_future<Data> data;
+            uint64_t size = 0;
+            std::list<std::string>::iterator lru;
+        };
+
+        const uint64_t m_maxBytes;
+
+        std::mutex m_mutex;
+        std::map<std::string, Entry> m_entries;
+        std::list<std::string> m_lru;
+        uint64_t m_bytes = 0;
+    };
+
+    struct Session
+    {
+        std::shared_ptr<Traversal> traversal;
+        std::list<std::string>::iterator lru;
+    };
+
+    void respond(int client);
+    Response get(const std::string& path, const std::string& query);
+    Response getQuery(const std::map<std::string, std::string>& params);
+    Response getView(const std::map<std::string, std::string>& params);
+    Data getFile(const std::string& subpath);
+    std::shared_ptr<Traversal> getTraversal(const std::string& session);
+    bool sendFile(int client, const std::string& path);
+
+    Reader& m_reader;
+    Cache m_cache;
+    Pool m_pool;
+    int m_socket = -1;
+
+    std::mutex m_sessionsMutex;
+    std::map<std::string, Session> m_sessions;
+    std::list<std::string> m_sessionLru;
+    std::atomic_bool m_done{ false };
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+};
+
+} // namespace entwine
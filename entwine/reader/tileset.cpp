@@ -0,0 +1,364 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/tileset.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+#include <entwine/types/key.hpp>
+#include <entwine/util/io.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+namespace tileset
+{
+
+namespace
+{
+
+enum class Color { None, Rgb, Intensity, Tile };
+
+Color getColor(const Options& options, const Schema& schema)
+{
+    const bool rgb(
+        maybeFind(schema, "Red") &&
+        maybeFind(schema, "Green") &&
+        maybeFind(schema, "Blue"));
+    const bool intensity(maybeFind(schema, "Intensity"));
+
+    const std::string& type(options.colorType);
+    if (type.empty())
+    {
+        if (rgb) return Color::Rgb;
+        if (intensity) return Color::Intensity;
+        return Color::None;
+    }
+
+    if (type == "none") return Color::None;
+    if (type == "tile") return Color::Tile;
+    if (type == "rgb" && rgb) return Color::Rgb;
+    if (type == "intensity" && intensity) return Color::Intensity;
+    throw std::runtime_error("Invalid colorType for this dataset: " + type);
+}
+
+// Positions are read as doubles, followed by any color dimensions as two-byte
+// values.
+Schema getSchema(const Color color)
+{
+    Schema schema {
+        Dimension("X", DimType::Double),
+        Dimension("Y", DimType::Double),
+        Dimension("Z", DimType::Double)
+    };
+
+    if (color == Color::Rgb)
+    {
+        schema.emplace_back("Red", DimType::Unsigned16);
+        schema.emplace_back("Green", DimType::Unsigned16);
+        schema.emplace_back("Blue", DimType::Unsigned16);
+    }
+    else if (color == Color::Intensity)
+    {
+        schema.emplace_back("Intensity", DimType::Unsigned16);
+    }
+
+    return schema;
+}
+
+uint64_t pad(const uint64_t n) { return (n + 7) / 8 * 8; }
+
+// Each node of our subtree which holds points, or is an ancestor of one, in
+// key order, with its children.
+using Tree = std::map<Dxyz, std::vector<Dxyz>>;
+
+class Writer
+{
+public:
+    Writer(Reader& reader, const std::string& path, const Options& options)
+        : m_reader(reader)
+        , m_metadata(reader.metadata())
+        , m_out(reader.endpoints().arbiter->getEndpoint(path))
+        , m_color(getColor(options, m_metadata.absoluteSchema))
+        , m_schema(getSchema(m_color))
+        , m_truncate(options.truncate)
+        , m_rootError(m_metadata.bounds.width() / options.geometricErrorDivisor)
+        , m_step(m_metadata.internal.hierarchyStep)
+    {
+        if (options.geometricErrorDivisor <= 0)
+        {
+            throw std::runtime_error("Invalid geometricErrorDivisor");
+        }
+        if (m_out.isLocal() && !arbiter::mkdirp(m_out.prefixedRoot()))
+        {
+            throw std::runtime_error("Failed to create directory: " + path);
+        }
+    }
+
+    uint64_t write()
+    {
+        for (const Reader::Node& node : m_reader.nodes(Query()))
+        {
+            m_points[node.key] = node.points;
+
+            Dxyz key(node.key);
+            m_tree[key];
+            while (key.d)
+            {
+                const Dxyz parent(
+                    key.d - 1,
+                    key.x >> 1,
+                    key.y >> 1,
+                    key.z >> 1);
+                std::vector<Dxyz>& children(m_tree[parent]);
+                const bool known(
+                    std::find(children.begin(), children.end(), key) !=
+                    children.end());
+                if (known) break;
+                children.push_back(key);
+                key = parent;
+            }
+        }
+
+        for (auto& p : m_tree) std::sort(p.second.begin(), p.second.end());
+
+        std::atomic_uint64_t tiles(0);
+        Pool pool(m_reader.threads());
+
+        for (const auto& p : m_points)
+        {
+            const Dxyz key(p.first);
+            pool.add([this, key, &tiles]()
+            {
+                const std::vector<char> data(m_reader.read(key, m_schema));
+                ensurePut(m_out, key.toString() + ".pnts", toPnts(key, data));
+                ++tiles;
+            });
+        }
+
+        for (const auto& p : m_tree)
+        {
+            const Dxyz& key(p.first);
+            if (key.d && !starts(key)) continue;
+
+            pool.add([this, key]()
+            {
+                const json tileset {
+                    { "asset", { { "version", "1.0" } } },
+                    { "geometricError", getError(key) },
+                    { "root", getTile(key) }
+                };
+                const std::string filename(
+                    key.d ? key.toString() + ".json" : "tileset.json");
+                ensurePut(m_out, filename, tileset.dump());
+            });
+        }
+
+        pool.join();
+
+        if (pool.errors().size())
+        {
+            throw std::runtime_error(pool.errors().front());
+        }
+
+        return tiles;
+    }
+
+private:
+    // True if this node is the root of an external tileset.
+    bool starts(const Dxyz& key) const
+    {
+        return key.d && m_step && key.d % m_step == 0;
+    }
+
+    // Leaves introduce no error.
+    double getError(const Dxyz& key) const
+    {
+        if (m_tree.at(key).empty()) return 0;
+        return m_rootError / std::pow(2.0, key.d);
+    }
+
+    json getBox(const Dxyz& key) const
+    {
+        const Bounds b(getNodeBounds(m_metadata, key));
+        const Point& mid(b.mid());
+        return {
+            mid.x, mid.y, mid.z,
+            b.width() / 2.0, 0, 0,
+            0, b.depth() / 2.0, 0,
+            0, 0, b.height() / 2.0
+        };
+    }
+
+    // The tile for this node, along with its subtree within its tileset.
+    // The roots of external tilesets are only referenced.
+    json getTile(const Dxyz& key, const bool root = true) const
+    {
+        json tile {
+            { "boundingVolume", { { "box", getBox(key) } } },
+            { "geometricError", getError(key) }
+        };
+        if (root) tile["refine"] = "ADD";
+
+        if (!root && starts(key))
+        {
+            tile["content"] = { { "uri", key.toString() + ".json" } };
+            return tile;
+        }
+
+        if (m_points.count(key))
+        {
+            tile["content"] = { { "uri", key.toString() + ".pnts" } };
+        }
+
+        const std::vector<Dxyz>& children(m_tree.at(key));
+        if (children.size())
+        {
+            json& list(tile["children"] = json::array());
+            for (const Dxyz& child : children)
+            {
+                list.push_back(getTile(child, false));
+            }
+        }
+
+        return tile;
+    }
+
+    // Positions are quantized to 16 bits within the bounds of the node.
+    std::vector<char> toPnts(const Dxyz& key, const std::vector<char>& data)
+        const
+    {
+        const uint64_t pointSize(getPointSize(m_schema));
+        const uint64_t n(data.size() / pointSize);
+
+        const Bounds bounds(getNodeBounds(m_metadata, key));
+        const Point& offset(bounds.min());
+        const Point scale(bounds.width(), bounds.depth(), bounds.height());
+
+        const bool colored(m_color != Color::None);
+        const uint64_t positionBytes(n * 3 * sizeof(uint16_t));
+        const uint64_t colorOffset(pad(positionBytes));
+
+        json table {
+            { "POINTS_LENGTH", n },
+            { "QUANTIZED_VOLUME_OFFSET", { offset.x, offset.y, offset.z } },
+            { "QUANTIZED_VOLUME_SCALE", { scale.x, scale.y, scale.z } },
+            { "POSITION_QUANTIZED", { { "byteOffset", 0 } } }
+        };
+        if (colored) table["RGB"] = { { "byteOffset", colorOffset } };
+
+        // The binary body must begin, and end, on an 8-byte boundary.
+        const uint64_t headerSize(28);
+        std::string text(table.dump());
+        text.resize(pad(headerSize + text.size()) - headerSize, ' ');
+
+        const uint64_t binarySize(
+            pad(colored ? colorOffset + n * 3 : positionBytes));
+        const uint64_t total(headerSize + text.size() + binarySize);
+
+        // The magic string is followed by the version, the total length, and
+        // the lengths of the feature table and the empty batch table.
+        std::vector<char> out(total, 0);
+        const uint32_t header[6] = {
+            1,
+            static_cast<uint32_t>(total),
+            static_cast<uint32_t>(text.size()),
+            static_cast<uint32_t>(binarySize),
+            0, 0
+        };
+        std::memcpy(out.data(), "pnts", 4);
+        std::memcpy(out.data() + 4, header, sizeof(header));
+        std::copy(text.begin(), text.end(), out.data() + headerSize);
+
+        char* body(out.data() + headerSize + text.size());
+        uint16_t* positions(reinterpret_cast<uint16_t*>(body));
+        uint8_t* colors(reinterpret_cast<uint8_t*>(body + colorOffset));
+
+        const auto quantize([](double v, double lo, double size)
+        {
+            const double q(size > 0 ? (v - lo) / size * 65535.0 : 0);
+            return static_cast<uint16_t>(
+                std::round(std::min(65535.0, std::max(0.0, q))));
+        });
+        const auto toByte([this](uint16_t v)
+        {
+            return static_cast<uint8_t>(
+                m_truncate ? v >> 8 : std::min<uint16_t>(v, 255));
+        });
+
+        // Tiles colored randomly are colored consistently by their keys.
+        const std::size_t hash(std::hash<std::string>()(key.toString()));
+        const uint8_t tile[3] = {
+            static_cast<uint8_t>(hash),
+            static_cast<uint8_t>(hash >> 8),
+            static_cast<uint8_t>(hash >> 16)
+        };
+
+        const char* pos(data.data());
+        for (uint64_t i(0); i < n; ++i, pos += pointSize)
+        {
+            double xyz[3];
+            std::memcpy(xyz, pos, sizeof(xyz));
+            positions[i * 3 + 0] = quantize(xyz[0], offset.x, scale.x);
+            positions[i * 3 + 1] = quantize(xyz[1], offset.y, scale.y);
+            positions[i * 3 + 2] = quantize(xyz[2], offset.z, scale.z);
+
+            uint8_t* rgb(colors + i * 3);
+            if (m_color == Color::Rgb)
+            {
+                uint16_t c[3];
+                std::memcpy(c, pos + sizeof(xyz), sizeof(c));
+                for (int j(0); j < 3; ++j) rgb[j] = toByte(c[j]);
+            }
+            else if (m_color == Color::Intensity)
+            {
+                uint16_t c(0);
+                std::memcpy(&c, pos + sizeof(xyz), sizeof(c));
+                std::fill(rgb, rgb + 3, toByte(c));
+            }
+            else if (m_color == Color::Tile)
+            {
+                std::copy(tile, tile + 3, rgb);
+            }
+        }
+
+        return out;
+    }
+
+    Reader& m_reader;
+    const Metadata& m_metadata;
+    const arbiter::Endpoint m_out;
+    const Color m_color;
+    const Schema m_schema;
+    const bool m_truncate;
+    const double m_rootError;
+    const uint64_t m_step;
+
+    std::map<Dxyz, uint64_t> m_points;
+    Tree m_tree;
+};
+
+} // unnamed namespace
+
+uint64_t write(Reader& reader, const std::string& path, const Options& options)
+{
+    return Writer(reader, path, options).write();
+}
+
+} // namespace tileset
+} // namespace entwine
@@ -0,0 +1,54 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <entwine/reader/reader.hpp>
+
+namespace entwine
+{
+namespace tileset
+{
+
+struct Options
+{
+    // One of "none", "rgb", "intensity", or "tile", which colors each tile
+    // randomly.  If empty, RGB is used if the dataset has it, or otherwise
+    // Intensity if it has that.
+    std::string colorType;
+
+    // If true, two-byte color values are scaled down to one byte, rather
+    // than clamped to it.
+    bool truncate = false;
+
+    // The geometric error of the root tile is the width of the dataset's cube
+    // over this divisor, and it halves with each depth.
+    double geometricErrorDivisor = 32.0;
+};
+
+// Convert this dataset into a Cesium 3D Tiles tileset at this path, with a
+// tile for each node of its octree.  Nodes are decoded and written in
+// parallel, each as a pnts tile named for its key whose positions are
+// quantized within the bounds of its node.  The tile tree follows the
+// hierarchy, and like the hierarchy it is split into external tilesets, named
+// for their root keys, at every hierarchy step.  The dataset should have been
+// built in EPSG:4978 to be positioned properly.
+//
+// Returns the number of tiles written.
+uint64_t write(
+    Reader& reader,
+    const std::string& path,
+    const Options& options = Options());
+
+} // namespace tileset
+} // namespace entwine
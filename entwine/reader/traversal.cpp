@@ -0,0 +1,173 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/traversal.hpp>
+
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+
+namespace entwine
+{
+
+namespace
+{
+
+using Plane = std::array<double, 4>;
+using Frustum = std::array<Plane, 6>;
+
+// Extract the clipping planes from a column-major view-projection matrix, each
+// as the coefficients of ax + by + cz + d >= 0 for the points within it.
+Frustum getFrustum(const std::array<double, 16>& m)
+{
+    const auto row([&m](std::size_t i)
+    {
+        return Plane {{ m[i], m[4 + i], m[8 + i], m[12 + i] }};
+    });
+
+    const Plane w(row(3));
+    Frustum frustum;
+    for (std::size_t i(0); i < 3; ++i)
+    {
+        const Plane r(row(i));
+        for (std::size_t c(0); c < 4; ++c)
+        {
+            frustum[i * 2][c] = w[c] + r[c];
+            frustum[i * 2 + 1][c] = w[c] - r[c];
+        }
+    }
+    return frustum;
+}
+
+bool intersects(const Frustum& frustum, const Bounds& b)
+{
+    for (const Plane& p : frustum)
+    {
+        // If even the corner farthest along the normal of a plane is outside
+        // of it, then so is the whole box.
+        const double x(p[0] >= 0 ? b.max().x : b.min().x);
+        const double y(p[1] >= 0 ? b.max().y : b.min().y);
+        const double z(p[2] >= 0 ? b.max().z : b.min().z);
+        if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0) return false;
+    }
+    return true;
+}
+
+} // unnamed namespace
+
+double Traversal::error(
+    const View& view,
+    const Dxyz& key,
+    const Bounds& b) const
+{
+    // The points of a node at depth d are spaced by its width over our span.
+    const Metadata& m(m_reader.metadata());
+    const double spacing(m.bounds.width() / m.span / (1ull << key.d));
+
+    // A camera within the bounding sphere of a node is as near as can be.
+    const double radius(std::sqrt(b.min().sqDist3d(b.max())) / 2);
+    const double distance(std::sqrt(view.eye.sqDist3d(b.mid())) - radius);
+    if (distance <= 0) return std::numeric_limits<double>::max();
+
+    return spacing * view.height / (2 * std::tan(view.fov / 2) * distance);
+}
+
+Selection Traversal::update(const View& view)
+{
+    if (view.maxError <= 0 && !view.pointBudget)
+    {
+        throw std::runtime_error("A view needs a maximum error or budget");
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const Metadata& m(m_reader.metadata());
+    const Frustum frustum(getFrustum(view.matrix));
+
+    // Candidates are the visible nodes whose parents have been refined.  The
+    // children of the nodes which were selected but not refined are held
+    // ahead, for prefetching.
+    std::priority_queue<Candidate> queue;
+    std::priority_queue<Candidate> ahead;
+
+    const auto push([&](
+        std::priority_queue<Candidate>& q,
+        const std::vector<Dxyz>& keys)
+    {
+        std::vector<Dxyz> visible;
+        std::vector<Bounds> bounds;
+        for (const Dxyz& key : keys)
+        {
+            const Bounds b(getNodeBounds(m, key));
+            if (!intersects(frustum, b)) continue;
+            visible.push_back(key);
+            bounds.push_back(b);
+        }
+
+        const std::vector<Reader::Node> nodes(m_reader.resolve(visible));
+        for (std::size_t i(0); i < nodes.size(); ++i)
+        {
+            q.push({ nodes[i], error(view, nodes[i].key, bounds[i]) });
+        }
+    });
+
+    push(queue, { Dxyz() });
+
+    Selection selection;
+    uint64_t points(0);
+    while (queue.size())
+    {
+        const Candidate c(queue.top());
+        if (view.pointBudget && points + c.node.points > view.pointBudget)
+        {
+            break;
+        }
+        queue.pop();
+
+        // Nodes without points of their own may still have children.
+        if (c.node.points) selection.nodes.push_back(c.node);
+        points += c.node.points;
+
+        const std::vector<Dxyz> children(m_reader.children(c.node.key));
+        if (view.maxError <= 0 || c.error > view.maxError)
+        {
+            push(queue, children);
+        }
+        else push(ahead, children);
+    }
+
+    while (
+        selection.prefetch.size() < view.prefetch &&
+        (queue.size() || ahead.size()))
+    {
+        std::priority_queue<Candidate>& q(
+            ahead.empty() || (queue.size() && ahead.top() < queue.top()) ?
+                queue : ahead);
+        if (q.top().node.points) selection.prefetch.push_back(q.top().node);
+        q.pop();
+    }
+
+    std::set<Dxyz> selected;
+    for (const Reader::Node& node : selection.nodes)
+    {
+        selected.insert(node.key);
+        if (!m_selected.count(node.key)) selection.added.push_back(node);
+    }
+    for (const Dxyz& key : m_selected)
+    {
+        if (!selected.count(key)) selection.removed.push_back(key);
+    }
+    m_selected = std::move(selected);
+
+    return selection;
+}
+
+} // namespace entwine
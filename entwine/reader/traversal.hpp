@@ -0,0 +1,99 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <entwine/reader/reader.hpp>
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/types/point.hpp>
+
+namespace entwine
+{
+
+// A camera from which a dataset is viewed, in the coordinates of its ept.json.
+struct View
+{
+    // The combined projection and view matrix of the camera, in column-major
+    // order as for OpenGL or WebGL, from which its frustum is taken.
+    std::array<double, 16> matrix;
+
+    // The position of the camera, and its vertical field of view in radians.
+    Point eye;
+    double fov = 1;
+
+    // The height, in pixels, of the viewport.
+    double height = 1080;
+
+    // Nodes are refined while their point spacing would be projected to more
+    // than this many pixels.  Zero leaves refinement to the point budget.
+    double maxError = 1;
+
+    // If nonzero, no more points than this are selected.
+    uint64_t pointBudget = 0;
+
+    // The number of nodes past the selection to hold ready.
+    uint64_t prefetch = 8;
+};
+
+// The nodes selected for a view, from the most to the least important, and the
+// changes from the previous selection of the same traversal.
+struct Selection
+{
+    std::vector<Reader::Node> nodes;
+    std::vector<Reader::Node> added;
+    std::vector<Dxyz> removed;
+
+    // The nodes which would be selected next, as the view moves closer or the
+    // budget grows, whose hierarchy has been resolved.  Clients may fetch
+    // their data while it is idle.
+    std::vector<Reader::Node> prefetch;
+};
+
+// A view-dependent traversal of the hierarchy of a dataset.  Nodes within the
+// frustum of a view are visited in order of their projected point spacing,
+// so that a point budget is spent on the nodes of the most visual importance,
+// and only the hierarchy pages which the traversal reaches are fetched.
+class Traversal
+{
+public:
+    explicit Traversal(Reader& reader) : m_reader(reader) { }
+
+    // Select the nodes of this view.  Concurrent updates are serialized.
+    Selection update(const View& view);
+
+private:
+    struct Candidate
+    {
+        Reader::Node node;
+        double error;
+
+        bool operator<(const Candidate& other) const
+        {
+            return error < other.error;
+        }
+    };
+
+    // The pixels onto which the point spacing of this node is projected.
+    double error(const View& view, const Dxyz& key, const Bounds& b) const;
+
+    Reader& m_reader;
+
+    std::mutex m_mutex;
+    std::set<Dxyz> m_selected;
+};
+
+} // namespace entwine
@@ -0,0 +1,196 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/verify.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#include <entwine/io/io.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/util/pack.hpp>
+#include <entwine/util/pool.hpp>
+#include <entwine/util/time.hpp>
+
+namespace entwine
+{
+namespace verifier
+{
+
+namespace
+{
+
+// Only this many errors are listed, though all of them are counted.
+const std::size_t maxErrors(100);
+
+class Errors
+{
+public:
+    explicit Errors(Report& report) : m_report(report) { }
+
+    void add(const std::string& error)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_report.errorCount;
+        if (m_report.errors.size() < maxErrors)
+        {
+            m_report.errors.push_back(error);
+        }
+    }
+
+private:
+    Report& m_report;
+    std::mutex m_mutex;
+};
+
+double secondsSince(const TimePoint start)
+{
+    return since<std::chrono::milliseconds>(start) / 1000.0;
+}
+
+} // unnamed namespace
+
+Report verify(Reader& reader, const double sample)
+{
+    const Metadata& metadata(reader.metadata());
+    const Endpoints& endpoints(reader.endpoints());
+
+    Report report;
+    Errors errors(report);
+
+    std::vector<Reader::Node> nodes(reader.nodes(Query()));
+    std::sort(
+        nodes.begin(),
+        nodes.end(),
+        [](const Reader::Node& a, const Reader::Node& b)
+        {
+            return a.key < b.key;
+        });
+    report.nodes = nodes.size();
+
+    // Each node is an object of its own, unless our nodes are packed.
+    std::map<std::string, std::vector<Dxyz>> objects;
+    for (const Reader::Node& node : nodes)
+    {
+        const std::string filename(
+            metadata.internal.pack
+                ? pack::getFilename(
+                    pack::getRoot(node.key, metadata.internal.hierarchyStep))
+                : node.key.toString() +
+                    io::getNodeExtension(metadata, node.key.d));
+        objects[filename].push_back(node.key);
+    }
+    report.objects = objects.size();
+
+    const auto checkStart(now());
+    std::atomic_uint64_t bytes(0);
+    {
+        Pool pool(reader.threads());
+        for (const auto& p : objects)
+        {
+            pool.add([&]()
+            {
+                const auto size(endpoints.data.tryGetSize(p.first));
+                if (size) bytes += *size;
+                else errors.add("Missing " + p.first);
+            });
+        }
+        pool.join();
+        for (const std::string& e : pool.errors()) errors.add(e);
+    }
+    report.bytes = bytes;
+    report.checkSeconds = secondsSince(checkStart);
+
+    if (sample <= 0) return report;
+
+    const uint64_t every(
+        std::max<uint64_t>(std::llround(1.0 / std::min(sample, 1.0)), 1));
+
+    const Schema xyz {
+        Dimension("X", DimType::Double),
+        Dimension("Y", DimType::Double),
+        Dimension("Z", DimType::Double)
+    };
+    const uint64_t pointSize(getPointSize(xyz));
+
+    const auto decodeStart(now());
+    std::atomic_uint64_t decoded(0);
+    std::atomic_uint64_t points(0);
+    {
+        Pool pool(reader.threads());
+        for (std::size_t i(0); i < nodes.size(); i += every)
+        {
+            pool.add([&, i]()
+            {
+                const Reader::Node& node(nodes[i]);
+                const std::string name(node.key.toString());
+                const std::vector<char> data(reader.read(node.key, xyz));
+                const uint64_t np(data.size() / pointSize);
+
+                ++decoded;
+                points += np;
+
+                if (np != node.points)
+                {
+                    errors.add(
+                        name + " has " + std::to_string(np) + " points, " +
+                        "but its hierarchy count is " +
+                        std::to_string(node.points));
+                }
+
+                // Allow a voxel of slack for the rounding of coordinates to
+                // their scale.
+                const Bounds b(getNodeBounds(metadata, node.key));
+                const double slack(b.width() / metadata.span);
+                const Bounds grown(b.min() - slack, b.max() + slack);
+
+                double p[3];
+                for (uint64_t n(0); n < np; ++n)
+                {
+                    std::memcpy(p, data.data() + n * pointSize, pointSize);
+                    if (!grown.contains(Point(p[0], p[1], p[2])))
+                    {
+                        errors.add(name + " holds a point outside of it");
+                        break;
+                    }
+                }
+            });
+        }
+        pool.join();
+        for (const std::string& e : pool.errors()) errors.add(e);
+    }
+    report.decoded = decoded;
+    report.points = points;
+    report.decodeSeconds = secondsSince(decodeStart);
+
+    return report;
+}
+
+void to_json(json& j, const Report& report)
+{
+    j = {
+        { "nodes", report.nodes },
+        { "objects", report.objects },
+        { "bytes", report.bytes },
+        { "checkSeconds", report.checkSeconds },
+        { "decoded", report.decoded },
+        { "points", report.points },
+        { "decodeSeconds", report.decodeSeconds },
+        { "errorCount", report.errorCount },
+        { "errors", report.errors }
+    };
+}
+
+} // namespace verifier
+} // namespace entwine
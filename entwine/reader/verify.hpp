@@ -0,0 +1,54 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <entwine/reader/reader.hpp>
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+namespace verifier
+{
+
+struct Report
+{
+    // Nodes listed by the hierarchy, and the objects holding their data:
+    // one per node, or one per pack for packed datasets.
+    uint64_t nodes = 0;
+    uint64_t objects = 0;
+    uint64_t bytes = 0;
+    double checkSeconds = 0;
+
+    // Nodes decoded, and their points.
+    uint64_t decoded = 0;
+    uint64_t points = 0;
+    double decodeSeconds = 0;
+
+    // The first of the problems found, and the number of all of them.
+    std::vector<std::string> errors;
+    uint64_t errorCount = 0;
+};
+
+// Check that the data of every node in the hierarchy of this dataset exists,
+// with a concurrent size request per object.  Then decode this fraction of
+// the nodes, evenly spaced in key order and including the root, and check
+// that the point count of each matches the hierarchy and that its points lie
+// within the node, give or take one voxel.
+Report verify(Reader& reader, double sample);
+
+void to_json(json& j, const Report& report);
+
+} // namespace verifier
+} // namespace entwine
@@ -201,6 +201,12 @@ std::unique_ptr<std::size_t> Arbiter::tryGetSize(const std::string path) const
     return getDriver(path).tryGetSize(stripProtocol(path));
 }
 
+std::unique_ptr<std::string> Arbiter::tryGetVersion(
+        const std::string path) const
+{
+    return getDriver(path).tryGetVersion(stripProtocol(path));
+}
+
 void Arbiter::put(const std::string path, const std::string& data) const
 {
     return getDriver(path).put(stripProtocol(path), data);
@@ -352,6 +358,25 @@ void Arbiter::copyFile(
     }
 }
 
+void Arbiter::remove(const std::vector<std::string>& paths) const
+{
+    std::map<std::string, std::vector<std::string>> types;
+    for (const std::string& path : paths)
+    {
+        types[getProtocol(path)].push_back(path);
+    }
+
+    for (const auto& type : types)
+    {
+        std::vector<std::string> stripped;
+        for (const std::string& path : type.second)
+        {
+            stripped.push_back(stripProtocol(path));
+        }
+        getDriver(type.second.front()).remove(stripped);
+    }
+}
+
 bool Arbiter::isRemote(const std::string path) const
 {
     return getDriver(path).isRemote();
@@ -379,6 +404,14 @@ std::vector<std::string> Arbiter::resolve(
     return getDriver(path).resolve(stripProtocol(path), verbose);
 }
 
+std::vector<std::string> Arbiter::resolvePages(
+        const std::string path,
+        const Driver::PageCallback& onPage,
+        const bool verbose) const
+{
+    return getDriver(path).resolvePages(stripProtocol(path), onPage, verbose);
+}
+
 Endpoint Arbiter::getEndpoint(const std::string root) const
 {
     return Endpoint(getDriver(root), stripProtocol(root));
@@ -501,6 +534,16 @@ void Driver::copy(std::string src, std::string dst) const
     put(dst, getBinary(src));
 }
 
+std::unique_ptr<std::string> Driver::tryGetVersion(std::string) const
+{
+    return std::unique_ptr<std::string>();
+}
+
+void Driver::remove(const std::vector<std::string>&) const
+{
+    throw ArbiterError("Cannot remove files of type " + type());
+}
+
 std::vector<std::string> Driver::resolve(
         std::string path,
         const bool verbose) const
@@ -534,6 +577,15 @@ std::vector<std::string> Driver::resolve(
     return results;
 }
 
+std::vector<std::string> Driver::resolvePages(
+        const std::string path,
+        const PageCallback& onPage,
+        const bool verbose) const
+{
+    onPage(resolve(path, verbose));
+    return std::vector<std::string>();
+}
+
 std::vector<std::string> Driver::glob(std::string path, bool verbose) const
 {
     throw ArbiterError("Cannot glob driver for: " + path);
@@ -725,6 +777,12 @@ std::unique_ptr<std::size_t> Endpoint::tryGetSize(
     return m_driver->tryGetSize(fullPath(subpath));
 }
 
+std::unique_ptr<std::string> Endpoint::tryGetVersion(
+        const std::string subpath) const
+{
+    return m_driver->tryGetVersion(fullPath(subpath));
+}
+
 void Endpoint::put(const std::string subpath, const std::string& data) const
 {
     m_driver->put(fullPath(subpath), data);
@@ -1023,6 +1081,18 @@ void Fs::copy(std::string src, std::string dst) const
     outstream << instream.rdbuf();
 }
 
+void Fs::remove(const std::vector<std::string>& paths) const
+{
+    for (const std::string& path : paths)
+    {
+        const std::string expanded(expandTilde(path));
+        if (!arbiter::remove(expanded) && std::ifstream(expanded).good())
+        {
+            throw ArbiterError("Could not remove " + expanded);
+        }
+    }
+}
+
 std::vector<std::string> Fs::glob(std::string path, bool verbose) const
 {
     return arbiter::glob(path);
@@ -1366,6 +1436,44 @@ std::unique_ptr<std::size_t> Http::tryGetSize(std::string path) const
     return size;
 }
 
+namespace
+{
+    // Header names are case-insensitive, and lowercased over HTTP/2.
+    std::unique_ptr<std::string> findHeader(
+            const Headers& headers,
+            const std::string& name)
+    {
+        const auto lower([](std::string s)
+        {
+            std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+            return s;
+        });
+
+        for (const auto& h : headers)
+        {
+            if (lower(h.first) == lower(name))
+            {
+                return std::unique_ptr<std::string>(
+                        new std::string(h.second));
+            }
+        }
+        return std::unique_ptr<std::string>();
+    }
+
+    std::unique_ptr<std::string> findVersion(const Response& res)
+    {
+        if (!res.ok()) return std::unique_ptr<std::string>();
+        if (auto etag = findHeader(res.headers(), "ETag")) return etag;
+        return findHeader(res.headers(), "Last-Modified");
+    }
+}
+
+std::unique_ptr<std::string> Http::tryGetVersion(std::string path) const
+{
+    auto http(m_pool.acquire());
+    return findVersion(http.head(typedPath(path)));
+}
+
 std::string Http::get(
         std::string path,
         Headers headers,
@@ -1516,6 +1624,14 @@ Response Http::internalPost(
     return m_pool.acquire().post(typedPath(path), data, headers, query);
 }
 
+Response Http::internalDelete(
+        const std::string path,
+        const Headers headers,
+        const Query query) const
+{
+    return m_pool.acquire().del(typedPath(path), headers, query);
+}
+
 std::string Http::typedPath(const std::string& p) const
 {
     if (getProtocol(p) != "file") return p;
@@ -1549,6 +1665,7 @@ std::string Http::typedPath(const std::string& p) const
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <chrono>
 #include <cstdlib>
@@ -1556,6 +1673,7 @@ std::string Http::typedPath(const std::string& p) const
 #include <ctime>
 #include <functional>
 #include <iostream>
+#include <mutex>
 #include <numeric>
 #include <sstream>
 #include <thread>
@@ -1601,6 +1719,35 @@ namespace
     typedef Xml::xml_node<> XmlNode;
     const std::string badResponse("Unexpected contents in AWS response");
 
+    // Objects of at least this size are uploaded in parts of this size, of
+    // which this many are in flight at once.  Each part is tried this many
+    // times, so a transient failure resends a single part rather than the
+    // entire object.
+    const std::size_t multipartThreshold(64 * 1024 * 1024);
+    const std::size_t multipartPartSize(16 * 1024 * 1024);
+    const std::size_t multipartThreads(8);
+    const int multipartTries(4);
+
+    // The most keys which may be removed by a single DeleteObjects request.
+    const std::size_t deleteBatchSize(1000);
+
+    // The value of the first element with this tag in an AWS response.
+    std::string findXmlValue(
+            const std::vector<char>& data,
+            const std::string tag)
+    {
+        const std::string s(data.data(), data.size());
+        const std::string open("<" + tag + ">");
+        const std::string close("</" + tag + ">");
+
+        const std::size_t begin(s.find(open));
+        if (begin == std::string::npos) throw ArbiterError(badResponse);
+        const std::size_t end(s.find(close, begin + open.size()));
+        if (end == std::string::npos) throw ArbiterError(badResponse);
+
+        return s.substr(begin + open.size(), end - begin - open.size());
+    }
+
     std::string toLower(const std::string& in)
     {
         return std::accumulate(
@@ -1985,10 +2132,8 @@ std::string S3::type() const
     else return m_profile + "@s3";
 }
 
-std::unique_ptr<std::size_t> S3::tryGetSize(std::string rawPath) const
+http::Response S3::headObject(std::string rawPath) const
 {
-    std::unique_ptr<std::size_t> size;
-
     Headers headers(m_config->baseHeaders());
     headers.erase("x-amz-server-side-encryption");
 
@@ -2003,7 +2148,19 @@ std::unique_ptr<std::size_t> S3::tryGetSize(std::string rawPath) const
             empty);
 
     drivers::Http http(m_pool);
-    Response res(http.internalHead(resource.url(), apiV4.headers()));
+    return http.internalHead(resource.url(), apiV4.headers());
+}
+
+std::unique_ptr<std::string> S3::tryGetVersion(std::string rawPath) const
+{
+    return findVersion(headObject(rawPath));
+}
+
+std::unique_ptr<std::size_t> S3::tryGetSize(std::string rawPath) const
+{
+    std::unique_ptr<std::size_t> size;
+
+    Response res(headObject(rawPath));
 
     if (res.ok() && res.headers().count("Content-Length"))
     {
@@ -2074,6 +2231,12 @@ void S3::put(
         headers["Content-Type"] = "application/json";
     }
 
+    if (data.size() >= multipartThreshold && query.empty())
+    {
+        putMultipart(rawPath, data, headers);
+        return;
+    }
+
     const ApiV4 apiV4(
             "PUT",
             m_config->region(),
@@ -2099,6 +2262,196 @@ void S3::put(
     }
 }
 
+void S3::putMultipart(
+        const std::string rawPath,
+        const std::vector<char>& data,
+        const Headers headers) const
+{
+    // See:
+    // https://docs.aws.amazon.com/AmazonS3/latest/dev/mpuoverview.html
+    const Resource resource(m_config->baseUrl(), rawPath);
+
+    // Our headers, such as those for encryption and content type, apply to
+    // the object as a whole, and so are sent only when it is initiated.
+    Query query;
+    query["uploads"] = "";
+
+    std::unique_ptr<ApiV4> apiV4(
+            new ApiV4(
+                "POST",
+                m_config->region(),
+                resource,
+                m_auth->fields(),
+                query,
+                headers,
+                empty));
+
+    drivers::Http http(m_pool);
+    Response res(
+            http.internalPost(
+                resource.url(),
+                empty,
+                apiV4->headers(),
+                apiV4->query()));
+
+    if (!res.ok())
+    {
+        throw ArbiterError(
+                "Couldn't initiate S3 multipart upload to " + rawPath + ": " +
+                res.str());
+    }
+
+    const std::string uploadId(findXmlValue(res.data(), "UploadId"));
+
+    // Once initiated, the parts of an upload are stored, and billed, until it
+    // is completed or aborted, so any failure aborts it before throwing.  An
+    // abort is only an attempt, so its own failure is not reported over ours.
+    auto fail([&](const std::string message)
+    {
+        Query abortQuery;
+        abortQuery["uploadId"] = uploadId;
+
+        try
+        {
+            const ApiV4 abortApi(
+                    "DELETE",
+                    m_config->region(),
+                    resource,
+                    m_auth->fields(),
+                    abortQuery,
+                    Headers(),
+                    empty);
+
+            http.internalDelete(
+                    resource.url(),
+                    abortApi.headers(),
+                    abortApi.query());
+        }
+        catch (...) { }
+
+        throw ArbiterError(message);
+    });
+
+    const std::size_t parts(
+            (data.size() + multipartPartSize - 1) / multipartPartSize);
+    std::vector<std::string> etags(parts);
+
+    std::atomic_size_t next(0);
+    std::mutex mutex;
+    std::string error;
+
+    // Each thread uploads the next part not yet taken until none remain, or
+    // until any part has exhausted its tries.
+    auto work([&]()
+    {
+        drivers::Http partHttp(m_pool);
+        std::size_t i(0);
+
+        while ((i = next++) < parts)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (error.size()) return;
+            }
+
+            const auto begin(data.begin() + i * multipartPartSize);
+            const auto end(
+                    data.begin() +
+                    std::min(data.size(), (i + 1) * multipartPartSize));
+            const std::vector<char> part(begin, end);
+
+            Query partQuery;
+            partQuery["partNumber"] = std::to_string(i + 1);
+            partQuery["uploadId"] = uploadId;
+
+            Response partRes(0);
+            for (int tries(0); tries < multipartTries; ++tries)
+            {
+                const ApiV4 partApi(
+                        "PUT",
+                        m_config->region(),
+                        resource,
+                        m_auth->fields(),
+                        partQuery,
+                        Headers(),
+                        part);
+
+                partRes = partHttp.internalPut(
+                        resource.url(),
+                        part,
+                        partApi.headers(),
+                        partApi.query());
+
+                if (partRes.ok() && partRes.headers().count("ETag")) break;
+
+                if (tries + 1 < multipartTries)
+                {
+                    std::this_thread::sleep_for(
+                            std::chrono::milliseconds(500 << tries));
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (partRes.ok() && partRes.headers().count("ETag"))
+            {
+                etags[i] = partRes.headers().at("ETag");
+            }
+            else if (error.empty())
+            {
+                error = "Couldn't S3 PUT part " + std::to_string(i + 1) +
+                    " of " + rawPath + ": " + partRes.str();
+            }
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (std::size_t i(0); i < std::min(parts, multipartThreads); ++i)
+    {
+        threads.emplace_back(work);
+    }
+    for (auto& t : threads) t.join();
+
+    if (error.size()) fail(error);
+
+    std::string body("<CompleteMultipartUpload>");
+    for (std::size_t i(0); i < parts; ++i)
+    {
+        body +=
+            "<Part><PartNumber>" + std::to_string(i + 1) + "</PartNumber>" +
+            "<ETag>" + etags[i] + "</ETag></Part>";
+    }
+    body += "</CompleteMultipartUpload>";
+    const std::vector<char> bodyData(body.begin(), body.end());
+
+    query.clear();
+    query["uploadId"] = uploadId;
+
+    apiV4.reset(
+            new ApiV4(
+                "POST",
+                m_config->region(),
+                resource,
+                m_auth->fields(),
+                query,
+                Headers(),
+                bodyData));
+
+    res = http.internalPost(
+            resource.url(),
+            bodyData,
+            apiV4->headers(),
+            apiV4->query());
+
+    // A completion may fail after its response has begun, in which case its
+    // status is successful but its body holds an error.
+    if (!res.ok() || res.str().find("<Error>") != std::string::npos)
+    {
+        fail(
+                "Couldn't complete S3 multipart upload to " + rawPath + ": " +
+                res.str());
+    }
+}
+
 void S3::copy(const std::string src, const std::string dst) const
 {
     Headers headers;
@@ -2107,6 +2460,91 @@ void S3::copy(const std::string src, const std::string dst) const
     put(dst, std::vector<char>(), headers, Query());
 }
 
+void S3::remove(const std::vector<std::string>& paths) const
+{
+    // See:
+    // https://docs.aws.amazon.com/AmazonS3/latest/API/API_DeleteObjects.html
+    std::map<std::string, std::vector<std::string>> buckets;
+    for (const std::string& path : paths)
+    {
+        const Resource resource(m_config->baseUrl(), path);
+        buckets[resource.bucket()].push_back(resource.object());
+    }
+
+    auto escape([](const std::string& s)
+    {
+        std::string out;
+        for (const char c : s)
+        {
+            switch (c)
+            {
+                case '&': out += "&amp;"; break;
+                case '<': out += "&lt;"; break;
+                case '>': out += "&gt;"; break;
+                case '"': out += "&quot;"; break;
+                case '\'': out += "&apos;"; break;
+                default: out += c;
+            }
+        }
+        return out;
+    });
+
+    drivers::Http http(m_pool);
+
+    for (const auto& bucket : buckets)
+    {
+        const std::vector<std::string>& objects(bucket.second);
+
+        for (std::size_t i(0); i < objects.size(); i += deleteBatchSize)
+        {
+            const std::size_t end(
+                    std::min(objects.size(), i + deleteBatchSize));
+
+            std::string body("<Delete><Quiet>true</Quiet>");
+            for (std::size_t o(i); o < end; ++o)
+            {
+                body +=
+                    "<Object><Key>" + escape(objects[o]) + "</Key></Object>";
+            }
+            body += "</Delete>";
+
+            const std::vector<char> data(body.begin(), body.end());
+            const Resource resource(m_config->baseUrl(), bucket.first + '/');
+
+            Query query;
+            query["delete"] = "";
+
+            Headers headers;
+            headers["Content-MD5"] = crypto::encodeBase64(crypto::md5(body));
+
+            std::unique_ptr<ApiV4> apiV4(
+                    new ApiV4(
+                        "POST",
+                        m_config->region(),
+                        resource,
+                        m_auth->fields(),
+                        query,
+                        headers,
+                        data));
+
+            Response res(
+                    http.internalPost(
+                        resource.url(),
+                        data,
+                        apiV4->headers(),
+                        apiV4->query()));
+
+            // With quiet mode, only the keys which failed are listed.
+            if (!res.ok() || res.str().find("<Error>") != std::string::npos)
+            {
+                throw ArbiterError(
+                        "Couldn't S3 delete from " + bucket.first + ": " +
+                        res.str());
+            }
+        }
+    }
+}
+
 std::vector<std::string> S3::glob(std::string path, bool verbose) const
 {
     std::vector<std::string> results;
@@ -2115,6 +2553,56 @@ std::vector<std::string> S3::glob(std::string path, bool verbose) const
     const bool recursive(path.back() == '*');
     if (recursive) path.pop_back();
 
+    // Keys beneath a further slash are only wanted if we are recursive, so
+    // otherwise they are left out of the listing rather than being filtered.
+    list(
+            path,
+            !recursive,
+            [&results](const std::vector<std::string>& page)
+            {
+                results.insert(results.end(), page.begin(), page.end());
+            },
+            nullptr,
+            verbose);
+
+    return results;
+}
+
+std::vector<std::string> S3::resolvePages(
+        std::string path,
+        const PageCallback& onPage,
+        const bool verbose) const
+{
+    std::vector<std::string> results;
+    if (path.size() < 2 || path.back() != '*')
+    {
+        return Driver::resolvePages(path, onPage, verbose);
+    }
+
+    path.pop_back();
+
+    const bool recursive(path.back() == '*');
+    if (recursive) path.pop_back();
+
+    std::vector<std::string> prefixes;
+    list(path, true, onPage, recursive ? &prefixes : nullptr, verbose);
+
+    const std::string bucket(Resource(m_config->baseUrl(), path).bucket());
+    for (const std::string& prefix : prefixes)
+    {
+        results.push_back(type() + "://" + bucket + "/" + prefix + "**");
+    }
+
+    return results;
+}
+
+void S3::list(
+        const std::string path,
+        const bool delimited,
+        const PageCallback& onPage,
+        std::vector<std::string>* prefixes,
+        const bool verbose) const
+{
     // https://docs.aws.amazon.com/AmazonS3/latest/API/RESTBucketGET.html
     const Resource resource(m_config->baseUrl(), path);
     const std::string& bucket(resource.bucket());
@@ -2123,6 +2611,7 @@ std::vector<std::string> S3::glob(std::string path, bool verbose) const
     Query query;
 
     if (object.size()) query["prefix"] = object;
+    if (delimited) query["delimiter"] = "/";
 
     bool more(false);
     std::vector<char> data;
@@ -2149,63 +2638,59 @@ std::vector<std::string> S3::glob(std::string path, bool verbose) const
             throw ArbiterError("Could not parse S3 response.");
         }
 
-        if (XmlNode* topNode = xml.first_node("ListBucketResult"))
+        XmlNode* topNode(xml.first_node("ListBucketResult"));
+        if (!topNode) throw ArbiterError(badResponse);
+
+        if (XmlNode* truncNode = topNode->first_node("IsTruncated"))
         {
-            if (XmlNode* truncNode = topNode->first_node("IsTruncated"))
-            {
-                std::string t(truncNode->value());
-                std::transform(t.begin(), t.end(), t.begin(), ::tolower);
+            std::string t(truncNode->value());
+            std::transform(t.begin(), t.end(), t.begin(), ::tolower);
 
-                more = (t == "true");
-            }
+            more = (t == "true");
+        }
 
-            if (XmlNode* conNode = topNode->first_node("Contents"))
-            {
-                for ( ; conNode; conNode = conNode->next_sibling())
-                {
-                    if (XmlNode* keyNode = conNode->first_node("Key"))
-                    {
-                        std::string key(keyNode->value());
-                        const bool isSubdir(
-                                key.find('/', object.size()) !=
-                                std::string::npos);
-
-                        // The prefix may contain slashes (i.e. is a sub-dir)
-                        // but we only want to traverse into subdirectories
-                        // beyond the prefix if recursive is true.
-                        if (recursive || !isSubdir)
-                        {
-                            results.push_back(
-                                    type() + "://" + bucket + "/" + key);
-                        }
-
-                        if (more)
-                        {
-                            query["marker"] =
-                                object + key.substr(object.size());
-                        }
-                    }
-                    else
-                    {
-                        throw ArbiterError(badResponse);
-                    }
-                }
-            }
-            else
-            {
-                throw ArbiterError(badResponse);
-            }
+        XmlNode* conNode(topNode->first_node("Contents"));
+        XmlNode* preNode(topNode->first_node("CommonPrefixes"));
+        if (!conNode && !preNode) throw ArbiterError(badResponse);
+
+        // Without a delimiter, the next page follows our last key.  With one,
+        // it may follow a common prefix instead, which S3 reports for us.
+        std::string marker;
+
+        std::vector<std::string> page;
+        for ( ; conNode; conNode = conNode->next_sibling("Contents"))
+        {
+            XmlNode* keyNode(conNode->first_node("Key"));
+            if (!keyNode) throw ArbiterError(badResponse);
+
+            marker = keyNode->value();
+            page.push_back(type() + "://" + bucket + "/" + marker);
         }
-        else
+
+        for ( ; preNode; preNode = preNode->next_sibling("CommonPrefixes"))
+        {
+            XmlNode* prefixNode(preNode->first_node("Prefix"));
+            if (!prefixNode) throw ArbiterError(badResponse);
+
+            if (prefixes) prefixes->push_back(prefixNode->value());
+        }
+
+        if (XmlNode* nextNode = topNode->first_node("NextMarker"))
+        {
+            marker = nextNode->value();
+        }
+
+        if (more)
         {
-            throw ArbiterError(badResponse);
+            if (marker.empty()) throw ArbiterError(badResponse);
+            query["marker"] = marker;
         }
 
         xml.clear();
+
+        onPage(page);
     }
     while (more);
-
-    return results;
 }
 
 S3::ApiV4::ApiV4(
@@ -2545,14 +3030,23 @@ std::unique_ptr<Google> Google::create(http::Pool& pool, const std::string s)
     return std::unique_ptr<Google>();
 }
 
-std::unique_ptr<std::size_t> Google::tryGetSize(const std::string path) const
+http::Response Google::headObject(const std::string path) const
 {
     http::Headers headers(m_auth->headers());
     const GResource resource(path);
 
     drivers::Https https(m_pool);
-    const auto res(
-            https.internalHead(resource.endpoint(), headers, altMediaQuery));
+    return https.internalHead(resource.endpoint(), headers, altMediaQuery);
+}
+
+std::unique_ptr<std::string> Google::tryGetVersion(const std::string path) const
+{
+    return findVersion(headObject(path));
+}
+
+std::unique_ptr<std::size_t> Google::tryGetSize(const std::string path) const
+{
+    const auto res(headObject(path));
 
     if (res.ok() && res.headers().count("Content-Length"))
     {
@@ -3321,7 +3815,8 @@ namespace
 #endif // ARBITER_CURL
 } // unnamed namespace
 
-Curl::Curl(const std::string s)
+Curl::Curl(const std::string s, CURLSH* share)
+    : m_share(share)
 {
 #ifdef ARBITER_CURL
     const json c(s.size() ? json::parse(s) : json::object());
@@ -3334,6 +3829,7 @@ Curl::Curl(const std::string s)
     //      - caBundle          (CURLOPT_CAPATH)
     //      - caInfo            (CURLOPT_CAINFO)
     //      - verifyPeer        (CURLOPT_SSL_VERIFYPEER)
+    //      - http2             (CURLOPT_HTTP_VERSION)
 
     using Keys = std::vector<std::string>;
     auto find([](const Keys& keys)->std::unique_ptr<std::string>
@@ -3382,6 +3878,11 @@ Curl::Curl(const std::string s)
             {
                 m_verifyPeer = h["verifyPeer"].get<bool>();
             }
+
+            if (h.count("http2"))
+            {
+                m_http2 = h["http2"].get<bool>();
+            }
         }
     }
 
@@ -3400,6 +3901,7 @@ Curl::Curl(const std::string s)
     };
     Keys caPathKeys{ "CURL_CA_PATH", "CURL_CA_BUNDLE", "ARBITER_CA_PATH" };
     Keys caInfoKeys{ "CURL_CAINFO", "CURL_CA_INFO", "ARBITER_CA_INFO" };
+    Keys http2Keys{ "CURL_HTTP2", "ARBITER_HTTP2" };
 
     if (auto v = find(verboseKeys)) m_verbose = !!std::stol(*v);
     if (auto v = find(timeoutKeys)) m_timeout = std::stol(*v);
@@ -3407,6 +3909,7 @@ Curl::Curl(const std::string s)
     if (auto v = find(verifyKeys)) m_verifyPeer = !!std::stol(*v);
     if (auto v = find(caPathKeys)) m_caPath = mk(*v);
     if (auto v = find(caInfoKeys)) m_caInfo = mk(*v);
+    if (auto v = find(http2Keys)) m_http2 = !!std::stol(*v);
 
     static bool logged(false);
     if (m_verbose && !logged)
@@ -3418,6 +3921,7 @@ Curl::Curl(const std::string s)
             "\n\tverifyPeer: " << m_verifyPeer <<
             "\n\tcaBundle: " << (m_caPath ? *m_caPath : "(default)") <<
             "\n\tcaInfo: " << (m_caInfo ? *m_caInfo : "(default)") <<
+            "\n\thttp2: " << m_http2 <<
             std::endl;
     }
 #endif
@@ -3460,6 +3964,24 @@ void Curl::init(
     curl_easy_setopt(m_curl, CURLOPT_CONNECTTIMEOUT_MS, 2000L);
     curl_easy_setopt(m_curl, CURLOPT_ACCEPTTIMEOUT_MS, 2000L);
 
+    // Keep idle connections alive so they may be reused by later requests.
+#if LIBCURL_VERSION_NUM >= 0x071900
+    curl_easy_setopt(m_curl, CURLOPT_TCP_KEEPALIVE, 1L);
+#endif
+
+    if (m_share) curl_easy_setopt(m_curl, CURLOPT_SHARE, m_share);
+
+    // Negotiate HTTP/2 over TLS if requested, falling back to HTTP/1.1.
+#ifdef CURL_HTTP_VERSION_2TLS
+    if (m_http2)
+    {
+        curl_easy_setopt(
+                m_curl,
+                CURLOPT_HTTP_VERSION,
+                CURL_HTTP_VERSION_2TLS);
+    }
+#endif
+
     auto toLong([](bool b) { return b ? 1L : 0L; });
 
     // Configuration options.
@@ -3665,6 +4187,31 @@ Response Curl::post(
 #endif
 }
 
+Response Curl::del(std::string path, Headers headers, Query query)
+{
+#ifdef ARBITER_CURL
+    std::vector<char> data;
+
+    init(path, headers, query);
+
+    // Register callback function and data pointer to consume the result.
+    curl_easy_setopt(m_curl, CURLOPT_WRITEFUNCTION, getCb);
+    curl_easy_setopt(m_curl, CURLOPT_WRITEDATA, &data);
+
+    // Insert all headers into the request.
+    curl_easy_setopt(m_curl, CURLOPT_HTTPHEADER, m_headers);
+
+    // Specify a DELETE request.
+    curl_easy_setopt(m_curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+
+    // Run the command.
+    const int httpCode(perform());
+    return Response(httpCode, data);
+#else
+    throw ArbiterError(fail);
+#endif
+}
+
 } // namepace http
 } // namespace arbiter
 
@@ -3814,6 +4361,17 @@ Response Resource::post(
     });
 }
 
+Response Resource::del(
+        const std::string path,
+        const Headers headers,
+        const Query query)
+{
+    return exec([this, path, headers, query]()->Response
+    {
+        return m_curl.del(path, headers, query);
+    });
+}
+
 Response Resource::exec(std::function<Response()> f)
 {
     Response res;
@@ -3830,13 +4388,28 @@ Response Resource::exec(std::function<Response()> f)
 
 ///////////////////////////////////////////////////////////////////////////////
 
+#ifdef ARBITER_CURL
+namespace
+{
+    using Mutexes = std::vector<std::unique_ptr<std::mutex>>;
+
+    void lockShare(CURL*, curl_lock_data data, curl_lock_access, void* p)
+    {
+        (*static_cast<Mutexes*>(p))[data]->lock();
+    }
+
+    void unlockShare(CURL*, curl_lock_data data, void* p)
+    {
+        (*static_cast<Mutexes*>(p))[data]->unlock();
+    }
+}
+#endif
+
 Pool::Pool(
-        const std::size_t concurrent,
+        std::size_t concurrent,
         const std::size_t retry,
         const std::string s)
-    : m_curls(concurrent)
-    , m_available(concurrent)
-    , m_retry(retry)
+    : m_retry(retry)
     , m_mutex()
     , m_cv()
 {
@@ -3845,15 +4418,54 @@ Pool::Pool(
 
     const json config(s.size() ? json::parse(s) : json::object());
 
+    // The number of handles bounds the number of concurrent requests.
+    const json h(config.value("http", json::object()));
+    if (h.is_object() && h.count("concurrent"))
+    {
+        concurrent = std::max<std::size_t>(
+                h["concurrent"].get<std::size_t>(),
+                1);
+    }
+
+    m_share = curl_share_init();
+    if (m_share)
+    {
+        for (int i(0); i < CURL_LOCK_DATA_LAST; ++i)
+        {
+            m_shareMutexes.emplace_back(new std::mutex());
+        }
+
+        curl_share_setopt(m_share, CURLSHOPT_LOCKFUNC, lockShare);
+        curl_share_setopt(m_share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+        curl_share_setopt(m_share, CURLSHOPT_USERDATA, &m_shareMutexes);
+        curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(
+                m_share,
+                CURLSHOPT_SHARE,
+                CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+        curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    }
+
+    m_curls.resize(concurrent);
+    m_available.resize(concurrent);
     for (std::size_t i(0); i < concurrent; ++i)
     {
         m_available[i] = i;
-        m_curls[i].reset(new Curl(config.dump()));
+        m_curls[i].reset(new Curl(config.dump(), m_share));
     }
 #endif
 }
 
-Pool::~Pool() { }
+Pool::~Pool()
+{
+#ifdef ARBITER_CURL
+    // Our handles must be cleaned up before the share they use.
+    m_curls.clear();
+    if (m_share) curl_share_cleanup(m_share);
+#endif
+}
 
 Resource Pool::acquire()
 {
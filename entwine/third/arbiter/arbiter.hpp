@@ -24259,6 +24259,7 @@ inline json merge(const json& a, const json& b)
 #include <curl/curl.h>
 #else
 typedef void CURL;
+typedef void CURLSH;
 #endif
 
 struct curl_slist;
@@ -24306,8 +24307,12 @@ public:
             Headers headers,
             Query query);
 
+    http::Response del(std::string path, Headers headers, Query query);
+
 private:
-    Curl(std::string j);
+    // If non-null, DNS results, TLS sessions, and connections are shared with
+    // every other handle using this share.
+    Curl(std::string j, CURLSH* share = nullptr);
 
     void init(std::string path, const Headers& headers, const Query& query);
 
@@ -24318,9 +24323,11 @@ private:
     Curl& operator=(const Curl&);
 
     CURL* m_curl = nullptr;
+    CURLSH* m_share = nullptr;
     curl_slist* m_headers = nullptr;
 
     bool m_verbose = false;
+    bool m_http2 = false;
     long m_timeout = defaultHttpTimeout;
     bool m_followRedirect = true;
     bool m_verifyPeer = true;
@@ -24424,6 +24431,11 @@ public:
             Headers headers = Headers(),
             Query query = Query());
 
+    http::Response del(
+            std::string path,
+            Headers headers = Headers(),
+            Query query = Query());
+
 private:
     Pool& m_pool;
     Curl& m_curl;
@@ -24454,6 +24466,11 @@ private:
 
     std::mutex m_mutex;
     std::condition_variable m_cv;
+
+    // Shared by all of our handles, so that a connection or TLS session
+    // established by one handle may be reused by any other.
+    CURLSH* m_share = nullptr;
+    std::vector<std::unique_ptr<std::mutex>> m_shareMutexes;
 };
 
 /** @endcond */
@@ -25091,6 +25108,13 @@ public:
     /** Get the file size in bytes, or throw if it does not exist. */
     std::size_t getSize(std::string path) const;
 
+    /** Get an opaque version of the file, such as its ETag, which changes
+     * whenever its contents change, if available.
+     *
+     * @note The default behavior is to return nothing.
+     */
+    virtual std::unique_ptr<std::string> tryGetVersion(std::string path) const;
+
     /** Write string data. */
     void put(std::string path, const std::string& data) const;
 
@@ -25099,6 +25123,14 @@ public:
      */
     virtual void copy(std::string src, std::string dst) const;
 
+    /** Remove these files, which must all be of this driver type, with their
+     * type-prefixes stripped.  Drivers supporting batched deletion may remove
+     * many files per request.
+     *
+     * @note The default behavior is to throw ArbiterError.
+     */
+    virtual void remove(const std::vector<std::string>& paths) const;
+
     /** @brief Resolve a possibly globbed path.
      *
      * See Arbiter::resolve for details.
@@ -25107,6 +25139,27 @@ public:
             std::string path,
             bool verbose = false) const;
 
+    /** Called with each page of a listing as it arrives. */
+    typedef std::function<void(const std::vector<std::string>&)> PageCallback;
+
+    /** @brief Resolve a possibly globbed path, page by page.
+     *
+     * As for resolve, but each page of results is passed to @p onPage as it
+     * arrives rather than being returned once the listing is complete.  For
+     * a recursive path, ending with `**`, a driver supporting delimited
+     * listings lists only the files directly within its directory, and
+     * returns each of its subdirectories as a recursive path of its own,
+     * prefixed with `type() + "://"`, which may be resolved in the same way,
+     * perhaps in parallel.  Otherwise, nothing is returned.
+     *
+     * @note The default behavior passes the result of resolve as a single
+     * page.
+     */
+    virtual std::vector<std::string> resolvePages(
+            std::string path,
+            const PageCallback& onPage,
+            bool verbose = false) const;
+
 protected:
     /** @brief Resolve a wildcard path.
      *
@@ -25273,6 +25326,8 @@ public:
     virtual bool isRemote() const override { return false; }
 
     virtual void copy(std::string src, std::string dst) const override;
+    virtual void remove(
+            const std::vector<std::string>& paths) const override;
 
 protected:
     virtual bool get(std::string path, std::vector<char>& data) const override;
@@ -25343,6 +25398,12 @@ public:
     virtual std::unique_ptr<std::size_t> tryGetSize(
             std::string path) const override;
 
+    /** By default, performs a HEAD request and returns the contents of the
+     * ETag header, or failing that the Last-Modified header.
+     */
+    virtual std::unique_ptr<std::string> tryGetVersion(
+            std::string path) const override;
+
     virtual void put(
             std::string path,
             const std::vector<char>& data) const final override
@@ -25437,6 +25498,11 @@ public:
             http::Headers headers = http::Headers(),
             http::Query query = http::Query()) const;
 
+    http::Response internalDelete(
+            std::string path,
+            http::Headers headers = http::Headers(),
+            http::Query query = http::Query()) const;
+
 protected:
     /** HTTP-derived Drivers should override this version of GET to allow for
      * custom headers and query parameters.
@@ -25555,6 +25621,9 @@ public:
     virtual std::unique_ptr<std::size_t> tryGetSize(
             std::string path) const override;
 
+    virtual std::unique_ptr<std::string> tryGetVersion(
+            std::string path) const override;
+
     /** Inherited from Drivers::Http. */
     virtual void put(
             std::string path,
@@ -25564,9 +25633,39 @@ public:
 
     virtual void copy(std::string src, std::string dst) const override;
 
+    /** Remove with DeleteObjects requests of up to 1000 keys each. */
+    virtual void remove(
+            const std::vector<std::string>& paths) const override;
+
+    /** Delimited listings, whose common prefixes are our subdirectories. */
+    virtual std::vector<std::string> resolvePages(
+            std::string path,
+            const PageCallback& onPage,
+            bool verbose = false) const override;
+
 private:
     static std::string extractProfile(std::string j);
 
+    /** List the keys beginning with the object of this path, page by page.
+     * If @p delimited, keys beneath a further slash are left out, and their
+     * common prefixes are appended to @p prefixes if it is non-null.
+     */
+    void list(
+            std::string path,
+            bool delimited,
+            const PageCallback& onPage,
+            std::vector<std::string>* prefixes,
+            bool verbose) const;
+
+    /** A signed HEAD request for this object. */
+    http::Response headObject(std::string path) const;
+
+    /** Upload this data in parts, in parallel, retrying each part. */
+    void putMultipart(
+            std::string path,
+            const std::vector<char>& data,
+            http::Headers headers) const;
+
     /*
     static std::unique_ptr<Config> extractConfig(
             std::string j,
@@ -25777,6 +25876,9 @@ public:
     virtual std::unique_ptr<std::size_t> tryGetSize(
             std::string path) const override;
 
+    virtual std::unique_ptr<std::string> tryGetVersion(
+            std::string path) const override;
+
     /** Inherited from Drivers::Http. */
     virtual void put(
             std::string path,
@@ -25796,6 +25898,9 @@ private:
             std::string path,
             bool verbose) const override;
 
+    /** An authorized HEAD request for this object. */
+    http::Response headObject(std::string path) const;
+
     std::unique_ptr<Auth> m_auth;
 };
 
@@ -26095,6 +26200,9 @@ public:
     /** Passthrough to Driver::tryGetSize. */
     std::unique_ptr<std::size_t> tryGetSize(std::string subpath) const;
 
+    /** Passthrough to Driver::tryGetVersion. */
+    std::unique_ptr<std::string> tryGetVersion(std::string subpath) const;
+
     /** Passthrough to Driver::put(std::string, const std::string&) const. */
     void put(std::string subpath, const std::string& data) const;
 
@@ -26315,6 +26423,9 @@ public:
     /** Get file size in bytes if accessible. */
     std::unique_ptr<std::size_t> tryGetSize(std::string path) const;
 
+    /** Passthrough to Driver::tryGetVersion. */
+    std::unique_ptr<std::string> tryGetVersion(std::string path) const;
+
     /** Write data to path. */
     void put(std::string path, const std::string& data) const;
 
@@ -26387,6 +26498,12 @@ public:
      */
     void copyFile(std::string file, std::string to, bool verbose = false) const;
 
+    /** Remove these files, which may be of differing driver types.  Files of
+     * each type are removed together, so drivers supporting batched deletion
+     * may remove many files per request.
+     */
+    void remove(const std::vector<std::string>& paths) const;
+
     /** Returns true if this path is a remote path, or false if it is on the
      * local filesystem.
      */
@@ -26447,6 +26564,12 @@ public:
             std::string path,
             bool verbose = false) const;
 
+    /** Passthrough to Driver::resolvePages. */
+    std::vector<std::string> resolvePages(
+            std::string path,
+            const Driver::PageCallback& onPage,
+            bool verbose = false) const;
+
     /** @brief Get a reusable Endpoint for this root directory. */
     Endpoint getEndpoint(std::string root) const;
 
@@ -58,12 +58,11 @@ public:
     // Returns true if these Bounds share any area in common with another.
     bool overlaps(const Bounds& other, bool force2d = false) const
     {
-        return
-            max().x > other.min().x && min().x < other.max().x &&
-            max().y > other.min().y && min().y < other.max().y &&
-            (force2d || (
-                (!height() && !other.height()) || (
-                    max().z > other.min().z && min().z < other.max().z)));
+        const bool xy(
+            (max().x > other.min().x) & (min().x < other.max().x) &
+            (max().y > other.min().y) & (min().y < other.max().y));
+        if (!xy || force2d || (!height() && !other.height())) return xy;
+        return (max().z > other.min().z) & (min().z < other.max().z);
     }
 
     // Returns true if the requested Bounds are contained within these Bounds.
@@ -84,12 +83,16 @@ public:
     }
 
     // Returns true if the requested point is contained within these Bounds.
+    // This is tested for every point inserted, so the comparisons are
+    // combined without short-circuiting to avoid a branch for each of them.
     bool contains(const Point& p) const
     {
-        if (is3d()) return p >= m_min && p < m_max;
-        else return
-            p.x >= m_min.x && p.x < m_max.x &&
-            p.y >= m_min.y && p.y < m_max.y;
+        const bool xy(
+            (p.x >= m_min.x) & (p.x < m_max.x) &
+            (p.y >= m_min.y) & (p.y < m_max.y));
+        const bool z((p.z >= m_min.z) & (p.z < m_max.z));
+        const bool flat(!is3d());
+        return xy & (z | flat);
     }
 
     double width()  const { return m_max.x - m_min.x; } // Length in X.
@@ -177,21 +180,16 @@ public:
     Bounds getSw() const { return getSwd(true); }
     Bounds getSe() const { return getSed(true); }
 
+    // Equivalent to the goXxx functions for this direction, but each axis
+    // selects the bound which moves to our midpoint rather than switching on
+    // the direction, which would be a mispredicted branch per level.
     void go(Dir dir, bool force2d = false)
     {
-        if (force2d) dir = toDir(toIntegral(dir, true));
-
-        switch (dir)
-        {
-            case Dir::swd: goSwd(force2d); break;
-            case Dir::sed: goSed(force2d); break;
-            case Dir::nwd: goNwd(force2d); break;
-            case Dir::ned: goNed(force2d); break;
-            case Dir::swu: goSwu(); break;
-            case Dir::seu: goSeu(); break;
-            case Dir::nwu: goNwu(); break;
-            case Dir::neu: goNeu(); break;
-        }
+        const unsigned d(static_cast<unsigned>(dir));
+        (d & EwBit ? m_min.x : m_max.x) = m_mid.x;
+        (d & NsBit ? m_min.y : m_max.y) = m_mid.y;
+        if (!force2d) (d & UdBit ? m_min.z : m_max.z) = m_mid.z;
+        setMid();
     }
 
     Bounds get(Dir dir, bool force2d = false) const
@@ -11,6 +11,8 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
+#include <vector>
 
 #include <entwine/builder/heuristics.hpp>
 #include <entwine/types/defs.hpp>
@@ -19,6 +21,32 @@
 namespace entwine
 {
 
+// The data type, and zstandard level, of the nodes shallower than a depth,
+// which supersede those of our build for those nodes.
+struct DataTier
+{
+    uint64_t below = 0;
+    std::string dataType;
+
+    // If zero, the zstandard level of our build.
+    int zstdLevel = 0;
+};
+
+using DataTiers = std::vector<DataTier>;
+
+inline void to_json(json& j, const DataTier& t)
+{
+    j = { { "below", t.below }, { "dataType", t.dataType } };
+    if (t.zstdLevel) j.update({ { "zstdLevel", t.zstdLevel } });
+}
+
+inline void from_json(const json& j, DataTier& t)
+{
+    t.below = j.at("below").get<uint64_t>();
+    t.dataType = j.at("dataType").get<std::string>();
+    t.zstdLevel = j.value("zstdLevel", 0);
+}
+
 struct BuildParameters
 {
     BuildParameters() = default;
@@ -51,6 +79,225 @@ struct BuildParameters
     uint64_t progressInterval = 10;
     uint64_t hierarchyStep = 0;
     bool verbose = true;
+
+    // If non-zero, each work thread only reads and decodes its source, and
+    // this many dedicated threads per work thread perform tree insertion.
+    uint64_t insertThreads = 0;
+
+    // If non-zero, a budget in bytes for the point data held by resident
+    // chunks.  While over budget, clipping and eviction are more aggressive.
+    uint64_t memory = 0;
+
+    // If true, large overflows are spilled to our temporary directory while
+    // over the memory budget, and read back when they become nodes.
+    bool spill = false;
+
+    // The number of remote input files to download ahead of the work threads.
+    uint64_t prefetch = 0;
+
+    // If true, remote uncompressed LAS files are fetched in ranges of points
+    // via ranged reads rather than being downloaded entirely.
+    bool rangeReads = false;
+
+    // If true, and the output schema is scaled, point coordinates are held in
+    // memory as scaled 32-bit integers rather than as doubles.
+    bool compact = false;
+
+    // If true, point data is allocated from slabs backed by transparent huge
+    // pages, where supported.
+    bool hugePages = false;
+
+    // The compression level for the zstandard data type, and the number of
+    // threads with which to compress large nodes.
+    int zstdLevel = 3;
+    uint64_t zstdThreads = 0;
+
+    // If non-zero, the maximum size in bytes of a dictionary trained from the
+    // first small zstandard nodes, which is persisted.
+    uint64_t zstdDictionary = 0;
+
+    // Sources with more points than this are split into ranges of this many
+    // points, which are inserted in parallel.  Zero disables splitting.
+    uint64_t splitPoints = 0;
+
+    // If non-zero, only about this fraction of the points of each source is
+    // read and inserted, for a quick preview of a build, which is persisted.
+    double sample = 0;
+
+    // The order in which sources are scheduled for insertion: "manifest",
+    // "spatial" (Morton order of their bounds), or "largest" (descending point
+    // count, then spatial).
+    std::string order = "manifest";
+
+    // The order of the points within each node: "morton", "progressive",
+    // "gpstime", or empty to keep them in the order they were inserted.  Any
+    // order is persisted, so that readers may rely on it.
+    std::string pointOrder;
+
+    // Which of two points contending for a voxel keeps it: "closest" to its
+    // center, "first", "maxz", "minz", or "random".
+    std::string voxelPolicy = "closest";
+
+    // If true, points with the same coordinates, after scale-offset clipping,
+    // as the occupant of their voxel are dropped as duplicates.
+    bool dedup = false;
+
+    // If non-zero, nodes are created only at depths shallower than this, and
+    // points which lose the competition for their voxel at the deepest of
+    // them are discarded.  This is persisted.
+    uint64_t maxDepth = 0;
+
+    // If set, the type in which a subset build writes its shared-depth nodes,
+    // which are rewritten in our data type when the subsets are merged.
+    std::string subsetDataType;
+
+    // If non-zero, the overflows of chunks which become nodes of their own are
+    // pushed down by this many background threads rather than by the thread
+    // whose insertion filled them.
+    uint64_t overflowThreads = 0;
+
+    // If non-zero, serialized nodes are written by this many dedicated upload
+    // threads rather than by the threads which serialized them.
+    uint64_t uploadThreads = 0;
+
+    // If true and supported, serialized nodes written to local output are
+    // queued to an io_uring rather than written by blocking calls.
+    bool ioUring = false;
+
+    // If non-zero, a budget in bytes for serialized nodes held in memory after
+    // their eviction, so they need not be fetched if they are woken up again.
+    uint64_t nodeCache = 0;
+
+    // If non-zero, a budget in bytes for the existing nodes of remote output
+    // which are fetched ahead of the threads which will wake them.
+    uint64_t nodePrefetch = 0;
+
+    // If set, the JSON files fetched by readers, which are ept.json, the
+    // hierarchy, and the manifest overview, are written compactly and, for
+    // remote output, precompressed with this content encoding: "gzip".
+    std::string contentEncoding;
+
+    // If non-zero, the hierarchy files fetched by readers are split wherever
+    // a subtree exceeds this many nodes, rather than at every hierarchyStep
+    // depths, which continues to group packs and node statistics.
+    uint64_t hierarchyPageSize = 0;
+
+    // If non-zero, a budget in bytes for the hierarchy nodes held in memory,
+    // beyond which deeper nodes are spilled to sorted runs in our temporary
+    // directory.
+    uint64_t hierarchyMemory = 0;
+
+    // If true, the nodes of a build to remote output are staged in our
+    // temporary directory, and uploaded together whenever the build is saved.
+    bool journal = false;
+
+    // Chunks shallower than this depth are kept resident for the entire
+    // build, and serialized only once at its end.
+    uint64_t pinnedDepth = 0;
+
+    // If non-zero, each thread resolves its insertions shallower than this
+    // depth in a private grid, which is merged into the shared tree in bulk.
+    uint64_t stagingDepth = 0;
+
+    // If set, a local path to which a JSON line of build metrics is appended
+    // at each progress interval.
+    std::string metricsPath;
+
+    // If non-zero, build metrics are served over HTTP on this port at
+    // /metrics, in the Prometheus text format.
+    uint64_t metricsPort = 0;
+
+    // If true, threads are shifted between work and clipping during the
+    // build, according to which is holding up the other.
+    bool adaptiveThreads = false;
+
+    // If either is non-zero, the build's progress is saved after this many
+    // minutes or inserted files since the last checkpoint, so it may be
+    // resumed from there if it is interrupted.
+    uint64_t checkpointMinutes = 0;
+    uint64_t checkpointFiles = 0;
+
+    // If non-zero, the number of seconds after which the build should be
+    // saved.  Files which are not expected to finish by then are not started,
+    // and are left for a continuation of the build.
+    uint64_t maxTime = 0;
+
+    // If previewMinutes is non-zero, the depths shallower than previewDepth
+    // are published this often as a standalone dataset, which may be viewed
+    // while the build continues.
+    uint64_t previewMinutes = 0;
+    uint64_t previewDepth = heuristics::previewDepth;
+
+    // If true, a continued build loads and rewrites the per-file metadata of
+    // only the sources which it has yet to insert.
+    bool append = false;
+
+    // If true, work and clip threads are pinned to the NUMA nodes of this
+    // machine, and each node inserts its own share of the input files.
+    bool numa = false;
+
+    // If true, a summary of the points of each node is saved alongside our
+    // hierarchy, in ept-node-stats.
+    bool nodeStats = false;
+
+    // If true, the encoded size in bytes of each node is saved alongside our
+    // hierarchy, in ept-node-sizes.
+    bool nodeSizes = false;
+
+    // If true, the nodes holding the points of each source, by their point
+    // IDs, are saved in ept-provenance.
+    bool provenance = false;
+
+    // If non-zero, the per-file metadata of our sources is saved in shards of
+    // this many consecutive origins rather than in a file per source.
+    uint64_t manifestShardSize = 0;
+
+    // If true, only an overview of each source is held in memory, and the
+    // rest of its metadata is loaded from ept-sources while it is inserted or
+    // saved.
+    bool compactManifest = false;
+
+    // If true, the nodes of each hierarchy file are packed into one object at
+    // the end of the build, which is persisted.
+    bool pack = false;
+
+    // If true, and the output schema is scaled, the XYZ of binary and
+    // zstandard nodes are stored as offsets from the minimum corner of each
+    // node, which is persisted in ept.json.
+    bool relativeXyz = false;
+
+    // If non-zero, and the output schema is scaled, binary and zstandard nodes
+    // shallower than this depth store XYZ at a coarser scale relative to their
+    // voxel size, which is persisted in ept.json.
+    uint64_t lossyDepth = 0;
+
+    // The data types and zstandard levels of shallow nodes, ordered by depth,
+    // where the first tier which a node is shallower than applies to it.
+    // These are persisted in ept.json.
+    DataTiers dataTiers;
+
+    // If non-zero, our inputs are first bucketed into local scratch files by
+    // their node at this depth, and each bucket is then inserted in turn.
+    uint64_t presortDepth = 0;
+
+    // If true, a presorted build inserts the nodes above its presort depth
+    // first, and then builds each subtree beneath it independently.
+    bool presortSplit = false;
+
+    // If true, a presorted build first builds each subtree beneath its presort
+    // depth independently, and then derives the nodes above it from them.
+    bool bottomUp = false;
+
+    // The generation of the latest checkpoint, which is persisted.
+    uint64_t checkpoint = 0;
+
+    // If the span and node sizes were chosen from the density of our sources,
+    // the reasoning for that choice, which is persisted.
+    json tuning;
+
+    // The threads and memory budget of the latest run of this build, and the
+    // container limits from which they were derived, which are persisted.
+    json resources;
 };
 
 inline void to_json(json& j, const BuildParameters& p)
@@ -62,6 +309,21 @@ inline void to_json(json& j, const BuildParameters& p)
         { "maxNodeSize", p.maxNodeSize }
     };
     if (p.hierarchyStep) j.update({ { "hierarchyStep", p.hierarchyStep } });
+    if (p.checkpoint) j.update({ { "checkpoint", p.checkpoint } });
+    if (p.sample) j.update({ { "sample", p.sample } });
+    if (p.pack) j.update({ { "pack", true } });
+    if (p.maxDepth) j.update({ { "maxDepth", p.maxDepth } });
+    if (p.pointOrder.size()) j.update({ { "pointOrder", p.pointOrder } });
+    if (p.subsetDataType.size())
+    {
+        j.update({ { "subsetDataType", p.subsetDataType } });
+    }
+    if (p.zstdDictionary)
+    {
+        j.update({ { "zstdDictionary", p.zstdDictionary } });
+    }
+    if (!p.tuning.is_null()) j.update({ { "tuning", p.tuning } });
+    if (!p.resources.is_null()) j.update({ { "resources", p.resources } });
 }
 
 } // namespace entwine
@@ -0,0 +1,192 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/types/copy-plan.hpp>
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace entwine
+{
+
+namespace
+{
+
+bool isXyz(const std::string& name)
+{
+    return name == "X" || name == "Y" || name == "Z";
+}
+
+// For integers, the bound above the maximum is a power of two, which is
+// exactly representable as a double even where the maximum itself is not.
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, bool>::type
+fits(const double d)
+{
+    return
+        d >= static_cast<double>(std::numeric_limits<T>::lowest()) &&
+        d < static_cast<double>(std::numeric_limits<T>::max()) + 1;
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value, bool>::type
+fits(const double d)
+{
+    return !(std::abs(d) > std::numeric_limits<T>::max());
+}
+
+} // unnamed namespace
+
+CopyPlan::CopyPlan(const Schema& schema)
+{
+    const Schema absolute(makeAbsolute(schema));
+    const auto absoluteLayout(toMemoryLayout(absolute));
+    const auto packedLayout(toLayout(schema));
+
+    m_absolutePointSize = absoluteLayout.pointSize();
+    m_packedPointSize = packedLayout.pointSize();
+
+    const DimType type(find(schema, "X").type);
+    if (find(schema, "Y").type != type || find(schema, "Z").type != type)
+    {
+        throw std::runtime_error("XYZ must share a type");
+    }
+
+    const optional<ScaleOffset> so(getScaleOffset(schema));
+    if (so) m_so = *so;
+    m_scaled = !!so;
+
+    // Unscaled doubles are copied verbatim along with the other dimensions.
+    const bool convert(so || type != DimType::Double);
+
+    for (const Dimension& d : schema)
+    {
+        const DimId id(absoluteLayout.findDim(d.name));
+        const uint64_t absoluteOffset(absoluteLayout.dimOffset(id));
+        const uint64_t packedOffset(
+            packedLayout.dimOffset(packedLayout.findDim(d.name)));
+        const uint64_t size(packedLayout.dimSize(packedLayout.findDim(d.name)));
+
+        if (convert && isXyz(d.name))
+        {
+            const std::size_t i(d.name[0] - 'X');
+            m_absoluteXyz[i] = absoluteOffset;
+            m_packedXyz[i] = packedOffset;
+        }
+        else if (
+            !m_runs.empty() &&
+            m_runs.back().absolute + m_runs.back().size == absoluteOffset &&
+            m_runs.back().packed + m_runs.back().size == packedOffset)
+        {
+            m_runs.back().size += size;
+        }
+        else m_runs.push_back({ absoluteOffset, packedOffset, size });
+    }
+
+    if (!convert) return;
+
+    switch (type)
+    {
+        case DimType::Signed8:
+            m_packXyz = &packXyz<int8_t>;
+            m_unpackXyz = &unpackXyz<int8_t>;
+            break;
+        case DimType::Signed16:
+            m_packXyz = &packXyz<int16_t>;
+            m_unpackXyz = &unpackXyz<int16_t>;
+            break;
+        case DimType::Signed32:
+            m_packXyz = &packXyz<int32_t>;
+            m_unpackXyz = &unpackXyz<int32_t>;
+            break;
+        case DimType::Signed64:
+            m_packXyz = &packXyz<int64_t>;
+            m_unpackXyz = &unpackXyz<int64_t>;
+            break;
+        case DimType::Unsigned8:
+            m_packXyz = &packXyz<uint8_t>;
+            m_unpackXyz = &unpackXyz<uint8_t>;
+            break;
+        case DimType::Unsigned16:
+            m_packXyz = &packXyz<uint16_t>;
+            m_unpackXyz = &unpackXyz<uint16_t>;
+            break;
+        case DimType::Unsigned32:
+            m_packXyz = &packXyz<uint32_t>;
+            m_unpackXyz = &unpackXyz<uint32_t>;
+            break;
+        case DimType::Unsigned64:
+            m_packXyz = &packXyz<uint64_t>;
+            m_unpackXyz = &unpackXyz<uint64_t>;
+            break;
+        case DimType::Float:
+            m_packXyz = &packXyz<float>;
+            m_unpackXyz = &unpackXyz<float>;
+            break;
+        case DimType::Double:
+            m_packXyz = &packXyz<double>;
+            m_unpackXyz = &unpackXyz<double>;
+            break;
+        default:
+            throw std::runtime_error("Invalid XYZ type: " + typeString(type));
+    }
+}
+
+template <typename T>
+void CopyPlan::packXyz(const CopyPlan& plan, const char* src, char* dst)
+{
+    std::array<double, 3> v;
+    for (std::size_t i(0); i < 3; ++i)
+    {
+        std::memcpy(&v[i], src + plan.m_absoluteXyz[i], sizeof(double));
+    }
+
+    for (std::size_t i(0); i < 3; ++i)
+    {
+        double d((v[i] - plan.m_so.offset[i]) / plan.m_so.scale[i]);
+        if (std::is_integral<T>::value || plan.m_scaled) d = std::round(d);
+
+        // A value which would round out of range keeps its full precision.
+        if (plan.m_quantized)
+        {
+            const double q(plan.m_quantum[i]);
+            const double r(std::round(d / q) * q);
+            if (fits<T>(r)) d = r;
+        }
+
+        // Casting an unrepresentable value is undefined, so a point outside
+        // of the range of its type is an error, as it would be for PDAL.
+        if (!fits<T>(d))
+        {
+            throw std::runtime_error(
+                "Coordinate " + std::to_string(v[i]) + " is out of range");
+        }
+
+        const T t(static_cast<T>(d));
+        std::memcpy(dst + plan.m_packedXyz[i], &t, sizeof(T));
+    }
+}
+
+template <typename T>
+void CopyPlan::unpackXyz(const CopyPlan& plan, const char* src, char* dst)
+{
+    T t;
+    for (std::size_t i(0); i < 3; ++i)
+    {
+        std::memcpy(&t, src + plan.m_packedXyz[i], sizeof(T));
+        const double v(t * plan.m_so.scale[i] + plan.m_so.offset[i]);
+        std::memcpy(dst + plan.m_absoluteXyz[i], &v, sizeof(double));
+    }
+}
+
+} // namespace entwine
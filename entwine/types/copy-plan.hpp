@@ -0,0 +1,108 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <entwine/types/dimension.hpp>
+#include <entwine/types/scale-offset.hpp>
+
+namespace entwine
+{
+
+// A precompiled conversion of single points between the absolute layout of a
+// schema, with XYZ as doubles and fields in their in-memory order, and its
+// packed layout, with fields in schema order, XYZ in their schema types, and
+// scaled if the schema is scaled.  Other dimensions are
+// copied as contiguous runs, coalesced wherever they are adjacent in both
+// layouts, so no per-dimension type dispatch is performed per point.
+class CopyPlan
+{
+public:
+    explicit CopyPlan(const Schema& schema);
+
+    // This plan with XYZ packed at another scale and offset, or unscaled if
+    // none is given.
+    CopyPlan rescaled(const optional<ScaleOffset>& so) const
+    {
+        CopyPlan plan(*this);
+        plan.m_so = so ? *so : ScaleOffset();
+        plan.m_scaled = !!so;
+        return plan;
+    }
+
+    // This plan with each packed XYZ value rounded to a multiple of this many
+    // units of its packed scale, which leaves it readable at that scale.
+    CopyPlan quantized(const std::array<double, 3>& quantum) const
+    {
+        CopyPlan plan(*this);
+        plan.m_quantum = quantum;
+        plan.m_quantized = true;
+        return plan;
+    }
+
+    uint64_t absolutePointSize() const { return m_absolutePointSize; }
+    uint64_t packedPointSize() const { return m_packedPointSize; }
+
+    // Convert a single point from the absolute layout to the packed layout.
+    void pack(const char* src, char* dst) const
+    {
+        for (const Run& run : m_runs)
+        {
+            std::memcpy(dst + run.packed, src + run.absolute, run.size);
+        }
+        if (m_packXyz) m_packXyz(*this, src, dst);
+    }
+
+    // Convert a single point from the packed layout to the absolute layout.
+    void unpack(const char* src, char* dst) const
+    {
+        for (const Run& run : m_runs)
+        {
+            std::memcpy(dst + run.absolute, src + run.packed, run.size);
+        }
+        if (m_unpackXyz) m_unpackXyz(*this, src, dst);
+    }
+
+private:
+    struct Run
+    {
+        uint64_t absolute;
+        uint64_t packed;
+        uint64_t size;
+    };
+
+    using XyzFunction = void (*)(const CopyPlan&, const char*, char*);
+
+    template <typename T>
+    static void packXyz(const CopyPlan& plan, const char* src, char* dst);
+    template <typename T>
+    static void unpackXyz(const CopyPlan& plan, const char* src, char* dst);
+
+    uint64_t m_absolutePointSize = 0;
+    uint64_t m_packedPointSize = 0;
+    std::vector<Run> m_runs;
+
+    // If XYZ need conversion, these are their offsets within each layout.
+    std::array<uint64_t, 3> m_absoluteXyz = { { 0, 0, 0 } };
+    std::array<uint64_t, 3> m_packedXyz = { { 0, 0, 0 } };
+    ScaleOffset m_so;
+    bool m_scaled = false;
+    std::array<double, 3> m_quantum = { { 1, 1, 1 } };
+    bool m_quantized = false;
+    XyzFunction m_packXyz = nullptr;
+    XyzFunction m_unpackXyz = nullptr;
+};
+
+} // namespace entwine
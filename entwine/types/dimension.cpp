@@ -10,6 +10,8 @@
 
 #include <entwine/types/dimension.hpp>
 
+#include <algorithm>
+
 #include <entwine/types/defs.hpp>
 
 namespace pdal
@@ -155,7 +157,8 @@ Schema omit(Schema dims, const std::string name)
         std::remove_if(
             dims.begin(),
             dims.end(),
-            [name](const Dimension& d) { return d.name == name; }));
+            [name](const Dimension& d) { return d.name == name; }),
+        dims.end());
     return dims;
 }
 
@@ -189,7 +192,10 @@ Dimension combine(Dimension agg, const Dimension& dim)
     if (agg.offset != dim.offset) agg.offset = 0;
 
     if (!agg.stats) agg.stats = dim.stats;
-    else if (dim.stats) agg.stats = combine(*agg.stats, *dim.stats);
+    else if (dim.stats)
+    {
+        *agg.stats = combine(std::move(*agg.stats), *dim.stats);
+    }
 
     return agg;
 }
@@ -208,12 +214,16 @@ Schema makeAbsolute(Schema list)
 
 Schema combine(Schema agg, const Schema& cur, const bool fixed)
 {
-    for (const auto& incoming : cur)
+    // Schemas from the same format share the order of their dimensions, so
+    // each incoming dimension is first sought at its own position.
+    for (std::size_t i(0); i < cur.size(); ++i)
     {
-        if (Dimension* current = maybeFind(agg, incoming.name))
-        {
-            *current = combine(*current, incoming);
-        }
+        const Dimension& incoming(cur[i]);
+        Dimension* current = i < agg.size() && agg[i].name == incoming.name
+            ? &agg[i]
+            : maybeFind(agg, incoming.name);
+
+        if (current) *current = combine(std::move(*current), incoming);
         else if (!fixed)
         {
             agg.push_back(incoming);
@@ -243,6 +253,27 @@ FixedPointLayout toLayout(const Schema& list)
     return layout;
 }
 
+FixedPointLayout toMemoryLayout(const Schema& list)
+{
+    const auto isXyz([](const Dimension& d)
+    {
+        return d.name == "X" || d.name == "Y" || d.name == "Z";
+    });
+
+    Schema ordered(list);
+    std::stable_sort(
+        ordered.begin(),
+        ordered.end(),
+        [&isXyz](const Dimension& a, const Dimension& b)
+        {
+            if (isXyz(a) != isXyz(b)) return isXyz(a);
+            return pdal::Dimension::size(a.type) >
+                pdal::Dimension::size(b.type);
+        });
+
+    return toLayout(ordered);
+}
+
 Schema setScaleOffset(Schema dims, const ScaleOffset so)
 {
     auto& x = find(dims, "X");
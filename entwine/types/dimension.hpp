@@ -77,6 +77,12 @@ Schema makeAbsolute(Schema list);
 Schema fromLayout(const pdal::PointLayout& layout);
 FixedPointLayout toLayout(const Schema& list);
 
+// The layout in which points of this schema are held in memory, which unlike
+// the packed layout of toLayout need not follow the order of the schema.  XYZ,
+// which are read for every point, lead, and the rest follow by descending
+// size so that each field is naturally aligned within the point.
+FixedPointLayout toMemoryLayout(const Schema& list);
+
 Schema setScaleOffset(Schema dims, ScaleOffset so);
 optional<ScaleOffset> getScaleOffset(const Schema& dims);
 
@@ -10,6 +10,14 @@
 
 #include <entwine/types/endpoints.hpp>
 
+#include <entwine/builder/node-sizes.hpp>
+#include <entwine/util/io.hpp>
+#include <entwine/util/journal.hpp>
+#include <entwine/util/node-cache.hpp>
+#include <entwine/util/node-prefetcher.hpp>
+#include <entwine/util/pack.hpp>
+#include <entwine/util/uploader.hpp>
+
 namespace entwine
 {
 
@@ -53,4 +61,52 @@ Endpoints::Endpoints(
     }
 }
 
+void putData(
+    const Endpoints& endpoints,
+    const std::string& path,
+    std::vector<char> data)
+{
+    if (endpoints.nodePrefetcher) endpoints.nodePrefetcher->invalidate(path);
+    if (endpoints.nodeSizes) endpoints.nodeSizes->add(path, data.size());
+
+    if (endpoints.nodeCache)
+    {
+        endpoints.nodeCache->put(path, std::move(data));
+    }
+    else if (endpoints.journal) endpoints.journal->put(path, data);
+    else if (endpoints.uploader)
+    {
+        endpoints.uploader->put(endpoints.data, path, std::move(data));
+    }
+    else ensurePut(endpoints.data, path, data);
+}
+
+void awaitData(const Endpoints& endpoints, const std::string& path)
+{
+    // An evicted node is handed to our uploader before it is released by the
+    // node cache, so wait for them in this order.
+    if (endpoints.nodeCache) endpoints.nodeCache->wait(path);
+    if (endpoints.uploader) endpoints.uploader->wait(endpoints.data, path);
+}
+
+optional<std::vector<char>> takeData(
+    const Endpoints& endpoints,
+    const std::string& path)
+{
+    if (endpoints.nodeCache)
+    {
+        if (auto data = endpoints.nodeCache->take(path)) return data;
+    }
+    if (endpoints.journal)
+    {
+        if (auto data = endpoints.journal->get(path)) return data;
+    }
+    if (endpoints.nodePrefetcher)
+    {
+        if (auto data = endpoints.nodePrefetcher->take(path)) return data;
+    }
+    if (endpoints.packs) return endpoints.packs->get(path);
+    return { };
+}
+
 } // namespace entwine
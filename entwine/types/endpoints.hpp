@@ -13,13 +13,25 @@
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <entwine/third/arbiter/arbiter.hpp>
 #include <entwine/util/json.hpp>
+#include <entwine/util/optional.hpp>
 
 namespace entwine
 {
 
+class Journal;
+class NodeCache;
+class NodePrefetcher;
+class NodeSizes;
+class NodeStats;
+class Packs;
+class Provenance;
+class Uploader;
+class ZstdDictionary;
+
 struct Endpoints
 {
     Endpoints(
@@ -33,6 +45,61 @@ struct Endpoints
     arbiter::Endpoint hierarchy;
     arbiter::Endpoint sources;
     arbiter::Endpoint tmp;
+
+    // If set, point data is written asynchronously by this uploader.
+    std::shared_ptr<Uploader> uploader;
+
+    // If set, point data is held by this cache, and only written once it has
+    // been evicted from it.
+    std::shared_ptr<NodeCache> nodeCache;
+
+    // If set, the existing point data of nodes may be fetched ahead of its
+    // use by this prefetcher.
+    std::shared_ptr<NodePrefetcher> nodePrefetcher;
+
+    // If set, point data is staged in this local journal, and only written to
+    // our data endpoint when the journal is uploaded.
+    std::shared_ptr<Journal> journal;
+
+    // If set, point data is read from the packs of a packed dataset.
+    std::shared_ptr<Packs> packs;
+
+    // If set, each node written is summarized here.
+    std::shared_ptr<NodeStats> nodeStats;
+
+    // If set, the encoded size of each node written is recorded here.
+    std::shared_ptr<NodeSizes> nodeSizes;
+
+    // If set, the origins and point IDs of each node written are recorded
+    // here.
+    std::shared_ptr<Provenance> provenance;
+
+    // If set, small zstandard nodes are compressed with this dictionary once
+    // it has been trained, and read with it.
+    std::shared_ptr<ZstdDictionary> zstdDictionary;
+
+    // If set, overflows may be spilled to files within this local directory
+    // while the build is over its memory budget.
+    std::string spill;
 };
 
+// Write point data to this path within our data endpoint, via our node cache
+// and our journal or uploader if we have them.  Any prefetched copy of its
+// previous data is discarded, and its size is recorded if we record sizes.
+void putData(
+    const Endpoints& endpoints,
+    const std::string& path,
+    std::vector<char> data);
+
+// Wait for any pending write of point data to this path, without its
+// extension, so that it may be read.
+void awaitData(const Endpoints& endpoints, const std::string& path);
+
+// Take the point data for this path from our node cache, if it is held there,
+// or from our journal if it is staged there, or from our prefetcher if it has
+// been fetched ahead, or read it from its pack if our data is packed.
+optional<std::vector<char>> takeData(
+    const Endpoints& endpoints,
+    const std::string& path);
+
 } // namespace entwine
@@ -12,6 +12,7 @@
 
 #include <cassert>
 #include <cctype>
+#include <cmath>
 #include <cstdint>
 #include <ostream>
 #include <string>
@@ -75,6 +76,11 @@ struct Dxyz
         : Dxyz(d, p.x, p.y, p.z)
     { }
 
+    // Our references must refer to our own position, not that of the source.
+    Dxyz(const Dxyz& other)
+        : Dxyz(other.d, other.p)
+    { }
+
     Dxyz(std::string v)
         : Dxyz()
     {
@@ -146,19 +152,25 @@ inline bool operator!=(const Dxyz& a, const Dxyz& b)
     return !(a == b);
 }
 
+struct ChunkKey;
+
+// A cell of the octree over a cube, as its integer position at its depth.
+// Its bounds are derived from its position rather than being carried along
+// and halved at each step, so keys stay small and the center of a cell costs
+// only a few multiplications.
 struct Key
 {
-    Key(Bounds cube, uint64_t startDepth)
-        : cube(cube)
+    Key(const Bounds& cube, uint64_t startDepth)
+        : origin(cube.min())
+        , size(cube.width(), cube.depth(), cube.height())
         , startDepth(startDepth)
-        , b(cube)
     {
         reset();
     }
 
     void reset()
     {
-        b = cube;
+        level = 0;
         p.reset();
     }
 
@@ -167,12 +179,37 @@ struct Key
     void init(const Point& g, uint64_t depth)
     {
         reset();
-        for (std::size_t d(0); d < startDepth + depth; ++d) step(g);
+        descend(g, startDepth + depth);
     }
 
+    // Equivalent to init(g, ck.depth()) for a point within this chunk key,
+    // but starts from the chunk's position rather than stepping down from the
+    // root.  This makes the cost independent of depth, which matters when
+    // keying every point of a deep node.
+    void init(const Point& g, const ChunkKey& ck);
+
     Dir step(const Point& g)
     {
-        return step(getDirection(b.mid(), g));
+        return step(getDirection(mid(), g));
+    }
+
+    // Equivalent to stepping toward g this many levels, but each coordinate
+    // of the resulting cell is located directly rather than by a comparison
+    // at every level in between.  See locate().
+    void descend(const Point& g, uint64_t levels)
+    {
+        const uint64_t n(level + levels);
+        if (n > maxDirectLevel)
+        {
+            for (uint64_t i(0); i < levels; ++i) step(g);
+            return;
+        }
+
+        const double scale(std::ldexp(1.0, -static_cast<int>(n)));
+        p.x = locate(g.x, origin.x, size.x, scale, p.x << levels, levels);
+        p.y = locate(g.y, origin.y, size.y, scale, p.y << levels, levels);
+        p.z = locate(g.z, origin.z, size.z, scale, p.z << levels, levels);
+        level = n;
     }
 
     Dir step(Dir dir)
@@ -181,17 +218,79 @@ struct Key
         p.y = (p.y << 1) | (isNorth(dir) ? 1u : 0u);
         p.z = (p.z << 1) | (isUp(dir)    ? 1u : 0u);
 
-        b.go(dir);
+        ++level;
         return dir;
     }
 
-    const Bounds& bounds() const { return b; }
+    // Cell sizes halve exactly with each level, so these are computed in
+    // doubles without accumulating error.
+    Point mid() const
+    {
+        const double scale(std::ldexp(1.0, -static_cast<int>(level)));
+        return Point(
+            origin.x + (p.x + 0.5) * size.x * scale,
+            origin.y + (p.y + 0.5) * size.y * scale,
+            origin.z + (p.z + 0.5) * size.z * scale);
+    }
+
+    Bounds bounds() const
+    {
+        const double scale(std::ldexp(1.0, -static_cast<int>(level)));
+        const Point cell(size.x * scale, size.y * scale, size.z * scale);
+        return Bounds(
+            origin.x + p.x * cell.x,
+            origin.y + p.y * cell.y,
+            origin.z + p.z * cell.z,
+            origin.x + (p.x + 1) * cell.x,
+            origin.y + (p.y + 1) * cell.y,
+            origin.z + (p.z + 1) * cell.z);
+    }
+
     const Xyz& position() const { return p; }
 
-    const Bounds cube;
+    // Beyond this level, cell indices are not exactly representable as
+    // doubles, so cells are found by stepping.
+    static constexpr uint64_t maxDirectLevel = 52;
+
+    // The index, at the level of this scale, of the cell along one axis at or
+    // beneath the range of the given number of levels starting at lo, which
+    // contains g.  Every mid() at a coarser level is exactly the boundary
+    // between two cells at this one, so counting the boundaries at or below g
+    // makes the same decisions as stepping.  The quotient only estimates the
+    // cell, which is then corrected against our exact boundaries, so points
+    // near a boundary fall on the same side of it either way.
+    static uint64_t locate(
+        const double g,
+        const double origin,
+        const double size,
+        const double scale,
+        const uint64_t lo,
+        const uint64_t levels)
+    {
+        const uint64_t hi(lo + (uint64_t(1) << levels) - 1);
+        const auto boundary([&](const uint64_t k)
+        {
+            return origin + static_cast<double>(k) * size * scale;
+        });
+
+        // Comparisons with NaN are false, leaving it in our lowest cell, as
+        // stepping would.
+        const double f((g - origin) / (size * scale));
+        uint64_t c(lo);
+        if (f >= static_cast<double>(hi)) c = hi;
+        else if (f > static_cast<double>(lo)) c = static_cast<uint64_t>(f);
+
+        while (c < hi && g >= boundary(c + 1)) ++c;
+        while (c > lo && !(g >= boundary(c))) --c;
+        return c;
+    }
+
+    const Point origin;
+    const Point size;
     const uint64_t startDepth = 0;
 
-    Bounds b;
+    // The number of levels beneath the cube at which this cell lies.
+    uint64_t level = 0;
     Xyz p;
 };
 
@@ -225,6 +324,20 @@ struct ChunkKey
         while (depth() < d) step(g);
     }
 
+    // Initialize to the given node, stepping by the bits of its position.
+    void init(const Dxyz& dxyz)
+    {
+        reset();
+        while (depth() < dxyz.d)
+        {
+            const uint64_t shift(dxyz.d - depth() - 1);
+            step(static_cast<Dir>(
+                    ((dxyz.y >> shift) & 1 ? NsBit : 0) |
+                    ((dxyz.x >> shift) & 1 ? EwBit : 0) |
+                    ((dxyz.z >> shift) & 1 ? UdBit : 0)));
+        }
+    }
+
     Dir step(const Point& g)
     {
         ++d;
@@ -250,7 +363,8 @@ struct ChunkKey
     Dxyz dxyz() const { return get(); }
 
     const Xyz& position() const { return k.position(); }
-    const Bounds& bounds() const { return k.bounds(); }
+    Point mid() const { return k.mid(); }
+    Bounds bounds() const { return k.bounds(); }
     const Key& key() const { return k; }
     uint64_t depth() const { return d; }
 
@@ -258,6 +372,21 @@ struct ChunkKey
     uint64_t d = 0;
 };
 
+inline void Key::init(const Point& g, const ChunkKey& ck)
+{
+    level = ck.depth();
+    p = ck.position();
+    descend(g, startDepth);
+}
+
+// The bounds of this node of a build, as given to the writer of its data.
+inline Bounds getNodeBounds(const Metadata& m, const Dxyz& dxyz)
+{
+    ChunkKey ck(m.bounds, getStartDepth(m));
+    ck.init(dxyz);
+    return ck.bounds();
+}
+
 inline std::ostream& operator<<(std::ostream& os, const Xyz& xyz)
 {
     os << xyz.toString();
@@ -274,6 +403,19 @@ inline std::ostream& operator<<(std::ostream& os, const Dxyz& dxyz)
 
 namespace std
 {
+    template<> struct hash<entwine::Xyz>
+    {
+        std::size_t operator()(const entwine::Xyz& p) const
+        {
+            // Mix the coordinates so that neighboring positions, which differ
+            // only in their low bits, are spread across buckets.
+            uint64_t h(p.x * 0x9e3779b97f4a7c15ull);
+            h ^= p.y * 0xc2b2ae3d27d4eb4full + (h << 6) + (h >> 2);
+            h ^= p.z * 0x165667b19e3779f9ull + (h << 6) + (h >> 2);
+            return h ^ (h >> 32);
+        }
+    };
+
     template<> struct hash<entwine::Key>
     {
         std::size_t operator()(const entwine::Key& k) const
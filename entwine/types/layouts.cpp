@@ -0,0 +1,73 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/types/layouts.hpp>
+
+#include <atomic>
+
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+// Thread-local copies are keyed by an id rather than by address, since the
+// address of a destroyed instance may be reused.
+std::atomic<uint64_t> nextId(0);
+
+} // unnamed namespace
+
+Layouts::Layouts(const Schema& schema)
+    : m_id(nextId++)
+    , m_schema(schema)
+    , m_absolute(makeUnique<FixedPointLayout>(
+            toMemoryLayout(makeAbsolute(schema))))
+    , m_packed(makeUnique<FixedPointLayout>(toLayout(schema)))
+{ }
+
+const CopyPlan& Layouts::plan() const
+{
+    std::call_once(m_planned, [this]()
+    {
+        m_plan = makeUnique<CopyPlan>(m_schema);
+    });
+    return *m_plan;
+}
+
+pdal::PointLayout& Layouts::absolute() const
+{
+    thread_local std::map<uint64_t, std::unique_ptr<FixedPointLayout>> copies;
+    std::unique_ptr<FixedPointLayout>& copy(copies[m_id]);
+    if (!copy) copy = makeUnique<FixedPointLayout>(*m_absolute);
+    return *copy;
+}
+
+CopyPlan Layouts::plan(const DimType type, const optional<ScaleOffset>& so)
+    const
+{
+    const std::pair<DimType, bool> key(type, !!so);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it(m_plans.find(key));
+    if (it == m_plans.end())
+    {
+        Schema schema(setScaleOffset(m_schema, so ? *so : ScaleOffset()));
+        for (const std::string name : { "X", "Y", "Z" })
+        {
+            find(schema, name).type = type;
+        }
+        it = m_plans.emplace(key, CopyPlan(schema)).first;
+    }
+    return it->second.rescaled(so);
+}
+
+} // namespace entwine
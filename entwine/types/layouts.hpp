@@ -0,0 +1,68 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include <entwine/types/copy-plan.hpp>
+#include <entwine/types/dimension.hpp>
+#include <entwine/types/fixed-point-layout.hpp>
+#include <entwine/types/scale-offset.hpp>
+#include <entwine/util/optional.hpp>
+
+namespace entwine
+{
+
+// The layouts and conversion plans of a schema, which are built once and
+// shared rather than rebuilt for every node which is read or written.
+class Layouts
+{
+public:
+    explicit Layouts(const Schema& schema);
+
+    // The in-memory layout of our absolute schema.  PDAL stages which read
+    // into a table register their dimensions on its layout, even once it is
+    // finalized, so each thread is given its own copy of this layout.
+    pdal::PointLayout& absolute() const;
+
+    // Our schema in its packed layout, which follows the order of the schema.
+    const pdal::PointLayout& packed() const { return *m_packed; }
+
+    uint64_t absolutePointSize() const { return m_absolute->pointSize(); }
+
+    // The plan between the two layouts above, built on first use since not
+    // every schema can be planned - XYZ must share a type.
+    const CopyPlan& plan() const;
+
+    // The plan between our absolute layout and a packed layout which differs
+    // from ours only in the type and scaling of XYZ, as for nodes which are
+    // stored with relative or coarsened coordinates.  The plans for each type
+    // are built on first use, so only their scaling is applied per call.
+    CopyPlan plan(DimType xyzType, const optional<ScaleOffset>& so) const;
+
+private:
+    const uint64_t m_id;
+    const Schema m_schema;
+    const std::unique_ptr<FixedPointLayout> m_absolute;
+    const std::unique_ptr<FixedPointLayout> m_packed;
+
+    mutable std::once_flag m_planned;
+    mutable std::unique_ptr<CopyPlan> m_plan;
+
+    mutable std::mutex m_mutex;
+    mutable std::map<std::pair<DimType, bool>, CopyPlan> m_plans;
+};
+
+} // namespace entwine
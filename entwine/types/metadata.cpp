@@ -40,6 +40,7 @@ Metadata::Metadata(
     , dataType(dataType)
     , span(span)
     , internal(internal)
+    , layouts(std::make_shared<Layouts>(schema))
 { }
 
 void to_json(json& j, const Metadata& m)
@@ -65,6 +66,15 @@ void to_json(json& j, const Metadata& m)
 
     if (m.srs) j.update({ { "srs", *m.srs } });
     if (m.subset) j.update({ { "subset", *m.subset } });
+    if (m.internal.relativeXyz) j.update({ { "relativeXyz", true } });
+    if (m.internal.lossyDepth)
+    {
+        j.update({ { "lossyDepth", m.internal.lossyDepth } });
+    }
+    if (m.internal.dataTiers.size())
+    {
+        j.update({ { "dataTiers", m.internal.dataTiers } });
+    }
 }
 
 Bounds cubeify(Bounds b)
@@ -19,6 +19,7 @@
 #include <entwine/types/build-parameters.hpp>
 #include <entwine/types/defs.hpp>
 #include <entwine/types/dimension.hpp>
+#include <entwine/types/layouts.hpp>
 #include <entwine/types/srs.hpp>
 #include <entwine/types/subset.hpp>
 #include <entwine/types/version.hpp>
@@ -54,6 +55,9 @@ struct Metadata
     uint64_t span = 0;
 
     BuildParameters internal;
+
+    // Built from our schema, and shared by every copy of this metadata.
+    std::shared_ptr<const Layouts> layouts;
 };
 
 void to_json(json& j, const Metadata& m);
@@ -15,22 +15,33 @@
 namespace entwine
 {
 
+// The fates of the points read from a source: inserted, outside of the
+// conforming bounds of the build, or within them but outside of the bounds of
+// its subset.
 struct PointCounts
 {
-    PointCounts(uint64_t inserts = 0, uint64_t outOfBounds = 0)
+    PointCounts(
+            uint64_t inserts = 0,
+            uint64_t outOfBounds = 0,
+            uint64_t outOfSubset = 0)
         : inserts(inserts)
         , outOfBounds(outOfBounds)
+        , outOfSubset(outOfSubset)
     { }
 
     PointCounts& operator+=(const PointCounts& o)
     {
         inserts += o.inserts;
         outOfBounds += o.outOfBounds;
+        outOfSubset += o.outOfSubset;
         return *this;
     }
 
+    bool empty() const { return !inserts && !outOfBounds && !outOfSubset; }
+
     uint64_t inserts = 0;
     uint64_t outOfBounds = 0;
+    uint64_t outOfSubset = 0;
 };
 
 } // namespace entwine
@@ -0,0 +1,201 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/types/point-order.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+namespace entwine
+{
+
+namespace
+{
+
+// Spread the low 21 bits of v so that there are two zero bits between each.
+uint64_t spread(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffff;
+    v = (v | v << 16) & 0x1f0000ff0000ff;
+    v = (v | v << 8) & 0x100f00f00f00f00f;
+    v = (v | v << 4) & 0x10c30c30c30c30c3;
+    v = (v | v << 2) & 0x1249249249249249;
+    return v;
+}
+
+// Reverse the 63 bits of a Morton code, so that its coarsest bits vary
+// fastest.
+uint64_t reverse(uint64_t v)
+{
+    v = (v >> 1 & 0x5555555555555555) | (v & 0x5555555555555555) << 1;
+    v = (v >> 2 & 0x3333333333333333) | (v & 0x3333333333333333) << 2;
+    v = (v >> 4 & 0x0f0f0f0f0f0f0f0f) | (v & 0x0f0f0f0f0f0f0f0f) << 4;
+    v = (v >> 8 & 0x00ff00ff00ff00ff) | (v & 0x00ff00ff00ff00ff) << 8;
+    v = (v >> 16 & 0x0000ffff0000ffff) | (v & 0x0000ffff0000ffff) << 16;
+    v = v >> 32 | v << 32;
+    return v >> 1;
+}
+
+// Map a double to an unsigned integer of the same ordering.
+uint64_t toOrdered(const double d)
+{
+    uint64_t v;
+    std::memcpy(&v, &d, sizeof(v));
+    const uint64_t sign(1ull << 63);
+    return (v & sign) ? ~v : v | sign;
+}
+
+template <typename F>
+std::vector<uint64_t> getKeys(BlockPointTable& table, F f)
+{
+    std::vector<uint64_t> keys;
+    keys.reserve(table.size());
+    table.forEach([&](const char* pos) { keys.push_back(f(pos)); });
+    return keys;
+}
+
+double getDouble(const char* pos)
+{
+    double d;
+    std::memcpy(&d, pos, sizeof(d));
+    return d;
+}
+
+} // unnamed namespace
+
+uint64_t getMortonCode(const Bounds& cube, const Point& p)
+{
+    const double cells = 1 << 21;
+
+    uint64_t code = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        const double width = cube.max()[i] - cube.min()[i];
+        const double ratio = width > 0 ? (p[i] - cube.min()[i]) / width : 0;
+        const double cell = std::min(std::max(ratio * cells, 0.0), cells - 1);
+        code |= spread(static_cast<uint64_t>(cell)) << i;
+    }
+    return code;
+}
+
+std::vector<uint32_t> radixSort(std::vector<uint64_t> keys)
+{
+    const uint64_t n(keys.size());
+    if (n > std::numeric_limits<uint32_t>::max())
+    {
+        throw std::runtime_error("Too many points to sort");
+    }
+
+    std::vector<uint32_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+
+    // Histogram every byte of the keys in a single pass, so bytes which are
+    // the same for every key, like the high bytes of Morton codes within a
+    // node, may be skipped entirely.
+    std::array<std::array<uint64_t, 256>, 8> counts;
+    for (auto& c : counts) c.fill(0);
+    for (const uint64_t key : keys)
+    {
+        for (int b(0); b < 8; ++b) ++counts[b][(key >> (b * 8)) & 0xff];
+    }
+
+    std::vector<uint64_t> swapKeys(n);
+    std::vector<uint32_t> swapOrder(n);
+    for (int b(0); b < 8; ++b)
+    {
+        auto& c(counts[b]);
+        const unsigned shift(b * 8);
+        if (std::find(c.begin(), c.end(), n) != c.end()) continue;
+
+        uint64_t offset(0);
+        for (uint64_t& v : c)
+        {
+            const uint64_t count(v);
+            v = offset;
+            offset += count;
+        }
+
+        for (uint64_t i(0); i < n; ++i)
+        {
+            const uint64_t dst(c[(keys[i] >> shift) & 0xff]++);
+            swapKeys[dst] = keys[i];
+            swapOrder[dst] = order[i];
+        }
+
+        keys.swap(swapKeys);
+        order.swap(swapOrder);
+    }
+
+    return order;
+}
+
+void sortPoints(
+    BlockPointTable& table,
+    const std::string& order,
+    const Bounds& bounds)
+{
+    if (order.empty() || table.size() < 2) return;
+
+    const pdal::PointLayout& layout(*table.layout());
+    std::vector<uint64_t> keys;
+
+    if (order == "morton" || order == "progressive")
+    {
+        const bool progressive(order == "progressive");
+        const uint64_t x(layout.dimOffset(pdal::Dimension::Id::X));
+        const uint64_t y(layout.dimOffset(pdal::Dimension::Id::Y));
+        const uint64_t z(layout.dimOffset(pdal::Dimension::Id::Z));
+
+        keys = getKeys(table, [&](const char* pos)
+        {
+            const Point p(
+                getDouble(pos + x),
+                getDouble(pos + y),
+                getDouble(pos + z));
+            const uint64_t code(getMortonCode(bounds, p));
+            return progressive ? reverse(code) : code;
+        });
+    }
+    else if (order == "gpstime")
+    {
+        const auto id(layout.findDim("GpsTime"));
+        if (id == pdal::Dimension::Id::Unknown) return;
+
+        const uint64_t t(layout.dimOffset(id));
+        const auto type(layout.dimType(id));
+        if (type == pdal::Dimension::Type::Double)
+        {
+            keys = getKeys(table, [t](const char* pos)
+            {
+                return toOrdered(getDouble(pos + t));
+            });
+        }
+        else if (type == pdal::Dimension::Type::Float)
+        {
+            keys = getKeys(table, [t](const char* pos)
+            {
+                float f;
+                std::memcpy(&f, pos + t, sizeof(f));
+                return toOrdered(f);
+            });
+        }
+        else throw std::runtime_error("Invalid GpsTime type for sorting");
+    }
+    else throw std::runtime_error("Invalid point order: " + order);
+
+    table.reorder(radixSort(std::move(keys)));
+}
+
+} // namespace entwine
@@ -0,0 +1,44 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/point.hpp>
+#include <entwine/types/vector-point-table.hpp>
+
+namespace entwine
+{
+
+// Get the Morton code of this point within the cube, with 21 bits per axis.
+uint64_t getMortonCode(const Bounds& cube, const Point& p);
+
+// Returns the indices of these keys in ascending order of key, with equal keys
+// in their original order.
+std::vector<uint32_t> radixSort(std::vector<uint64_t> keys);
+
+// Reorder the points of this table, whose layout is absolute, by "morton" code
+// within these bounds, by "progressive" order, or by "gpstime".  An empty
+// order leaves the points in place, as does "gpstime" if the layout has no
+// GpsTime dimension.
+//
+// The progressive order is that of bit-reversed Morton codes, which visits
+// each octant of the bounds in turn, and each octant of those, and so on, so
+// that every prefix of the points is a spatially uniform subsample of them.
+void sortPoints(
+    BlockPointTable& table,
+    const std::string& order,
+    const Bounds& bounds);
+
+} // namespace entwine
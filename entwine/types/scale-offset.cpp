@@ -0,0 +1,162 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/types/scale-offset.hpp>
+
+#include <cmath>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ENTWINE_KERNEL_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define ENTWINE_KERNEL_NEON
+#include <arm_neon.h>
+#endif
+
+#include <entwine/util/cpu.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+// The vectorized kernels treat a run of points as a flat array of doubles.
+static_assert(sizeof(Point) == 3 * sizeof(double), "Unexpected Point layout");
+
+using ClipKernel = void(*)(Point*, std::size_t, const ScaleOffset&);
+
+// The reference kernel, against which the others must be exact.
+void clipScalar(Point* points, const std::size_t n, const ScaleOffset& so)
+{
+    const Scale& s(so.scale);
+    const Offset& o(so.offset);
+    for (std::size_t i(0); i < n; ++i)
+    {
+        Point& p(points[i]);
+        p.x = std::round((p.x - o.x) / s.x) * s.x + o.x;
+        p.y = std::round((p.y - o.y) / s.y) * s.y + o.y;
+        p.z = std::round((p.z - o.z) / s.z) * s.z + o.z;
+    }
+}
+
+#ifdef ENTWINE_KERNEL_AVX2
+// Rounds half away from zero, like std::round, which has no AVX instruction.
+// Truncation is exact, as is the difference from it, so adding one unit toward
+// the sign of v wherever that difference is at least one half is exact too.
+__attribute__((target("avx2")))
+inline __m256d roundAway(const __m256d v)
+{
+    const __m256d sign(_mm256_set1_pd(-0.0));
+    const __m256d t(_mm256_round_pd(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC));
+    const __m256d frac(_mm256_andnot_pd(sign, _mm256_sub_pd(v, t)));
+    const __m256d up(
+        _mm256_cmp_pd(frac, _mm256_set1_pd(0.5), _CMP_GE_OQ));
+    const __m256d one(
+        _mm256_or_pd(_mm256_and_pd(v, sign), _mm256_set1_pd(1.0)));
+    return _mm256_add_pd(t, _mm256_and_pd(up, one));
+}
+
+// Division and the separate multiply and add are kept, rather than a
+// reciprocal or FMA, so rounding matches the scalar kernel exactly.
+__attribute__((target("avx2")))
+inline void clipVector(double* d, const __m256d s, const __m256d o)
+{
+    const __m256d v(_mm256_loadu_pd(d));
+    const __m256d r(roundAway(_mm256_div_pd(_mm256_sub_pd(v, o), s)));
+    _mm256_storeu_pd(d, _mm256_add_pd(_mm256_mul_pd(r, s), o));
+}
+
+__attribute__((target("avx2")))
+void clipAvx2(Point* points, const std::size_t n, const ScaleOffset& so)
+{
+    const Scale& s(so.scale);
+    const Offset& o(so.offset);
+
+    // Four points are three vectors, across which the XYZ pattern repeats.
+    const __m256d s0(_mm256_setr_pd(s.x, s.y, s.z, s.x));
+    const __m256d s1(_mm256_setr_pd(s.y, s.z, s.x, s.y));
+    const __m256d s2(_mm256_setr_pd(s.z, s.x, s.y, s.z));
+    const __m256d o0(_mm256_setr_pd(o.x, o.y, o.z, o.x));
+    const __m256d o1(_mm256_setr_pd(o.y, o.z, o.x, o.y));
+    const __m256d o2(_mm256_setr_pd(o.z, o.x, o.y, o.z));
+
+    std::size_t i(0);
+    for ( ; i + 4 <= n; i += 4)
+    {
+        double* d(&points[i].x);
+        clipVector(d, s0, o0);
+        clipVector(d + 4, s1, o1);
+        clipVector(d + 8, s2, o2);
+    }
+
+    clipScalar(points + i, n - i, so);
+}
+#endif
+
+#ifdef ENTWINE_KERNEL_NEON
+// As in the scalar kernel, without fusing the multiply and add.
+inline void clipVector(double* d, const float64x2_t s, const float64x2_t o)
+{
+    const float64x2_t v(vld1q_f64(d));
+    const float64x2_t r(vrndaq_f64(vdivq_f64(vsubq_f64(v, o), s)));
+    vst1q_f64(d, vaddq_f64(vmulq_f64(r, s), o));
+}
+
+void clipNeon(Point* points, const std::size_t n, const ScaleOffset& so)
+{
+    const Scale& s(so.scale);
+    const Offset& o(so.offset);
+
+    // Two points are three vectors, across which the XYZ pattern repeats.
+    const double sv[6] = { s.x, s.y, s.z, s.x, s.y, s.z };
+    const double ov[6] = { o.x, o.y, o.z, o.x, o.y, o.z };
+    const float64x2_t s0(vld1q_f64(sv)), s1(vld1q_f64(sv + 2));
+    const float64x2_t s2(vld1q_f64(sv + 4));
+    const float64x2_t o0(vld1q_f64(ov)), o1(vld1q_f64(ov + 2));
+    const float64x2_t o2(vld1q_f64(ov + 4));
+
+    std::size_t i(0);
+    for ( ; i + 2 <= n; i += 2)
+    {
+        double* d(&points[i].x);
+        clipVector(d, s0, o0);
+        clipVector(d + 2, s1, o1);
+        clipVector(d + 4, s2, o2);
+    }
+
+    clipScalar(points + i, n - i, so);
+}
+#endif
+
+cpu::Kernel<ClipKernel> clipKernels()
+{
+    cpu::Kernel<ClipKernel> k;
+    k.scalar = clipScalar;
+#ifdef ENTWINE_KERNEL_AVX2
+    k.avx2 = clipAvx2;
+#endif
+#ifdef ENTWINE_KERNEL_NEON
+    k.neon = clipNeon;
+#endif
+    return k;
+}
+
+} // unnamed namespace
+
+void clip(Point* points, const std::size_t n, const ScaleOffset& so)
+{
+    static const ClipKernel kernel(clipKernels().select());
+    kernel(points, n, so);
+}
+
+} // namespace entwine
@@ -10,6 +10,9 @@
 
 #pragma once
 
+#include <cmath>
+#include <cstddef>
+
 #include <entwine/types/point.hpp>
 
 namespace entwine
@@ -36,4 +39,8 @@ inline Point clip(const Point& p, const ScaleOffset& so)
         so.offset);
 }
 
+// Clip a batch of points in place, with results identical to those of clip().
+// The kernel is selected at runtime for the instruction sets of this host.
+void clip(Point* points, std::size_t n, const ScaleOffset& so);
+
 } // namespace entwine
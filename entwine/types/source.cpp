@@ -9,9 +9,16 @@
 ******************************************************************************/
 
 #include <entwine/types/source.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+
 #include <entwine/util/fs.hpp>
 #include <entwine/util/io.hpp>
 #include <entwine/util/pool.hpp>
+#include <entwine/util/reduce.hpp>
+#include <entwine/util/sax.hpp>
 
 namespace entwine
 {
@@ -19,6 +26,18 @@ namespace entwine
 namespace
 {
 
+const std::string multipleSrs("Multiple spatial references found");
+
+// This warning is held once, however many sources are responsible for it.
+void warn(StringList& warnings, const std::string& message)
+{
+    if (message != multipleSrs ||
+        std::find(warnings.begin(), warnings.end(), message) == warnings.end())
+    {
+        warnings.push_back(message);
+    }
+}
+
 bool areStemsUnique(const SourceList& sources)
 {
     std::set<std::string> stems;
@@ -54,6 +73,13 @@ void to_json(json& j, const SourceInfo& info)
     if (info.warnings.size()) j["warnings"] = info.warnings;
     if (info.errors.size()) j["errors"] = info.errors;
     j["points"] = info.points;
+    if (info.counts.inserts || info.counts.outOfBounds)
+    {
+        j["counts"] = {
+            { "inserted", info.counts.inserts },
+            { "outOfBounds", info.counts.outOfBounds }
+        };
+    }
 
     // If we have no points, then our SRS, bounds, and dimensions are not
     // applicable.
@@ -89,15 +115,19 @@ SourceInfo::SourceInfo(const json& j)
     , points(j.value("points", 0))
     , schema(j.value("schema", Schema()))
     , metadata(j.value("metadata", json()))
-{ }
+{
+    if (j.count("counts"))
+    {
+        const json& c(j.at("counts"));
+        counts.inserts = c.value("inserted", 0);
+        counts.outOfBounds = c.value("outOfBounds", 0);
+    }
+}
 
 SourceInfo manifest::combine(SourceInfo agg, const SourceInfo& cur)
 {
     agg.errors.insert(agg.errors.end(), cur.errors.begin(), cur.errors.end());
-    agg.warnings.insert(
-        agg.warnings.end(),
-        cur.warnings.begin(),
-        cur.warnings.end());
+    for (const std::string& w : cur.warnings) warn(agg.warnings, w);
 
     if (!cur.points) return agg;
 
@@ -105,43 +135,46 @@ SourceInfo manifest::combine(SourceInfo agg, const SourceInfo& cur)
     if (cur.srs.exists())
     {
         if (agg.srs.empty()) agg.srs = cur.srs;
-        else if (agg.srs != cur.srs)
-        {
-            const std::string message = "Multiple spatial references found";
-            const auto pred = [message](const std::string& s)
-            {
-                return s == message;
-            };
-            if (std::none_of(agg.warnings.begin(), agg.warnings.end(), pred))
-            {
-                agg.warnings.push_back(message);
-            }
-        }
+        else if (agg.srs != cur.srs) warn(agg.warnings, multipleSrs);
     }
     agg.bounds.grow(cur.bounds);
     agg.points += cur.points;
-    agg.schema = combine(agg.schema, cur.schema);
+    agg.schema = combine(std::move(agg.schema), cur.schema);
 
     return agg;
 }
 
-SourceInfo manifest::combine(SourceInfo agg, Source source)
+SourceInfo manifest::combine(SourceInfo agg, const Source& source)
 {
-    for (auto& w : source.info.warnings) w = source.path + ": " + w;
-    for (auto& e : source.info.errors) e = source.path + ": " + e;
-    return combine(agg, source.info);
+    // Only the messages of a source are altered, so it is copied only if it
+    // has any.
+    if (source.info.warnings.empty() && source.info.errors.empty())
+    {
+        return combine(std::move(agg), source.info);
+    }
+
+    SourceInfo info(source.info);
+    for (auto& w : info.warnings) w = source.path + ": " + w;
+    for (auto& e : info.errors) e = source.path + ": " + e;
+    return combine(std::move(agg), info);
 }
 
-SourceInfo manifest::reduce(const SourceList& list)
+SourceInfo manifest::reduce(const SourceList& list, const unsigned threads)
 {
     SourceInfo initial;
     initial.bounds = Bounds::expander();
-    return std::accumulate(
-        list.begin(),
-        list.end(),
+    return parallelReduce(
+        list.size(),
         initial,
-        [](SourceInfo info, Source source) { return combine(info, source); }
-    );
+        threads,
+        [&list](SourceInfo& info, std::size_t i)
+        {
+            info = combine(std::move(info), list[i]);
+        },
+        [](SourceInfo& info, SourceInfo&& other)
+        {
+            info = combine(std::move(info), other);
+        });
 }
 
 json toOverview(const Manifest& manifest)
@@ -192,14 +225,15 @@ void saveEach(
     const bool stemsAreUnique = areStemsUnique(sources);
 
     uint64_t i = 0;
-    Pool pool(threads);
+    std::vector<Task> tasks;
+    tasks.reserve(sources.size());
     for (const Source& source : sources)
     {
         const std::string stem = stemsAreUnique
             ? getStem(source.path)
             : std::to_string(i);
 
-        pool.add([&ep, &source, stem, pretty]()
+        tasks.emplace_back([&ep, &source, stem, pretty]()
         {
             ensurePut(ep, stem + ".json", json(source).dump(getIndent(pretty)));
         });
@@ -207,6 +241,8 @@ void saveEach(
         ++i;
     }
 
+    Pool pool(threads);
+    pool.add(std::move(tasks));
     pool.join();
 }
 
@@ -216,11 +252,11 @@ void saveEach(
     const unsigned threads,
     const bool pretty)
 {
-    Pool pool(threads);
-
+    std::vector<Task> tasks;
+    tasks.reserve(manifest.size());
     for (const auto& item : manifest)
     {
-        pool.add([&ep, &item, pretty]()
+        tasks.emplace_back([&ep, &item, pretty]()
         {
             ensurePut(
                 ep,
@@ -229,33 +265,169 @@ void saveEach(
         });
     }
 
+    Pool pool(threads);
+    pool.add(std::move(tasks));
     pool.join();
 }
 
+std::string manifest::getShardPath(
+    const Origin origin,
+    const uint64_t shardSize)
+{
+    return shardDir + std::to_string(origin / shardSize) + ".json";
+}
+
+void manifest::saveShards(
+    const Manifest& manifest,
+    const OriginList& origins,
+    const arbiter::Endpoint& ep,
+    const unsigned threads,
+    const bool pretty)
+{
+    std::map<std::string, OriginList> shards;
+    for (const Origin o : origins)
+    {
+        shards[manifest.at(o).metadataPath].push_back(o);
+    }
+
+    if (shards.size() && ep.isLocal())
+    {
+        arbiter::mkdirp(arbiter::join(ep.prefixedRoot(), shardDir));
+    }
+
+    Pool pool(threads);
+    for (const auto& shard : shards)
+    {
+        pool.add([&manifest, &ep, &shard, pretty]()
+        {
+            const std::string& path = shard.first;
+
+            json j = json::object();
+            if (const auto existing = ep.tryGet(path))
+            {
+                j = json::parse(*existing);
+            }
+            for (const Origin o : shard.second)
+            {
+                j[std::to_string(o)] = manifest[o].source;
+            }
+
+            ensurePut(ep, path, j.dump(getIndent(pretty)));
+        });
+    }
+    pool.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+}
+
 Manifest manifest::load(
     const arbiter::Endpoint& ep,
     const unsigned threads,
-    const std::string postfix)
+    const std::string postfix,
+    const bool detailed)
 {
-    Manifest manifest =
-        json::parse(ensureGet(ep, "manifest" + postfix + ".json"));
+    Manifest manifest;
+    sax::forEachElement(
+        ensureGet(ep, "manifest" + postfix + ".json"),
+        [&manifest](json&& entry) { manifest.emplace_back(entry); });
+
+    const auto needed = [detailed](const BuildItem& entry)
+    {
+        return entry.metadataPath.size() && (detailed || !isSettled(entry));
+    };
+
+    const uint64_t loading =
+        std::count_if(manifest.begin(), manifest.end(), needed);
+    if (loading)
+    {
+        std::cout << "Loading metadata of " << loading << " sources from " <<
+            ep.prefixedRoot() << std::endl;
+    }
+
+    // Each file is read once, even if it is a shard holding many entries.
+    std::map<std::string, OriginList> files;
+    for (Origin o = 0; o < manifest.size(); ++o)
+    {
+        if (needed(manifest[o])) files[manifest[o].metadataPath].push_back(o);
+    }
 
     Pool pool(threads);
-    for (auto& entry : manifest)
+    for (const auto& file : files)
     {
-        if (entry.metadataPath.size())
+        pool.add([&ep, &manifest, &file]()
         {
-            std::cout << "Loading " << entry.metadataPath << " from " <<
-                ep.prefixedRoot() << std::endl;
-            const json metadata =
-                json::parse(ensureGet(ep, entry.metadataPath));
-            entry = BuildItem(entwine::merge(json(entry), metadata));
-        }
+            const std::string& path = file.first;
+            const json metadata = json::parse(ensureGet(ep, path));
+            for (const Origin o : file.second)
+            {
+                BuildItem& entry = manifest[o];
+                entry = BuildItem(
+                    entwine::merge(
+                        json(entry),
+                        isShardPath(path)
+                            ? metadata.at(std::to_string(o))
+                            : metadata));
+            }
+        });
     }
     pool.join();
     return manifest;
 }
 
+void manifest::compact(BuildItem& item)
+{
+    SourceInfo& info = item.source.info;
+    info.schema = Schema();
+    info.srs = Srs();
+    info.metadata = json();
+    item.detailed = false;
+}
+
+void manifest::restore(BuildItem& item, SourceInfo detail)
+{
+    SourceInfo& info = item.source.info;
+    info.schema = std::move(detail.schema);
+    info.srs = std::move(detail.srs);
+    info.metadata = std::move(detail.metadata);
+    item.detailed = true;
+}
+
+void manifest::loadDetails(
+    const arbiter::Endpoint& ep,
+    Manifest& manifest,
+    const OriginList& origins,
+    const unsigned threads)
+{
+    std::map<std::string, OriginList> files;
+    for (const Origin o : origins)
+    {
+        const BuildItem& entry = manifest.at(o);
+        if (!entry.detailed) files[entry.metadataPath].push_back(o);
+    }
+
+    Pool pool(threads);
+    for (const auto& file : files)
+    {
+        pool.add([&ep, &manifest, &file]()
+        {
+            const std::string& path = file.first;
+            const json metadata = json::parse(ensureGet(ep, path));
+            for (const Origin o : file.second)
+            {
+                restore(
+                    manifest[o],
+                    SourceInfo(
+                        isShardPath(path)
+                            ? metadata.at(std::to_string(o))
+                            : metadata));
+            }
+        });
+    }
+    pool.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+}
+
 Manifest manifest::merge(Manifest dst, const Manifest& src)
 {
     if (dst.size() != src.size())
@@ -282,7 +454,14 @@ Manifest manifest::merge(Manifest dst, const Manifest& src)
             if (!dstEntry.inserted) dstEntry = srcEntry;
             else
             {
-                // If both subsets inserted this file, then
+                // If both subsets inserted this file, then each inserted its
+                // own share of its points, while those out of bounds were
+                // rejected by every subset which read them.
+                dstInfo.counts.inserts += srcInfo.counts.inserts;
+                dstInfo.counts.outOfBounds = std::max(
+                    dstInfo.counts.outOfBounds,
+                    srcInfo.counts.outOfBounds);
+
                 dstInfo.errors.insert(
                     dstInfo.errors.end(),
                     srcInfo.errors.begin(),
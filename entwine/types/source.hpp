@@ -14,6 +14,7 @@
 #include <entwine/types/bounds.hpp>
 #include <entwine/types/defs.hpp>
 #include <entwine/types/dimension.hpp>
+#include <entwine/types/point-counts.hpp>
 #include <entwine/types/srs.hpp>
 #include <entwine/util/json.hpp>
 
@@ -34,6 +35,12 @@ struct SourceInfo
     uint64_t points = 0;
     Schema schema;
 
+    // Counts of the points of this source which were inserted and which were
+    // rejected by our bounds, which are zero until it has been inserted.
+    // Points rejected by the bounds of a subset are not counted here, since
+    // they are inserted by another.
+    PointCounts counts;
+
     json metadata;
 };
 using InfoList = std::vector<SourceInfo>;
@@ -77,6 +84,10 @@ struct BuildItem
     Source source;
     bool inserted = false;
     std::string metadataPath;
+
+    // False while the detail of this entry is released from a compact
+    // manifest, which is not persisted.
+    bool detailed = true;
 };
 using Manifest = std::vector<BuildItem>;
 void to_json(json& j, const BuildItem& item);
@@ -85,8 +96,9 @@ inline void from_json(const json& j, BuildItem& item) { item = BuildItem(j); }
 namespace manifest
 {
 SourceInfo combine(SourceInfo agg, const SourceInfo& info);
-SourceInfo combine(SourceInfo agg, Source source);
-SourceInfo reduce(const SourceList& list);
+SourceInfo combine(SourceInfo agg, const Source& source);
+// Merge the information of these sources, in order, over this many threads.
+SourceInfo reduce(const SourceList& list, unsigned threads = 1);
 SourceInfo merge(SourceInfo a, const SourceInfo& b);
 } // namespace manifest
 
@@ -122,19 +134,66 @@ void saveEach(
     unsigned threads,
     bool pretty = true);
 
+// The per-file metadata of large manifests may instead be saved in shards of
+// consecutive origins, each a JSON object of origin IDs to their metadata, so
+// that the number of objects scales with the number of shards.
+namespace manifest
+{
+
+const std::string shardDir = "shards/";
+
+std::string getShardPath(Origin origin, uint64_t shardSize);
+inline bool isShardPath(const std::string& path)
+{
+    return !path.compare(0, shardDir.size(), shardDir);
+}
+
+// Save the metadata of these origins of our manifest, whose metadata paths
+// are their shard paths, into their shards.  Each shard which exists already
+// is updated rather than replaced.
+void saveShards(
+    const Manifest& manifest,
+    const OriginList& origins,
+    const arbiter::Endpoint& ep,
+    unsigned threads,
+    bool pretty = true);
+
+} // namespace manifest
+
 uint64_t getInsertedPoints(const Manifest& manifest);
 uint64_t getTotalPoints(const Manifest& manifest);
 
 namespace manifest
 {
 
+// If not detailed, the per-file metadata of entries which are already settled
+// is not loaded, leaving only their overview.
 Manifest load(
     const arbiter::Endpoint& ep,
     unsigned threads,
-    std::string postfix = "");
+    std::string postfix = "",
+    bool detailed = true);
 
 Manifest merge(Manifest manifest, const Manifest& other);
 
+// A compact manifest holds only the overview of each entry, along with the
+// pipeline by which its reads are planned, while its detail - its schema, SRS,
+// and reader metadata - is only held while the entry is inserted or saved.
+// Release the detail of this entry, which must have been saved.
+void compact(BuildItem& item);
+
+// Restore the detail of this entry from a detailed copy of its info.
+void restore(BuildItem& item, SourceInfo detail);
+
+// Load the detail of these entries of a compact manifest from their saved
+// metadata.  Only their detail is assigned, so their overviews may be read
+// meanwhile.
+void loadDetails(
+    const arbiter::Endpoint& ep,
+    Manifest& manifest,
+    const OriginList& origins,
+    unsigned threads);
+
 } // namespace manifest
 
 } // namespace entwine
@@ -0,0 +1,223 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/types/stats-accumulator.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace entwine
+{
+
+StatsAccumulator::StatsAccumulator(Schema schema, StringList enumerate)
+    : m_schema(schema)
+    , m_enumerate(enumerate)
+{ }
+
+void StatsAccumulator::init(const pdal::PointLayout& layout)
+{
+    if (m_schema.empty()) m_schema = fromLayout(layout);
+
+    for (const Dimension& d : m_schema)
+    {
+        const DimId id(layout.findDim(d.name));
+        if (id == DimId::Unknown)
+        {
+            throw std::runtime_error("Missing dimension for stats: " + d.name);
+        }
+
+        const bool enumerate(
+            std::find(m_enumerate.begin(), m_enumerate.end(), d.name) !=
+            m_enumerate.end());
+
+        m_columns.emplace_back(
+            id,
+            layout.dimType(id),
+            layout.dimOffset(id),
+            enumerate);
+    }
+
+    m_initialized = true;
+}
+
+void StatsAccumulator::add(VectorPointTable& table)
+{
+    if (!m_initialized) init(*table.layout());
+
+    m_rows.clear();
+    for (auto it = table.begin(); it != table.end(); ++it)
+    {
+        m_rows.push_back(it.data());
+    }
+    if (m_rows.empty()) return;
+
+    for (Column& c : m_columns)
+    {
+        switch (c.type)
+        {
+            case Type::Signed8:     c.add<int8_t>(m_rows, m_scratch);     break;
+            case Type::Signed16:    c.add<int16_t>(m_rows, m_scratch);    break;
+            case Type::Signed32:    c.add<int32_t>(m_rows, m_scratch);    break;
+            case Type::Signed64:    c.add<int64_t>(m_rows, m_scratch);    break;
+            case Type::Unsigned8:   c.add<uint8_t>(m_rows, m_scratch);    break;
+            case Type::Unsigned16:  c.add<uint16_t>(m_rows, m_scratch);   break;
+            case Type::Unsigned32:  c.add<uint32_t>(m_rows, m_scratch);   break;
+            case Type::Unsigned64:  c.add<uint64_t>(m_rows, m_scratch);   break;
+            case Type::Float:       c.add<float>(m_rows, m_scratch);      break;
+            case Type::Double:      c.add<double>(m_rows, m_scratch);     break;
+            default: throw std::runtime_error("Invalid dimension type");
+        }
+    }
+}
+
+template <typename T>
+void StatsAccumulator::Column::add(
+    const std::vector<const char*>& rows,
+    std::vector<double>& scratch)
+{
+    const uint64_t n(rows.size());
+
+    // Each pass reads a single dimension across the batch, so the inner loops
+    // are free of type dispatch.  The dimension is gathered once into a
+    // contiguous buffer, whose reductions are split across independent lanes
+    // so that they may be vectorized.
+    T v;
+    scratch.resize(n);
+    for (uint64_t i(0); i < n; ++i)
+    {
+        std::memcpy(&v, rows[i] + offset, sizeof(T));
+        scratch[i] = v;
+    }
+
+    const std::size_t lanes(4);
+    std::array<double, lanes> lo;
+    std::array<double, lanes> hi;
+    std::array<double, lanes> sum;
+    lo.fill(std::numeric_limits<double>::max());
+    hi.fill(std::numeric_limits<double>::lowest());
+    sum.fill(0);
+
+    const uint64_t body(n - n % lanes);
+    for (uint64_t i(0); i < body; i += lanes)
+    {
+        for (std::size_t l(0); l < lanes; ++l)
+        {
+            const double d(scratch[i + l]);
+            lo[l] = std::min(lo[l], d);
+            hi[l] = std::max(hi[l], d);
+            sum[l] += d;
+        }
+    }
+    for (uint64_t i(body); i < n; ++i)
+    {
+        lo[0] = std::min(lo[0], scratch[i]);
+        hi[0] = std::max(hi[0], scratch[i]);
+        sum[0] += scratch[i];
+    }
+
+    const double batchMin(*std::min_element(lo.begin(), lo.end()));
+    const double batchMax(*std::max_element(hi.begin(), hi.end()));
+    const double batchMean((sum[0] + sum[1] + sum[2] + sum[3]) / n);
+
+    std::array<double, lanes> sq;
+    sq.fill(0);
+    for (uint64_t i(0); i < body; i += lanes)
+    {
+        for (std::size_t l(0); l < lanes; ++l)
+        {
+            const double delta(scratch[i + l] - batchMean);
+            sq[l] += delta * delta;
+        }
+    }
+    for (uint64_t i(body); i < n; ++i)
+    {
+        const double delta(scratch[i] - batchMean);
+        sq[0] += delta * delta;
+    }
+    const double batchM2(sq[0] + sq[1] + sq[2] + sq[3]);
+
+    if (enumerate)
+    {
+        if (sizeof(T) == 1)
+        {
+            std::array<uint64_t, 256> counts;
+            counts.fill(0);
+            uint8_t b;
+            for (const char* row : rows)
+            {
+                std::memcpy(&b, row + offset, 1);
+                ++counts[b];
+            }
+            for (std::size_t i(0); i < counts.size(); ++i)
+            {
+                if (!counts[i]) continue;
+                T value;
+                const uint8_t byte(i);
+                std::memcpy(&value, &byte, 1);
+                values[static_cast<double>(value)] += counts[i];
+            }
+        }
+        else
+        {
+            for (const char* row : rows)
+            {
+                std::memcpy(&v, row + offset, sizeof(T));
+                ++values[static_cast<double>(v)];
+            }
+        }
+    }
+
+    // Combine with our running statistics, per Chan et al.
+    if (!count)
+    {
+        minimum = batchMin;
+        maximum = batchMax;
+    }
+    else
+    {
+        minimum = std::min(minimum, batchMin);
+        maximum = std::max(maximum, batchMax);
+    }
+
+    const double na(count);
+    const double nb(n);
+    const double total(na + nb);
+    const double delta(batchMean - mean);
+    mean += delta * nb / total;
+    m2 += batchM2 + delta * delta * na * nb / total;
+    count += n;
+}
+
+Schema StatsAccumulator::schema() const
+{
+    if (!m_initialized) return Schema();
+
+    Schema schema(m_schema);
+    for (std::size_t i(0); i < m_columns.size(); ++i)
+    {
+        const Column& c(m_columns[i]);
+
+        DimensionStats stats;
+        stats.minimum = c.minimum;
+        stats.maximum = c.maximum;
+        stats.mean = c.mean;
+        // As for filters.stats, this is the sample variance.
+        stats.variance = c.count > 1 ? c.m2 / (c.count - 1) : 0;
+        stats.count = c.count;
+        stats.values = c.values;
+        schema[i].stats = stats;
+    }
+    return schema;
+}
+
+} // namespace entwine
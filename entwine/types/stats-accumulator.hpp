@@ -0,0 +1,84 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <entwine/types/defs.hpp>
+#include <entwine/types/dimension.hpp>
+#include <entwine/types/dimension-stats.hpp>
+#include <entwine/types/vector-point-table.hpp>
+
+namespace entwine
+{
+
+// Accumulates dimension statistics over the batches of a streaming table,
+// one dimension at a time, in place of a filters.stats stage.  Values of the
+// enumerated dimensions are also counted.
+class StatsAccumulator
+{
+public:
+    // Statistics are gathered for the dimensions of this schema, or for every
+    // dimension of the table's layout if it is empty.
+    explicit StatsAccumulator(
+        Schema schema = Schema(),
+        StringList enumerate = { "Classification" });
+
+    // Accumulate the points of the current batch of this table, skipping any
+    // which have been filtered out.
+    void add(VectorPointTable& table);
+
+    // Returns our schema with statistics attached, which is empty if no
+    // batches have been added.
+    Schema schema() const;
+
+private:
+    struct Column
+    {
+        Column(DimId id, Type type, std::size_t offset, bool enumerate)
+            : id(id)
+            , type(type)
+            , offset(offset)
+            , enumerate(enumerate)
+        { }
+
+        DimId id;
+        Type type;
+        std::size_t offset;
+        bool enumerate;
+
+        uint64_t count = 0;
+        double minimum = 0;
+        double maximum = 0;
+        double mean = 0;
+        double m2 = 0;
+        DimensionStats::Values values;
+
+        template <typename T>
+        void add(
+            const std::vector<const char*>& rows,
+            std::vector<double>& scratch);
+    };
+
+    void init(const pdal::PointLayout& layout);
+
+    Schema m_schema;
+    const StringList m_enumerate;
+    std::vector<Column> m_columns;
+    std::vector<const char*> m_rows;
+    std::vector<double> m_scratch;
+    bool m_initialized = false;
+};
+
+} // namespace entwine
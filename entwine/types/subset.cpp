@@ -10,11 +10,121 @@
 
 #include <entwine/types/subset.hpp>
 
+#include <algorithm>
 #include <cassert>
 
+#include <entwine/builder/heuristics.hpp>
+
 namespace entwine
 {
 
+namespace
+{
+
+// Get the XY grid cell of this point at this depth, in quadtree order.  The
+// cube is descended just as the octree is, so each node at this depth or
+// deeper lies within exactly one cell.
+uint64_t getCell(Bounds cube, const uint64_t depth, const Point& p)
+{
+    uint64_t cell(0);
+    for (uint64_t d(0); d < depth; ++d)
+    {
+        const Dir dir(getDirection(cube.mid(), p, true));
+        cell = (cell << 2) | toIntegral(dir);
+        cube.go(dir, true);
+    }
+    return cell;
+}
+
+Bounds getCellBounds(Bounds cube, const uint64_t depth, const uint64_t cell)
+{
+    for (uint64_t d(0); d < depth; ++d)
+    {
+        cube.go(toDir((cell >> ((depth - d - 1) * 2)) & 0x3), true);
+    }
+    return cube;
+}
+
+// Get the quadtree order of the cell at this column and row of the grid.
+uint64_t toCell(const uint64_t depth, const uint64_t x, const uint64_t y)
+{
+    uint64_t cell(0);
+    for (uint64_t d(0); d < depth; ++d)
+    {
+        const uint64_t shift(depth - d - 1);
+        cell = (cell << 2) | (((y >> shift) & 1) << 1) | ((x >> shift) & 1);
+    }
+    return cell;
+}
+
+uint64_t getOwner(const Subset& s, const uint64_t cell)
+{
+    return std::distance(
+        s.starts.begin(),
+        std::upper_bound(s.starts.begin(), s.starts.end(), cell));
+}
+
+// Estimate the points within each grid cell at this depth by spreading the
+// points of each file evenly over its XY bounds.
+std::vector<double> getWeights(
+    const Bounds& cube,
+    const uint64_t depth,
+    const Manifest& manifest)
+{
+    const uint64_t n(1ull << depth);
+    const double cw(cube.width() / n);
+    const double ch(cube.depth() / n);
+    const auto column = [&](double x)
+    {
+        const double i(std::floor((x - cube.min().x) / cw));
+        return static_cast<uint64_t>(std::max(0.0, std::min<double>(i, n - 1)));
+    };
+    const auto row = [&](double y)
+    {
+        const double i(std::floor((y - cube.min().y) / ch));
+        return static_cast<uint64_t>(std::max(0.0, std::min<double>(i, n - 1)));
+    };
+
+    std::vector<double> weights(n * n, 0);
+    for (const BuildItem& item : manifest)
+    {
+        const SourceInfo& info(item.source.info);
+        if (!info.points) continue;
+
+        const Bounds& b(info.bounds);
+        const double area(b.area());
+        if (!area)
+        {
+            weights[getCell(cube, depth, b.mid())] += info.points;
+            continue;
+        }
+
+        for (uint64_t y(row(b.min().y)); y <= row(b.max().y); ++y)
+        {
+            const double ymin(cube.min().y + y * ch);
+            const double dy(
+                std::min(b.max().y, ymin + ch) - std::max(b.min().y, ymin));
+            if (dy <= 0) continue;
+
+            for (uint64_t x(column(b.min().x)); x <= column(b.max().x); ++x)
+            {
+                const double xmin(cube.min().x + x * cw);
+                const double dx(
+                    std::min(b.max().x, xmin + cw) -
+                    std::max(b.min().x, xmin));
+                if (dx <= 0) continue;
+
+                weights[toCell(depth, x, y)] += info.points * dx * dy / area;
+            }
+        }
+    }
+
+
+    return weights;
+}
+
+} // unnamed namespace
+
 Subset::Subset(const uint64_t id, const uint64_t of)
     : id(id)
     , of(of)
@@ -22,22 +132,123 @@ Subset::Subset(const uint64_t id, const uint64_t of)
     if (!id) throw std::runtime_error("Subset IDs should be 1-based.");
     if (of <= 1) throw std::runtime_error("Invalid subset range");
     if (id > of) throw std::runtime_error("Invalid subset ID - too large.");
+}
+
+Subset::Subset(
+    const uint64_t id,
+    const uint64_t of,
+    const uint64_t depth,
+    const std::vector<uint64_t> starts)
+    : Subset(id, of)
+{
+    this->depth = depth;
+    this->starts = starts;
+
+    if (depth > heuristics::maxSubsetDepth)
+    {
+        throw std::runtime_error("Invalid subset depth");
+    }
+    if (starts.size() != of || starts.front() != 0)
+    {
+        throw std::runtime_error("Invalid subset starts");
+    }
+    for (uint64_t i(1); i < of; ++i)
+    {
+        if (starts[i] <= starts[i - 1] || starts[i] >= (1ull << (depth * 2)))
+        {
+            throw std::runtime_error("Invalid subset starts");
+        }
+    }
+}
+
+Subset::Subset(const json& j)
+    : Subset(j.at("id").get<uint64_t>(), j.at("of").get<uint64_t>())
+{
+    if (j.count("starts"))
+    {
+        *this = Subset(
+            id,
+            of,
+            j.at("depth").get<uint64_t>(),
+            j.at("starts").get<std::vector<uint64_t>>());
+    }
+}
 
-    if (std::pow(2, static_cast<uint64_t>(std::log2(of))) != of)
+Subset balance(const Subset& s, const Bounds& cube, const Manifest& manifest)
+{
+    uint64_t depth(0);
+    while ((1ull << (depth * 2)) < s.of * heuristics::subsetCells) ++depth;
+    if (depth > heuristics::maxSubsetDepth)
     {
-        throw std::runtime_error("Subset range must be a power of 2");
+        throw std::runtime_error("Too many subsets");
     }
 
-    if (std::pow(static_cast<uint64_t>(std::sqrt(of)), 2) != of)
+    // Refine the grid while any one cell holds too large a share of the
+    // points of a subset, so that dense regions may be divided finely.
+    std::vector<double> weights(getWeights(cube, depth, manifest));
+    const auto coarse = [&]()
+    {
+        double total(0);
+        for (const double w : weights) total += w;
+        const double most(*std::max_element(weights.begin(), weights.end()));
+        return most > total / s.of / heuristics::subsetCells;
+    };
+    while (depth < heuristics::maxSubsetDepth && coarse())
     {
-        throw std::runtime_error("Subset range must be a perfect square");
+        weights = getWeights(cube, ++depth, manifest);
     }
+    const uint64_t cells(weights.size());
+
+    double total(0);
+    for (const double w : weights) total += w;
+
+    // Cut the cells, in quadtree order, into runs of roughly equal weight so
+    // that each subset covers a compact region.  Every subset gets at least
+    // one cell.  Without any points, cells are split evenly.
+    std::vector<uint64_t> starts(1, 0);
+    double running(0);
+    for (uint64_t cell(0); cell < cells && starts.size() < s.of; ++cell)
+    {
+        const uint64_t next(starts.size());
+        const uint64_t remaining(s.of - next);
+        const bool full(
+            total
+                ? running >= total * next / s.of
+                : cell >= cells * next / s.of);
+
+        if (cell > starts.back() && (full || cells - cell == remaining))
+        {
+            starts.push_back(cell);
+        }
+        running += weights[cell];
+    }
+
+    return Subset(s.id, s.of, depth, starts);
 }
 
 Bounds getBounds(Bounds cube, const Subset& s)
 {
     assert(s.id);
 
+    if (isBalanced(s))
+    {
+        const uint64_t begin(s.starts[s.id - 1]);
+        const uint64_t end(
+            s.id < s.of ? s.starts[s.id] : 1ull << (s.depth * 2));
+
+        Bounds bounds(Bounds::expander());
+        for (uint64_t cell(begin); cell < end; ++cell)
+        {
+            bounds.grow(getCellBounds(cube, s.depth, cell));
+        }
+        return bounds;
+    }
+
+    if (std::pow(4, getSplits(s)) != s.of)
+    {
+        throw std::runtime_error("Subset range must be a power of 4");
+    }
+
     const uint64_t mask(0x3);
     for (std::size_t i(0); i < getSplits(s); ++i)
     {
@@ -47,6 +258,10 @@ Bounds getBounds(Bounds cube, const Subset& s)
     return cube;
 }
 
+bool contains(const Subset& s, Bounds cube, const Point& p)
+{
+    if (!isBalanced(s)) return getBounds(cube, s).contains(p);
+    return getOwner(s, getCell(cube, s.depth, p)) == s.id;
+}
 
 } // namespace entwine
-
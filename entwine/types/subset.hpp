@@ -10,12 +10,15 @@
 
 #pragma once
 
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 #include <entwine/types/bounds.hpp>
 #include <entwine/types/dir.hpp>
+#include <entwine/types/source.hpp>
 #include <entwine/util/json.hpp>
 #include <entwine/util/optional.hpp>
 
@@ -26,25 +29,52 @@ struct Subset
 {
     Subset() = default;
     Subset(uint64_t id, uint64_t of);
-    Subset(const json& j)
-        : Subset(j.at("id").get<uint64_t>(), j.at("of").get<uint64_t>())
-    { }
+    Subset(
+        uint64_t id,
+        uint64_t of,
+        uint64_t depth,
+        std::vector<uint64_t> starts);
+    Subset(const json& j);
+
     uint64_t id = 0;
     uint64_t of = 0;
+
+    // Balanced subsets partition the XY grid of cells at this depth, where
+    // each subset owns a contiguous run of cells in quadtree order beginning
+    // at its entry in starts.  Unbalanced subsets, without starts, split
+    // space evenly, which requires that "of" is a power of 4.
+    uint64_t depth = 0;
+    std::vector<uint64_t> starts;
 };
 
 inline bool isPrimary(const Subset& s) { return s.id == 1; }
+inline bool isBalanced(const Subset& s) { return !s.starts.empty(); }
 
 inline uint64_t getSplits(const Subset& s)
 {
+    if (isBalanced(s)) return s.depth;
     return std::log2(s.of) / std::log2(4);
 }
 
+// Plan a subset whose cells are balanced by the estimated point counts of the
+// manifest within this cube.  Every subset of a build must be planned from
+// the same manifest so that their plans agree.
+Subset balance(const Subset& s, const Bounds& cube, const Manifest& manifest);
+
+// Returns the bounds containing every point of this subset - for balanced
+// subsets, points within these bounds may still belong to other subsets.
 Bounds getBounds(Bounds cube, const Subset& s);
 
+// Returns true if this point belongs to this subset.
+bool contains(const Subset& s, Bounds cube, const Point& p);
+
 inline void to_json(json& j, const Subset& s)
 {
     j = { { "id", s.id }, { "of", s.of } };
+    if (isBalanced(s))
+    {
+        j.update({ { "depth", s.depth }, { "starts", s.starts } });
+    }
 }
 
 inline void from_json(const json& j, Subset& s) { s = Subset(j); }
@@ -13,10 +13,20 @@
 #include <cmath>
 
 #include <entwine/builder/heuristics.hpp>
+#include <entwine/util/container.hpp>
 
 namespace entwine
 {
 
+uint64_t getDefaultThreads()
+{
+    if (const optional<double> cpus = container::cpus())
+    {
+        return std::max<uint64_t>(std::ceil(*cpus), 1);
+    }
+    return heuristics::defaultThreads;
+}
+
 void from_json(const json& j, Threads& t)
 {
     if (j.is_array())
@@ -25,7 +35,8 @@ void from_json(const json& j, Threads& t)
         return;
     }
 
-    const uint64_t total = j.is_number() ? j.get<uint64_t>() : 8;
+    const uint64_t total =
+        j.is_number() ? j.get<uint64_t>() : getDefaultThreads();
     const uint64_t work =
         std::llround(total * heuristics::defaultWorkToClipRatio);
     assert(total >= work);
@@ -31,6 +31,11 @@ struct Threads
 };
 
 inline uint64_t getTotal(const Threads& t) { return t.work + t.clip; }
+
+// The total thread count used when none is given: the CPUs available to our
+// container, rounded up, or a fixed default if it is not limited.
+uint64_t getDefaultThreads();
+
 void from_json(const json& j, Threads& threads);
 
 } // namespace entwine
@@ -10,53 +10,93 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
 #include <stdexcept>
 #include <vector>
 
 #include <pdal/PointRef.hpp>
 #include <pdal/PointTable.hpp>
 
+#include <entwine/types/point.hpp>
+#include <entwine/util/block-pool.hpp>
+#include <entwine/util/metrics.hpp>
+
 namespace entwine
 {
 
+// A contiguous run of packed points.
+struct PointSpan
+{
+    char* data;
+    uint64_t size;
+};
+
 class MemBlock
 {
 public:
-    using Block = std::vector<char>;
+    using Block = BlockPool::Block;
 
-    MemBlock(uint64_t pointSize, uint64_t pointsPerBlock)
+    // Our blocks are attributed to this subsystem while memory is tracked.
+    MemBlock(
+            uint64_t pointSize,
+            uint64_t pointsPerBlock,
+            metrics::Memory memory = metrics::Memory::Tables)
         : m_pointSize(pointSize)
         , m_pointsPerBlock(pointsPerBlock)
         , m_bytesPerBlock(m_pointsPerBlock * m_pointSize)
+        , m_charge(memory)
     {
         m_blocks.reserve(8);
-        m_refs.reserve(m_pointsPerBlock);
     }
 
     char* next()
     {
         if (m_pos == m_end)
         {
-            m_blocks.emplace_back(Block(m_bytesPerBlock));
+            m_blocks.push_back(BlockPool::get().acquire(m_bytesPerBlock));
+            m_charge.add(m_bytesPerBlock);
             m_pos = m_blocks.back().data();
             m_end = m_pos + m_bytesPerBlock;
         }
 
         char* result(m_pos);
-        m_refs.push_back(m_pos);
         m_pos += m_pointSize;
+        ++m_size;
         return result;
     }
 
-    uint64_t size() const { return m_refs.size(); }
-    const std::vector<char*>& refs() const { return m_refs; }
+    uint64_t size() const { return m_size; }
+    uint64_t bytes() const { return m_blocks.size() * m_bytesPerBlock; }
+    uint64_t pointSize() const { return m_pointSize; }
+
+    // The points of this block in insertion order, one span per allocation.
+    std::vector<PointSpan> spans() const
+    {
+        std::vector<PointSpan> spans;
+        spans.reserve(m_blocks.size());
+
+        uint64_t remaining(m_size);
+        for (const Block& block : m_blocks)
+        {
+            const uint64_t n(std::min(remaining, m_pointsPerBlock));
+            spans.push_back({ block.data(), n });
+            remaining -= n;
+        }
+
+        return spans;
+    }
+
     void clear()
     {
         m_blocks.clear();
+        m_charge.release();
         m_pos = nullptr;
         m_end = nullptr;
-        m_refs.clear();
+        m_size = 0;
     }
 
 private:
@@ -67,35 +107,103 @@ private:
     std::vector<Block> m_blocks;
     char* m_pos = nullptr;
     char* m_end = nullptr;
+    uint64_t m_size = 0;
 
-    std::vector<char*> m_refs;
+    metrics::MemoryCharge m_charge;
 };
 
-// For writing.
+// For writing.  Points are referenced in place within the spans of their
+// MemBlocks, which must outlive this table.
 class BlockPointTable : public pdal::SimplePointTable
 {
 public:
     BlockPointTable(pdal::PointLayout& layout)
         : SimplePointTable(layout)
+        , m_pointSize(layout.pointSize())
     { }
 
-    void reserve(uint64_t size) { m_refs.reserve(size); }
     void insert(const MemBlock& m)
     {
-        m_refs.insert(m_refs.end(), m.refs().begin(), m.refs().end());
+        m_ordered.clear();
+        for (const PointSpan& span : m.spans())
+        {
+            if (!span.size) continue;
+            m_spans.push_back(span);
+            m_starts.push_back(m_size);
+            m_size += span.size;
+        }
+    }
+
+    // Reorder our points, without moving them, so that our point i is the
+    // point which was previously at order[i].
+    void reorder(const std::vector<uint32_t>& order)
+    {
+        if (order.size() != m_size)
+        {
+            throw std::runtime_error("Invalid BlockPointTable order");
+        }
+
+        std::vector<char*> points;
+        points.reserve(m_size);
+        forEach([&points](char* point) { points.push_back(point); });
+
+        m_ordered.resize(m_size);
+        for (uint64_t i(0); i < m_size; ++i) m_ordered[i] = points[order[i]];
+    }
+
+    // Visit our points in order.
+    template <typename F>
+    void forEach(F f) const
+    {
+        if (m_ordered.size())
+        {
+            for (char* point : m_ordered) f(point);
+            return;
+        }
+
+        for (const PointSpan& span : m_spans)
+        {
+            char* point(span.data);
+            for (uint64_t i(0); i < span.size; ++i, point += m_pointSize)
+            {
+                f(point);
+            }
+        }
     }
 
     virtual char* getPoint(pdal::PointId index) override
     {
-        return m_refs[index];
+        if (m_ordered.size()) return m_ordered[index];
+
+        // Access is nearly always sequential, so check the most recent span
+        // before searching for the one containing this point.
+        if (
+            m_current >= m_spans.size() ||
+            index < m_starts[m_current] ||
+            index >= m_starts[m_current] + m_spans[m_current].size)
+        {
+            const auto it(
+                std::upper_bound(m_starts.begin(), m_starts.end(), index));
+            m_current = std::distance(m_starts.begin(), it) - 1;
+        }
+
+        const PointSpan& span(m_spans[m_current]);
+        return span.data + (index - m_starts[m_current]) * m_pointSize;
     }
 
     virtual pdal::PointId addPoint() override { return m_index++; }
     virtual bool supportsView() const override { return true; }
-    uint64_t size() const { return m_refs.size(); }
+    uint64_t size() const { return m_size; }
+    uint64_t pointSize() const { return m_pointSize; }
+    const std::vector<PointSpan>& spans() const { return m_spans; }
 
 private:
-    std::vector<char*> m_refs;
+    const uint64_t m_pointSize;
+    std::vector<PointSpan> m_spans;
+    std::vector<char*> m_ordered;
+    std::vector<uint64_t> m_starts;
+    uint64_t m_size = 0;
+    std::size_t m_current = 0;
     uint64_t m_index = 0;
 };
 
@@ -109,7 +217,22 @@ public:
         : pdal::StreamPointTable(layout, np)
         , m_pointSize(layout.pointSize())
         , m_data(np * m_pointSize, 0)
-    { }
+    {
+        m_charge.add(m_data.size());
+    }
+
+    // Hold np points in this storage, whose existing capacity is reused.
+    VectorPointTable(
+            pdal::PointLayout& layout,
+            std::size_t np,
+            std::vector<char>&& storage)
+        : pdal::StreamPointTable(layout, np)
+        , m_pointSize(layout.pointSize())
+        , m_data(std::move(storage))
+    {
+        m_data.assign(np * m_pointSize, 0);
+        m_charge.add(m_data.size());
+    }
 
     VectorPointTable(pdal::PointLayout& layout, std::vector<char>&& data)
         : pdal::StreamPointTable(layout, data.size() / layout.pointSize())
@@ -121,6 +244,7 @@ public:
         {
             throw std::runtime_error("Invalid VectorPointTable data");
         }
+        m_charge.add(m_data.size());
     }
 
     pdal::PointRef at(pdal::PointId index)
@@ -143,7 +267,11 @@ public:
 
     uint64_t size() const { return data().size() / m_pointSize; }
 
-    std::vector<char>&& acquire() { return std::move(m_data); }
+    std::vector<char>&& acquire()
+    {
+        m_charge.release();
+        return std::move(m_data);
+    }
 
     void setProcess(Process f) { m_f = f; }
     void reset() override { m_f(); }
@@ -195,8 +323,81 @@ public:
     Iterator begin() { return Iterator(*this); }
     Iterator end() { return Iterator(*this, numPoints()); }
 
+    // Direct access to our current batch, for loops over every point.  These
+    // check skips with a plain branch rather than within an iterator, and
+    // read coordinates at fixed offsets rather than through PDAL's type
+    // dispatch, so our layout must store X, Y, and Z as doubles - as absolute
+    // layouts do.
+    class Batch
+    {
+    public:
+        explicit Batch(VectorPointTable& table)
+            : m_table(table)
+            , m_data(table.data().data())
+            , m_pointSize(table.pointSize())
+            , m_size(table.numPoints())
+            , m_x(offset(pdal::Dimension::Id::X))
+            , m_y(offset(pdal::Dimension::Id::Y))
+            , m_z(offset(pdal::Dimension::Id::Z))
+        { }
+
+        std::size_t size() const { return m_size; }
+        bool skip(pdal::PointId i) const { return m_table.skip(i); }
+        char* data(pdal::PointId i) const { return m_data + i * m_pointSize; }
+
+        Point point(pdal::PointId i) const
+        {
+            const char* pos(data(i));
+            Point p;
+            std::memcpy(&p.x, pos + m_x, sizeof(double));
+            std::memcpy(&p.y, pos + m_y, sizeof(double));
+            std::memcpy(&p.z, pos + m_z, sizeof(double));
+            return p;
+        }
+
+        void setPoint(pdal::PointId i, const Point& p) const
+        {
+            char* pos(data(i));
+            std::memcpy(pos + m_x, &p.x, sizeof(double));
+            std::memcpy(pos + m_y, &p.y, sizeof(double));
+            std::memcpy(pos + m_z, &p.z, sizeof(double));
+        }
+
+    private:
+        std::size_t offset(pdal::Dimension::Id id) const
+        {
+            const pdal::PointLayout& layout(*m_table.layout());
+            if (layout.dimType(id) != pdal::Dimension::Type::Double)
+            {
+                throw std::runtime_error("Batch coordinates must be doubles");
+            }
+            return layout.dimOffset(id);
+        }
+
+        VectorPointTable& m_table;
+        char* const m_data;
+        const std::size_t m_pointSize;
+        const std::size_t m_size;
+        const std::size_t m_x;
+        const std::size_t m_y;
+        const std::size_t m_z;
+    };
+
+    Batch batch() { return Batch(*this); }
+
     std::size_t pointSize() const { return m_pointSize; }
 
+    // If our layout is not known until a pipeline is prepared with this
+    // table, our buffer is allocated once it has been finalized.
+    virtual void finalize() override
+    {
+        if (layout()->finalized()) return;
+
+        pdal::StreamPointTable::finalize();
+        m_pointSize = layout()->pointSize();
+        m_data.assign(capacity() * m_pointSize, 0);
+    }
+
     // Used when wrapping this table in a pdal::PointView, which calls this
     // function to populate its indices.
     virtual pdal::PointId addPoint() override
@@ -209,9 +410,10 @@ private:
     VectorPointTable(const VectorPointTable&);
     VectorPointTable& operator=(const VectorPointTable&);
 
-    const std::size_t m_pointSize;
+    std::size_t m_pointSize;
     std::vector<char> m_data;
     std::size_t m_added = 0;
+    metrics::MemoryCharge m_charge{ metrics::Memory::Tables };
 
     Process m_f = []() { };
 };
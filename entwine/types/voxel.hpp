@@ -13,6 +13,7 @@
 #include <algorithm>
 #include <cmath>
 #include <cstddef>
+#include <cstring>
 
 #include <entwine/types/point.hpp>
 #include <entwine/types/scale-offset.hpp>
@@ -33,11 +34,9 @@ public:
         std::copy(pos, pos + size, m_data);
     }
 
-    void initShallow(const pdal::PointRef& pr, char* pos)
+    void initShallow(const Point& point, char* pos)
     {
-        m_point.x = pr.getFieldAs<double>(pdal::Dimension::Id::X);
-        m_point.y = pr.getFieldAs<double>(pdal::Dimension::Id::Y);
-        m_point.z = pr.getFieldAs<double>(pdal::Dimension::Id::Z);
+        m_point = point;
         m_data = pos;
     }
 
@@ -46,12 +45,26 @@ public:
         m_point = entwine::clip(m_point, so);
     }
 
+    // The winner of a voxel must be copied into its chunk's storage, which is
+    // serialized as a whole, and the loser out of it, since the storage of
+    // the incoming point is reused by its batch - so a swap of handles alone
+    // could not suffice.  Instead the data is swapped through a small buffer,
+    // which compiles to a few wide moves rather than a loop over bytes.
     void swapDeep(Voxel& other, uint64_t pointSize)
     {
         assert(m_data);
         assert(other.m_data);
         std::swap(m_point, other.m_point);
-        std::swap_ranges(m_data, m_data + pointSize, other.m_data);
+
+        char buffer[64];
+        for (uint64_t pos(0); pos < pointSize; pos += sizeof(buffer))
+        {
+            const std::size_t n(
+                std::min<uint64_t>(sizeof(buffer), pointSize - pos));
+            std::memcpy(buffer, m_data + pos, n);
+            std::memcpy(m_data + pos, other.m_data + pos, n);
+            std::memcpy(other.m_data + pos, buffer, n);
+        }
     }
 
 private:
@@ -0,0 +1,149 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/access-trace.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+
+namespace entwine
+{
+namespace accessTrace
+{
+
+namespace
+{
+
+const std::string magic("entwine-access-1");
+const std::size_t bufferRecords(65536);
+
+std::mutex mutex;
+std::ofstream file;
+std::vector<Record> buffer;
+
+std::atomic_uint64_t nextThreadId(0);
+
+uint16_t threadId()
+{
+    static thread_local const uint64_t id(++nextThreadId);
+    return std::min<uint64_t>(id, std::numeric_limits<uint16_t>::max());
+}
+
+void flush()
+{
+    file.write(
+        reinterpret_cast<const char*>(buffer.data()),
+        buffer.size() * sizeof(Record));
+    buffer.clear();
+}
+
+} // unnamed namespace
+
+std::string toString(const Event event)
+{
+    switch (event)
+    {
+        case Event::Hit: return "hit";
+        case Event::Create: return "create";
+        case Event::Rewake: return "rewake";
+        case Event::Reclaim: return "reclaim";
+        case Event::Clip: return "clip";
+        case Event::Evict: return "evict";
+        default: throw std::runtime_error("Invalid access trace event");
+    }
+}
+
+void start(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file.is_open()) throw std::runtime_error("Access trace already started");
+
+    file.open(
+        arbiter::expandTilde(path),
+        std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!file)
+    {
+        throw std::runtime_error("Could not open access trace file: " + path);
+    }
+
+    file.write(magic.data(), magic.size());
+    buffer.reserve(bufferRecords);
+    active() = true;
+}
+
+void stop()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open()) return;
+
+    active() = false;
+    flush();
+    file.close();
+    if (!file) throw std::runtime_error("Failed to write access trace");
+}
+
+void write(const Event event, const uint64_t depth, const Xyz& p)
+{
+    const uint64_t max(std::numeric_limits<uint32_t>::max());
+    if (depth > 32 || p.x > max || p.y > max || p.z > max) return;
+
+    Record r;
+    r.event = event;
+    r.depth = depth;
+    r.thread = threadId();
+    r.x = p.x;
+    r.y = p.y;
+    r.z = p.z;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open()) return;
+
+    buffer.push_back(r);
+    if (buffer.size() >= bufferRecords) flush();
+}
+
+std::vector<Record> read(const std::string& path)
+{
+    std::ifstream stream(
+        arbiter::expandTilde(path),
+        std::ios::binary | std::ios::ate);
+    if (!stream) throw std::runtime_error("Could not open " + path);
+
+    const uint64_t size(stream.tellg());
+    stream.seekg(0);
+
+    std::string header(magic.size(), 0);
+    stream.read(&header[0], header.size());
+    if (!stream || header != magic)
+    {
+        throw std::runtime_error("Not an access trace: " + path);
+    }
+
+    const uint64_t bytes(size - magic.size());
+    if (bytes % sizeof(Record))
+    {
+        throw std::runtime_error("Truncated access trace: " + path);
+    }
+
+    std::vector<Record> records(bytes / sizeof(Record));
+    stream.read(reinterpret_cast<char*>(records.data()), bytes);
+    if (!stream) throw std::runtime_error("Failed to read " + path);
+
+    return records;
+}
+
+} // namespace accessTrace
+} // namespace entwine
@@ -0,0 +1,89 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <entwine/types/key.hpp>
+
+namespace entwine
+{
+namespace accessTrace
+{
+
+// The chunk cache events of a build, by which alternative cache policies may
+// be evaluated without its point data.  A reference is recorded as a hit, a
+// creation, or a rewake, according to whether the chunk was resident, new, or
+// read back from its saved data.  A reclaim follows the reference of a chunk
+// which had been released but not yet evicted.
+enum class Event : uint8_t
+{
+    Hit,
+    Create,
+    Rewake,
+    Reclaim,
+    Clip,
+    Evict
+};
+
+std::string toString(Event event);
+
+// Events are written to a local binary file as a header followed by these
+// fixed-size records, in the order in which they occurred.  Positions deeper
+// than 32 bits are not representable, so their events are not recorded.
+struct Record
+{
+    Event event;
+    uint8_t depth;
+    uint16_t thread;
+    uint32_t x;
+    uint32_t y;
+    uint32_t z;
+
+    Dxyz dxyz() const { return Dxyz(depth, x, y, z); }
+};
+
+static_assert(sizeof(Record) == 16, "Unexpected access trace record size");
+
+// Begin recording events to this local path.
+void start(const std::string& path);
+
+// Flush and complete the trace file.  Later events are not recorded.
+void stop();
+
+// Read back the records of a trace file.
+std::vector<Record> read(const std::string& path);
+
+inline std::atomic_bool& active()
+{
+    static std::atomic_bool a(false);
+    return a;
+}
+
+inline bool enabled() { return active().load(std::memory_order_relaxed); }
+
+void write(Event event, uint64_t depth, const Xyz& p);
+
+inline void record(Event event, uint64_t depth, const Xyz& p)
+{
+    if (enabled()) write(event, depth, p);
+}
+
+inline void record(Event event, const Dxyz& key)
+{
+    record(event, key.depth(), key.position());
+}
+
+} // namespace accessTrace
+} // namespace entwine
@@ -0,0 +1,203 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/block-pool.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <utility>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include <entwine/builder/heuristics.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+const uint64_t hugePageSize(2 * 1024 * 1024);
+
+} // unnamed namespace
+
+// A few recently released blocks, so that a thread which frees a block and
+// then allocates another of the same size needs no synchronization.
+struct BlockPool::ThreadCache
+{
+    ~ThreadCache()
+    {
+        BlockPool& pool(BlockPool::get());
+        std::lock_guard<std::mutex> lock(pool.m_mutex);
+        for (const auto& entry : entries) pool.give(entry.first, entry.second);
+    }
+
+    std::vector<std::pair<uint64_t, Slot>> entries;
+};
+
+void BlockPool::Block::reset()
+{
+    if (m_data) BlockPool::get().release(m_data, m_size, m_slab);
+    m_data = nullptr;
+    m_size = 0;
+    m_slab = false;
+}
+
+BlockPool& BlockPool::get()
+{
+    static BlockPool pool;
+    return pool;
+}
+
+BlockPool::~BlockPool()
+{
+    for (auto& p : m_free)
+    {
+        for (const Slot& slot : p.second) if (!slot.slab) delete[] slot.data;
+    }
+    for (const auto& p : m_slabs) std::free(p.first);
+}
+
+BlockPool::ThreadCache& BlockPool::cache()
+{
+    static thread_local ThreadCache cache;
+    return cache;
+}
+
+BlockPool::Block BlockPool::acquire(const uint64_t size)
+{
+    auto& entries(cache().entries);
+    for (auto it(entries.rbegin()); it != entries.rend(); ++it)
+    {
+        if (it->first == size)
+        {
+            const Slot slot(it->second);
+            entries.erase(std::next(it).base());
+            return Block(slot.data, size, slot.slab);
+        }
+    }
+
+    Slot slot;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (take(size, slot)) return Block(slot.data, size, slot.slab);
+        if (m_hugePages) slot = carve(size);
+        else slot = Slot { nullptr, false };
+    }
+
+    if (!slot.data) slot.data = new char[size];
+    return Block(slot.data, size, slot.slab);
+}
+
+uint64_t BlockPool::pooled() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pooled;
+}
+
+void BlockPool::release(char* data, const uint64_t size, const bool slab)
+{
+    auto& entries(cache().entries);
+    if (entries.size() < heuristics::blockPoolThreadCache)
+    {
+        entries.emplace_back(size, Slot { data, slab });
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    give(size, Slot { data, slab });
+}
+
+bool BlockPool::take(const uint64_t size, Slot& slot)
+{
+    auto it(m_free.find(size));
+    if (it == m_free.end() || it->second.empty()) return false;
+
+    slot = it->second.back();
+    it->second.pop_back();
+    m_pooled -= size;
+    return true;
+}
+
+void BlockPool::give(const uint64_t size, const Slot slot)
+{
+    if (m_pooled + size > heuristics::blockPoolBytes)
+    {
+        if (slot.slab) drop(slot.data);
+        else delete[] slot.data;
+        return;
+    }
+
+    m_free[size].push_back(slot);
+    m_pooled += size;
+}
+
+void BlockPool::drop(char* data)
+{
+    // Slab blocks cannot be freed individually, so their slab is freed along
+    // with the last of them - or if it is still being carved, reused whole.
+    const auto it(std::prev(m_slabs.upper_bound(data)));
+    Slab& slab(it->second);
+    if (--slab.held) return;
+
+    if (it->first == m_current) slab.used = 0;
+    else
+    {
+        std::free(it->first);
+        m_slabs.erase(it);
+    }
+}
+
+BlockPool::Slot BlockPool::carve(const uint64_t size)
+{
+#ifdef _WIN32
+    return Slot { nullptr, false };
+#else
+    if (!m_current || m_slabs.at(m_current).used + size >
+            m_slabs.at(m_current).size)
+    {
+        const uint64_t min((size + hugePageSize - 1) / hugePageSize);
+        const uint64_t bytes(std::max<uint64_t>(
+            heuristics::hugePageSlabBytes,
+            min * hugePageSize));
+
+        void* data(nullptr);
+        if (posix_memalign(&data, hugePageSize, bytes) != 0)
+        {
+            return Slot { nullptr, false };
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(data, bytes, MADV_HUGEPAGE);
+#endif
+
+        // A previous slab, no longer carved, whose blocks were all dropped
+        // meanwhile is freed now.
+        if (m_current && !m_slabs.at(m_current).held)
+        {
+            std::free(m_current);
+            m_slabs.erase(m_current);
+        }
+
+        m_current = static_cast<char*>(data);
+        m_slabs[m_current] = Slab { bytes, 0, 0 };
+    }
+
+    Slab& slab(m_slabs.at(m_current));
+    char* data(m_current + slab.used);
+    slab.used += size;
+    ++slab.held;
+    return Slot { data, true };
+#endif
+}
+
+} // namespace entwine
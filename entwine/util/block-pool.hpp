@@ -0,0 +1,133 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace entwine
+{
+
+// A process-wide pool of fixed-size memory blocks, so the blocks freed when a
+// chunk is serialized may be reused for the next chunks rather than being
+// returned to the allocator.  Free blocks are kept in a free list per block
+// size, fronted by a small cache per thread.  Optionally, new blocks are
+// carved from slabs backed by transparent huge pages, where supported.  Slab
+// blocks count against the same pooling limit as any other, and a slab is
+// freed once every block carved from it has been dropped.
+class BlockPool
+{
+public:
+    // An owned block of memory which is returned to the pool on destruction.
+    class Block
+    {
+        friend class BlockPool;
+
+    public:
+        Block() = default;
+        ~Block() { reset(); }
+
+        Block(Block&& other) noexcept { swap(other); }
+        Block& operator=(Block&& other) noexcept
+        {
+            reset();
+            swap(other);
+            return *this;
+        }
+
+        char* data() const { return m_data; }
+        uint64_t size() const { return m_size; }
+
+        void reset();
+
+    private:
+        Block(char* data, uint64_t size, bool slab)
+            : m_data(data)
+            , m_size(size)
+            , m_slab(slab)
+        { }
+
+        void swap(Block& other)
+        {
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+            std::swap(m_slab, other.m_slab);
+        }
+
+        char* m_data = nullptr;
+        uint64_t m_size = 0;
+        bool m_slab = false;
+
+        Block(const Block&) = delete;
+        Block& operator=(const Block&) = delete;
+    };
+
+    static BlockPool& get();
+
+    ~BlockPool();
+
+    // Get a block of exactly this many bytes.  Its contents are unspecified.
+    Block acquire(uint64_t size);
+
+    // If true, subsequently allocated blocks are carved from huge-page slabs.
+    void hugePages(bool enable) { m_hugePages = enable; }
+
+    // Bytes currently held in free lists, excluding per-thread caches.
+    uint64_t pooled() const;
+
+private:
+    friend class Block;
+
+    struct Slot
+    {
+        char* data;
+        bool slab;
+    };
+
+    struct ThreadCache;
+
+    BlockPool() = default;
+
+    void release(char* data, uint64_t size, bool slab);
+
+    // These require the lock to be held.
+    bool take(uint64_t size, Slot& slot);
+    void give(uint64_t size, Slot slot);
+    Slot carve(uint64_t size);
+    void drop(char* data);
+
+    static ThreadCache& cache();
+
+    std::atomic_bool m_hugePages{ false };
+
+    mutable std::mutex m_mutex;
+    std::map<uint64_t, std::vector<Slot>> m_free;
+    uint64_t m_pooled = 0;
+
+    // Slabs by their addresses, each with the number of its blocks which are
+    // in use or pooled.  New blocks are carved from the current slab.
+    struct Slab
+    {
+        uint64_t size;
+        uint64_t used;
+        uint64_t held;
+    };
+    std::map<char*, Slab> m_slabs;
+    char* m_current = nullptr;
+
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+};
+
+} // namespace entwine
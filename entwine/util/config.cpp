@@ -17,8 +17,11 @@
 #include <entwine/builder/heuristics.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
 #include <entwine/types/exceptions.hpp>
+#include <entwine/util/container.hpp>
 #include <entwine/util/io.hpp>
 #include <entwine/util/pipeline.hpp>
+#include <entwine/util/rate-limit.hpp>
+#include <entwine/util/read-cache.hpp>
 
 namespace entwine
 {
@@ -30,7 +33,7 @@ namespace
 
 BuildParameters getBuildParameters(const json& j)
 {
-    return BuildParameters(
+    BuildParameters params(
         getMinNodeSize(j),
         getMaxNodeSize(j),
         getCacheSize(j),
@@ -38,6 +41,61 @@ BuildParameters getBuildParameters(const json& j)
         getProgressInterval(j),
         getHierarchyStep(j),
         getVerbose(j));
+    params.insertThreads = getInsertThreads(j);
+    params.splitPoints = getSplitPoints(j);
+    params.sample = getSample(j);
+    params.memory = getMemory(j);
+    params.spill = getSpill(j);
+    params.prefetch = getPrefetch(j);
+    params.rangeReads = getRangeReads(j);
+    params.compact = getCompact(j);
+    params.hugePages = getHugePages(j);
+    params.zstdLevel = getZstdLevel(j);
+    params.zstdThreads = getZstdThreads(j);
+    params.zstdDictionary = getZstdDictionary(j);
+    params.order = getOrder(j);
+    params.pointOrder = getPointOrder(j);
+    params.voxelPolicy = getVoxelPolicy(j);
+    params.dedup = getDedup(j);
+    params.maxDepth = getMaxDepth(j);
+    params.subsetDataType = getSubsetDataType(j);
+    params.overflowThreads = getOverflowThreads(j);
+    params.uploadThreads = getUploadThreads(j);
+    params.ioUring = getIoUring(j);
+    params.nodeCache = getNodeCache(j);
+    params.nodePrefetch = getNodePrefetch(j);
+    params.contentEncoding = getContentEncoding(j);
+    params.hierarchyPageSize = getHierarchyPageSize(j);
+    params.hierarchyMemory = getHierarchyMemory(j);
+    params.journal = getJournal(j);
+    params.pinnedDepth = getPinnedDepth(j);
+    params.stagingDepth = getStagingDepth(j);
+    params.metricsPath = getMetricsPath(j);
+    params.metricsPort = getMetricsPort(j);
+    params.adaptiveThreads = getAdaptiveThreads(j);
+    params.checkpointMinutes = getCheckpointMinutes(j);
+    params.checkpointFiles = getCheckpointFiles(j);
+    params.maxTime = getMaxTime(j);
+    params.previewMinutes = getPreviewMinutes(j);
+    params.previewDepth = getPreviewDepth(j);
+    params.append = getAppend(j);
+    params.numa = getNuma(j);
+    params.pack = getPack(j);
+    params.relativeXyz = getRelativeXyz(j);
+    params.lossyDepth = getLossyDepth(j);
+    params.dataTiers = getDataTiers(j);
+    params.manifestShardSize = getManifestShardSize(j);
+    params.compactManifest = getCompactManifest(j);
+    params.nodeStats = getNodeStats(j);
+    params.nodeSizes = getNodeSizes(j);
+    params.provenance = getProvenance(j);
+    params.presortDepth = getPresortDepth(j);
+    params.presortSplit = getPresortSplit(j);
+    params.bottomUp = getBottomUp(j);
+    params.checkpoint = j.value("checkpoint", 0);
+    params.tuning = j.value("tuning", json());
+    params.resources = getResources(j);
+    return params;
 }
 
 } // unnamed namespace
@@ -51,6 +109,19 @@ Endpoints getEndpoints(const json& j)
     if (!output.size()) throw ConfigurationError("Missing 'output'");
     if (!tmp.size()) throw ConfigurationError("Missing 'tmp'");
 
+    const std::string readCache = getReadCache(j);
+    if (readCache.size())
+    {
+        if (!arbiter->isLocal(readCache))
+        {
+            throw ConfigurationError("The readCache must be local");
+        }
+        setReadCache(
+            std::make_shared<ReadCache>(readCache, getReadCacheSize(j)));
+    }
+
+    setRateLimits(std::make_shared<RateLimits>(getRateLimits(j)));
+
     return Endpoints(arbiter, output, tmp);
 }
 
@@ -70,7 +141,12 @@ Metadata getMetadata(const json& j)
 
 arbiter::Arbiter getArbiter(const json& j)
 {
-    return arbiter::Arbiter(j.value("arbiter", json()).dump());
+    arbiter::Arbiter a(j.value("arbiter", json()).dump());
+    if (const auto options = getSimulation(j))
+    {
+        a.addDriver("sim", makeUnique<SimulatedDriver>(*options));
+    }
+    return a;
 }
 StringList getInput(const json& j)
 {
@@ -81,6 +157,10 @@ StringList getInput(const json& j)
     else return input.get<StringList>();
 }
 std::string getOutput(const json& j) { return j.value("output", ""); }
+StringList getSubsetOutputs(const json& j)
+{
+    return j.value("subsetOutputs", StringList());
+}
 std::string getTmp(const json& j)
 {
     return j.value("tmp", arbiter::getTempPath());
@@ -207,11 +287,15 @@ json getPipeline(const json& j)
     return pipeline;
 }
 
-unsigned getThreads(const json& j) { return j.value("threads", 8); }
+unsigned getThreads(const json& j)
+{
+    return j.value("threads", getDefaultThreads());
+}
 Threads getCompoundThreads(const json& j)
 {
     return Threads(j.value("threads", json()));
 }
+unsigned getIoThreads(const json& j) { return j.value("ioThreads", 0); }
 Version getEptVersion(const json& j)
 {
     if (!j.count("version")) return currentEptVersion();
@@ -222,7 +306,11 @@ bool getVerbose(const json& j) { return j.value("verbose", true); }
 bool getDeep(const json& j) { return j.value("deep", false); }
 bool getStats(const json& j) { return j.value("stats", true); }
 bool getForce(const json& j) { return j.value("force", false); }
+bool getClean(const json& j) { return j.value("clean", false); }
+bool getEstimate(const json& j) { return j.value("estimate", false); }
 bool getAbsolute(const json& j) { return j.value("absolute", false); }
+bool getAllowOriginId(const json& j) { return j.value("allowOriginId", true); }
+bool getAllowPointId(const json& j) { return j.value("allowPointId", true); }
 
 uint64_t getSpan(const json& j)
 {
@@ -238,6 +326,67 @@ uint64_t getMaxNodeSize(const json& j)
     const auto span = getSpan(j);
     return j.value("maxNodeSize", span * span * 4);
 }
+bool getAutoTune(const json& j)
+{
+    return j.value("autoTune", false);
+}
+
+json tune(const json& j, const Manifest& manifest)
+{
+    uint64_t points(0);
+    double area(0);
+    for (const BuildItem& item : manifest)
+    {
+        const SourceInfo& info(item.source.info);
+        if (!info.points) continue;
+        points += info.points;
+        area += info.bounds.width() * info.bounds.depth();
+    }
+
+    // Overlapping sources overstate our footprint, which is at most that of
+    // our conforming bounds.
+    const Bounds conforming(getBoundsConforming(j));
+    area = std::min(area, conforming.width() * conforming.depth());
+    if (!points || area <= 0) return json();
+
+    // The number of point spacings across our cube, which a node at depth d
+    // spans with span * 2^d voxels - so the depth at which voxels reach our
+    // point spacing is that of the leaves of a surface.
+    const double density(points / area);
+    const double spacing(1.0 / std::sqrt(density));
+    const double columns(getBounds(j).width() / spacing);
+
+    // A node over a surface holds up to span^2 points.
+    uint64_t span(1);
+    while (span * span < heuristics::tuneNodePoints) span *= 2;
+
+    const auto depthFor = [columns](uint64_t span)
+    {
+        return static_cast<uint64_t>(
+            std::max(0.0, std::ceil(std::log2(columns / span))));
+    };
+
+    // Dense data is given a wider span, rather than an excessively deep tree,
+    // and sparse data a narrower one, so that its shallowest nodes are not
+    // nearly empty.
+    while (depthFor(span) > heuristics::tuneMaxDepth) span *= 2;
+    while (span / 2 >= heuristics::tuneMinSpan && span / 2 >= columns)
+    {
+        span /= 2;
+    }
+
+    return {
+        { "points", points },
+        { "area", area },
+        { "density", density },
+        { "spacing", spacing },
+        { "depth", depthFor(span) },
+        { "span", span },
+        { "minNodeSize", span * span },
+        { "maxNodeSize", span * span * 4 }
+    };
+}
+
 uint64_t getCacheSize(const json& j)
 {
     return j.value("cacheSize", heuristics::cacheSize);
@@ -258,6 +407,469 @@ uint64_t getHierarchyStep(const json& j)
 {
     return j.value("hierarchyStep", 0);
 }
+uint64_t getInsertThreads(const json& j)
+{
+    return j.value("insertThreads", 0);
+}
+
+uint64_t getSplitPoints(const json& j)
+{
+    return j.value("splitPoints", 0);
+}
+
+double getSample(const json& j)
+{
+    const double sample = j.value("sample", 0.0);
+    if (sample < 0 || sample > 1)
+    {
+        throw ConfigurationError("Invalid sample: " + std::to_string(sample));
+    }
+    return sample < 1 ? sample : 0;
+}
+
+uint64_t getMemory(const json& j)
+{
+    if (j.count("memory")) return j.at("memory").get<uint64_t>();
+    if (const optional<uint64_t> limit = container::memory())
+    {
+        return *limit * heuristics::containerMemoryRatio;
+    }
+    return 0;
+}
+
+json getResources(const json& j)
+{
+    const Threads threads(getCompoundThreads(j));
+    json resources = {
+        { "threads", { threads.work, threads.clip } },
+        { "memory", getMemory(j) }
+    };
+
+    json limits = json::object();
+    if (const optional<double> cpus = container::cpus())
+    {
+        limits["cpus"] = *cpus;
+    }
+    if (const optional<uint64_t> memory = container::memory())
+    {
+        limits["memory"] = *memory;
+    }
+    if (limits.size()) resources["container"] = limits;
+    return resources;
+}
+
+bool getSpill(const json& j)
+{
+    return j.value("spill", false);
+}
+
+uint64_t getPrefetch(const json& j)
+{
+    return j.value("prefetch", 0);
+}
+
+bool getRangeReads(const json& j)
+{
+    return j.value("rangeReads", false);
+}
+
+bool getCompact(const json& j)
+{
+    return j.value("compact", false);
+}
+
+bool getHugePages(const json& j)
+{
+    return j.value("hugePages", false);
+}
+
+int getZstdLevel(const json& j)
+{
+    return j.value("zstdLevel", 3);
+}
+
+uint64_t getZstdThreads(const json& j)
+{
+    return j.value("zstdThreads", 0);
+}
+
+uint64_t getZstdDictionary(const json& j)
+{
+    return j.value("zstdDictionary", 0);
+}
+
+std::string getOrder(const json& j)
+{
+    const std::string order = j.value("order", "manifest");
+    if (order != "manifest" && order != "spatial" && order != "largest")
+    {
+        throw ConfigurationError("Invalid order: " + order);
+    }
+    return order;
+}
+
+std::string getPointOrder(const json& j)
+{
+    const std::string order = j.value("pointOrder", "");
+    if (
+        order.size() &&
+        order != "morton" &&
+        order != "progressive" &&
+        order != "gpstime")
+    {
+        throw ConfigurationError("Invalid pointOrder: " + order);
+    }
+    return order;
+}
+
+std::string getVoxelPolicy(const json& j)
+{
+    const std::string policy = j.value("voxelPolicy", "closest");
+    if (
+        policy != "closest" &&
+        policy != "first" &&
+        policy != "maxz" &&
+        policy != "minz" &&
+        policy != "random")
+    {
+        throw ConfigurationError("Invalid voxelPolicy: " + policy);
+    }
+    return policy;
+}
+
+bool getDedup(const json& j)
+{
+    return j.value("dedup", false);
+}
+
+uint64_t getMaxDepth(const json& j)
+{
+    if (j.count("maxDepth"))
+    {
+        const uint64_t depth(j.at("maxDepth").get<uint64_t>());
+        if (!depth) throw ConfigurationError("Invalid maxDepth: 0");
+        return depth;
+    }
+
+    const double size(j.value("minVoxelSize", 0.0));
+    if (size < 0) throw ConfigurationError("Invalid minVoxelSize");
+    if (!size || !j.count("bounds")) return 0;
+
+    // The depth beneath the deepest whose voxels are at least this size.
+    const double root(getBounds(j).width() / getSpan(j));
+    if (root <= size) return 1;
+    return std::floor(std::log2(root / size)) + 1;
+}
+
+DataTiers getDataTiers(const json& j)
+{
+    DataTiers tiers = j.value("dataTiers", DataTiers());
+    for (const DataTier& tier : tiers) io::toType(tier.dataType);
+    std::stable_sort(
+        tiers.begin(),
+        tiers.end(),
+        [](const DataTier& a, const DataTier& b) { return a.below < b.below; });
+    return tiers;
+}
+
+std::string getSubsetDataType(const json& j)
+{
+    const std::string type(j.value("subsetDataType", ""));
+    if (type.size()) io::toType(type);
+    return type;
+}
+
+uint64_t getOverflowThreads(const json& j)
+{
+    return j.value("overflowThreads", 0);
+}
+
+uint64_t getUploadThreads(const json& j)
+{
+    return j.value("uploadThreads", 0);
+}
+
+bool getIoUring(const json& j)
+{
+    return j.value("ioUring", false);
+}
+
+uint64_t getNodeCache(const json& j)
+{
+    return j.value("nodeCache", 0);
+}
+
+uint64_t getNodePrefetch(const json& j)
+{
+    return j.value("nodePrefetch", 0);
+}
+
+std::string getContentEncoding(const json& j)
+{
+    const std::string encoding = j.value("contentEncoding", "");
+    if (encoding.size() && encoding != "gzip")
+    {
+        throw ConfigurationError("Invalid contentEncoding: " + encoding);
+    }
+#ifndef ENTWINE_ZLIB
+    if (encoding.size())
+    {
+        throw ConfigurationError("contentEncoding requires zlib support");
+    }
+#endif
+    return encoding;
+}
+
+uint64_t getHierarchyPageSize(const json& j)
+{
+    return j.value("hierarchyPageSize", 0);
+}
+
+uint64_t getHierarchyMemory(const json& j)
+{
+    return j.value("hierarchyMemory", 0);
+}
+
+bool getJournal(const json& j)
+{
+    return j.value("journal", false);
+}
+
+uint64_t getPinnedDepth(const json& j)
+{
+    return j.value("pinnedDepth", 0);
+}
+
+uint64_t getStagingDepth(const json& j)
+{
+    return j.value("stagingDepth", 0);
+}
+
+std::string getMetricsPath(const json& j)
+{
+    return j.value("metricsPath", "");
+}
+
+uint64_t getMetricsPort(const json& j)
+{
+    return j.value("metricsPort", 0);
+}
+
+bool getAdaptiveThreads(const json& j)
+{
+    return j.value("adaptiveThreads", false);
+}
+
+uint64_t getCheckpointMinutes(const json& j)
+{
+    return j.value("checkpointMinutes", 0);
+}
+
+uint64_t getCheckpointFiles(const json& j)
+{
+    return j.value("checkpointFiles", 0);
+}
+
+uint64_t getMaxTime(const json& j)
+{
+    return j.value("maxTime", 0);
+}
+
+uint64_t getPreviewMinutes(const json& j)
+{
+    return j.value("previewMinutes", 0);
+}
+
+uint64_t getPreviewDepth(const json& j)
+{
+    return j.value("previewDepth", heuristics::previewDepth);
+}
+
+bool getAppend(const json& j)
+{
+    return j.value("append", false);
+}
+
+bool getNuma(const json& j)
+{
+    return j.value("numa", false);
+}
+
+bool getPack(const json& j)
+{
+    return j.value("pack", false);
+}
+
+bool getRelativeXyz(const json& j)
+{
+    return j.value("relativeXyz", false);
+}
+
+uint64_t getLossyDepth(const json& j)
+{
+    return j.value("lossyDepth", 0);
+}
+
+uint64_t getManifestShardSize(const json& j)
+{
+    return j.value("manifestShardSize", 0);
+}
+
+bool getCompactManifest(const json& j)
+{
+    return j.value("compactManifest", false);
+}
+
+bool getNodeStats(const json& j)
+{
+    return j.value("nodeStats", false);
+}
+
+bool getNodeSizes(const json& j)
+{
+    return j.value("nodeSizes", false);
+}
+
+bool getProvenance(const json& j)
+{
+    return j.value("provenance", false);
+}
+
+uint64_t getPresortDepth(const json& j)
+{
+    const uint64_t depth = j.value("presortDepth", 0);
+    if (depth > heuristics::maxPresortDepth)
+    {
+        throw std::runtime_error(
+            "Presort depth may be at most " +
+            std::to_string(heuristics::maxPresortDepth));
+    }
+    return depth;
+}
+
+bool getPresortSplit(const json& j)
+{
+    const bool split(j.value("presortSplit", false));
+    if (split && !getPresortDepth(j))
+    {
+        throw std::runtime_error(
+            "Cannot use presortSplit without presortDepth");
+    }
+    return split;
+}
+
+bool getBottomUp(const json& j)
+{
+    const bool bottomUp(j.value("bottomUp", false));
+    if (bottomUp && !getPresortDepth(j))
+    {
+        throw std::runtime_error("Cannot use bottomUp without presortDepth");
+    }
+    return bottomUp;
+}
+
+uint64_t getCoordinate(const json& j)
+{
+    return j.value("coordinate", 0);
+}
+
+bool getIncremental(const json& j)
+{
+    return j.value("incremental", false);
+}
+
+std::vector<uint64_t> getSubsets(const json& j)
+{
+    return j.value("subsets", std::vector<uint64_t>());
+}
+
+std::string getScanCache(const json& j)
+{
+    return j.value("scanCache", "");
+}
+
+std::string getListingCache(const json& j)
+{
+    return j.value("listingCache", "");
+}
+
+std::string getReadCache(const json& j)
+{
+    return j.value("readCache", "");
+}
+
+uint64_t getReadCacheSize(const json& j)
+{
+    return j.value("readCacheSize", heuristics::readCacheBytes);
+}
+
+optional<SimulatedDriver::Options> getSimulation(const json& j)
+{
+    if (!j.count("simulate")) return { };
+
+    const json& s(j.at("simulate"));
+    SimulatedDriver::Options options;
+    options.latency = s.value("latency", 0.0) / 1000.0;
+    options.bandwidth = s.value("bandwidth", 0.0) * 1000000.0;
+    options.failureRate = s.value("failureRate", 0.0);
+    options.seed = s.value<uint64_t>("seed", 0);
+
+    if (options.latency < 0 || options.bandwidth < 0)
+    {
+        throw ConfigurationError(
+            "Simulated latency and bandwidth may not be negative");
+    }
+    if (options.failureRate < 0 || options.failureRate >= 1)
+    {
+        throw ConfigurationError(
+            "Simulated failureRate must be at least 0 and less than 1");
+    }
+    return options;
+}
+
+RateLimits getRateLimits(const json& j)
+{
+    const json r(j.value("rateLimit", json::object()));
+    RateLimits limits;
+    limits.requests = r.value("requests", 0.0);
+    limits.bytes = r.value("bandwidth", 0.0) * 1000000.0;
+    limits.priority = r.value("priority", 1.0);
+
+    if (limits.requests < 0 || limits.bytes < 0)
+    {
+        throw ConfigurationError("Rate limits may not be negative");
+    }
+    if (limits.priority <= 0)
+    {
+        throw ConfigurationError("Rate limit priority must be positive");
+    }
+    return limits;
+}
+
+std::string getTrace(const json& j)
+{
+    return j.value("trace", "");
+}
+
+std::string getAccessTrace(const json& j)
+{
+    return j.value("accessTrace", "");
+}
+
+std::string getTuningProfile(const json& j)
+{
+    return j.value("tuningProfile", "");
+}
+
+bool getTrackMemory(const json& j)
+{
+    return j.value("trackMemory", false);
+}
+
+bool getPerfCounters(const json& j)
+{
+    return j.value("perfCounters", false);
+}
 
 } // namespace config
 } // namespace entwine
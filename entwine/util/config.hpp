@@ -31,6 +31,8 @@
 #include <entwine/types/version.hpp>
 #include <entwine/util/json.hpp>
 #include <entwine/util/optional.hpp>
+#include <entwine/util/rate-limit.hpp>
+#include <entwine/util/simulated.hpp>
 #include <entwine/util/unique.hpp>
 
 namespace entwine
@@ -43,6 +45,7 @@ Metadata getMetadata(const json& j);
 
 arbiter::Arbiter getArbiter(const json& j);
 StringList getInput(const json& j);
+StringList getSubsetOutputs(const json& j);
 std::string getOutput(const json& j);
 std::string getTmp(const json& j);
 
@@ -60,22 +63,105 @@ json getPipeline(const json& j);
 
 unsigned getThreads(const json& j);
 Threads getCompoundThreads(const json& j);
+unsigned getIoThreads(const json& j);
 Version getEptVersion(const json& j);
 
 bool getVerbose(const json& j);
 bool getDeep(const json& j);
 bool getStats(const json& j);
 bool getForce(const json& j);
+bool getClean(const json& j);
+bool getEstimate(const json& j);
 bool getAbsolute(const json& j);
+bool getAllowOriginId(const json& j);
+bool getAllowPointId(const json& j);
 
 uint64_t getSpan(const json& j);
 uint64_t getMinNodeSize(const json& j);
 uint64_t getMaxNodeSize(const json& j);
+
+// If set, a new build chooses those of its span and node sizes which are not
+// given explicitly by tune().
+bool getAutoTune(const json& j);
+
+// Choose a span and node sizes for a build of this manifest from the point
+// density of its sources, returning them along with the figures from which
+// they were chosen, or null if there are no points to judge by.
+json tune(const json& j, const Manifest& manifest);
 uint64_t getCacheSize(const json& j);
 uint64_t getSleepCount(const json& j);
 uint64_t getProgressInterval(const json& j);
 uint64_t getLimit(const json& j);
 uint64_t getHierarchyStep(const json& j);
+uint64_t getInsertThreads(const json& j);
+uint64_t getSplitPoints(const json& j);
+double getSample(const json& j);
+uint64_t getMemory(const json& j);
+
+// The threads and memory budget chosen for a build, along with the limits of
+// our container from which they were derived by default, if it has any.
+json getResources(const json& j);
+bool getSpill(const json& j);
+uint64_t getPrefetch(const json& j);
+bool getRangeReads(const json& j);
+bool getCompact(const json& j);
+bool getHugePages(const json& j);
+int getZstdLevel(const json& j);
+uint64_t getZstdThreads(const json& j);
+uint64_t getZstdDictionary(const json& j);
+std::string getOrder(const json& j);
+std::string getPointOrder(const json& j);
+std::string getVoxelPolicy(const json& j);
+bool getDedup(const json& j);
+uint64_t getMaxDepth(const json& j);
+std::string getSubsetDataType(const json& j);
+DataTiers getDataTiers(const json& j);
+uint64_t getOverflowThreads(const json& j);
+uint64_t getUploadThreads(const json& j);
+bool getIoUring(const json& j);
+uint64_t getNodeCache(const json& j);
+uint64_t getNodePrefetch(const json& j);
+std::string getContentEncoding(const json& j);
+uint64_t getHierarchyPageSize(const json& j);
+uint64_t getHierarchyMemory(const json& j);
+bool getJournal(const json& j);
+uint64_t getPinnedDepth(const json& j);
+uint64_t getStagingDepth(const json& j);
+std::string getMetricsPath(const json& j);
+uint64_t getMetricsPort(const json& j);
+bool getAdaptiveThreads(const json& j);
+uint64_t getCheckpointMinutes(const json& j);
+uint64_t getCheckpointFiles(const json& j);
+uint64_t getMaxTime(const json& j);
+uint64_t getPreviewMinutes(const json& j);
+uint64_t getPreviewDepth(const json& j);
+bool getAppend(const json& j);
+bool getNuma(const json& j);
+bool getPack(const json& j);
+bool getRelativeXyz(const json& j);
+uint64_t getLossyDepth(const json& j);
+uint64_t getManifestShardSize(const json& j);
+bool getCompactManifest(const json& j);
+bool getNodeStats(const json& j);
+bool getNodeSizes(const json& j);
+bool getProvenance(const json& j);
+uint64_t getPresortDepth(const json& j);
+bool getPresortSplit(const json& j);
+bool getBottomUp(const json& j);
+uint64_t getCoordinate(const json& j);
+bool getIncremental(const json& j);
+std::vector<uint64_t> getSubsets(const json& j);
+std::string getScanCache(const json& j);
+std::string getListingCache(const json& j);
+std::string getReadCache(const json& j);
+uint64_t getReadCacheSize(const json& j);
+optional<SimulatedDriver::Options> getSimulation(const json& j);
+RateLimits getRateLimits(const json& j);
+std::string getTrace(const json& j);
+std::string getAccessTrace(const json& j);
+std::string getTuningProfile(const json& j);
+bool getTrackMemory(const json& j);
+bool getPerfCounters(const json& j);
 
 } // namespace config
 } // namespace entwine
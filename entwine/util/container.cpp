@@ -0,0 +1,175 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/container.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace entwine
+{
+namespace container
+{
+
+namespace
+{
+
+// Limits at least this large are how cgroup v1 spells "unlimited".
+constexpr uint64_t unlimited = 1ull << 60;
+
+// The first line of this file, or an empty string if it cannot be read.
+std::string read(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+// The cgroup path of this process for this controller, from /proc/self/cgroup,
+// whose lines are "<id>:<controllers>:<path>".  The unified hierarchy of
+// cgroup v2 has no controllers.
+std::string path(const std::string& controller)
+{
+    std::ifstream file("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(file, line))
+    {
+        const std::size_t a(line.find(':'));
+        const std::size_t b(line.find(':', a + 1));
+        if (a == std::string::npos || b == std::string::npos) continue;
+
+        const std::string controllers(line.substr(a + 1, b - a - 1));
+        bool found(controllers == controller);
+
+        std::istringstream ss(controllers);
+        std::string c;
+        while (std::getline(ss, c, ',')) found = found || c == controller;
+        if (found) return line.substr(b + 1);
+    }
+    return "";
+}
+
+// The candidate locations of this file of our cgroup for this controller,
+// whose hierarchy is mounted at this directory beneath /sys/fs/cgroup.  Within
+// a container, our own cgroup is usually mounted at the root, so that is tried
+// as well.
+std::vector<std::string> candidates(
+    const std::string& controller,
+    const std::string& dir,
+    const std::string& file)
+{
+    const std::string own(path(controller));
+    const std::string base("/sys/fs/cgroup/" + (dir.empty() ? "" : dir + "/"));
+
+    std::vector<std::string> list;
+    if (own.size() && own != "/") list.push_back(base + own + "/" + file);
+    list.push_back(base + file);
+    return list;
+}
+
+optional<double> quota()
+{
+    // Version 2: "<quota> <period>", where the quota may be "max".
+    for (const std::string& p : candidates("", "", "cpu.max"))
+    {
+        std::istringstream ss(read(p));
+        std::string q;
+        double period(0);
+        if (!(ss >> q >> period)) continue;
+        if (q == "max" || period <= 0) return { };
+        return std::stod(q) / period;
+    }
+
+    // Version 1, where a quota of -1 is unlimited.
+    for (const std::string dir : { "cpu,cpuacct", "cpu" })
+    {
+        const auto q(candidates("cpu", dir, "cpu.cfs_quota_us"));
+        const auto p(candidates("cpu", dir, "cpu.cfs_period_us"));
+        for (std::size_t i(0); i < q.size(); ++i)
+        {
+            const std::string qs(read(q[i])), ps(read(p[i]));
+            if (qs.empty() || ps.empty()) continue;
+            const double quota(std::stod(qs)), period(std::stod(ps));
+            if (quota <= 0 || period <= 0) return { };
+            return quota / period;
+        }
+    }
+
+    return { };
+}
+
+optional<double> affinity()
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set)) return { };
+    const unsigned count(CPU_COUNT(&set));
+    if (count && count < std::thread::hardware_concurrency()) return count;
+#endif
+    return { };
+}
+
+} // unnamed namespace
+
+optional<double> cpus()
+{
+#ifdef __linux__
+    try
+    {
+        const optional<double> q(quota());
+        const optional<double> a(affinity());
+        if (q && a) return std::min(*q, *a);
+        if (q) return q;
+        return a;
+    }
+    catch (...) { }
+#endif
+    return { };
+}
+
+optional<uint64_t> memory()
+{
+#ifdef __linux__
+    try
+    {
+        std::vector<std::string> paths(candidates("", "", "memory.max"));
+        for (const std::string& p :
+            candidates("memory", "memory", "memory.limit_in_bytes"))
+        {
+            paths.push_back(p);
+        }
+
+        for (const std::string& p : paths)
+        {
+            const std::string s(read(p));
+            if (s.empty()) continue;
+            if (s == "max") return { };
+            const uint64_t limit(std::stoull(s));
+            if (!limit || limit >= unlimited) return { };
+            return limit;
+        }
+    }
+    catch (...) { }
+#endif
+    return { };
+}
+
+} // namespace container
+} // namespace entwine
@@ -0,0 +1,33 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+
+#include <entwine/util/optional.hpp>
+
+namespace entwine
+{
+namespace container
+{
+
+// The number of CPUs available to this process: the CPU quota of its cgroup,
+// from cpu.max for cgroup v2 or cpu.cfs_quota_us for v1, or the size of its
+// CPU affinity mask if that is smaller than the machine.  Quotas may be
+// fractional.  Empty if neither limits us.
+optional<double> cpus();
+
+// The memory limit in bytes of the cgroup of this process, from memory.max for
+// cgroup v2 or memory.limit_in_bytes for v1.  Empty if it is unlimited.
+optional<uint64_t> memory();
+
+} // namespace container
+} // namespace entwine
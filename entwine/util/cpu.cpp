@@ -0,0 +1,122 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/cpu.hpp>
+
+#include <stdexcept>
+
+#if defined(__linux__) && defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+#include <entwine/util/env.hpp>
+
+namespace entwine
+{
+namespace cpu
+{
+
+namespace
+{
+
+bool detect(const Isa isa)
+{
+    switch (isa)
+    {
+        case Isa::Scalar: return true;
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+        // These account for whether the OS preserves the wider registers.
+        case Isa::Avx2: return __builtin_cpu_supports("avx2");
+        case Isa::Avx512:
+            return __builtin_cpu_supports("avx512f") &&
+                __builtin_cpu_supports("avx512dq");
+#endif
+#if defined(__aarch64__)
+        case Isa::Neon:
+#if defined(__linux__)
+            return getauxval(AT_HWCAP) & HWCAP_ASIMD;
+#else
+            return true;
+#endif
+#endif
+        default: return false;
+    }
+}
+
+Isa detectBest()
+{
+    Isa result(Isa::Scalar);
+    for (const Isa isa : { Isa::Avx2, Isa::Avx512, Isa::Neon })
+    {
+        if (detect(isa)) result = isa;
+    }
+    return result;
+}
+
+// The instruction set to which we are limited, if any.
+Isa ceiling()
+{
+    const auto s(env("ENTWINE_ISA"));
+    return s && s->size() ? toIsa(*s) : detectBest();
+}
+
+} // unnamed namespace
+
+std::string toString(const Isa isa)
+{
+    switch (isa)
+    {
+        case Isa::Scalar: return "scalar";
+        case Isa::Avx2: return "avx2";
+        case Isa::Avx512: return "avx512";
+        case Isa::Neon: return "neon";
+        default: throw std::runtime_error("Invalid instruction set");
+    }
+}
+
+Isa toIsa(const std::string& s)
+{
+    if (s == "scalar") return Isa::Scalar;
+    if (s == "avx2") return Isa::Avx2;
+    if (s == "avx512") return Isa::Avx512;
+    if (s == "neon") return Isa::Neon;
+    throw std::runtime_error("Invalid instruction set: " + s);
+}
+
+bool supports(const Isa isa)
+{
+    static const bool avx2(detect(Isa::Avx2));
+    static const bool avx512(detect(Isa::Avx512));
+    static const bool neon(detect(Isa::Neon));
+    static const Isa limit(ceiling());
+
+    switch (isa)
+    {
+        case Isa::Scalar: return true;
+        case Isa::Avx2:
+            return avx2 && (limit == Isa::Avx2 || limit == Isa::Avx512);
+        case Isa::Avx512: return avx512 && limit == Isa::Avx512;
+        case Isa::Neon: return neon && limit == Isa::Neon;
+        default: return false;
+    }
+}
+
+Isa best()
+{
+    for (const Isa isa : { Isa::Avx512, Isa::Avx2, Isa::Neon })
+    {
+        if (supports(isa)) return isa;
+    }
+    return Isa::Scalar;
+}
+
+} // namespace cpu
+} // namespace entwine
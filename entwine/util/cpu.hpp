@@ -0,0 +1,59 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <string>
+
+namespace entwine
+{
+namespace cpu
+{
+
+// Instruction sets for which kernels may be specialized, in increasing order
+// of preference within each architecture.
+enum class Isa { Scalar, Avx2, Avx512, Neon };
+
+std::string toString(Isa isa);
+Isa toIsa(const std::string& s);
+
+// Whether this host, and our build, support kernels for this instruction set.
+// This is detected once, from CPUID on x86 and from HWCAP on ARM.  Support may
+// be removed, but never added, by setting ENTWINE_ISA to a lesser instruction
+// set, for instance to "scalar", so that the scalar reference kernels may be
+// exercised, and compared against the others, on any host.
+bool supports(Isa isa);
+
+// The most preferred instruction set which we support.
+Isa best();
+
+// The implementations of one kernel, each of which must produce identical
+// results.  Specializations are null if absent, or if our build cannot compile
+// them, and the scalar implementation is required.  Callers typically hold the
+// selection in a function-local static, so it is made once.
+template <typename F>
+struct Kernel
+{
+    F scalar = nullptr;
+    F avx2 = nullptr;
+    F avx512 = nullptr;
+    F neon = nullptr;
+
+    F select() const
+    {
+        if (avx512 && supports(Isa::Avx512)) return avx512;
+        if (avx2 && supports(Isa::Avx2)) return avx2;
+        if (neon && supports(Isa::Neon)) return neon;
+        return scalar;
+    }
+};
+
+} // namespace cpu
+} // namespace entwine
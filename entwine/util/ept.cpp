@@ -0,0 +1,245 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/ept.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+namespace ept
+{
+
+namespace
+{
+
+Dxyz getAncestor(const Dxyz& key, const uint64_t depth)
+{
+    const uint64_t shift = key.d - depth;
+    return Dxyz(depth, key.x >> shift, key.y >> shift, key.z >> shift);
+}
+
+int getDir(const Dxyz& key, const uint64_t shift)
+{
+    return ((key.x >> shift) & 1) |
+        (((key.y >> shift) & 1) << 1) |
+        (((key.z >> shift) & 1) << 2);
+}
+
+// Whether a precedes b in a depth-first traversal of the tree which visits
+// children in the order of their Dir.
+bool precedes(const Dxyz& a, const Dxyz& b)
+{
+    const uint64_t depth(std::min(a.d, b.d));
+    const Dxyz pa(getAncestor(a, depth));
+    const Dxyz pb(getAncestor(b, depth));
+    if (pa == pb) return a.d < b.d;
+
+    for (uint64_t shift(depth); shift-- > 0; )
+    {
+        const int da(getDir(pa, shift));
+        const int db(getDir(pb, shift));
+        if (da != db) return da < db;
+    }
+    return false;
+}
+
+Endpoints getEndpoints(
+    std::shared_ptr<arbiter::Arbiter> a,
+    const std::string& path,
+    const std::string& tmp)
+{
+    return Endpoints(a, arbiter::getDirname(path), tmp);
+}
+
+} // unnamed namespace
+
+bool isDataset(const std::string& path)
+{
+    return arbiter::getBasename(path) == "ept.json";
+}
+
+SourceInfo getInfo(
+    const std::string& path,
+    const json& pipelineTemplate,
+    const arbiter::Arbiter& a)
+{
+    SourceInfo info;
+    try
+    {
+        const json j(json::parse(a.get(path)));
+
+        json pipeline = pipelineTemplate.is_null()
+            ? json::array({ json::object() })
+            : pipelineTemplate;
+        pipeline.at(0)["type"] = "readers.ept";
+        pipeline.at(0)["filename"] = path;
+
+        info.pipeline = pipeline;
+        info.points = j.at("points").get<uint64_t>();
+        info.bounds = j.at("boundsConforming").get<Bounds>();
+        info.schema = j.at("schema").get<Schema>();
+        if (j.count("srs")) info.srs = j.at("srs").get<Srs>();
+    }
+    catch (const std::exception& e)
+    {
+        info.errors.push_back(std::string("Failed to analyze: ") + e.what());
+    }
+    return info;
+}
+
+bool isNativeCandidate(const json& pipeline)
+{
+    if (!pipeline.is_array() || pipeline.size() != 1) return false;
+
+    const json& reader(pipeline.at(0));
+    if (
+        reader.value("type", "readers.ept") != "readers.ept" ||
+        !isDataset(reader.value("filename", "")))
+    {
+        return false;
+    }
+
+    for (const auto& p : reader.items())
+    {
+        if (p.key() != "type" && p.key() != "filename") return false;
+    }
+    return true;
+}
+
+Decoder::Decoder(
+    std::shared_ptr<arbiter::Arbiter> a,
+    const std::string& path,
+    const std::string& tmp,
+    const pdal::PointLayout& layout,
+    const uint64_t threads,
+    const optional<Bounds> bounds)
+    : m_reader(getEndpoints(a, path, tmp), threads)
+    , m_nodes(m_reader.threads() * heuristics::eptNodesPerThread)
+{
+    // Each dimension of our layout which the dataset has is read in the type
+    // of our layout, and copied into place.
+    const Schema& absolute(m_reader.metadata().absoluteSchema);
+    for (const DimId id : layout.dims())
+    {
+        const std::string name(layout.dimName(id));
+        if (!contains(absolute, name)) continue;
+
+        Field field;
+        field.src = m_recordSize;
+        field.dst = layout.dimOffset(id);
+        field.size = layout.dimSize(id);
+        m_fields.push_back(field);
+
+        m_schema.emplace_back(name, layout.dimType(id));
+        m_recordSize += field.size;
+    }
+    if (!m_recordSize)
+    {
+        throw std::runtime_error("No dimensions in common with: " + path);
+    }
+
+    Query query;
+    query.bounds = bounds;
+    for (const Reader::Node& node : m_reader.nodes(query))
+    {
+        if (node.points) m_keys.push_back(node.key);
+    }
+    std::sort(m_keys.begin(), m_keys.end(), precedes);
+
+    // Each thread takes the next node in order, so nodes arrive in about that
+    // order, and the last to finish ends our queue.
+    const uint64_t n(m_reader.threads());
+    m_pool = makeUnique<Pool>(n);
+    for (uint64_t t(0); t < n; ++t)
+    {
+        m_pool->add([this, n, bounds]()
+        {
+            try
+            {
+                uint64_t i(0);
+                while ((i = m_index++) < m_keys.size())
+                {
+                    std::vector<char> data(
+                        m_reader.read(m_keys[i], m_schema, bounds));
+                    if (data.size() && !m_nodes.push(std::move(data))) break;
+                }
+            }
+            catch (...)
+            {
+                m_nodes.close();
+                throw;
+            }
+            if (++m_done == n) m_nodes.close();
+        });
+    }
+}
+
+Decoder::~Decoder()
+{
+    m_nodes.close();
+    m_pool->join();
+}
+
+bool Decoder::next()
+{
+    while (m_pos == m_node.size())
+    {
+        if (!m_nodes.pop(m_node))
+        {
+            m_pool->join();
+            if (m_pool->errors().size())
+            {
+                throw std::runtime_error(m_pool->errors().front());
+            }
+            return false;
+        }
+        m_pos = 0;
+    }
+    return true;
+}
+
+uint64_t Decoder::read(VectorPointTable& table)
+{
+    const std::size_t pointSize(table.pointSize());
+    uint64_t np(0);
+
+    while (np < table.capacity() && next())
+    {
+        const uint64_t n(std::min<uint64_t>(
+            table.capacity() - np,
+            (m_node.size() - m_pos) / m_recordSize));
+
+        char* dst(table.data().data() + np * pointSize);
+        std::fill(dst, dst + n * pointSize, 0);
+
+        const char* src(m_node.data() + m_pos);
+        for (uint64_t i(0); i < n; ++i, src += m_recordSize, dst += pointSize)
+        {
+            for (const Field& f : m_fields)
+            {
+                std::memcpy(dst + f.dst, src + f.src, f.size);
+            }
+        }
+
+        m_pos += n * m_recordSize;
+        np += n;
+    }
+
+    return np;
+}
+
+} // namespace ept
+} // namespace entwine
@@ -0,0 +1,98 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <pdal/PointLayout.hpp>
+
+#include <entwine/reader/reader.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/source.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/optional.hpp>
+#include <entwine/util/pool.hpp>
+#include <entwine/util/queue.hpp>
+
+namespace entwine
+{
+namespace ept
+{
+
+// Returns true if this path is the ept.json of an existing EPT dataset.
+bool isDataset(const std::string& path);
+
+// Extract the info of an EPT dataset from its metadata alone.
+SourceInfo getInfo(
+    const std::string& path,
+    const json& pipelineTemplate,
+    const arbiter::Arbiter& a);
+
+// Returns true if this pipeline is only an EPT reader without options which
+// alter the points it reads, so that its dataset may be read by a Decoder.
+bool isNativeCandidate(const json& pipeline);
+
+// Reads the points of an existing EPT dataset, in place, straight into tables
+// of a packed layout, without a PDAL pipeline or any intermediate files.  Its
+// nodes are fetched and decoded in parallel via its hierarchy and our own
+// codecs, in roughly depth-first order, and at most a few nodes ahead of our
+// reads.  Dimensions of the layout which the dataset lacks are zeroed.
+class Decoder
+{
+public:
+    // Reads only the points within these bounds, if they are set.
+    Decoder(
+        std::shared_ptr<arbiter::Arbiter> a,
+        const std::string& path,
+        const std::string& tmp,
+        const pdal::PointLayout& layout,
+        uint64_t threads,
+        optional<Bounds> bounds = optional<Bounds>());
+    ~Decoder();
+
+    // Decode the next points into this table, up to its capacity, returning
+    // the number decoded, which is zero once we are done.
+    uint64_t read(VectorPointTable& table);
+
+private:
+    // A dimension of the records read from each node, and its position in
+    // our layout.
+    struct Field
+    {
+        std::size_t src = 0;
+        std::size_t dst = 0;
+        std::size_t size = 0;
+    };
+
+    bool next();
+
+    Reader m_reader;
+    Schema m_schema;
+    uint64_t m_recordSize = 0;
+    std::vector<Field> m_fields;
+
+    std::vector<Dxyz> m_keys;
+    std::atomic_uint64_t m_index{ 0 };
+    std::atomic_uint64_t m_done{ 0 };
+    BoundedQueue<std::vector<char>> m_nodes;
+    std::unique_ptr<Pool> m_pool;
+
+    std::vector<char> m_node;
+    uint64_t m_pos = 0;
+};
+
+} // namespace ept
+} // namespace entwine
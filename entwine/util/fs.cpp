@@ -10,11 +10,109 @@
 
 #include <entwine/util/fs.hpp>
 
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <stdexcept>
 
+#include <entwine/util/io.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/optional.hpp>
+#include <entwine/util/pool.hpp>
+
 namespace entwine
 {
 
+namespace
+{
+
+std::string getCacheFilename(const std::string& glob)
+{
+    return arbiter::crypto::encodeAsHex(arbiter::crypto::md5(glob)) + ".json";
+}
+
+// Returns our cached listing of this directory glob, if we hold one.
+optional<StringList> getCached(
+    const std::string& glob,
+    const arbiter::Endpoint& cache)
+{
+    if (const auto data = cache.tryGet(getCacheFilename(glob)))
+    {
+        try
+        {
+            // Guard against hash collisions, and corrupted entries.
+            const json j(json::parse(*data));
+            if (j.at("glob").get<std::string>() == glob)
+            {
+                return j.at("files").get<StringList>();
+            }
+        }
+        catch (...) { }
+    }
+    return { };
+}
+
+// The files beneath one input, which may be gathered from the listings of
+// several of its subdirectories at once.
+struct Listing
+{
+    std::mutex mutex;
+    StringList files;
+    bool split = false;
+    bool cached = false;
+};
+
+// List the files of this directory glob page by page, adding each page to our
+// listing and passing it along to onFiles as it arrives.  Subdirectories split
+// out of a recursive glob are listed by tasks of their own in this pool.
+void list(
+    const std::string& glob,
+    const arbiter::Arbiter& a,
+    Listing& listing,
+    const OnFiles& onFiles,
+    Pool& pool)
+{
+    const auto onPage([&listing, &onFiles](const StringList& page)
+    {
+        StringList files;
+        for (const auto& item : page)
+        {
+            if (!isDirectory(item)) files.push_back(item);
+        }
+        if (files.empty()) return;
+
+        {
+            std::lock_guard<std::mutex> lock(listing.mutex);
+            listing.files.insert(
+                listing.files.end(),
+                files.begin(),
+                files.end());
+        }
+
+        if (onFiles) onFiles(files);
+    });
+
+    const StringList subdirs(a.resolvePages(glob, onPage));
+    if (subdirs.empty()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(listing.mutex);
+        listing.split = true;
+    }
+
+    for (const std::string& subdir : subdirs)
+    {
+        pool.add([subdir, &a, &listing, &onFiles, &pool]()
+        {
+            list(subdir, a, listing, onFiles, pool);
+        });
+    }
+}
+
+} // unnamed namespace
+
 bool isDirectory(std::string path)
 {
     if (path.empty()) throw std::runtime_error("Cannot specify empty path");
@@ -28,11 +126,32 @@ std::string getStem(const std::string path)
     return arbiter::stripExtension(arbiter::getBasename(path));
 }
 
-StringList resolve(const StringList& input, const arbiter::Arbiter& a)
+StringList resolve(
+    const StringList& input,
+    const arbiter::Arbiter& a,
+    const unsigned threads,
+    const std::string listingCache,
+    const OnFiles onFiles)
 {
-    StringList output;
-    for (std::string item : input)
+    std::unique_ptr<arbiter::Endpoint> cache;
+    if (listingCache.size())
+    {
+        cache.reset(new arbiter::Endpoint(a.getEndpoint(listingCache)));
+        if (cache->isLocal()) arbiter::mkdirp(cache->root());
+    }
+
+    // Each input is resolved into its own list, so that our output retains
+    // the order of our inputs regardless of which listings finish first.
+    std::vector<std::unique_ptr<Listing>> listings;
+    StringList globs(input.size());
+
+    Pool pool(threads);
+    for (std::size_t i(0); i < input.size(); ++i)
     {
+        listings.emplace_back(new Listing());
+        Listing& listing(*listings.back());
+
+        std::string item(input[i]);
         if (isDirectory(item))
         {
             const char last = item.back();
@@ -41,16 +160,74 @@ StringList resolve(const StringList& input, const arbiter::Arbiter& a)
                 if (last != '/') item.push_back('/');
                 item.push_back('*');
             }
+            globs[i] = item;
 
-            const StringList directory(a.resolve(item));
-            for (const auto& item : directory)
+            const arbiter::Endpoint* ep(cache.get());
+            pool.add([&listing, &a, &onFiles, &pool, ep, item]()
             {
-                if (!isDirectory(item)) output.push_back(item);
-            }
+                if (ep)
+                {
+                    if (const auto files = getCached(item, *ep))
+                    {
+                        listing.files = *files;
+                        listing.cached = true;
+                        if (onFiles) onFiles(listing.files);
+                        return;
+                    }
+                }
+                list(item, a, listing, onFiles, pool);
+            });
+        }
+        else
+        {
+            listing.files.push_back(arbiter::expandTilde(item));
+            if (onFiles) onFiles(listing.files);
+        }
+    }
+    pool.join();
+
+    if (pool.errors().size()) throw std::runtime_error(pool.errors().front());
+
+    StringList output;
+    for (std::size_t i(0); i < input.size(); ++i)
+    {
+        Listing& listing(*listings[i]);
+        StringList& files(listing.files);
+
+        // The pages of split listings arrive in no particular order, so they
+        // are restored to the key order of a single listing.
+        if (listing.split) std::sort(files.begin(), files.end());
+
+        // A listing which fails to save is simply taken again by the next
+        // run, so putWithRetry's failure is not an error here.
+        if (cache && globs[i].size() && !listing.cached)
+        {
+            const json j { { "glob", globs[i] }, { "files", files } };
+            putWithRetry(*cache, getCacheFilename(globs[i]), j.dump());
         }
-        else output.push_back(arbiter::expandTilde(item));
+
+        output.insert(output.end(), files.begin(), files.end());
     }
     return output;
 }
 
+void removeTree(const std::string dir, const arbiter::Arbiter& a)
+{
+    // Directories are removed once they are empty, deepest first.
+    std::set<std::string, std::greater<std::string>> dirs;
+    for (const std::string& f : a.resolve(arbiter::join(dir, "**")))
+    {
+        arbiter::remove(f);
+
+        std::string parent(f.substr(0, f.find_last_of("/\\")));
+        while (parent.size() > dir.size() && dirs.insert(parent).second)
+        {
+            parent = parent.substr(0, parent.find_last_of("/\\"));
+        }
+    }
+
+    for (const std::string& d : dirs) arbiter::remove(d);
+    arbiter::remove(dir);
+}
+
 } // namespace entwine
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
 
 #include <entwine/third/arbiter/arbiter.hpp>
@@ -21,11 +22,32 @@ namespace entwine
 bool isDirectory(std::string path);
 std::string getStem(std::string path);
 
+// Called with each batch of files found by resolve, as their listings arrive,
+// perhaps from several threads at once.
+using OnFiles = std::function<void(const StringList&)>;
+
 // Accepts an array of inputs which are some combination of file/directory
 // paths.  Input paths which are directories are globbed into their constituent
-// files.
+// files, with up to this many globs listed in parallel.  Recursive globs, those
+// ending with "**", are split at their subdirectories where their storage
+// supports delimited listings, as S3 does, and those are listed in parallel as
+// well, although a single flat directory is still listed serially.
+//
+// If a listing cache is given, the listing of each glob is saved there, and
+// reused in place of listing that glob again.  Files are passed to onFiles as
+// each page of their listing arrives, so that their analysis may begin before
+// our listings are done, and are returned in the order of our inputs once
+// every listing is complete.
 StringList resolve(
     const StringList& input,
+    const arbiter::Arbiter& a = arbiter::Arbiter(),
+    unsigned threads = 1,
+    std::string listingCache = "",
+    OnFiles onFiles = OnFiles());
+
+// Remove a local directory along with everything beneath it.
+void removeTree(
+    std::string dir,
     const arbiter::Arbiter& a = arbiter::Arbiter());
 
 } // namespace entwine
@@ -11,21 +11,33 @@
 #include "info.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <numeric>
 
 #include <pdal/io/BufferReader.hpp>
 #include <pdal/PipelineManager.hpp>
 #include <pdal/PointTable.hpp>
 
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
 #include <entwine/types/scale-offset.hpp>
+#include <entwine/types/stats-accumulator.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/ept.hpp>
 #include <entwine/util/fs.hpp>
 #include <entwine/util/io.hpp>
+#include <entwine/util/las.hpp>
 #include <entwine/util/pdal-mutex.hpp>
 #include <entwine/util/pipeline.hpp>
 #include <entwine/util/pool.hpp>
+#include <entwine/util/scan-cache.hpp>
 #include <entwine/util/unique.hpp>
 
 namespace entwine
@@ -34,7 +46,21 @@ namespace entwine
 void executeStandard(pdal::Stage& s, pdal::StreamPointTable& table)
 {
     pdal::PointTable standardTable;
-    s.prepare(standardTable);
+    {
+        std::lock_guard<std::mutex> lock(PdalMutex::get());
+        s.prepare(standardTable);
+    }
+
+    // Mirror the prepared layout in our streaming table, into which each view
+    // is copied.
+    const pdal::PointLayout& standardLayout(*standardTable.layout());
+    for (const DimId id : standardLayout.dims())
+    {
+        table.layout()->registerOrAssignDim(
+            standardLayout.dimName(id),
+            standardLayout.dimType(id));
+    }
+    table.finalize();
 
     pdal::PointRef pr(table);
     uint64_t current(0);
@@ -78,13 +104,14 @@ SourceInfo getShallowInfo(const json pipeline)
 
     const json filterJson = slice(pipeline, 1);
 
-    std::unique_lock<std::mutex> lock(PdalMutex::get());
-
     pdal::PipelineManager pm;
     std::istringstream iss(pipeline.dump());
     pm.readPipeline(iss);
     pm.validateStageOptions();
 
+    // Previewing the reader may initialize spatial reference state.
+    std::unique_lock<std::mutex> lock(PdalMutex::get());
+
     pdal::Stage& stage = getStage(pm);
     pdal::Reader& reader(getReader(stage));
     const bool streamable = stage.pipelineStreamable();
@@ -171,17 +198,8 @@ SourceInfo getDeepInfo(json pipeline)
     SourceInfo info;
     info.pipeline = pipeline;
 
-    {
-        json& filter(findOrAppendStage(pipeline, "filters.stats"));
-        if (!filter.count("enumerate"))
-        {
-            filter.update({ { "enumerate", "Classification" } });
-        }
-    }
-
     try
     {
-        std::unique_lock<std::mutex> lock(PdalMutex::get());
         pdal::PipelineManager pm;
         std::istringstream iss(pipeline.dump());
         pm.readPipeline(iss);
@@ -190,32 +208,24 @@ SourceInfo getDeepInfo(json pipeline)
         {
             info.warnings.push_back("Pipeline is not streamable");
         }
-        lock.unlock();
 
-        // Extract stats filter from the pipeline.
         pdal::Stage& last(getStage(pm));
-        if (last.getName() != "filters.stats")
-        {
-            throw std::runtime_error(
-                "Invalid pipeline - must end with filters.stats");
-        }
-        const pdal::StatsFilter& statsFilter(
-            dynamic_cast<const pdal::StatsFilter&>(last));
-
-        pdal::Reader& reader(getReader(getStage(pm)));
-
-        pdal::FixedPointTable table(4096);
+        pdal::Reader& reader(getReader(last));
+
+        // Our layout is determined as the pipeline is prepared, after which
+        // each batch of points is accumulated into our statistics.
+        pdal::PointLayout layout;
+        VectorPointTable table(layout);
+        StatsAccumulator stats;
+        table.setProcess([&]() { stats.add(table); });
         execute(last, table);
 
-        const auto& layout(*table.layout());
-        for (const DimId id : layout.dims())
+        // Without any points, there are no statistics or bounds.
+        info.schema = stats.schema();
+        if (info.schema.empty())
         {
-            const DimensionStats stats(statsFilter.getStats(id));
-            const Dimension dimension(
-                layout.dimName(id),
-                layout.dimType(id),
-                stats);
-            info.schema.push_back(dimension);
+            info.schema = fromLayout(layout);
+            return info;
         }
 
         info.metadata = getMetadata(reader);
@@ -329,47 +339,304 @@ arbiter::LocalHandle localize(
     return getPointlessLasFile(path, tmp, a);
 }
 
+// Returns true if a deep analysis of this path may be split into ranges of
+// points, which requires a bare LAS reader so that the ranges are independent.
+bool isRangeCandidate(const std::string& path, const json& pipelineTemplate)
+{
+    const std::string extension = toLower(arbiter::getExtension(path));
+    if (extension != "las" && extension != "laz") return false;
+    if (pipelineTemplate.size() != 1) return false;
+
+    const json& reader(pipelineTemplate.at(0));
+    if (reader.count("start") || reader.count("count")) return false;
+    return reader.value("type", "readers.las") == "readers.las";
+}
+
+// Analyze this local LAS or LAZ file as ranges of points.  The ranges are
+// claimed in turn by the calling worker and by tasks added to its pool, so
+// the caller never waits on a range which has not been started and this may
+// safely be called from within the pool.
+SourceInfo analyzeRanges(
+    const std::string path,
+    json pipeline,
+    const uint64_t points,
+    Pool& pool)
+{
+    pipeline.at(0)["filename"] = path;
+    pipeline.at(0)["type"] = "readers.las";
+
+    const uint64_t size(heuristics::deepRangePoints);
+    const uint64_t ranges((points + size - 1) / size);
+
+    struct Shared
+    {
+        explicit Shared(uint64_t ranges) : infos(ranges) { }
+
+        std::vector<SourceInfo> infos;
+        std::atomic<uint64_t> next{ 0 };
+        std::atomic<uint64_t> done{ 0 };
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+    auto shared(std::make_shared<Shared>(ranges));
+
+    const auto work = [shared, pipeline, size, ranges]()
+    {
+        uint64_t i(0);
+        while ((i = shared->next++) < ranges)
+        {
+            json range(pipeline);
+            range.at(0)["start"] = i * size;
+            range.at(0)["count"] = size;
+            shared->infos[i] = getDeepInfo(range);
+
+            if (++shared->done == ranges)
+            {
+                std::lock_guard<std::mutex> lock(shared->mutex);
+                shared->cv.notify_all();
+            }
+        }
+    };
+
+    for (uint64_t i(1); i < ranges; ++i) pool.add(work);
+    work();
+
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->cv.wait(lock, [&]() { return shared->done == ranges; });
+    lock.unlock();
+
+    // Our ranges share their reader, so its metadata is that of the first,
+    // and the pipeline is that of the whole file.
+    SourceInfo info;
+    info.bounds = Bounds::expander();
+    for (const SourceInfo& range : shared->infos)
+    {
+        info = manifest::combine(info, range);
+    }
+    info.pipeline = shared->infos.front().pipeline;
+    info.pipeline.at(0).erase("start");
+    info.pipeline.at(0).erase("count");
+    info.metadata = shared->infos.front().metadata;
+
+    if (!info.points) info.bounds = Bounds();
+    return info;
+}
+
+// The latency-bound stage of analysis, which runs in our I/O pool.  Where
+// possible, remote LAS headers are parsed directly rather than executing a
+// PDAL pipeline, in which case there is nothing left to do.
+optional<SourceInfo> analyzeRemote(
+    const std::string path,
+    const json& pipelineTemplate,
+    const bool deep,
+    const arbiter::Arbiter& a)
+{
+    if (deep || !las::isShallowCandidate(path, pipelineTemplate, a))
+    {
+        return { };
+    }
+
+    try
+    {
+        return las::getShallowInfo(path, pipelineTemplate, a);
+    }
+    catch (const std::exception& e)
+    {
+        SourceInfo info;
+        info.errors.push_back(std::string("Failed to analyze: ") + e.what());
+        return info;
+    }
+}
+
+// The CPU-bound stage of analysis, of a file which has been localized, which
+// runs in our CPU pool.
+SourceInfo analyzeLocal(
+    const std::string path,
+    const arbiter::LocalHandle& handle,
+    const json& pipelineTemplate,
+    const bool deep,
+    Pool& pool)
+{
+    // Very large files are split so that a single file does not serialize
+    // the analysis while the rest of our pool sits idle.
+    const bool splittable(
+        deep &&
+        pool.numThreads() > 1 &&
+        isRangeCandidate(path, pipelineTemplate));
+
+    if (splittable)
+    {
+        const uint64_t size(heuristics::deepRangePoints);
+        const SourceInfo header(
+            analyzeOne(handle.localPath(), false, pipelineTemplate));
+        if (header.errors.empty() && header.points > size)
+        {
+            return analyzeRanges(
+                handle.localPath(),
+                pipelineTemplate,
+                header.points,
+                pool);
+        }
+    }
+
+    return analyzeOne(handle.localPath(), deep, pipelineTemplate);
+}
+
 SourceList analyze(
     const StringList& inputs,
     const json& pipelineTemplate,
     const bool deep,
     const std::string tmp,
     const arbiter::Arbiter& a,
-    const unsigned int threads)
+    const unsigned int threads,
+    const std::string cachePath,
+    const unsigned int ioThreads,
+    const std::string listingCache,
+    const std::function<bool(const std::string&)> skip)
 {
-    const StringList filenames = resolve(inputs);
-    SourceList sources(filenames.begin(), filenames.end());
-
-    uint64_t i(0);
-
-    Pool pool(threads);
-    for (Source& source : sources)
+    const optional<ScanCache> cache(cachePath.size()
+        ? ScanCache(a, cachePath)
+        : optional<ScanCache>());
+    std::atomic<uint64_t> cached(0);
+
+    // Our sources are added as the listings of our inputs arrive, so they are
+    // held where adding more does not move those already being analyzed.
+    std::deque<Source> sources;
+    std::map<std::string, std::deque<std::size_t>> indices;
+    std::mutex mutex;
+
+    // Fetching headers and files is bound by latency rather than by our
+    // cores, so it runs in a larger pool of its own, which hands localized
+    // files to our CPU pool for parsing.  While the CPU pool is backed up,
+    // additions to it block, which bounds the files localized ahead of it.
+    Pool cpu(threads);
+    Pool io(ioThreads ? ioThreads : heuristics::analysisIoThreads);
+    const auto schedule = [&](Source& source)
     {
-        std::cout << ++i << "/" << sources.size() << ": " << source.path <<
-            std::endl;
-
-        if (arbiter::getExtension(source.path) == "json")
+        // Existing EPT datasets are described by their metadata alone.
+        if (ept::isDataset(source.path))
         {
-            pool.add([&source, &a]()
+            io.add([&source, &pipelineTemplate, &a]()
+            {
+                source.info = ept::getInfo(source.path, pipelineTemplate, a);
+            });
+        }
+        else if (arbiter::getExtension(source.path) == "json")
+        {
+            io.add([&source, &a]()
             {
                 source = parseOne(source.path, a);
             });
         }
         else
         {
-            pool.add([&]()
+            io.add([&]()
             {
-                const auto handle(localize(source.path, deep, tmp, a));
-                source.info = analyzeOne(
-                    handle.localPath(),
-                    deep,
-                    pipelineTemplate);
+                const std::string key(cache
+                    ? cache->getKey(source.path, deep, pipelineTemplate)
+                    : "");
+
+                if (key.size())
+                {
+                    if (const auto info = cache->get(key))
+                    {
+                        source.info = *info;
+                        ++cached;
+                        return;
+                    }
+                }
+
+                // Don't cache failures, which may be transient.
+                const auto done = [&cache, &source, key]()
+                {
+                    if (key.size() && source.info.errors.empty())
+                    {
+                        cache->put(key, source.info);
+                    }
+                };
+
+                if (auto info = analyzeRemote(
+                        source.path,
+                        pipelineTemplate,
+                        deep,
+                        a))
+                {
+                    source.info = std::move(*info);
+                    return done();
+                }
+
+                std::shared_ptr<arbiter::LocalHandle> handle;
+                try
+                {
+                    handle = std::make_shared<arbiter::LocalHandle>(
+                        localize(source.path, deep, tmp, a));
+                }
+                catch (const std::exception& e)
+                {
+                    source.info.errors.push_back(
+                        std::string("Failed to fetch: ") + e.what());
+                    return;
+                }
+
+                cpu.add([&, handle, done]()
+                {
+                    source.info = analyzeLocal(
+                        source.path,
+                        *handle,
+                        pipelineTemplate,
+                        deep,
+                        cpu);
+                    done();
+                });
             });
         }
+    };
+
+    const StringList filenames(resolve(
+        inputs,
+        a,
+        threads,
+        listingCache,
+        [&](const StringList& files)
+        {
+            for (const std::string& path : files)
+            {
+                if (skip && skip(path)) continue;
+
+                Source* source(nullptr);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    indices[path].push_back(sources.size());
+                    sources.emplace_back(path);
+                    source = &sources.back();
+
+                    std::cout << sources.size() << ": " << path << std::endl;
+                }
+                schedule(*source);
+            }
+        }));
+    io.join();
+    cpu.join();
+
+    if (cache)
+    {
+        std::cout << "Reused cached info for " << cached << "/" <<
+            sources.size() << " files" << std::endl;
     }
-    pool.join();
 
-    return sources;
+    // Our sources are returned in the order of our inputs, rather than the
+    // order in which their listings happened to arrive.
+    SourceList output;
+    output.reserve(sources.size());
+    for (const std::string& path : filenames)
+    {
+        auto it(indices.find(path));
+        if (it == indices.end() || it->second.empty()) continue;
+
+        output.push_back(std::move(sources[it->second.front()]));
+        it->second.pop_front();
+    }
+    return output;
 }
 
 } // namespace entwine
@@ -10,6 +10,9 @@
 
 #pragma once
 
+#include <functional>
+#include <string>
+
 #include <entwine/third/arbiter/arbiter.hpp>
 #include <entwine/types/reprojection.hpp>
 #include <entwine/types/source.hpp>
@@ -27,12 +30,23 @@ arbiter::LocalHandle localize(
 SourceInfo analyzeOne(std::string path, bool deep, json pipelineTemplate);
 Source parseOne(std::string path, const arbiter::Arbiter& a = { });
 
+// Analyze these inputs, parsing them with this many threads while fetching
+// them, or their headers, with a separate pool of ioThreads.  If zero, a
+// default suited to remote inputs is used.  Directories among our inputs are
+// resolved, through this listing cache if one is given, and their files begin
+// their analysis as each page of their listings arrives.  Files for which skip
+// returns true are left out.  Sources are returned in the order of their
+// resolved inputs.
 SourceList analyze(
     const StringList& inputs,
     const json& pipelineTemplate,
     bool deep,
     std::string tmp = arbiter::getTempPath(),
     const arbiter::Arbiter& a = { },
-    unsigned threads = 8);
+    unsigned threads = 8,
+    std::string cachePath = "",
+    unsigned ioThreads = 0,
+    std::string listingCache = "",
+    std::function<bool(const std::string&)> skip = { });
 
 } // namespace entwine
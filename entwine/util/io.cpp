@@ -13,10 +13,18 @@
 #include <pdal/util/IStream.hpp>
 #include <pdal/util/OStream.hpp>
 
+#include <algorithm>
 #include <chrono>
+#include <limits>
 #include <mutex>
+#include <random>
 #include <thread>
 
+#include <entwine/util/metrics.hpp>
+#include <entwine/util/rate-limit.hpp>
+#include <entwine/util/read-cache.hpp>
+#include <entwine/util/sweep.hpp>
+
 namespace entwine
 {
 
@@ -25,10 +33,38 @@ namespace
 
 std::mutex mutex;
 
+std::shared_ptr<ReadCache> readCache;
+std::shared_ptr<Sweep> sweep;
+
+std::shared_ptr<ReadCache> getReadCache(const arbiter::Endpoint& ep)
+{
+    if (ep.isLocal()) return { };
+    return std::atomic_load(&readCache);
+}
+
+void discard(const arbiter::Endpoint& ep, const std::string& path)
+{
+    if (const auto cache = getReadCache(ep))
+    {
+        cache->erase(ep.prefixedFullPath(path));
+    }
+    noteWrite(ep.prefixedFullPath(path));
+}
+
+const int64_t baseDelayMs(250);
+const int64_t maxDelayMs(30000);
+
 void sleep(const int tried, const std::string message)
 {
-    // Linear back-off should be fine.
-    std::this_thread::sleep_for(std::chrono::seconds(tried));
+    // Back off exponentially, with half of each delay randomized so that many
+    // threads failing at once do not retry in lockstep.
+    const int64_t delay(
+        std::min(maxDelayMs, baseDelayMs << std::min(tried - 1, 16)));
+
+    static thread_local std::mt19937 gen(std::random_device{ }());
+    std::uniform_int_distribution<int64_t> jitter(0, delay / 2);
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(delay / 2 + jitter(gen)));
 
     if (message.size())
     {
@@ -37,8 +73,13 @@ void sleep(const int tried, const std::string message)
     }
 }
 
+// If given a limiter, its rates are adjusted by the outcome of each try.
 template <typename F>
-bool loop(F f, const int tries, std::string message = "")
+bool loop(
+    F f,
+    const int tries,
+    std::string message = "",
+    RateLimiter* limiter = nullptr)
 {
     int tried = 0;
 
@@ -47,8 +88,13 @@ bool loop(F f, const int tries, std::string message = "")
         try
         {
             f();
+            if (limiter) limiter->succeeded();
             return true;
         }
+        catch (std::exception& e)
+        {
+            if (limiter && isThrottle(e.what())) limiter->throttled();
+        }
         catch (...) { }
 
         sleep(tried + 1, message);
@@ -58,7 +104,24 @@ bool loop(F f, const int tries, std::string message = "")
     return false;
 }
 
-arbiter::http::Headers getRangeHeader(int start, int end = 0)
+} // unnamed namespace
+
+void setReadCache(std::shared_ptr<ReadCache> cache)
+{
+    std::atomic_store(&readCache, cache);
+}
+
+void setSweep(std::shared_ptr<Sweep> s)
+{
+    std::atomic_store(&sweep, s);
+}
+
+void noteWrite(const std::string& path)
+{
+    if (const auto s = std::atomic_load(&sweep)) s->wrote(path);
+}
+
+arbiter::http::Headers getRangeHeader(const uint64_t start, const uint64_t end)
 {
     arbiter::http::Headers h;
     h["Range"] = "bytes=" + std::to_string(start) + "-" +
@@ -66,16 +129,24 @@ arbiter::http::Headers getRangeHeader(int start, int end = 0)
     return h;
 }
 
-} // unnamed namespace
-
 bool putWithRetry(
     const arbiter::Endpoint& ep,
     const std::string& path,
     const std::vector<char>& data,
     const int tries)
 {
-    const auto f = [&ep, &path, &data]() { ep.put(path, data); };
-    return loop(f, tries, "Failed to put " + path);
+    discard(ep, path);
+
+    metrics::ScopedTimer timer(metrics::Timer::Upload);
+    const std::shared_ptr<RateLimiter> limiter(getRateLimiter(ep));
+    const auto f = [&ep, &path, &data, &limiter]()
+    {
+        if (limiter) limiter->acquire(data.size());
+        ep.put(path, data);
+    };
+    if (!loop(f, tries, "Failed to put " + path, limiter.get())) return false;
+    metrics::add(metrics::Counter::BytesWritten, data.size());
+    return true;
 }
 
 bool putWithRetry(
@@ -108,19 +179,96 @@ void ensurePut(
     ensurePut(ep, path, std::vector<char>(s.begin(), s.end()), tries);
 }
 
+void ensurePutJson(
+    const arbiter::Endpoint& ep,
+    const std::string& path,
+    const std::string& s,
+    const std::string& encoding,
+    const int tries)
+{
+    if (encoding.empty() || !ep.isHttpDerived())
+    {
+        return ensurePut(ep, path, s, tries);
+    }
+
+#ifdef ENTWINE_ZLIB
+    if (encoding != "gzip")
+    {
+        throw std::runtime_error("Invalid content encoding: " + encoding);
+    }
+
+    const std::string compressed(arbiter::gzip::compress(s.data(), s.size()));
+    const std::vector<char> data(compressed.begin(), compressed.end());
+
+    arbiter::http::Headers headers;
+    headers["Content-Encoding"] = encoding;
+    discard(ep, path);
+
+    // Unlike our other puts, those with headers take the full path.
+    metrics::ScopedTimer timer(metrics::Timer::Upload);
+    const std::string full(ep.fullPath(path));
+    const std::shared_ptr<RateLimiter> limiter(getRateLimiter(ep));
+    const auto f = [&]()
+    {
+        if (limiter) limiter->acquire(data.size());
+        ep.put(full, data, headers, { });
+    };
+    if (!loop(f, tries, "Failed to put " + path, limiter.get()))
+    {
+        throw FatalError("Failed to put to " + path);
+    }
+    metrics::add(metrics::Counter::BytesWritten, data.size());
+#else
+    throw std::runtime_error("Content encoding requires zlib: " + encoding);
+#endif
+}
+
 optional<std::vector<char>> getBinaryWithRetry(
     const arbiter::Endpoint& ep,
     const std::string& path,
     const int tries)
 {
+    // Our copy is validated by the version of the remote object, which costs
+    // a round trip but not its transfer.  The version is taken before our
+    // read, so a rewrite meanwhile leaves a copy which no longer matches.
+    const std::shared_ptr<ReadCache> cache(getReadCache(ep));
+    std::unique_ptr<std::string> version;
+    if (cache)
+    {
+        try { version = ep.tryGetVersion(path); }
+        catch (...) { }
+
+        if (version)
+        {
+            const std::string full(ep.prefixedFullPath(path));
+            if (auto data = cache->get(full, *version))
+            {
+                metrics::add(metrics::Counter::ReadCacheHits);
+                return data;
+            }
+        }
+        metrics::add(metrics::Counter::ReadCacheMisses);
+    }
+
+    // The size of a get is unknown until it completes, so its bytes delay
+    // the requests which follow it.
     std::vector<char> data;
-    const auto f = [&ep, &path, &data]() { data = ep.getBinary(path); };
+    const std::shared_ptr<RateLimiter> limiter(getRateLimiter(ep));
+    const auto f = [&ep, &path, &data, &limiter]()
+    {
+        if (limiter) limiter->acquire(0);
+        data = ep.getBinary(path);
+        if (limiter) limiter->charge(data.size());
+    };
     const std::string message =
         "Failed to get " +
         arbiter::join(ep.prefixedRoot(), path);
 
-    if (loop(f, tries, message)) return data;
-    else return { };
+    if (!loop(f, tries, message, limiter.get())) return { };
+    metrics::add(metrics::Counter::BytesRead, data.size());
+
+    if (version) cache->put(ep.prefixedFullPath(path), *version, data);
+    return data;
 }
 
 optional<std::string> getWithRetry(
@@ -281,4 +429,146 @@ arbiter::LocalHandle getPointlessLasFile(
     a.put(outputPath, data);
     return arbiter::LocalHandle(outputPath, true);
 }
+arbiter::LocalHandle getLasRangeFile(
+    const std::string& path,
+    const std::string& tmp,
+    const arbiter::Arbiter& a,
+    const uint64_t start,
+    const uint64_t count)
+{
+    const uint64_t maxHeaderSize(375);
+
+    const uint64_t minorVersionPos(25);
+    const uint64_t headerSizePos(94);
+    const uint64_t pointOffsetPos(96);
+    const uint64_t pointFormatPos(104);
+    const uint64_t recordLengthPos(105);
+    const uint64_t legacyCountPos(107);
+    const uint64_t evlrOffsetPos(235);
+    const uint64_t evlrNumberPos(evlrOffsetPos + 8);
+    const uint64_t countPos(evlrNumberPos + 4);
+
+    std::string fileSignature;
+    uint8_t minorVersion(0);
+    uint16_t headerSize(0);
+    uint32_t pointOffset(0);
+    uint8_t pointFormat(0);
+    uint16_t recordLength(0);
+    uint32_t legacyCount(0);
+    uint64_t evlrOffset(0);
+    uint32_t evlrNumber(0);
+
+    std::string header(a.get(path, getRangeHeader(0, maxHeaderSize)));
+
+    std::stringstream headerStream(
+            header,
+            std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+
+    pdal::ILeStream is(&headerStream);
+    pdal::OLeStream os(&headerStream);
+
+    is.seek(0);
+    is.get(fileSignature, 4);
+
+    if (fileSignature != "LASF")
+    {
+        throw std::runtime_error(
+            "Invalid file signature for .las or .laz file: must be LASF");
+    }
+
+    is.seek(minorVersionPos);
+    is >> minorVersion;
+
+    is.seek(headerSizePos);
+    is >> headerSize;
+
+    is.seek(pointOffsetPos);
+    is >> pointOffset;
+
+    is.seek(pointFormatPos);
+    is >> pointFormat;
+
+    is.seek(recordLengthPos);
+    is >> recordLength;
+
+    is.seek(legacyCountPos);
+    is >> legacyCount;
+
+    // The high bits of the point format indicate compression, in which case
+    // point records cannot be addressed by their byte offsets.
+    if (pointFormat & 0xc0)
+    {
+        throw std::runtime_error("Cannot range-read compressed file " + path);
+    }
+    if (!recordLength) throw std::runtime_error("Invalid record length");
+
+    if (minorVersion >= 4)
+    {
+        is.seek(evlrOffsetPos);
+        is >> evlrOffset;
+
+        is.seek(evlrNumberPos);
+        is >> evlrNumber;
+    }
+
+    const bool hasEvlrs = evlrNumber && evlrOffset;
+
+    // If no count is given, read through the end of the point records.
+    const uint64_t begin(pointOffset + start * recordLength);
+    const uint64_t end(count
+        ? begin + count * recordLength
+        : hasEvlrs ? evlrOffset : 0);
+
+    std::vector<char> points(a.getBinary(path, getRangeHeader(begin, end)));
+    const uint64_t np(points.size() / recordLength);
+    points.resize(np * recordLength);
+
+    // Modify the header to describe only the points we've extracted.
+    if (legacyCount)
+    {
+        const uint64_t legacyMax(std::numeric_limits<uint32_t>::max());
+        os.seek(legacyCountPos);
+        os << static_cast<uint32_t>(np <= legacyMax ? np : 0);
+    }
+
+    if (minorVersion >= 4)
+    {
+        os.seek(countPos);
+        os << np;
+
+        if (hasEvlrs)
+        {
+            os.seek(evlrOffsetPos);
+            os << static_cast<uint64_t>(pointOffset + points.size());
+        }
+    }
+
+    header = headerStream.str();
+    std::vector<char> data(header.data(), header.data() + headerSize);
+
+    const bool hasVlrs = headerSize < pointOffset;
+    if (hasVlrs)
+    {
+        const auto vlrs = a.getBinary(
+            path,
+            getRangeHeader(headerSize, pointOffset));
+        data.insert(data.end(), vlrs.begin(), vlrs.end());
+    }
+
+    data.insert(data.end(), points.begin(), points.end());
+
+    if (hasEvlrs)
+    {
+        const auto evlrs = a.getBinary(path, getRangeHeader(evlrOffset));
+        data.insert(data.end(), evlrs.begin(), evlrs.end());
+    }
+
+    const std::string basename(
+        std::to_string(arbiter::randomNumber()) + ".las");
+
+    const std::string outputPath = arbiter::join(tmp, basename);
+    a.put(outputPath, data);
+    return arbiter::LocalHandle(outputPath, true);
+}
+
 } // namespace entwine
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -21,8 +22,26 @@
 namespace entwine
 {
 
+class ReadCache;
+class Sweep;
+
 static constexpr int defaultTries = 8;
 
+// If set, the remote objects read by the get functions below are read
+// through this cache, and those written by the put functions below are
+// discarded from it.
+void setReadCache(std::shared_ptr<ReadCache> cache);
+
+// If set, the files written by the put functions below are noted by this
+// sweep, which spares them from its removal.
+void setSweep(std::shared_ptr<Sweep> sweep);
+
+// Note a write of the file at this full path which was made other than by the
+// put functions below, such as a node written in place by PDAL or a copy
+// between endpoints, so that our sweep spares it.  Such writes are local or
+// copied, so no read cache holds them.
+void noteWrite(const std::string& path);
+
 bool putWithRetry(
     const arbiter::Endpoint& ep,
     const std::string& path,
@@ -45,6 +64,18 @@ void ensurePut(
     const std::string& s,
     int tries = defaultTries);
 
+// Write this JSON text for readers.  If an encoding is given, the text is
+// precompressed with it and stored with a matching Content-Encoding, which
+// HTTP clients decode transparently, unless our endpoint cannot store such
+// metadata, in which case the text is written as it is.  The only supported
+// encoding is "gzip".
+void ensurePutJson(
+    const arbiter::Endpoint& ep,
+    const std::string& path,
+    const std::string& s,
+    const std::string& encoding,
+    int tries = defaultTries);
+
 optional<std::vector<char>> getBinaryWithRetry(
     const arbiter::Endpoint& ep,
     const std::string& path,
@@ -76,9 +107,23 @@ arbiter::LocalHandle ensureGetLocalHandle(
     const std::string& path,
     int tries = defaultTries);
 
+// Get the HTTP headers for a ranged read of [start, end).  An end of zero
+// reads through the end of the file.
+arbiter::http::Headers getRangeHeader(uint64_t start, uint64_t end = 0);
+
 arbiter::LocalHandle getPointlessLasFile(
     const std::string& path,
     const std::string& tmp,
     const arbiter::Arbiter& a);
 
+// Create a local copy of an uncompressed LAS file containing only the
+// requested range of points, using ranged reads of the remote file.  A count
+// of zero reads through the end of the point records.
+arbiter::LocalHandle getLasRangeFile(
+    const std::string& path,
+    const std::string& tmp,
+    const arbiter::Arbiter& a,
+    uint64_t start,
+    uint64_t count = 0);
+
 } // namespace entwine
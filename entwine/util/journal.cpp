@@ -0,0 +1,101 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/journal.hpp>
+
+#include <stdexcept>
+
+#include <entwine/util/io.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+Journal::Journal(const arbiter::Endpoint& local) : m_local(local)
+{
+    if (!m_local.isLocal())
+    {
+        throw std::runtime_error("Journal directory must be local");
+    }
+
+    // Files staged before an interruption, other than those of an interrupted
+    // upload, are superseded by the state from which we resume, so they are
+    // never read back.
+    if (const auto manifest = m_local.tryGet(manifestFilename()))
+    {
+        for (const std::string path : json::parse(*manifest))
+        {
+            m_pending.insert(path);
+        }
+    }
+}
+
+void Journal::put(const std::string& path, const std::vector<char>& data)
+{
+    ensurePut(m_local, path, data);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending.insert(path);
+}
+
+optional<std::vector<char>> Journal::get(const std::string& path) const
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_pending.count(path)) return { };
+    }
+    return ensureGetBinary(m_local, path);
+}
+
+void Journal::upload(const arbiter::Endpoint& out, const unsigned threads)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pending.empty()) return;
+
+    const std::string manifest = manifestFilename();
+    ensurePut(m_local, manifest, json(m_pending).dump());
+
+    std::mutex mutex;
+    std::set<std::string> uploaded;
+
+    Pool pool(threads);
+    for (const std::string& path : m_pending)
+    {
+        pool.add([&]()
+        {
+            ensurePut(out, path, ensureGetBinary(m_local, path));
+            arbiter::remove(m_local.prefixedRoot() + path);
+
+            std::lock_guard<std::mutex> uploadedLock(mutex);
+            uploaded.insert(path);
+        });
+    }
+    pool.join();
+
+    for (const std::string& path : uploaded) m_pending.erase(path);
+
+    if (pool.errors().size())
+    {
+        // Our manifest remains, covering those which are still pending.
+        ensurePut(m_local, manifest, json(m_pending).dump());
+        throw std::runtime_error(pool.errors().front());
+    }
+
+    arbiter::remove(m_local.prefixedRoot() + manifest);
+}
+
+uint64_t Journal::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pending.size();
+}
+
+} // namespace entwine
@@ -0,0 +1,61 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/optional.hpp>
+
+namespace entwine
+{
+
+// Stages writes to a remote endpoint in a local directory, and uploads them
+// together when asked, so that a file rewritten several times between uploads
+// costs a single remote write and its writers never wait on the network.
+// Files staged since the last upload are read back from here.
+//
+// While an upload is in progress, the paths being uploaded are recorded in a
+// manifest within our directory.  If it is found when we are constructed, the
+// upload was interrupted, and its files are uploaded along with the next.
+class Journal
+{
+public:
+    explicit Journal(const arbiter::Endpoint& local);
+
+    // Stage this data for an upload to this path.
+    void put(const std::string& path, const std::vector<char>& data);
+
+    // Read back the data staged for this path, if any.
+    optional<std::vector<char>> get(const std::string& path) const;
+
+    // Write each staged file to this endpoint, with this many concurrent puts,
+    // and then release it.  Throws if any of the puts has failed, in which
+    // case the files which were not uploaded remain staged.
+    void upload(const arbiter::Endpoint& out, unsigned threads);
+
+    // The number of files staged since the last upload.
+    uint64_t size() const;
+
+    static std::string manifestFilename() { return "ept-journal.json"; }
+
+private:
+    const arbiter::Endpoint m_local;
+
+    mutable std::mutex m_mutex;
+    std::set<std::string> m_pending;
+};
+
+} // namespace entwine
@@ -0,0 +1,635 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/las.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <entwine/types/scale-offset.hpp>
+#include <entwine/util/io.hpp>
+
+namespace entwine
+{
+namespace las
+{
+
+namespace
+{
+
+using Data = std::vector<char>;
+
+const uint64_t maxHeaderSize(375);
+const uint64_t minHeaderSize(227);
+const uint64_t vlrHeaderSize(54);
+const uint64_t evlrHeaderSize(60);
+
+// Record lengths of the standard point formats, without extra bytes.
+const uint16_t recordLengths[] = {
+    20, 28, 26, 34, 57, 63, 30, 36, 38, 59, 67
+};
+
+template <typename T>
+T extract(const Data& data, const uint64_t pos)
+{
+    if (pos + sizeof(T) > data.size())
+    {
+        throw std::runtime_error("Invalid LAS header: unexpected end of data");
+    }
+
+    T v;
+    std::memcpy(&v, data.data() + pos, sizeof(T));
+    return v;
+}
+
+std::string extractString(const Data& data, uint64_t pos, uint64_t size)
+{
+    if (pos + size > data.size())
+    {
+        throw std::runtime_error("Invalid LAS header: unexpected end of data");
+    }
+
+    std::string s(data.data() + pos, size);
+    s.erase(std::find(s.begin(), s.end(), '\0'), s.end());
+    return s;
+}
+
+struct Vlr
+{
+    std::string userId;
+    uint16_t recordId = 0;
+    Data data;
+};
+
+// Parse count records from data, each of which has a header of this size
+// whose payload length is of type L.
+template <typename L>
+std::vector<Vlr> parseVlrs(
+    const Data& data,
+    const uint64_t count,
+    const uint64_t headerSize)
+{
+    std::vector<Vlr> vlrs;
+    uint64_t pos(0);
+    for (uint64_t i(0); i < count; ++i)
+    {
+        Vlr vlr;
+        vlr.userId = extractString(data, pos + 2, 16);
+        vlr.recordId = extract<uint16_t>(data, pos + 18);
+        const uint64_t length(extract<L>(data, pos + 20));
+        pos += headerSize;
+
+        if (pos + length > data.size())
+        {
+            throw std::runtime_error("Invalid LAS VLR: unexpected end of data");
+        }
+        vlr.data.assign(
+            data.begin() + pos,
+            data.begin() + pos + length);
+        pos += length;
+
+        vlrs.push_back(std::move(vlr));
+    }
+    return vlrs;
+}
+
+// Reduce a GeoTIFF key directory to EPSG codes if possible, like
+// "EPSG:26915+5703".  Returns an empty string otherwise.
+std::string getGeoTiffCode(const Data& data)
+{
+    const uint64_t count(extract<uint16_t>(data, 6));
+
+    uint16_t horizontal(0);
+    uint16_t vertical(0);
+    for (uint64_t i(0); i < count; ++i)
+    {
+        const uint64_t pos((i + 1) * 8);
+        const uint16_t id(extract<uint16_t>(data, pos));
+        const uint16_t location(extract<uint16_t>(data, pos + 2));
+        const uint16_t value(extract<uint16_t>(data, pos + 6));
+
+        // Values stored outside of the directory, and user-defined values,
+        // require a full GeoTIFF interpretation.
+        const bool isCode(location == 0 && value && value != 32767);
+
+        // ProjectedCSTypeGeoKey, and GeographicTypeGeoKey if unprojected.
+        if (id == 3072 || (id == 2048 && !horizontal))
+        {
+            if (!isCode) return "";
+            horizontal = value;
+        }
+        // VerticalCSTypeGeoKey.
+        else if (id == 4096 && isCode) vertical = value;
+    }
+
+    if (!horizontal) return "";
+    std::string code("EPSG:" + std::to_string(horizontal));
+    if (vertical) code += "+" + std::to_string(vertical);
+    return code;
+}
+
+// Matches the dimensions registered by readers.las for this point format.
+Schema getSchema(const uint8_t format)
+{
+    Schema schema {
+        { "X", Type::Double },
+        { "Y", Type::Double },
+        { "Z", Type::Double },
+        { "Intensity", Type::Unsigned16 },
+        { "ReturnNumber", Type::Unsigned8 },
+        { "NumberOfReturns", Type::Unsigned8 },
+        { "ScanDirectionFlag", Type::Unsigned8 },
+        { "EdgeOfFlightLine", Type::Unsigned8 },
+        { "Classification", Type::Unsigned8 },
+        { "ScanAngleRank", Type::Float },
+        { "UserData", Type::Unsigned8 },
+        { "PointSourceId", Type::Unsigned16 }
+    };
+
+    const bool hasTime(format == 1 || format >= 3);
+    const bool hasColor(format == 2 || format == 3 || format >= 7);
+    const bool hasInfrared(format == 8);
+
+    if (hasTime) schema.emplace_back("GpsTime", Type::Double);
+    if (hasColor)
+    {
+        schema.emplace_back("Red", Type::Unsigned16);
+        schema.emplace_back("Green", Type::Unsigned16);
+        schema.emplace_back("Blue", Type::Unsigned16);
+    }
+    if (hasInfrared) schema.emplace_back("Infrared", Type::Unsigned16);
+    if (format >= 6)
+    {
+        schema.emplace_back("ScanChannel", Type::Unsigned8);
+        schema.emplace_back("ClassFlags", Type::Unsigned8);
+    }
+
+    return schema;
+}
+
+std::string toLower(std::string s)
+{
+    std::transform(
+        s.begin(),
+        s.end(),
+        s.begin(),
+        [](unsigned char c) { return std::tolower(c); });
+    return s;
+}
+
+template <typename T>
+void store(char* pos, const double v)
+{
+    const T t(static_cast<T>(v));
+    std::memcpy(pos, &t, sizeof(T));
+}
+
+using Store = void (*)(char*, double);
+
+Store getStore(const DimType type)
+{
+    switch (type)
+    {
+        case DimType::Signed8:      return &store<int8_t>;
+        case DimType::Signed16:     return &store<int16_t>;
+        case DimType::Signed32:     return &store<int32_t>;
+        case DimType::Signed64:     return &store<int64_t>;
+        case DimType::Unsigned8:    return &store<uint8_t>;
+        case DimType::Unsigned16:   return &store<uint16_t>;
+        case DimType::Unsigned32:   return &store<uint32_t>;
+        case DimType::Unsigned64:   return &store<uint64_t>;
+        case DimType::Float:        return &store<float>;
+        case DimType::Double:       return &store<double>;
+        default: throw std::runtime_error("Invalid dimension type");
+    }
+}
+
+template <typename T>
+T get(const char* pos)
+{
+    T v;
+    std::memcpy(&v, pos, sizeof(T));
+    return v;
+}
+
+} // unnamed namespace
+
+bool isShallowCandidate(
+    const std::string& path,
+    const json& pipelineTemplate,
+    const arbiter::Arbiter& a)
+{
+    const std::string extension = toLower(arbiter::getExtension(path));
+    if (extension != "las" && extension != "laz") return false;
+    if (a.isLocal(path)) return false;
+
+    // Any filters, or reader options, may alter the info from the header.
+    if (pipelineTemplate.size() != 1) return false;
+    for (const auto& p : pipelineTemplate.at(0).items())
+    {
+        if (p.key() == "filename") continue;
+        if (p.key() == "type" && p.value() == "readers.las") continue;
+        return false;
+    }
+    return true;
+}
+
+optional<SourceInfo> getShallowInfo(
+    const std::string& path,
+    json pipeline,
+    const arbiter::Arbiter& a)
+{
+    const Data header(a.getBinary(path, getRangeHeader(0, maxHeaderSize)));
+
+    if (header.size() < minHeaderSize || extractString(header, 0, 4) != "LASF")
+    {
+        throw std::runtime_error(
+            "Invalid file signature for .las or .laz file: must be LASF");
+    }
+
+    const uint16_t globalEncoding(extract<uint16_t>(header, 6));
+    const uint8_t majorVersion(extract<uint8_t>(header, 24));
+    const uint8_t minorVersion(extract<uint8_t>(header, 25));
+    const uint16_t headerSize(extract<uint16_t>(header, 94));
+    const uint32_t pointOffset(extract<uint32_t>(header, 96));
+    const uint32_t vlrCount(extract<uint32_t>(header, 100));
+    const uint8_t formatByte(extract<uint8_t>(header, 104));
+    const uint16_t recordLength(extract<uint16_t>(header, 105));
+    uint64_t points(extract<uint32_t>(header, 107));
+
+    // The high bits of the point format flag LAZ compression.
+    const uint8_t format(formatByte & 0x3f);
+    const bool compressed((formatByte & 0xc0) != 0);
+
+    // Waveform formats and extra bytes need a full reader.
+    if (format > 10) return { };
+    if (format == 4 || format == 5 || format == 9 || format == 10) return { };
+    if (recordLength != recordLengths[format]) return { };
+
+    const Scale scale(
+        extract<double>(header, 131),
+        extract<double>(header, 139),
+        extract<double>(header, 147));
+    const Offset offset(
+        extract<double>(header, 155),
+        extract<double>(header, 163),
+        extract<double>(header, 171));
+    const Bounds bounds(
+        extract<double>(header, 187),
+        extract<double>(header, 203),
+        extract<double>(header, 219),
+        extract<double>(header, 179),
+        extract<double>(header, 195),
+        extract<double>(header, 211));
+
+    uint64_t evlrOffset(0);
+    uint32_t evlrCount(0);
+    if (minorVersion >= 4 && headerSize >= maxHeaderSize)
+    {
+        evlrOffset = extract<uint64_t>(header, 235);
+        evlrCount = extract<uint32_t>(header, 243);
+        if (!points) points = extract<uint64_t>(header, 247);
+    }
+
+    std::vector<Vlr> vlrs;
+    if (vlrCount && headerSize < pointOffset)
+    {
+        vlrs = parseVlrs<uint16_t>(
+            a.getBinary(path, getRangeHeader(headerSize, pointOffset)),
+            vlrCount,
+            vlrHeaderSize);
+    }
+    if (evlrCount && evlrOffset)
+    {
+        const std::vector<Vlr> evlrs(
+            parseVlrs<uint64_t>(
+                a.getBinary(path, getRangeHeader(evlrOffset)),
+                evlrCount,
+                evlrHeaderSize));
+        vlrs.insert(vlrs.end(), evlrs.begin(), evlrs.end());
+    }
+
+    std::string wkt;
+    std::string code;
+    bool hasGeoTiff(false);
+    for (const Vlr& vlr : vlrs)
+    {
+        // Extra bytes dimensions need a full reader.
+        if (vlr.userId == "LASF_Spec" && vlr.recordId == 4) return { };
+        if (vlr.userId != "LASF_Projection") continue;
+
+        if (vlr.recordId == 2112)
+        {
+            wkt = extractString(vlr.data, 0, vlr.data.size());
+        }
+        else if (vlr.recordId == 34735)
+        {
+            hasGeoTiff = true;
+            code = getGeoTiffCode(vlr.data);
+        }
+    }
+
+    // The WKT bit of the global encoding selects between the WKT and GeoTIFF
+    // records, if both exist.
+    const bool useWkt(wkt.size() && (globalEncoding & 0x10 || !hasGeoTiff));
+    if (!useWkt && hasGeoTiff && code.empty()) return { };
+
+    pipeline.at(0)["filename"] = path;
+
+    SourceInfo info;
+    info.pipeline = pipeline;
+    info.points = points;
+    info.bounds = bounds;
+    info.schema = setScaleOffset(getSchema(format), ScaleOffset(scale, offset));
+    if (useWkt) info.srs = Srs(wkt);
+    else if (code.size()) info.srs = Srs(code);
+
+    info.metadata = {
+        { "major_version", majorVersion },
+        { "minor_version", minorVersion },
+        { "dataformat_id", format },
+        { "point_length", recordLength },
+        { "compressed", compressed },
+        { "count", points },
+        { "scale_x", scale.x },
+        { "scale_y", scale.y },
+        { "scale_z", scale.z },
+        { "offset_x", offset.x },
+        { "offset_y", offset.y },
+        { "offset_z", offset.z },
+        { "minx", bounds.min().x },
+        { "miny", bounds.min().y },
+        { "minz", bounds.min().z },
+        { "maxx", bounds.max().x },
+        { "maxy", bounds.max().y },
+        { "maxz", bounds.max().z }
+    };
+
+    return info;
+}
+
+bool isNativeCandidate(const json& pipeline)
+{
+    if (!pipeline.is_array() || pipeline.size() != 1) return false;
+
+    const json& reader(pipeline.at(0));
+    const std::string type(reader.value("type", ""));
+    if (type.empty())
+    {
+        const std::string extension(
+            toLower(arbiter::getExtension(reader.value("filename", ""))));
+        if (extension != "las" && extension != "laz") return false;
+    }
+    else if (type != "readers.las") return false;
+
+    for (const auto& p : reader.items())
+    {
+        const std::string& key(p.key());
+        if (
+            key != "type" && key != "filename" &&
+            key != "start" && key != "count")
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::unique_ptr<Decoder> Decoder::create(
+    const std::string& localPath,
+    const pdal::PointLayout& layout,
+    const uint64_t start,
+    const uint64_t count)
+{
+    std::ifstream file(localPath, std::ios::binary);
+    if (!file.good()) throw std::runtime_error("Could not open " + localPath);
+
+    Data header(maxHeaderSize);
+    file.read(header.data(), header.size());
+    header.resize(file.gcount());
+
+    if (header.size() < minHeaderSize || extractString(header, 0, 4) != "LASF")
+    {
+        throw std::runtime_error(
+            "Invalid file signature for .las or .laz file: must be LASF");
+    }
+
+    const uint8_t minorVersion(extract<uint8_t>(header, 25));
+    const uint16_t headerSize(extract<uint16_t>(header, 94));
+    const uint32_t pointOffset(extract<uint32_t>(header, 96));
+    const uint8_t formatByte(extract<uint8_t>(header, 104));
+    const uint16_t recordLength(extract<uint16_t>(header, 105));
+    uint64_t points(extract<uint32_t>(header, 107));
+    if (minorVersion >= 4 && headerSize >= maxHeaderSize && !points)
+    {
+        points = extract<uint64_t>(header, 247);
+    }
+
+    // Compressed data, waveform formats, and extra bytes need a full reader.
+    const uint8_t format(formatByte & 0x3f);
+    if (formatByte & 0xc0) return { };
+    if (format > 10) return { };
+    if (format == 4 || format == 5 || format == 9 || format == 10) return { };
+    if (recordLength != recordLengths[format]) return { };
+
+    const Scale scale(
+        extract<double>(header, 131),
+        extract<double>(header, 139),
+        extract<double>(header, 147));
+    const Offset offset(
+        extract<double>(header, 155),
+        extract<double>(header, 163),
+        extract<double>(header, 171));
+
+    const uint64_t begin(std::min(start, points));
+    const uint64_t remaining(
+        count ? std::min(count, points - begin) : points - begin);
+
+    file.clear();
+    file.seekg(pointOffset + begin * recordLength);
+
+    return std::unique_ptr<Decoder>(
+        new Decoder(
+            std::move(file),
+            getFields(format, scale, offset, layout),
+            recordLength,
+            remaining));
+}
+
+// Matches the fields decoded by readers.las for each of the formats named by
+// getSchema(), in the types of that schema.
+std::vector<Decoder::Field> Decoder::getFields(
+    const uint8_t format,
+    const Scale& scale,
+    const Offset& offset,
+    const pdal::PointLayout& layout)
+{
+    std::vector<std::pair<std::string, Field>> all;
+    const auto add([&all](
+        const std::string& name,
+        const Kind kind,
+        const uint64_t src,
+        const double s = 1,
+        const double o = 0)
+    {
+        Field field;
+        field.kind = kind;
+        field.src = src;
+        field.scale = s;
+        field.offset = o;
+        all.emplace_back(name, field);
+    });
+    const auto bits([&all](
+        const std::string& name,
+        const uint64_t src,
+        const unsigned shift,
+        const unsigned mask)
+    {
+        Field field;
+        field.kind = Kind::Bits;
+        field.src = src;
+        field.shift = shift;
+        field.mask = mask;
+        all.emplace_back(name, field);
+    });
+
+    add("X", Kind::Coordinate, 0, scale.x, offset.x);
+    add("Y", Kind::Coordinate, 4, scale.y, offset.y);
+    add("Z", Kind::Coordinate, 8, scale.z, offset.z);
+    add("Intensity", Kind::Unsigned16, 12);
+
+    if (format < 6)
+    {
+        bits("ReturnNumber", 14, 0, 0x07);
+        bits("NumberOfReturns", 14, 3, 0x07);
+        bits("ScanDirectionFlag", 14, 6, 0x01);
+        bits("EdgeOfFlightLine", 14, 7, 0x01);
+        add("Classification", Kind::Unsigned8, 15);
+        add("ScanAngleRank", Kind::Signed8, 16);
+        add("UserData", Kind::Unsigned8, 17);
+        add("PointSourceId", Kind::Unsigned16, 18);
+
+        if (format == 1 || format == 3) add("GpsTime", Kind::Double, 20);
+
+        const uint64_t color(format == 2 ? 20 : 28);
+        if (format == 2 || format == 3)
+        {
+            add("Red", Kind::Unsigned16, color);
+            add("Green", Kind::Unsigned16, color + 2);
+            add("Blue", Kind::Unsigned16, color + 4);
+        }
+    }
+    else
+    {
+        bits("ReturnNumber", 14, 0, 0x0f);
+        bits("NumberOfReturns", 14, 4, 0x0f);
+        bits("ClassFlags", 15, 0, 0x0f);
+        bits("ScanChannel", 15, 4, 0x03);
+        bits("ScanDirectionFlag", 15, 6, 0x01);
+        bits("EdgeOfFlightLine", 15, 7, 0x01);
+        add("Classification", Kind::Unsigned8, 16);
+        add("UserData", Kind::Unsigned8, 17);
+
+        // The scan angle is in increments of 0.006 degrees.
+        add("ScanAngleRank", Kind::Signed16, 18, 0.006);
+        add("PointSourceId", Kind::Unsigned16, 20);
+        add("GpsTime", Kind::Double, 22);
+
+        if (format >= 7)
+        {
+            add("Red", Kind::Unsigned16, 30);
+            add("Green", Kind::Unsigned16, 32);
+            add("Blue", Kind::Unsigned16, 34);
+        }
+        if (format == 8) add("Infrared", Kind::Unsigned16, 36);
+    }
+
+    std::vector<Field> fields;
+    for (auto& p : all)
+    {
+        const DimId id(layout.findDim(p.first));
+        if (id == DimId::Unknown) continue;
+
+        Field& field(p.second);
+        field.dst = layout.dimOffset(id);
+        field.store = getStore(layout.dimType(id));
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+Decoder::Decoder(
+        std::ifstream file,
+        std::vector<Field> fields,
+        const uint64_t recordLength,
+        const uint64_t remaining)
+    : m_file(std::move(file))
+    , m_fields(std::move(fields))
+    , m_recordLength(recordLength)
+    , m_remaining(remaining)
+{ }
+
+uint64_t Decoder::read(VectorPointTable& table)
+{
+    const uint64_t wanted(std::min<uint64_t>(m_remaining, table.capacity()));
+    if (!wanted) return 0;
+
+    m_records.resize(wanted * m_recordLength);
+    m_file.read(m_records.data(), m_records.size());
+
+    // A truncated file ends our points, as it would for readers.las.
+    const uint64_t np(m_file.gcount() / m_recordLength);
+    m_remaining = np < wanted ? 0 : m_remaining - np;
+
+    const std::size_t pointSize(table.pointSize());
+    std::fill(
+        table.data().begin(),
+        table.data().begin() + np * pointSize,
+        0);
+
+    for (const Field& field : m_fields)
+    {
+        const char* src(m_records.data() + field.src);
+        char* dst(table.data().data() + field.dst);
+        for (
+            uint64_t i(0);
+            i < np;
+            ++i, src += m_recordLength, dst += pointSize)
+        {
+            double v(0);
+            switch (field.kind)
+            {
+                case Kind::Coordinate:
+                    v = get<int32_t>(src) * field.scale + field.offset;
+                    break;
+                case Kind::Unsigned8: v = get<uint8_t>(src); break;
+                case Kind::Unsigned16: v = get<uint16_t>(src); break;
+                case Kind::Signed8: v = get<int8_t>(src); break;
+                case Kind::Signed16:
+                    v = get<int16_t>(src) * field.scale;
+                    break;
+                case Kind::Double: v = get<double>(src); break;
+                case Kind::Bits:
+                    v = (get<uint8_t>(src) >> field.shift) & field.mask;
+                    break;
+            }
+            field.store(dst, v);
+        }
+    }
+
+    return np;
+}
+
+} // namespace las
+} // namespace entwine
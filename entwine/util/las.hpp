@@ -0,0 +1,122 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <pdal/PointLayout.hpp>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/source.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/optional.hpp>
+
+namespace entwine
+{
+namespace las
+{
+
+// Returns true if shallow info for this path and pipeline may be extracted
+// from the LAS header alone, without executing a PDAL pipeline.
+bool isShallowCandidate(
+    const std::string& path,
+    const json& pipelineTemplate,
+    const arbiter::Arbiter& a);
+
+// Extract shallow info for a LAS or LAZ file by fetching and parsing only its
+// header, VLRs, and EVLRs with ranged reads.  Returns nothing if this file
+// needs a full PDAL reader, for example for extra-bytes dimensions or a
+// GeoTIFF SRS which cannot be expressed as EPSG codes.
+optional<SourceInfo> getShallowInfo(
+    const std::string& path,
+    json pipeline,
+    const arbiter::Arbiter& a);
+
+// Returns true if this pipeline is only a LAS reader without options which
+// alter the points it reads, so that its file may be read by a Decoder.
+bool isNativeCandidate(const json& pipeline);
+
+// Decodes the point records of an uncompressed LAS file straight into tables
+// of a packed layout, as readers.las would, but without a PDAL pipeline.  The
+// mapping of each field of the point format to its dimension of the layout,
+// if it has one, is resolved once, and dimensions which the format lacks are
+// zeroed.
+class Decoder
+{
+public:
+    // Returns null if this file needs a full PDAL reader, for example if it
+    // is compressed or has extra bytes or waveform data.  Reads count points
+    // from point index start, or through the end if count is zero.
+    static std::unique_ptr<Decoder> create(
+        const std::string& localPath,
+        const pdal::PointLayout& layout,
+        uint64_t start = 0,
+        uint64_t count = 0);
+
+    // Decode the next points into this table, up to its capacity, returning
+    // the number decoded, which is zero once we are done.
+    uint64_t read(VectorPointTable& table);
+
+private:
+    enum class Kind
+    {
+        Coordinate,
+        Unsigned8,
+        Unsigned16,
+        Signed8,
+        Signed16,
+        Double,
+        Bits
+    };
+
+    // A field at this offset of each record, which for coordinates and for
+    // signed 16-bit values is scaled and offset, and for bit fields is
+    // shifted and masked, and its store into our layout.
+    struct Field
+    {
+        Kind kind = Kind::Unsigned8;
+        uint64_t src = 0;
+        double scale = 1;
+        double offset = 0;
+        unsigned shift = 0;
+        unsigned mask = 0;
+
+        std::size_t dst = 0;
+        void (*store)(char*, double) = nullptr;
+    };
+
+    // The fields of this point format which have dimensions in our layout.
+    static std::vector<Field> getFields(
+        uint8_t format,
+        const Scale& scale,
+        const Offset& offset,
+        const pdal::PointLayout& layout);
+
+    Decoder(
+        std::ifstream file,
+        std::vector<Field> fields,
+        uint64_t recordLength,
+        uint64_t remaining);
+
+    std::ifstream m_file;
+    const std::vector<Field> m_fields;
+    const uint64_t m_recordLength;
+    uint64_t m_remaining;
+    std::vector<char> m_records;
+};
+
+} // namespace las
+} // namespace entwine
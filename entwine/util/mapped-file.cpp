@@ -0,0 +1,65 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/mapped-file.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ENTWINE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace entwine
+{
+
+std::unique_ptr<MappedFile> MappedFile::create(const std::string path)
+{
+#ifdef ENTWINE_MMAP
+    const int fd(::open(path.c_str(), O_RDONLY));
+    if (fd < 0) return std::unique_ptr<MappedFile>();
+
+    // Empty files cannot be mapped.
+    struct stat s;
+    void* data(MAP_FAILED);
+    if (!::fstat(fd, &s) && s.st_size > 0)
+    {
+        data = ::mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    // The mapping remains valid after its descriptor is closed.
+    ::close(fd);
+    if (data == MAP_FAILED) return std::unique_ptr<MappedFile>();
+
+    ::madvise(data, s.st_size, MADV_SEQUENTIAL);
+    return std::unique_ptr<MappedFile>(
+        new MappedFile(static_cast<const char*>(data), s.st_size));
+#else
+    return std::unique_ptr<MappedFile>();
+#endif
+}
+
+std::unique_ptr<MappedFile> MappedFile::create(
+    const arbiter::Endpoint& ep,
+    const std::string& path)
+{
+    if (!ep.isLocal()) return std::unique_ptr<MappedFile>();
+    return create(arbiter::expandTilde(ep.fullPath(path)));
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef ENTWINE_MMAP
+    ::munmap(const_cast<char*>(m_data), m_size);
+#endif
+}
+
+} // namespace entwine
@@ -0,0 +1,51 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+
+namespace entwine
+{
+
+// A read-only memory mapping of an entire local file, advised for sequential
+// access, so it may be read without copying it to the heap.  Only supported
+// on POSIX systems - elsewhere, or if the file cannot be mapped, create()
+// returns null and callers should fall back to reading the file.
+class MappedFile
+{
+public:
+    static std::unique_ptr<MappedFile> create(std::string path);
+
+    // Map this path within a local endpoint, or return null for remote ones.
+    static std::unique_ptr<MappedFile> create(
+        const arbiter::Endpoint& ep,
+        const std::string& path);
+
+    ~MappedFile();
+
+    const char* data() const { return m_data; }
+    uint64_t size() const { return m_size; }
+
+private:
+    MappedFile(const char* data, uint64_t size) : m_data(data), m_size(size) { }
+
+    const char* const m_data;
+    const uint64_t m_size;
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+} // namespace entwine
@@ -0,0 +1,90 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/mem-file.hpp>
+
+#include <cerrno>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace entwine
+{
+
+std::unique_ptr<MemFile> MemFile::create(const std::string name)
+{
+#if defined(__linux__) && defined(SYS_memfd_create)
+    const long fd(syscall(SYS_memfd_create, name.c_str(), 0));
+    if (fd >= 0)
+    {
+        return std::unique_ptr<MemFile>(new MemFile(static_cast<int>(fd)));
+    }
+#endif
+    return std::unique_ptr<MemFile>();
+}
+
+MemFile::~MemFile()
+{
+#ifdef __linux__
+    ::close(m_fd);
+#endif
+}
+
+std::string MemFile::path() const
+{
+    return "/proc/self/fd/" + std::to_string(m_fd);
+}
+
+std::vector<char> MemFile::read() const
+{
+    std::vector<char> data;
+#ifdef __linux__
+    struct stat info;
+    if (::fstat(m_fd, &info) != 0) throw std::runtime_error("Failed to stat");
+    data.resize(info.st_size);
+
+    std::size_t pos(0);
+    while (pos < data.size())
+    {
+        const ssize_t n(
+            ::pread(m_fd, data.data() + pos, data.size() - pos, pos));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw std::runtime_error("Failed to read memory file");
+        pos += n;
+    }
+#endif
+    return data;
+}
+
+void MemFile::write(const std::vector<char>& data)
+{
+#ifdef __linux__
+    if (::ftruncate(m_fd, 0) != 0)
+    {
+        throw std::runtime_error("Failed to truncate memory file");
+    }
+
+    std::size_t pos(0);
+    while (pos < data.size())
+    {
+        const ssize_t n(
+            ::pwrite(m_fd, data.data() + pos, data.size() - pos, pos));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw std::runtime_error("Failed to write memory file");
+        pos += n;
+    }
+#endif
+}
+
+} // namespace entwine
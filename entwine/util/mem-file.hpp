@@ -0,0 +1,44 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace entwine
+{
+
+// An anonymous file which lives entirely in memory, for handing data to
+// libraries which can only read and write by path.  The file is reachable at
+// path() until this object is destroyed.  Only supported on Linux - elsewhere,
+// create() returns null and callers should fall back to a temporary file.
+class MemFile
+{
+public:
+    static std::unique_ptr<MemFile> create(std::string name);
+    ~MemFile();
+
+    std::string path() const;
+
+    std::vector<char> read() const;
+    void write(const std::vector<char>& data);
+
+private:
+    explicit MemFile(int fd) : m_fd(fd) { }
+
+    const int m_fd;
+
+    MemFile(const MemFile&) = delete;
+    MemFile& operator=(const MemFile&) = delete;
+};
+
+} // namespace entwine
@@ -0,0 +1,162 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/metrics-server.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ENTWINE_SOCKETS
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Writes to a closed connection should fail rather than raise SIGPIPE.
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+namespace entwine
+{
+
+namespace
+{
+
+// How often our serving thread checks whether it should stop.
+const int pollMs(250);
+
+// Requests which are slower than this to arrive are dropped.
+const int requestTimeoutSeconds(2);
+
+std::string response(const std::string& status, const std::string& body)
+{
+    return
+        "HTTP/1.1 " + status + "\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n"
+        "\r\n" + body;
+}
+
+} // unnamed namespace
+
+MetricsServer::MetricsServer(const uint64_t port, Render render)
+    : m_render(render)
+{
+#ifdef ENTWINE_SOCKETS
+    m_socket = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (m_socket < 0) throw std::runtime_error("Could not create socket");
+
+    const int yes(1);
+    ::setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    if (
+        ::bind(
+            m_socket,
+            reinterpret_cast<sockaddr*>(&address),
+            sizeof(address)) < 0 ||
+        ::listen(m_socket, 8) < 0)
+    {
+        ::close(m_socket);
+        throw std::runtime_error(
+            "Could not serve metrics on port " + std::to_string(port) +
+            ": " + std::strerror(errno));
+    }
+
+    m_thread = std::thread([this]() { serve(); });
+#else
+    throw std::runtime_error("Metrics server is not supported on this system");
+#endif
+}
+
+MetricsServer::~MetricsServer()
+{
+#ifdef ENTWINE_SOCKETS
+    m_done = true;
+    if (m_thread.joinable()) m_thread.join();
+    ::close(m_socket);
+#endif
+}
+
+void MetricsServer::serve()
+{
+#ifdef ENTWINE_SOCKETS
+    while (!m_done)
+    {
+        pollfd p;
+        p.fd = m_socket;
+        p.events = POLLIN;
+        if (::poll(&p, 1, pollMs) <= 0) continue;
+
+        const int client(::accept(m_socket, nullptr, nullptr));
+        if (client < 0) continue;
+
+        try { respond(client); }
+        catch (std::exception& e)
+        {
+            std::cout << "Metrics request failed: " << e.what() << std::endl;
+        }
+        ::close(client);
+    }
+#endif
+}
+
+void MetricsServer::respond(const int client)
+{
+#ifdef ENTWINE_SOCKETS
+    timeval timeout;
+    timeout.tv_sec = requestTimeoutSeconds;
+    timeout.tv_usec = 0;
+    ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // We only need the request line, so read until we have it.
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n") == std::string::npos && request.size() < 8192)
+    {
+        const ssize_t n(::recv(client, buffer, sizeof(buffer), 0));
+        if (n <= 0) return;
+        request.append(buffer, n);
+    }
+
+    const std::string line(request.substr(0, request.find("\r\n")));
+    const bool found(
+        line.compare(0, 13, "GET /metrics ") == 0 ||
+        line.compare(0, 13, "GET /metrics?") == 0);
+
+    const std::string out(found
+        ? response("200 OK", m_render())
+        : response("404 Not Found", "Not found\n"));
+
+    std::size_t sent(0);
+    while (sent < out.size())
+    {
+        const ssize_t n(
+            ::send(client, out.data() + sent, out.size() - sent, MSG_NOSIGNAL));
+        if (n <= 0) return;
+        sent += n;
+    }
+#endif
+}
+
+} // namespace entwine
@@ -0,0 +1,48 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace entwine
+{
+
+// A minimal HTTP server, on its own thread, which answers GET requests for
+// /metrics with the text produced by our callback, in the Prometheus text
+// exposition format.  Requests are served one at a time, which suffices for
+// a few scrapers.  Only supported on POSIX systems - elsewhere, construction
+// throws.
+class MetricsServer
+{
+public:
+    using Render = std::function<std::string()>;
+
+    MetricsServer(uint64_t port, Render render);
+    ~MetricsServer();
+
+private:
+    void serve();
+    void respond(int client);
+
+    const Render m_render;
+    int m_socket = -1;
+    std::atomic_bool m_done{ false };
+    std::thread m_thread;
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+};
+
+} // namespace entwine
@@ -0,0 +1,315 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/metrics.hpp>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+
+#include <entwine/util/spin-lock.hpp>
+
+namespace entwine
+{
+namespace metrics
+{
+
+namespace
+{
+
+double toSeconds(const uint64_t ns) { return ns / 1000000000.0; }
+
+// Prometheus metric names are conventionally snake case.
+std::string toSnake(const std::string s)
+{
+    std::string result;
+    for (const char c : s)
+    {
+        if (std::isupper(c))
+        {
+            result.push_back('_');
+            result.push_back(std::tolower(c));
+        }
+        else result.push_back(c);
+    }
+    return result;
+}
+
+} // unnamed namespace
+
+void addSince(const Timer t, const perf::Sample& start)
+{
+    perf::Sample end;
+    if (!perf::read(end)) return;
+
+    HardwareData& data(hardware()[static_cast<std::size_t>(t)]);
+    for (std::size_t i(0); i < perf::eventCount; ++i)
+    {
+        data[i].fetch_add(end[i] - start[i], std::memory_order_relaxed);
+    }
+}
+
+std::string toString(const Timer t)
+{
+    switch (t)
+    {
+        case Timer::Read: return "read";
+        case Timer::Insert: return "insert";
+        case Timer::Clip: return "clip";
+        case Timer::ClipWait: return "clipWait";
+        case Timer::Serialize: return "serialize";
+        case Timer::Compress: return "compress";
+        case Timer::Upload: return "upload";
+        case Timer::HierarchySave: return "hierarchySave";
+        case Timer::RateLimitWait: return "rateLimitWait";
+    }
+    return "unknown";
+}
+
+std::string toString(const Counter c)
+{
+    switch (c)
+    {
+        case Counter::ChunkHits: return "chunkHits";
+        case Counter::ChunkMisses: return "chunkMisses";
+        case Counter::ChunkRewakes: return "chunkRewakes";
+        case Counter::ChunkReclaims: return "chunkReclaims";
+        case Counter::ChunkWrites: return "chunkWrites";
+        case Counter::ChunkSkips: return "chunkSkips";
+        case Counter::BytesRead: return "bytesRead";
+        case Counter::BytesWritten: return "bytesWritten";
+        case Counter::ReadCacheHits: return "readCacheHits";
+        case Counter::ReadCacheMisses: return "readCacheMisses";
+        case Counter::SourcesInserted: return "sourcesInserted";
+        case Counter::SourceErrors: return "sourceErrors";
+        case Counter::SourceRetries: return "sourceRetries";
+        case Counter::Duplicates: return "duplicates";
+        case Counter::TooDeep: return "tooDeep";
+        case Counter::OutOfBounds: return "outOfBounds";
+        case Counter::OutOfSubset: return "outOfSubset";
+        case Counter::Throttles: return "throttles";
+    }
+    return "unknown";
+}
+
+std::string toString(const Gauge g)
+{
+    switch (g)
+    {
+        case Gauge::SerializeQueue: return "serializeQueue";
+        case Gauge::UploadQueue: return "uploadQueue";
+        case Gauge::ResidentBytes: return "residentBytes";
+        case Gauge::ChunksAlive: return "chunksAlive";
+    }
+    return "unknown";
+}
+
+std::string toString(const Histogram h)
+{
+    switch (h)
+    {
+        case Histogram::ChunkSave: return "chunkSave";
+        case Histogram::ChunkLoad: return "chunkLoad";
+    }
+    return "unknown";
+}
+
+std::string toString(const Memory m)
+{
+    switch (m)
+    {
+        case Memory::ChunkPoints: return "chunkPoints";
+        case Memory::ChunkGrids: return "chunkGrids";
+        case Memory::Overflows: return "overflows";
+        case Memory::Tables: return "tables";
+        case Memory::Hierarchy: return "hierarchy";
+        case Memory::Serialized: return "serialized";
+    }
+    return "unknown";
+}
+
+json get()
+{
+    json j {
+        { "times", json::object() },
+        { "counts", json::object() },
+        { "levels", json::object() },
+        { "latencies", json::object() },
+        { "lockWaits", json::object() }
+    };
+
+    for (std::size_t i(0); i < timerCount; ++i)
+    {
+        j["times"][toString(static_cast<Timer>(i))] =
+            toSeconds(timers()[i].load());
+    }
+    for (std::size_t i(0); i < counterCount; ++i)
+    {
+        j["counts"][toString(static_cast<Counter>(i))] = counters()[i].load();
+    }
+    for (std::size_t i(0); i < gaugeCount; ++i)
+    {
+        j["levels"][toString(static_cast<Gauge>(i))] = gauges()[i].load();
+    }
+    for (std::size_t i(0); i < histogramCount; ++i)
+    {
+        // Only occupied buckets are listed, keyed by their upper bounds in
+        // seconds.
+        const HistogramData& data(histograms()[i]);
+        json buckets = json::object();
+        uint64_t count(0);
+        for (std::size_t b(0); b < histogramBuckets; ++b)
+        {
+            const uint64_t n(data.buckets[b].load());
+            if (!n) continue;
+            count += n;
+            buckets[std::to_string(toSeconds((1ull << b) * 1000))] = n;
+        }
+
+        j["latencies"][toString(static_cast<Histogram>(i))] = {
+            { "count", count },
+            { "seconds", toSeconds(data.sum.load()) },
+            { "buckets", buckets }
+        };
+    }
+
+    // Hardware events are only listed while they are counted.
+    for (std::size_t i(0); perf::enabled() && i < timerCount; ++i)
+    {
+        json& events(j["hardware"][toString(static_cast<Timer>(i))]);
+        for (std::size_t e(0); e < perf::eventCount; ++e)
+        {
+            events[perf::toString(static_cast<perf::Event>(e))] =
+                hardware()[i][e].load();
+        }
+    }
+
+    // Attributions are only listed while they are tracked, with their peaks.
+    for (std::size_t i(0); trackingMemory() && i < memoryCount; ++i)
+    {
+        const MemoryData& data(memory()[i]);
+        j["memory"][toString(static_cast<Memory>(i))] = {
+            { "bytes", std::max<int64_t>(data.bytes.load(), 0) },
+            { "peak", data.peak.load() }
+        };
+    }
+
+    const lockstats::Counts waits(lockstats::waits());
+    for (std::size_t i(0); i < waits.size(); ++i)
+    {
+        j["lockWaits"][lockstats::toString(static_cast<LockType>(i))] =
+            toSeconds(waits[i]);
+    }
+
+    return j;
+}
+
+std::string toPrometheus()
+{
+    std::ostringstream os;
+
+    os << "# TYPE entwine_phase_seconds_total counter\n";
+    for (std::size_t i(0); i < timerCount; ++i)
+    {
+        os << "entwine_phase_seconds_total{phase=\"" <<
+            toString(static_cast<Timer>(i)) << "\"} " <<
+            toSeconds(timers()[i].load()) << "\n";
+    }
+
+    for (std::size_t i(0); i < counterCount; ++i)
+    {
+        const std::string name(
+            "entwine_" + toSnake(toString(static_cast<Counter>(i))) +
+            "_total");
+        os << "# TYPE " << name << " counter\n" <<
+            name << " " << counters()[i].load() << "\n";
+    }
+
+    for (std::size_t i(0); i < gaugeCount; ++i)
+    {
+        const std::string name(
+            "entwine_" + toSnake(toString(static_cast<Gauge>(i))));
+        os << "# TYPE " << name << " gauge\n" <<
+            name << " " << gauges()[i].load() << "\n";
+    }
+
+    for (std::size_t i(0); i < histogramCount; ++i)
+    {
+        const HistogramData& data(histograms()[i]);
+        const std::string name(
+            "entwine_" + toSnake(toString(static_cast<Histogram>(i))) +
+            "_seconds");
+        os << "# TYPE " << name << " histogram\n";
+
+        uint64_t count(0);
+        for (std::size_t b(0); b < histogramBuckets; ++b)
+        {
+            count += data.buckets[b].load();
+            os << name << "_bucket{le=\"" <<
+                toSeconds((1ull << b) * 1000) << "\"} " << count << "\n";
+        }
+        os << name << "_bucket{le=\"+Inf\"} " << count << "\n" <<
+            name << "_sum " << toSeconds(data.sum.load()) << "\n" <<
+            name << "_count " << count << "\n";
+    }
+
+    if (perf::enabled())
+    {
+        os << "# TYPE entwine_phase_events_total counter\n";
+        for (std::size_t i(0); i < timerCount; ++i)
+        {
+            for (std::size_t e(0); e < perf::eventCount; ++e)
+            {
+                os << "entwine_phase_events_total{phase=\"" <<
+                    toString(static_cast<Timer>(i)) << "\",event=\"" <<
+                    toSnake(perf::toString(static_cast<perf::Event>(e))) <<
+                    "\"} " << hardware()[i][e].load() << "\n";
+            }
+        }
+    }
+
+    if (trackingMemory())
+    {
+        os << "# TYPE entwine_memory_bytes gauge\n";
+        for (std::size_t i(0); i < memoryCount; ++i)
+        {
+            os << "entwine_memory_bytes{subsystem=\"" <<
+                toString(static_cast<Memory>(i)) << "\"} " <<
+                std::max<int64_t>(memory()[i].bytes.load(), 0) << "\n";
+        }
+    }
+
+    os << "# TYPE entwine_lock_wait_seconds_total counter\n";
+    const lockstats::Counts waits(lockstats::waits());
+    for (std::size_t i(0); i < waits.size(); ++i)
+    {
+        os << "entwine_lock_wait_seconds_total{lock=\"" <<
+            lockstats::toString(static_cast<LockType>(i)) << "\"} " <<
+            toSeconds(waits[i]) << "\n";
+    }
+
+    return os.str();
+}
+
+uint64_t peakRss()
+{
+    struct rusage usage;
+    if (::getrusage(RUSAGE_SELF, &usage)) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024;
+#endif
+}
+
+} // namespace metrics
+} // namespace entwine
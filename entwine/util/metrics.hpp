@@ -0,0 +1,382 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <entwine/util/json.hpp>
+#include <entwine/util/perf.hpp>
+
+namespace entwine
+{
+namespace metrics
+{
+
+// Cumulative time spent in each phase of a build, summed over all threads.
+// Phases may nest: serialization includes compression, and also the upload
+// when there are no dedicated upload threads.  Clip waits are the time spent
+// by inserting threads blocked while queueing chunks for serialization.
+enum class Timer
+{
+    Read,
+    Insert,
+    Clip,
+    ClipWait,
+    Serialize,
+    Compress,
+    Upload,
+    HierarchySave,
+    RateLimitWait
+};
+
+// Cumulative event counts.  A chunk cache miss is a reference to a chunk which
+// was not resident, and a rewake is a miss which needed to fetch the chunk's
+// previously serialized data.  A reclaim is a hit on a chunk which had been
+// released by all threads but not yet evicted.  Points read but rejected are
+// counted by the bounds which rejected them, and points discarded at the
+// maximum depth are too deep.  Throttles are failures of requests which
+// storage asked us to slow down.
+enum class Counter
+{
+    ChunkHits,
+    ChunkMisses,
+    ChunkRewakes,
+    ChunkReclaims,
+    ChunkWrites,
+    ChunkSkips,
+    BytesRead,
+    BytesWritten,
+    ReadCacheHits,
+    ReadCacheMisses,
+    SourcesInserted,
+    SourceErrors,
+    SourceRetries,
+    Duplicates,
+    TooDeep,
+    OutOfBounds,
+    OutOfSubset,
+    Throttles
+};
+
+// Instantaneous levels.
+enum class Gauge
+{
+    SerializeQueue,
+    UploadQueue,
+    ResidentBytes,
+    ChunksAlive
+};
+
+// Distributions of the latency of individual operations, in buckets whose
+// upper bounds are successive powers of two microseconds.
+enum class Histogram
+{
+    ChunkSave,
+    ChunkLoad
+};
+
+// Bytes currently allocated on behalf of each subsystem, which are only
+// attributed while memory tracking is enabled.  Chunk points and chunk grids
+// are the point data and voxel grids of resident chunks, overflows are the
+// points held by chunks for their children, tables are the other point data
+// being read or serialized, and serialized nodes are those pending upload,
+// held by the node cache, or fetched ahead by the node prefetcher.
+enum class Memory
+{
+    ChunkPoints,
+    ChunkGrids,
+    Overflows,
+    Tables,
+    Hierarchy,
+    Serialized
+};
+
+static constexpr std::size_t timerCount = 9;
+static constexpr std::size_t counterCount = 18;
+static constexpr std::size_t gaugeCount = 4;
+static constexpr std::size_t histogramCount = 2;
+static constexpr std::size_t memoryCount = 6;
+static constexpr std::size_t histogramBuckets = 32;
+
+using Clock = std::chrono::steady_clock;
+
+inline std::array<std::atomic_uint64_t, timerCount>& timers()
+{
+    static std::array<std::atomic_uint64_t, timerCount> t{ };
+    return t;
+}
+
+// Hardware events counted during each phase, summed over all threads, while
+// perf counting is enabled.  Like their times, the events of nested phases
+// are also counted by the phases which contain them.
+using HardwareData = std::array<std::atomic_uint64_t, perf::eventCount>;
+
+inline std::array<HardwareData, timerCount>& hardware()
+{
+    static std::array<HardwareData, timerCount> h{ };
+    return h;
+}
+
+inline std::array<std::atomic_uint64_t, counterCount>& counters()
+{
+    static std::array<std::atomic_uint64_t, counterCount> c{ };
+    return c;
+}
+
+inline std::array<std::atomic_int64_t, gaugeCount>& gauges()
+{
+    static std::array<std::atomic_int64_t, gaugeCount> g{ };
+    return g;
+}
+
+struct HistogramData
+{
+    std::array<std::atomic_uint64_t, histogramBuckets> buckets{ };
+    std::atomic_uint64_t sum{ 0 };
+};
+
+inline std::array<HistogramData, histogramCount>& histograms()
+{
+    static std::array<HistogramData, histogramCount> h{ };
+    return h;
+}
+
+struct MemoryData
+{
+    std::atomic_int64_t bytes{ 0 };
+    std::atomic_int64_t peak{ 0 };
+};
+
+inline std::array<MemoryData, memoryCount>& memory()
+{
+    static std::array<MemoryData, memoryCount> m{ };
+    return m;
+}
+
+inline std::atomic_bool& memoryTracking()
+{
+    static std::atomic_bool enabled{ false };
+    return enabled;
+}
+
+// Enable memory tracking for the rest of this process.  This should be done
+// before anything is allocated, since only the allocations made afterward are
+// attributed.
+inline void trackMemory(bool enable) { memoryTracking() = enable; }
+inline bool trackingMemory()
+{
+    return memoryTracking().load(std::memory_order_relaxed);
+}
+
+// Attribute some bytes, or release them if negative, if we are tracking.
+inline void add(Memory m, int64_t delta)
+{
+    if (!trackingMemory()) return;
+
+    MemoryData& data(memory()[static_cast<std::size_t>(m)]);
+    const int64_t bytes(
+        data.bytes.fetch_add(delta, std::memory_order_relaxed) + delta);
+
+    int64_t peak(data.peak.load(std::memory_order_relaxed));
+    while (
+        bytes > peak &&
+        !data.peak.compare_exchange_weak(
+            peak,
+            bytes,
+            std::memory_order_relaxed))
+    { }
+}
+
+// Bytes attributed to a subsystem on behalf of a single owner, which are
+// released along with it.  Only bytes added while tracking are attributed, so
+// enabling tracking midway never releases more than was attributed.
+class MemoryCharge
+{
+public:
+    explicit MemoryCharge(Memory m) : m_memory(m) { }
+    MemoryCharge(MemoryCharge&& other) noexcept
+        : m_memory(other.m_memory)
+        , m_bytes(other.m_bytes)
+    {
+        other.m_bytes = 0;
+    }
+    ~MemoryCharge() { release(); }
+
+    void add(uint64_t bytes)
+    {
+        if (!trackingMemory()) return;
+        m_bytes += bytes;
+        metrics::add(m_memory, bytes);
+    }
+
+    void release()
+    {
+        if (!m_bytes) return;
+        metrics::add(m_memory, -static_cast<int64_t>(m_bytes));
+        m_bytes = 0;
+    }
+
+private:
+    const Memory m_memory;
+    uint64_t m_bytes = 0;
+
+    MemoryCharge(const MemoryCharge&) = delete;
+    MemoryCharge& operator=(const MemoryCharge&) = delete;
+};
+
+// A standard allocator which attributes the bytes of a container to a
+// subsystem.  If tracking is enabled after some allocations have been made,
+// their release may briefly make the attribution negative.
+template <typename T, Memory M>
+class Allocator
+{
+public:
+    using value_type = T;
+
+    template <typename U> struct rebind { using other = Allocator<U, M>; };
+
+    Allocator() = default;
+    template <typename U> Allocator(const Allocator<U, M>&) { }
+
+    T* allocate(std::size_t n)
+    {
+        add(M, n * sizeof(T));
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        add(M, -static_cast<int64_t>(n * sizeof(T)));
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U> bool operator==(const Allocator<U, M>&) const
+    {
+        return true;
+    }
+    template <typename U> bool operator!=(const Allocator<U, M>&) const
+    {
+        return false;
+    }
+};
+
+// Record some nanoseconds spent in this phase.
+inline void add(Timer t, uint64_t ns)
+{
+    timers()[static_cast<std::size_t>(t)].fetch_add(
+        ns,
+        std::memory_order_relaxed);
+}
+
+// Record the hardware events of the calling thread since this sample, taken
+// by the same thread, in this phase.
+void addSince(Timer t, const perf::Sample& start);
+
+inline void add(Counter c, uint64_t n = 1)
+{
+    counters()[static_cast<std::size_t>(c)].fetch_add(
+        n,
+        std::memory_order_relaxed);
+}
+
+inline void add(Gauge g, int64_t delta)
+{
+    gauges()[static_cast<std::size_t>(g)].fetch_add(
+        delta,
+        std::memory_order_relaxed);
+}
+
+inline uint64_t nanosSince(Clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start).count();
+}
+
+// Record an operation which took this many nanoseconds.  Bucket i holds
+// durations of less than 2^i microseconds, and at least half of that, except
+// that the last also holds anything longer.
+inline void observe(Histogram h, uint64_t ns)
+{
+    std::size_t bucket(0);
+    for (uint64_t us(ns / 1000); us && bucket + 1 < histogramBuckets; us >>= 1)
+    {
+        ++bucket;
+    }
+
+    HistogramData& data(histograms()[static_cast<std::size_t>(h)]);
+    data.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    data.sum.fetch_add(ns, std::memory_order_relaxed);
+}
+
+// Adds the lifetime of this object to a phase, along with the hardware events
+// of its thread meanwhile if perf counting is enabled.
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(Timer t)
+        : m_timer(t)
+        , m_start(Clock::now())
+        , m_counting(perf::enabled() && perf::read(m_sample))
+    { }
+    ~ScopedTimer()
+    {
+        add(m_timer, nanosSince(m_start));
+        if (m_counting) addSince(m_timer, m_sample);
+    }
+
+private:
+    const Timer m_timer;
+    const Clock::time_point m_start;
+    perf::Sample m_sample;
+    const bool m_counting;
+
+    ScopedTimer(const ScopedTimer& other) = delete;
+};
+
+// Observes the lifetime of this object in a histogram.
+class ScopedLatency
+{
+public:
+    explicit ScopedLatency(Histogram h) : m_histogram(h), m_start(Clock::now())
+    { }
+    ~ScopedLatency() { observe(m_histogram, nanosSince(m_start)); }
+
+private:
+    const Histogram m_histogram;
+    const Clock::time_point m_start;
+
+    ScopedLatency(const ScopedLatency& other) = delete;
+};
+
+std::string toString(Timer t);
+std::string toString(Counter c);
+std::string toString(Gauge g);
+std::string toString(Histogram h);
+std::string toString(Memory m);
+
+// A snapshot of everything recorded during this process, with times in
+// seconds, including the time spent waiting on each type of lock.
+json get();
+
+// The same snapshot in the Prometheus text exposition format.
+std::string toPrometheus();
+
+// The peak resident memory of this process so far, in bytes.
+uint64_t peakRss();
+
+} // namespace metrics
+} // namespace entwine
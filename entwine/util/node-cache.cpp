@@ -0,0 +1,211 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/node-cache.hpp>
+
+#include <stdexcept>
+
+#include <zstd.h>
+
+#include <entwine/util/metrics.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+// Favor speed, since these nodes are likely to be woken up again soon.
+const int compressionLevel(1);
+
+std::string getStem(const std::string& path)
+{
+    return path.substr(0, path.rfind('.'));
+}
+
+bool needsCompression(const std::string& path)
+{
+    return path.size() >= 4 && !path.compare(path.size() - 4, 4, ".bin");
+}
+
+std::vector<char> compress(const std::vector<char>& data)
+{
+    std::vector<char> out(ZSTD_compressBound(data.size()));
+    const std::size_t size(
+        ZSTD_compress(
+            out.data(),
+            out.size(),
+            data.data(),
+            data.size(),
+            compressionLevel));
+    if (ZSTD_isError(size)) throw std::runtime_error(ZSTD_getErrorName(size));
+    out.resize(size);
+    return out;
+}
+
+std::vector<char> decompress(const std::vector<char>& data)
+{
+    const unsigned long long size(
+        ZSTD_getFrameContentSize(data.data(), data.size()));
+    if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR)
+    {
+        throw std::runtime_error("Invalid cached node data");
+    }
+
+    std::vector<char> out(size);
+    const std::size_t result(
+        ZSTD_decompress(out.data(), out.size(), data.data(), data.size()));
+    if (ZSTD_isError(result) || result != size)
+    {
+        throw std::runtime_error("Invalid cached node data");
+    }
+    return out;
+}
+
+} // unnamed namespace
+
+NodeCache::NodeCache(const uint64_t maxBytes, const Write write)
+    : m_maxBytes(maxBytes)
+    , m_write(write)
+{ }
+
+void NodeCache::put(const std::string& path, std::vector<char> data)
+{
+    Entry entry;
+    entry.path = path;
+    entry.compressed = needsCompression(path);
+    entry.data = entry.compressed ? compress(data) : std::move(data);
+
+    const std::string stem(getStem(path));
+    std::vector<Entry> evicted;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const int64_t before(m_bytes);
+
+        auto it(m_entries.find(stem));
+        if (it != m_entries.end())
+        {
+            m_bytes -= it->second.data.size();
+            m_lru.erase(it->second.lru);
+            m_entries.erase(it);
+        }
+
+        m_bytes += entry.data.size();
+        m_lru.push_back(stem);
+        entry.lru = std::prev(m_lru.end());
+        m_entries.emplace(stem, std::move(entry));
+
+        // Mark our evicted nodes as being written while still holding our
+        // lock, so no one can miss them in the meantime.
+        while (m_bytes > m_maxBytes && m_lru.size() > 1)
+        {
+            const std::string oldest(m_lru.front());
+            m_lru.pop_front();
+
+            auto e(m_entries.find(oldest));
+            m_bytes -= e->second.data.size();
+            evicted.push_back(std::move(e->second));
+            m_entries.erase(e);
+            m_writing.insert(oldest);
+        }
+
+        metrics::add(metrics::Memory::Serialized, int64_t(m_bytes) - before);
+    }
+
+    write(evicted);
+}
+
+optional<std::vector<char>> NodeCache::take(const std::string& path)
+{
+    const std::string stem(getStem(path));
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&]() { return !m_writing.count(stem); });
+
+    auto it(m_entries.find(stem));
+    if (it == m_entries.end() || it->second.path != path) return { };
+
+    Entry entry(std::move(it->second));
+    m_bytes -= entry.data.size();
+    metrics::add(metrics::Memory::Serialized, -int64_t(entry.data.size()));
+    m_lru.erase(entry.lru);
+    m_entries.erase(it);
+    lock.unlock();
+
+    if (entry.compressed) return decompress(entry.data);
+    return std::move(entry.data);
+}
+
+bool NodeCache::holds(const std::string& stem)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.count(stem);
+}
+
+void NodeCache::wait(const std::string& stem)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&]() { return !m_writing.count(stem); });
+}
+
+void NodeCache::flush()
+{
+    std::vector<Entry> evicted;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& p : m_entries)
+        {
+            m_writing.insert(p.first);
+            evicted.push_back(std::move(p.second));
+        }
+        m_entries.clear();
+        m_lru.clear();
+        metrics::add(metrics::Memory::Serialized, -int64_t(m_bytes));
+        m_bytes = 0;
+    }
+
+    write(evicted);
+}
+
+void NodeCache::write(std::vector<Entry>& evicted)
+{
+    const auto done([this, &evicted](std::size_t begin, std::size_t end)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (std::size_t i(begin); i < end; ++i)
+            {
+                m_writing.erase(getStem(evicted[i].path));
+            }
+        }
+        m_cv.notify_all();
+    });
+
+    for (std::size_t i(0); i < evicted.size(); ++i)
+    {
+        Entry& entry(evicted[i]);
+        try
+        {
+            if (entry.compressed) entry.data = decompress(entry.data);
+            m_write(entry.path, std::move(entry.data));
+        }
+        catch (...)
+        {
+            // Release any waiters on the nodes we will not write.
+            done(i, evicted.size());
+            throw;
+        }
+        done(i, i + 1);
+    }
+}
+
+} // namespace entwine
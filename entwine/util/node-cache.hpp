@@ -0,0 +1,84 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <entwine/util/optional.hpp>
+
+namespace entwine
+{
+
+// A bounded write-back cache of serialized nodes, which are held in memory
+// in compressed form rather than being written out immediately.  A node which
+// is woken up again is taken from here instead of being fetched, and only the
+// nodes which are evicted from here, or which remain at flush(), are written.
+//
+// Nodes are keyed by their path without its extension.  Data which is not
+// already compressed, i.e. binary nodes, is compressed with zstandard.
+class NodeCache
+{
+public:
+    using Write = std::function<void(const std::string&, std::vector<char>)>;
+
+    // Evicted nodes are passed to this function to be written.
+    NodeCache(uint64_t maxBytes, Write write);
+
+    // Hold the data for this path, evicting the least recently stored nodes
+    // while we are over budget.
+    void put(const std::string& path, std::vector<char> data);
+
+    // Take the data for this path, if we hold it.  Our copy is released, so
+    // whoever takes a node holds its only copy until it is put again.
+    optional<std::vector<char>> take(const std::string& path);
+
+    // Whether we hold the node at this path, without its extension, which
+    // has not been written since it was put.
+    bool holds(const std::string& stem);
+
+    // Wait until the node at this path, without its extension, is not being
+    // written as a result of its eviction.
+    void wait(const std::string& stem);
+
+    // Write every node we hold.
+    void flush();
+
+private:
+    struct Entry
+    {
+        std::string path;
+        std::vector<char> data;
+        bool compressed = false;
+        std::list<std::string>::iterator lru;
+    };
+
+    void write(std::vector<Entry>& evicted);
+
+    const uint64_t m_maxBytes;
+    const Write m_write;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::map<std::string, Entry> m_entries;
+    std::list<std::string> m_lru;
+    std::set<std::string> m_writing;
+    uint64_t m_bytes = 0;
+};
+
+} // namespace entwine
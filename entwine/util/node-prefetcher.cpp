@@ -0,0 +1,159 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/node-prefetcher.hpp>
+
+#include <algorithm>
+
+#include <entwine/util/metrics.hpp>
+
+namespace entwine
+{
+
+NodePrefetcher::NodePrefetcher(
+        const arbiter::Endpoint& ep,
+        const uint64_t threads,
+        const uint64_t maxBytes)
+    : m_endpoint(ep)
+    , m_maxBytes(maxBytes)
+{
+    for (uint64_t i(0); i < std::max<uint64_t>(threads, 1); ++i)
+    {
+        m_threads.emplace_back([this]() { run(); });
+    }
+}
+
+NodePrefetcher::~NodePrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_queue.clear();
+    }
+    m_cv.notify_all();
+    for (std::thread& t : m_threads) t.join();
+
+    metrics::add(metrics::Memory::Serialized, -int64_t(m_bytes));
+}
+
+bool NodePrefetcher::fetch(const std::string& path, const uint64_t estimate)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_done.count(path) || m_entries.count(path)) return true;
+
+        while (!m_order.empty() && !m_entries.count(m_order.front()))
+        {
+            m_order.pop_front();
+        }
+        while (m_bytes + estimate > m_maxBytes && !m_order.empty())
+        {
+            auto it(m_entries.find(m_order.front()));
+            if (it != m_entries.end())
+            {
+                if (!it->second.ready) break;
+                erase(it);
+            }
+            m_order.pop_front();
+        }
+        if (m_bytes + estimate > m_maxBytes) return false;
+
+        m_bytes += estimate;
+        metrics::add(metrics::Memory::Serialized, estimate);
+
+        m_entries[path].bytes = estimate;
+        m_queue.push_back(path);
+        m_order.push_back(path);
+    }
+    m_cv.notify_all();
+    return true;
+}
+
+optional<std::vector<char>> NodePrefetcher::take(const std::string& path)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&]()
+    {
+        const auto it(m_entries.find(path));
+        return it == m_entries.end() || it->second.ready;
+    });
+
+    m_done.insert(path);
+
+    auto it(m_entries.find(path));
+    if (it == m_entries.end()) return { };
+
+    std::vector<char> data(std::move(it->second.data));
+    erase(it);
+    return data;
+}
+
+void NodePrefetcher::invalidate(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_done.insert(path);
+
+    // A fetch in progress is discarded by its thread once it completes.
+    auto it(m_entries.find(path));
+    if (it != m_entries.end() && it->second.ready) erase(it);
+}
+
+void NodePrefetcher::erase(const Entries::iterator it)
+{
+    m_bytes -= it->second.bytes;
+    metrics::add(metrics::Memory::Serialized, -int64_t(it->second.bytes));
+    m_entries.erase(it);
+}
+
+void NodePrefetcher::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_cv.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+        if (m_stop) return;
+
+        const std::string path(m_queue.front());
+        m_queue.pop_front();
+
+        // Our entry may have been invalidated while it was queued.
+        if (m_done.count(path))
+        {
+            erase(m_entries.find(path));
+            m_cv.notify_all();
+            continue;
+        }
+
+        lock.unlock();
+
+        std::unique_ptr<std::vector<char>> data;
+        try { data = m_endpoint.tryGetBinary(path); }
+        catch (...) { }
+
+        lock.lock();
+
+        // A failed fetch is left to the reader, which will observe its error.
+        auto it(m_entries.find(path));
+        if (!data || m_done.count(path)) erase(it);
+        else
+        {
+            Entry& entry(it->second);
+            const int64_t delta(int64_t(data->size()) - int64_t(entry.bytes));
+            m_bytes += delta;
+            metrics::add(metrics::Memory::Serialized, delta);
+            entry.bytes = data->size();
+            entry.data = std::move(*data);
+            entry.ready = true;
+        }
+        m_cv.notify_all();
+    }
+}
+
+} // namespace entwine
@@ -0,0 +1,93 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/optional.hpp>
+
+namespace entwine
+{
+
+// Fetches the point data of existing nodes on dedicated threads ahead of the
+// threads which will wake them, so that the latency of remote reads overlaps
+// with other work.  Nodes are keyed by their path within our endpoint.
+//
+// Only the data a node had before this build may be fetched ahead, so a node
+// which is written is discarded if we hold it and is never fetched again.
+// Likewise a node is taken at most once, since once taken it is resident.
+// Data which has not been taken by the time its room is needed is unlikely
+// to be, so the oldest fetched is discarded first.
+class NodePrefetcher
+{
+public:
+    // At most maxBytes of data are held or being fetched at once, where the
+    // size of a node being fetched is its estimate until it is complete.
+    NodePrefetcher(
+        const arbiter::Endpoint& ep,
+        uint64_t threads,
+        uint64_t maxBytes);
+
+    ~NodePrefetcher();
+
+    // Begin fetching this path, of about this size, unless it has already
+    // been fetched or written.  Returns false, fetching nothing, if our budget
+    // is spent.
+    bool fetch(const std::string& path, uint64_t estimate);
+
+    // Take the data for this path, waiting for it if it is being fetched.
+    // Nothing is returned if it was not fetched, or if its fetch failed, in
+    // which case the caller reads it for itself.
+    optional<std::vector<char>> take(const std::string& path);
+
+    // Note that this path is being written, so any data we fetched for it is
+    // stale.
+    void invalidate(const std::string& path);
+
+private:
+    struct Entry
+    {
+        uint64_t bytes = 0;
+        bool ready = false;
+        std::vector<char> data;
+    };
+
+    using Entries = std::map<std::string, Entry>;
+
+    void run();
+    void erase(Entries::iterator it);
+
+    const arbiter::Endpoint m_endpoint;
+    const uint64_t m_maxBytes;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    Entries m_entries;
+    std::deque<std::string> m_queue;
+    std::deque<std::string> m_order;
+    std::set<std::string> m_done;
+    uint64_t m_bytes = 0;
+    bool m_stop = false;
+
+    std::vector<std::thread> m_threads;
+};
+
+} // namespace entwine
@@ -0,0 +1,98 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/numa.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace entwine
+{
+namespace numa
+{
+
+namespace
+{
+
+// Parse a sysfs CPU list, like "0-15,32-47".
+Node parseList(const std::string& s)
+{
+    Node cpus;
+    std::istringstream ss(s);
+    std::string part;
+    while (std::getline(ss, part, ','))
+    {
+        if (part.empty() || part == "\n") continue;
+        const std::size_t dash(part.find('-'));
+        const unsigned begin(std::stoul(part.substr(0, dash)));
+        const unsigned end(
+            dash == std::string::npos
+                ? begin
+                : std::stoul(part.substr(dash + 1)));
+        for (unsigned cpu(begin); cpu <= end; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+} // unnamed namespace
+
+std::vector<Node> nodes()
+{
+    std::vector<Node> result;
+#ifdef __linux__
+    // Node IDs may be sparse, so look past gaps for a while.
+    for (unsigned id(0), missing(0); missing < 64; ++id)
+    {
+        std::ifstream file(
+            "/sys/devices/system/node/node" + std::to_string(id) +
+            "/cpulist");
+        if (!file)
+        {
+            ++missing;
+            continue;
+        }
+        missing = 0;
+
+        std::string list;
+        std::getline(file, list);
+        try
+        {
+            const Node cpus(parseList(list));
+            if (cpus.size()) result.push_back(cpus);
+        }
+        catch (...) { return std::vector<Node>(); }
+    }
+#endif
+    return result;
+}
+
+bool pin(const Node& node)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const unsigned cpu : node)
+    {
+        if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    return !pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    return false;
+#endif
+}
+
+} // namespace numa
+} // namespace entwine
@@ -0,0 +1,34 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace entwine
+{
+namespace numa
+{
+
+// The CPUs of a NUMA node.
+using Node = std::vector<unsigned>;
+
+// The NUMA nodes of this machine which have CPUs, as described by sysfs.
+// Empty where this is unsupported or unknown.
+std::vector<Node> nodes();
+
+// Restrict the calling thread to the CPUs of this node, so that the memory
+// it touches first is allocated on the node.  Returns false on failure,
+// which leaves the thread unrestricted.
+bool pin(const Node& node);
+
+} // namespace numa
+} // namespace entwine
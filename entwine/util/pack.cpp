@@ -0,0 +1,180 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/pack.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/util/io.hpp>
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+// Read [start, end) of this file.
+std::vector<char> getRange(
+    const arbiter::Endpoint& ep,
+    const std::string& path,
+    const uint64_t start,
+    const uint64_t end)
+{
+    if (!ep.isLocal())
+    {
+        std::vector<char> data(
+            ep.getBinary(path, getRangeHeader(start, end)));
+        if (data.size() != end - start)
+        {
+            throw std::runtime_error("Short read of " + path);
+        }
+        return data;
+    }
+
+    std::ifstream file(ep.prefixedRoot() + path, std::ios::binary);
+    std::vector<char> data(end - start);
+    file.seekg(start);
+    file.read(data.data(), data.size());
+    if (!file) throw std::runtime_error("Short read of " + path);
+    return data;
+}
+
+uint64_t toLittleEndian(const uint64_t v)
+{
+    uint64_t result(0);
+    unsigned char* bytes(reinterpret_cast<unsigned char*>(&result));
+    for (int i(0); i < 8; ++i) bytes[i] = (v >> (i * 8)) & 0xff;
+    return result;
+}
+
+uint64_t fromLittleEndian(const char* pos)
+{
+    const unsigned char* bytes(reinterpret_cast<const unsigned char*>(pos));
+    uint64_t result(0);
+    for (int i(0); i < 8; ++i) result |= uint64_t(bytes[i]) << (i * 8);
+    return result;
+}
+
+} // unnamed namespace
+
+namespace pack
+{
+
+Dxyz getRoot(const Dxyz& key, const uint64_t step)
+{
+    return hierarchy::getRoot(key, step);
+}
+
+void write(
+    const arbiter::Endpoint& src,
+    const arbiter::Endpoint& dst,
+    const Dxyz& root,
+    const std::vector<Dxyz>& keys,
+    const std::function<std::string(uint64_t depth)>& extension,
+    const bool remove)
+{
+    json index = json::object();
+    std::vector<char> data;
+    for (const Dxyz& key : keys)
+    {
+        const std::vector<char> node(
+            ensureGetBinary(src, key.toString() + extension(key.d)));
+        index[key.toString()] = { data.size(), node.size() };
+        data.insert(data.end(), node.begin(), node.end());
+    }
+
+    const std::string header(index.dump());
+    const uint64_t size(toLittleEndian(header.size()));
+
+    std::vector<char> packed(sizeof(uint64_t) + header.size() + data.size());
+    char* pos(packed.data());
+    std::memcpy(pos, &size, sizeof(uint64_t));
+    pos += sizeof(uint64_t);
+    std::copy(header.begin(), header.end(), pos);
+    pos += header.size();
+    std::copy(data.begin(), data.end(), pos);
+
+    ensurePut(dst, getFilename(root), packed);
+
+    if (!remove) return;
+    for (const Dxyz& key : keys)
+    {
+        arbiter::remove(
+            src.prefixedRoot() + key.toString() + extension(key.d));
+    }
+}
+
+} // namespace pack
+
+Packs::Packs(const arbiter::Endpoint& data, const uint64_t step)
+    : m_data(data)
+    , m_step(step)
+{ }
+
+optional<std::vector<char>> Packs::get(const std::string& path)
+{
+    const std::size_t dot(path.find('.'));
+    const Dxyz key(path.substr(0, dot));
+
+    const Index& index(getIndex(pack::getRoot(key, m_step)));
+    const auto it(index.find(key));
+    if (it == index.end()) return { };
+
+    const Entry& entry(it->second);
+    return getRange(
+        m_data,
+        pack::getFilename(pack::getRoot(key, m_step)),
+        entry.offset,
+        entry.offset + entry.size);
+}
+
+const Packs::Index& Packs::getIndex(const Dxyz& root)
+{
+    // Indexes are not evicted, so references to them remain valid.  A pack
+    // whose index is wanted concurrently may be read more than once.
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it(m_indexes.find(root));
+        if (it != m_indexes.end()) return it->second;
+    }
+
+    const std::string filename(pack::getFilename(root));
+    const std::vector<char> size(
+        getRange(m_data, filename, 0, sizeof(uint64_t)));
+    const uint64_t length(fromLittleEndian(size.data()));
+    const std::vector<char> header(
+        getRange(
+            m_data,
+            filename,
+            sizeof(uint64_t),
+            sizeof(uint64_t) + length));
+
+    // Offsets in the index are relative to the end of the header.
+    const uint64_t base(sizeof(uint64_t) + length);
+
+    Index index;
+    const json j(json::parse(header.begin(), header.end()));
+    for (const auto& node : j.items())
+    {
+        const json& v(node.value());
+        index[Dxyz(node.key())] = Entry {
+            base + v.at(0).get<uint64_t>(),
+            v.at(1).get<uint64_t>() };
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_indexes.emplace(root, std::move(index)).first->second;
+}
+
+} // namespace entwine
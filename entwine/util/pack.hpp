@@ -0,0 +1,88 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/util/optional.hpp>
+
+namespace entwine
+{
+
+// The data files of the nodes of each hierarchy file may be packed into a
+// single object, named for the root of that file, so that a build of many
+// small nodes writes far fewer objects.
+//
+// A pack begins with the size of its index as a little-endian uint64, and
+// then its index: a JSON object of each node key to the offset and size of
+// its data, which follows the index.  So a single node may be read from its
+// pack with a ranged read, once the index has been read.
+namespace pack
+{
+
+// The root of the pack holding this node, for this hierarchy step.
+Dxyz getRoot(const Dxyz& key, uint64_t step);
+
+inline std::string getFilename(const Dxyz& root)
+{
+    return root.toString() + ".pack";
+}
+
+// Pack the data of these nodes, named by their keys and the extension of their
+// depths, from src into the pack rooted at root in dst.  If remove is set, the
+// node files are removed from src, which must be local, once the pack is
+// written.
+void write(
+    const arbiter::Endpoint& src,
+    const arbiter::Endpoint& dst,
+    const Dxyz& root,
+    const std::vector<Dxyz>& keys,
+    const std::function<std::string(uint64_t depth)>& extension,
+    bool remove);
+
+} // namespace pack
+
+// Reads the data of single nodes from their packs, holding the index of each
+// pack once it has been read.
+class Packs
+{
+public:
+    Packs(const arbiter::Endpoint& data, uint64_t step);
+
+    // Get the data of the node file at this path, of the form <key>.<ext>, or
+    // nothing if it is absent from its pack.
+    optional<std::vector<char>> get(const std::string& path);
+
+private:
+    struct Entry
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+    using Index = std::map<Dxyz, Entry>;
+
+    const Index& getIndex(const Dxyz& root);
+
+    const arbiter::Endpoint m_data;
+    const uint64_t m_step;
+
+    std::mutex m_mutex;
+    std::map<Dxyz, Index> m_indexes;
+};
+
+} // namespace entwine
@@ -15,6 +15,10 @@
 namespace entwine
 {
 
+// Serializes the parts of PDAL which are not thread-safe.  Stage creation and
+// option validation are safe to run concurrently, but preparing a stage may
+// initialize spatial reference and GDAL state, so only prepare() calls need to
+// be guarded.
 class PdalMutex
 {
 public:
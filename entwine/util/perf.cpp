@@ -0,0 +1,132 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/perf.hpp>
+
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace entwine
+{
+namespace perf
+{
+
+namespace
+{
+
+#ifdef __linux__
+const std::array<uint64_t, eventCount> configs = { {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+} };
+
+// The counters of a single thread, opened as one group led by the first, so
+// that they are scheduled together and read at once.
+class Group
+{
+public:
+    Group()
+    {
+        m_fds.fill(-1);
+        for (std::size_t i(0); i < eventCount; ++i)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+
+            m_fds[i] = syscall(
+                __NR_perf_event_open, &attr, 0, -1, i ? m_fds[0] : -1, 0);
+            if (m_fds[i] < 0) return;
+        }
+
+        m_ok = !ioctl(m_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    ~Group()
+    {
+        for (const int fd : m_fds) if (fd >= 0) close(fd);
+    }
+
+    bool read(Sample& sample) const
+    {
+        if (!m_ok) return false;
+
+        struct { uint64_t count; Sample values; } data;
+        const auto bytes(::read(m_fds[0], &data, sizeof(data)));
+        if (bytes != sizeof(data) || data.count != eventCount) return false;
+
+        sample = data.values;
+        return true;
+    }
+
+    bool ok() const { return m_ok; }
+
+private:
+    std::array<int, eventCount> m_fds;
+    bool m_ok = false;
+
+    Group(const Group&) = delete;
+    Group& operator=(const Group&) = delete;
+};
+
+Group& group()
+{
+    static thread_local Group g;
+    return g;
+}
+#endif
+
+} // unnamed namespace
+
+std::string toString(const Event e)
+{
+    switch (e)
+    {
+        case Event::Cycles: return "cycles";
+        case Event::Instructions: return "instructions";
+        case Event::CacheMisses: return "cacheMisses";
+        case Event::BranchMisses: return "branchMisses";
+    }
+    return "unknown";
+}
+
+bool enable()
+{
+#ifdef __linux__
+    if (group().ok()) active() = true;
+#endif
+    return enabled();
+}
+
+bool read(Sample& sample)
+{
+#ifdef __linux__
+    return group().read(sample);
+#else
+    return false;
+#endif
+}
+
+} // namespace perf
+} // namespace entwine
@@ -0,0 +1,59 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace entwine
+{
+namespace perf
+{
+
+// Hardware events counted for each thread, in user space only, via
+// perf_event_open.  Cache misses are those of the last level cache.
+enum class Event
+{
+    Cycles,
+    Instructions,
+    CacheMisses,
+    BranchMisses
+};
+
+static constexpr std::size_t eventCount = 4;
+
+using Sample = std::array<uint64_t, eventCount>;
+
+std::string toString(Event e);
+
+inline std::atomic_bool& active()
+{
+    static std::atomic_bool enabled{ false };
+    return enabled;
+}
+
+// Enable counting for the rest of this process.  Returns false if the counters
+// cannot be opened, for lack of support by this platform or by a virtualized
+// CPU, or for lack of permission by perf_event_paranoid, in which case
+// counting remains disabled.
+bool enable();
+
+inline bool enabled() { return active().load(std::memory_order_relaxed); }
+
+// Read the cumulative counts of the calling thread, whose counters are opened
+// on its first read.  Returns false if they are unavailable to this thread.
+bool read(Sample& sample);
+
+} // namespace perf
+} // namespace entwine
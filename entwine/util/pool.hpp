@@ -10,33 +10,174 @@
 
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
 #include <cstddef>
+#include <deque>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace entwine
 {
 
+// A move-only, type-erased callable.  Small callables, which includes nearly
+// all of our lambdas, are stored inline so wrapping them does not allocate.
+class Task
+{
+public:
+    Task() = default;
+
+    template <
+        typename F,
+        typename D = typename std::decay<F>::type,
+        typename = typename std::enable_if<
+            !std::is_same<D, Task>::value>::type>
+    Task(F&& f)
+    {
+        init<D>(
+            std::forward<F>(f),
+            std::integral_constant<bool, isInlined<D>()>());
+    }
+
+    Task(Task&& other) { take(other); }
+    Task& operator=(Task&& other)
+    {
+        if (this != &other)
+        {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    ~Task() { reset(); }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+    void operator()() { m_ops->invoke(&m_storage); }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void*);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void*);
+    };
+
+    using Storage = std::aligned_storage<
+        12 * sizeof(void*),
+        alignof(std::max_align_t)>::type;
+
+    template <typename D>
+    static constexpr bool isInlined()
+    {
+        return
+            sizeof(D) <= sizeof(Storage) &&
+            alignof(D) <= alignof(Storage) &&
+            std::is_nothrow_move_constructible<D>::value;
+    }
+
+    template <typename D, typename F>
+    void init(F&& f, std::true_type)
+    {
+        new (&m_storage) D(std::forward<F>(f));
+        m_ops = inlineOps<D>();
+    }
+
+    template <typename D, typename F>
+    void init(F&& f, std::false_type)
+    {
+        *reinterpret_cast<D**>(&m_storage) = new D(std::forward<F>(f));
+        m_ops = heapOps<D>();
+    }
+
+    template <typename D>
+    static const Ops* inlineOps()
+    {
+        static const Ops ops = {
+            [](void* p) { (*static_cast<D*>(p))(); },
+            [](void* dst, void* src)
+            {
+                new (dst) D(std::move(*static_cast<D*>(src)));
+                static_cast<D*>(src)->~D();
+            },
+            [](void* p) { static_cast<D*>(p)->~D(); }
+        };
+        return &ops;
+    }
+
+    template <typename D>
+    static const Ops* heapOps()
+    {
+        static const Ops ops = {
+            [](void* p) { (**static_cast<D**>(p))(); },
+            [](void* dst, void* src)
+            {
+                *static_cast<D**>(dst) = *static_cast<D**>(src);
+            },
+            [](void* p) { delete *static_cast<D**>(p); }
+        };
+        return &ops;
+    }
+
+    void take(Task& other)
+    {
+        if (!other.m_ops) return;
+        other.m_ops->move(&m_storage, &other.m_storage);
+        m_ops = other.m_ops;
+        other.m_ops = nullptr;
+    }
+
+    void reset()
+    {
+        if (m_ops) m_ops->destroy(&m_storage);
+        m_ops = nullptr;
+    }
+
+    Storage m_storage;
+    const Ops* m_ops = nullptr;
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+};
+
+// A work-stealing thread pool.  Each worker owns a deque of tasks: it pops its
+// own most recently added tasks, and when it runs dry it steals the oldest
+// tasks from another worker.  Tasks added from within a worker go to that
+// worker's own deque and never block, so tasks may recursively add tasks.
 class Pool
 {
 public:
+    // Called by each worker thread, with its index, before it runs any tasks.
+    using Start = std::function<void(std::size_t)>;
+
+    // The depth of our queue for each thread, if none is specified.
+    static constexpr std::size_t queuePerThread = 4;
+
     // After numThreads tasks are actively running, and queueSize tasks have
     // been enqueued to wait for an available worker thread, subsequent calls
-    // to Pool::add will block until an enqueued task has been popped from the
-    // queue.
+    // to Pool::add from outside of the pool will block until an enqueued task
+    // has been popped from the queue.  A queueSize of zero allows
+    // queuePerThread tasks for each thread, so producers of many small tasks
+    // rarely block on a single slot.  Callers which schedule each task with
+    // care, so that tasks should not be queued ahead, should specify one.
     Pool(
             std::size_t numThreads,
-            std::size_t queueSize = 1,
-            bool verbose = true)
+            std::size_t queueSize = 0,
+            bool verbose = true,
+            Start start = Start())
         : m_verbose(verbose)
         , m_numThreads(std::max<std::size_t>(numThreads, 1))
-        , m_queueSize(std::max<std::size_t>(queueSize, 1))
+        , m_requestedQueueSize(queueSize)
+        , m_start(start)
     {
         go();
     }
@@ -50,9 +191,19 @@ public:
         if (m_running) return;
         m_running = true;
 
+        m_queueSize = m_requestedQueueSize
+            ? m_requestedQueueSize
+            : m_numThreads * queuePerThread;
+
+        m_workers.clear();
+        for (std::size_t i(0); i < m_numThreads; ++i)
+        {
+            m_workers.emplace_back(new Worker());
+        }
+
         for (std::size_t i(0); i < m_numThreads; ++i)
         {
-            m_threads.emplace_back([this]() { work(); });
+            m_threads.emplace_back([this, i]() { work(i); });
         }
     }
 
@@ -75,10 +226,12 @@ public:
     void await()
     {
         std::unique_lock<std::mutex> lock(m_mutex);
-        m_produceCv.wait(lock, [this]()
+        ++m_awaiting;
+        m_idleCv.wait(lock, [this]()
         {
-            return !m_outstanding && m_tasks.empty();
+            return !m_outstanding && !m_queued;
         });
+        --m_awaiting;
     }
 
     // Join and restart.
@@ -88,73 +241,199 @@ public:
     void resize(const std::size_t numThreads)
     {
         join();
-        m_numThreads = numThreads;
+        m_numThreads = std::max<std::size_t>(numThreads, 1);
         go();
     }
 
     // Not thread-safe, pool should be joined before calling.
     const std::vector<std::string>& errors() const { return m_errors; }
 
-    // Add a threaded task, blocking until a thread is available.  If join() is
-    // called, add() may not be called again until go() is called and completes.
-    void add(std::function<void()> task)
+    // Add a threaded task.  From outside of the pool, this blocks until there
+    // is room in the queue.  If join() is called, add() may not be called
+    // again until go() is called and completes.
+    template <typename F>
+    void add(F&& f)
     {
-        std::unique_lock<std::mutex> lock(m_mutex);
+        push(Task(std::forward<F>(f)));
+    }
+
+    // Add a batch of tasks at once, which are spread over our workers with a
+    // single wakeup each.  From outside of the pool, this blocks until there
+    // is room in the queue for the entire batch, or until the queue is empty
+    // if the batch is larger than the queue.
+    void add(std::vector<Task> tasks)
+    {
+        if (tasks.empty()) return;
         if (!m_running)
         {
             throw std::runtime_error(
                     "Attempted to add a task to a stopped Pool");
         }
 
-        m_produceCv.wait(lock, [this]()
+        const Current& c(current());
+        const bool internal(c.pool == this);
+        const std::size_t n(tasks.size());
+
+        if (!internal)
         {
-            return m_tasks.size() < m_queueSize;
-        });
+            const std::size_t room(m_queueSize > n ? m_queueSize - n : 0);
+            waitForSpace(room);
+        }
 
-        m_tasks.emplace(task);
+        // Our tasks are counted before they are published, so that a worker
+        // popping one never decrements our count below zero.
+        m_queued += n;
+        for (std::size_t i(0); i < n; ++i)
+        {
+            const std::size_t index(
+                internal ? c.index : m_next++ % m_workers.size());
+            Worker& worker(*m_workers[index]);
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.tasks.push_back(std::move(tasks[i]));
+        }
 
-        // Notify worker that a task is available.
-        lock.unlock();
-        m_consumeCv.notify_all();
+        if (m_sleeping)
+        {
+            { std::lock_guard<std::mutex> lock(m_mutex); }
+            if (n >= m_sleeping) m_consumeCv.notify_all();
+            else for (std::size_t i(0); i < n; ++i) m_consumeCv.notify_one();
+        }
     }
 
-
     std::size_t size() const { return m_numThreads; }
     std::size_t numThreads() const { return m_numThreads; }
 
 private:
-    // Worker thread function.  Wait for a task and run it - or if stop() is
-    // called, complete any outstanding task and return.
-    void work()
+    struct Worker
     {
-        while (true)
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct Current
+    {
+        const Pool* pool = nullptr;
+        std::size_t index = 0;
+    };
+
+    // The pool and worker index of the calling thread, if it is a worker.
+    static Current& current()
+    {
+        static thread_local Current c;
+        return c;
+    }
+
+    void push(Task task)
+    {
+        if (!m_running)
         {
-            std::unique_lock<std::mutex> lock(m_mutex);
-            m_consumeCv.wait(lock, [this]()
-            {
-                return m_tasks.size() || !m_running;
-            });
+            throw std::runtime_error(
+                    "Attempted to add a task to a stopped Pool");
+        }
+
+        const Current& c(current());
+        const bool internal(c.pool == this);
+
+        std::size_t index(c.index);
+        if (!internal)
+        {
+            // Apply backpressure to external producers.
+            waitForSpace(m_queueSize - 1);
+            index = m_next++ % m_workers.size();
+        }
+
+        // As for batches, our task is counted before it is published.
+        ++m_queued;
+        {
+            Worker& worker(*m_workers[index]);
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.tasks.push_back(std::move(task));
+        }
+
+        // Wake a sleeping worker, if there is one.  Taking the mutex here
+        // ensures that the notification can't slip in between a worker
+        // checking for tasks and going to sleep.
+        if (m_sleeping)
+        {
+            { std::lock_guard<std::mutex> lock(m_mutex); }
+            m_consumeCv.notify_one();
+        }
+    }
+
+    // Block until no more than this many tasks are queued.
+    void waitForSpace(const std::size_t most)
+    {
+        if (m_queued <= most) return;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        ++m_blocked;
+        m_spaceCv.wait(lock, [this, most]()
+        {
+            return m_queued <= most;
+        });
+        --m_blocked;
+    }
+
+    // Pop from the back of our own deque, or steal from the front of another.
+    bool pop(const std::size_t index, Task& task)
+    {
+        for (std::size_t i(0); i < m_workers.size(); ++i)
+        {
+            const std::size_t victim((index + i) % m_workers.size());
+            Worker& worker(*m_workers[victim]);
+
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.tasks.empty()) continue;
 
-            if (m_tasks.size())
+            if (victim == index)
             {
-                ++m_outstanding;
-                auto task(std::move(m_tasks.front()));
-                m_tasks.pop();
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            }
+
+            // Mark this task as outstanding before it is no longer queued, so
+            // await() never observes it as neither.
+            ++m_outstanding;
+            --m_queued;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Worker thread function.  Run tasks until join() is called and no tasks
+    // remain.
+    void work(const std::size_t index)
+    {
+        Current& c(current());
+        c.pool = this;
+        c.index = index;
 
-                lock.unlock();
+        if (m_start) m_start(index);
 
-                // Notify add(), which may be waiting for a spot in the queue.
-                m_produceCv.notify_all();
+        Task task;
+
+        while (true)
+        {
+            if (pop(index, task))
+            {
+                notifySpace();
 
                 std::string err;
                 try { task(); }
                 catch (std::exception& e) { err = e.what(); }
                 catch (...) { err = "Unknown error"; }
 
-                lock.lock();
-                --m_outstanding;
+                task = Task();
+
                 if (err.size())
                 {
+                    std::lock_guard<std::mutex> lock(m_errorMutex);
                     if (m_verbose)
                     {
                         std::cout << "Exception in pool task: " << err <<
@@ -162,32 +441,74 @@ private:
                     }
                     m_errors.push_back(err);
                 }
-                lock.unlock();
 
-                // Notify await(), which may be waiting for a running task.
-                m_produceCv.notify_all();
+                --m_outstanding;
+                notifyIdle();
+                continue;
             }
-            else if (!m_running)
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            ++m_sleeping;
+            m_consumeCv.wait(lock, [this]()
             {
-                return;
-            }
+                return m_queued || !m_running;
+            });
+            --m_sleeping;
+
+            if (!m_queued && !m_running) break;
+        }
+
+        c.pool = nullptr;
+    }
+
+    // Notify the producers blocked in add(), if any, that a task has left
+    // the queue, which follows every decrement of our count.  Producers wait
+    // for differing amounts of room, since batches need room for all of their
+    // tasks, so all of them are woken to check, lest the only one woken be
+    // one which must keep waiting.  A producer counts itself as blocked
+    // before checking for room, so it either sees our decrement or is woken.
+    void notifySpace()
+    {
+        if (m_blocked)
+        {
+            { std::lock_guard<std::mutex> lock(m_mutex); }
+            m_spaceCv.notify_all();
+        }
+    }
+
+    // Notify await() once we may have become idle.  Taking the mutex ensures
+    // that the notification can't slip in before a waiter goes to sleep.
+    void notifyIdle()
+    {
+        if (m_awaiting && !m_outstanding && !m_queued)
+        {
+            { std::lock_guard<std::mutex> lock(m_mutex); }
+            m_idleCv.notify_all();
         }
     }
 
     bool m_verbose;
     std::size_t m_numThreads;
-    std::size_t m_queueSize;
+    const std::size_t m_requestedQueueSize;
+    std::size_t m_queueSize = 1;
+    const Start m_start;
     std::vector<std::thread> m_threads;
-    std::queue<std::function<void()>> m_tasks;
+    std::vector<std::unique_ptr<Worker>> m_workers;
 
     std::vector<std::string> m_errors;
     std::mutex m_errorMutex;
 
-    std::size_t m_outstanding = 0;
-    bool m_running = false;
+    std::atomic_size_t m_next{ 0 };
+    std::atomic_size_t m_queued{ 0 };
+    std::atomic_size_t m_outstanding{ 0 };
+    std::atomic_size_t m_sleeping{ 0 };
+    std::atomic_size_t m_blocked{ 0 };
+    std::atomic_size_t m_awaiting{ 0 };
+    std::atomic_bool m_running{ false };
 
     mutable std::mutex m_mutex;
-    std::condition_variable m_produceCv;
+    std::condition_variable m_spaceCv;
+    std::condition_variable m_idleCv;
     std::condition_variable m_consumeCv;
 
     // Disable copy/assignment.
@@ -0,0 +1,112 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace entwine
+{
+
+// A multi-producer, multi-consumer FIFO holding at most maxSize entries.
+// Producers block in push() while the queue is full, and consumers block in
+// pop() while it is empty.  After close() is called, push() fails immediately
+// and pop() fails once the remaining entries have been drained.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(std::size_t maxSize)
+        : m_maxSize(std::max<std::size_t>(maxSize, 1))
+    { }
+
+    bool push(T v)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_produceCv.wait(lock, [this]()
+        {
+            return m_closed || m_queue.size() < m_maxSize;
+        });
+        if (m_closed) return false;
+
+        m_queue.push_back(std::move(v));
+
+        lock.unlock();
+        m_consumeCv.notify_one();
+        return true;
+    }
+
+    bool pop(T& v)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_consumeCv.wait(lock, [this]()
+        {
+            return m_closed || !m_queue.empty();
+        });
+        if (m_queue.empty()) return false;
+
+        v = std::move(m_queue.front());
+        m_queue.pop_front();
+
+        lock.unlock();
+        m_produceCv.notify_one();
+        return true;
+    }
+
+    // Like pop(), but never blocks.
+    bool tryPop(T& v)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_queue.empty()) return false;
+
+        v = std::move(m_queue.front());
+        m_queue.pop_front();
+
+        lock.unlock();
+        m_produceCv.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_produceCv.notify_all();
+        m_consumeCv.notify_all();
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_queue.size();
+    }
+
+    std::size_t maxSize() const { return m_maxSize; }
+
+private:
+    const std::size_t m_maxSize;
+    std::deque<T> m_queue;
+    bool m_closed = false;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_produceCv;
+    std::condition_variable m_consumeCv;
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+};
+
+} // namespace entwine
@@ -0,0 +1,194 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/rate-limit.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/util/metrics.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+std::mutex mutex;
+std::shared_ptr<RateLimits> rateLimits;
+std::map<std::string, std::shared_ptr<RateLimiter>> limiters;
+
+double secondsBetween(const TimePoint a, const TimePoint b)
+{
+    return std::chrono::duration<double>(b - a).count();
+}
+
+// The storage location of an endpoint, which is shared by all of the
+// endpoints beneath it - like the bucket of an S3 path.
+std::string getLocation(const arbiter::Endpoint& ep)
+{
+    const std::string root(arbiter::stripProtocol(ep.root()));
+    const std::size_t begin(root.find_first_not_of('/'));
+    const std::size_t end(root.find('/', begin));
+    return ep.type() + "://" + root.substr(0, end);
+}
+
+} // unnamed namespace
+
+RateLimiter::RateLimiter(const RateLimits& limits)
+    : m_priority(limits.priority)
+    , m_refilled(now())
+    , m_adjusted(now())
+    , m_window(now())
+{
+    m_requests.ceiling = limits.requests;
+    m_bytes.ceiling = limits.bytes;
+
+    // Our buckets start full, holding a second at our ceilings.
+    m_requests.tokens = m_requests.ceiling;
+    m_bytes.tokens = m_bytes.ceiling;
+}
+
+void RateLimiter::refill()
+{
+    const TimePoint t(now());
+    const double elapsed(secondsBetween(m_refilled, t));
+    m_refilled = t;
+
+    for (Bucket* b : { &m_requests, &m_bytes })
+    {
+        const double rate(b->ceiling * m_scale);
+        b->tokens = std::min(b->tokens + elapsed * rate, rate);
+    }
+
+    const double windowed(secondsBetween(m_window, t));
+    if (windowed >= 1)
+    {
+        m_previous = windowed < 2 ? m_current : 0;
+        m_current = 0;
+        m_window = t;
+    }
+}
+
+void RateLimiter::acquire(const uint64_t bytes)
+{
+    double wait(0);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        refill();
+        ++m_current;
+
+        // Tokens are taken up front, so that a request which must wait also
+        // holds its place against those which follow it.
+        if (m_requests.ceiling)
+        {
+            m_requests.tokens -= 1;
+            const double rate(m_requests.ceiling * m_scale);
+            wait = std::max(wait, -m_requests.tokens / rate);
+        }
+        if (m_bytes.ceiling)
+        {
+            m_bytes.tokens -= bytes;
+            const double rate(m_bytes.ceiling * m_scale);
+            wait = std::max(wait, -m_bytes.tokens / rate);
+        }
+    }
+
+    if (wait > 0)
+    {
+        metrics::ScopedTimer timer(metrics::Timer::RateLimitWait);
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+    }
+}
+
+void RateLimiter::charge(const uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_bytes.ceiling) m_bytes.tokens -= bytes;
+}
+
+void RateLimiter::succeeded()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_scale >= 1) return;
+
+    // Regain our rates by a fraction of our ceilings per second, weighted by
+    // our priority.
+    const TimePoint t(now());
+    const double elapsed(secondsBetween(m_adjusted, t));
+    if (elapsed < 1) return;
+
+    m_scale = std::min(
+        1.0,
+        m_scale + elapsed * m_priority * heuristics::rateLimitRecovery);
+    m_adjusted = t;
+}
+
+void RateLimiter::throttled()
+{
+    metrics::add(metrics::Counter::Throttles);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    refill();
+
+    // Requests failing together are a single signal, so we back off at most
+    // once per second.
+    const TimePoint t(now());
+    if (secondsBetween(m_adjusted, t) < 1 && m_scale < 1) return;
+
+    if (!m_requests.ceiling)
+    {
+        m_requests.ceiling = std::max(1.0, std::max(m_previous, m_current));
+        m_requests.tokens = 0;
+    }
+
+    m_scale = std::max(m_scale / 2, heuristics::minRateLimitScale);
+    m_adjusted = t;
+}
+
+double RateLimiter::scale() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_scale;
+}
+
+void setRateLimits(std::shared_ptr<RateLimits> limits)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    rateLimits = limits;
+    limiters.clear();
+}
+
+std::shared_ptr<RateLimiter> getRateLimiter(const arbiter::Endpoint& ep)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!rateLimits) return { };
+
+    std::shared_ptr<RateLimiter>& limiter(limiters[getLocation(ep)]);
+    if (!limiter) limiter = std::make_shared<RateLimiter>(*rateLimits);
+    return limiter;
+}
+
+bool isThrottle(const std::string& message)
+{
+    for (const std::string s : {
+            "SlowDown", "503", "429", "Too Many Requests",
+            "Throttl", "ServerBusy", "rateLimitExceeded" })
+    {
+        if (message.find(s) != std::string::npos) return true;
+    }
+    return false;
+}
+
+} // namespace entwine
@@ -0,0 +1,98 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/time.hpp>
+
+namespace entwine
+{
+
+struct RateLimits
+{
+    // Ceilings on requests per second and bytes per second to each storage
+    // location, or zero for none.
+    double requests = 0;
+    double bytes = 0;
+
+    // The weight of this process among those sharing storage, by which it
+    // regains its rates after being throttled.  Processes recovering at
+    // different weights converge to shares of the storage in proportion to
+    // them.
+    double priority = 1;
+};
+
+// Token buckets for the requests and bytes to a single storage location, whose
+// rates are halved whenever it throttles us, and then regained additively.
+// If no request ceiling was given, the request rate at the first throttle
+// becomes the ceiling.
+class RateLimiter
+{
+public:
+    explicit RateLimiter(const RateLimits& limits);
+
+    // Wait until a request of this many bytes may be made.
+    void acquire(uint64_t bytes);
+
+    // Account for bytes whose size was not known until after their request,
+    // which delays subsequent requests rather than this one.
+    void charge(uint64_t bytes);
+
+    void succeeded();
+    void throttled();
+
+    // The current fraction of our ceilings at which we run.
+    double scale() const;
+
+private:
+    struct Bucket
+    {
+        double ceiling = 0;
+        double tokens = 0;
+    };
+
+    // Refill our buckets, with our mutex held.
+    void refill();
+
+    const double m_priority;
+
+    mutable std::mutex m_mutex;
+    Bucket m_requests;
+    Bucket m_bytes;
+    double m_scale = 1;
+    TimePoint m_refilled;
+    TimePoint m_adjusted;
+
+    // Requests in the current and previous seconds, from which a ceiling is
+    // taken if we are throttled without one.
+    TimePoint m_window;
+    double m_current = 0;
+    double m_previous = 0;
+};
+
+// If set, requests made by the functions of entwine/util/io.hpp are limited
+// by these rates, with a limiter for each storage location - a bucket or
+// container for remote endpoints, or the top directory of local ones.
+void setRateLimits(std::shared_ptr<RateLimits> limits);
+
+// The limiter for the location of this endpoint, or null if none are set.
+std::shared_ptr<RateLimiter> getRateLimiter(const arbiter::Endpoint& ep);
+
+// Whether an error from storage is a request to slow down, like an HTTP 503
+// SlowDown from S3 or a 429.
+bool isThrottle(const std::string& message);
+
+} // namespace entwine
@@ -0,0 +1,211 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/read-cache.hpp>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+const std::string extension(".cache");
+
+// Paths and versions longer than this are taken as corrupt entries, or those
+// of an older format, rather than being allocated.
+const uint64_t maxHeaderLength(1 << 16);
+
+bool readString(std::istream& file, std::string& s)
+{
+    uint64_t length(0);
+    if (!file.read(reinterpret_cast<char*>(&length), sizeof(length)))
+    {
+        return false;
+    }
+    if (length > maxHeaderLength) return false;
+
+    s.assign(length, 0);
+    return length == 0 || !!file.read(&s[0], length);
+}
+
+void writeString(std::ostream& file, const std::string& s)
+{
+    const uint64_t length(s.size());
+    file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    file.write(s.data(), length);
+}
+
+bool endsWith(const std::string& s, const std::string& end)
+{
+    return s.size() > end.size() &&
+        !s.compare(s.size() - end.size(), end.size(), end);
+}
+
+} // unnamed namespace
+
+ReadCache::ReadCache(const std::string dir, const uint64_t maxBytes)
+    : m_dir(arbiter::expandTilde(arbiter::stripProtocol(dir)))
+    , m_maxBytes(maxBytes)
+{
+    if (!arbiter::mkdirp(m_dir))
+    {
+        throw std::runtime_error("Could not create read cache: " + dir);
+    }
+
+    // Entries left by previous runs are ordered by their modification times.
+    std::vector<std::pair<time_t, std::pair<std::string, uint64_t>>> existing;
+    for (const std::string& path : arbiter::Arbiter().resolve(m_dir + "/*"))
+    {
+        const std::string name(arbiter::getBasename(path));
+        const std::string local(arbiter::join(m_dir, name));
+
+        // Partial entries are left only by runs which were interrupted.
+        if (endsWith(name, ".tmp")) std::remove(local.c_str());
+        if (!endsWith(name, extension)) continue;
+
+        struct stat s;
+        if (::stat(local.c_str(), &s)) continue;
+        existing.emplace_back(s.st_mtime, std::make_pair(name, s.st_size));
+    }
+    std::sort(existing.begin(), existing.end());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& e : existing) insert(e.second.first, e.second.second);
+}
+
+optional<std::vector<char>> ReadCache::get(
+    const std::string& path,
+    const std::string& version)
+{
+    const std::string name(filename(path));
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it(m_entries.find(name));
+        if (it == m_entries.end()) return { };
+
+        // Touch this entry.
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+    }
+
+    // Our entry may be evicted while we read it, in which case we see either
+    // its complete contents or nothing, since entries are replaced by rename.
+    std::ifstream file(
+        arbiter::join(m_dir, name),
+        std::ios::binary | std::ios::ate);
+    const std::streamoff end(file.tellg());
+    file.seekg(0);
+
+    std::string stored;
+    if (!readString(file, stored) || stored != path) return { };
+    if (!readString(file, stored) || stored != version) return { };
+
+    const std::streamoff begin(file.tellg());
+    if (begin < 0 || end < begin) return { };
+
+    std::vector<char> data(end - begin);
+    if (!file.read(data.data(), data.size())) return { };
+
+    return data;
+}
+
+void ReadCache::put(
+    const std::string& path,
+    const std::string& version,
+    const std::vector<char>& data)
+{
+    const uint64_t bytes(
+        2 * sizeof(uint64_t) + path.size() + version.size() + data.size());
+    if (bytes > m_maxBytes || version.size() > maxHeaderLength) return;
+
+    const std::string name(filename(path));
+    std::string tmp;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        tmp = arbiter::join(
+            m_dir,
+            name + "." + std::to_string(m_written++) + ".tmp");
+    }
+
+    // Entries are written under a temporary name and renamed into place, so
+    // a reader never sees a partial entry.  If local storage fails us, this
+    // object is left uncached - our caller already holds its data.
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        writeString(file, path);
+        writeString(file, version);
+        file.write(data.data(), data.size());
+        if (!file.good())
+        {
+            std::remove(tmp.c_str());
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (std::rename(tmp.c_str(), arbiter::join(m_dir, name).c_str()))
+    {
+        std::remove(tmp.c_str());
+        return;
+    }
+
+    const auto it(m_entries.find(name));
+    if (it != m_entries.end())
+    {
+        m_bytes -= it->second.bytes;
+        m_lru.erase(it->second.lru);
+        m_entries.erase(it);
+    }
+    insert(name, bytes);
+}
+
+void ReadCache::erase(const std::string& path)
+{
+    const std::string name(filename(path));
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_entries.count(name)) remove(name);
+}
+
+std::string ReadCache::filename(const std::string& path) const
+{
+    return arbiter::crypto::encodeAsHex(arbiter::crypto::md5(path)) +
+        extension;
+}
+
+void ReadCache::insert(const std::string& name, const uint64_t bytes)
+{
+    m_lru.push_front(name);
+    Entry& entry(m_entries[name]);
+    entry.bytes = bytes;
+    entry.lru = m_lru.begin();
+    m_bytes += bytes;
+
+    while (m_bytes > m_maxBytes && m_lru.size()) remove(m_lru.back());
+}
+
+void ReadCache::remove(const std::string name)
+{
+    const auto it(m_entries.find(name));
+    m_bytes -= it->second.bytes;
+    m_lru.erase(it->second.lru);
+    m_entries.erase(it);
+    std::remove(arbiter::join(m_dir, name).c_str());
+}
+
+} // namespace entwine
@@ -0,0 +1,83 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/util/optional.hpp>
+
+namespace entwine
+{
+
+// A size-bounded, least recently used cache of remote objects in a local
+// directory, through which our remote reads pass, so that objects read again
+// by later runs need not be transferred again.  Each entry is a file named
+// by a hash of the full path of its object, holding that path and the version
+// of the object, such as its ETag, followed by the object's data, and entries
+// left by previous runs are reused.
+//
+// A copy is only valid if its version matches that of its remote object, since
+// a rewrite of the same size is common for nodes.  Objects whose drivers report
+// no version are not cached.  Objects written through our io functions also
+// discard their copies.
+class ReadCache
+{
+public:
+    ReadCache(std::string dir, uint64_t maxBytes);
+
+    // Returns our copy of the object at this full path, if we hold one of
+    // this version.
+    optional<std::vector<char>> get(
+        const std::string& path,
+        const std::string& version);
+
+    // Store a copy of this object at this version, evicting the least
+    // recently used entries while we are over budget.
+    void put(
+        const std::string& path,
+        const std::string& version,
+        const std::vector<char>& data);
+
+    // Discard our copy of this object, if we hold one.
+    void erase(const std::string& path);
+
+private:
+    struct Entry
+    {
+        uint64_t bytes = 0;
+        std::list<std::string>::iterator lru;
+    };
+
+    std::string filename(const std::string& path) const;
+
+    // Track this file as the most recently used, and evict the least recently
+    // used files while we are over budget.
+    void insert(const std::string& name, uint64_t bytes);
+
+    // The name is copied, since it may be that of an entry of our LRU list.
+    void remove(std::string name);
+
+    const std::string m_dir;
+    const uint64_t m_maxBytes;
+
+    std::mutex m_mutex;
+    std::map<std::string, Entry> m_entries;
+    std::list<std::string> m_lru;
+    uint64_t m_bytes = 0;
+    uint64_t m_written = 0;
+};
+
+} // namespace entwine
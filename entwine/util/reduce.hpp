@@ -0,0 +1,88 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+// Reduce the items [0, n) in parallel.  Each of up to threads contiguous
+// ranges of items is folded in order, by fold(partial, i), into its own copy
+// of init.  Adjacent partial results are then merged pairwise, as a tree, by
+// merge(left, std::move(right)), so the order of the items is preserved for
+// operations which are associative but not commutative.  With a single
+// thread, or a single item, this is a plain serial fold.
+template <typename T, typename Fold, typename Merge>
+T parallelReduce(
+    const std::size_t n,
+    const T& init,
+    const unsigned threads,
+    Fold fold,
+    Merge merge)
+{
+    const std::size_t shares(
+        std::max<std::size_t>(std::min<std::size_t>(threads, n), 1));
+
+    std::vector<T> partials(shares, init);
+    if (shares == 1)
+    {
+        for (std::size_t i(0); i < n; ++i) fold(partials.front(), i);
+        return std::move(partials.front());
+    }
+
+    const auto check([](const Pool& pool)
+    {
+        const auto& errors(pool.errors());
+        if (errors.size()) throw std::runtime_error(errors.front());
+    });
+
+    {
+        Pool pool(shares);
+        for (std::size_t s(0); s < shares; ++s)
+        {
+            pool.add([&, s]()
+            {
+                const std::size_t end(n * (s + 1) / shares);
+                for (std::size_t i(n * s / shares); i < end; ++i)
+                {
+                    fold(partials[s], i);
+                }
+            });
+        }
+        pool.join();
+        check(pool);
+    }
+
+    for (std::size_t step(1); step < shares; step *= 2)
+    {
+        Pool pool(shares / (step * 2) + 1);
+        for (std::size_t i(0); i + step < shares; i += step * 2)
+        {
+            pool.add([&, i, step]()
+            {
+                merge(partials[i], std::move(partials[i + step]));
+            });
+        }
+        pool.join();
+        check(pool);
+    }
+
+    return std::move(partials.front());
+}
+
+} // namespace entwine
@@ -0,0 +1,165 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/reprojector.hpp>
+
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#ifdef ENTWINE_HAVE_PROJ
+#include <proj.h>
+#endif
+
+namespace entwine
+{
+
+namespace
+{
+
+#ifdef ENTWINE_HAVE_PROJ
+// The PROJ state of one thread.
+class Transforms
+{
+public:
+    Transforms() : m_ctx(proj_context_create()) { }
+
+    ~Transforms()
+    {
+        for (auto& p : m_transforms) proj_destroy(p.second);
+        proj_context_destroy(m_ctx);
+    }
+
+    PJ* get(const std::string& in, const std::string& out)
+    {
+        PJ*& transform = m_transforms[std::make_pair(in, out)];
+        if (transform) return transform;
+
+        PJ* raw = proj_create_crs_to_crs(
+            m_ctx,
+            in.c_str(),
+            out.c_str(),
+            nullptr);
+        if (!raw)
+        {
+            m_transforms.erase(std::make_pair(in, out));
+            throw std::runtime_error(
+                "Failed to create transformation from " + in + " to " + out);
+        }
+
+        // Keep our coordinates in easting, northing order regardless of the
+        // axis order declared by either SRS.
+        transform = proj_normalize_for_visualization(m_ctx, raw);
+        proj_destroy(raw);
+        if (!transform)
+        {
+            m_transforms.erase(std::make_pair(in, out));
+            throw std::runtime_error(
+                "Failed to normalize transformation to " + out);
+        }
+        return transform;
+    }
+
+    std::vector<PJ_COORD>& coords() { return m_coords; }
+
+private:
+    PJ_CONTEXT* m_ctx;
+    std::map<std::pair<std::string, std::string>, PJ*> m_transforms;
+    std::vector<PJ_COORD> m_coords;
+
+    Transforms(const Transforms& other) = delete;
+};
+
+Transforms& transforms()
+{
+    thread_local Transforms t;
+    return t;
+}
+#endif
+
+} // unnamed namespace
+
+Reprojector::Reprojector(const std::string in, const std::string out)
+    : m_in(in)
+    , m_out(out)
+{
+    if (!available())
+    {
+        throw std::runtime_error("Entwine was built without PROJ");
+    }
+    if (m_in.empty()) throw std::runtime_error("No input SRS to reproject");
+    if (m_out.empty()) throw std::runtime_error("Empty output projection");
+}
+
+bool Reprojector::available()
+{
+#ifdef ENTWINE_HAVE_PROJ
+    return true;
+#else
+    return false;
+#endif
+}
+
+optional<Reprojection> Reprojector::extract(json& pipeline)
+{
+    if (!available() || pipeline.size() < 2) return { };
+
+    const json& stage(pipeline.back());
+    if (stage.value("type", "") != "filters.reprojection") return { };
+    if (!stage.count("out_srs")) return { };
+
+    // Any options beyond the SRS are left for PDAL to handle.
+    for (const auto& p : stage.items())
+    {
+        const std::string& key(p.key());
+        if (key != "type" && key != "in_srs" && key != "out_srs") return { };
+    }
+
+    const Reprojection reprojection(
+        stage.value("in_srs", ""),
+        stage.value("out_srs", ""));
+    pipeline.erase(pipeline.size() - 1);
+    return reprojection;
+}
+
+void Reprojector::transform(const VectorPointTable::Batch& batch) const
+{
+#ifdef ENTWINE_HAVE_PROJ
+    Transforms& t(transforms());
+    PJ* transform(t.get(m_in, m_out));
+
+    std::vector<PJ_COORD>& coords(t.coords());
+    coords.clear();
+    for (pdal::PointId i(0); i < batch.size(); ++i)
+    {
+        if (batch.skip(i)) continue;
+        const Point p(batch.point(i));
+        coords.push_back(proj_coord(p.x, p.y, p.z, 0));
+    }
+
+    // Failed points are set to HUGE_VAL, which will fall outside of any
+    // bounds, so the error is not fatal for the batch.
+    proj_trans_array(transform, PJ_FWD, coords.size(), coords.data());
+
+    auto it(coords.begin());
+    for (pdal::PointId i(0); i < batch.size(); ++i)
+    {
+        if (batch.skip(i)) continue;
+        const PJ_XYZ& c(it->xyz);
+        batch.setPoint(i, Point(c.x, c.y, c.z));
+        ++it;
+    }
+#else
+    throw std::runtime_error("Entwine was built without PROJ");
+#endif
+}
+
+} // namespace entwine
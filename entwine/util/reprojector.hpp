@@ -0,0 +1,49 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <string>
+
+#include <entwine/types/reprojection.hpp>
+#include <entwine/types/vector-point-table.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/optional.hpp>
+
+namespace entwine
+{
+
+// Transforms the coordinates of whole batches of points with PROJ, in place of
+// a filters.reprojection stage.  PROJ transformations may not be shared across
+// threads, so each thread keeps its own for each pair of SRS strings, created
+// on first use and reused by every file the thread reads.
+class Reprojector
+{
+public:
+    Reprojector(std::string in, std::string out);
+
+    // Whether we were built with PROJ.  Otherwise reprojection is left to the
+    // pipeline.
+    static bool available();
+
+    // If the final stage of this pipeline is a plain filters.reprojection
+    // which we may perform ourselves, remove it and return its SRS options.
+    static optional<Reprojection> extract(json& pipeline);
+
+    // Transform the XYZ coordinates of each point of this batch.  Points which
+    // cannot be transformed are left non-finite.
+    void transform(const VectorPointTable::Batch& batch) const;
+
+private:
+    const std::string m_in;
+    const std::string m_out;
+};
+
+} // namespace entwine
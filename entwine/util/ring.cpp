@@ -0,0 +1,333 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/ring.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ENTWINE_IO_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+namespace entwine
+{
+
+struct Ring::Op
+{
+    int fd = -1;
+    std::string path;
+    Data data;
+    uint64_t offset = 0;
+    Done done;
+    std::string error;
+};
+
+#ifdef ENTWINE_IO_URING
+
+namespace
+{
+
+// Submissions are made by writers themselves once this many are queued, and
+// otherwise by our reaper as it waits.
+const uint64_t submitBatch(32);
+
+// Completions of close operations are told apart from those of writes by the
+// low bit of their user data, which is free since operations are aligned.
+const uint64_t closeBit(1);
+
+int enter(int fd, unsigned submit, unsigned wait)
+{
+    return syscall(
+        __NR_io_uring_enter,
+        fd,
+        submit,
+        wait,
+        wait ? IORING_ENTER_GETEVENTS : 0,
+        nullptr,
+        0);
+}
+
+template <typename T>
+T* at(void* base, uint64_t offset)
+{
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+} // unnamed namespace
+
+std::unique_ptr<Ring> Ring::create(const uint64_t entries)
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    const long fd(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) return std::unique_ptr<Ring>();
+
+    // Writes and closes need a 5.6 kernel, and fast poll arrived just after.
+    if (!(params.features & IORING_FEAT_FAST_POLL))
+    {
+        ::close(fd);
+        return std::unique_ptr<Ring>();
+    }
+
+    try { return std::unique_ptr<Ring>(new Ring(fd, &params)); }
+    catch (...) { return std::unique_ptr<Ring>(); }
+}
+
+Ring::Ring(const int fd, const void* p)
+    : m_fd(fd)
+{
+    const io_uring_params& params(*static_cast<const io_uring_params*>(p));
+
+    m_sqBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    m_sqeBytes = params.sq_entries * sizeof(io_uring_sqe);
+
+    const bool single(params.features & IORING_FEAT_SINGLE_MMAP);
+    if (single) m_sqBytes = m_cqBytes = std::max(m_sqBytes, m_cqBytes);
+
+    const int prot(PROT_READ | PROT_WRITE);
+    const int flags(MAP_SHARED | MAP_POPULATE);
+    m_sq = ::mmap(nullptr, m_sqBytes, prot, flags, fd, IORING_OFF_SQ_RING);
+    m_cq = single
+        ? m_sq
+        : ::mmap(nullptr, m_cqBytes, prot, flags, fd, IORING_OFF_CQ_RING);
+    m_sqes = ::mmap(nullptr, m_sqeBytes, prot, flags, fd, IORING_OFF_SQES);
+
+    if (m_sq == MAP_FAILED || m_cq == MAP_FAILED || m_sqes == MAP_FAILED)
+    {
+        if (m_sq != MAP_FAILED) ::munmap(m_sq, m_sqBytes);
+        if (m_cq != MAP_FAILED && !single) ::munmap(m_cq, m_cqBytes);
+        if (m_sqes != MAP_FAILED) ::munmap(m_sqes, m_sqeBytes);
+        ::close(fd);
+        throw std::runtime_error("Failed to map io_uring");
+    }
+
+    m_sqHead = at<unsigned>(m_sq, params.sq_off.head);
+    m_sqTail = at<unsigned>(m_sq, params.sq_off.tail);
+    m_sqMask = *at<unsigned>(m_sq, params.sq_off.ring_mask);
+    m_sqEntries = params.sq_entries;
+    m_sqArray = at<unsigned>(m_sq, params.sq_off.array);
+
+    m_cqHead = at<unsigned>(m_cq, params.cq_off.head);
+    m_cqTail = at<unsigned>(m_cq, params.cq_off.tail);
+    m_cqMask = *at<unsigned>(m_cq, params.cq_off.ring_mask);
+    m_cqEntries = params.cq_entries;
+    m_cqes = at<void>(m_cq, params.cq_off.cqes);
+
+    m_reaper = std::thread([this]() { reap(); });
+}
+
+Ring::~Ring()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_cv.notify_all();
+    m_reaper.join();
+
+    ::munmap(m_sqes, m_sqeBytes);
+    if (m_cq != m_sq) ::munmap(m_cq, m_cqBytes);
+    ::munmap(m_sq, m_sqBytes);
+    ::close(m_fd);
+}
+
+void Ring::write(const std::string& path, Data data, Done done)
+{
+    const int flags(O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+    int fd(::open(path.c_str(), flags, 0644));
+    if (fd < 0 && errno == ENOENT && arbiter::mkdirp(arbiter::getDirname(path)))
+    {
+        fd = ::open(path.c_str(), flags, 0644);
+    }
+    if (fd < 0)
+    {
+        throw std::runtime_error(
+            "Failed to open " + path + ": " + std::strerror(errno));
+    }
+
+    Op* op(new Op());
+    op->fd = fd;
+    op->path = path;
+    op->data = data;
+    op->done = done;
+
+    // Each file may have a write and then a close outstanding, so this keeps
+    // both of our queues from overflowing.
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return m_inFlight < m_sqEntries / 4; });
+
+    // An empty file has nothing to write, so it only needs to be closed.
+    ++m_inFlight;
+    if (data->empty()) queueClose(*op);
+    else queueWrite(*op);
+    if (m_unsubmitted >= submitBatch) submit(lock);
+
+    lock.unlock();
+    m_cv.notify_all();
+}
+
+void Ring::queueWrite(Op& op)
+{
+    const unsigned tail(*m_sqTail);
+    const unsigned index(tail & m_sqMask);
+    io_uring_sqe& sqe(static_cast<io_uring_sqe*>(m_sqes)[index]);
+    std::memset(&sqe, 0, sizeof(sqe));
+
+    // A single write is limited to 32 bits, so large files are written in
+    // parts, as are files whose writes came up short.
+    const uint64_t remaining(op.data->size() - op.offset);
+    sqe.opcode = IORING_OP_WRITE;
+    sqe.fd = op.fd;
+    sqe.addr = reinterpret_cast<uint64_t>(op.data->data() + op.offset);
+    sqe.len = std::min<uint64_t>(remaining, 1u << 30);
+    sqe.off = op.offset;
+    sqe.user_data = reinterpret_cast<uint64_t>(&op);
+
+    m_sqArray[index] = index;
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++m_unsubmitted;
+}
+
+void Ring::queueClose(Op& op)
+{
+    const unsigned tail(*m_sqTail);
+    const unsigned index(tail & m_sqMask);
+    io_uring_sqe& sqe(static_cast<io_uring_sqe*>(m_sqes)[index]);
+    std::memset(&sqe, 0, sizeof(sqe));
+
+    sqe.opcode = IORING_OP_CLOSE;
+    sqe.fd = op.fd;
+    sqe.user_data = reinterpret_cast<uint64_t>(&op) | closeBit;
+
+    m_sqArray[index] = index;
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++m_unsubmitted;
+}
+
+void Ring::submit(std::unique_lock<std::mutex>&)
+{
+    while (m_unsubmitted)
+    {
+        const int n(enter(m_fd, m_unsubmitted, 0));
+        if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            throw std::runtime_error(
+                std::string("Failed to submit to io_uring: ") +
+                std::strerror(errno));
+        }
+        if (n > 0) m_unsubmitted -= n;
+    }
+}
+
+void Ring::reap()
+{
+    std::vector<std::pair<uint64_t, int>> completions;
+    while (true)
+    {
+        unsigned submit(0);
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this]() { return m_inFlight || m_done; });
+            if (!m_inFlight) return;
+            submit = m_unsubmitted;
+            m_unsubmitted = 0;
+        }
+
+        // Submit whatever is queued and wait for at least one completion.
+        // Every file in flight has an operation outstanding, so one comes.
+        const int n(enter(m_fd, submit, 1));
+        if (static_cast<unsigned>(std::max(n, 0)) < submit)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_unsubmitted += submit - std::max(n, 0);
+        }
+
+        unsigned head(*m_cqHead);
+        const unsigned tail(__atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE));
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe& cqe(
+                static_cast<io_uring_cqe*>(m_cqes)[head & m_cqMask]);
+            completions.emplace_back(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+
+        for (const auto& c : completions) complete(c.first, c.second);
+        completions.clear();
+    }
+}
+
+void Ring::complete(const uint64_t userData, const int result)
+{
+    Op* op(reinterpret_cast<Op*>(userData & ~closeBit));
+    const bool closed(userData & closeBit);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!closed)
+    {
+        // A file is only closed once it has been written in full, or failed.
+        if (result > 0) op->offset += result;
+        if (result > 0 && op->offset < op->data->size()) queueWrite(*op);
+        else
+        {
+            if (result <= 0)
+            {
+                op->error = "Failed to write " + op->path + ": " +
+                    (result < 0 ? std::strerror(-result) : "no progress");
+            }
+            queueClose(*op);
+        }
+        return;
+    }
+
+    if (result < 0 && op->error.empty())
+    {
+        op->error = "Failed to close " + op->path + ": " +
+            std::strerror(-result);
+    }
+
+    --m_inFlight;
+    lock.unlock();
+    m_cv.notify_all();
+
+    op->done(op->error.empty()
+        ? std::exception_ptr()
+        : std::make_exception_ptr(std::runtime_error(op->error)));
+    delete op;
+}
+
+#else
+
+std::unique_ptr<Ring> Ring::create(uint64_t) { return std::unique_ptr<Ring>(); }
+Ring::Ring(const int fd, const void*) : m_fd(fd) { }
+Ring::~Ring() { }
+void Ring::write(const std::string&, Data, Done) { }
+void Ring::queueWrite(Op&) { }
+void Ring::queueClose(Op&) { }
+void Ring::submit(std::unique_lock<std::mutex>&) { }
+void Ring::reap() { }
+void Ring::complete(uint64_t, int) { }
+
+#endif
+
+} // namespace entwine
@@ -0,0 +1,101 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace entwine
+{
+
+// Writes whole local files through a Linux io_uring.  Each file is opened by
+// the calling thread, and then its write is queued, and submitted in batches
+// along with those of other files, so that many files cost a few system calls
+// rather than several each.  Their completions are reaped by a dedicated
+// thread, which queues the close of each file once it has been written in
+// full, and then calls its callback once it is closed.
+//
+// Only supported on Linux with io_uring - elsewhere, or if the kernel or its
+// security policy refuses a ring, create() returns null and callers should
+// write files directly.
+class Ring
+{
+public:
+    using Data = std::shared_ptr<const std::vector<char>>;
+
+    // Called once the file has been written and closed, with any error.
+    using Done = std::function<void(std::exception_ptr)>;
+
+    static std::unique_ptr<Ring> create(uint64_t entries);
+
+    // Waits for every queued file.
+    ~Ring();
+
+    // Queue this data to be written to this path, which is replaced if it
+    // exists.  Throws if the file cannot be opened, in which case done is not
+    // called.  Blocks while our completion queue is full.
+    void write(const std::string& path, Data data, Done done);
+
+private:
+    struct Op;
+
+    Ring(int fd, const void* params);
+
+    // Queue an operation on an open file, with our mutex held.
+    void queueWrite(Op& op);
+    void queueClose(Op& op);
+    void submit(std::unique_lock<std::mutex>& lock);
+
+    void reap();
+    void complete(uint64_t userData, int result);
+
+    const int m_fd;
+
+    // Our mappings of the submission queue, its entries, and the completion
+    // queue, and their sizes.
+    void* m_sq = nullptr;
+    void* m_sqes = nullptr;
+    void* m_cq = nullptr;
+    uint64_t m_sqBytes = 0;
+    uint64_t m_sqeBytes = 0;
+    uint64_t m_cqBytes = 0;
+
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    unsigned* m_sqArray = nullptr;
+
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    unsigned m_cqEntries = 0;
+    void* m_cqes = nullptr;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    uint64_t m_unsubmitted = 0;
+    uint64_t m_inFlight = 0;
+    bool m_done = false;
+    std::thread m_reaper;
+
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+};
+
+} // namespace entwine
@@ -0,0 +1,201 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/sax.hpp>
+
+#include <stdexcept>
+#include <vector>
+
+namespace entwine
+{
+namespace sax
+{
+
+namespace
+{
+
+using Sax = nsjson::json_sax<json>;
+
+class Handler : public Sax
+{
+public:
+    bool parse_error(
+        std::size_t position,
+        const std::string&,
+        const nsjson::detail::exception& e) override
+    {
+        throw std::runtime_error(
+            "Invalid JSON at " + std::to_string(position) + ": " + e.what());
+    }
+};
+
+class IntegerHandler : public Handler
+{
+public:
+    explicit IntegerHandler(
+            const std::function<void(std::string&, int64_t)>& f)
+        : m_f(f)
+    { }
+
+    bool null() override { return fail(); }
+    bool boolean(bool) override { return fail(); }
+    bool number_integer(number_integer_t v) override { return add(v); }
+    bool number_unsigned(number_unsigned_t v) override { return add(v); }
+    bool number_float(number_float_t, const string_t&) override
+    {
+        return fail();
+    }
+    bool string(string_t&) override { return fail(); }
+
+    bool start_object(std::size_t) override
+    {
+        if (m_started) return fail();
+        m_started = true;
+        return true;
+    }
+    bool key(string_t& k) override
+    {
+        m_key.swap(k);
+        return true;
+    }
+    bool end_object() override { return true; }
+    bool start_array(std::size_t) override { return fail(); }
+    bool end_array() override { return fail(); }
+
+private:
+    bool add(int64_t v)
+    {
+        m_f(m_key, v);
+        return true;
+    }
+
+    bool fail()
+    {
+        throw std::runtime_error("Expected a flat object of integers");
+    }
+
+    const std::function<void(std::string&, int64_t)>& m_f;
+    bool m_started = false;
+    std::string m_key;
+};
+
+class ElementHandler : public Handler
+{
+public:
+    explicit ElementHandler(const std::function<void(json&&)>& f) : m_f(f) { }
+
+    bool null() override { return add(json()); }
+    bool boolean(bool v) override { return add(v); }
+    bool number_integer(number_integer_t v) override { return add(v); }
+    bool number_unsigned(number_unsigned_t v) override { return add(v); }
+    bool number_float(number_float_t v, const string_t&) override
+    {
+        return add(v);
+    }
+    bool string(string_t& v) override { return add(std::move(v)); }
+
+    bool start_object(std::size_t) override
+    {
+        return open(json::object());
+    }
+    bool key(string_t& k) override
+    {
+        m_key.swap(k);
+        return true;
+    }
+    bool end_object() override { return close(); }
+
+    bool start_array(std::size_t) override
+    {
+        // Our outermost array is not itself held.
+        if (m_started) return open(json::array());
+        m_started = true;
+        return true;
+    }
+    bool end_array() override
+    {
+        if (m_stack.empty()) return true;
+        return close();
+    }
+
+private:
+    json* insert(json&& v)
+    {
+        if (!m_started) throw std::runtime_error("Expected an array");
+
+        if (m_stack.empty())
+        {
+            m_current = std::move(v);
+            return &m_current;
+        }
+
+        json& parent(*m_stack.back());
+        if (parent.is_array())
+        {
+            parent.push_back(std::move(v));
+            return &parent.back();
+        }
+        return &(parent[m_key] = std::move(v));
+    }
+
+    bool add(json&& v)
+    {
+        if (m_stack.empty() && m_started)
+        {
+            m_f(std::move(v));
+            return true;
+        }
+        insert(std::move(v));
+        return true;
+    }
+
+    bool open(json&& v)
+    {
+        m_stack.push_back(insert(std::move(v)));
+        return true;
+    }
+
+    bool close()
+    {
+        m_stack.pop_back();
+        if (m_stack.empty()) m_f(std::move(m_current));
+        return true;
+    }
+
+    const std::function<void(json&&)>& m_f;
+    bool m_started = false;
+    std::string m_key;
+
+    // The element currently being parsed, and the path to its innermost open
+    // container.
+    json m_current;
+    std::vector<json*> m_stack;
+};
+
+} // unnamed namespace
+
+void forEachInteger(
+    const std::string& data,
+    const std::function<void(std::string&, int64_t)>& f)
+{
+    IntegerHandler handler(f);
+    json::sax_parse(data.begin(), data.end(), &handler);
+}
+
+void forEachElement(
+    const std::string& data,
+    const std::function<void(json&&)>& f)
+{
+    ElementHandler handler(f);
+    json::sax_parse(data.begin(), data.end(), &handler);
+}
+
+} // namespace sax
+} // namespace entwine
@@ -0,0 +1,40 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+// Streaming parsers for our largest documents, which avoid building a DOM of
+// the entire document.
+namespace sax
+{
+
+// Parse a flat JSON object of integer values, calling f(key, value) for each
+// of its entries in document order.
+void forEachInteger(
+    const std::string& data,
+    const std::function<void(std::string&, int64_t)>& f);
+
+// Parse a JSON array, calling f(element) with each of its elements in turn, so
+// that only a single element is ever held as a DOM.
+void forEachElement(
+    const std::string& data,
+    const std::function<void(json&&)>& f);
+
+} // namespace sax
+} // namespace entwine
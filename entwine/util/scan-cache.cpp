@@ -0,0 +1,91 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/scan-cache.hpp>
+
+#include <sys/stat.h>
+
+#include <entwine/util/io.hpp>
+
+namespace entwine
+{
+
+ScanCache::ScanCache(const arbiter::Arbiter& a, const std::string path)
+    : m_arbiter(a)
+    , m_ep(a.getEndpoint(path))
+{
+    if (m_ep.isLocal()) arbiter::mkdirp(m_ep.root());
+}
+
+std::string ScanCache::getKey(
+    const std::string& path,
+    const bool deep,
+    const json& pipelineTemplate) const
+{
+    json version;
+    if (m_arbiter.isLocal(path))
+    {
+        struct stat s;
+        const std::string local(
+            arbiter::expandTilde(arbiter::stripProtocol(path)));
+        if (::stat(local.c_str(), &s)) return "";
+        version = { { "size", s.st_size }, { "mtime", s.st_mtime } };
+    }
+    else
+    {
+        // A rewrite of the same size is common for remote data, so without
+        // an ETag or modification time this file is not cached at all.
+        const auto size(m_arbiter.tryGetSize(path));
+        const auto tag(m_arbiter.tryGetVersion(path));
+        if (!size || !tag) return "";
+        version = { { "size", *size }, { "tag", *tag } };
+    }
+
+    const json key {
+        { "path", path },
+        { "version", version },
+        { "deep", deep },
+        { "pipeline", pipelineTemplate }
+    };
+    return key.dump();
+}
+
+optional<SourceInfo> ScanCache::get(const std::string& key) const
+{
+    const auto data(m_ep.tryGet(filename(key)));
+    if (!data) return { };
+
+    try
+    {
+        // Guard against hash collisions, and against corrupted entries.
+        const json j(json::parse(*data));
+        if (j.at("key").get<std::string>() != key) return { };
+        return j.at("info").get<SourceInfo>();
+    }
+    catch (...)
+    {
+        return { };
+    }
+}
+
+void ScanCache::put(const std::string& key, const SourceInfo& info) const
+{
+    // A failed write only costs a repeated analysis of this file next time,
+    // so it does not fail the scan.
+    const json j { { "key", key }, { "info", info } };
+    putWithRetry(m_ep, filename(key), j.dump());
+}
+
+std::string ScanCache::filename(const std::string& key) const
+{
+    return arbiter::crypto::encodeAsHex(arbiter::crypto::md5(key)) + ".json";
+}
+
+} // namespace entwine
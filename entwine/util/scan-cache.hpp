@@ -0,0 +1,52 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <string>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/source.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/optional.hpp>
+
+namespace entwine
+{
+
+// A persistent cache of analysis results, so that unchanged files need not be
+// analyzed again.  Entries are stored one per file, named by a hash of the
+// file's path, version, and the analysis settings.  A file's version is its
+// size and modification time for local files, or its size and ETag, or last
+// modification time, for remote files.  Remote files for which neither is
+// available are not cached.
+class ScanCache
+{
+public:
+    ScanCache(const arbiter::Arbiter& a, std::string path);
+
+    // Returns the cache key for analyzing this file with these settings, or
+    // an empty string if the version of this file cannot be determined.
+    std::string getKey(
+        const std::string& path,
+        bool deep,
+        const json& pipelineTemplate) const;
+
+    // Returns the cached info for this key, if any.
+    optional<SourceInfo> get(const std::string& key) const;
+    void put(const std::string& key, const SourceInfo& info) const;
+
+private:
+    std::string filename(const std::string& key) const;
+
+    const arbiter::Arbiter& m_arbiter;
+    const arbiter::Endpoint m_ep;
+};
+
+} // namespace entwine
@@ -0,0 +1,68 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <entwine/builder/heuristics.hpp>
+
+namespace entwine
+{
+
+// A vector leased from a free list held by the calling thread, to which it is
+// returned on destruction with its capacity intact.  Buffers which are needed
+// only for the duration of a call, like those in which nodes are serialized,
+// are then reallocated only when a node outgrows them.  Leases may be nested,
+// and a vector which has grown beyond heuristics::scratchBytes is freed on
+// return, so that a single large node does not leave its memory pinned.
+template <typename T>
+class Scratch
+{
+public:
+    Scratch()
+    {
+        auto& free(getFree());
+        if (free.empty()) return;
+        m_data.swap(free.back());
+        free.pop_back();
+    }
+
+    ~Scratch()
+    {
+        if (m_data.capacity() * sizeof(T) > heuristics::scratchBytes) return;
+
+        auto& free(getFree());
+        if (free.size() >= heuristics::scratchThreadCache) return;
+
+        m_data.clear();
+        try { free.push_back(std::move(m_data)); }
+        catch (...) { }
+    }
+
+    std::vector<T>& get() { return m_data; }
+    std::vector<T>* operator->() { return &m_data; }
+
+private:
+    static std::vector<std::vector<T>>& getFree()
+    {
+        thread_local std::vector<std::vector<T>> free;
+        return free;
+    }
+
+    std::vector<T> m_data;
+
+    Scratch(const Scratch&) = delete;
+    Scratch& operator=(const Scratch&) = delete;
+};
+
+} // namespace entwine
@@ -0,0 +1,120 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/simulated.hpp>
+
+#include <algorithm>
+#include <thread>
+
+namespace entwine
+{
+
+namespace
+{
+
+const std::string prefix("sim://");
+
+} // unnamed namespace
+
+SimulatedDriver::SimulatedDriver(const Options options)
+    : m_options(options)
+    , m_fs(arbiter::drivers::Fs::create())
+    , m_random(options.seed)
+    , m_free(Clock::now())
+{ }
+
+std::unique_ptr<std::size_t> SimulatedDriver::tryGetSize(
+    const std::string path) const
+{
+    request(path);
+    return m_fs->tryGetSize(path);
+}
+
+void SimulatedDriver::put(
+    const std::string path,
+    const std::vector<char>& data) const
+{
+    request(path);
+    transfer(data.size());
+
+    const std::string dir(arbiter::getDirname(path));
+    if (dir.size() && !arbiter::mkdirp(dir))
+    {
+        throw arbiter::ArbiterError("Could not create " + dir);
+    }
+    m_fs->put(path, data);
+}
+
+bool SimulatedDriver::get(const std::string path, std::vector<char>& data)
+    const
+{
+    request(path);
+
+    std::unique_ptr<std::vector<char>> result(m_fs->tryGetBinary(path));
+    if (!result) return false;
+
+    transfer(result->size());
+    data = std::move(*result);
+    return true;
+}
+
+std::vector<std::string> SimulatedDriver::glob(
+    const std::string path,
+    const bool verbose) const
+{
+    request(path);
+
+    // Unlike those of other drivers, the results of the filesystem driver are
+    // not prefixed.
+    std::vector<std::string> results(m_fs->resolve(path, verbose));
+    for (std::string& result : results) result = prefix + result;
+    return results;
+}
+
+void SimulatedDriver::request(const std::string& path) const
+{
+    bool fail(false);
+    if (m_options.failureRate > 0)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::uniform_real_distribution<double> d(0, 1);
+        fail = d(m_random) < m_options.failureRate;
+    }
+
+    if (m_options.latency > 0)
+    {
+        std::this_thread::sleep_for(
+            std::chrono::duration<double>(m_options.latency));
+    }
+
+    if (fail) throw arbiter::ArbiterError("Simulated failure of " + path);
+}
+
+void SimulatedDriver::transfer(const uint64_t bytes) const
+{
+    if (m_options.bandwidth <= 0) return;
+
+    // Transfers are served one after another at our full bandwidth, so a
+    // transfer ends once those ahead of it, and it, have been sent.
+    const auto duration(
+        std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(bytes / m_options.bandwidth)));
+
+    Clock::time_point done;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free = std::max(m_free, Clock::now()) + duration;
+        done = m_free;
+    }
+
+    std::this_thread::sleep_until(done);
+}
+
+} // namespace entwine
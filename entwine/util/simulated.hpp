@@ -0,0 +1,81 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+
+namespace entwine
+{
+
+// An arbiter driver for paths of the form sim://<local path>, which are stored
+// on the local filesystem but accessed as if they were remote: each request
+// is delayed by a fixed latency, transfers share a bandwidth limit, and
+// requests fail at random at a given rate, so that remote behavior may be
+// reproduced locally.  Like an object store, writes create their parent
+// directories.
+class SimulatedDriver : public arbiter::Driver
+{
+    using Clock = std::chrono::steady_clock;
+
+public:
+    struct Options
+    {
+        // Seconds added to every request.
+        double latency = 0;
+
+        // Bytes per second shared by all transfers, or zero for no limit.
+        double bandwidth = 0;
+
+        // The probability with which each request throws.
+        double failureRate = 0;
+
+        uint64_t seed = 0;
+    };
+
+    explicit SimulatedDriver(Options options);
+
+    using arbiter::Driver::get;
+
+    std::string type() const override { return "sim"; }
+    bool isRemote() const override { return true; }
+
+    std::unique_ptr<std::size_t> tryGetSize(std::string path) const override;
+    void put(std::string path, const std::vector<char>& data) const override;
+
+protected:
+    bool get(std::string path, std::vector<char>& data) const override;
+    std::vector<std::string> glob(std::string path, bool verbose)
+        const override;
+
+private:
+    // Wait out our latency, and throw if this request is to fail.
+    void request(const std::string& path) const;
+
+    // Wait for the transfer of this many bytes within our bandwidth limit.
+    void transfer(uint64_t bytes) const;
+
+    const Options m_options;
+    const std::unique_ptr<arbiter::drivers::Fs> m_fs;
+
+    mutable std::mutex m_mutex;
+    mutable std::mt19937_64 m_random;
+    mutable Clock::time_point m_free;
+};
+
+} // namespace entwine
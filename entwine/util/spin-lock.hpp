@@ -10,31 +10,198 @@
 
 #pragma once
 
-#ifdef SPINLOCK_AS_MUTEX
-#include <mutex>
-#else
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) \
+    || defined(_M_IX86)
+#include <immintrin.h>
 #endif
 
 namespace entwine
 {
 
+// Locks are tagged with the structure they guard, so that contention may be
+// attributed to them.
+enum class LockType
+{
+    Other,
+    Tube,
+    Chunk,
+    Overflow,
+    Slice,
+    Hierarchy
+};
+
+namespace lockstats
+{
+
+static constexpr std::size_t typeCount = 6;
+using Counts = std::array<uint64_t, typeCount>;
+
+inline std::array<std::atomic_uint64_t, typeCount>& counters()
+{
+    static std::array<std::atomic_uint64_t, typeCount> c{ };
+    return c;
+}
+
+// Record a lock acquisition which was not immediately successful.
+inline void contended(LockType type)
+{
+    counters()[static_cast<std::size_t>(type)].fetch_add(
+        1,
+        std::memory_order_relaxed);
+}
+
+inline std::array<std::atomic_uint64_t, typeCount>& waitTimes()
+{
+    static std::array<std::atomic_uint64_t, typeCount> w{ };
+    return w;
+}
+
+// Record nanoseconds spent waiting for a contended lock.
+inline void waited(LockType type, uint64_t ns)
+{
+    waitTimes()[static_cast<std::size_t>(type)].fetch_add(
+        ns,
+        std::memory_order_relaxed);
+}
+
+// Get the total nanoseconds spent waiting on each type of lock.  Unlike the
+// contention counts, these are never reset.
+inline Counts waits()
+{
+    Counts result;
+    auto& w(waitTimes());
+    for (std::size_t i(0); i < typeCount; ++i) result[i] = w[i].load();
+    return result;
+}
+
+// Get the contention counts since the previous call, and reset them.
+inline Counts latch()
+{
+    Counts result;
+    auto& c(counters());
+    for (std::size_t i(0); i < typeCount; ++i) result[i] = c[i].exchange(0);
+    return result;
+}
+
+inline uint64_t nanosSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+inline std::string toString(LockType type)
+{
+    switch (type)
+    {
+        case LockType::Other: return "other";
+        case LockType::Tube: return "tube";
+        case LockType::Chunk: return "chunk";
+        case LockType::Overflow: return "overflow";
+        case LockType::Slice: return "slice";
+        case LockType::Hierarchy: return "hierarchy";
+    }
+    return "unknown";
+}
+
+} // namespace lockstats
+
 #ifdef SPINLOCK_AS_MUTEX
 
-using SpinLock = std::mutex;
+class SpinLock : public std::mutex
+{
+public:
+    explicit SpinLock(LockType type = LockType::Other) : m_type(type) { }
+
+    void lock()
+    {
+        if (try_lock()) return;
+        lockstats::contended(m_type);
+        const auto start(std::chrono::steady_clock::now());
+        std::mutex::lock();
+        lockstats::waited(m_type, lockstats::nanosSince(start));
+    }
+
+private:
+    const LockType m_type;
+};
 
 #else
 
+// A lock which spins briefly, then yields, and finally sleeps with backoff
+// while it remains held, so waiters on oversubscribed hosts don't burn the
+// CPU time needed by the holder.
 class SpinLock
 {
 public:
-    SpinLock() = default;
+    explicit SpinLock(LockType type = LockType::Other) : m_type(type) { }
+
+    void lock()
+    {
+        if (try_lock()) return;
+        lockstats::contended(m_type);
+        const auto start(std::chrono::steady_clock::now());
+        lockSlow();
+        lockstats::waited(m_type, lockstats::nanosSince(start));
+    }
+
+    bool try_lock()
+    {
+        return !m_locked.exchange(true, std::memory_order_acquire);
+    }
 
-    void lock() { while (m_flag.test_and_set()) ; }
-    void unlock() { m_flag.clear(); }
+    void unlock() { m_locked.store(false, std::memory_order_release); }
 
 private:
-    std::atomic_flag m_flag = ATOMIC_FLAG_INIT;
+    static void relax()
+    {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) \
+    || defined(_M_IX86)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield");
+#endif
+    }
+
+    void lockSlow()
+    {
+        const uint64_t spins(64);
+        const uint64_t yields(spins + 16);
+        const uint64_t maxSleepUs(256);
+
+        uint64_t attempt(0);
+        uint64_t sleepUs(1);
+
+        do
+        {
+            // Wait for the lock to appear free before trying to take it, to
+            // avoid bouncing its cache line between waiters.
+            while (m_locked.load(std::memory_order_relaxed))
+            {
+                if (attempt < spins) relax();
+                else if (attempt < yields) std::this_thread::yield();
+                else
+                {
+                    std::this_thread::sleep_for(
+                        std::chrono::microseconds(sleepUs));
+                    if (sleepUs < maxSleepUs) sleepUs *= 2;
+                }
+                ++attempt;
+            }
+        }
+        while (!try_lock());
+    }
+
+    std::atomic_bool m_locked{ false };
+    const LockType m_type;
 
     SpinLock(const SpinLock& other) = delete;
 };
@@ -0,0 +1,125 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/sweep.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include <entwine/types/defs.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+
+// Our outputs other than node files are each listed as a whole.
+const std::vector<std::string> directories = {
+    "ept-hierarchy",
+    "ept-sources",
+    "ept-node-stats",
+    "ept-node-sizes",
+    "ept-provenance",
+    "ept-preview"
+};
+
+// The most files removed by a single request, which is the most that a
+// single S3 DeleteObjects request accepts.
+const std::size_t batchSize(1000);
+
+} // unnamed namespace
+
+Sweep::Sweep(
+        const arbiter::Arbiter& a,
+        const arbiter::Endpoint& output,
+        const unsigned threads)
+    : m_arbiter(a)
+    , m_threads(threads)
+    , m_pool(new Pool(threads, 0, false))
+{
+    const std::string root(output.prefixedRoot());
+
+    // Node files are listed one depth at a time, so that listings of remote
+    // prefixes, which are paginated, proceed in parallel.
+    for (uint64_t d(0); d <= maxDepth; ++d)
+    {
+        const std::string glob(root + "ept-data/" + std::to_string(d) + "-*");
+        m_pool->add([this, glob]() { list(glob); });
+    }
+    for (const std::string& dir : directories)
+    {
+        const std::string glob(root + dir + "/**");
+        m_pool->add([this, glob]() { list(glob); });
+    }
+}
+
+Sweep::~Sweep() { m_pool->join(); }
+
+void Sweep::list(const std::string& glob)
+{
+    const std::vector<std::string> paths(m_arbiter.resolve(glob));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_listed.insert(m_listed.end(), paths.begin(), paths.end());
+}
+
+void Sweep::wrote(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_written.insert(path);
+}
+
+uint64_t Sweep::run(const Keep& keep)
+{
+    m_pool->join();
+    if (m_pool->errors().size())
+    {
+        throw std::runtime_error(
+            "Could not list previous outputs: " + m_pool->errors().front());
+    }
+
+    std::vector<std::string> stale;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::sort(m_listed.begin(), m_listed.end());
+        m_listed.erase(
+            std::unique(m_listed.begin(), m_listed.end()),
+            m_listed.end());
+
+        for (const std::string& path : m_listed)
+        {
+            if (!m_written.count(path) && !keep(path)) stale.push_back(path);
+        }
+    }
+
+    Pool pool(m_threads, 0, false);
+    for (std::size_t i(0); i < stale.size(); i += batchSize)
+    {
+        const auto begin(stale.begin() + i);
+        const auto end(stale.begin() + std::min(stale.size(), i + batchSize));
+        const std::vector<std::string> batch(begin, end);
+
+        pool.add([this, batch]() { m_arbiter.remove(batch); });
+    }
+    pool.join();
+
+    if (pool.errors().size())
+    {
+        throw std::runtime_error(
+            "Could not remove previous outputs: " + pool.errors().front());
+    }
+
+    return stale.size();
+}
+
+} // namespace entwine
@@ -0,0 +1,65 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+
+namespace entwine
+{
+
+class Pool;
+
+// The removal of whatever a previous build left at our output which a forced
+// rebuild does not overwrite.  Our output prefixes are listed in the
+// background as the build begins, and every file written through our io
+// functions meanwhile is noted, so that once the build is saved, the listed
+// files which were not rewritten are removed in parallel batches.
+class Sweep
+{
+public:
+    Sweep(
+        const arbiter::Arbiter& a,
+        const arbiter::Endpoint& output,
+        unsigned threads);
+    ~Sweep();
+
+    // Note that the file at this full path has been written.
+    void wrote(const std::string& path);
+
+    // Await our listing and remove the files listed which have not been
+    // written, unless kept by this filter of their full paths, which guards
+    // against writes which were not noted.  Returns the number of files
+    // removed.
+    using Keep = std::function<bool(const std::string&)>;
+    uint64_t run(const Keep& keep);
+
+private:
+    void list(const std::string& glob);
+
+    const arbiter::Arbiter& m_arbiter;
+    const unsigned m_threads;
+
+    std::unique_ptr<Pool> m_pool;
+
+    std::mutex m_mutex;
+    std::vector<std::string> m_listed;
+    std::set<std::string> m_written;
+};
+
+} // namespace entwine
@@ -0,0 +1,173 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/synthetic.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace entwine
+{
+namespace synthetic
+{
+
+namespace
+{
+
+const double pi(3.14159265358979323846);
+
+const uint64_t clusterCount(16);
+const double clusterRadius(0.03);
+
+const uint64_t stripCount(8);
+const double stripWidth(0.6);
+
+// The standard distributions are implementation-defined, so we derive our
+// values from the engine directly to generate identical points everywhere.
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : m_engine(seed) { }
+
+    // Uniform in [0, 1).
+    double uniform() { return (m_engine() >> 11) * (1.0 / (1ull << 53)); }
+
+    // Standard normal, by the Box-Muller transform.
+    double normal()
+    {
+        const double u(1.0 - uniform());
+        const double v(uniform());
+        return std::sqrt(-2.0 * std::log(u)) * std::cos(2.0 * pi * v);
+    }
+
+private:
+    std::mt19937_64 m_engine;
+};
+
+// Height of our terrain in [0, 1], for normalized XY coordinates.
+double terrain(double x, double y)
+{
+    const double h(
+        0.5 +
+        0.25 * std::sin(2 * pi * 1.5 * x) * std::cos(2 * pi * y) +
+        0.15 * std::sin(2 * pi * 5 * (x + y)) +
+        0.05 * std::cos(2 * pi * 13 * x) * std::sin(2 * pi * 11 * y));
+    return std::min(std::max(h, 0.0), 1.0);
+}
+
+double clamp(double v) { return std::min(std::max(v, 0.0), 1.0); }
+
+} // unnamed namespace
+
+Distribution toDistribution(const std::string s)
+{
+    if (s == "uniform") return Distribution::Uniform;
+    if (s == "clustered") return Distribution::Clustered;
+    if (s == "terrain") return Distribution::Terrain;
+    if (s == "strips") return Distribution::Strips;
+    throw std::runtime_error("Invalid synthetic distribution: " + s);
+}
+
+std::string toString(const Distribution d)
+{
+    switch (d)
+    {
+        case Distribution::Uniform: return "uniform";
+        case Distribution::Clustered: return "clustered";
+        case Distribution::Terrain: return "terrain";
+        case Distribution::Strips: return "strips";
+    }
+    throw std::runtime_error("Invalid synthetic distribution");
+}
+
+StringList distributions()
+{
+    return { "uniform", "clustered", "terrain", "strips" };
+}
+
+std::vector<Point> generate(
+    const Distribution distribution,
+    const uint64_t count,
+    const Bounds& bounds,
+    const uint64_t seed)
+{
+    Random random(seed);
+
+    std::vector<Point> centers;
+    if (distribution == Distribution::Clustered)
+    {
+        for (uint64_t i(0); i < clusterCount; ++i)
+        {
+            centers.emplace_back(
+                random.uniform(),
+                random.uniform(),
+                random.uniform());
+        }
+    }
+
+    // Points are generated in normalized coordinates, and then scaled to our
+    // bounds.  Values on the upper edge are pulled inside.
+    const Point& min(bounds.min());
+    const Point extents(bounds.max() - bounds.min());
+    const double edge(1.0 - 1e-9);
+
+    std::vector<Point> points;
+    points.reserve(count);
+
+    for (uint64_t i(0); i < count; ++i)
+    {
+        Point p;
+        switch (distribution)
+        {
+            case Distribution::Uniform:
+            {
+                p = Point(random.uniform(), random.uniform(), random.uniform());
+                break;
+            }
+            case Distribution::Clustered:
+            {
+                const Point& c(centers[i % centers.size()]);
+                p.x = clamp(c.x + random.normal() * clusterRadius);
+                p.y = clamp(c.y + random.normal() * clusterRadius);
+                p.z = clamp(c.z + random.normal() * clusterRadius);
+                break;
+            }
+            case Distribution::Terrain:
+            {
+                p.x = random.uniform();
+                p.y = random.uniform();
+                p.z = terrain(p.x, p.y);
+                break;
+            }
+            case Distribution::Strips:
+            {
+                const uint64_t strip(i % stripCount);
+                const double offset(
+                    (1.0 - stripWidth) / 2 + stripWidth * random.uniform());
+                p.x = random.uniform();
+                p.y = (strip + offset) / stripCount;
+                p.z = terrain(p.x, p.y);
+                break;
+            }
+        }
+
+        points.emplace_back(
+            min.x + std::min(p.x, edge) * extents.x,
+            min.y + std::min(p.y, edge) * extents.y,
+            min.z + std::min(p.z, edge) * extents.z);
+    }
+
+    return points;
+}
+
+} // namespace synthetic
+} // namespace entwine
@@ -0,0 +1,58 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <entwine/types/bounds.hpp>
+#include <entwine/types/defs.hpp>
+#include <entwine/types/point.hpp>
+
+namespace entwine
+{
+namespace synthetic
+{
+
+// Synthetic point distributions for benchmarking, chosen to resemble the
+// shapes of real data which stress the tree differently.
+enum class Distribution
+{
+    // Uniform throughout the bounds.
+    Uniform,
+
+    // Gaussian clusters around a few random centers, like dense urban areas
+    // surrounded by little data.
+    Clustered,
+
+    // A smooth surface spanning the XY extents, like aerial terrain.
+    Terrain,
+
+    // Terrain covered only by parallel strips, like overlapping flight lines
+    // with gaps between them.
+    Strips
+};
+
+Distribution toDistribution(std::string s);
+std::string toString(Distribution d);
+StringList distributions();
+
+// Generate points within these bounds.  The same seed always generates the
+// same points, so that results are comparable between runs.
+std::vector<Point> generate(
+    Distribution distribution,
+    uint64_t count,
+    const Bounds& bounds,
+    uint64_t seed = 0);
+
+} // namespace synthetic
+} // namespace entwine
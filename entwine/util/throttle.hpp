@@ -0,0 +1,97 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace entwine
+{
+
+// A counting semaphore whose limit may be changed while it is in use, so that
+// a pool with more threads than it should run may be narrowed and widened at
+// runtime.  Lowering the limit does not interrupt holders - they give up
+// their slots at their next call to check() or release().
+class Throttle
+{
+public:
+    explicit Throttle(uint64_t limit) : m_limit(std::max<uint64_t>(limit, 1))
+    { }
+
+    void acquire()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return m_active < m_limit; });
+        ++m_active;
+    }
+
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_active;
+        }
+        m_cv.notify_one();
+    }
+
+    // Called between units of work by a holder, which will wait here if we
+    // are now over our limit.  Cheap while we are not.
+    void check()
+    {
+        if (m_active <= m_limit) return;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_active <= m_limit) return;
+
+        --m_active;
+        m_cv.notify_one();
+        m_cv.wait(lock, [this]() { return m_active < m_limit; });
+        ++m_active;
+    }
+
+    void limit(uint64_t v)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_limit = std::max<uint64_t>(v, 1);
+        }
+        m_cv.notify_all();
+    }
+
+    uint64_t limit() const { return m_limit; }
+
+    // Holds a slot for its lifetime.
+    class Guard
+    {
+    public:
+        explicit Guard(Throttle& t) : m_throttle(t) { m_throttle.acquire(); }
+        ~Guard() { m_throttle.release(); }
+
+    private:
+        Throttle& m_throttle;
+
+        Guard(const Guard& other) = delete;
+    };
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    // Modified only while holding our mutex, but atomic so they may be read
+    // without it.
+    std::atomic_uint64_t m_limit;
+    std::atomic_uint64_t m_active{ 0 };
+};
+
+} // namespace entwine
@@ -0,0 +1,103 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/trace.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+namespace trace
+{
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+std::mutex mutex;
+std::ofstream file;
+Clock::time_point origin;
+bool first = true;
+
+std::atomic_uint64_t nextThreadId(0);
+
+// Small sequential IDs are easier to follow in a viewer than native ones.
+uint64_t threadId()
+{
+    static thread_local const uint64_t id(++nextThreadId);
+    return id;
+}
+
+int64_t micros(Clock::duration d)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+} // unnamed namespace
+
+void start(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file.is_open()) throw std::runtime_error("Trace already started");
+
+    file.open(arbiter::expandTilde(path), std::ios::trunc);
+    if (!file) throw std::runtime_error("Could not open trace file: " + path);
+
+    file << "[\n";
+    first = true;
+    origin = Clock::now();
+    active() = true;
+}
+
+void stop()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open()) return;
+
+    active() = false;
+    file << "\n]\n";
+    file.close();
+}
+
+void Span::record() const
+{
+    const Clock::time_point end(Clock::now());
+
+    json event {
+        { "name", m_name },
+        { "ph", "X" },
+        { "pid", 1 },
+        { "tid", threadId() }
+    };
+    if (m_detail.size()) event["args"] = { { "detail", m_detail } };
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open()) return;
+
+    // Spans begun before the trace was started are clamped to its start.
+    const Clock::time_point begin(std::max(m_start, origin));
+    event["ts"] = micros(begin - origin);
+    event["dur"] = micros(end - begin);
+
+    if (!first) file << ",\n";
+    first = false;
+    file << event.dump();
+}
+
+} // namespace trace
+} // namespace entwine
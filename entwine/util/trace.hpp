@@ -0,0 +1,62 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <utility>
+
+namespace entwine
+{
+namespace trace
+{
+
+// Begin recording spans to this local path in the Chrome trace-event format,
+// which may be viewed with Perfetto or chrome://tracing.
+void start(const std::string& path);
+
+// Complete the trace file.  Spans which end afterward are not recorded.
+void stop();
+
+inline std::atomic_bool& active()
+{
+    static std::atomic_bool a(false);
+    return a;
+}
+
+inline bool enabled() { return active().load(std::memory_order_relaxed); }
+
+// Records its own lifetime, on the calling thread, as a span with this name.
+// The detail, if any, is attached as an argument of the span.
+class Span
+{
+public:
+    explicit Span(const char* name, std::string detail = "")
+        : m_name(name)
+        , m_detail(std::move(detail))
+        , m_start(std::chrono::steady_clock::now())
+    { }
+
+    ~Span() { if (enabled()) record(); }
+
+private:
+    void record() const;
+
+    const char* const m_name;
+    const std::string m_detail;
+    const std::chrono::steady_clock::time_point m_start;
+
+    Span(const Span& other) = delete;
+};
+
+} // namespace trace
+} // namespace entwine
@@ -0,0 +1,164 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/util/uploader.hpp>
+
+#include <algorithm>
+#include <memory>
+
+#include <entwine/util/io.hpp>
+#include <entwine/util/metrics.hpp>
+
+namespace entwine
+{
+
+Uploader::Uploader(
+        const uint64_t threads,
+        const uint64_t maxBytes,
+        std::unique_ptr<Ring> ring)
+    : m_maxBytes(maxBytes)
+    , m_pool(threads, threads, false)
+    , m_ring(std::move(ring))
+{ }
+
+Uploader::~Uploader()
+{
+    try { join(); }
+    catch (...) { }
+}
+
+void Uploader::put(
+    const arbiter::Endpoint& ep,
+    const std::string& path,
+    std::vector<char> data)
+{
+    const std::string full(arbiter::join(ep.prefixedRoot(), path));
+    const uint64_t size(data.size());
+
+    {
+        // A single put larger than our limit proceeds once nothing else is
+        // pending, rather than waiting forever.
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this, size]()
+        {
+            return m_error || !m_bytes || m_bytes + size <= m_maxBytes;
+        });
+        check();
+
+        ++m_pending[full];
+        m_bytes += size;
+    }
+    metrics::add(metrics::Gauge::UploadQueue, 1);
+    metrics::add(metrics::Memory::Serialized, size);
+
+    // Lambdas cannot capture by move, so share the data rather than copying
+    // it into the task.
+    auto shared(std::make_shared<std::vector<char>>(std::move(data)));
+
+    if (m_ring && ep.isLocal())
+    {
+        // Local endpoints are never held by our read cache, so there is
+        // nothing to discard, but our sweep must spare the file.
+        noteWrite(ep.prefixedFullPath(path));
+        const auto start(metrics::Clock::now());
+        try
+        {
+            m_ring->write(
+                arbiter::expandTilde(ep.fullPath(path)),
+                shared,
+                [this, full, size, start](std::exception_ptr error)
+                {
+                    metrics::add(
+                        metrics::Timer::Upload,
+                        metrics::nanosSince(start));
+                    if (!error)
+                    {
+                        metrics::add(metrics::Counter::BytesWritten, size);
+                    }
+                    finish(full, size, error);
+                });
+        }
+        catch (...) { finish(full, size, std::current_exception()); }
+        return;
+    }
+
+    m_pool.add([this, ep, path, full, size, shared]()
+    {
+        std::exception_ptr error;
+        try { ensurePut(ep, path, *shared); }
+        catch (...) { error = std::current_exception(); }
+        shared->clear();
+        finish(full, size, error);
+    });
+}
+
+void Uploader::finish(
+    const std::string& full,
+    const uint64_t size,
+    const std::exception_ptr error)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (error && !m_error) m_error = error;
+        if (!--m_pending[full]) m_pending.erase(full);
+        m_bytes -= size;
+    }
+    metrics::add(metrics::Gauge::UploadQueue, -1);
+    metrics::add(metrics::Memory::Serialized, -int64_t(size));
+    m_cv.notify_all();
+}
+
+void Uploader::wait(const arbiter::Endpoint& ep, const std::string& path)
+{
+    const std::string full(arbiter::join(ep.prefixedRoot(), path));
+    const auto matches([this, &full]()
+    {
+        for (
+            auto it(m_pending.lower_bound(full));
+            it != m_pending.end() && !it->first.compare(0, full.size(), full);
+            ++it)
+        {
+            const std::string& k(it->first);
+            if (k.size() == full.size() || k[full.size()] == '.') return true;
+        }
+        return false;
+    });
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&]() { return m_error || !matches(); });
+    check();
+}
+
+void Uploader::await()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return !m_bytes && m_pending.empty(); });
+    check();
+}
+
+void Uploader::join()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return !m_bytes && m_pending.empty(); });
+    }
+    m_pool.join();
+    m_ring.reset();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    check();
+}
+
+void Uploader::check() const
+{
+    if (m_error) std::rethrow_exception(m_error);
+}
+
+} // namespace entwine
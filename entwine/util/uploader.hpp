@@ -0,0 +1,84 @@
+/******************************************************************************
+* Copyright (c) 2020, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/pool.hpp>
+#include <entwine/util/ring.hpp>
+
+namespace entwine
+{
+
+// Performs puts on dedicated threads, so that the threads producing the data
+// need not wait on network latency and retries.  At most threads puts are in
+// flight at once, and while the data pending upload exceeds maxBytes, further
+// puts block until some of it has been written.
+//
+// If given a ring, puts to local endpoints are instead queued to it, so that
+// they are written asynchronously in batches rather than by our threads.
+class Uploader
+{
+public:
+    Uploader(
+        uint64_t threads,
+        uint64_t maxBytes,
+        std::unique_ptr<Ring> ring = std::unique_ptr<Ring>());
+
+    // Waits for pending uploads, discarding any errors.  Call join to observe
+    // errors.
+    ~Uploader();
+
+    // Enqueue a put of this data.  Throws if a previous put has failed.
+    void put(
+        const arbiter::Endpoint& ep,
+        const std::string& path,
+        std::vector<char> data);
+
+    // Wait until no put is pending to this path, or to this path with any
+    // extension, so that it may be read back.
+    void wait(const arbiter::Endpoint& ep, const std::string& path);
+
+    // Wait for all pending puts, throwing if any of them has failed.  As
+    // opposed to join, puts may be enqueued again afterward.
+    void await();
+
+    // Wait for all pending puts and stop our threads, throwing if any of the
+    // puts has failed.
+    void join();
+
+private:
+    void check() const;
+
+    // Release a completed put of this size to this full path.
+    void finish(const std::string& full, uint64_t size, std::exception_ptr e);
+
+    const uint64_t m_maxBytes;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::map<std::string, uint64_t> m_pending;
+    uint64_t m_bytes = 0;
+    std::exception_ptr m_error;
+
+    Pool m_pool;
+    std::unique_ptr<Ring> m_ring;
+};
+
+} // namespace entwine
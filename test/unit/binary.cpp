@@ -0,0 +1,125 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <entwine/io/binary.hpp>
+#include <entwine/types/metadata.hpp>
+
+using namespace entwine;
+
+namespace
+{
+    const double scale(0.001);
+    const double offset(100);
+
+    // A cube of 1024 units of width, with a span of 128, so each voxel of the
+    // root node is 8 wide.
+    Metadata makeMetadata(const uint64_t lossyDepth)
+    {
+        Schema schema;
+        for (const std::string name : { "X", "Y", "Z" })
+        {
+            Dimension d(name, DimType::Signed32);
+            d.scale = scale;
+            d.offset = offset;
+            schema.push_back(d);
+        }
+
+        const Bounds bounds(Point(0, 0, 0), Point(1024, 1024, 1024));
+
+        BuildParameters params;
+        params.lossyDepth = lossyDepth;
+
+        return Metadata(
+            Version(1, 1),
+            schema,
+            bounds,
+            bounds,
+            optional<Srs>(),
+            optional<Subset>(),
+            io::Type::Binary,
+            128,
+            params);
+    }
+
+    // Pack a point at these coordinates into a node with these bounds.
+    std::vector<char> pack(
+        const Metadata& m,
+        const Bounds& bounds,
+        const Point& p)
+    {
+        // Our schema plan unpacks exact integers into the absolute layout.
+        const CopyPlan& plain(m.layouts->plan());
+        std::vector<char> exact(plain.packedPointSize());
+        for (std::size_t i(0); i < 3; ++i)
+        {
+            const int32_t v(std::llround((p[i] - offset) / scale));
+            std::memcpy(exact.data() + i * 4, &v, 4);
+        }
+        std::vector<char> absolute(plain.absolutePointSize());
+        plain.unpack(exact.data(), absolute.data());
+
+        const CopyPlan plan(io::binary::getPackedPlan(m, bounds));
+        std::vector<char> packed(plan.packedPointSize());
+        plan.pack(absolute.data(), packed.data());
+        return packed;
+    }
+
+    int32_t getUnits(const std::vector<char>& packed, const std::size_t i)
+    {
+        int32_t v;
+        std::memcpy(&v, packed.data() + i * 4, 4);
+        return v;
+    }
+}
+
+TEST(binary, lossyNodesUseSchemaScale)
+{
+    const Metadata m(makeMetadata(6));
+    const Point p(123.4567, 512.0011, 1000.9999);
+
+    // The root is lossy, and remains readable with the scale and offset of
+    // our schema, as for any EPT reader.
+    const Schema schema(io::binary::getPackedSchema(m, m.bounds));
+    EXPECT_EQ(find(schema, "X").scale, scale);
+    EXPECT_EQ(find(schema, "X").offset, offset);
+
+    // Its voxels are 8 wide, so its step is at most 8 / 1024, which is 4
+    // units of our scale.
+    const std::vector<char> packed(pack(m, m.bounds, p));
+    for (std::size_t i(0); i < 3; ++i)
+    {
+        const int32_t units(getUnits(packed, i));
+        EXPECT_EQ(units % 4, 0);
+        EXPECT_NEAR(units * scale + offset, p[i], 3 * scale);
+    }
+}
+
+TEST(binary, deepNodesAreExact)
+{
+    const Metadata m(makeMetadata(6));
+    const Point p(123.457, 512.001, 1000.999);
+
+    // A node at depth 6 is not lossy.
+    const Bounds bounds(Point(0, 0, 0), Point(16, 16, 16));
+    const std::vector<char> packed(pack(m, bounds, p));
+    for (std::size_t i(0); i < 3; ++i)
+    {
+        EXPECT_EQ(getUnits(packed, i), std::llround((p[i] - offset) / scale));
+    }
+}
+
+TEST(binary, unlossyByDefault)
+{
+    const Metadata m(makeMetadata(0));
+    const Point p(123.457, 512.001, 1000.999);
+
+    const std::vector<char> packed(pack(m, m.bounds, p));
+    for (std::size_t i(0); i < 3; ++i)
+    {
+        EXPECT_EQ(getUnits(packed, i), std::llround((p[i] - offset) / scale));
+    }
+}
@@ -0,0 +1,61 @@
+#include "gtest/gtest.h"
+#include "config.hpp"
+
+#include <cstdlib>
+#include <string>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/json.hpp>
+
+using namespace entwine;
+
+namespace
+{
+    const arbiter::Arbiter a;
+
+    int build(const std::string& out, const std::string& flags)
+    {
+        const std::string command(
+            test::binaryPath() + "entwine build -i " +
+            test::dataPath() + "ellipsoid.laz -o " + out + " " + flags +
+            " > /dev/null");
+        return std::system(command.c_str());
+    }
+
+    // Every node of each hierarchy file, and those of the files it refers
+    // to, must exist in our data.
+    void checkNodes(const std::string& out, const std::string& root)
+    {
+        const std::string path(out + "ept-hierarchy/" + root + ".json");
+        const json h(json::parse(a.get(path)));
+        for (const auto& node : h.items())
+        {
+            const int64_t count(node.value().get<int64_t>());
+            if (count == -1 && node.key() != root) checkNodes(out, node.key());
+            else if (count > 0)
+            {
+                const std::string data(out + "ept-data/" + node.key());
+                EXPECT_TRUE(a.tryGetSize(data + ".laz")) <<
+                    "Missing node " << node.key();
+            }
+        }
+    }
+}
+
+TEST(clean, forcedRebuildKeepsNodes)
+{
+    const std::string out(test::dataPath() + "out/clean/");
+
+    ASSERT_EQ(build(out, "--force"), 0);
+
+    // Files which no build writes are stale.
+    const std::string stale(out + "ept-data/30-0-0-0.laz");
+    a.put(stale, "stale");
+    ASSERT_TRUE(a.tryGetSize(stale));
+
+    ASSERT_EQ(build(out, "--force --clean"), 0);
+
+    EXPECT_FALSE(a.tryGetSize(stale));
+    EXPECT_TRUE(a.tryGetSize(out + "ept.json"));
+    checkNodes(out, "0-0-0-0");
+}
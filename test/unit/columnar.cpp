@@ -0,0 +1,140 @@
+#include "gtest/gtest.h"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <entwine/io/columnar.hpp>
+
+using namespace entwine;
+using namespace entwine::io;
+
+namespace
+{
+    template <typename T>
+    std::vector<char> pack(const std::vector<T>& values)
+    {
+        std::vector<char> data(values.size() * sizeof(T));
+        if (!values.empty())
+        {
+            std::memcpy(data.data(), values.data(), data.size());
+        }
+        return data;
+    }
+
+    // Values which exercise wrapping differences and long runs, along with
+    // some which change at every point.
+    template <typename T>
+    std::vector<T> makeValues()
+    {
+        const T lo(std::numeric_limits<T>::lowest());
+        const T hi(std::numeric_limits<T>::max());
+
+        std::vector<T> values { 0, hi, lo, hi, 1, 1, 1, 1, 0 };
+        for (int i(0); i < 100; ++i) values.push_back(static_cast<T>(i * 37));
+        values.insert(values.end(), 50, static_cast<T>(7));
+        return values;
+    }
+
+    void roundTrip(
+        const std::vector<char>& values,
+        const columnar::Encoding encoding,
+        const uint8_t size)
+    {
+        const uint64_t points(values.size() / size);
+        const std::vector<char> encoded(
+            columnar::encode(values, encoding, size));
+        EXPECT_EQ(columnar::decode(encoded, encoding, size, points), values);
+    }
+
+    template <typename T>
+    void roundTrip(const columnar::Encoding encoding)
+    {
+        roundTrip(pack(makeValues<T>()), encoding, sizeof(T));
+        roundTrip(pack(std::vector<T>()), encoding, sizeof(T));
+    }
+}
+
+TEST(columnar, raw)
+{
+    roundTrip<uint8_t>(columnar::Encoding::Raw);
+    roundTrip<int32_t>(columnar::Encoding::Raw);
+    roundTrip<double>(columnar::Encoding::Raw);
+}
+
+TEST(columnar, delta)
+{
+    roundTrip<uint8_t>(columnar::Encoding::Delta);
+    roundTrip<int16_t>(columnar::Encoding::Delta);
+    roundTrip<int32_t>(columnar::Encoding::Delta);
+    roundTrip<uint32_t>(columnar::Encoding::Delta);
+    roundTrip<int64_t>(columnar::Encoding::Delta);
+
+    // Small differences of either sign stay small.
+    const std::vector<int32_t> values { 1000, 999, 1001, 1000 };
+    const std::vector<char> encoded(
+        columnar::encode(pack(values), columnar::Encoding::Delta, 4));
+    uint32_t z(0);
+    std::memcpy(&z, encoded.data() + 4, sizeof(z));
+    EXPECT_EQ(z, 1u);
+    std::memcpy(&z, encoded.data() + 8, sizeof(z));
+    EXPECT_EQ(z, 4u);
+}
+
+TEST(columnar, runLength)
+{
+    roundTrip<uint8_t>(columnar::Encoding::RunLength);
+    roundTrip<uint16_t>(columnar::Encoding::RunLength);
+    roundTrip<int64_t>(columnar::Encoding::RunLength);
+
+    // Each run is a value and a uint32 count.
+    const std::vector<uint8_t> values(1000, 2);
+    EXPECT_EQ(
+        columnar::encode(pack(values), columnar::Encoding::RunLength, 1)
+            .size(),
+        5u);
+}
+
+TEST(columnar, runLengthRejectsExcessPoints)
+{
+    const std::vector<uint8_t> values(10, 2);
+    const std::vector<char> encoded(
+        columnar::encode(pack(values), columnar::Encoding::RunLength, 1));
+    EXPECT_ANY_THROW(
+        columnar::decode(encoded, columnar::Encoding::RunLength, 1, 9));
+}
+
+TEST(columnar, bitPack)
+{
+    // Every width from zero to eight bits.
+    for (unsigned bits(0); bits <= 8; ++bits)
+    {
+        std::vector<uint8_t> values;
+        const unsigned most(bits ? (1u << bits) - 1 : 0);
+        for (unsigned i(0); i < 77; ++i) values.push_back(i % (most + 1));
+        values.push_back(most);
+
+        const std::vector<char> encoded(
+            columnar::encode(pack(values), columnar::Encoding::BitPack, 1));
+        EXPECT_EQ(static_cast<unsigned>(encoded.at(0)), bits);
+        EXPECT_EQ(encoded.size(), 1 + (values.size() * bits + 7) / 8);
+        EXPECT_EQ(
+            columnar::decode(
+                encoded,
+                columnar::Encoding::BitPack,
+                1,
+                values.size()),
+            pack(values));
+    }
+}
+
+TEST(columnar, bitPackRejectsTruncation)
+{
+    const std::vector<uint8_t> values(64, 5);
+    std::vector<char> encoded(
+        columnar::encode(pack(values), columnar::Encoding::BitPack, 1));
+    encoded.pop_back();
+    EXPECT_ANY_THROW(
+        columnar::decode(encoded, columnar::Encoding::BitPack, 1, 64));
+}
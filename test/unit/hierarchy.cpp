@@ -0,0 +1,132 @@
+#include "gtest/gtest.h"
+#include "config.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/defs.hpp>
+
+using namespace entwine;
+
+namespace
+{
+    // A connected tree, reaching coordinates beyond 32 bits, with siblings
+    // at the shallow depths.
+    Hierarchy makeHierarchy()
+    {
+        Hierarchy h;
+        for (uint64_t d(0); d <= 48; ++d)
+        {
+            const uint64_t last((1ull << d) - 1);
+            h.set(Dxyz(d, last, last, last), 100 - d);
+            if (d) h.set(Dxyz(d, last - 1, last, last), d);
+        }
+        return h;
+    }
+
+    void expectEqual(const Hierarchy& a, const Hierarchy& b)
+    {
+        EXPECT_EQ(a.size(), b.size());
+        a.forEach([&b](const Dxyz& key, int64_t count)
+        {
+            EXPECT_EQ(b.get(key), count) << key.toString();
+        });
+    }
+}
+
+TEST(hierarchy, shallowKeys)
+{
+    Hierarchy h;
+    h.set(Dxyz(1, 1, 0, 1), 10);
+    h.set(Dxyz(2, 3, 2, 1), 20);
+
+    EXPECT_EQ(h.get(Dxyz(1, 1, 0, 1)), 10);
+    EXPECT_EQ(h.get(Dxyz(2, 3, 2, 1)), 20);
+    EXPECT_EQ(h.get(Dxyz(2, 3, 2, 0)), 0);
+    EXPECT_TRUE(h.has(Dxyz(1, 1, 0, 1)));
+    EXPECT_FALSE(h.has(Dxyz(1, 0, 0, 0)));
+}
+
+TEST(hierarchy, keysBeyond32Bits)
+{
+    // Keys deeper than 32 have coordinates which do not fit in 32 bits, and
+    // must not collide with those sharing their low bits.
+    const uint64_t high(1ull << 40);
+    const Dxyz deep(48, high + 5, high + 6, 7);
+    const Dxyz aliased(48, 5, 6, 7);
+
+    Hierarchy h;
+    h.set(deep, 1);
+    h.set(aliased, 2);
+
+    EXPECT_EQ(h.get(deep), 1);
+    EXPECT_EQ(h.get(aliased), 2);
+
+    bool found(false);
+    h.forEach([&](const Dxyz& key, int64_t count)
+    {
+        if (key == deep)
+        {
+            found = true;
+            EXPECT_EQ(count, 1);
+        }
+    });
+    EXPECT_TRUE(found);
+}
+
+TEST(hierarchy, maxDepth)
+{
+    const uint64_t last(~0ull);
+    const Dxyz deepest(maxDepth, last, last - 1, last - 2);
+
+    Hierarchy h;
+    h.set(deepest, 3);
+    EXPECT_EQ(h.get(deepest), 3);
+    EXPECT_TRUE(h.has(deepest));
+
+    EXPECT_ANY_THROW(h.set(Dxyz(maxDepth + 1, 0, 0, 0), 1));
+}
+
+TEST(hierarchy, binaryRoundTrip)
+{
+    const Hierarchy h(makeHierarchy());
+    expectEqual(h, Hierarchy::fromBinary(h.toBinary()));
+    expectEqual(Hierarchy(), Hierarchy::fromBinary(Hierarchy().toBinary()));
+}
+
+TEST(hierarchy, binaryRejectsCorruption)
+{
+    const std::vector<char> data(makeHierarchy().toBinary());
+
+    const std::vector<char> truncated(data.begin(), data.end() - 1);
+    EXPECT_ANY_THROW(Hierarchy::fromBinary(truncated));
+
+    const std::vector<char> header(data.begin(), data.begin() + 3);
+    EXPECT_ANY_THROW(Hierarchy::fromBinary(header));
+
+    std::vector<char> magic(data);
+    magic[0] = 'X';
+    EXPECT_ANY_THROW(Hierarchy::fromBinary(magic));
+}
+
+TEST(hierarchy, loadFallsBackToJson)
+{
+    const std::string out(test::dataPath() + "out/hierarchy/");
+    arbiter::mkdirp(out);
+
+    const arbiter::Arbiter a;
+    const arbiter::Endpoint ep(a.getEndpoint(out));
+
+    const Hierarchy h(makeHierarchy());
+    hierarchy::save(h, ep, 0, 2);
+    expectEqual(h, hierarchy::load(ep, 2));
+
+    // With the binary copy truncated, the JSON files are read instead.
+    std::vector<char> data(h.toBinary());
+    data.resize(data.size() / 2);
+    ep.put("hierarchy.bin", data);
+    expectEqual(h, hierarchy::load(ep, 2));
+}
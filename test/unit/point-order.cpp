@@ -0,0 +1,103 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include <entwine/types/point-order.hpp>
+
+using namespace entwine;
+
+namespace
+{
+    // The expected order, from a stable sort of the indices by key.
+    std::vector<uint32_t> stableOrder(const std::vector<uint64_t>& keys)
+    {
+        std::vector<uint32_t> order(keys.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(
+            order.begin(),
+            order.end(),
+            [&keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+        return order;
+    }
+}
+
+TEST(pointOrder, radixSortTrivial)
+{
+    EXPECT_TRUE(radixSort({ }).empty());
+    EXPECT_EQ(radixSort({ 42 }), std::vector<uint32_t>({ 0 }));
+
+    // Keys identical in every byte are left in place.
+    EXPECT_EQ(radixSort({ 7, 7, 7 }), std::vector<uint32_t>({ 0, 1, 2 }));
+}
+
+TEST(pointOrder, radixSortRandom)
+{
+    std::mt19937_64 gen(12345);
+    std::vector<uint64_t> keys(5000);
+    for (uint64_t& k : keys) k = gen();
+
+    EXPECT_EQ(radixSort(keys), stableOrder(keys));
+}
+
+TEST(pointOrder, radixSortSharedBytes)
+{
+    // As for Morton codes within a node, the high bytes of every key match,
+    // and only some of the low bytes vary.
+    std::mt19937_64 gen(678);
+    std::vector<uint64_t> keys(3000);
+    for (uint64_t& k : keys)
+    {
+        k = 0xabcdef0000000000ull | (gen() & 0xff00ff);
+    }
+
+    EXPECT_EQ(radixSort(keys), stableOrder(keys));
+}
+
+TEST(pointOrder, radixSortStable)
+{
+    // Equal keys keep their original order.
+    std::vector<uint64_t> keys;
+    for (int i(0); i < 1000; ++i) keys.push_back((i * 7919) % 10);
+
+    const std::vector<uint32_t> order(radixSort(keys));
+    EXPECT_EQ(order, stableOrder(keys));
+    for (std::size_t i(1); i < order.size(); ++i)
+    {
+        if (keys[order[i]] == keys[order[i - 1]])
+        {
+            EXPECT_LT(order[i - 1], order[i]);
+        }
+    }
+}
+
+TEST(pointOrder, mortonCode)
+{
+    const Bounds cube(Point(0, 0, 0), Point(8, 8, 8));
+
+    EXPECT_EQ(getMortonCode(cube, Point(0, 0, 0)), 0u);
+
+    // The maximum corner, and those beyond it, are clamped to the last cell.
+    const uint64_t last((1ull << 63) - 1);
+    EXPECT_EQ(getMortonCode(cube, Point(8, 8, 8)), last);
+    EXPECT_EQ(getMortonCode(cube, Point(100, 100, 100)), last);
+    EXPECT_EQ(getMortonCode(cube, Point(-1, -1, -1)), 0u);
+
+    // X occupies the lowest bit of each triple, then Y, then Z, so the top
+    // bits select the octant of the cube.
+    EXPECT_EQ(getMortonCode(cube, Point(4, 0, 0)) >> 60, 1u);
+    EXPECT_EQ(getMortonCode(cube, Point(0, 4, 0)) >> 60, 2u);
+    EXPECT_EQ(getMortonCode(cube, Point(0, 0, 4)) >> 60, 4u);
+
+    // Within an axis, codes increase with the coordinate.
+    uint64_t prev(0);
+    for (int i(1); i < 64; ++i)
+    {
+        const uint64_t code(getMortonCode(cube, Point(i / 8.0, 0, 0)));
+        EXPECT_GT(code, prev);
+        prev = code;
+    }
+}
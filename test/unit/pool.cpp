@@ -0,0 +1,134 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include <entwine/util/pool.hpp>
+
+using namespace entwine;
+
+TEST(pool, runsEveryTask)
+{
+    std::atomic_size_t count(0);
+    {
+        Pool pool(4);
+        std::vector<std::thread> producers;
+        for (std::size_t p(0); p < 8; ++p)
+        {
+            producers.emplace_back([&pool, &count]()
+            {
+                for (std::size_t i(0); i < 10000; ++i)
+                {
+                    pool.add([&count]() { ++count; });
+                }
+            });
+        }
+        for (std::thread& t : producers) t.join();
+        pool.join();
+        EXPECT_TRUE(pool.errors().empty());
+    }
+    EXPECT_EQ(count, 80000u);
+}
+
+TEST(pool, runsEveryBatch)
+{
+    // Batches both smaller and larger than the queue are added at once by
+    // many producers.
+    std::atomic_size_t count(0);
+    {
+        Pool pool(3, 2);
+        std::vector<std::thread> producers;
+        for (std::size_t p(0); p < 6; ++p)
+        {
+            producers.emplace_back([&pool, &count, p]()
+            {
+                for (std::size_t i(0); i < 500; ++i)
+                {
+                    std::vector<Task> batch;
+                    for (std::size_t j(0); j < 1 + (i + p) % 5; ++j)
+                    {
+                        batch.emplace_back([&count]() { ++count; });
+                    }
+                    pool.add(std::move(batch));
+                }
+            });
+        }
+        for (std::thread& t : producers) t.join();
+        pool.await();
+    }
+
+    std::size_t expected(0);
+    for (std::size_t p(0); p < 6; ++p)
+    {
+        for (std::size_t i(0); i < 500; ++i) expected += 1 + (i + p) % 5;
+    }
+    EXPECT_EQ(count, expected);
+}
+
+TEST(pool, appliesBackpressure)
+{
+    Pool pool(1, 1);
+
+    // Occupy our only worker, and then our only queue slot.
+    std::promise<void> release;
+    std::shared_future<void> released(release.get_future());
+    std::promise<void> started;
+    pool.add([&started, released]()
+    {
+        started.set_value();
+        released.wait();
+    });
+    started.get_future().wait();
+    pool.add([]() { });
+
+    std::atomic_bool added(false);
+    std::thread producer([&pool, &added]()
+    {
+        pool.add([]() { });
+        added = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_FALSE(added);
+
+    release.set_value();
+    producer.join();
+    EXPECT_TRUE(added);
+
+    pool.join();
+    EXPECT_TRUE(pool.errors().empty());
+}
+
+TEST(pool, awaitsQueuedTasks)
+{
+    Pool pool(2);
+    std::atomic_size_t count(0);
+    for (std::size_t i(0); i < 1000; ++i)
+    {
+        pool.add([&count]()
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(10));
+            ++count;
+        });
+    }
+    pool.await();
+    EXPECT_EQ(count, 1000u);
+
+    // The pool remains usable after awaiting.
+    pool.add([&count]() { ++count; });
+    pool.join();
+    EXPECT_EQ(count, 1001u);
+}
+
+TEST(pool, collectsErrors)
+{
+    Pool pool(2, 0, false);
+    pool.add([]() { throw std::runtime_error("failed"); });
+    pool.add([]() { });
+    pool.join();
+    ASSERT_EQ(pool.errors().size(), 1u);
+    EXPECT_EQ(pool.errors().front(), "failed");
+}
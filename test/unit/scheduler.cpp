@@ -0,0 +1,117 @@
+#include "gtest/gtest.h"
+#include "config.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <entwine/builder/allotment.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/pool.hpp>
+
+using namespace entwine;
+
+namespace
+{
+    const arbiter::Arbiter a;
+
+    // The number of points of our ellipsoid.
+    const uint64_t ellipsoidPoints(100000);
+
+    // Run a task for a little while, noting the most of them running at once.
+    void occupy(std::atomic_uint64_t& running, std::atomic_uint64_t& most)
+    {
+        const uint64_t now(++running);
+        uint64_t prev(most.load());
+        while (now > prev && !most.compare_exchange_weak(prev, now)) { }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        --running;
+    }
+}
+
+TEST(scheduler, allotmentAdmitsItsShare)
+{
+    Pool pool(8);
+    std::atomic_uint64_t resident(0);
+    Allotment allotment(pool, resident, 0, 2);
+
+    std::atomic_uint64_t running(0);
+    std::atomic_uint64_t most(0);
+    for (int i(0); i < 40; ++i)
+    {
+        allotment.add([&]() { occupy(running, most); });
+    }
+    allotment.await();
+    EXPECT_EQ(running.load(), 0u);
+    EXPECT_LE(most.load(), 2u);
+
+    // Once widened, as when another build finishes, more run at once.
+    allotment.threads(6);
+    most = 0;
+    for (int i(0); i < 60; ++i)
+    {
+        allotment.add([&]() { occupy(running, most); });
+    }
+    allotment.await();
+    EXPECT_LE(most.load(), 6u);
+    EXPECT_GT(most.load(), 2u);
+
+    pool.join();
+}
+
+TEST(scheduler, sharedMemoryBudget)
+{
+    Pool pool(1);
+    std::atomic_uint64_t resident(0);
+    Allotment first(pool, resident, 100, 1);
+    Allotment second(pool, resident, 100, 1);
+
+    // Each build is held to the budget by the memory of both.
+    first.addResident(60);
+    EXPECT_FALSE(second.overBudget());
+    second.addResident(60);
+    EXPECT_TRUE(first.overBudget());
+    EXPECT_TRUE(second.overBudget());
+
+    first.removeResident(60);
+    EXPECT_FALSE(second.overBudget());
+}
+
+TEST(scheduler, twoBuildsTogether)
+{
+    const std::string out(test::dataPath() + "out/scheduler/");
+    const std::vector<std::string> names { "a", "b" };
+    arbiter::mkdirp(out);
+
+    json jobs = json::array();
+    for (const std::string& name : names)
+    {
+        const std::string path(out + name + ".json");
+        const json job {
+            { "input", test::dataPath() + "ellipsoid.laz" },
+            { "output", out + name + "/" },
+            { "force", true }
+        };
+        a.put(path, job.dump());
+        jobs.push_back(path);
+    }
+
+    const std::string command(
+        test::binaryPath() + "entwine build --threads 8 --jobs '" +
+        jobs.dump() + "' > /dev/null");
+    ASSERT_EQ(std::system(command.c_str()), 0);
+
+    for (const std::string& name : names)
+    {
+        const json info(json::parse(a.get(out + name + "/ept.json")));
+        EXPECT_EQ(info.at("points").get<uint64_t>(), ellipsoidPoints) <<
+            "In build " << name;
+        EXPECT_TRUE(a.tryGetSize(out + name + "/ept-hierarchy/0-0-0-0.json"));
+    }
+}